@@ -0,0 +1,86 @@
+#define _POSIX_C_SOURCE 200809L
+// bench/array_bench.c - Growable arrays against a plain malloc'd vector
+//
+// Builds a list of ints by pushing, sums it and frees it, for short lists
+// (which fit the inline storage and never allocate) and long ones (which
+// grow geometrically). Built with NDEBUG, as a release build would be, so
+// indexing is unchecked. Strategies:
+//   vector   malloc/realloc doubling from 4 elements, the usual hand-written C
+//   array    Array on the heap
+//   arena    Array inside an arena that is reset per list
+// Numbers are nanoseconds per list.
+#include "safety.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static long vector_list(int length) {
+    int   *items = NULL;
+    size_t count = 0, capacity = 0;
+    for (int i = 0; i < length; i++) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 4;
+            items = realloc(items, capacity * sizeof(int));
+        }
+        items[count++] = i;
+    }
+    long sum = 0;
+    for (size_t i = 0; i < count; i++)
+        sum += items[i];
+    free(items);
+    return sum;
+}
+
+static long array_list(Array xs, int length) {
+    for (int i = 0; i < length; i++)
+        array_push(xs, int, i);
+    long sum = 0;
+    for (size_t i = 0; i < array_len(xs); i++)
+        sum += array_at(xs, int, i);
+    array_free(&xs);
+    return sum;
+}
+
+static void bench(int length, int lists) {
+    Arena *arena = arena_create((size_t)length * sizeof(int) * 4 + 4096);
+    long   check = 0;
+
+    double start = now_ns();
+    for (int r = 0; r < lists; r++)
+        check += vector_list(length);
+    double vector = (now_ns() - start) / lists;
+
+    start = now_ns();
+    for (int r = 0; r < lists; r++)
+        check += array_list(array_create(sizeof(int)), length);
+    double heap = (now_ns() - start) / lists;
+
+    start = now_ns();
+    for (int r = 0; r < lists; r++) {
+        check += array_list(array_create_arena(arena, sizeof(int)), length);
+        arena_reset(arena);
+    }
+    double in_arena = (now_ns() - start) / lists;
+
+    printf("%6d ints  vector %10.1f  array %10.1f  arena %10.1f  (%ld)\n", length, vector, heap,
+           in_arena, check);
+    arena_destroy(arena);
+}
+
+int main(int argc, char **argv) {
+    int scale = argc > 1 ? atoi(argv[1]) : 1;
+
+    printf("ns per list\n");
+    bench(6, 2000000 * scale);
+    bench(16, 1000000 * scale);
+    bench(1000, 20000 * scale);
+    bench(100000, 200 * scale);
+    return 0;
+}
@@ -0,0 +1,342 @@
+#define _GNU_SOURCE // pipe2
+// bench/async_bench.c - Event loop tasks against a thread per connection
+//
+// The tasks are written the way lower_async_functions lowers them: a frame
+// with the locals and a step function switching on the resume point.
+//   tasks      N tasks alive at once, each with a 1KB buffer, sleeping and
+//              yielding; memory is the peak RSS growth per task
+//   ping-pong  one byte bounced over a pair of pipes, by two tasks on one
+//              loop and by two threads blocking in read
+//   echo       C loopback TCP connections each doing R round trips of 64
+//              bytes, served by tasks on one loop and by a thread each
+// Every case runs in a child process so its RSS starts from scratch.
+#include "event_loop.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PINGS 100000
+#define MESSAGE 64
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static long peak_kb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// =========================== [ TASKS ] ====================================
+
+// async void idle(int id) { char buf[1024]; await async_sleep(10); for (...) await async_yield(); }
+struct idle_frame {
+    AsyncTask task;
+    int       id;
+    char      buf[1024];
+    int       i;
+};
+
+static int idle_step(AsyncTask *task) {
+    struct idle_frame *f = (struct idle_frame *)task;
+    switch (task->state) {
+    case 0:
+        f->buf[0] = (char)f->id;
+        task->state = 1; // fall through
+    case 1:
+        if (async_sleep(task, 10) == ASYNC_PENDING) return ASYNC_SUSPENDED;
+        for (f->i = 0; f->i < 3; f->i++) {
+            task->state = 2; // fall through
+        case 2:
+            if (async_yield(task) == ASYNC_PENDING) return ASYNC_SUSPENDED;
+        }
+    }
+    return ASYNC_DONE;
+}
+
+static void bench_tasks(long count) {
+    long   before = peak_kb();
+    double start = now_ms();
+    for (long i = 0; i < count; i++) {
+        struct idle_frame *f = async_frame_alloc(sizeof(struct idle_frame), idle_step);
+        f->id = (int)i;
+        async_spawn(&f->task);
+    }
+    int    stuck = async_run();
+    double took = now_ms() - start;
+    printf("tasks      %7ld  %8.1f ms  %6.0f bytes/task (frame %zu)%s\n", count, took,
+           (peak_kb() - before) * 1024.0 / count, sizeof(struct idle_frame), stuck ? "  STUCK" : "");
+}
+
+// =========================== [ PING-PONG ] ====================================
+
+// async void bounce(int in, int out, int serve) { char c; for (...) { read; write } }
+struct bounce_frame {
+    AsyncTask task;
+    int       in, out, serve;
+    long      i;
+    char      c;
+};
+
+static int bounce_step(AsyncTask *task) {
+    struct bounce_frame *f = (struct bounce_frame *)task;
+    long                 await;
+    switch (task->state) {
+    case 0:
+        for (f->i = 0; f->i < PINGS; f->i++) {
+            if (!f->serve) {
+                task->state = 1; // fall through
+            case 1:
+                if ((await = async_write(task, f->out, &f->c, 1)) == ASYNC_PENDING) return ASYNC_SUSPENDED;
+            }
+            task->state = 2; // fall through
+        case 2:
+            if ((await = async_read(task, f->in, &f->c, 1)) == ASYNC_PENDING) return ASYNC_SUSPENDED;
+            if (await != 1) return ASYNC_DONE;
+            if (f->serve) {
+                task->state = 3; // fall through
+            case 3:
+                if ((await = async_write(task, f->out, &f->c, 1)) == ASYNC_PENDING) return ASYNC_SUSPENDED;
+            }
+        }
+    }
+    return ASYNC_DONE;
+}
+
+static void *bounce_thread(void *arg) {
+    int *fds = arg; // in, out
+    char c;
+    for (long i = 0; i < PINGS; i++) {
+        if (read(fds[0], &c, 1) != 1 || write(fds[1], &c, 1) != 1) break;
+    }
+    return NULL;
+}
+
+static void bench_ping_pong(int threaded) {
+    int    there[2], back[2];
+    double start;
+    if (threaded) {
+        if (pipe(there) < 0 || pipe(back) < 0) return;
+        int       served[2] = {there[0], back[1]};
+        pthread_t thread;
+        char      c = 'x';
+        start = now_ms();
+        pthread_create(&thread, NULL, bounce_thread, served);
+        for (long i = 0; i < PINGS; i++) {
+            if (write(there[1], &c, 1) != 1 || read(back[0], &c, 1) != 1) break;
+        }
+        pthread_join(thread, NULL);
+    } else {
+        if (async_pipe(there) < 0 || async_pipe(back) < 0) return;
+        struct bounce_frame *client = async_frame_alloc(sizeof(struct bounce_frame), bounce_step);
+        struct bounce_frame *server = async_frame_alloc(sizeof(struct bounce_frame), bounce_step);
+        *client = (struct bounce_frame){client->task, back[0], there[1], 0, 0, 'x'};
+        *server = (struct bounce_frame){server->task, there[0], back[1], 1, 0, 0};
+        start = now_ms();
+        async_spawn(&server->task);
+        async_spawn(&client->task);
+        async_run();
+    }
+    double took = now_ms() - start;
+    printf("ping-pong  %-7s  %8.1f ms  %6.2f us/round trip\n", threaded ? "threads" : "tasks", took,
+           took * 1e3 / PINGS);
+}
+
+// =========================== [ ECHO ] ====================================
+
+static int rounds;
+static int port;
+
+// async void serve(int fd) { char buf[64]; while ((n = await read) > 0) await write_all }
+struct serve_frame {
+    AsyncTask task;
+    int       fd;
+    char      buf[MESSAGE];
+    long      n;
+};
+
+static int serve_step(AsyncTask *task) {
+    struct serve_frame *f = (struct serve_frame *)task;
+    long                await;
+    switch (task->state) {
+    case 0:
+        for (;;) {
+            task->state = 1; // fall through
+        case 1:
+            if ((await = async_read(task, f->fd, f->buf, MESSAGE)) == ASYNC_PENDING) return ASYNC_SUSPENDED;
+            f->n = await;
+            if (f->n <= 0) break;
+            task->state = 2; // fall through
+        case 2:
+            if ((await = async_write_all(task, f->fd, f->buf, f->n)) == ASYNC_PENDING) return ASYNC_SUSPENDED;
+        }
+        close(f->fd);
+    }
+    return ASYNC_DONE;
+}
+
+// async void accept_all(int listener, int count) { for (...) async_spawn(serve(await accept)) }
+struct accept_frame {
+    AsyncTask task;
+    int       listener, count, i;
+};
+
+static int accept_step(AsyncTask *task) {
+    struct accept_frame *f = (struct accept_frame *)task;
+    long                 await;
+    switch (task->state) {
+    case 0:
+        for (f->i = 0; f->i < f->count; f->i++) {
+            task->state = 1; // fall through
+        case 1:
+            if ((await = async_accept(task, f->listener)) == ASYNC_PENDING) return ASYNC_SUSPENDED;
+            if (await < 0) return ASYNC_DONE;
+            struct serve_frame *serve = async_frame_alloc(sizeof(struct serve_frame), serve_step);
+            serve->fd = (int)await;
+            async_spawn(&serve->task);
+        }
+    }
+    return ASYNC_DONE;
+}
+
+// Clients block in their own threads for both servers, so only the serving side differs
+static void *client_thread(void *arg) {
+    long               count = (long)arg;
+    char               out[MESSAGE], in[MESSAGE];
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(0x7f000001);
+
+    int fds[64];
+    for (long c = 0; c < count; c++) {
+        fds[c] = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fds[c], (struct sockaddr *)&addr, sizeof(addr)) < 0) perror("connect");
+    }
+    memset(out, 'x', sizeof(out));
+    for (int r = 0; r < rounds; r++) {
+        for (long c = 0; c < count; c++) {
+            if (write(fds[c], out, MESSAGE) != MESSAGE) return NULL;
+        }
+        for (long c = 0; c < count; c++) {
+            for (long got = 0; got < MESSAGE;) {
+                long n = read(fds[c], in + got, MESSAGE - got);
+                if (n <= 0) return NULL;
+                got += n;
+            }
+        }
+    }
+    for (long c = 0; c < count; c++)
+        close(fds[c]);
+    return NULL;
+}
+
+static void *serve_thread(void *arg) {
+    int  fd = (int)(long)arg;
+    char buf[MESSAGE];
+    long n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        if (write(fd, buf, n) != n) break;
+    }
+    close(fd);
+    return NULL;
+}
+
+static void *accept_thread(void *arg) {
+    int            listener = (int)(long)arg;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64 * 1024);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) break;
+        pthread_t thread;
+        pthread_create(&thread, &attr, serve_thread, (void *)(long)fd);
+    }
+    return NULL;
+}
+
+static void bench_echo(int connections, int threaded) {
+    int listener = async_listen("127.0.0.1", 0, 4096);
+    if (listener < 0) return;
+    port = async_local_port(listener);
+    int       clients = (connections + 63) / 64;
+    pthread_t client_threads[clients];
+    long      before = peak_kb();
+    double    start = now_ms();
+
+    for (int c = 0; c < clients; c++) {
+        long count = connections - c * 64 < 64 ? connections - c * 64 : 64;
+        pthread_create(&client_threads[c], NULL, client_thread, (void *)count);
+    }
+    if (threaded) {
+        // The listener is non-blocking; make the accept loop wait instead
+        fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) & ~O_NONBLOCK);
+        pthread_t acceptor;
+        pthread_create(&acceptor, NULL, accept_thread, (void *)(long)listener);
+        pthread_detach(acceptor);
+        for (int c = 0; c < clients; c++)
+            pthread_join(client_threads[c], NULL);
+    } else {
+        struct accept_frame *acceptor = async_frame_alloc(sizeof(struct accept_frame), accept_step);
+        acceptor->listener = listener;
+        acceptor->count = connections;
+        async_spawn(&acceptor->task);
+        async_run();
+        for (int c = 0; c < clients; c++)
+            pthread_join(client_threads[c], NULL);
+    }
+    double took = now_ms() - start;
+    printf("echo       %-7s  %5d conns  %8.1f ms  %6.0f k round trips/s  %6ld KB peak growth\n",
+           threaded ? "threads" : "tasks", connections, took,
+           (double)connections * rounds / took, peak_kb() - before);
+}
+
+// =========================== [ MAIN ] ====================================
+
+#define IN_CHILD(call)                                                                             \
+    do {                                                                                           \
+        fflush(stdout);                                                                            \
+        pid_t child = fork();                                                                      \
+        if (child == 0) {                                                                          \
+            call;                                                                                  \
+            fflush(stdout);                                                                        \
+            _exit(0);                                                                              \
+        }                                                                                          \
+        if (child > 0) waitpid(child, NULL, 0);                                                    \
+    } while (0)
+
+int main(int argc, char **argv) {
+    long          most = argc > 1 ? atol(argv[1]) : 100000;
+    int           connections = argc > 2 ? atoi(argv[2]) : 1000;
+    struct rlimit files;
+
+    rounds = argc > 3 ? atoi(argv[3]) : 100;
+    // Both ends of every connection are ours
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+        if ((rlim_t)connections * 2 + 64 > files.rlim_cur) connections = (int)(files.rlim_cur - 64) / 2;
+    }
+
+    for (long count = 10000; count <= most; count *= 10)
+        IN_CHILD(bench_tasks(count));
+    IN_CHILD(bench_ping_pong(0));
+    IN_CHILD(bench_ping_pong(1));
+    IN_CHILD(bench_echo(connections, 0));
+    IN_CHILD(bench_echo(connections, 1));
+    return 0;
+}
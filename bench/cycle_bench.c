@@ -0,0 +1,73 @@
+#define _POSIX_C_SOURCE 200809L
+// bench/cycle_bench.c - Pauses of the cycle collector (SAM_RC_CYCLES)
+//
+// A service loop that leaks one garbage ring of refcounted nodes per request,
+// the shape that used to make RSS creep. The releases that fill the root
+// buffer run one budgeted collection step; the worst request shows the pause
+// that adds, next to what a single full collection of the same garbage costs.
+// Numbers are microseconds.
+#include "safety.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define RING_SIZE 16
+
+typedef struct Node *Node;
+struct Node {
+    struct Node *next;
+    char        *name;
+    int          id;
+};
+static const size_t Node__fields[] = {offsetof(struct Node, next), offsetof(struct Node, name)};
+static const RcType Node__type = {"Node", sizeof(struct Node), 2, Node__fields};
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+// One ring whose only outside reference is dropped at the end
+static void leak_ring(void) {
+    Node first = rc_new(Node), prev = first;
+    for (int i = 1; i < RING_SIZE; i++) {
+        Node node = rc_new(Node);
+        node->id = i;
+        node->name = string_create("ring node");
+        prev->next = node;
+        prev = node;
+    }
+    prev->next = first;
+    rc_retain(first);
+    rc_release(first);
+}
+
+int main(int argc, char **argv) {
+    int requests = argc > 1 ? atoi(argv[1]) : 200000;
+
+    double worst = 0, start = now_us();
+    for (int r = 0; r < requests; r++) {
+        double begin = now_us();
+        leak_ring();
+        double took = now_us() - begin;
+        if (took > worst) worst = took;
+    }
+    double total = now_us() - start;
+    size_t left = rc_cycle_roots();
+    double drain_start = now_us();
+    rc_collect_cycles();
+    printf("incremental  %d requests  total %10.0f  worst request %8.1f  (%zu roots left)\n",
+           requests, total, worst, left);
+    printf("             collecting what was left            %8.1f\n", now_us() - drain_start);
+
+    // The same garbage collected in one go
+    for (int r = 0; r < RC_CYCLE_THRESHOLD - 1; r++)
+        leak_ring();
+    double full_start = now_us();
+    size_t freed = rc_collect_cycles();
+    printf("full         %zu objects in one pause            %8.1f\n", freed,
+           now_us() - full_start);
+    return 0;
+}
@@ -0,0 +1,235 @@
+#define _POSIX_C_SOURCE 200809L
+// bench/map_bench.c - Swiss-table map against a chained hash table
+//
+// Both tables hash with the same runtime hash (string_hash32 / its byte form),
+// so the comparison is about layout and probing. Each size is measured as
+// insert N keys, look every key up, then delete every key, with lookups and
+// deletes in a shuffled order so chained nodes are not visited in allocation
+// order. Numbers are millions of operations per second.
+#include "map.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static volatile uint64_t sink;
+
+// =========================== [ CHAINED BASELINE ] ====================================
+// The table every team ends up writing: power-of-two buckets of malloc'd nodes.
+
+typedef struct Node {
+    struct Node *next;
+    uint32_t     hash;
+    uint64_t     key; // Integer key, or a string pointer for string tables
+    uint64_t     value;
+} Node;
+
+typedef struct {
+    Node **buckets;
+    size_t bucket_count;
+    size_t count;
+    int    string_keys;
+} Chained;
+
+static uint32_t chained_hash(Chained *t, uint64_t key) {
+    return t->string_keys ? string_hash32_bytes((const char *)key, strlen((const char *)key))
+                          : string_hash32_bytes((const char *)&key, sizeof(key));
+}
+
+static int chained_eq(Chained *t, uint64_t a, uint64_t b) {
+    return t->string_keys ? strcmp((const char *)a, (const char *)b) == 0 : a == b;
+}
+
+static void chained_grow(Chained *t) {
+    size_t new_count = t->bucket_count ? t->bucket_count * 2 : 16;
+    Node **buckets = calloc(new_count, sizeof(Node *));
+    for (size_t i = 0; i < t->bucket_count; i++) {
+        for (Node *node = t->buckets[i], *next; node; node = next) {
+            next = node->next;
+            Node **head = &buckets[node->hash & (new_count - 1)];
+            node->next = *head;
+            *head = node;
+        }
+    }
+    free(t->buckets);
+    t->buckets = buckets;
+    t->bucket_count = new_count;
+}
+
+static void chained_put(Chained *t, uint64_t key, uint64_t value) {
+    if (t->count >= t->bucket_count) chained_grow(t);
+    uint32_t hash = chained_hash(t, key);
+    Node   **head = &t->buckets[hash & (t->bucket_count - 1)];
+    for (Node *node = *head; node; node = node->next) {
+        if (node->hash == hash && chained_eq(t, node->key, key)) {
+            node->value = value;
+            return;
+        }
+    }
+    Node *node = malloc(sizeof(Node));
+    node->next = *head;
+    node->hash = hash;
+    node->key = key;
+    node->value = value;
+    *head = node;
+    t->count++;
+}
+
+static uint64_t *chained_get(Chained *t, uint64_t key) {
+    if (!t->bucket_count) return NULL;
+    uint32_t hash = chained_hash(t, key);
+    for (Node *node = t->buckets[hash & (t->bucket_count - 1)]; node; node = node->next) {
+        if (node->hash == hash && chained_eq(t, node->key, key)) return &node->value;
+    }
+    return NULL;
+}
+
+static int chained_remove(Chained *t, uint64_t key) {
+    if (!t->bucket_count) return 0;
+    uint32_t hash = chained_hash(t, key);
+    for (Node **link = &t->buckets[hash & (t->bucket_count - 1)]; *link; link = &(*link)->next) {
+        Node *node = *link;
+        if (node->hash == hash && chained_eq(t, node->key, key)) {
+            *link = node->next;
+            free(node);
+            t->count--;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void chained_free(Chained *t) {
+    for (size_t i = 0; i < t->bucket_count; i++) {
+        for (Node *node = t->buckets[i], *next; node; node = next) {
+            next = node->next;
+            free(node);
+        }
+    }
+    free(t->buckets);
+}
+
+// =========================== [ MEASUREMENTS ] ====================================
+
+typedef struct {
+    double insert, lookup, remove; // Mops/s
+} Result;
+
+static double mops(size_t n, double seconds) { return n / seconds / 1e6; }
+
+static Result bench_chained(uint64_t *keys, uint64_t *probes, size_t n, int string_keys) {
+    Chained t = {NULL, 0, 0, string_keys};
+    Result  r;
+
+    double start = now_seconds();
+    for (size_t i = 0; i < n; i++)
+        chained_put(&t, keys[i], i);
+    r.insert = mops(n, now_seconds() - start);
+
+    start = now_seconds();
+    for (size_t i = 0; i < n; i++)
+        sink += *chained_get(&t, probes[i]);
+    r.lookup = mops(n, now_seconds() - start);
+
+    start = now_seconds();
+    for (size_t i = 0; i < n; i++)
+        sink += chained_remove(&t, probes[i]);
+    r.remove = mops(n, now_seconds() - start);
+
+    chained_free(&t);
+    return r;
+}
+
+static Result bench_map(uint64_t *keys, uint64_t *probes, size_t n, int string_keys) {
+    map    m = string_keys ? map_of_strings(uint64_t) : map_of(uint64_t, uint64_t);
+    Result r;
+
+    double start = now_seconds();
+    for (size_t i = 0; i < n; i++) {
+        uint64_t value = i;
+        if (string_keys) {
+            map_put_str(m, (string)keys[i], &value);
+        } else {
+            map_put(m, &keys[i], &value);
+        }
+    }
+    r.insert = mops(n, now_seconds() - start);
+
+    start = now_seconds();
+    for (size_t i = 0; i < n; i++) {
+        void *value = string_keys ? map_get_str(m, (string)probes[i]) : map_get(m, &probes[i]);
+        sink += map_value(value, uint64_t);
+    }
+    r.lookup = mops(n, now_seconds() - start);
+
+    start = now_seconds();
+    for (size_t i = 0; i < n; i++)
+        sink += string_keys ? map_remove_str(m, (string)probes[i]) : map_remove(m, &probes[i]);
+    r.remove = mops(n, now_seconds() - start);
+
+    map_release(m);
+    return r;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void bench_size(size_t n, int string_keys) {
+    uint64_t *keys = malloc(n * sizeof(uint64_t));
+    uint64_t  state = 0x2545F4914F6CDD1DULL;
+    char      text[32];
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t key = next_random(&state);
+        if (string_keys) {
+            snprintf(text, sizeof(text), "key:%016llx", (unsigned long long)key);
+            keys[i] = (uint64_t)(uintptr_t)string_create(text);
+        } else {
+            keys[i] = key;
+        }
+    }
+
+    uint64_t *probes = malloc(n * sizeof(uint64_t));
+    memcpy(probes, keys, n * sizeof(uint64_t));
+    for (size_t i = n - 1; i > 0; i--) {
+        size_t   j = next_random(&state) % (i + 1);
+        uint64_t tmp = probes[i];
+        probes[i] = probes[j];
+        probes[j] = tmp;
+    }
+
+    Result chained = bench_chained(keys, probes, n, string_keys);
+    Result swiss = bench_map(keys, probes, n, string_keys);
+    printf("%-6s %9zu | chained ins %6.2f get %6.2f del %6.2f | map ins %6.2f get %6.2f del "
+           "%6.2f\n",
+           string_keys ? "string" : "u64", n, chained.insert, chained.lookup, chained.remove,
+           swiss.insert, swiss.lookup, swiss.remove);
+
+    if (string_keys) {
+        for (size_t i = 0; i < n; i++)
+            rc_release((string)keys[i]);
+    }
+    free(keys);
+    free(probes);
+}
+
+int main(int argc, char **argv) {
+    size_t max = argc > 1 ? strtoull(argv[1], NULL, 10) : 10 * 1000 * 1000;
+
+    printf("Mops/s; insert, lookup (all hits) and delete of N random keys\n");
+    for (int string_keys = 0; string_keys <= 1; string_keys++) {
+        for (size_t n = 1000; n <= max; n *= 10)
+            bench_size(n, string_keys);
+    }
+    return 0;
+}
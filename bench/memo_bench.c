@@ -0,0 +1,162 @@
+#define _POSIX_C_SOURCE 200809L
+// bench/memo_bench.c - Cost of the caches behind `memo` functions
+//
+// fib and a two-argument grid walk are written the way the transpiler lowers
+// them, next to the plain recursive versions. Then the per-call cost of each
+// cache path: a direct-table hit, a hashed hit (the table a quarter full),
+// and a hashed miss that stores and evicts (keys cycling through twice the
+// capacity). Built once per counting mode; under SAM_RC_ATOMIC the hashed
+// sets take their spinlock and the last rows repeat the hits from several
+// threads on one shared cache.
+#include "memo_cache.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CALLS 10000000L
+
+static volatile long sink; // Keeps the lookups
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+// =========================== [ FUNCTIONS ] ====================================
+
+static long plain_fib(int n) { return n <= 1 ? n : plain_fib(n - 1) + plain_fib(n - 2); }
+
+static MemoCache __memo_fib = MEMO_CACHE("fib", sizeof(int), sizeof(long), 4096, 4096);
+static long      __memo_fib_compute(int n);
+
+static long fib(int n) {
+    long          __value;
+    long          __slot = memo_slot(n, 4096);
+    unsigned char __key[sizeof(int)];
+    memcpy(__key, &n, sizeof(int));
+    if (memo_lookup(&__memo_fib, __slot, __key, &__value)) return __value;
+    __value = __memo_fib_compute(n);
+    memo_store(&__memo_fib, __slot, __key, &__value);
+    return __value;
+}
+
+static long __memo_fib_compute(int n) { return n <= 1 ? n : fib(n - 1) + fib(n - 2); }
+
+static double plain_grid(int x, int y) {
+    return x == 0 || y == 0 ? 1 : plain_grid(x - 1, y) + plain_grid(x, y - 1);
+}
+
+static MemoCache __memo_grid = MEMO_CACHE("grid", sizeof(int) + sizeof(int), sizeof(double), 0, 4096);
+static double    __memo_grid_compute(int x, int y);
+
+static double grid(int x, int y) {
+    double        __value;
+    long          __slot = -1;
+    unsigned char __key[sizeof(int) + sizeof(int)];
+    memcpy(__key, &x, sizeof(int));
+    memcpy(__key + sizeof(int), &y, sizeof(int));
+    if (memo_lookup(&__memo_grid, __slot, __key, &__value)) return __value;
+    __value = __memo_grid_compute(x, y);
+    memo_store(&__memo_grid, __slot, __key, &__value);
+    return __value;
+}
+
+static double __memo_grid_compute(int x, int y) {
+    return x == 0 || y == 0 ? 1 : grid(x - 1, y) + grid(x, y - 1);
+}
+
+// =========================== [ CACHE PATHS ] ====================================
+
+static MemoCache direct_cache = MEMO_CACHE("direct", sizeof(int), sizeof(long), 1024, 0);
+static MemoCache hashed_cache = MEMO_CACHE("hashed", 2 * sizeof(int), sizeof(long), 0, 4096);
+static MemoCache evict_cache = MEMO_CACHE("evicting", 2 * sizeof(int), sizeof(long), 0, 1024);
+
+static void warm(void) {
+    for (int i = 0; i < 1024; i++) {
+        long value = i;
+        int  key[2] = {i, -i};
+        memo_store(&direct_cache, i, &i, &value);
+        memo_store(&hashed_cache, -1, key, &value);
+    }
+}
+
+// ns per lookup; evicting stores a value after every miss
+static double run_path(MemoCache *cache, int direct, int evicting, long calls) {
+    long   sum = 0;
+    double start = now_ms();
+    for (long c = 0; c < calls; c++) {
+        int  i = (int)(c & (evicting ? 2047 : 1023));
+        int  key[2] = {i, -i};
+        long value = 0;
+        if (!memo_lookup(cache, direct ? i : -1, direct ? (void *)&i : (void *)key, &value) && evicting)
+            memo_store(cache, -1, key, &value);
+        sum += value;
+    }
+    sink += sum;
+    return (now_ms() - start) * 1e6 / calls;
+}
+
+typedef struct {
+    MemoCache *cache;
+    int        direct;
+    long       calls;
+} Worker;
+
+static void *worker(void *arg) {
+    Worker *w = arg;
+    run_path(w->cache, w->direct, 0, w->calls);
+    return NULL;
+}
+
+// Total ns per lookup with threads sharing the cache
+static double run_shared(MemoCache *cache, int direct, int threads) {
+    pthread_t ids[16];
+    Worker    w = {cache, direct, CALLS / threads};
+    double    start = now_ms();
+    for (int t = 0; t < threads; t++)
+        pthread_create(&ids[t], NULL, worker, &w);
+    for (int t = 0; t < threads; t++)
+        pthread_join(ids[t], NULL);
+    return (now_ms() - start) * 1e6 / CALLS;
+}
+
+int main(void) {
+#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)
+    printf("memo caches, shared between threads\n");
+#else
+    printf("memo caches, single-threaded\n");
+#endif
+    double start = now_ms();
+    long   slow = plain_fib(32);
+    double plain_ms = now_ms() - start;
+    start = now_ms();
+    long   fast = fib(32);
+    printf("  fib(32)         %9.2f ms plain, %7.4f ms memo (%s)\n", plain_ms, now_ms() - start,
+           slow == fast ? "same" : "DIFFERENT");
+
+    start = now_ms();
+    double slow_grid = plain_grid(14, 14);
+    plain_ms = now_ms() - start;
+    start = now_ms();
+    double fast_grid = grid(14, 14);
+    printf("  grid(14, 14)    %9.2f ms plain, %7.4f ms memo (%s)\n", plain_ms, now_ms() - start,
+           slow_grid == fast_grid ? "same" : "DIFFERENT");
+
+    warm();
+    printf("  direct hit      %6.2f ns/call\n", run_path(&direct_cache, 1, 0, CALLS));
+    printf("  hashed hit      %6.2f ns/call\n", run_path(&hashed_cache, 0, 0, CALLS));
+    printf("  hashed evicting %6.2f ns/call\n", run_path(&evict_cache, 0, 1, CALLS));
+#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)
+    for (int threads = 2; threads <= 8; threads *= 2) {
+        printf("  %d threads       %6.2f ns/call direct, %6.2f hashed\n", threads,
+               run_shared(&direct_cache, 1, threads), run_shared(&hashed_cache, 0, threads));
+    }
+#else
+    (void)run_shared;
+#endif
+    memo_report(stdout);
+    return 0;
+}
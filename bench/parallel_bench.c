@@ -0,0 +1,106 @@
+#define _POSIX_C_SOURCE 200809L
+// bench/parallel_bench.c - Scaling of `parallel for` on the work-stealing pool
+//
+// Two loops, each timed against the same loop run serially:
+//   balanced    every iteration does the same hashing work
+//   unbalanced  iteration i does work proportional to i, so with static
+//               chunks the last worker gets most of it
+// under both schedules. Every thread count runs in a child process with
+// SAM_THREADS set, since the pool sizes itself once when it starts. Numbers
+// are milliseconds, with the speedup over the serial loop.
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BALANCED_N 2000000
+#define BALANCED_STEPS 64
+#define UNBALANCED_N 40000
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static unsigned long mix(unsigned long x, long steps) {
+    for (long s = 0; s < steps; s++)
+        x = x * 6364136223846793005UL + 1442695040888963407UL;
+    return x;
+}
+
+typedef struct {
+    unsigned long *out;
+    long           scale;
+} Loop;
+
+static void balanced_body(void *context, long begin, long end, struct Arena *scratch) {
+    Loop *loop = context;
+    (void)scratch;
+    for (long i = begin; i < end; i++)
+        loop->out[i] = mix(i, BALANCED_STEPS * loop->scale);
+}
+
+static void unbalanced_body(void *context, long begin, long end, struct Arena *scratch) {
+    Loop *loop = context;
+    (void)scratch;
+    for (long i = begin; i < end; i++)
+        loop->out[i] = mix(i, i / 16 * loop->scale);
+}
+
+static double run(ParallelBody body, long n, Loop *loop, int schedule) {
+    double start = now_ms();
+    if (schedule < 0)
+        body(loop, 0, n, NULL);
+    else
+        parallel_for_range(0, n, 0, schedule, body, loop);
+    return now_ms() - start;
+}
+
+static void bench(int threads, long scale) {
+    unsigned long *out = malloc(sizeof(unsigned long) * BALANCED_N);
+    Loop           loop = {out, scale};
+
+    if (!out) return;
+    parallel_workers(); // Start the pool outside the timings
+    printf("%7d", threads);
+    ParallelBody bodies[] = {balanced_body, unbalanced_body};
+    long         sizes[] = {BALANCED_N, UNBALANCED_N};
+    for (int b = 0; b < 2; b++) {
+        double serial = run(bodies[b], sizes[b], &loop, -1);
+        for (int schedule = PARALLEL_STATIC; schedule <= PARALLEL_DYNAMIC; schedule++) {
+            double took = run(bodies[b], sizes[b], &loop, schedule);
+            printf("  %9.1f (%4.2fx)", took, serial / took);
+        }
+    }
+    printf("\n");
+    free(out);
+}
+
+int main(int argc, char **argv) {
+    long most = argc > 1 ? atol(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    long scale = argc > 2 ? atol(argv[2]) : 1;
+
+    printf("ms (speedup over a serial loop)\n");
+    printf("%7s  %-17s  %-17s  %-17s  %-17s\n", "threads", "balanced static", "dynamic",
+           "unbalanced static", "dynamic");
+    fflush(stdout);
+    // Powers of two, then every CPU
+    for (long threads = 1; threads <= most;
+         threads = threads < most && threads * 2 > most ? most : threads * 2) {
+        pid_t child = fork();
+        if (child == 0) {
+            char count[16];
+            snprintf(count, sizeof(count), "%ld", threads);
+            setenv("SAM_THREADS", count, 1);
+            bench(threads, scale);
+            fflush(stdout);
+            _exit(0);
+        }
+        if (child < 0) return 1;
+        waitpid(child, NULL, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,123 @@
+#define _POSIX_C_SOURCE 200809L
+// bench/pool_bench.c - Request latency with and without release pools
+//
+// Every request builds a tree of refcounted objects (a list node array
+// holding strings) and drops it at the end, the teardown add_refcounting
+// emits at scope exit. Strategies:
+//   immediate   rc_release frees each object on the spot
+//   pool        a release pool per request, drained at the request's end
+//   background  a pool per request whose batch of dead blocks is handed to a
+//               worker thread, so the request only runs the destructors
+// Numbers are microseconds per request: median, 99th percentile and worst.
+#include "safety.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define OBJECTS_PER_REQUEST 20000
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+static void release_string(void *item) { rc_release(item); }
+
+static void run_request(void) {
+    void **items = rc_alloc_array(sizeof(void *), OBJECTS_PER_REQUEST);
+    for (size_t i = 0; i < OBJECTS_PER_REQUEST; i++)
+        items[i] = string_create("payload of a request-scoped string");
+    rc_release_array(items, release_string);
+}
+
+// =========================== [ BACKGROUND FREEING ] ====================================
+
+#define QUEUE_SIZE 64
+
+static ReleaseBatch    queue[QUEUE_SIZE];
+static size_t          queue_head, queue_tail;
+static int             queue_done;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  queue_ready = PTHREAD_COND_INITIALIZER;
+
+static void *free_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&queue_lock);
+    for (;;) {
+        while (queue_head == queue_tail && !queue_done)
+            pthread_cond_wait(&queue_ready, &queue_lock);
+        if (queue_head == queue_tail) break;
+        ReleaseBatch batch = queue[queue_head++ % QUEUE_SIZE];
+        pthread_mutex_unlock(&queue_lock);
+        rc_batch_free(&batch);
+        pthread_mutex_lock(&queue_lock);
+        pthread_cond_signal(&queue_ready);
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return NULL;
+}
+
+static void hand_off(ReleaseBatch batch) {
+    pthread_mutex_lock(&queue_lock);
+    while (queue_tail - queue_head == QUEUE_SIZE)
+        pthread_cond_wait(&queue_ready, &queue_lock);
+    queue[queue_tail++ % QUEUE_SIZE] = batch;
+    pthread_cond_signal(&queue_ready);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+// =========================== [ MEASUREMENTS ] ====================================
+
+typedef enum { IMMEDIATE, POOL, BACKGROUND } Strategy;
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench(Strategy strategy, const char *name, int requests) {
+    double   *latency = malloc(requests * sizeof(double));
+    pthread_t worker;
+    if (strategy == BACKGROUND) {
+        queue_done = 0;
+        pthread_create(&worker, NULL, free_worker, NULL);
+    }
+
+    for (int r = 0; r < requests; r++) {
+        double start = now_us();
+        if (strategy == IMMEDIATE) {
+            run_request();
+        } else {
+            ReleasePool pool = {0};
+            rc_pool_push(&pool);
+            run_request();
+            if (strategy == BACKGROUND) hand_off(rc_pool_collect(&pool));
+            rc_pool_pop(&pool);
+        }
+        latency[r] = now_us() - start;
+    }
+
+    if (strategy == BACKGROUND) {
+        pthread_mutex_lock(&queue_lock);
+        queue_done = 1;
+        pthread_cond_broadcast(&queue_ready);
+        pthread_mutex_unlock(&queue_lock);
+        pthread_join(worker, NULL);
+    }
+    qsort(latency, requests, sizeof(double), compare_doubles);
+    printf("%-10s p50 %8.1f  p99 %8.1f  max %8.1f\n", name, latency[requests / 2],
+           latency[requests * 99 / 100], latency[requests - 1]);
+    free(latency);
+}
+
+int main(int argc, char **argv) {
+    int requests = argc > 1 ? atoi(argv[1]) : 500;
+
+    printf("us per request of %d objects\n", OBJECTS_PER_REQUEST + 1);
+    bench(IMMEDIATE, "immediate", requests);
+    bench(POOL, "pool", requests);
+    bench(BACKGROUND, "background", requests);
+    return 0;
+}
@@ -0,0 +1,123 @@
+#define _POSIX_C_SOURCE 200809L
+// bench/rc_bench.c - Cost of each refcount mode, with and without contention
+//
+// Built three times (see the Makefile): plain counts, SAM_RC_ATOMIC and
+// SAM_RC_BIASED. Every scenario times retain+release pairs, which the compiler
+// cannot fold because the runtime lives in another translation unit:
+//   owned    one thread on an object it allocated
+//   private  every thread on its own object (no sharing, so no cache-line traffic)
+//   shared   every thread on one object allocated by the main thread
+//   handoff  objects allocated on the main thread and released on a worker
+// The plain build is only correct for the first scenario; it runs the
+// threaded ones to show what an unsynchronised count would cost, not as an
+// option. Numbers are nanoseconds per retain+release pair (per release for
+// handoff).
+#include "safety.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(SAM_RC_BIASED)
+#define MODE "biased"
+#elif defined(SAM_RC_ATOMIC)
+#define MODE "atomic"
+#else
+#define MODE "plain"
+#endif
+
+#define MAX_THREADS 16
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct {
+    void  *object; // NULL: allocate a private one
+    size_t pairs;
+} Work;
+
+static void *retain_release(void *arg) {
+    Work *work = arg;
+    void *object = work->object ? work->object : rc_alloc(64);
+    for (size_t i = 0; i < work->pairs; i++) {
+        rc_retain(object);
+        rc_release(object);
+    }
+    if (!work->object) rc_release(object);
+    return NULL;
+}
+
+static double run_threads(int threads, void *shared, size_t pairs) {
+    pthread_t workers[MAX_THREADS];
+    Work      work = {shared, pairs};
+
+    double start = now_seconds();
+    for (int t = 0; t < threads; t++)
+        pthread_create(&workers[t], NULL, retain_release, &work);
+    for (int t = 0; t < threads; t++)
+        pthread_join(workers[t], NULL);
+    return (now_seconds() - start) * 1e9 / ((double)pairs * threads);
+}
+
+typedef struct {
+    void **objects;
+    size_t count;
+} Batch;
+
+static void *release_all(void *arg) {
+    Batch *batch = arg;
+    for (size_t i = 0; i < batch->count; i++)
+        rc_release(batch->objects[i]);
+    return NULL;
+}
+
+// The worker's releases drop the last reference of objects it does not own
+static double run_handoff(size_t count) {
+    Batch     batch = {malloc(count * sizeof(void *)), count};
+    pthread_t worker;
+
+    for (size_t i = 0; i < count; i++)
+        batch.objects[i] = rc_alloc(64);
+    double start = now_seconds();
+    for (size_t i = 0; i < count; i++)
+        rc_retain(batch.objects[i]); // The worker's reference
+    pthread_create(&worker, NULL, release_all, &batch);
+    pthread_join(worker, NULL);
+    for (size_t i = 0; i < count; i++)
+        rc_release(batch.objects[i]); // The owner's reference
+#ifdef SAM_RC_BIASED
+    rc_biased_flush();
+#endif
+    double ns = (now_seconds() - start) * 1e9 / (double)count;
+    free(batch.objects);
+    return ns;
+}
+
+int main(int argc, char **argv) {
+    size_t pairs = argc > 1 ? strtoull(argv[1], NULL, 10) : 20 * 1000 * 1000;
+    int    max_threads = argc > 2 ? atoi(argv[2]) : 4;
+    if (max_threads > MAX_THREADS) max_threads = MAX_THREADS;
+
+    printf("%-6s ns per retain+release pair\n", MODE);
+
+    Work   owned = {rc_alloc(64), pairs};
+    double start = now_seconds();
+    retain_release(&owned);
+    printf("%-6s owned            %6.2f\n", MODE, (now_seconds() - start) * 1e9 / (double)pairs);
+
+    void *shared = rc_alloc(64);
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        double private_ns = run_threads(threads, NULL, pairs / threads);
+        double shared_ns = run_threads(threads, shared, pairs / threads);
+        printf("%-6s %2d threads  private %6.2f  shared %6.2f\n", MODE, threads, private_ns,
+               shared_ns);
+    }
+    rc_release(shared);
+    rc_release(owned.object);
+
+    printf("%-6s handoff          %6.2f\n", MODE, run_handoff(pairs / 20));
+    return 0;
+}
@@ -0,0 +1,101 @@
+#define _POSIX_C_SOURCE 200809L
+// bench/soa_bench.c - An array of structs against its `soa` columns
+//
+// Moves a million particles one step, x += vx * dt, over two layouts:
+//   aos  struct Particle[n]: each step uses 16 of every 56 bytes it loads
+//   soa  the columns lower_soa_arrays allocates: restrict pointers into one
+//        block, each column on a 64-byte boundary, read densely
+// Numbers are nanoseconds per element.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LENGTH 1000000
+#define ROUNDS 50
+#define ALIGN 64
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+struct Particle {
+    double x, y, z;
+    double vx, vy, vz;
+    int    id;
+    float  mass;
+};
+
+// =========================== [ AOS ] ====================================
+
+static double aos_round(double dt) {
+    struct Particle *ps = calloc(LENGTH, sizeof(struct Particle));
+    for (int i = 0; i < LENGTH; i++)
+        ps[i].vx = i * 0.25;
+    double start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < LENGTH; i++)
+            ps[i].x += ps[i].vx * dt;
+    }
+    double ns = (now_ns() - start) / ((double)ROUNDS * LENGTH), check = ps[LENGTH - 1].x;
+    free(ps);
+    printf("  aos  %6.2f ns/element  (x %.1f)\n", ns, check);
+    return check;
+}
+
+// =========================== [ SOA ] ====================================
+
+typedef struct {
+    double *restrict x, *restrict y, *restrict z;
+    double *restrict vx, *restrict vy, *restrict vz;
+    int *restrict    id;
+    float *restrict  mass;
+    size_t           length;
+    void            *base;
+} Particle__soa;
+
+static size_t column_bytes(size_t count, size_t size) { return (count * size + ALIGN - 1) & ~(size_t)(ALIGN - 1); }
+
+static Particle__soa particle_columns(size_t length) {
+    Particle__soa  s = {0};
+    size_t         wide = column_bytes(length, sizeof(double)), narrow = column_bytes(length, sizeof(int));
+    unsigned char *column = s.base = calloc(1, 6 * wide + 2 * narrow + ALIGN);
+    column = (unsigned char *)(((uintptr_t)column + ALIGN - 1) & ~(uintptr_t)(ALIGN - 1));
+    s.x = (void *)column;
+    s.y = (void *)(column += wide);
+    s.z = (void *)(column += wide);
+    s.vx = (void *)(column += wide);
+    s.vy = (void *)(column += wide);
+    s.vz = (void *)(column += wide);
+    s.id = (void *)(column += wide);
+    s.mass = (void *)(column + narrow);
+    s.length = length;
+    return s;
+}
+
+static double soa_round(double dt) {
+    Particle__soa ps = particle_columns(LENGTH);
+    for (int i = 0; i < LENGTH; i++)
+        ps.vx[i] = i * 0.25;
+    double start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < LENGTH; i++)
+            ps.x[i] += ps.vx[i] * dt;
+    }
+    double ns = (now_ns() - start) / ((double)ROUNDS * LENGTH), check = ps.x[LENGTH - 1];
+    free(ps.base);
+    printf("  soa  %6.2f ns/element  (x %.1f)\n", ns, check);
+    return check;
+}
+
+// ==============================================================================
+
+int main(int argc, char **argv) {
+    (void)argv;
+    double dt = argc > 5 ? 0.5 : 0.01; // Not a constant the loops could fold
+    printf("%d particles of %zu bytes: x += vx * dt\n", LENGTH, sizeof(struct Particle));
+    if (aos_round(dt) != soa_round(dt)) printf("  results DIFFER\n");
+    return 0;
+}
@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+// bench/string_bench.c - String kernels against libc memmem/memchr/strcmp
+//
+// For each haystack length the needle sits at the very end, so every
+// implementation scans the whole buffer. Reported numbers are GB/s; utf8 is
+// validation of mixed 1-4 byte text, which takes the non-ASCII path throughout.
+#include "simd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TARGET_BYTES (256u * 1024 * 1024) // Bytes scanned per measurement
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static volatile size_t sink;
+
+static double gbps(double seconds, size_t bytes) { return bytes / seconds / 1e9; }
+
+static void bench_length(size_t len, const SimdKernels **kernels, int kernel_count) {
+    const char *needle = "xyz!";
+    size_t      needle_len = strlen(needle);
+    if (len < needle_len) return; // The needle has to fit at the end
+
+    char *hay = malloc(len + 1);
+    char *other = malloc(len + 1);
+    char *text = malloc(len + 1);
+    if (!hay || !other || !text) {
+        free(hay);
+        free(other);
+        free(text);
+        return;
+    }
+    for (size_t i = 0; i < len; i++)
+        hay[i] = 'a' + (i * 7 + i / 13) % 20;
+    hay[len] = '\0';
+    memcpy(hay + len - needle_len, needle, needle_len);
+    memcpy(other, hay, len + 1);
+    other[len - 1] = '?';
+
+    const char *sample = "h\xC3\xA9llo w\xC3\xB6rld \xE2\x82\xAC \xF0\x9F\x98\x80 ";
+    size_t      sample_len = strlen(sample);
+    for (size_t i = 0; i < len; i++)
+        text[i] = sample[i % sample_len];
+    text[len] = '\0';
+    size_t text_len = len; // End on a code point: the byte after is no continuation
+    while (text_len > 0 && ((unsigned char)sample[text_len % sample_len] & 0xC0) == 0x80)
+        text_len--;
+
+    size_t iterations = TARGET_BYTES / len;
+    if (iterations < 8) iterations = 8;
+    size_t bytes = iterations * len;
+
+    printf("%8zu B |", len);
+
+    double start = now_seconds();
+    for (size_t i = 0; i < iterations; i++)
+        sink += (size_t)memmem(hay, len, needle, needle_len);
+    printf(" memmem %6.2f", gbps(now_seconds() - start, bytes));
+
+    start = now_seconds();
+    for (size_t i = 0; i < iterations; i++)
+        sink += (size_t)memchr(hay, '!', len);
+    printf(" memchr %6.2f", gbps(now_seconds() - start, bytes));
+
+    start = now_seconds();
+    for (size_t i = 0; i < iterations; i++)
+        sink += strcmp(hay, other);
+    printf(" strcmp %6.2f |", gbps(now_seconds() - start, bytes));
+
+    for (int k = 0; k < kernel_count; k++) {
+        const SimdKernels *kern = kernels[k];
+
+        start = now_seconds();
+        for (size_t i = 0; i < iterations; i++)
+            sink += (size_t)kern->find(hay, len, needle, needle_len);
+        double find = gbps(now_seconds() - start, bytes);
+
+        start = now_seconds();
+        for (size_t i = 0; i < iterations; i++)
+            sink += (size_t)kern->find_char(hay, len, '!');
+        double find_char = gbps(now_seconds() - start, bytes);
+
+        start = now_seconds();
+        for (size_t i = 0; i < iterations; i++)
+            sink += kern->cmp(hay, other, len + 1);
+        double cmp = gbps(now_seconds() - start, bytes);
+
+        start = now_seconds();
+        for (size_t i = 0; i < iterations; i++)
+            sink += kern->count_char(hay, len, 'a');
+        double count = gbps(now_seconds() - start, bytes);
+
+        start = now_seconds();
+        for (size_t i = 0; i < iterations; i++)
+            sink += kern->hash(hay, len);
+        double hash = gbps(now_seconds() - start, bytes);
+
+        start = now_seconds();
+        for (size_t i = 0; i < iterations; i++)
+            sink += kern->utf8_validate(text, text_len);
+        double utf8 = gbps(now_seconds() - start, bytes);
+
+        printf(" %s find %6.2f chr %6.2f cmp %6.2f cnt %6.2f hash %6.2f utf8 %6.2f |", kern->name,
+               find, find_char, cmp, count, hash, utf8);
+    }
+    printf("\n");
+
+    free(hay);
+    free(other);
+    free(text);
+}
+
+int main(void) {
+    const SimdKernels *kernels[4];
+    int                kernel_count = 0;
+    kernels[kernel_count++] = &simd_scalar;
+    if (simd_sse2()) kernels[kernel_count++] = simd_sse2();
+    if (simd_avx2()) kernels[kernel_count++] = simd_avx2();
+    if (simd_avx512()) kernels[kernel_count++] = simd_avx512();
+
+    printf("Selected kernels: %s (GB/s, needle at end of haystack)\n", simd_kernels()->name);
+    for (size_t len = 8; len <= 1024 * 1024; len *= 8) {
+        bench_length(len, kernels, kernel_count);
+    }
+    bench_length(1024 * 1024, kernels, kernel_count);
+    return 0;
+}
@@ -8,11 +8,26 @@ mkdir -p bin output
 gcc -Wall -Wextra -std=c99 -Ilib \
     main.c \
     lib/arena.c \
+    lib/arena_pass.c \
+    lib/iterators.c \
+    lib/array.c \
+    lib/soa.c \
+    lib/parallel_for.c \
     lib/semicolon.c \
+    lib/comptime.c \
+    lib/generics.c \
+    lib/struct_layout.c \
+    lib/rc_struct.c \
     lib/string_transform.c \
+    lib/string_builder.c \
+    lib/own_string.c \
+    lib/release_pool.c \
     lib/refcount.c \
-    lib/safety.c \
-    -o bin/main
+    lib/rc_elide.c \
+    lib/async.c \
+    lib/memo.c \
+    lib/common.c \
+    -o bin/main -lm
 
 echo "✓ Transpiler built as bin/main"
 
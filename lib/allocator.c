@@ -0,0 +1,56 @@
+// lib/allocator.c - Region behind the ALLOC_ARENA backend (see allocator.h)
+//
+// The region is a list of arena chunks. A request that does not fit the
+// newest chunk opens another, at least ALLOCATOR_CHUNK_SIZE and big enough
+// for the request, so the region grows without moving what it handed out.
+#include "allocator.h"
+#include "arena.h"
+#include <stdio.h>
+
+static Arena **region_chunks;
+static size_t  region_count, region_capacity;
+static size_t  region_chunk_size = ALLOCATOR_CHUNK_SIZE;
+static int     region_registered; // allocator_cleanup is queued with atexit
+
+void allocator_init(size_t arena_size) {
+    if (arena_size) region_chunk_size = arena_size;
+}
+
+void *allocator_region_alloc(size_t size) {
+    void *ptr = region_count ? arena_try_alloc(region_chunks[region_count - 1], size) : NULL;
+    if (ptr || size == 0) return ptr;
+
+    if (region_count == region_capacity) {
+        size_t  capacity = region_capacity ? region_capacity * 2 : 16;
+        Arena **chunks = realloc(region_chunks, capacity * sizeof(Arena *));
+        if (!chunks) return NULL;
+        region_chunks = chunks;
+        region_capacity = capacity;
+    }
+    size_t needed = (size + 7) & ~(size_t)7;
+    Arena *chunk = arena_create(needed > region_chunk_size ? needed : region_chunk_size);
+    if (!chunk) return NULL;
+    if (!region_registered) region_registered = atexit(allocator_cleanup) == 0;
+    region_chunks[region_count++] = chunk;
+    return arena_try_alloc(chunk, size);
+}
+
+void *allocator_region_grow(void *ptr, size_t old_size, size_t new_size) {
+    if (region_count == 0) return NULL;
+    return arena_try_extend(region_chunks[region_count - 1], ptr, old_size, new_size) ? ptr : NULL;
+}
+
+void allocator_reset(void) {
+    // Keep the first chunk for the allocations that follow
+    while (region_count > 1)
+        arena_destroy(region_chunks[--region_count]);
+    if (region_count) arena_reset(region_chunks[0]);
+}
+
+void allocator_cleanup(void) {
+    while (region_count > 0)
+        arena_destroy(region_chunks[--region_count]);
+    free(region_chunks);
+    region_chunks = NULL;
+    region_capacity = 0;
+}
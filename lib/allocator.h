@@ -1,28 +1,117 @@
 #ifndef ALLOCATOR_H
 #define ALLOCATOR_H
 
+#include "safety.h"
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
-// Allocator interface
+// Allocator interface. The backend is fixed at compile time (main.c defines
+// SAM_ALLOC_ARENA or SAM_ALLOC_MALLOC for --alloc=arena|malloc), so the
+// dispatch below is static inline and folds to a direct call.
+//   ALLOC_REFCOUNT  default: refcounted objects on calloc/free. Under --alloc=rc
+//                   the program's malloc family hands out refcounted blocks
+//                   that free() releases, so rc_retain can share them
+//   ALLOC_STANDARD  refcounted objects as above; malloc and free are plain
+//   ALLOC_ARENA     objects and the program's blocks are carved from one
+//                   growing region with immortal headers. Nothing is freed
+//                   until allocator_reset or exit
+// Only when --alloc= is given, the transpiler routes malloc, calloc, realloc,
+// strdup and free in Sam code here, and then only if every free() and
+// realloc() in the program takes a pointer it saw filled by those calls.
+// Otherwise all of them stay with the C library: a block from the C library
+// must never reach allocator_free or allocator_realloc.
 typedef enum {
     ALLOC_STANDARD, // Use malloc/free
     ALLOC_ARENA,    // Use arena allocator
     ALLOC_REFCOUNT  // Use refcounting (default)
 } AllocatorMode;
 
-// Initialize allocator system
-void allocator_init(AllocatorMode mode, size_t arena_size);
+#if defined(SAM_ALLOC_ARENA)
+#define SAM_ALLOC_MODE ALLOC_ARENA
+#elif defined(SAM_ALLOC_MALLOC)
+#define SAM_ALLOC_MODE ALLOC_STANDARD
+#else
+#define SAM_ALLOC_MODE ALLOC_REFCOUNT
+#endif
 
-// Allocation functions
-void *allocator_alloc(size_t size);
-void *allocator_alloc_array(size_t elem_size, size_t count);
-void  allocator_free(void *ptr);
+#ifndef ALLOCATOR_CHUNK_SIZE
+#define ALLOCATOR_CHUNK_SIZE (1024 * 1024) // Region growth step under ALLOC_ARENA
+#endif
 
-// String allocation
-char *allocator_strdup(const char *str);
+// Region size to start from under ALLOC_ARENA (0 keeps ALLOCATOR_CHUNK_SIZE);
+// optional, and ignored by the other backends
+void allocator_init(size_t arena_size);
+
+// Region backing ALLOC_ARENA: 8-byte aligned, not zeroed, NULL only when
+// malloc fails
+void *allocator_region_alloc(size_t size);
+
+// Extend the region's latest block from old_size to new_size in place; NULL
+// when something was allocated after it or the chunk is full
+void *allocator_region_grow(void *ptr, size_t old_size, size_t new_size);
 
 // Cleanup
-void allocator_cleanup(void);
-void allocator_reset(void);
+void allocator_cleanup(void); // Registered with atexit by the first region allocation
+void allocator_reset(void);   // Drops every region block at once
+
+// Under the refcounting backends a block is a refcounted byte array, whose
+// header remembers the size for realloc
+static inline void *allocator_rc_block(size_t size) {
+    void *ptr = rc_alloc(size);
+    if (ptr) RC_GET_HEADER(ptr)->array_count = size;
+    return ptr;
+}
+
+// Allocation functions
+static inline void *allocator_alloc(size_t size) {
+    if (SAM_ALLOC_MODE == ALLOC_STANDARD) return malloc(size);
+    return allocator_rc_block(size);
+}
+
+static inline void *allocator_alloc_array(size_t elem_size, size_t count) {
+    if (SAM_ALLOC_MODE == ALLOC_STANDARD) return calloc(count, elem_size);
+    if (elem_size && count > SIZE_MAX / elem_size) return NULL;
+    return allocator_rc_block(elem_size * count);
+}
+
+static inline void *allocator_realloc(void *ptr, size_t size) {
+    if (SAM_ALLOC_MODE == ALLOC_STANDARD) return realloc(ptr, size);
+    if (!ptr) return allocator_alloc(size);
+
+    RCHeader *header = RC_GET_HEADER(ptr);
+    if (SAM_ALLOC_MODE == ALLOC_REFCOUNT && rc_is_unique(ptr)) {
+        header = realloc(header, RC_HEADER_SIZE + size);
+        if (!header) return NULL;
+        header->array_count = size;
+        return (char *)header + RC_HEADER_SIZE;
+    }
+    if (SAM_ALLOC_MODE == ALLOC_ARENA &&
+        allocator_region_grow(header, RC_HEADER_SIZE + header->array_count, RC_HEADER_SIZE + size)) {
+        header->array_count = size;
+        return ptr;
+    }
+    // Shared or older region blocks move; the other holders keep the old bytes
+    void *copy = allocator_alloc(size);
+    if (copy) {
+        memcpy(copy, ptr, header->array_count < size ? header->array_count : size);
+        rc_release(ptr);
+    }
+    return copy;
+}
+
+static inline void allocator_free(void *ptr) {
+    if (SAM_ALLOC_MODE == ALLOC_STANDARD) free(ptr);
+    else rc_release(ptr);
+}
+
+// String allocation
+static inline char *allocator_strdup(const char *str) {
+    if (!str) return NULL;
+    size_t len = strlen(str);
+    char  *copy = allocator_alloc(len + 1);
+    if (copy) memcpy(copy, str, len + 1);
+    return copy;
+}
 
 #endif // ALLOCATOR_H
@@ -14,11 +14,14 @@ void   arena_reset(Arena *arena);
 
 // Allocation
 void *arena_alloc(Arena *arena, size_t size);
+void *arena_try_alloc(Arena *arena, size_t size); // NULL without a message when full
 void *arena_alloc_zero(Arena *arena, size_t size);
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+void *arena_try_realloc(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+int   arena_try_extend(Arena *arena, void *ptr, size_t old_size, size_t new_size); // In place only
 
 // String allocation
-char         *arena_strdup(Arena *arena, const char *str);
-void          add_arena_support(FILE *in, FILE *out); // NEW
-static size_t parse_size_spec(const char *spec);
+char *arena_strdup(Arena *arena, const char *str);
+void  add_arena_support(FILE *in, FILE *out); // NEW
 
 #endif // ARENA_H
@@ -0,0 +1,856 @@
+#define _POSIX_C_SOURCE 200809L
+// arena_pass.c - The transpiler passes behind `arena(...)` scopes; the
+// runtime they target is arena.c
+#include "arena.h"
+#include "common.h"
+#include "comptime.h"
+#include "options.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Enhanced arena transformation that handles allocations (`array` declarations
+// are lowered by add_arrays in array.c)
+void fix_arena_transformations(FILE *in, FILE *out) {
+    char line[1024];
+    int  in_arena_declaration = 0;
+    char arena_size[64] = "1024 * 1024"; // Default 1MB
+
+    while (fgets(line, sizeof(line), in)) {
+        // Check for arena declaration with size
+        if (strstr(line, "arena(")) {
+            in_arena_declaration = 1;
+
+            // Extract size specification
+            char *start = strchr(line, '(');
+            char *end = strchr(line, ')');
+            if (start && end) {
+                size_t len = end - start - 1;
+                if (len < sizeof(arena_size) - 1) {
+                    strncpy(arena_size, start + 1, len);
+                    arena_size[len] = '\0';
+
+                    // Remove the arena(size) part
+                    memmove(start, end + 1, strlen(end + 1) + 1);
+                }
+            }
+        }
+
+        // Check for malloc/calloc calls
+        char *malloc_pos = strstr(line, "malloc(");
+        char *calloc_pos = strstr(line, "calloc(");
+        char *rc_alloc_pos = strstr(line, "rc_alloc(");
+
+        if (in_arena_declaration && (malloc_pos || calloc_pos || rc_alloc_pos)) {
+            char *alloc_pos = malloc_pos ? malloc_pos : (calloc_pos ? calloc_pos : rc_alloc_pos);
+
+            if (strstr(line, "__arena")) {
+                // Already using arena, skip
+            } else {
+                // Transform to arena allocation
+                char  new_line[1024];
+                char *func_name = malloc_pos ? "malloc" : (calloc_pos ? "calloc" : "rc_alloc");
+
+                // Find the function call start
+                char *paren = strchr(alloc_pos, '(');
+                if (paren) {
+                    int offset = alloc_pos - line;
+                    strncpy(new_line, line, offset);
+                    new_line[offset] = '\0';
+
+                    // Replace with arena version
+                    if (func_name[0] == 'r') { // rc_alloc
+                        strcat(new_line, "rc_arena_alloc(__arena, ");
+                    } else if (func_name[0] == 'c' && func_name[1] == 'a') { // calloc
+                        // calloc(a, b) -> arena_alloc_zero(__arena, a * b)
+                        strcat(new_line, "arena_alloc_zero(__arena, ");
+                        // Need to handle multiplication of arguments
+                    } else { // malloc
+                        strcat(new_line, "arena_alloc(__arena, ");
+                    }
+
+                    // Copy the rest (skip the function name and opening paren)
+                    strcat(new_line, paren + 1);
+
+                    // Replace the line
+                    strcpy(line, new_line);
+                }
+            }
+        }
+
+        fputs(line, out);
+
+        // Reset arena declaration after semicolon
+        if (strchr(line, ';')) {
+            in_arena_declaration = 0;
+            strcpy(arena_size, "1024 * 1024"); // Reset to default
+        }
+    }
+}
+
+void add_arena_cleanup(FILE *in, FILE *out) {
+    char line[1024];
+    int  brace_depth = 0;
+    int  has_arena = 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        // Check for arena declaration
+        if (strstr(line, "__arena = arena_create")) {
+            has_arena = 1;
+        }
+
+        // Track braces
+        char *ch = line;
+        while (*ch) {
+            if (*ch == '{') {
+                brace_depth++;
+            }
+            if (*ch == '}') {
+                brace_depth--;
+                if (brace_depth == 0 && has_arena) {
+                    // At function end, add arena cleanup
+                    strcat(line, "\n    if (__arena) arena_destroy(__arena);\n");
+                    has_arena = 0;
+                }
+            }
+            ch++;
+        }
+
+        fputs(line, out);
+    }
+}
+
+// The C expression for an arena(...) size: a constant expression with an
+// optional KB/MB/GB unit, folded to bytes by comptime_eval when it can be.
+// Anything else (a runtime variable, say) is computed when the arena is made;
+// an empty size means 1MB.
+static void size_expression(const char *spec, char *out, size_t size) {
+    static const struct {
+        const char *suffix;
+        const char *scale;
+        int         shift;
+    } units[] = {{"KB", "1024", 10}, {"MB", "1024 * 1024", 20}, {"GB", "1024 * 1024 * 1024", 30}};
+    char        expr[128];
+    const char *scale = NULL;
+    int         shift = 0;
+
+    snprintf(expr, sizeof(expr), "%s", spec + strspn(spec, " \t"));
+    size_t len = strlen(expr);
+    while (len > 0 && isspace((unsigned char)expr[len - 1]))
+        expr[--len] = '\0';
+    if (len == 0) {
+        snprintf(out, size, "%d", 1024 * 1024);
+        return;
+    }
+    for (size_t u = 0; u < sizeof(units) / sizeof(units[0]) && len >= 2; u++) {
+        if (strcasecmp(expr + len - 2, units[u].suffix) == 0 &&
+            (len == 2 || !isalpha((unsigned char)expr[len - 3]))) {
+            scale = units[u].scale;
+            shift = units[u].shift;
+            expr[len - 2] = '\0';
+        }
+    }
+    for (len = strlen(expr); len > 0 && isspace((unsigned char)expr[len - 1]);)
+        expr[--len] = '\0';
+
+    ComptimeValue value;
+    if (comptime_eval(expr, &value) && !value.is_float) {
+        snprintf(out, size, "%llu", (unsigned long long)value.i << shift);
+    } else if (scale) {
+        snprintf(out, size, "(size_t)(%s) * %s", expr, scale);
+    } else {
+        snprintf(out, size, "%s", expr);
+    }
+}
+
+// =========================== [ ARENA OBJECTS ] ====================================
+
+// Constructors that get an arena variant inside an arena(...) scope
+static const char *arena_constructors[][2] = {
+    {"string_create", "arena_string_create"},
+    {"string_concat", "arena_string_concat"},
+    {"string_substr", "arena_string_substr"},
+    {"rc_alloc", "rc_arena_alloc"},
+};
+
+static int mentions_identifier(const char *text, const char *name) {
+    size_t len = strlen(name);
+    for (const char *p = strstr(text, name); p; p = strstr(p + 1, name)) {
+        if ((p == text || !is_ident_char(p[-1])) && !is_ident_char(p[len])) return 1;
+    }
+    return 0;
+}
+
+// Names declared after the function's first arena(...): anything else that is
+// assigned (a parameter, an earlier local, a global) outlives the arena
+#define MAX_ARENA_LOCALS 128
+static char arena_locals[MAX_ARENA_LOCALS][64];
+static int  arena_local_count;
+
+static int is_arena_local(const char *name) {
+    for (int i = 0; i < arena_local_count; i++) {
+        if (strcmp(arena_locals[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+// The assignment on line: copies the name it assigns to name and returns the
+// position of its `=`, or NULL when line assigns nothing. *declares is set
+// for `T name = ...`; a field, element or pointer target leaves name empty.
+static char *assignment(char *line, char *name, size_t size, int *declares) {
+    char *equals = line;
+    while ((equals = strchr(equals, '=')) != NULL) {
+        int op = equals > line && strchr("<>!=", equals[-1]) != NULL;
+        if (!op && equals[1] != '=') break;
+        equals += equals[1] == '=' ? 2 : 1;
+    }
+    if (!equals) return NULL;
+
+    const char *end = equals;
+    while (end > line && (isspace((unsigned char)end[-1]) || strchr("+-|&", end[-1])))
+        end--;
+    const char *begin = end;
+    while (begin > line && is_ident_char(begin[-1]))
+        begin--;
+    const char *before = begin;
+    while (before > line && isspace((unsigned char)before[-1]))
+        before--;
+
+    const char *type = before;
+    while (type > line && is_ident_char(type[-1]))
+        type--;
+
+    name[0] = '\0';
+    size_t word = before - type;
+    *declares = word > 0 && !(word == 4 && strncmp(type, "else", 4) == 0) &&
+                !(word == 6 && strncmp(type, "return", 6) == 0);
+    if (before > line && !*declares && !strchr(";{})", before[-1]))
+        return equals; // `p->f = `, `xs[i] = `, `*p = `: a store through something
+    if (begin == end || (size_t)(end - begin) >= size) return equals;
+    memcpy(name, begin, end - begin);
+    name[end - begin] = '\0';
+    return equals;
+}
+
+// Records the name a line in the arena scope declares
+static void note_arena_local(char *line) {
+    char name[64];
+    int  declares;
+    if (assignment(line, name, sizeof(name), &declares) && declares && name[0] &&
+        arena_local_count < MAX_ARENA_LOCALS && !is_arena_local(name))
+        strcpy(arena_locals[arena_local_count++], name);
+}
+
+// Whether the rest of the function returns `name`, stores it through a field,
+// element or pointer, or assigns it to a name declared before the arena, also
+// by way of a local it is copied to: arena_destroy runs at the function's
+// end, so such a value has to stay on the heap. The read position of in is
+// restored.
+static int leaves_function(FILE *in, const char *name, int depth, int aliases) {
+    long pos = ftell(in);
+    char line[1024];
+    int  leaves = 0;
+
+    while (!leaves && depth > 0 && fgets(line, sizeof(line), in)) {
+        char  target[64];
+        int   declares;
+        char *equals = assignment(line, target, sizeof(target), &declares);
+        if (strstr(line, "return") && mentions_identifier(line, name)) leaves = 1;
+        if (equals && mentions_identifier(equals + 1, name) && strcmp(target, name) != 0) {
+            if (!target[0] || (!declares && !is_arena_local(target)))
+                leaves = 1;
+            else if (aliases > 0)
+                leaves = leaves_function(in, target, depth, aliases - 1);
+        }
+        for (char *c = line; *c; c++) {
+            if (*c == '{') depth++;
+            if (*c == '}') depth--;
+        }
+    }
+    fseek(in, pos, SEEK_SET);
+    return leaves;
+}
+
+// Move the constructors on line into arena_var. A value assigned to a name
+// from outside the arena scope, or that leaves_function sees escape, stays on
+// the heap. So do self-appends (`s = string_concat(s, ...)`), which the
+// builder and in-place passes grow without filling the arena with every
+// intermediate string.
+static void use_arena_constructors(char *line, const char *arena_var, FILE *in, int depth) {
+    char name[64], self[64];
+    int  declares;
+    if (sscanf(line, " %63[A-Za-z0-9_] = string_concat ( %63[A-Za-z0-9_]", name, self) == 2 &&
+        strcmp(name, self) == 0)
+        return;
+    if (strstr(line, "return")) return;
+    if (assignment(line, name, sizeof(name), &declares) &&
+        (!name[0] || !is_arena_local(name) || leaves_function(in, name, depth, 4)))
+        return;
+
+    char out[1024];
+    size_t n = 0;
+    for (char *p = line; *p && n < sizeof(out) - 1;) {
+        const char *arena_name = NULL;
+        size_t      len = 0;
+        for (size_t c = 0; c < sizeof(arena_constructors) / sizeof(arena_constructors[0]); c++) {
+            len = strlen(arena_constructors[c][0]);
+            if (strncmp(p, arena_constructors[c][0], len) == 0 && p[len] == '(' &&
+                (p == line || !is_ident_char(p[-1]))) {
+                arena_name = arena_constructors[c][1];
+                break;
+            }
+        }
+        if (!arena_name) {
+            out[n++] = *p++;
+            continue;
+        }
+        int written = snprintf(out + n, sizeof(out) - n, "%s(%s, ", arena_name, arena_var);
+        if (written < 0 || (size_t)written >= sizeof(out) - n) return; // Too long: leave it
+        n += written;
+        p += len + 1;
+    }
+    out[n] = '\0';
+    strcpy(line, out);
+}
+
+// =========================== [ ALLOCATOR ROUTING ] ====================================
+
+// The C allocation calls in Sam code and the allocator.h backend taking them
+static const char *allocator_routes[][2] = {
+    {"malloc", "allocator_alloc"},   {"calloc", "allocator_alloc_array"},
+    {"realloc", "allocator_realloc"}, {"strdup", "allocator_strdup"},
+    {"free", "allocator_free"},
+};
+
+// Routing is all or nothing: a block allocator_alloc hands out must reach
+// allocator_free, and a block from the C library (getline, a library call, a
+// caller) must reach plain free. The calls are routed only when every free()
+// and realloc() takes a pointer expression that holds nothing but what the
+// malloc family returned, wherever in the program it is assigned. Expressions
+// are keyed by name, or by field name for stores through `.` and `->`.
+#define MAX_ALLOC_KEYS 256
+
+typedef struct {
+    char key[64];
+    int  allocated; // Assigned what malloc, calloc, realloc or strdup returned
+    int  foreign;   // Assigned anything else, address taken, or a parameter
+    int  freed;     // Passed to free() or realloc()
+} AllocKey;
+
+static AllocKey alloc_keys[MAX_ALLOC_KEYS];
+static int      alloc_key_count;
+
+// The line with literal contents blanked and the comment dropped
+static void blank_literals(const char *line, char *out, size_t size) {
+    int    in_string = 0, in_char = 0;
+    size_t n = 0;
+    for (const char *p = line; *p && n < size - 1; p++) {
+        if (!in_string && !in_char && p[0] == '/' && p[1] == '/') break;
+        if (*p == '\\' && (in_string || in_char) && p[1]) {
+            out[n++] = ' ';
+            if (n < size - 1) out[n++] = ' ';
+            p++;
+            continue;
+        }
+        int quote = (*p == '"' && !in_char) || (*p == '\'' && !in_string);
+        if (*p == '"' && !in_char) in_string = !in_string;
+        if (*p == '\'' && !in_string) in_char = !in_char;
+        out[n++] = (in_string || in_char) && !quote ? ' ' : *p;
+    }
+    out[n] = '\0';
+}
+
+static AllocKey *alloc_key(const char *key) {
+    for (int i = 0; i < alloc_key_count; i++) {
+        if (strcmp(alloc_keys[i].key, key) == 0) return &alloc_keys[i];
+    }
+    if (alloc_key_count >= MAX_ALLOC_KEYS) return NULL;
+    AllocKey *k = &alloc_keys[alloc_key_count++];
+    snprintf(k->key, sizeof(k->key), "%s", key);
+    k->allocated = k->foreign = k->freed = 0;
+    return k;
+}
+
+// End of the name, element or field chain starting at p
+static const char *chain_end(const char *p) {
+    for (;;) {
+        while (is_ident_char(*p))
+            p++;
+        if (*p == '[') {
+            int depth = 0;
+            do {
+                if (*p == '[') depth++;
+                if (*p == ']') depth--;
+                p++;
+            } while (*p && depth > 0);
+        }
+        if (p[0] == '.' && is_ident_char(p[1])) p++;
+        else if (p[0] == '-' && p[1] == '>' && is_ident_char(p[2])) p += 2;
+        else if (*p != '[') return p;
+    }
+}
+
+// Key of the chain text [begin, end): `xs[i]` is "xs[]", `s->data` and
+// `t.data` are ".data"; an empty key when the text is not a chain
+static void chain_key(const char *begin, const char *end, char *key, size_t size) {
+    char   text[256];
+    size_t n = 0;
+    key[0] = '\0';
+    while (begin < end && isspace((unsigned char)*begin))
+        begin++;
+    if (begin < end && *begin == '*') text[n++] = *begin++;
+    while (begin < end && isspace((unsigned char)*begin))
+        begin++;
+    if (begin >= end || !(isalpha((unsigned char)*begin) || *begin == '_')) return;
+    const char *stop = chain_end(begin);
+    const char *rest = stop;
+    while (rest < end && isspace((unsigned char)*rest))
+        rest++;
+    if (stop > end || rest != end) return;
+
+    for (const char *p = begin; p < stop && n < sizeof(text) - 3; p++) {
+        if (*p == '[') {
+            text[n++] = '[';
+            text[n++] = ']';
+            for (int depth = 0; p < stop; p++) {
+                if (*p == '[') depth++;
+                if (*p == ']' && --depth == 0) break;
+            }
+        } else if (*p == '-' && p[1] == '>') {
+            text[n++] = '.';
+            p++;
+        } else {
+            text[n++] = *p;
+        }
+    }
+    text[n] = '\0';
+    const char *field = strrchr(text, '.');
+    snprintf(key, size, "%s", field ? field : text);
+}
+
+// Past a cast in front of p, if there is one
+static const char *skip_cast(const char *p) {
+    while (isspace((unsigned char)*p))
+        p++;
+    const char *close = *p == '(' ? strchr(p, ')') : NULL;
+    if (!close) return p;
+    const char *next = close + 1;
+    while (isspace((unsigned char)*next))
+        next++;
+    return is_ident_char(*next) || *next == '(' ? next : p;
+}
+
+// Index into allocator_routes of the call starting at p, or -1
+static int route_at(const char *p) {
+    for (size_t r = 0; r < sizeof(allocator_routes) / sizeof(allocator_routes[0]); r++) {
+        size_t len = strlen(allocator_routes[r][0]);
+        if (strncmp(p, allocator_routes[r][0], len) == 0 && !is_ident_char(p[len]) &&
+            p[len + strspn(p + len, " ")] == '(')
+            return (int)r;
+    }
+    return -1;
+}
+
+static int is_null(const char *p) {
+    p = skip_cast(p);
+    const char *end = strncmp(p, "NULL", 4) == 0 ? p + 4 : *p == '0' ? p + 1 : NULL;
+    if (!end || is_ident_char(*end)) return 0;
+    end += strspn(end, " ");
+    return *end == ';' || *end == ',' || *end == ')' || *end == '\0' || *end == '\n';
+}
+
+// Records the first argument of the call whose `(` is at open as freed
+static void note_freed(const char *open) {
+    const char *end = open + 1;
+    int         depth = 0;
+    for (; *end && !(depth == 0 && (*end == ')' || *end == ',')); end++) {
+        if (*end == '(') depth++;
+        if (*end == ')') depth--;
+    }
+    const char *arg = skip_cast(open + 1);
+    if (is_null(arg)) return;
+    char      key[64];
+    AllocKey *k = NULL;
+    chain_key(arg, end, key, sizeof(key));
+    if (key[0]) k = alloc_key(key);
+    if (!k) k = alloc_key("?"); // Not a plain pointer expression: never routable
+    if (k) k->freed = 1;
+}
+
+static void note_line(const char *line, int depth) {
+    char text[1024];
+    char key[64];
+    blank_literals(line, text, sizeof(text));
+
+    // A function's parameters hold whatever its callers pass
+    const char *open = strchr(text, '(');
+    if (depth == 0 && open && strchr(open, '{')) {
+        const char *param = open + 1;
+        for (const char *p = param;; p++) {
+            if (*p != ',' && *p != ')') continue;
+            const char *end = p;
+            while (end > param && isspace((unsigned char)end[-1]))
+                end--;
+            const char *begin = end;
+            while (begin > param && is_ident_char(begin[-1]))
+                begin--;
+            if (begin < end && end - begin < (int)sizeof(key)) {
+                snprintf(key, sizeof(key), "%.*s", (int)(end - begin), begin);
+                AllocKey *k = alloc_key(key);
+                if (k) k->foreign = 1;
+            }
+            if (*p == ')') break;
+            param = p + 1;
+        }
+    }
+
+    for (const char *p = text; *p; p++) {
+        int r = p > text && is_ident_char(p[-1]) ? -1 : route_at(p);
+        if (r >= 0 && (strcmp(allocator_routes[r][0], "free") == 0 ||
+                       strcmp(allocator_routes[r][0], "realloc") == 0))
+            note_freed(strchr(p, '('));
+
+        // &name: something else may store into it
+        if (*p == '&' && p[1] != '&' && (p == text || !strchr("&)]", p[-1])) &&
+            !(p > text && is_ident_char(p[-1]))) {
+            const char *name = p + 1 + strspn(p + 1, " ");
+            if (isalpha((unsigned char)*name) || *name == '_') {
+                chain_key(name, chain_end(name), key, sizeof(key));
+                AllocKey *k = key[0] ? alloc_key(key) : NULL;
+                if (k) k->foreign = 1;
+            }
+        }
+
+        if (*p != '=' || p[1] == '=' || (p > text && strchr("<>!=", p[-1]))) continue;
+        const char *end = p;
+        while (end > text && strchr("+-*/%&|^", end[-1]))
+            end--;
+        int compound = end != p;
+        while (end > text && isspace((unsigned char)end[-1]))
+            end--;
+        const char *begin = end;
+        for (;;) {
+            while (begin > text && (is_ident_char(begin[-1]) || begin[-1] == '.'))
+                begin--;
+            if (begin > text + 1 && begin[-1] == '>' && begin[-2] == '-') {
+                begin -= 2;
+                continue;
+            }
+            if (begin > text && begin[-1] == ']') {
+                int d = 0;
+                do {
+                    begin--;
+                    if (*begin == ']') d++;
+                    if (*begin == '[') d--;
+                } while (begin > text && d > 0);
+                continue;
+            }
+            break;
+        }
+        const char *before = begin;
+        while (before > text && isspace((unsigned char)before[-1]))
+            before--;
+        if (before > text && before[-1] == '*') {
+            const char *ahead = before - 1;
+            while (ahead > text && isspace((unsigned char)ahead[-1]))
+                ahead--;
+            if (ahead == text || strchr(";{}(,=", ahead[-1])) begin = before - 1; // *p = ...
+        }
+        chain_key(begin, end, key, sizeof(key));
+        AllocKey *k = key[0] ? alloc_key(key) : NULL;
+        if (!k) continue;
+
+        const char *value = skip_cast(p + 1);
+        int         route = compound ? -1 : route_at(value);
+        if (route >= 0 && strcmp(allocator_routes[route][0], "free") != 0) k->allocated = 1;
+        else if (compound || !is_null(value)) k->foreign = 1;
+    }
+}
+
+// Whether the program's allocation calls can all be routed; reads in to its end
+static int allocations_routable(FILE *in) {
+    char line[1024];
+    int  depth = 0;
+    alloc_key_count = 0;
+    while (fgets(line, sizeof(line), in)) {
+        note_line(line, depth);
+        depth += brace_delta(line);
+    }
+    if (alloc_key_count >= MAX_ALLOC_KEYS) {
+        fprintf(stderr, "Warning: --alloc: too many pointers to follow; malloc and free stay "
+                        "with the C library\n");
+        return 0;
+    }
+    for (int i = 0; i < alloc_key_count; i++) {
+        AllocKey *k = &alloc_keys[i];
+        if (k->freed && (!k->allocated || k->foreign)) {
+            fprintf(stderr, "Warning: --alloc: '%s' is freed but may hold memory the "
+                            "allocator did not hand out; malloc and free stay with the C library\n",
+                    k->key);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Send the allocation calls on line through the backend picked by --alloc
+static void route_allocations(char *line) {
+    char   out[1024];
+    size_t n = 0;
+    int    in_string = 0, in_char = 0;
+    char  *p = line;
+
+    while (*p && n < sizeof(out) - 1) {
+        if (*p == '\\' && (in_string || in_char) && p[1]) {
+            out[n++] = *p++;
+            continue;
+        }
+        if (*p == '"' && !in_char) in_string = !in_string;
+        if (*p == '\'' && !in_string) in_char = !in_char;
+        if (!in_string && !in_char && p[0] == '/' && p[1] == '/') break; // Comment: copied as is
+
+        const char *route = NULL;
+        size_t      len = 0;
+        int member = p > line && (p[-1] == '.' || (p[-1] == '>' && p - 1 > line && p[-2] == '-'));
+        if (!in_string && !in_char && !member && (p == line || !is_ident_char(p[-1]))) {
+            for (size_t r = 0; r < sizeof(allocator_routes) / sizeof(allocator_routes[0]); r++) {
+                len = strlen(allocator_routes[r][0]);
+                if (strncmp(p, allocator_routes[r][0], len) == 0 &&
+                    p[len + strspn(p + len, " ")] == '(') {
+                    route = allocator_routes[r][1];
+                    break;
+                }
+            }
+        }
+        if (!route) {
+            out[n++] = *p++;
+            continue;
+        }
+        int written = snprintf(out + n, sizeof(out) - n, "%s", route);
+        if (written < 0 || (size_t)written >= sizeof(out) - n) return; // Too long: leave it
+        n += written;
+        p += len;
+    }
+    if (strlen(p) >= sizeof(out) - n) return;
+    strcpy(out + n, p);
+    strcpy(line, out);
+}
+
+// ==============================================================================
+void add_arena_support(FILE *in, FILE *out) {
+    char line[1024];
+    int  current_function_arenas = 0;
+    char current_arena_vars[10][32];
+    int  brace_depth = 0;
+    int  in_function = 0;
+
+    FILE *temp_out = tmpfile();
+    if (!temp_out) return;
+
+    int route = 0;
+    if (sam_options.route_allocs) {
+        route = allocations_routable(in);
+        rewind(in);
+    }
+
+    while (fgets(line, sizeof(line), in)) {
+        if (route) route_allocations(line);
+
+        // Track braces to determine function boundaries
+        char *ch = line;
+        while (*ch) {
+            if (*ch == '{') {
+                brace_depth++;
+                if (brace_depth == 1) {
+                    // Entering a new function/scope
+                    in_function = 1;
+                    current_function_arenas = 0;
+                    arena_local_count = 0;
+                }
+            }
+            if (*ch == '}') {
+                brace_depth--;
+                if (brace_depth == 0 && in_function) {
+                    // Exiting a function - add arena cleanup
+                    in_function = 0;
+                    for (int i = current_function_arenas; i >= 1; i--) {
+                        fprintf(temp_out, "    arena_destroy(%s);\n", current_arena_vars[i - 1]);
+                    }
+                    current_function_arenas = 0;
+                }
+            }
+            ch++;
+        }
+
+        char *arena_pos = strstr(line, "arena(");
+
+        if (!arena_pos && in_function && current_function_arenas > 0) note_arena_local(line);
+        if (!arena_pos && in_function && current_function_arenas > 0)
+            use_arena_constructors(line, current_arena_vars[current_function_arenas - 1], in,
+                                   brace_depth);
+
+        if (!arena_pos) {
+            // Check for return statements within current function
+            char *return_pos = strstr(line, "return");
+            if (return_pos && in_function && current_function_arenas > 0) {
+                // Insert arena_destroy before return
+                for (int i = current_function_arenas; i >= 1; i--) {
+                    fprintf(temp_out, "    arena_destroy(%s);\n", current_arena_vars[i - 1]);
+                }
+                current_function_arenas = 0;
+            }
+            fputs(line, temp_out);
+            continue;
+        }
+
+        // We're in a function and found arena()
+        if (in_function) {
+            current_function_arenas++;
+        } else {
+            // arena() outside any function - error or global scope
+            fputs(line, temp_out);
+            continue;
+        }
+
+        // Extract size
+        char *size_start = arena_pos + 6;
+        char *size_end = strchr(size_start, ')');
+        if (!size_end) {
+            fputs(line, temp_out);
+            continue;
+        }
+
+        char   size_spec[128];
+        size_t size_len = size_end - size_start;
+        if (size_len >= sizeof(size_spec)) size_len = sizeof(size_spec) - 1;
+        strncpy(size_spec, size_start, size_len);
+        size_spec[size_len] = '\0';
+
+        char bytes[192];
+        size_expression(size_spec, bytes, sizeof(bytes));
+
+        // Create arena variable name for THIS function
+        char arena_var[32];
+        snprintf(arena_var, sizeof(arena_var), "__arena%d", current_function_arenas);
+        if (in_function) {
+            strcpy(current_arena_vars[current_function_arenas - 1], arena_var);
+        }
+
+        // Write everything before arena()
+        *arena_pos = '\0';
+        fputs(line, temp_out);
+
+        // Create arena
+        fprintf(temp_out, "Arena *%s = arena_create(%s);\n", arena_var, bytes);
+
+        // Process what comes after arena()
+        char *after_arena = size_end + 1;
+
+        // Look for array declaration (same as before)
+        char *brackets = strstr(after_arena, "[]");
+        if (brackets) {
+            // Find type
+            char *type_start = after_arena;
+            while (*type_start == ' ' || *type_start == '\t')
+                type_start++;
+
+            char *type_end = type_start;
+            while (*type_end && *type_end != ' ')
+                type_end++;
+
+            if (type_end > type_start) {
+                char   type[32];
+                size_t type_len = type_end - type_start;
+                if (type_len >= sizeof(type)) type_len = sizeof(type) - 1;
+                strncpy(type, type_start, type_len);
+                type[type_len] = '\0';
+
+                // Find variable name
+                char *name_start = type_end;
+                while (*name_start == ' ')
+                    name_start++;
+
+                char *name_end = name_start;
+                while (*name_end && *name_end != '[')
+                    name_end++;
+
+                if (name_end > name_start) {
+                    char   name[64];
+                    size_t name_len = name_end - name_start;
+                    if (name_len >= sizeof(name)) name_len = sizeof(name) - 1;
+                    strncpy(name, name_start, name_len);
+                    name[name_len] = '\0';
+
+                    // Count elements
+                    int   count = 0;
+                    char *brace = strstr(name_end, "{");
+                    if (brace) {
+                        count = 1;
+                        char *comma = brace;
+                        while (*comma && *comma != '}') {
+                            if (*comma == ',') count++;
+                            comma++;
+                        }
+                    } else {
+                        count = 1;
+                    }
+
+                    // Write transformed array allocation
+                    fprintf(temp_out, "    %s *%s = arena_array(%s, %s, %d);\n", type, name,
+                            arena_var, type, count);
+
+                    // Handle initializer if present
+                    if (brace) {
+                        // Create temporary array - WITHOUT the " = " part
+                        fprintf(temp_out, "    %s temp_%s[]", type, name);
+
+                        // Find and copy the ENTIRE initializer including the "="
+                        // We need to find where the initializer starts in the original line
+                        char *equals_in_original = strstr(after_arena, "=");
+                        if (equals_in_original) {
+                            // Write from = to end of line
+                            char *line_end = strchr(equals_in_original, ';');
+                            if (!line_end) line_end = strchr(equals_in_original, '\n');
+                            if (line_end) {
+                                fwrite(equals_in_original, 1, line_end - equals_in_original,
+                                       temp_out);
+                            } else {
+                                fputs(equals_in_original, temp_out);
+                            }
+                        }
+
+                        // Add semicolon and copy loop
+                        fprintf(temp_out,
+                                ";\n    for (int i = 0; i < %d; i++) %s[i] = temp_%s[i];\n", count,
+                                name, name);
+                    }
+
+                    continue; // Skip writing original line
+                }
+            }
+        }
+
+        // If not an array, write original line
+        note_arena_local(after_arena);
+        fputs(after_arena, temp_out);
+    }
+
+    // Handle case where file ends while still in a function
+    if (in_function && current_function_arenas > 0) {
+        fprintf(temp_out, "\n");
+        for (int i = current_function_arenas; i >= 1; i--) {
+            fprintf(temp_out, "    arena_destroy(%s);\n", current_arena_vars[i - 1]);
+        }
+    }
+
+    // Copy to output
+    rewind(temp_out);
+    int ch;
+    while ((ch = fgetc(temp_out)) != EOF) {
+        fputc(ch, out);
+    }
+
+    fclose(temp_out);
+}
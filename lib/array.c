@@ -0,0 +1,263 @@
+// lib/array.c - Lower `array` declarations onto the growable Array
+//
+//     array int xs = {1, 2}          Array xs SAM_ARRAY = array_create(sizeof(int));
+//     array_push(xs, 3)       =>     array_append(&xs, (int[]){1, 2}, 2);
+//     printf("%d", xs[0])            array_push(xs, int, 3);
+//                                    printf("%d", array_at(xs, int, 0));
+//
+// `rc array` keeps the elements in an RC block, and an array declared inside
+// an `arena(...)` scope grows in that arena. The element type is added to
+// array_push, array_pop and array_insert calls on a declared array, and
+// indexing becomes a bounds-checked array_at. The array is freed when its
+// block ends: ARRAY_END is empty where SAM_ARRAY frees through a cleanup
+// attribute. Elements are plain values; an array of strings borrows them.
+#include "common.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_ARRAYS 128
+
+typedef struct {
+    char name[64];
+    char type[64];
+    int  depth; // Brace depth of the declaring block
+} ArrayVar;
+
+static ArrayVar arrays[MAX_ARRAYS];
+static int      array_count;
+
+static ArrayVar *find_array(const char *name, size_t len) {
+    for (int i = array_count - 1; i >= 0; i--) {
+        if (strlen(arrays[i].name) == len && strncmp(arrays[i].name, name, len) == 0)
+            return &arrays[i];
+    }
+    return NULL;
+}
+
+static int is_ident(char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+// Is the text before p (ignoring spaces) `array_push(` or one of its siblings?
+static int is_typed_call_arg(const char *start, const char *p) {
+    static const char *calls[] = {"array_push", "array_pop", "array_insert"};
+    while (p > start && isspace((unsigned char)p[-1]))
+        p--;
+    if (p == start || p[-1] != '(') return 0;
+    p--;
+    while (p > start && isspace((unsigned char)p[-1]))
+        p--;
+
+    for (size_t i = 0; i < sizeof(calls) / sizeof(calls[0]); i++) {
+        size_t len = strlen(calls[i]);
+        if ((size_t)(p - start) >= len && strncmp(p - len, calls[i], len) == 0 &&
+            (p - len == start || !is_ident(p[-len - 1])))
+            return 1;
+    }
+    return 0;
+}
+
+// Copies text[0, len) to out, adding the element type to array calls and
+// turning indexing into array_at. Returns the bytes written.
+static size_t rewrite_uses(const char *text, size_t len, char *out, size_t size) {
+    size_t n = 0;
+    int    in_string = 0, in_char = 0;
+
+#define EMIT(c)                                                                                    \
+    do {                                                                                           \
+        if (n + 1 < size) out[n++] = (c);                                                          \
+    } while (0)
+
+    for (size_t i = 0; i < len; i++) {
+        char c = text[i];
+        if (c == '\\' && (in_string || in_char) && i + 1 < len) {
+            EMIT(c);
+            EMIT(text[++i]);
+            continue;
+        }
+        if (c == '"' && !in_char) in_string = !in_string;
+        if (c == '\'' && !in_string) in_char = !in_char;
+        if (in_string || in_char || !is_ident(c) || (i > 0 && is_ident(text[i - 1]))) {
+            if (!in_string && !in_char && c == '/' && i + 1 < len && text[i + 1] == '/') {
+                while (i < len)
+                    EMIT(text[i++]);
+                break;
+            }
+            EMIT(c);
+            continue;
+        }
+
+        size_t end = i;
+        while (end < len && is_ident(text[end]))
+            end++;
+        ArrayVar *var = find_array(text + i, end - i);
+        int       member = i > 0 && (text[i - 1] == '.' || (i > 1 && text[i - 1] == '>' &&
+                                                            text[i - 2] == '-'));
+        if (!var || member) {
+            while (i < end)
+                EMIT(text[i++]);
+            i--;
+            continue;
+        }
+
+        size_t after = end;
+        while (after < len && text[after] == ' ')
+            after++;
+        if (after < len && text[after] == '[') {
+            // Find the matching bracket and rewrite the index too
+            size_t close = after + 1;
+            int    nesting = 1;
+            for (; close < len; close++) {
+                if (text[close] == '[') nesting++;
+                if (text[close] == ']' && --nesting == 0) break;
+            }
+            if (close < len) {
+                n += snprintf(out + n, n < size ? size - n : 0, "array_at(%s, %s, ", var->name,
+                              var->type);
+                if (n >= size) n = size - 1;
+                n += rewrite_uses(text + after + 1, close - after - 1, out + n, size - n);
+                EMIT(')');
+                i = close;
+                continue;
+            }
+        }
+
+        n += snprintf(out + n, n < size ? size - n : 0, "%s", var->name);
+        if (is_typed_call_arg(text, text + i))
+            n += snprintf(out + n, n < size ? size - n : 0, ", %s", var->type);
+        if (n >= size) n = size - 1;
+        i = end - 1;
+    }
+#undef EMIT
+
+    out[n] = '\0';
+    return n;
+}
+
+// `[rc ]array type name [= {...}];`: splits the declaration and returns 1
+static int parse_declaration(const char *line, int *rc, char *type, char *name, char *init) {
+    char text[1024];
+    snprintf(text, sizeof(text), "%s", line + strspn(line, " \t"));
+    text[strcspn(text, "\n")] = '\0';
+
+    char *p = text;
+    *rc = strncmp(p, "rc", 2) == 0 && isspace((unsigned char)p[2]);
+    if (*rc) p += 2 + strspn(p + 2, " \t");
+    if (strncmp(p, "array", 5) != 0 || !isspace((unsigned char)p[5])) return 0;
+    p += 5 + strspn(p + 5, " \t");
+
+    init[0] = '\0';
+    char *equals = strchr(p, '=');
+    if (equals) {
+        char *value = equals + 1 + strspn(equals + 1, " \t");
+        char *close = strrchr(value, '}');
+        if (*value != '{' || !close) return 0;
+        close[1] = '\0';
+        snprintf(init, 1024, "%s", value);
+        *equals = '\0';
+    }
+
+    size_t len = strcspn(p, ";");
+    while (len > 0 && isspace((unsigned char)p[len - 1]))
+        len--;
+    size_t start = len;
+    while (start > 0 && is_ident(p[start - 1]))
+        start--;
+    if (start == len || start == 0 || len - start >= 64) return 0;
+
+    memcpy(name, p + start, len - start);
+    name[len - start] = '\0';
+    while (start > 0 && isspace((unsigned char)p[start - 1]))
+        start--;
+    if (start == 0 || start >= 64) return 0;
+    memcpy(type, p, start);
+    type[start] = '\0';
+    return 1;
+}
+
+// Elements in a `{...}` initializer
+static int count_elements(const char *init) {
+    int count = 0, nesting = 0, in_string = 0, pending = 0;
+    for (const char *p = init + 1; *p; p++) {
+        if (*p == '\\' && in_string && p[1]) {
+            p++;
+            continue;
+        }
+        if (*p == '"') in_string = !in_string;
+        if (!in_string && (*p == '{' || *p == '(' || *p == '[')) nesting++;
+        if (!in_string && (*p == '}' || *p == ')' || *p == ']') && --nesting < 0) break;
+        if (!in_string && *p == ',' && nesting == 0) {
+            count += pending;
+            pending = 0;
+        } else if (!isspace((unsigned char)*p)) {
+            pending = 1;
+        }
+    }
+    return count + pending;
+}
+
+// =========================== [ MAIN TRANSFORMATION ] ====================================
+
+void add_arrays(FILE *in, FILE *out) {
+    char line[1024];
+    char rewritten[2048];
+    int  depth = 0;
+    char arena[32] = ""; // Arena of the enclosing function, if any
+
+    array_count = 0;
+    while (fgets(line, sizeof(line), in)) {
+        int indent = strspn(line, " \t");
+
+        // The line closing a block frees the arrays it declared
+        if (line[indent] == '}') {
+            while (array_count > 0 && arrays[array_count - 1].depth == depth) {
+                array_count--;
+                fprintf(out, "%*sARRAY_END(%s);\n", indent + 4, "", arrays[array_count].name);
+            }
+        }
+
+        int  rc;
+        char type[64], name[64], init[1024];
+        if (parse_declaration(line, &rc, type, name, init)) {
+            if (depth == 0) {
+                // File scope: no inline storage, nothing frees it
+                fprintf(out, "%*sArray %s = {.elem_size = sizeof(%s), .backing = %s};\n", indent, "", name,
+                        type, rc ? "ARRAY_RC" : "ARRAY_HEAP");
+            } else if (rc) {
+                fprintf(out, "%*sArray %s SAM_ARRAY = array_create_rc(sizeof(%s));\n", indent, "",
+                        name, type);
+            } else if (arena[0]) {
+                fprintf(out, "%*sArray %s SAM_ARRAY = array_create_arena(%s, sizeof(%s));\n",
+                        indent, "", name, arena, type);
+            } else {
+                fprintf(out, "%*sArray %s SAM_ARRAY = array_create(sizeof(%s));\n", indent, "",
+                        name, type);
+            }
+            if (init[0] && count_elements(init) > 0) {
+                fprintf(out, "%*sarray_append(&%s, (%s[])%s, %d);\n", indent, "", name, type, init,
+                        count_elements(init));
+            }
+            if (array_count < MAX_ARRAYS) {
+                snprintf(arrays[array_count].name, sizeof(arrays[0].name), "%s", name);
+                snprintf(arrays[array_count].type, sizeof(arrays[0].type), "%s", type);
+                arrays[array_count++].depth = depth;
+            }
+            continue;
+        }
+
+        // Arrays declared after `arena(...)` grow in its arena
+        char *arena_decl = strstr(line, "Arena *__arena");
+        if (arena_decl && strstr(line, "= arena_create(")) {
+            sscanf(arena_decl, "Arena *%31[A-Za-z0-9_]", arena);
+        }
+
+        if (array_count > 0) {
+            rewrite_uses(line, strlen(line), rewritten, sizeof(rewritten));
+            fputs(rewritten, out);
+        } else {
+            fputs(line, out);
+        }
+
+        depth += brace_delta(line);
+        if (depth == 0) arena[0] = '\0';
+    }
+}
@@ -0,0 +1,803 @@
+#define _POSIX_C_SOURCE 200809L
+// lib/async.c - Lower `async` functions to stackless state machines
+//
+//     async long relay(int from, int to) {
+//         char buf[512];
+//         long n = await async_read(from, buf, 512)
+//         ...
+//         return total
+//     }
+//
+// The parameters and every local move into a frame. The function's own name
+// becomes a constructor that fills one in, and a step function resumes the
+// body at the await it last stopped at:
+//
+//     struct __async_relay {
+//         AsyncTask __task;
+//         int from;
+//         int to;
+//         char buf[512];
+//         long n;
+//     };
+//     AsyncTask *relay(int from, int to) {
+//         struct __async_relay *__f = async_frame_alloc(sizeof(struct __async_relay), __async_relay_step);
+//         __f->from = from;
+//         __f->to = to;
+//         return &__f->__task;
+//     }
+//     static int __async_relay_step(AsyncTask *__task) {
+//         struct __async_relay *__f = (struct __async_relay *)__task;
+//         long __await;
+//         switch (__task->state) {
+//         case 0:
+//         __task->state = 1; // fall through
+//         case 1:
+//         if ((__await = async_read(__task, __f->from, __f->buf, 512)) == ASYNC_PENDING) return ASYNC_SUSPENDED;
+//         __f->n = __await;
+//         ...
+//         { if (__task->result) *(long *)__task->result = __f->total; return ASYNC_DONE; }
+//         }
+//         return ASYNC_DONE;
+//     }
+//
+// `await` takes a call and starts a statement, or follows `return`, an
+// assignment (compound ones too) or a declaration's `=`. Awaiting another
+// async function runs it at once and suspends only if it does; any other
+// function is an awaitable (event_loop.h) and gets the task as its first
+// argument. Called from ordinary code, an async function makes a task for
+// async_spawn. String parameters are retained for the task's life, since a
+// spawned task outlives its caller. Locals that shadow one another get
+// fields of their own; arrays need a constant size. An await cannot sit
+// inside a switch, whose case labels would catch the resume point.
+//
+// This runs after the refcounting passes, so the retains and releases
+// add_refcounting placed are already there and simply follow the locals into
+// the frame. Only lower_memo_functions runs after it.
+#include "common.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LOCALS 256
+#define MAX_FIELDS 256
+#define MAX_ASYNC 256
+
+typedef struct {
+    char name[64];
+    char type[128]; // Declared type without the array dimensions
+    char dims[128]; // `[4][4]` for arrays, empty otherwise
+    int  vla;       // Dimensions that are not constants
+    int  depth;     // Brace depth where the variable is visible
+    int  field;     // Frame field holding it
+} Local;
+
+typedef struct {
+    char name[80];
+    char type[128];
+    char dims[128];
+    int  live; // A visible local uses it
+} Field;
+
+typedef struct {
+    char name[64];
+    char type[128];    // Return type
+    char params[1024]; // As written
+    int  is_static;
+} AsyncFn;
+
+// One async function being lowered
+typedef struct {
+    const AsyncFn *fn;
+    Field          fields[MAX_FIELDS];
+    int            field_count;
+    Local          locals[MAX_LOCALS]; // Visible ones, innermost last
+    int            local_count;
+    int            resumes;     // Resume points so far
+    int            uses_await;  // Some awaitable's result passes through __await
+    int            switches[64]; // Depths of the switch blocks open
+    int            switch_count;
+} Frame;
+
+static AsyncFn async_fns[MAX_ASYNC];
+static int     async_count;
+
+// =========================== [ HELPERS ] =========================================
+
+// First place word stands on its own in line, outside literals and comments
+static const char *find_word(const char *line, const char *word) {
+    int in_string = 0, in_char = 0;
+    for (const char *p = line; *p; p++) {
+        if (*p == '\\' && (in_string || in_char) && p[1]) {
+            p++;
+            continue;
+        }
+        if (*p == '"' && !in_char) in_string = !in_string;
+        if (*p == '\'' && !in_string) in_char = !in_char;
+        if (in_string || in_char) continue;
+        if (*p == '/' && p[1] == '/') return NULL;
+        if ((p == line || !is_ident_char((unsigned char)p[-1])) && match_word(p, word)) return p;
+    }
+    return NULL;
+}
+
+// End of the expression starting at p: the first `,` or `;` outside
+// brackets and literals (stop_at_comma 0 only stops at `;`), or the bracket
+// closing the list it is in
+static const char *expression_end(const char *p, int stop_at_comma) {
+    int nesting = 0, in_string = 0, in_char = 0;
+    for (; *p; p++) {
+        if (*p == '\\' && (in_string || in_char) && p[1]) {
+            p++;
+            continue;
+        }
+        if (*p == '"' && !in_char) in_string = !in_string;
+        if (*p == '\'' && !in_string) in_char = !in_char;
+        if (in_string || in_char) continue;
+        if (*p == '(' || *p == '{' || *p == '[') nesting++;
+        if ((*p == ')' || *p == '}' || *p == ']') && --nesting < 0) break;
+        if (nesting == 0 && (*p == ';' || (stop_at_comma && *p == ','))) break;
+    }
+    return p;
+}
+
+// Space between a type and a name: none after a star
+static const char *gap(const char *type) { return type[strlen(type) - 1] == '*' ? "" : " "; }
+
+// Appends formatted text to out, which holds *used of size bytes
+static void append(char *out, size_t size, size_t *used, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (*used < size) {
+        int written = vsnprintf(out + *used, size - *used, format, args);
+        if (written > 0) *used += (size_t)written;
+        if (*used >= size) *used = size - 1;
+    }
+    va_end(args);
+}
+
+// =========================== [ LOCALS ] =========================================
+
+static const char *const statement_words[] = {"return", "if",       "else",  "while",   "do",
+                                              "switch", "case",     "goto",  "break",   "continue",
+                                              "sizeof", "typedef",  "default", "await"};
+static const char *const storage_words[] = {"static", "register", "extern", "auto", "inline"};
+
+static int in_list(const char *word, const char *const *list, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(word, list[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static Local *find_local(Local *locals, int count, const char *name, size_t len) {
+    for (int i = count - 1; i >= 0; i--) {
+        if (strlen(locals[i].name) == len && strncmp(locals[i].name, name, len) == 0)
+            return &locals[i];
+    }
+    return NULL;
+}
+
+static const AsyncFn *find_async(const char *name, size_t len) {
+    for (int i = 0; i < async_count; i++) {
+        if (strlen(async_fns[i].name) == len && strncmp(async_fns[i].name, name, len) == 0)
+            return &async_fns[i];
+    }
+    return NULL;
+}
+
+// Records the variables that `type name [dims] [= value], ...` declares in
+// text; returns how many. Statements that only look like one are rejected by
+// needing a type word before the name and one of = ; , [ after it.
+static int declare_locals(const char *text, int depth, Local *locals, int *count) {
+    char        base[112] = "";
+    char        words[8][64];
+    int         word_count = 0, stars = 0, declared = 0;
+    const char *p = text + strspn(text, " \t");
+
+    // Type words and stars up to the first declarator's name
+    for (;;) {
+        p += strspn(p, " \t");
+        if (*p == '*') {
+            stars++;
+            p++;
+            continue;
+        }
+        if (!isalpha((unsigned char)*p) && *p != '_') break;
+        size_t len = 0;
+        while (is_ident_char((unsigned char)p[len]))
+            len++;
+        if (word_count == 8 || len >= 64 || stars > 0) break;
+        memcpy(words[word_count], p, len);
+        words[word_count++][len] = '\0';
+        p += len;
+    }
+    // Attribute macros such as SAM_ARRAY follow the name
+    while (word_count > 2 && strncmp(words[word_count - 1], "SAM_", 4) == 0)
+        word_count--;
+    if (word_count < 2 && !(word_count == 1 && stars > 0)) return 0;
+    if (in_list(words[0], statement_words, sizeof(statement_words) / sizeof(statement_words[0])))
+        return 0;
+
+    // With stars the name comes after them
+    if (stars > 0) {
+        size_t len = 0;
+        while (is_ident_char((unsigned char)p[len]))
+            len++;
+        if (len == 0 || len >= 64 || isdigit((unsigned char)*p)) return 0;
+        memcpy(words[word_count++], p, len);
+        words[word_count - 1][len] = '\0';
+        p += len;
+    }
+
+    for (int i = 0; i < word_count - 1; i++) {
+        if (in_list(words[i], storage_words, sizeof(storage_words) / sizeof(storage_words[0])))
+            continue;
+        size_t used = strlen(base);
+        int    n = snprintf(base + used, sizeof(base) - used, "%s%s", used ? " " : "", words[i]);
+        if (n < 0 || (size_t)n >= sizeof(base) - used) return 0; // Too long a type
+    }
+    if (!base[0]) return 0;
+
+    const char *name = words[word_count - 1];
+    for (;;) {
+        p += strspn(p, " \t");
+        char dims[128] = "";
+        int  vla = 0;
+        while (*p == '[') {
+            const char *close = strchr(p, ']');
+            if (!close) return declared;
+            size_t used = strlen(dims);
+            if (used + (close - p) + 2 >= sizeof(dims)) return declared;
+            memcpy(dims + used, p, close - p + 1);
+            dims[used + (close - p) + 1] = '\0';
+            for (const char *q = p + 1; q < close; q++) {
+                if (islower((unsigned char)*q)) vla = 1;
+            }
+            p = close + 1 + strspn(close + 1, " \t");
+        }
+        if (*p != '=' && *p != ';' && *p != ',' && *p != '\n' && *p != '\0') return declared;
+        if (*p == '=' && p[1] == '=') return declared;
+
+        if (*count < MAX_LOCALS) {
+            Local *local = &locals[(*count)++];
+            snprintf(local->name, sizeof(local->name), "%s", name);
+            snprintf(local->type, sizeof(local->type), "%s%s%.*s", base, stars ? " " : "", stars,
+                     "********");
+            snprintf(local->dims, sizeof(local->dims), "%s", dims);
+            local->vla = vla;
+            local->depth = depth;
+            local->field = -1;
+            declared++;
+        }
+
+        // Skip the initializer to the next declarator
+        p = expression_end(p, 1);
+        if (*p != ',') return declared;
+        p++;
+        p += strspn(p, " \t");
+        stars = 0;
+        while (*p == '*' || *p == ' ') {
+            if (*p == '*') stars++;
+            p++;
+        }
+        size_t len = 0;
+        while (is_ident_char((unsigned char)p[len]))
+            len++;
+        if (len == 0 || len >= 64) return declared;
+        memcpy(words[0], p, len);
+        words[0][len] = '\0';
+        name = words[0];
+        p += len;
+    }
+}
+
+// `type name(type a, type b) {`: the parameters, visible at depth 1
+static void declare_params(const char *line, Local *locals, int *count) {
+    char        params[1024];
+    const char *open = strchr(line, '(');
+    if (!open || !copy_parens(open, params, sizeof(params))) return;
+
+    char *param = params;
+    while (param) {
+        char *comma = strchr(param, ',');
+        if (comma) *comma = '\0';
+        int before = *count;
+        declare_locals(param, 1, locals, count);
+        // An array parameter is a pointer
+        for (int i = before; i < *count; i++) {
+            if (locals[i].dims[0]) {
+                size_t used = strlen(locals[i].type);
+                snprintf(locals[i].type + used, sizeof(locals[i].type) - used, " *");
+                locals[i].dims[0] = '\0';
+            }
+        }
+        param = comma ? comma + 1 : NULL;
+    }
+}
+
+// Elements of a one-dimensional `{a, b, c}` initializer
+static int count_elements(const char *init) {
+    const char *p = init + strspn(init, " \t");
+    if (*p != '{') return -1;
+    int count = 0;
+    for (p++; *p && *p != '}';) {
+        p += strspn(p, " \t");
+        if (*p == '}') break;
+        count++;
+        p = expression_end(p, 1);
+        if (*p == ',') p++;
+        else if (*p == ';' || !*p) return -1;
+        else break;
+    }
+    return count;
+}
+
+// Gives local a frame field: a free one of the same name and type if its
+// scope has ended, otherwise a new one, suffixed when the name is taken
+static int bind_field(Frame *frame, Local *local, int number) {
+    int taken = 0;
+    for (int i = 0; i < frame->field_count; i++) {
+        Field *field = &frame->fields[i];
+        size_t len = strlen(local->name);
+        if (strncmp(field->name, local->name, len) != 0 ||
+            (field->name[len] && field->name[len] != '_'))
+            continue;
+        taken++;
+        if (!field->live && strcmp(field->type, local->type) == 0 &&
+            strcmp(field->dims, local->dims) == 0) {
+            field->live = 1;
+            return local->field = i;
+        }
+    }
+    if (frame->field_count == MAX_FIELDS) {
+        report(number, "too many locals in an async function", "");
+        return -1;
+    }
+    Field *field = &frame->fields[frame->field_count];
+    if (taken)
+        snprintf(field->name, sizeof(field->name), "%s_%d", local->name, taken + 1);
+    else
+        snprintf(field->name, sizeof(field->name), "%s", local->name);
+    snprintf(field->type, sizeof(field->type), "%s", local->type);
+    snprintf(field->dims, sizeof(field->dims), "%s", local->dims);
+    field->live = 1;
+    return local->field = frame->field_count++;
+}
+
+// Frame fields for the locals a line just declared; init is where the first
+// one's declarator starts, to size `[]` arrays from their initializer
+static void bind_new_locals(Frame *frame, int before, const char *init, int number) {
+    for (int i = before; i < frame->local_count; i++) {
+        Local *local = &frame->locals[i];
+        if (local->vla) {
+            report(number, "array size must be a constant in an async function: ", local->name);
+            continue;
+        }
+        if (strncmp(local->dims, "[]", 2) == 0) {
+            const char *equals = init ? strchr(init, '=') : NULL;
+            int         count = equals ? count_elements(equals + 1) : -1;
+            if (count < 0) {
+                report(number, "array size must be given in an async function: ", local->name);
+                continue;
+            }
+            char dims[128];
+            snprintf(dims, sizeof(dims), "[%d]%s", count, local->dims + 2);
+            strcpy(local->dims, dims);
+        }
+        bind_field(frame, local, number);
+    }
+}
+
+static void pop_locals(Frame *frame, int depth) {
+    while (frame->local_count > 0 && frame->locals[frame->local_count - 1].depth > depth) {
+        int field = frame->locals[--frame->local_count].field;
+        if (field >= 0) frame->fields[field].live = 0;
+    }
+}
+
+// =========================== [ REWRITING ] =========================================
+
+// Replaces every identifier naming a visible local with its frame field
+static void rewrite_locals(Frame *frame, const char *line, char *out, size_t size) {
+    size_t n = 0;
+    int    in_string = 0, in_char = 0;
+
+    for (size_t i = 0; line[i]; i++) {
+        char c = line[i];
+        if (c == '\\' && (in_string || in_char) && line[i + 1]) {
+            append(out, size, &n, "%c%c", c, line[i + 1]);
+            i++;
+            continue;
+        }
+        if (c == '"' && !in_char) in_string = !in_string;
+        if (c == '\'' && !in_string) in_char = !in_char;
+        if (!in_string && !in_char && c == '/' && line[i + 1] == '/') {
+            append(out, size, &n, "%s", line + i);
+            break;
+        }
+        if (in_string || in_char || !(isalpha((unsigned char)c) || c == '_') ||
+            (i > 0 && is_ident_char((unsigned char)line[i - 1]))) {
+            append(out, size, &n, "%c", c);
+            continue;
+        }
+
+        size_t end = i;
+        while (is_ident_char((unsigned char)line[end]))
+            end++;
+        int member = i > 0 && (line[i - 1] == '.' || (i > 1 && line[i - 1] == '>' && line[i - 2] == '-'));
+        Local *local = member ? NULL : find_local(frame->locals, frame->local_count, line + i, end - i);
+        if (local && local->field >= 0)
+            append(out, size, &n, "__f->%s", frame->fields[local->field].name);
+        else
+            append(out, size, &n, "%.*s", (int)(end - i), line + i);
+        i = end - 1;
+    }
+    out[n < size ? n : size - 1] = '\0';
+}
+
+// `return value;` as storing value for the awaiting task
+static void write_return(const Frame *frame, const char *value, char *out, size_t size, size_t *n) {
+    const char *type = frame->fn->type;
+    if (strcmp(type, "void") == 0 || !value[0]) {
+        append(out, size, n, "return ASYNC_DONE;");
+        return;
+    }
+    append(out, size, n, "{ if (__task->result) *(%s%s*)__task->result = %s; return ASYNC_DONE; }",
+           type, gap(type), value);
+}
+
+static void lower_returns(const Frame *frame, const char *line, char *out, size_t size) {
+    size_t      n = 0;
+    const char *p = line;
+    for (const char *at; (at = find_word(p, "return"));) {
+        append(out, size, &n, "%.*s", (int)(at - p), p);
+        const char *value = at + strlen("return");
+        const char *end = expression_end(value, 0);
+        char        text[2048];
+        snprintf(text, sizeof(text), "%.*s", (int)(end - value), value);
+        trim(text);
+        write_return(frame, text, out, size, &n);
+        p = *end ? end + 1 : end;
+    }
+    append(out, size, &n, "%s", p);
+}
+
+// `declared` locals came from this declaration; writes the initialized
+// ones as assignments (arrays and brace lists through compound literals)
+static void lower_declaration(Frame *frame, int before, const char *text, char *out, size_t size) {
+    size_t      n = 0;
+    const char *indent_end = text + strspn(text, " \t");
+    const char *p = find_word(indent_end, frame->locals[before].name);
+    if (!p) p = indent_end;
+    append(out, size, &n, "%.*s", (int)(indent_end - text), text);
+
+    for (int i = before; i < frame->local_count && *p; i++) {
+        const Local *local = &frame->locals[i];
+        p += strspn(p, " \t*");
+        p += strlen(local->name);
+        while (*p && *p != '=' && *p != ',' && *p != ';')
+            p++; // Dimensions
+        if (*p == '=') {
+            const char *value = p + 1;
+            const char *end = expression_end(value, 1);
+            char        init[2048];
+            snprintf(init, sizeof(init), "%.*s", (int)(end - value), value);
+            trim(init);
+            if (local->dims[0]) {
+                int braced = init[0] == '{';
+                append(out, size, &n, "memcpy(%s, (%s%s)%s%s%s, sizeof(%s)); ", local->name,
+                       local->type, local->dims, braced ? "" : "{", init, braced ? "" : "}",
+                       local->name);
+            } else if (init[0] == '{') {
+                append(out, size, &n, "%s = (%s)%s; ", local->name, local->type, init);
+            } else {
+                append(out, size, &n, "%s = %s; ", local->name, init);
+            }
+            p = end;
+        }
+        if (*p == ',') p++;
+    }
+    if (*p == ';') p++;
+    // What follows the declaration: a closing brace, a comment
+    while (n > 0 && out[n - 1] == ' ')
+        n--;
+    out[n] = '\0';
+    append(out, size, &n, "%s", p);
+}
+
+// Lowers `head await name(args);rest` into out (several lines); returns 0
+// when the await is not in a form this pass handles
+static int lower_await(Frame *frame, const char *line, const char *at, LineBuffer *out, int number) {
+    int         indent = strspn(line, " \t");
+    const char *after = match_word(at, "await");
+    char        head[1024], args[2048], name[64], text[4096];
+
+    snprintf(head, sizeof(head), "%.*s", (int)(at - line - indent), line + indent);
+    trim(head);
+    size_t len = 0;
+    while (is_ident_char((unsigned char)after[len]))
+        len++;
+    if (len == 0 || len >= sizeof(name)) return 0;
+    snprintf(name, sizeof(name), "%.*s", (int)len, after);
+    const char *rest = copy_parens(after + len + strspn(after + len, " \t"), args, sizeof(args));
+    if (!rest || *rest != ';') return 0;
+    rest++;
+
+    // The head is empty, `return`, or an assignment's left side and operator
+    size_t head_len = strlen(head);
+    int    returns = strcmp(head, "return") == 0;
+    if (head_len > 0 && !returns) {
+        char first[64] = "";
+        sscanf(head, "%63[A-Za-z_]", first);
+        if (head[head_len - 1] != '=' || strpbrk(head, ";{}") ||
+            in_list(first, statement_words, sizeof(statement_words) / sizeof(statement_words[0])))
+            return 0;
+        if (head_len >= 2 && strchr("=!", head[head_len - 2])) return 0;
+        if (head_len >= 2 && strchr("<>", head[head_len - 2]) &&
+            (head_len < 3 || head[head_len - 3] != head[head_len - 2]))
+            return 0;
+    }
+    if (frame->switch_count > 0) {
+        report(number, "await inside a switch", "");
+        return 1;
+    }
+
+    const AsyncFn *child = find_async(name, len);
+    int            id = ++frame->resumes;
+    char           value[128];
+    size_t         n = 0;
+    if (child && head_len > 0 && strcmp(child->type, "void") == 0) {
+        report(number, "awaited async function returns void: ", name);
+        return 1;
+    }
+
+    snprintf(text, sizeof(text), "%*s__task->state = %d;%s\n", indent, "", id,
+             child ? "" : " // fall through");
+    push_numbered_line(out, text, number);
+    if (child) {
+        // The child writes its result into a field of this frame
+        if (head_len > 0) {
+            Field *field = &frame->fields[frame->field_count];
+            if (frame->field_count == MAX_FIELDS) {
+                report(number, "too many locals in an async function", "");
+                return 1;
+            }
+            snprintf(field->name, sizeof(field->name), "__await%d", id);
+            snprintf(field->type, sizeof(field->type), "%s", child->type);
+            field->dims[0] = '\0';
+            field->live = 1;
+            frame->field_count++;
+            snprintf(value, sizeof(value), "__f->__await%d", id);
+        }
+        snprintf(text, sizeof(text),
+                 "%*sif (async_await(__task, %s(%s), %s%s)) return ASYNC_SUSPENDED; // fall through\n",
+                 indent, "", name, args, head_len > 0 ? "&" : "NULL", head_len > 0 ? value : "");
+        push_numbered_line(out, text, number);
+        snprintf(text, sizeof(text), "%*scase %d:\n", indent, "", id);
+        push_numbered_line(out, text, number);
+    } else {
+        frame->uses_await = 1;
+        snprintf(value, sizeof(value), "__await");
+        snprintf(text, sizeof(text), "%*scase %d:\n", indent, "", id);
+        push_numbered_line(out, text, number);
+        snprintf(text, sizeof(text),
+                 "%*sif ((__await = %s(__task%s%s)) == ASYNC_PENDING) return ASYNC_SUSPENDED;\n", indent,
+                 "", name, args[strspn(args, " \t")] ? ", " : "", args);
+        push_numbered_line(out, text, number);
+    }
+
+    append(text, sizeof(text), &n, "%*s", indent, "");
+    if (returns)
+        write_return(frame, value, text, sizeof(text), &n);
+    else if (head_len > 0)
+        append(text, sizeof(text), &n, "%s %s;", head, value);
+    append(text, sizeof(text), &n, "%s", rest);
+    if (text[strspn(text, " \t\n")]) push_numbered_line(out, text, number);
+    return 1;
+}
+
+// =========================== [ FUNCTIONS ] =========================================
+
+// `[static] async type name(params)`: fills fn and returns the text after the
+// parameter list, or NULL
+static const char *parse_header(const char *line, AsyncFn *fn) {
+    const char *p = line + strspn(line, " \t");
+    const char *next = match_word(p, "static");
+    fn->is_static = next != NULL;
+    if (next) p = next;
+    if (!(p = match_word(p, "async"))) return NULL;
+
+    const char *open = strchr(p, '(');
+    if (!open) return NULL;
+    const char *name_end = open;
+    while (name_end > p && (name_end[-1] == ' ' || name_end[-1] == '\t'))
+        name_end--;
+    const char *name = name_end;
+    while (name > p && is_ident_char((unsigned char)name[-1]))
+        name--;
+    if (name == name_end || name == p || name_end - name >= (long)sizeof(fn->name)) return NULL;
+    if (name - p >= (long)sizeof(fn->type)) return NULL;
+
+    snprintf(fn->name, sizeof(fn->name), "%.*s", (int)(name_end - name), name);
+    snprintf(fn->type, sizeof(fn->type), "%.*s", (int)(name - p), p);
+    trim(fn->type);
+    if (!fn->type[0]) return NULL;
+    return copy_parens(open, fn->params, sizeof(fn->params));
+}
+
+static void write_prototype(FILE *out, const AsyncFn *fn) {
+    fprintf(out, "%sAsyncTask *%s(%s);\n", fn->is_static ? "static " : "", fn->name, fn->params);
+}
+
+// Writes the frame, constructor and step function for fn->lines
+static void lower_function(LineBuffer *fn, const AsyncFn *async, FILE *out) {
+    static Frame frame;
+    char         text[4096], line[4096], lowered[8192];
+    int          number = fn->numbers[0], depth = 1;
+    LineBuffer   body = {0};
+
+    memset(&frame, 0, sizeof(frame));
+    frame.fn = async;
+    declare_params(fn->lines[0], frame.locals, &frame.local_count);
+    int param_count = frame.local_count;
+    bind_new_locals(&frame, 0, NULL, number);
+
+    for (int i = 1; i < fn->count; i++) {
+        int         n = fn->numbers[i];
+        const char *source = fn->lines[i];
+        snprintf(line, sizeof(line), "%s", source);
+        // The function's closing brace closes the switch instead
+        if (i == fn->count - 1) {
+            char *close = strrchr(line, '}');
+            if (close) strcpy(close, close[1] == '\n' || !close[1] ? "\n" : close + 1);
+        }
+
+        const char *p = line + strspn(line, " \t");
+        const char *after_for = match_word(p, "for");
+        int         before = frame.local_count;
+        if (match_word(p, "static")) {
+            // Static locals keep their storage and their declaration
+        } else if (after_for && *after_for == '(') {
+            declare_locals(after_for + 1, depth + 1, frame.locals, &frame.local_count);
+            bind_new_locals(&frame, before, after_for + 1, n);
+            if (frame.local_count > before) {
+                // `for (int i = 0; ...` keeps `i = 0`
+                const char *name = find_word(after_for + 1, frame.locals[before].name);
+                snprintf(text, sizeof(text), "%.*s%s", (int)(after_for + 1 - line), line, name);
+                strcpy(line, text);
+            }
+        } else if (*p != '#' && *p != '/' && *p != '}' &&
+                   declare_locals(p, depth, frame.locals, &frame.local_count) > 0) {
+            bind_new_locals(&frame, before, p, n);
+            lower_declaration(&frame, before, line, text, sizeof(text));
+            strcpy(line, text);
+        }
+
+        rewrite_locals(&frame, line, lowered, sizeof(lowered));
+        const char *at = find_word(lowered, "await");
+        if (at) {
+            if (!lower_await(&frame, lowered, at, &body, n))
+                report(n, "await must take a call and start a statement, or follow `=` or `return`", "");
+        } else {
+            lower_returns(&frame, lowered, text, sizeof(text));
+            push_numbered_line(&body, text, n);
+        }
+
+        depth += brace_delta(source);
+        pop_locals(&frame, depth);
+        while (frame.switch_count > 0 && frame.switches[frame.switch_count - 1] > depth)
+            frame.switch_count--;
+        if (match_word(p, "switch") && brace_delta(source) > 0 && frame.switch_count < 64)
+            frame.switches[frame.switch_count++] = depth;
+    }
+
+    // Frame
+    const char *name = async->name;
+    fprintf(out, "struct __async_%s {\n    AsyncTask __task;\n", name);
+    for (int f = 0; f < frame.field_count; f++) {
+        const Field *field = &frame.fields[f];
+        fprintf(out, "    %s%s%s%s;\n", field->type, gap(field->type), field->name, field->dims);
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "static int __async_%s_step(AsyncTask *__task);\n\n", name);
+
+    // String parameters live as long as the task
+    int strings = 0;
+    for (int i = 0; i < param_count; i++)
+        strings += strcmp(frame.locals[i].type, "string") == 0;
+    if (strings > 0) {
+        fprintf(out, "static void __async_%s_drop(AsyncTask *__task) {\n", name);
+        fprintf(out, "    struct __async_%s *__f = (struct __async_%s *)__task;\n", name, name);
+        for (int i = 0; i < param_count; i++) {
+            if (strcmp(frame.locals[i].type, "string") == 0)
+                fprintf(out, "    rc_release(__f->%s);\n", frame.fields[frame.locals[i].field].name);
+        }
+        fprintf(out, "}\n\n");
+    }
+
+    // Constructor
+    fprintf(out, "%sAsyncTask *%s(%s) {\n", async->is_static ? "static " : "", name, async->params);
+    fprintf(out, "    struct __async_%s *__f = async_frame_alloc(sizeof(struct __async_%s), __async_%s_step);\n",
+            name, name, name);
+    for (int i = 0; i < param_count; i++) {
+        const char *field = frame.fields[frame.locals[i].field].name;
+        fprintf(out, "    __f->%s = %s;\n", field, frame.locals[i].name);
+        if (strcmp(frame.locals[i].type, "string") == 0) fprintf(out, "    rc_retain(__f->%s);\n", field);
+    }
+    if (strings > 0) fprintf(out, "    __f->__task.drop = __async_%s_drop;\n", name);
+    fprintf(out, "    return &__f->__task;\n}\n\n");
+
+    // Step function
+    fprintf(out, "static int __async_%s_step(AsyncTask *__task) {\n", name);
+    if (frame.field_count > 0)
+        fprintf(out, "    struct __async_%s *__f = (struct __async_%s *)__task;\n", name, name);
+    if (frame.uses_await) fprintf(out, "    long __await;\n");
+    fprintf(out, "    switch (__task->state) {\n    case 0:\n");
+    for (int i = 0; i < body.count; i++)
+        fputs(body.lines[i], out);
+    fprintf(out, "    }\n    return ASYNC_DONE;\n}\n");
+    free_lines(&body);
+}
+
+// =========================== [ MAIN TRANSFORMATION ] ====================================
+
+int lower_async_functions(FILE *in, FILE *out) {
+    LineBuffer buf = {0};
+    char       line[1024];
+    int        depth = 0, declared = 0;
+
+    pass_errors = 0;
+    async_count = 0;
+    while (fgets(line, sizeof(line), in))
+        push_line(&buf, line);
+
+    // Every async function first, so awaits may come before the definition
+    for (int i = 0; i < buf.count; i++) {
+        AsyncFn fn;
+        if (depth == 0 && async_count < MAX_ASYNC && parse_header(buf.lines[i], &fn) &&
+            !find_async(fn.name, strlen(fn.name)))
+            async_fns[async_count++] = fn;
+        depth += brace_delta(buf.lines[i]);
+    }
+
+    depth = 0;
+    for (int i = 0; i < buf.count; i++) {
+        const char *text = buf.lines[i];
+        AsyncFn     fn;
+        const char *rest = depth == 0 ? parse_header(text, &fn) : NULL;
+
+        if (rest && !declared) {
+            // Constructor prototypes, so any function can await any other
+            for (int f = 0; f < async_count; f++)
+                write_prototype(out, &async_fns[f]);
+            fputc('\n', out);
+            declared = 1;
+        }
+        if (rest && *rest == '{') {
+            int        end = block_end(&buf, i);
+            LineBuffer body = {0};
+            for (int j = i; j <= end; j++)
+                push_numbered_line(&body, buf.lines[j], buf.numbers[j]);
+            lower_function(&body, find_async(fn.name, strlen(fn.name)), out);
+            free_lines(&body);
+            i = end;
+            continue;
+        }
+        if (rest && *rest == ';') {
+            write_prototype(out, &fn);
+            continue;
+        }
+        const char *p = text + strspn(text, " \t");
+        if (depth == 0 && (match_word(p, "async") || (match_word(p, "static") &&
+                                                      match_word(match_word(p, "static"), "async"))))
+            report(buf.numbers[i], "expected `async type name(params) {` on one line", "");
+        if (find_word(text, "await")) report(buf.numbers[i], "await outside an async function", "");
+        fputs(text, out);
+        depth += brace_delta(text);
+    }
+
+    free_lines(&buf);
+    return pass_errors;
+}
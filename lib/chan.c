@@ -0,0 +1,304 @@
+#define _GNU_SOURCE // syscall
+// lib/chan.c - Bounded rings: owned indices for SPSC, per-slot turns for MPMC
+#include "chan.h"
+#include <limits.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define CHAN_LINE 64  // Keeps the two sides' indices off each other's cache line
+#define CHAN_SPIN 128 // Polls before sleeping
+
+struct Chan {
+    // Senders' side
+    size_t head;      // Next position to send into
+    size_t tail_seen; // SPSC: the sender's last look at tail
+    char   pad_send[CHAN_LINE - 2 * sizeof(size_t)];
+
+    // Receivers' side
+    size_t tail;      // Next position to receive from
+    size_t head_seen; // SPSC: the receiver's last look at head
+    char   pad_recv[CHAN_LINE - 2 * sizeof(size_t)];
+
+    // Futex words, bumped to wake the other side, and how many sleep on each
+    uint32_t not_empty;
+    uint32_t not_full;
+    uint32_t receivers_asleep;
+    uint32_t senders_asleep;
+    uint32_t closed;
+
+    ChanKind       kind;
+    int            strings;
+    size_t         elem_size;
+    size_t         mask;  // Capacity - 1
+    size_t        *turns; // MPMC: slot free for position p when p, full when p + 1
+    unsigned char *slots;
+};
+
+static inline void chan_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static void futex_wait(uint32_t *word, uint32_t seen) {
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+#else
+    (void)word;
+    (void)seen;
+    sched_yield();
+#endif
+}
+
+static void futex_wake(uint32_t *word) {
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+    (void)word;
+#endif
+}
+
+static inline unsigned char *slot(chan c, size_t pos) {
+    return c->slots + (pos & c->mask) * c->elem_size;
+}
+
+// =========================== [ RINGS ] ====================================
+
+static size_t spsc_send(chan c, const unsigned char *values, size_t count) {
+    size_t head = __atomic_load_n(&c->head, __ATOMIC_RELAXED);
+    if (head - c->tail_seen + count > c->mask + 1)
+        c->tail_seen = __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+    size_t room = c->mask + 1 - (head - c->tail_seen);
+    if (count > room) count = room;
+    if (count == 0) return 0;
+
+    for (size_t i = 0; i < count; i++)
+        memcpy(slot(c, head + i), values + i * c->elem_size, c->elem_size);
+    __atomic_store_n(&c->head, head + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+static size_t spsc_recv(chan c, unsigned char *values, size_t max) {
+    size_t tail = __atomic_load_n(&c->tail, __ATOMIC_RELAXED);
+    if (c->head_seen - tail < max) c->head_seen = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+    size_t ready = c->head_seen - tail;
+    if (max > ready) max = ready;
+    if (max == 0) return 0;
+
+    for (size_t i = 0; i < max; i++)
+        memcpy(values + i * c->elem_size, slot(c, tail + i), c->elem_size);
+    __atomic_store_n(&c->tail, tail + max, __ATOMIC_RELEASE);
+    return max;
+}
+
+// Claims the run of free slots at head with one CAS, then fills them
+static size_t mpmc_send(chan c, const unsigned char *values, size_t count) {
+    size_t pos = __atomic_load_n(&c->head, __ATOMIC_RELAXED);
+    for (;;) {
+        size_t n = 0;
+        while (n < count && __atomic_load_n(&c->turns[(pos + n) & c->mask], __ATOMIC_ACQUIRE) == pos + n)
+            n++;
+        if (n == 0) {
+            size_t turn = __atomic_load_n(&c->turns[pos & c->mask], __ATOMIC_ACQUIRE);
+            if ((intptr_t)(turn - pos) < 0) return 0; // Still holds the value from a lap ago
+            pos = __atomic_load_n(&c->head, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&c->head, &pos, pos + n, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            for (size_t i = 0; i < n; i++) {
+                memcpy(slot(c, pos + i), values + i * c->elem_size, c->elem_size);
+                __atomic_store_n(&c->turns[(pos + i) & c->mask], pos + i + 1, __ATOMIC_RELEASE);
+            }
+            return n;
+        }
+    }
+}
+
+static size_t mpmc_recv(chan c, unsigned char *values, size_t max) {
+    size_t pos = __atomic_load_n(&c->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        size_t n = 0;
+        while (n < max && __atomic_load_n(&c->turns[(pos + n) & c->mask], __ATOMIC_ACQUIRE) == pos + n + 1)
+            n++;
+        if (n == 0) {
+            size_t turn = __atomic_load_n(&c->turns[pos & c->mask], __ATOMIC_ACQUIRE);
+            if ((intptr_t)(turn - (pos + 1)) < 0) return 0; // Not sent yet
+            pos = __atomic_load_n(&c->tail, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&c->tail, &pos, pos + n, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            for (size_t i = 0; i < n; i++) {
+                memcpy(values + i * c->elem_size, slot(c, pos + i), c->elem_size);
+                __atomic_store_n(&c->turns[(pos + i) & c->mask], pos + i + c->mask + 1, __ATOMIC_RELEASE);
+            }
+            return n;
+        }
+    }
+}
+
+// =========================== [ SLEEPING ] ====================================
+
+// After a send or receive: wake the other side if any of it sleeps. The
+// fence pairs with the one in wait_for, so either the sleeper sees the new
+// state or this sees the sleeper. Taking the count to zero wakes them all at
+// once, so the sends made before they get to run cost no further syscalls.
+static void wake(uint32_t *word, uint32_t *asleep) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(asleep, __ATOMIC_RELAXED) == 0) return;
+    if (__atomic_exchange_n(asleep, 0, __ATOMIC_RELAXED) == 0) return;
+    __atomic_add_fetch(word, 1, __ATOMIC_RELEASE);
+    futex_wake(word);
+}
+
+static int is_closed(chan c) { return __atomic_load_n(&c->closed, __ATOMIC_ACQUIRE); }
+
+// Could a send (or receive) get anywhere now? Losing a race still counts.
+static int ready(chan c, int sending) {
+    if (is_closed(c)) return 1;
+    if (sending) {
+        size_t head = __atomic_load_n(&c->head, __ATOMIC_RELAXED);
+        if (c->kind == CHAN_SPSC) return head - __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE) <= c->mask;
+        return (intptr_t)(__atomic_load_n(&c->turns[head & c->mask], __ATOMIC_ACQUIRE) - head) >= 0;
+    }
+    size_t tail = __atomic_load_n(&c->tail, __ATOMIC_RELAXED);
+    if (c->kind == CHAN_SPSC) return __atomic_load_n(&c->head, __ATOMIC_ACQUIRE) != tail;
+    return (intptr_t)(__atomic_load_n(&c->turns[tail & c->mask], __ATOMIC_ACQUIRE) - (tail + 1)) >= 0;
+}
+
+static void wait_for(chan c, int sending) {
+    uint32_t *word = sending ? &c->not_full : &c->not_empty;
+    uint32_t *asleep = sending ? &c->senders_asleep : &c->receivers_asleep;
+
+    for (int i = 0; i < CHAN_SPIN; i++) {
+        if (ready(c, sending)) return;
+        chan_relax();
+    }
+    uint32_t seen = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+    __atomic_add_fetch(asleep, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!ready(c, sending)) {
+        futex_wait(word, seen);
+        return;
+    }
+    // Did not sleep after all: take back the count unless a waker already did
+    uint32_t count = __atomic_load_n(asleep, __ATOMIC_RELAXED);
+    while (count > 0 &&
+           !__atomic_compare_exchange_n(asleep, &count, count - 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// =========================== [ CHANNELS ] ====================================
+
+static chan chan_new(size_t elem_size, size_t capacity, ChanKind kind, int strings) {
+    size_t rounded = 2;
+    while (rounded < capacity && rounded <= SIZE_MAX / 4)
+        rounded *= 2;
+    if (elem_size == 0 || rounded > SIZE_MAX / elem_size) return NULL;
+
+    chan c = calloc(1, sizeof(struct Chan));
+    if (!c) return NULL;
+    c->kind = kind;
+    c->strings = strings;
+    c->elem_size = elem_size;
+    c->mask = rounded - 1;
+    c->slots = malloc(rounded * elem_size);
+    if (kind == CHAN_MPMC) c->turns = malloc(rounded * sizeof(size_t));
+    if (!c->slots || (kind == CHAN_MPMC && !c->turns)) {
+        free(c->slots);
+        free(c->turns);
+        free(c);
+        return NULL;
+    }
+    for (size_t i = 0; c->turns && i < rounded; i++)
+        c->turns[i] = i;
+    return c;
+}
+
+chan chan_create(size_t elem_size, size_t capacity, ChanKind kind) {
+    return chan_new(elem_size, capacity, kind, 0);
+}
+
+chan chan_create_strings(size_t capacity, ChanKind kind) {
+    return chan_new(sizeof(string), capacity, kind, 1);
+}
+
+void chan_close(chan c) {
+    if (!c) return;
+    __atomic_store_n(&c->closed, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&c->not_empty, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&c->not_full, 1, __ATOMIC_RELEASE);
+    futex_wake(&c->not_empty);
+    futex_wake(&c->not_full);
+}
+
+void chan_free(chan c) {
+    if (!c) return;
+    string s;
+    while (c->strings && chan_try_recv(c, &s))
+        rc_release(s);
+    free(c->slots);
+    free(c->turns);
+    free(c);
+}
+
+size_t chan_try_send_batch(chan c, const void *values, size_t count) {
+    if (is_closed(c)) return 0;
+    size_t n = c->kind == CHAN_SPSC ? spsc_send(c, values, count) : mpmc_send(c, values, count);
+    if (n > 0) wake(&c->not_empty, &c->receivers_asleep);
+    return n;
+}
+
+size_t chan_try_recv_batch(chan c, void *values, size_t max) {
+    size_t n = c->kind == CHAN_SPSC ? spsc_recv(c, values, max) : mpmc_recv(c, values, max);
+    if (n > 0) wake(&c->not_full, &c->senders_asleep);
+    return n;
+}
+
+int chan_try_send(chan c, const void *value) { return chan_try_send_batch(c, value, 1) == 1; }
+
+int chan_try_recv(chan c, void *value) { return chan_try_recv_batch(c, value, 1) == 1; }
+
+size_t chan_send_batch(chan c, const void *values, size_t count) {
+    const unsigned char *bytes = values;
+    size_t               sent = 0;
+    while (sent < count && !is_closed(c)) {
+        size_t n = chan_try_send_batch(c, bytes + sent * c->elem_size, count - sent);
+        if (n == 0) wait_for(c, 1);
+        sent += n;
+    }
+    return sent;
+}
+
+size_t chan_recv_batch(chan c, void *values, size_t max) {
+    if (max == 0) return 0;
+    for (;;) {
+        size_t n = chan_try_recv_batch(c, values, max);
+        if (n > 0) return n;
+        // Whatever was sent before the close is still delivered
+        if (is_closed(c)) return chan_try_recv_batch(c, values, max);
+        wait_for(c, 0);
+    }
+}
+
+int chan_send(chan c, const void *value) { return chan_send_batch(c, value, 1) == 1; }
+
+int chan_recv(chan c, void *value) { return chan_recv_batch(c, value, 1) == 1; }
+
+int chan_send_str(chan c, string *s) {
+    if (!chan_send(c, s)) return 0;
+    *s = NULL;
+    return 1;
+}
+
+string chan_recv_str(chan c) {
+    string s;
+    return chan_recv(c, &s) ? s : NULL;
+}
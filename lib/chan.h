@@ -0,0 +1,56 @@
+// chan.h - Bounded lock-free channels between threads
+#ifndef SAM_CHAN_H
+#define SAM_CHAN_H
+
+#include "safety.h"
+#include <stddef.h>
+
+// A channel is a ring of fixed-size slots; capacity rounds up to a power of two.
+//   CHAN_SPSC  one sending and one receiving thread at a time: each side owns
+//              its index and only reads the other's when its cached copy says
+//              the ring is full or empty
+//   CHAN_MPMC  any number of threads on either side: a slot's sequence number
+//              says whose turn it is, and a position is claimed with one CAS
+//              (one per batch)
+// The blocking calls spin briefly, then sleep on a futex that the other side
+// only wakes when someone is asleep. chan_close makes sends fail and lets
+// receivers drain what is left; close once the last send has returned.
+//
+// A string channel moves references: chan_send_str takes the caller's
+// reference and clears the variable, chan_recv_str hands it to the receiver,
+// so nothing is retained or released on the way (the count is never touched
+// by two threads at once). chan_free releases strings nobody received.
+// Channels are not refcounted, since threads share them; free one once every
+// thread is done with it.
+typedef struct Chan *chan;
+
+typedef enum { CHAN_MPMC, CHAN_SPSC } ChanKind;
+
+chan chan_create(size_t elem_size, size_t capacity, ChanKind kind);
+chan chan_create_strings(size_t capacity, ChanKind kind);
+void chan_close(chan c);
+void chan_free(chan c);
+
+// 1 once sent or received; 0 when the channel is closed (and, for receives,
+// drained). The try forms return 0 at once when full or empty.
+int chan_send(chan c, const void *value);
+int chan_recv(chan c, void *value);
+int chan_try_send(chan c, const void *value);
+int chan_try_recv(chan c, void *value);
+
+// Batches claim several slots at once. chan_send_batch blocks until all count
+// values are in (fewer only when closed); chan_recv_batch blocks until at
+// least one arrives and takes up to max. Both return how many moved.
+size_t chan_send_batch(chan c, const void *values, size_t count);
+size_t chan_recv_batch(chan c, void *values, size_t max);
+size_t chan_try_send_batch(chan c, const void *values, size_t count);
+size_t chan_try_recv_batch(chan c, void *values, size_t max);
+
+// Strings: send clears *s on success and leaves it alone when closed; receive
+// returns NULL once closed and drained
+int    chan_send_str(chan c, string *s);
+string chan_recv_str(chan c);
+
+#define chan_of(T, capacity) chan_create(sizeof(T), (capacity), CHAN_MPMC)
+
+#endif
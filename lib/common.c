@@ -1,5 +1,7 @@
-// lib/common.c - Basic string utilities
+#define _POSIX_C_SOURCE 200809L
+// lib/common.c - Basic string utilities, and the helpers the transpiler passes share
 #include "common.h"
+#include <ctype.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -46,3 +48,208 @@ void error(const char *format, ...) {
     va_end(args);
     exit(1);
 }
+
+// =========================== [ LINE BUFFERS ] ====================================
+
+void push_numbered_line(LineBuffer *buf, const char *line, int number) {
+    if (buf->count >= buf->capacity) {
+        buf->capacity = buf->capacity ? buf->capacity * 2 : 64;
+        buf->lines = realloc(buf->lines, sizeof(char *) * buf->capacity);
+        buf->numbers = realloc(buf->numbers, sizeof(int) * buf->capacity);
+    }
+    buf->numbers[buf->count] = number;
+    buf->lines[buf->count++] = strdup(line);
+}
+
+void push_line(LineBuffer *buf, const char *line) { push_numbered_line(buf, line, buf->count + 1); }
+
+void free_lines(LineBuffer *buf) {
+    for (int i = 0; i < buf->count; i++)
+        free(buf->lines[i]);
+    free(buf->lines);
+    free(buf->numbers);
+    buf->lines = NULL;
+    buf->numbers = NULL;
+    buf->count = buf->capacity = 0;
+}
+
+int block_end(const LineBuffer *buf, int header) {
+    int depth = 0;
+    for (int i = header; i < buf->count; i++) {
+        depth += brace_delta(buf->lines[i]);
+        if (depth <= 0) return i;
+    }
+    return buf->count - 1;
+}
+
+// =========================== [ PASS ERRORS ] =====================================
+
+int pass_errors;
+
+void report(int number, const char *message, const char *detail) {
+    fprintf(stderr, "Error: line %d: %s%s\n", number, message, detail);
+    pass_errors++;
+}
+
+// =========================== [ TEXT ] ============================================
+
+int is_ident_char(int ch) { return isalnum((unsigned char)ch) || ch == '_'; }
+
+int brace_delta(const char *line) {
+    int delta = 0;
+    int in_string = 0, in_char = 0;
+
+    for (const char *p = line; *p; p++) {
+        if (*p == '\\' && (in_string || in_char) && p[1]) {
+            p++;
+            continue;
+        }
+        if (*p == '"' && !in_char) in_string = !in_string;
+        if (*p == '\'' && !in_string) in_char = !in_char;
+        if (in_string || in_char) continue;
+        if (*p == '/' && p[1] == '/') break;
+        if (*p == '{') delta++;
+        if (*p == '}') delta--;
+    }
+    return delta;
+}
+
+// Does word start p, followed by something that is not part of a name? Returns
+// what follows it, past any blanks
+const char *match_word(const char *p, const char *word) {
+    size_t len = strlen(word);
+    if (strncmp(p, word, len) != 0 || is_ident_char((unsigned char)p[len])) return NULL;
+    p += len;
+    return p + strspn(p, " \t");
+}
+
+void trim(char *text) {
+    size_t start = strspn(text, " \t\n");
+    size_t len = strlen(text + start);
+    memmove(text, text + start, len + 1);
+    while (len > 0 && isspace((unsigned char)text[len - 1]))
+        text[--len] = '\0';
+}
+
+// Copies what is inside the parentheses opening at p; returns the text
+// after the closing one, or NULL when they do not close on this line
+const char *copy_parens(const char *p, char *text, size_t size) {
+    if (*p != '(') return NULL;
+    int nesting = 0;
+    for (const char *q = p; *q; q++) {
+        if (*q == '(') nesting++;
+        if (*q == ')' && --nesting == 0) {
+            size_t len = q - p - 1;
+            if (len >= size) return NULL;
+            memcpy(text, p + 1, len);
+            text[len] = '\0';
+            return q + 1 + strspn(q + 1, " \t");
+        }
+    }
+    return NULL;
+}
+
+// =========================== [ TOKENIZER ] =======================================
+
+static void push_token(TokenStream *ts, int start, int end, TokenKind kind, int block, int in_return) {
+    if (ts->tok_count >= ts->tok_capacity) {
+        ts->tok_capacity = ts->tok_capacity ? ts->tok_capacity * 2 : 1024;
+        ts->toks = realloc(ts->toks, sizeof(Token) * ts->tok_capacity);
+    }
+    ts->toks[ts->tok_count++] = (Token){start, end, kind, block, in_return};
+}
+
+static int push_block(TokenStream *ts, int open, int parent) {
+    if (ts->block_count >= ts->block_capacity) {
+        ts->block_capacity = ts->block_capacity ? ts->block_capacity * 2 : 64;
+        ts->blocks = realloc(ts->blocks, sizeof(Block) * ts->block_capacity);
+    }
+    ts->blocks[ts->block_count] = (Block){open, -1, parent};
+    return ts->block_count++;
+}
+
+int tok_is(const TokenStream *ts, int i, const char *text) {
+    if (i < 0 || i >= ts->tok_count) return 0;
+    int len = ts->toks[i].end - ts->toks[i].start;
+    return len == (int)strlen(text) && memcmp(ts->src + ts->toks[i].start, text, len) == 0;
+}
+
+int tok_same(const TokenStream *ts, int a, int b) {
+    int len = ts->toks[a].end - ts->toks[a].start;
+    return len == ts->toks[b].end - ts->toks[b].start &&
+           memcmp(ts->src + ts->toks[a].start, ts->src + ts->toks[b].start, len) == 0;
+}
+
+void tokenize(TokenStream *ts) {
+    const char *s = ts->src;
+    int         i = 0, block = -1, in_return = 0, line_start = 1;
+
+    while (s[i]) {
+        int start = i;
+        if (s[i] == '\n') {
+            line_start = 1;
+            i++;
+            continue;
+        }
+        if (isspace((unsigned char)s[i])) {
+            i++;
+            continue;
+        }
+        if (line_start && s[i] == '#') {
+            while (s[i] && !(s[i] == '\n' && s[i - 1] != '\\'))
+                i++;
+            continue;
+        }
+        line_start = 0;
+
+        if (s[i] == '/' && s[i + 1] == '/') {
+            while (s[i] && s[i] != '\n')
+                i++;
+        } else if (s[i] == '/' && s[i + 1] == '*') {
+            for (i += 2; s[i] && !(s[i] == '*' && s[i + 1] == '/'); i++)
+                ;
+            if (s[i]) i += 2;
+        } else if (s[i] == '"' || s[i] == '\'') {
+            char quote = s[i++];
+            while (s[i] && s[i] != quote) {
+                if (s[i] == '\\' && s[i + 1]) i++;
+                i++;
+            }
+            if (s[i]) i++;
+            push_token(ts, start, i, TOK_OTHER, block, in_return);
+        } else if (isalpha((unsigned char)s[i]) || s[i] == '_') {
+            while (isalnum((unsigned char)s[i]) || s[i] == '_')
+                i++;
+            push_token(ts, start, i, TOK_IDENT, block, in_return);
+            if (tok_is(ts, ts->tok_count - 1, "return")) in_return = 1;
+        } else if (isdigit((unsigned char)s[i])) {
+            while (isalnum((unsigned char)s[i]) || s[i] == '.' || s[i] == '_')
+                i++;
+            push_token(ts, start, i, TOK_OTHER, block, in_return);
+        } else {
+            // Two-character operators matter only so `==` is never taken for `=`
+            int two = s[i + 1] && strchr("=!<>+-*/&|", s[i]) &&
+                      (s[i + 1] == '=' || (s[i + 1] == s[i] && strchr("+-&|", s[i])));
+            i += two ? 2 : 1;
+            if (s[start] == '{' && !two) {
+                block = push_block(ts, ts->tok_count, block);
+                push_token(ts, start, i, TOK_PUNCT, block, in_return);
+            } else if (s[start] == '}' && !two && block >= 0) {
+                push_token(ts, start, i, TOK_PUNCT, block, in_return);
+                ts->blocks[block].close = ts->tok_count - 1;
+                block = ts->blocks[block].parent;
+            } else {
+                push_token(ts, start, i, TOK_PUNCT, block, in_return);
+            }
+            if (s[start] == ';' || s[start] == '{' || s[start] == '}') in_return = 0;
+        }
+    }
+}
+
+void free_tokens(TokenStream *ts) {
+    free(ts->toks);
+    free(ts->blocks);
+    ts->toks = NULL;
+    ts->blocks = NULL;
+    ts->tok_count = ts->tok_capacity = ts->block_count = ts->block_capacity = 0;
+}
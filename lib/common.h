@@ -19,4 +19,59 @@ void   string_free(String *str);
 // Error handling
 void error(const char *format, ...);
 
+// ===== Transpiler pass helpers =====
+
+// The lines of a pass's input, each with the line number errors report
+typedef struct {
+    char **lines;
+    int   *numbers;
+    int    count;
+    int    capacity;
+} LineBuffer;
+
+void push_line(LineBuffer *buf, const char *line); // Numbered by its position
+void push_numbered_line(LineBuffer *buf, const char *line, int number);
+void free_lines(LineBuffer *buf);
+int  block_end(const LineBuffer *buf, int header); // Line closing the block opened at header
+
+// Errors: report prints one and counts it in pass_errors, which each pass
+// clears when it starts and returns when it is done
+extern int pass_errors;
+void       report(int number, const char *message, const char *detail);
+
+int         is_ident_char(int ch);
+int         brace_delta(const char *line); // Net brace change, ignoring literals and comments
+const char *match_word(const char *p, const char *word);
+void        trim(char *text);
+const char *copy_parens(const char *p, char *text, size_t size);
+
+// A C source split into tokens, with the blocks its braces open. Comments and
+// preprocessor lines produce no tokens; literals become one token each.
+typedef enum { TOK_IDENT, TOK_PUNCT, TOK_OTHER } TokenKind;
+
+typedef struct {
+    int       start, end; // Byte range in the source
+    TokenKind kind;
+    int       block;     // Innermost enclosing block, -1 at file scope
+    int       in_return; // Part of a return statement
+} Token;
+
+typedef struct {
+    int open, close; // Token indices of the braces
+    int parent;
+} Block;
+
+typedef struct {
+    const char *src;
+    Token      *toks;
+    int         tok_count, tok_capacity;
+    Block      *blocks;
+    int         block_count, block_capacity;
+} TokenStream;
+
+void tokenize(TokenStream *ts); // Tokenizes ts->src
+void free_tokens(TokenStream *ts);
+int  tok_is(const TokenStream *ts, int i, const char *text);
+int  tok_same(const TokenStream *ts, int a, int b);
+
 #endif
@@ -0,0 +1,1246 @@
+#define _POSIX_C_SOURCE 200809L
+// lib/comptime.c - Evaluate `comptime` declarations and expressions while translating
+//
+//     comptime int PAGE = 4 * 1024
+//     comptime uint32_t crc_table[256] {
+//         for (uint32_t n = 0; n < 256; n++) {
+//             uint32_t c = n
+//             for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1
+//             crc_table[n] = c
+//         }
+//     }
+//     char buf[comptime(PAGE * 2)]
+//
+// becomes
+//
+//     static const int PAGE __attribute__((unused)) = 4096;
+//     static const uint32_t crc_table[256] __attribute__((unused)) = {
+//         0, 1996959894, 3993919788, ...
+//     };
+//     char buf[8192];
+//
+// The attribute keeps -Wunused from flagging a name whose every use was a
+// `comptime(...)` that is now a literal.
+// A declaration takes `= expression` (a `{...}` list for an array) or a block
+// that fills it in: the block runs with the variable zeroed, and what it
+// holds at the end is emitted. `comptime(expr)` anywhere else is replaced by
+// its value. The code is interpreted straight from the text and covers
+// integer and floating-point scalars and arrays of up to two dimensions, C's
+// operators with C's promotions and wrap-around, if/for/while/do with break
+// and continue, sizeof on types and the <math.h> functions. Names from
+// earlier comptime declarations can be read. Runtime variables, pointers,
+// strings and calls to Sam functions are errors, and so is a loop that runs
+// past COMPTIME_STEPS iterations in all.
+//
+// This runs right after add_semicolons. add_arena_support evaluates
+// `arena(...)` sizes with comptime_eval, so they may use these names too.
+#include "common.h"
+#include "comptime.h"
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COMPTIME_STEPS 10000000L
+#define MAX_VARS 256
+#define MAX_ELEMENTS (1 << 20)
+
+typedef struct {
+    char           name[64];
+    char           type_text[64]; // As written, for the emitted declaration
+    ComptimeValue  type;          // Element type
+    int            dims[2];
+    int            rank; // 0 for scalars
+    ComptimeValue *values;
+    int            readonly; // Declared by an earlier comptime declaration
+} Var;
+
+typedef struct {
+    const char *p;
+    const char *end;
+    int         skip; // Parsing without executing: a branch not taken, or an error
+    int         breaking;
+    int         continuing;
+    long        steps;
+    const char *error_at;
+    char        error[160];
+} Eval;
+
+// An expression's value, and where it lives when it names a variable
+typedef struct {
+    ComptimeValue value;
+    ComptimeValue *slot;
+    Var           *var;
+} Operand;
+
+static Var globals[MAX_VARS]; // comptime declarations so far
+static int global_count;
+static Var locals[MAX_VARS];  // The running block's, innermost last
+static int local_count;
+
+static const ComptimeValue int_type = {0, 32, 0, 0, 0};
+
+// =========================== [ HELPERS ] =========================================
+
+// =========================== [ VALUES ] =========================================
+
+static ComptimeValue type_of(ComptimeValue v) {
+    v.i = 0;
+    v.f = 0;
+    return v;
+}
+
+static ComptimeValue float_type(int bits) {
+    ComptimeValue t = {1, bits, 0, 0, 0};
+    return t;
+}
+
+static ComptimeValue int_value(long long i) {
+    ComptimeValue v = int_type;
+    v.i = i;
+    return v;
+}
+
+static double to_double(ComptimeValue v) {
+    if (v.is_float) return v.f;
+    return v.is_unsigned ? (double)(unsigned long long)v.i : (double)v.i;
+}
+
+static int truthy(ComptimeValue v) { return v.is_float ? v.f != 0 : v.i != 0; }
+
+static void fail(Eval *e, const char *format, ...) {
+    if (!e->error[0]) {
+        va_list args;
+        va_start(args, format);
+        vsnprintf(e->error, sizeof(e->error), format, args);
+        va_end(args);
+        e->error_at = e->p;
+    }
+    e->skip++;
+    e->p = e->end; // Nothing left to parse
+}
+
+static int running(const Eval *e) { return !e->skip && !e->breaking && !e->continuing; }
+
+// v as a value of type, wrapping integers to its width the way C converts
+static ComptimeValue convert(Eval *e, ComptimeValue v, ComptimeValue type) {
+    ComptimeValue r = type_of(type);
+    if (type.is_float) {
+        r.f = type.bits == 32 ? (double)(float)to_double(v) : to_double(v);
+        return r;
+    }
+    if (type.bits == 1) {
+        r.i = truthy(v);
+        return r;
+    }
+    unsigned long long u = (unsigned long long)v.i;
+    if (v.is_float) {
+        if (!(v.f > -9.3e18 && v.f < 1.8e19)) {
+            if (e) fail(e, "%g does not fit an integer", v.f);
+            return r;
+        }
+        u = v.f < 0 ? (unsigned long long)(long long)v.f : (unsigned long long)v.f;
+    }
+    if (type.bits < 64) {
+        u &= (1ULL << type.bits) - 1;
+        if (!type.is_unsigned && (u >> (type.bits - 1)) & 1) u |= ~0ULL << type.bits;
+    }
+    r.i = (long long)u;
+    return r;
+}
+
+// Integer promotion: anything narrower than int computes as int
+static ComptimeValue promote(ComptimeValue v) {
+    return !v.is_float && v.bits < 32 ? convert(NULL, v, int_type) : v;
+}
+
+// The usual arithmetic conversions
+static ComptimeValue common_type(ComptimeValue a, ComptimeValue b) {
+    if (a.is_float || b.is_float)
+        return float_type((a.is_float && a.bits == 64) || (b.is_float && b.bits == 64) ? 64 : 32);
+    a = promote(a);
+    b = promote(b);
+    if (a.bits != b.bits) return type_of(a.bits > b.bits ? a : b);
+    a.is_unsigned = a.is_unsigned || b.is_unsigned;
+    return type_of(a);
+}
+
+static ComptimeValue binary(Eval *e, const char *op, ComptimeValue a, ComptimeValue b) {
+    if (!running(e)) return type_of(common_type(a, b));
+
+    if (strcmp(op, "<<") == 0 || strcmp(op, ">>") == 0) {
+        if (a.is_float || b.is_float) {
+            fail(e, "shift of a floating-point value");
+            return a;
+        }
+        a = promote(a);
+        long long n = promote(b).i;
+        if (n < 0 || n >= a.bits) {
+            fail(e, "shift by %lld of a %d-bit value", n, a.bits);
+            return a;
+        }
+        ComptimeValue      r = type_of(a);
+        unsigned long long u = (unsigned long long)a.i;
+        if (op[0] == '<')
+            r.i = (long long)(u << n);
+        else
+            r.i = a.is_unsigned ? (long long)((a.bits < 64 ? u & ((1ULL << a.bits) - 1) : u) >> n) : a.i >> n;
+        return convert(e, r, a);
+    }
+
+    ComptimeValue t = common_type(a, b);
+    a = convert(e, a, t);
+    b = convert(e, b, t);
+    int compare = !strcmp(op, "<") || !strcmp(op, "<=") || !strcmp(op, ">") || !strcmp(op, ">=") ||
+                  !strcmp(op, "==") || !strcmp(op, "!=");
+    if (t.is_float) {
+        double x = a.f, y = b.f;
+        if (compare) {
+            int less = x < y, equal = x == y;
+            return int_value(op[0] == '<'   ? (op[1] ? less || equal : less)
+                             : op[0] == '>' ? (op[1] ? !less : !less && !equal)
+                             : op[0] == '=' ? equal
+                                            : !equal);
+        }
+        ComptimeValue r = t;
+        switch (op[0]) {
+        case '+': r.f = x + y; break;
+        case '-': r.f = x - y; break;
+        case '*': r.f = x * y; break;
+        case '/': r.f = x / y; break;
+        default: fail(e, "'%s' needs integer operands", op); return t;
+        }
+        return convert(e, r, t);
+    }
+
+    unsigned long long x = (unsigned long long)a.i, y = (unsigned long long)b.i;
+    if (compare) {
+        int less = t.is_unsigned ? x < y : a.i < b.i, equal = x == y;
+        return int_value(op[0] == '<'   ? (op[1] ? less || equal : less)
+                         : op[0] == '>' ? (op[1] ? !less : !less && !equal)
+                         : op[0] == '=' ? equal
+                                        : !equal);
+    }
+    ComptimeValue r = t;
+    switch (op[0]) {
+    case '+': r.i = (long long)(x + y); break;
+    case '-': r.i = (long long)(x - y); break;
+    case '*': r.i = (long long)(x * y); break;
+    case '&': r.i = (long long)(x & y); break;
+    case '|': r.i = (long long)(x | y); break;
+    case '^': r.i = (long long)(x ^ y); break;
+    case '/':
+    case '%':
+        if (y == 0) {
+            fail(e, "division by zero");
+            return t;
+        }
+        if (t.is_unsigned)
+            r.i = (long long)(op[0] == '/' ? x / y : x % y);
+        else if (b.i == -1)
+            r.i = op[0] == '/' ? (long long)(0 - x) : 0; // Wraps like the other operators
+        else
+            r.i = op[0] == '/' ? a.i / b.i : a.i % b.i;
+        break;
+    }
+    return convert(e, r, t);
+}
+
+// =========================== [ LEXING ] =========================================
+
+// Skips white space and comments; stops at a newline when lines is 0
+static void skip_space(Eval *e, int lines) {
+    for (;;) {
+        while (*e->p == ' ' || *e->p == '\t' || *e->p == '\r' || (lines && *e->p == '\n'))
+            e->p++;
+        if (e->p[0] == '/' && e->p[1] == '/') {
+            while (*e->p && *e->p != '\n')
+                e->p++;
+        } else if (e->p[0] == '/' && e->p[1] == '*') {
+            const char *close = strstr(e->p + 2, "*/");
+            e->p = close ? close + 2 : e->end;
+        } else {
+            return;
+        }
+    }
+}
+
+// Longest operator or punctuator at p
+static size_t operator_length(const char *p) {
+    if (!*p) return 0;
+    if (p[1] == '=' && strchr("=!<>+-*/%&|^", *p)) return 2;
+    if ((p[0] == '<' || p[0] == '>') && p[1] == p[0]) return p[2] == '=' ? 3 : 2;
+    if (p[1] == p[0] && strchr("&|+-", *p)) return 2;
+    if (p[0] == '-' && p[1] == '>') return 2;
+    return 1;
+}
+
+// Consumes the operator or word token when it comes next
+static int accept(Eval *e, const char *token) {
+    const char *start = e->p;
+    size_t      len = strlen(token);
+    skip_space(e, 1);
+    int match = *e->p == token[0] &&
+                (is_ident_char((unsigned char)token[0])
+                     ? match_word(e->p, token) != NULL
+                     : operator_length(e->p) == len && strncmp(e->p, token, len) == 0);
+    e->p = match ? e->p + len : start;
+    return match;
+}
+
+static void expect(Eval *e, const char *token) {
+    if (!accept(e, token)) fail(e, "expected '%s'", token);
+}
+
+static int identifier(Eval *e, char *name, size_t size) {
+    skip_space(e, 1);
+    size_t len = 0;
+    if (!isalpha((unsigned char)*e->p) && *e->p != '_') return 0;
+    while (is_ident_char((unsigned char)e->p[len]))
+        len++;
+    if (len >= size) {
+        fail(e, "name too long");
+        return 0;
+    }
+    memcpy(name, e->p, len);
+    name[len] = '\0';
+    e->p += len;
+    return 1;
+}
+
+// `;`, or the end of the line for statements add_semicolons left alone
+static void end_statement(Eval *e) {
+    skip_space(e, 0);
+    if (*e->p == ';')
+        e->p++;
+    else if (*e->p && *e->p != '\n' && *e->p != '}')
+        fail(e, "expected ';'");
+}
+
+// =========================== [ TYPES ] =========================================
+
+static const struct {
+    const char *name;
+    int         bits;
+    int         is_unsigned;
+} named_types[] = {
+    {"int8_t", 8, 0},     {"int16_t", 16, 0},  {"int32_t", 32, 0},   {"int64_t", 64, 0},
+    {"uint8_t", 8, 1},    {"uint16_t", 16, 1}, {"uint32_t", 32, 1},  {"uint64_t", 64, 1},
+    {"size_t", 64, 1},    {"ssize_t", 64, 0},  {"ptrdiff_t", 64, 0}, {"intptr_t", 64, 0},
+    {"uintptr_t", 64, 1}, {"bool", 1, 1},      {"_Bool", 1, 1},
+};
+
+// A scalar type such as `unsigned char` or `uint32_t`, and its text; 0 with
+// nothing consumed when p does not start one
+static int parse_type(Eval *e, ComptimeValue *type, char *text, size_t size) {
+    const char *start = e->p;
+    int         is_unsigned = 0, longs = 0, base = 0, words = 0; // base: 'c', 's', 'i', 'f', 'd', 'n'
+    ComptimeValue named = int_type;
+    char          word[64];
+    size_t        used = 0;
+
+    text[0] = '\0';
+    for (;;) {
+        const char *before = e->p;
+        if (!identifier(e, word, sizeof(word))) break;
+        int known = 1;
+        if (strcmp(word, "const") == 0 || strcmp(word, "volatile") == 0 || strcmp(word, "signed") == 0) {
+        } else if (strcmp(word, "unsigned") == 0) {
+            is_unsigned = 1;
+        } else if (strcmp(word, "long") == 0) {
+            longs++;
+        } else if (strcmp(word, "char") == 0 && !base) {
+            base = 'c';
+        } else if (strcmp(word, "short") == 0 && !base) {
+            base = 's';
+        } else if (strcmp(word, "int") == 0 && (!base || base == 's')) {
+            base = base ? base : 'i';
+        } else if (strcmp(word, "float") == 0 && !base) {
+            base = 'f';
+        } else if (strcmp(word, "double") == 0 && !base) {
+            base = 'd';
+        } else {
+            known = 0;
+            for (size_t i = 0; !base && i < sizeof(named_types) / sizeof(named_types[0]); i++) {
+                if (strcmp(word, named_types[i].name) == 0) {
+                    named.bits = named_types[i].bits;
+                    named.is_unsigned = named_types[i].is_unsigned;
+                    base = 'n';
+                    known = 1;
+                }
+            }
+        }
+        if (!known) {
+            e->p = before;
+            break;
+        }
+        words++;
+        if (used < size) used += snprintf(text + used, size - used, "%s%s", used ? " " : "", word);
+    }
+    if (!words) {
+        e->p = start;
+        return 0;
+    }
+
+    if (base == 'f' || base == 'd') {
+        *type = float_type(base == 'f' ? 32 : 64);
+    } else if (base == 'n') {
+        *type = named;
+    } else {
+        *type = int_type;
+        type->bits = base == 'c' ? 8 : base == 's' ? 16 : longs ? 64 : 32;
+        type->is_unsigned = is_unsigned;
+    }
+    return 1;
+}
+
+// =========================== [ VARIABLES ] =========================================
+
+static size_t element_count(const Var *v) {
+    size_t count = 1;
+    for (int d = 0; d < v->rank; d++)
+        count *= (size_t)v->dims[d];
+    return count;
+}
+
+static Var *find_var(const char *name) {
+    for (int i = local_count - 1; i >= 0; i--) {
+        if (strcmp(locals[i].name, name) == 0) return &locals[i];
+    }
+    for (int i = 0; i < global_count; i++) {
+        if (strcmp(globals[i].name, name) == 0) return &globals[i];
+    }
+    return NULL;
+}
+
+static void pop_locals(int base) {
+    while (local_count > base)
+        free(locals[--local_count].values);
+}
+
+// Allocates v's elements, zeroed; 0 after failing when they are too many
+static int allocate(Eval *e, Var *v) {
+    size_t count = element_count(v);
+    if (count == 0 || count > MAX_ELEMENTS) {
+        fail(e, "'%s' must have between 1 and %d elements", v->name, MAX_ELEMENTS);
+        return 0;
+    }
+    v->values = malloc(count * sizeof(ComptimeValue));
+    for (size_t i = 0; v->values && i < count; i++)
+        v->values[i] = v->type;
+    return v->values != NULL;
+}
+
+// =========================== [ EXPRESSIONS ] =========================================
+
+static Operand parse_assignment(Eval *e);
+static Operand parse_unary(Eval *e);
+
+static ComptimeValue parse_expression(Eval *e) {
+    Operand o = parse_assignment(e);
+    while (accept(e, ","))
+        o = parse_assignment(e);
+    return o.value;
+}
+
+static ComptimeValue parse_number(Eval *e) {
+    const char *start = e->p, *q = e->p;
+    int         hex = start[0] == '0' && (start[1] == 'x' || start[1] == 'X'), is_float = 0;
+    while (is_ident_char((unsigned char)*q) || *q == '.' ||
+           (!hex && (*q == '+' || *q == '-') && (q[-1] == 'e' || q[-1] == 'E'))) {
+        is_float |= *q == '.' || (!hex && (*q == 'e' || *q == 'E'));
+        q++;
+    }
+    char *end;
+    if (is_float) {
+        ComptimeValue v = float_type(64);
+        v.f = strtod(start, &end);
+        if (*end == 'f' || *end == 'F') v = convert(e, v, float_type(32)), end++;
+        else if (*end == 'l' || *end == 'L') end++;
+        if (end != q) fail(e, "bad number '%.*s'", (int)(q - start), start);
+        e->p = q;
+        return v;
+    }
+
+    unsigned long long u = strtoull(start, &end, 0);
+    int                has_u = 0, longs = 0;
+    for (; end < q && (*end == 'u' || *end == 'U' || *end == 'l' || *end == 'L'); end++) {
+        has_u |= *end == 'u' || *end == 'U';
+        longs += *end == 'l' || *end == 'L';
+    }
+    if (end != q) fail(e, "bad number '%.*s'", (int)(q - start), start);
+    e->p = q;
+
+    // The first of C's candidate types that holds the value
+    ComptimeValue v = int_type;
+    v.i = (long long)u;
+    if (!longs && !has_u && u <= INT_MAX) return v;
+    if (!longs && (has_u || start[0] == '0') && u <= UINT_MAX) {
+        v.is_unsigned = 1;
+        return v;
+    }
+    v.bits = 64;
+    v.is_unsigned = has_u || u > LLONG_MAX;
+    if (v.is_unsigned && !has_u && start[0] != '0') fail(e, "%llu does not fit a long long", u);
+    return v;
+}
+
+static ComptimeValue parse_char(Eval *e) {
+    const char *p = e->p + 1;
+    long long   ch = (unsigned char)*p++;
+    if (ch == '\\') {
+        char escape = *p++;
+        switch (escape) {
+        case 'n': ch = '\n'; break;
+        case 't': ch = '\t'; break;
+        case 'r': ch = '\r'; break;
+        case '0': ch = 0; break;
+        case 'x': ch = strtol(p, (char **)&p, 16); break;
+        default: ch = (unsigned char)escape; break;
+        }
+    }
+    if (*p != '\'') fail(e, "bad character literal");
+    e->p = p + 1;
+    return int_value((char)ch);
+}
+
+static const struct {
+    const char *name;
+    double (*one)(double);
+    double (*two)(double, double);
+} math_functions[] = {
+    {"sin", sin, NULL},     {"cos", cos, NULL},     {"tan", tan, NULL},       {"asin", asin, NULL},
+    {"acos", acos, NULL},   {"atan", atan, NULL},   {"sinh", sinh, NULL},     {"cosh", cosh, NULL},
+    {"tanh", tanh, NULL},   {"exp", exp, NULL},     {"exp2", exp2, NULL},     {"log", log, NULL},
+    {"log2", log2, NULL},   {"log10", log10, NULL}, {"sqrt", sqrt, NULL},     {"cbrt", cbrt, NULL},
+    {"fabs", fabs, NULL},   {"floor", floor, NULL}, {"ceil", ceil, NULL},     {"round", round, NULL},
+    {"trunc", trunc, NULL}, {"pow", NULL, pow},     {"atan2", NULL, atan2},   {"fmod", NULL, fmod},
+    {"fmin", NULL, fmin},   {"fmax", NULL, fmax},   {"hypot", NULL, hypot},
+};
+
+static ComptimeValue call(Eval *e, const char *name) {
+    int is_abs = strcmp(name, "abs") == 0 || strcmp(name, "labs") == 0 || strcmp(name, "llabs") == 0;
+    int arity = strcmp(name, "comptime") == 0 || is_abs ? 1 : 0;
+    for (size_t i = 0; !arity && i < sizeof(math_functions) / sizeof(math_functions[0]); i++) {
+        if (strcmp(name, math_functions[i].name) == 0) arity = math_functions[i].one ? 1 : 2;
+    }
+    if (!arity) {
+        fail(e, "%s() cannot run at compile time", name);
+        return int_type;
+    }
+
+    ComptimeValue args[2];
+    int           count = 0;
+    if (!accept(e, ")")) {
+        do {
+            ComptimeValue arg = parse_assignment(e).value;
+            if (count < 2) args[count] = arg;
+            count++;
+        } while (accept(e, ","));
+        expect(e, ")");
+    }
+    if (count != arity) {
+        fail(e, "%s() takes %d argument%s", name, arity, arity == 1 ? "" : "s");
+        return int_type;
+    }
+
+    if (strcmp(name, "comptime") == 0) return args[0];
+    if (is_abs) {
+        ComptimeValue v = promote(args[0]);
+        return v.is_float || v.i >= 0 ? v : binary(e, "-", convert(e, int_value(0), v), v);
+    }
+    ComptimeValue r = float_type(64);
+    for (size_t i = 0; running(e) && i < sizeof(math_functions) / sizeof(math_functions[0]); i++) {
+        if (strcmp(name, math_functions[i].name) == 0)
+            r.f = math_functions[i].one ? math_functions[i].one(to_double(args[0]))
+                                        : math_functions[i].two(to_double(args[0]), to_double(args[1]));
+    }
+    return r;
+}
+
+// A variable, indexed down to one element
+static Operand variable(Eval *e, const char *name) {
+    Operand o = {int_type, NULL, NULL};
+    Var    *v = find_var(name);
+    if (!v) {
+        if (running(e)) fail(e, "'%s' is not a comptime value", name);
+        return o;
+    }
+    size_t index = 0;
+    for (int d = 0; d < v->rank; d++) {
+        expect(e, "[");
+        ComptimeValue i = promote(parse_expression(e));
+        expect(e, "]");
+        if (running(e) && (i.is_float || i.i < 0 || i.i >= v->dims[d])) {
+            fail(e, "index %lld is out of bounds for '%s'", i.i, name);
+            return o;
+        }
+        index = index * v->dims[d] + (size_t)i.i;
+    }
+    skip_space(e, 1);
+    if (*e->p == '[') fail(e, "'%s' has %d dimension%s", name, v->rank, v->rank == 1 ? "" : "s");
+    if (!running(e)) return (Operand){v->type, NULL, NULL};
+    o.var = v;
+    o.slot = &v->values[index];
+    o.value = *o.slot;
+    return o;
+}
+
+static Operand parse_primary(Eval *e) {
+    Operand o = {int_type, NULL, NULL};
+    char    name[64];
+    skip_space(e, 1);
+
+    if (isdigit((unsigned char)*e->p) || (*e->p == '.' && isdigit((unsigned char)e->p[1]))) {
+        o.value = parse_number(e);
+    } else if (*e->p == '\'') {
+        o.value = parse_char(e);
+    } else if (accept(e, "(")) {
+        ComptimeValue type;
+        char          text[64];
+        if (parse_type(e, &type, text, sizeof(text))) {
+            expect(e, ")");
+            o.value = convert(e, parse_unary(e).value, type);
+        } else {
+            o.value = parse_expression(e);
+            expect(e, ")");
+        }
+    } else if (identifier(e, name, sizeof(name))) {
+        if (strcmp(name, "sizeof") == 0) {
+            ComptimeValue type;
+            char          text[64];
+            expect(e, "(");
+            if (!parse_type(e, &type, text, sizeof(text))) fail(e, "sizeof needs a type here");
+            expect(e, ")");
+            o.value = int_value(type.bits == 1 ? 1 : type.bits / 8);
+            o.value.bits = 64;
+            o.value.is_unsigned = 1;
+        } else if (accept(e, "(")) {
+            o.value = call(e, name);
+        } else {
+            o = variable(e, name);
+        }
+    } else {
+        fail(e, *e->p ? "unexpected '%c'" : "unexpected end%c", *e->p);
+    }
+    return o;
+}
+
+static void step(Eval *e, Operand *o, int delta) {
+    if (!running(e)) return;
+    if (!o->slot) {
+        fail(e, "++ and -- need a variable");
+        return;
+    }
+    if (o->var->readonly) {
+        fail(e, "'%s' is read-only here", o->var->name);
+        return;
+    }
+    *o->slot = convert(e, binary(e, "+", *o->slot, int_value(delta)), *o->slot);
+}
+
+static Operand parse_postfix(Eval *e) {
+    Operand o = parse_primary(e);
+    for (;;) {
+        if (accept(e, "++")) {
+            step(e, &o, 1);
+        } else if (accept(e, "--")) {
+            step(e, &o, -1);
+        } else {
+            return o;
+        }
+        o.slot = NULL; // The old value, no longer a variable
+    }
+}
+
+static Operand parse_unary(Eval *e) {
+    Operand o;
+    if (accept(e, "++") || accept(e, "--")) {
+        int delta = e->p[-1] == '+' ? 1 : -1;
+        o = parse_unary(e);
+        step(e, &o, delta);
+        if (o.slot) o.value = *o.slot;
+    } else if (accept(e, "-")) {
+        o = parse_unary(e);
+        o.value = binary(e, "-", convert(e, int_value(0), promote(o.value)), o.value);
+    } else if (accept(e, "+")) {
+        o = parse_unary(e);
+        o.value = promote(o.value);
+    } else if (accept(e, "!")) {
+        o = parse_unary(e);
+        o.value = int_value(!truthy(o.value));
+    } else if (accept(e, "~")) {
+        o = parse_unary(e);
+        if (o.value.is_float) fail(e, "'~' needs an integer operand");
+        o.value = promote(o.value);
+        o.value = convert(e, int_value(~o.value.i), o.value);
+    } else {
+        return parse_postfix(e);
+    }
+    o.slot = NULL;
+    return o;
+}
+
+// Binding strength of a binary operator, 0 for anything else
+static int precedence(const char *op, size_t len) {
+    static const struct {
+        const char *op;
+        int         precedence;
+    } table[] = {
+        {"||", 1}, {"&&", 2}, {"|", 3},  {"^", 4},  {"&", 5},  {"==", 6},  {"!=", 6}, {"<", 7}, {"<=", 7},
+        {">", 7},  {">=", 7}, {"<<", 8}, {">>", 8}, {"+", 9},  {"-", 9},   {"*", 10}, {"/", 10}, {"%", 10},
+    };
+    for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+        if (strlen(table[i].op) == len && strncmp(op, table[i].op, len) == 0) return table[i].precedence;
+    }
+    return 0;
+}
+
+// Operators binding at least as tightly as lowest, left to right
+static Operand parse_binary(Eval *e, int lowest) {
+    Operand left = parse_unary(e);
+
+    for (;;) {
+        const char *start = e->p;
+        skip_space(e, 1);
+        size_t len = operator_length(e->p);
+        int    level = precedence(e->p, len);
+        if (level < lowest || level == 0) {
+            e->p = start;
+            return left;
+        }
+        char op[4] = {0};
+        memcpy(op, e->p, len);
+        e->p += len;
+
+        if (level <= 2) {
+            // Short-circuit: the right side runs only when it decides the result
+            int run = running(e), decided = run && (level == 1) == truthy(left.value);
+            if (decided) e->skip++;
+            Operand right = parse_binary(e, level + 1);
+            if (decided) e->skip--;
+            left.value = int_value(run && (decided ? level == 1 : truthy(right.value)));
+        } else {
+            Operand right = parse_binary(e, level + 1);
+            left.value = binary(e, op, left.value, right.value);
+        }
+        left.slot = NULL;
+    }
+}
+
+static Operand parse_conditional(Eval *e) {
+    Operand condition = parse_binary(e, 1);
+    if (!accept(e, "?")) return condition;
+
+    int run = running(e), take = run && truthy(condition.value);
+    if (run && !take) e->skip++;
+    Operand yes = parse_assignment(e);
+    if (run && !take) e->skip--;
+    expect(e, ":");
+    if (take) e->skip++;
+    Operand no = parse_conditional(e);
+    if (take) e->skip--;
+    Operand result = {take ? yes.value : no.value, NULL, NULL};
+    return result;
+}
+
+static Operand parse_assignment(Eval *e) {
+    Operand target = parse_conditional(e);
+
+    // `=` or a compound assignment such as `<<=`
+    const char *start = e->p;
+    skip_space(e, 1);
+    size_t len = operator_length(e->p);
+    if (len == 0 || e->p[len - 1] != '=' || (len == 2 && strchr("=!<>", e->p[0]))) {
+        e->p = start;
+        return target;
+    }
+    char op[4] = {0};
+    memcpy(op, e->p, len - 1);
+    e->p += len;
+
+    Operand value = parse_assignment(e);
+    if (!running(e)) return value;
+    if (!target.slot) {
+        fail(e, "only variables can be assigned");
+        return value;
+    }
+    if (target.var->readonly) {
+        fail(e, "'%s' is read-only here", target.var->name);
+        return value;
+    }
+    ComptimeValue result = op[0] ? binary(e, op, *target.slot, value.value) : value.value;
+    *target.slot = convert(e, result, *target.slot);
+    target.value = *target.slot;
+    target.slot = NULL;
+    return target;
+}
+
+// =========================== [ STATEMENTS ] =========================================
+
+static void parse_statement(Eval *e);
+
+// Values of `= ...`: one expression, or a braced list flattened in order
+static void parse_initializer(Eval *e, ComptimeValue *values, size_t capacity, size_t *count) {
+    if (accept(e, "{")) {
+        if (accept(e, "}")) return;
+        do {
+            skip_space(e, 1);
+            if (*e->p == '}') break; // Trailing comma
+            parse_initializer(e, values, capacity, count);
+        } while (accept(e, ","));
+        expect(e, "}");
+        return;
+    }
+    ComptimeValue v = parse_assignment(e).value;
+    if (*count < capacity) values[*count] = v;
+    (*count)++;
+}
+
+// `name[dims] = init` after the type: fills v, whose storage the caller
+// owns; an empty first dimension takes the initializer's length
+static void parse_declarator(Eval *e, Var *v, int allow_block) {
+    if (!identifier(e, v->name, sizeof(v->name))) {
+        fail(e, "expected a name");
+        return;
+    }
+    int open = 0;
+    for (v->rank = 0; accept(e, "["); v->rank++) {
+        if (v->rank == 2) {
+            fail(e, "comptime arrays have at most two dimensions");
+            return;
+        }
+        if (accept(e, "]")) {
+            if (v->rank > 0) fail(e, "only the first dimension may be left out");
+            open = 1;
+            v->dims[v->rank] = 1;
+            continue;
+        }
+        ComptimeValue n = promote(parse_expression(e));
+        expect(e, "]");
+        v->dims[v->rank] = 1;
+        if (n.is_float || n.i <= 0 || n.i > MAX_ELEMENTS)
+            fail(e, "'%s' needs a positive constant size", v->name);
+        else
+            v->dims[v->rank] = (int)n.i;
+    }
+
+    skip_space(e, 0);
+    if (allow_block && *e->p == '{') {
+        if (open) fail(e, "'%s' needs a size to be filled by a block", v->name);
+        allocate(e, v);
+        return;
+    }
+    if (!accept(e, "=")) {
+        if (open) fail(e, "'%s' needs a size or an initializer", v->name);
+        allocate(e, v);
+        return;
+    }
+
+    size_t         capacity = open ? MAX_ELEMENTS : element_count(v);
+    ComptimeValue *values = malloc(capacity * sizeof(ComptimeValue));
+    size_t         count = 0;
+    if (!values) {
+        fail(e, "out of memory");
+        return;
+    }
+    parse_initializer(e, values, capacity, &count);
+    if (open) {
+        size_t row = v->rank == 2 ? (size_t)v->dims[1] : 1;
+        v->dims[0] = (int)((count + row - 1) / row);
+    }
+    if (allocate(e, v)) {
+        if (count > element_count(v)) fail(e, "too many initializers for '%s'", v->name);
+        for (size_t i = 0; i < count && i < element_count(v); i++)
+            v->values[i] = convert(e, values[i], v->type);
+    }
+    free(values);
+}
+
+// `type a = 1, b[4]`: locals of the block running now
+static void parse_declaration(Eval *e, ComptimeValue type, const char *type_text) {
+    do {
+        Var v = {0};
+        v.type = type;
+        snprintf(v.type_text, sizeof(v.type_text), "%s", type_text);
+        int run = running(e);
+        parse_declarator(e, &v, 0);
+        if (!run || e->error[0]) {
+            free(v.values);
+        } else if (local_count == MAX_VARS) {
+            free(v.values);
+            fail(e, "too many comptime variables");
+        } else {
+            locals[local_count++] = v;
+        }
+    } while (accept(e, ","));
+}
+
+static void parse_block(Eval *e) {
+    int base = local_count;
+    for (;;) {
+        skip_space(e, 1);
+        if (accept(e, "}")) break;
+        if (!*e->p) {
+            fail(e, "expected '}'");
+            break;
+        }
+        const char *before = e->p;
+        parse_statement(e);
+        if (e->p == before) fail(e, "unexpected '%c'", *e->p);
+    }
+    pop_locals(base);
+}
+
+// Counts an iteration; 0 once the budget is spent
+static int iterate(Eval *e) {
+    if (++e->steps <= COMPTIME_STEPS) return 1;
+    fail(e, "comptime loops ran past %ld iterations", COMPTIME_STEPS);
+    return 0;
+}
+
+// The body after a loop's condition: run when go, else skipped. Returns 1
+// to go round again.
+static int loop_body(Eval *e, int go) {
+    if (!go) e->skip++;
+    parse_statement(e);
+    if (!go) {
+        e->skip--;
+        return 0;
+    }
+    if (e->breaking) {
+        e->breaking = 0;
+        return 0;
+    }
+    e->continuing = 0;
+    return iterate(e);
+}
+
+static void parse_for(Eval *e) {
+    int base = local_count;
+    expect(e, "(");
+    ComptimeValue type;
+    char          text[64];
+    skip_space(e, 1);
+    if (parse_type(e, &type, text, sizeof(text)))
+        parse_declaration(e, type, text);
+    else if (*e->p != ';')
+        parse_expression(e);
+    expect(e, ";");
+
+    const char *condition = e->p;
+    for (;;) {
+        e->p = condition;
+        skip_space(e, 1);
+        int go = running(e);
+        if (*e->p != ';') go = truthy(parse_expression(e)) && go;
+        expect(e, ";");
+        const char *increment = e->p;
+        e->skip++;
+        skip_space(e, 1);
+        if (*e->p != ')') parse_expression(e);
+        e->skip--;
+        expect(e, ")");
+        if (!loop_body(e, go)) break;
+        const char *after = e->p;
+        e->p = increment;
+        skip_space(e, 1);
+        if (*e->p != ')') parse_expression(e);
+        e->p = after;
+    }
+    pop_locals(base);
+}
+
+static void parse_statement(Eval *e) {
+    ComptimeValue type;
+    char          text[64];
+    skip_space(e, 1);
+
+    if (accept(e, "{")) {
+        parse_block(e);
+    } else if (accept(e, ";")) {
+    } else if (accept(e, "if")) {
+        expect(e, "(");
+        int run = running(e), take = truthy(parse_expression(e)) && run;
+        expect(e, ")");
+        if (run && !take) e->skip++;
+        parse_statement(e);
+        if (run && !take) e->skip--;
+        if (accept(e, "else")) {
+            if (take) e->skip++;
+            parse_statement(e);
+            if (take) e->skip--;
+        }
+    } else if (accept(e, "while")) {
+        const char *condition = e->p;
+        do {
+            e->p = condition;
+            expect(e, "(");
+            int go = running(e);
+            go = truthy(parse_expression(e)) && go;
+            expect(e, ")");
+            if (!loop_body(e, go)) break;
+        } while (1);
+    } else if (accept(e, "do")) {
+        const char *body = e->p;
+        for (;;) {
+            e->p = body;
+            int go = running(e);
+            parse_statement(e);
+            int broke = e->breaking;
+            e->breaking = e->continuing = 0;
+            if (!accept(e, "while")) fail(e, "expected 'while'");
+            expect(e, "(");
+            if (broke) e->skip++;
+            go = truthy(parse_expression(e)) && go && !broke;
+            if (broke) e->skip--;
+            expect(e, ")");
+            if (!go || !iterate(e)) break;
+        }
+        end_statement(e);
+    } else if (accept(e, "for")) {
+        parse_for(e);
+    } else if (accept(e, "break")) {
+        if (running(e)) e->breaking = 1;
+        end_statement(e);
+    } else if (accept(e, "continue")) {
+        if (running(e)) e->continuing = 1;
+        end_statement(e);
+    } else if (parse_type(e, &type, text, sizeof(text))) {
+        parse_declaration(e, type, text);
+        end_statement(e);
+    } else {
+        parse_expression(e);
+        end_statement(e);
+    }
+}
+
+// =========================== [ OUTPUT ] =========================================
+
+void comptime_format(const ComptimeValue *value, char *out, size_t size) {
+    if (value->is_float) {
+        int written = snprintf(out, size, value->bits == 32 ? "%.9g" : "%.17g", value->f);
+        if (written > 0 && (size_t)written < size - 2 && !strpbrk(out, ".eEn")) strcat(out, ".0");
+        if (value->bits == 32 && strlen(out) < size - 1) strcat(out, "f");
+    } else if (value->is_unsigned) {
+        unsigned long long u = (unsigned long long)value->i;
+        snprintf(out, size, u > LLONG_MAX ? "%lluULL" : u > INT_MAX ? "%lluu" : "%llu", u);
+    } else if (value->i == LLONG_MIN) {
+        snprintf(out, size, "(-9223372036854775807LL - 1)");
+    } else {
+        snprintf(out, size, "%lld", value->i);
+    }
+}
+
+// Elements from first, count of them, wrapped after column 100
+static void write_values(FILE *out, const ComptimeValue *first, size_t count, const char *indent) {
+    char   text[64];
+    size_t column = strlen(indent);
+    for (size_t i = 0; i < count; i++) {
+        comptime_format(&first[i], text, sizeof(text));
+        size_t width = strlen(text) + 2;
+        if (i > 0 && column + width > 100) {
+            fprintf(out, ",\n%s", indent);
+            column = strlen(indent);
+        } else if (i > 0) {
+            fputs(", ", out);
+        }
+        fputs(text, out);
+        column += width;
+    }
+}
+
+static void write_declaration(FILE *out, const Var *v, const char *indent) {
+    char text[64];
+    fprintf(out, "%sstatic const %s %s", indent, v->type_text, v->name);
+    for (int d = 0; d < v->rank; d++)
+        fprintf(out, "[%d]", v->dims[d]);
+    fputs(" __attribute__((unused))", out);
+    if (v->rank == 0) {
+        comptime_format(&v->values[0], text, sizeof(text));
+        fprintf(out, " = %s;\n", text);
+        return;
+    }
+
+    char inner[80];
+    snprintf(inner, sizeof(inner), "%s    ", indent);
+    fputs(" = {\n", out);
+    if (v->rank == 1) {
+        fputs(inner, out);
+        write_values(out, v->values, (size_t)v->dims[0], inner);
+        fputc('\n', out);
+    } else {
+        char row_indent[96];
+        snprintf(row_indent, sizeof(row_indent), "%s ", inner);
+        for (int r = 0; r < v->dims[0]; r++) {
+            fprintf(out, "%s{", inner);
+            write_values(out, v->values + (size_t)r * v->dims[1], (size_t)v->dims[1], row_indent);
+            fprintf(out, "}%s\n", r + 1 < v->dims[0] ? "," : "");
+        }
+    }
+    fprintf(out, "%s};\n", indent);
+}
+
+// =========================== [ EVALUATION ] =========================================
+
+static void start(Eval *e, const char *text) {
+    memset(e, 0, sizeof(*e));
+    e->p = text;
+    e->end = text + strlen(text);
+    local_count = 0;
+}
+
+static int error_line(const Eval *e, const char *text, int first) {
+    int line = first;
+    for (const char *p = text; e->error_at && p < e->error_at; p++)
+        line += *p == '\n';
+    return line;
+}
+
+int comptime_eval(const char *expr, ComptimeValue *value) {
+    Eval e;
+    start(&e, expr);
+    *value = parse_expression(&e);
+    skip_space(&e, 1);
+    return !e.error[0] && *e.p == '\0';
+}
+
+// `type name[dims] = init` or `type name[dims] { block }`, the text after
+// `comptime`: evaluates it, registers the name and writes the declaration
+static void declare(const char *text, const char *indent, int number, FILE *out) {
+    Eval e;
+    Var  v = {0};
+    start(&e, text);
+    if (!parse_type(&e, &v.type, v.type_text, sizeof(v.type_text))) fail(&e, "comptime needs a scalar type");
+    parse_declarator(&e, &v, 1);
+    if (!e.error[0] && accept(&e, "{")) {
+        // The block fills the variable in, as a local it may write
+        locals[local_count++] = v;
+        parse_block(&e);
+        v.values = locals[0].values;
+        local_count = 0;
+    }
+    end_statement(&e);
+    skip_space(&e, 1);
+    if (!e.error[0] && *e.p) fail(&e, "unexpected '%c'", *e.p);
+
+    if (e.error[0]) {
+        report(error_line(&e, text, number), "comptime: ", e.error);
+        pop_locals(0);
+        free(v.values);
+        return;
+    }
+    write_declaration(out, &v, indent);
+
+    v.readonly = 1;
+    Var *slot = NULL;
+    for (int i = 0; i < global_count && !slot; i++) {
+        if (strcmp(globals[i].name, v.name) == 0) slot = &globals[i];
+    }
+    if (slot) {
+        free(slot->values);
+    } else if (global_count < MAX_VARS) {
+        slot = &globals[global_count++];
+    }
+    if (slot)
+        *slot = v;
+    else
+        free(v.values);
+}
+
+// Replaces each `comptime(expr)` on line with its value
+static void replace_inline(const char *line, int number, FILE *out) {
+    int in_string = 0, in_char = 0;
+    for (const char *p = line; *p; p++) {
+        if (*p == '\\' && (in_string || in_char) && p[1]) {
+            fputc(*p++, out);
+            fputc(*p, out);
+            continue;
+        }
+        if (*p == '"' && !in_char) in_string = !in_string;
+        if (*p == '\'' && !in_string) in_char = !in_char;
+        if (!in_string && !in_char && p[0] == '/' && p[1] == '/') {
+            fputs(p, out);
+            return;
+        }
+        const char *after = !in_string && !in_char && (p == line || !is_ident_char((unsigned char)p[-1]))
+                                ? match_word(p, "comptime")
+                                : NULL;
+        if (!after || *after != '(') {
+            fputc(*p, out);
+            continue;
+        }
+
+        // The text inside the parentheses
+        const char *q = after;
+        int         nesting = 0;
+        for (; *q; q++) {
+            if (*q == '(') nesting++;
+            if (*q == ')' && --nesting == 0) break;
+        }
+        if (!*q) {
+            report(number, "comptime(...) must close on its line", "");
+            fputs(p, out);
+            return;
+        }
+        char *expr = strndup(after + 1, q - after - 1);
+        Eval  e;
+        start(&e, expr);
+        ComptimeValue value = parse_expression(&e);
+        skip_space(&e, 1);
+        if (!e.error[0] && *e.p) fail(&e, "unexpected '%c'", *e.p);
+        if (e.error[0]) {
+            report(number, "comptime: ", e.error);
+        } else {
+            char text[64];
+            comptime_format(&value, text, sizeof(text));
+            fprintf(out, text[0] == '-' ? "(%s)" : "%s", text);
+        }
+        free(expr);
+        p = q;
+    }
+}
+
+// =========================== [ MAIN TRANSFORMATION ] ====================================
+
+int evaluate_comptime(FILE *in, FILE *out) {
+    LineBuffer buf = {0};
+    char       line[4096];
+
+    pass_errors = 0;
+    while (fgets(line, sizeof(line), in))
+        push_line(&buf, line);
+
+    for (int i = 0; i < buf.count; i++) {
+        const char *text = buf.lines[i];
+        const char *p = text + strspn(text, " \t");
+        const char *after = match_word(p, "comptime");
+        if (!after || *after == '(') {
+            replace_inline(text, i + 1, out);
+            continue;
+        }
+
+        // The declaration, through the end of its block when it has one
+        int    first = i, depth = brace_delta(text);
+        size_t size = strlen(after) + 1;
+        while (depth > 0 && i + 1 < buf.count) {
+            depth += brace_delta(buf.lines[++i]);
+            size += strlen(buf.lines[i]);
+        }
+        char *declaration = malloc(size);
+        strcpy(declaration, after);
+        for (int j = first + 1; j <= i; j++)
+            strcat(declaration, buf.lines[j]);
+
+        char indent[64];
+        snprintf(indent, sizeof(indent), "%.*s", (int)(p - text), text);
+        declare(declaration, indent, first + 1, out);
+        free(declaration);
+    }
+
+    free_lines(&buf);
+    return pass_errors;
+}
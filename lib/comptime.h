@@ -0,0 +1,29 @@
+// comptime.h - Translation-time evaluation shared by the transpiler passes
+#ifndef SAM_COMPTIME_H
+#define SAM_COMPTIME_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// A value of C scalar type: integers carry their width and signedness, and
+// arithmetic on them wraps and promotes the way C's does
+typedef struct {
+    int       is_float;
+    int       bits; // 1 for bool, 8 to 64 for integers, 32 or 64 for floats
+    int       is_unsigned;
+    long long i; // Integer value, sign-extended (the bit pattern for unsigned long long)
+    double    f;
+} ComptimeValue;
+
+// The pass: `comptime` declarations become static const data and
+// `comptime(expr)` becomes a literal. Returns the number of errors.
+int evaluate_comptime(FILE *in, FILE *out);
+
+// Evaluates a constant expression over literals and the names earlier
+// `comptime` declarations defined; 0 when it is not one
+int comptime_eval(const char *expr, ComptimeValue *value);
+
+// The value as a C literal
+void comptime_format(const ComptimeValue *value, char *out, size_t size);
+
+#endif
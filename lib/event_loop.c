@@ -0,0 +1,527 @@
+#define _GNU_SOURCE // accept4, pipe2, pthread_setaffinity_np
+// lib/event_loop.c - Ready queue, epoll readiness, a timer heap and the frame pool
+#include "event_loop.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ASYNC_POOL_CLASS 64          // Frame sizes round up to a multiple of this
+#define ASYNC_POOL_CLASSES 64        // Pooled up to 4KB; bigger frames use malloc
+#define ASYNC_POOL_CHUNK (64 * 1024) // Carved into frames as the pool grows
+#define ASYNC_EVENTS 256             // epoll_wait batch
+#define ASYNC_MAX_CORES 256
+
+// Who waits on a descriptor: one reader and one writer at a time. The
+// registration is one-shot, so it is re-armed for whatever is still wanted.
+typedef struct {
+    AsyncTask *reader;
+    AsyncTask *writer;
+    int        registered;
+} AsyncFd;
+
+typedef struct {
+    int         epfd;
+    long        tasks;  // Spawned or awaited and not finished
+    long        frames; // Allocated and not freed
+    AsyncTask  *ready, *ready_tail;
+    AsyncTask **timers; // Min-heap on deadline
+    int         timer_count, timer_capacity;
+    AsyncFd    *fds;
+    int         fd_capacity;
+    int         io_waiting; // Tasks parked on a descriptor
+
+    void *free_frames[ASYNC_POOL_CLASSES];
+    char *chunk;      // Current chunk; each starts with a link to the previous one
+    size_t chunk_used;
+} EventLoop;
+
+static __thread EventLoop *loop_self;
+
+static void out_of_memory(const char *what) {
+    fprintf(stderr, "async: out of memory %s\n", what);
+    abort();
+}
+
+static EventLoop *current_loop(void) {
+    if (loop_self) return loop_self;
+    EventLoop *loop = calloc(1, sizeof(EventLoop));
+    if (!loop) out_of_memory("starting the event loop");
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        perror("async: epoll_create1");
+        abort();
+    }
+    loop_self = loop;
+    return loop;
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// =========================== [ FRAMES ] ====================================
+
+void *async_frame_alloc(size_t size, AsyncStep step) {
+    EventLoop *loop = current_loop();
+    size_t     class = (size + ASYNC_POOL_CLASS - 1) / ASYNC_POOL_CLASS;
+    AsyncTask *task;
+
+    if (class > ASYNC_POOL_CLASSES) {
+        task = malloc(size);
+    } else if (loop->free_frames[class - 1]) {
+        task = loop->free_frames[class - 1];
+        loop->free_frames[class - 1] = *(void **)task;
+    } else {
+        size_t bytes = class * ASYNC_POOL_CLASS;
+        if (!loop->chunk || loop->chunk_used + bytes > ASYNC_POOL_CHUNK) {
+            char *chunk = malloc(ASYNC_POOL_CHUNK);
+            if (!chunk) out_of_memory("allocating a task");
+            *(char **)chunk = loop->chunk;
+            loop->chunk = chunk;
+            loop->chunk_used = ASYNC_POOL_CLASS; // The link takes the first slot
+        }
+        task = (AsyncTask *)(loop->chunk + loop->chunk_used);
+        loop->chunk_used += bytes;
+    }
+    if (!task) out_of_memory("allocating a task");
+    memset(task, 0, size);
+    task->step = step;
+    task->timer = -1;
+    task->size = (unsigned)size;
+    loop->frames++;
+    return task;
+}
+
+static void frame_free(EventLoop *loop, AsyncTask *task) {
+    size_t class = (task->size + ASYNC_POOL_CLASS - 1) / ASYNC_POOL_CLASS;
+    if (class > ASYNC_POOL_CLASSES) {
+        free(task);
+    } else {
+        *(void **)task = loop->free_frames[class - 1];
+        loop->free_frames[class - 1] = task;
+    }
+    loop->frames--;
+}
+
+// Once every frame is back, the chunks go too
+static void pool_trim(EventLoop *loop) {
+    if (loop->frames > 0) return;
+    while (loop->chunk) {
+        char *previous = *(char **)loop->chunk;
+        free(loop->chunk);
+        loop->chunk = previous;
+    }
+    memset(loop->free_frames, 0, sizeof(loop->free_frames));
+    loop->chunk_used = 0;
+}
+
+// =========================== [ SCHEDULING ] ====================================
+
+static void make_ready(EventLoop *loop, AsyncTask *task) {
+    task->next = NULL;
+    if (loop->ready_tail)
+        loop->ready_tail->next = task;
+    else
+        loop->ready = task;
+    loop->ready_tail = task;
+}
+
+static void finish(EventLoop *loop, AsyncTask *task) {
+    if (task->waiter) make_ready(loop, task->waiter);
+    if (task->drop) task->drop(task);
+    frame_free(loop, task);
+    loop->tasks--;
+}
+
+static void run_task(EventLoop *loop, AsyncTask *task) {
+    if (task->step(task) == ASYNC_DONE) finish(loop, task);
+}
+
+void async_spawn(AsyncTask *task) {
+    EventLoop *loop = current_loop();
+    loop->tasks++;
+    make_ready(loop, task);
+}
+
+// The child runs at once; only if it suspends does the parent wait for it
+int async_await(AsyncTask *self, AsyncTask *child, void *result) {
+    EventLoop *loop = current_loop();
+    loop->tasks++;
+    child->result = result;
+    if (child->step(child) == ASYNC_DONE) {
+        finish(loop, child);
+        return 0;
+    }
+    child->waiter = self;
+    return 1;
+}
+
+// =========================== [ TIMERS ] ====================================
+
+static void timer_swap(EventLoop *loop, int a, int b) {
+    AsyncTask *t = loop->timers[a];
+    loop->timers[a] = loop->timers[b];
+    loop->timers[b] = t;
+    loop->timers[a]->timer = a;
+    loop->timers[b]->timer = b;
+}
+
+static void timer_push(EventLoop *loop, AsyncTask *task) {
+    if (loop->timer_count == loop->timer_capacity) {
+        int         capacity = loop->timer_capacity ? loop->timer_capacity * 2 : 64;
+        AsyncTask **timers = realloc(loop->timers, sizeof(AsyncTask *) * capacity);
+        if (!timers) out_of_memory("adding a timer");
+        loop->timers = timers;
+        loop->timer_capacity = capacity;
+    }
+    int i = loop->timer_count++;
+    loop->timers[i] = task;
+    task->timer = i;
+    while (i > 0 && loop->timers[(i - 1) / 2]->deadline > task->deadline) {
+        timer_swap(loop, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static AsyncTask *timer_pop(EventLoop *loop) {
+    AsyncTask *top = loop->timers[0];
+    timer_swap(loop, 0, --loop->timer_count);
+    for (int i = 0;;) {
+        int child = 2 * i + 1;
+        if (child >= loop->timer_count) break;
+        if (child + 1 < loop->timer_count &&
+            loop->timers[child + 1]->deadline < loop->timers[child]->deadline)
+            child++;
+        if (loop->timers[i]->deadline <= loop->timers[child]->deadline) break;
+        timer_swap(loop, i, child);
+        i = child;
+    }
+    top->timer = -1;
+    return top;
+}
+
+// =========================== [ DESCRIPTORS ] ====================================
+
+static int arm(EventLoop *loop, int fd) {
+    AsyncFd           *entry = &loop->fds[fd];
+    struct epoll_event event = {0};
+    event.events = EPOLLONESHOT | (entry->reader ? EPOLLIN : 0) | (entry->writer ? EPOLLOUT : 0);
+    event.data.fd = fd;
+    // A descriptor closed and reopened under the same number left epoll with it
+    int op = entry->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(loop->epfd, op, fd, &event) < 0) {
+        if (errno != ENOENT && errno != EEXIST) return -errno;
+        op = op == EPOLL_CTL_MOD ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        if (epoll_ctl(loop->epfd, op, fd, &event) < 0) return -errno;
+    }
+    entry->registered = 1;
+    return 0;
+}
+
+long async_wait_fd(AsyncTask *self, int fd, int writable) {
+    EventLoop *loop = current_loop();
+    if (self->waiting) {
+        self->waiting = 0;
+        return 0;
+    }
+    if (fd < 0) return -EBADF;
+    if (fd >= loop->fd_capacity) {
+        int capacity = loop->fd_capacity ? loop->fd_capacity : 256;
+        while (capacity <= fd)
+            capacity *= 2;
+        AsyncFd *fds = realloc(loop->fds, sizeof(AsyncFd) * capacity);
+        if (!fds) out_of_memory("watching a descriptor");
+        memset(fds + loop->fd_capacity, 0, sizeof(AsyncFd) * (capacity - loop->fd_capacity));
+        loop->fds = fds;
+        loop->fd_capacity = capacity;
+    }
+    AsyncTask **slot = writable ? &loop->fds[fd].writer : &loop->fds[fd].reader;
+    if (*slot) return -EBUSY;
+    *slot = self;
+    int failed = arm(loop, fd);
+    if (failed) {
+        *slot = NULL;
+        return failed;
+    }
+    loop->io_waiting++;
+    self->waiting = 1;
+    return ASYNC_PENDING;
+}
+
+static void dispatch(EventLoop *loop, const struct epoll_event *event) {
+    AsyncFd *entry = &loop->fds[event->data.fd];
+    int      failed = event->events & (EPOLLERR | EPOLLHUP);
+    if (entry->reader && (event->events & EPOLLIN || failed)) {
+        make_ready(loop, entry->reader);
+        entry->reader = NULL;
+        loop->io_waiting--;
+    }
+    if (entry->writer && (event->events & EPOLLOUT || failed)) {
+        make_ready(loop, entry->writer);
+        entry->writer = NULL;
+        loop->io_waiting--;
+    }
+    if (entry->reader || entry->writer) arm(loop, event->data.fd);
+}
+
+// =========================== [ RUNNING ] ====================================
+
+int async_run(void) {
+    EventLoop         *loop = current_loop();
+    struct epoll_event events[ASYNC_EVENTS];
+
+    while (loop->tasks > 0) {
+        // Tasks readied meanwhile wait for the next round, after I/O is polled
+        AsyncTask *ready = loop->ready;
+        loop->ready = loop->ready_tail = NULL;
+        while (ready) {
+            AsyncTask *next = ready->next;
+            run_task(loop, ready);
+            ready = next;
+        }
+        if (loop->tasks == 0) break;
+
+        int timeout = -1;
+        if (loop->ready) {
+            timeout = 0;
+        } else if (loop->timer_count > 0) {
+            long long wait = loop->timers[0]->deadline - now_ns();
+            timeout = wait <= 0 ? 0 : (int)((wait + 999999) / 1000000);
+        } else if (loop->io_waiting == 0) {
+            break; // Nothing left that could wake anyone
+        }
+        int count = epoll_wait(loop->epfd, events, ASYNC_EVENTS, timeout);
+        for (int i = 0; i < count; i++)
+            dispatch(loop, &events[i]);
+        if (loop->timer_count > 0) {
+            long long now = now_ns();
+            while (loop->timer_count > 0 && loop->timers[0]->deadline <= now)
+                make_ready(loop, timer_pop(loop));
+        }
+    }
+    int stuck = (int)loop->tasks;
+    pool_trim(loop);
+    return stuck;
+}
+
+typedef struct {
+    int  core;
+    int  cpu; // -1 when it cannot be pinned
+    void (*start)(int core, void *arg);
+    void *arg;
+    int   stuck;
+} AsyncCore;
+
+static void *core_main(void *data) {
+    AsyncCore *core = data;
+#ifdef CPU_SET
+    if (core->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+    core->start(core->core, core->arg);
+    core->stuck = async_run();
+    return NULL;
+}
+
+int async_run_per_core(void (*start)(int core, void *arg), void *arg) {
+    AsyncCore        cores[ASYNC_MAX_CORES];
+    pthread_t        threads[ASYNC_MAX_CORES];
+    int              count = 0;
+    const char      *wanted = getenv("SAM_THREADS");
+
+#ifdef CPU_SET
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE && count < ASYNC_MAX_CORES; cpu++) {
+            if (CPU_ISSET(cpu, &set)) cores[count++].cpu = cpu;
+        }
+    }
+#endif
+    if (count == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        count = online > 0 ? (online < ASYNC_MAX_CORES ? (int)online : ASYNC_MAX_CORES) : 1;
+        for (int i = 0; i < count; i++)
+            cores[i].cpu = -1;
+    }
+    if (wanted && atoi(wanted) > 0) {
+        int n = atoi(wanted) < ASYNC_MAX_CORES ? atoi(wanted) : ASYNC_MAX_CORES;
+        for (int i = count; i < n; i++)
+            cores[i].cpu = -1; // More loops than CPUs share them unpinned
+        count = n;
+    }
+
+    int started = 1;
+    for (int i = 0; i < count; i++) {
+        cores[i].core = i;
+        cores[i].start = start;
+        cores[i].arg = arg;
+        cores[i].stuck = 0;
+    }
+    for (; started < count; started++) {
+        if (pthread_create(&threads[started], NULL, core_main, &cores[started]) != 0) break;
+    }
+    core_main(&cores[0]); // The calling thread is core 0
+    int stuck = cores[0].stuck;
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        stuck += cores[i].stuck;
+    }
+    return stuck;
+}
+
+// =========================== [ AWAITABLES ] ====================================
+
+long async_read(AsyncTask *self, int fd, void *buf, size_t n) {
+    self->waiting = 0;
+    for (;;) {
+        ssize_t got = read(fd, buf, n);
+        if (got >= 0) return got;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -errno;
+        return async_wait_fd(self, fd, 0);
+    }
+}
+
+long async_write(AsyncTask *self, int fd, const void *buf, size_t n) {
+    self->waiting = 0;
+    for (;;) {
+        ssize_t put = write(fd, buf, n);
+        if (put >= 0) return put;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -errno;
+        return async_wait_fd(self, fd, 1);
+    }
+}
+
+// Keeps the bytes already written in progress across retries
+long async_write_all(AsyncTask *self, int fd, const void *buf, size_t n) {
+    if (!self->waiting) self->progress = 0;
+    self->waiting = 0;
+    while ((size_t)self->progress < n) {
+        ssize_t put = write(fd, (const char *)buf + self->progress, n - self->progress);
+        if (put >= 0) {
+            self->progress += put;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -errno;
+        return async_wait_fd(self, fd, 1);
+    }
+    return (long)n;
+}
+
+long async_accept(AsyncTask *self, int fd) {
+    self->waiting = 0;
+    for (;;) {
+        int client = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client >= 0) return client;
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -errno;
+        return async_wait_fd(self, fd, 0);
+    }
+}
+
+// The socket being connected waits in progress
+long async_connect_tcp(AsyncTask *self, const char *host, int port) {
+    if (self->waiting) {
+        int       fd = (int)self->progress, error = 0;
+        socklen_t len = sizeof(error);
+        self->waiting = 0;
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) error = errno;
+        if (error == 0) return fd;
+        close(fd);
+        return -error;
+    }
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) return -EINVAL;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -errno;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+    if (errno != EINPROGRESS) {
+        int error = errno;
+        close(fd);
+        return -error;
+    }
+    self->progress = fd;
+    long waited = async_wait_fd(self, fd, 1);
+    if (waited != ASYNC_PENDING) close(fd);
+    return waited;
+}
+
+long async_sleep(AsyncTask *self, long ms) {
+    if (self->waiting) {
+        self->waiting = 0;
+        return 0;
+    }
+    if (ms <= 0) return async_yield(self);
+    self->deadline = now_ns() + ms * 1000000LL;
+    self->waiting = 1;
+    timer_push(current_loop(), self);
+    return ASYNC_PENDING;
+}
+
+// Lets every other ready task run first
+long async_yield(AsyncTask *self) {
+    if (self->waiting) {
+        self->waiting = 0;
+        return 0;
+    }
+    self->waiting = 1;
+    make_ready(current_loop(), self);
+    return ASYNC_PENDING;
+}
+
+// =========================== [ SETUP ] =====================================
+
+int async_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return -errno;
+    return 0;
+}
+
+int async_pipe(int fds[2]) { return pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0 ? -errno : 0; }
+
+int async_listen(const char *host, int port, int backlog) {
+    struct sockaddr_in addr = {0};
+    int                on = 1;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) return -EINVAL;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -errno;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, backlog) < 0) {
+        int error = errno;
+        close(fd);
+        return -error;
+    }
+    return fd;
+}
+
+int async_local_port(int fd) {
+    struct sockaddr_in addr;
+    socklen_t          len = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr *)&addr, &len) < 0) return -errno;
+    return ntohs(addr.sin_port);
+}
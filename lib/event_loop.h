@@ -0,0 +1,71 @@
+// event_loop.h - Single-threaded epoll loop behind `async` functions
+#ifndef SAM_EVENT_LOOP_H
+#define SAM_EVENT_LOOP_H
+
+#include <limits.h>
+#include <stddef.h>
+
+// An async function is lowered to a frame holding its parameters and locals
+// plus a step function that resumes it where it last suspended (`state`).
+// Frames come from a per-thread pool of 64-byte size classes, so a task
+// costs the header below plus its locals. Each thread that runs tasks owns
+// one loop: tasks never move between threads, and nothing here locks.
+//
+// Awaitables are plain functions taking the task as their first argument:
+// they return a result, or ASYNC_PENDING after arranging for the task to be
+// resumed, at which point the same call is made again. Results are >= 0 on
+// success and -errno on failure. `waiting` tells a retry from a first call;
+// an awaitable of your own should clear it as the ones here do. File
+// descriptors must be non-blocking; a regular file never reports EAGAIN, so
+// async_read on one completes at once.
+#define ASYNC_PENDING LONG_MIN
+
+enum { ASYNC_DONE, ASYNC_SUSPENDED }; // What a step function returns
+
+typedef struct AsyncTask AsyncTask;
+typedef int (*AsyncStep)(AsyncTask *task);
+
+struct AsyncTask {
+    AsyncStep  step;
+    void     (*drop)(AsyncTask *task); // Releases what the frame owns, or NULL
+    AsyncTask *waiter;                 // Resumed when this task finishes
+    void      *result;                 // Where `return` stores its value, or NULL
+    AsyncTask *next;                   // Ready queue
+    long long  deadline;               // async_sleep, monotonic nanoseconds
+    long       progress;               // An awaitable's own state across retries
+    int        state;                  // Resume point; 0 before the first step
+    int        waiting;                // Suspended by an awaitable that will be retried
+    int        timer;                  // Slot in the timer heap, -1 when not sleeping
+    unsigned   size;                   // Frame bytes, for the pool
+};
+
+// Frames and scheduling, used by the lowered code
+void *async_frame_alloc(size_t size, AsyncStep step);
+void  async_spawn(AsyncTask *task);
+int   async_await(AsyncTask *self, AsyncTask *child, void *result); // 1 when self must suspend
+
+// Runs this thread's tasks until none is left; returns how many are still
+// suspended on something the loop cannot see (0 normally)
+int async_run(void);
+// One thread and loop per CPU (SAM_THREADS overrides the count), each pinned
+// to its CPU: start(core, arg) spawns that loop's tasks, typically accepting
+// on its own async_listen socket
+int async_run_per_core(void (*start)(int core, void *arg), void *arg);
+
+// Awaitables
+long async_read(AsyncTask *self, int fd, void *buf, size_t n);
+long async_write(AsyncTask *self, int fd, const void *buf, size_t n);
+long async_write_all(AsyncTask *self, int fd, const void *buf, size_t n);
+long async_accept(AsyncTask *self, int fd);
+long async_connect_tcp(AsyncTask *self, const char *host, int port); // The connected fd
+long async_sleep(AsyncTask *self, long ms);
+long async_yield(AsyncTask *self);
+long async_wait_fd(AsyncTask *self, int fd, int writable); // Readiness only
+
+// Non-blocking descriptors
+int async_nonblocking(int fd);
+int async_pipe(int fds[2]);
+int async_listen(const char *host, int port, int backlog); // SO_REUSEPORT; port 0 picks one
+int async_local_port(int fd);
+
+#endif
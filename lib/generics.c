@@ -0,0 +1,492 @@
+#define _POSIX_C_SOURCE 200809L
+// lib/generics.c - Monomorphise `generic` structs and functions
+//
+//     generic(T) struct Vec {                 typedef struct Vec__double Vec__double;
+//         T  *items                           struct Vec__double {
+//         int len                                 double *items;
+//     }                                           int len;
+//     generic(T) T vec_sum(Vec<T> *v) {  =>   };
+//         T sum = 0                           static double vec_sum__double(Vec__double *v);
+//         ...                                 int main() {
+//     }                                           Vec__double v = {items, 3};
+//     int main() {                                double s = vec_sum__double(&v);
+//         Vec<double> v = {items, 3}          }
+//         double s = vec_sum<double>(&v)      static double vec_sum__double(Vec__double *v) {
+//     }                                           double sum = 0;
+//                                                 ...
+//                                             }
+//
+// `Name<args>` names the instance of a template for those type arguments,
+// mangled into an identifier, so uses stay unboxed: the element type is the
+// C type itself, not a void pointer behind a size. Each distinct instance is
+// generated once per file, however many times it is named; `Vec<char *>` and
+// `Vec<char*>` are the same one. Inside a template, its own name without
+// arguments means the instance being generated, so recursion and
+// self-referencing structs need no `<T>`.
+//
+// A struct instance is written (with its semicolons) just before the
+// top-level declaration that first uses it, after the instances it needs
+// itself. A function instance gets a static prototype in the same place
+// and its body at the end of the file, where every type is known. Type
+// arguments must be given: nothing is inferred from call arguments. A
+// `generic(T) rc struct` becomes an `rc struct` per instance, so each gets
+// its own RcType, which traces only the fields that are strings or rc
+// structs for its arguments.
+//
+// This runs before the string and refcounting passes, which then see each
+// instance as if it had been written out by hand.
+#include "common.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_TEMPLATES 64
+#define MAX_INSTANCES 256
+#define MAX_PARAMS 4
+#define LINE_SIZE 8192
+
+typedef struct {
+    char       name[64];
+    char       params[MAX_PARAMS][32];
+    int        param_count;
+    int        is_struct;
+    int        is_rc;
+    int        line;  // Source line of the header
+    LineBuffer body;  // The declaration from its header, `generic(...)` dropped
+} Template;
+
+typedef struct {
+    Template *template;
+    char      name[160]; // Mangled
+    char      args[MAX_PARAMS][96];
+    int       declared; // Struct or prototype written
+    int       defined;  // Function body written
+} Instance;
+
+static Template templates[MAX_TEMPLATES];
+static int      template_count;
+static Instance instances[MAX_INSTANCES];
+static int      instance_count;
+
+// =========================== [ HELPERS ] =========================================
+
+// Writes buf's lines to out and empties it
+static void flush_lines(LineBuffer *buf, FILE *out) {
+    for (int i = 0; i < buf->count; i++) {
+        fputs(buf->lines[i], out);
+        free(buf->lines[i]);
+    }
+    buf->count = 0;
+}
+
+static Template *find_template(const char *name, size_t len) {
+    for (int i = 0; i < template_count; i++) {
+        if (strlen(templates[i].name) == len && strncmp(templates[i].name, name, len) == 0)
+            return &templates[i];
+    }
+    return NULL;
+}
+
+// =========================== [ TEMPLATES ] =========================================
+
+// `generic(T, U) rest`: fills t's parameters and returns rest, or NULL
+static const char *parse_generic(const char *p, Template *t) {
+    p = match_word(p, "generic");
+    if (!p || *p != '(') return NULL;
+    p++;
+    t->param_count = 0;
+    for (;;) {
+        p += strspn(p, " \t");
+        size_t len = 0;
+        while (is_ident_char((unsigned char)p[len]))
+            len++;
+        if (len == 0 || len >= sizeof(t->params[0]) || t->param_count == MAX_PARAMS) return NULL;
+        memcpy(t->params[t->param_count], p, len);
+        t->params[t->param_count++][len] = '\0';
+        p += len + strspn(p + len, " \t");
+        if (*p == ')') break;
+        if (*p++ != ',') return NULL;
+    }
+    p++;
+    return p + strspn(p, " \t");
+}
+
+// The struct or function name in a template's header, after `generic(...)`
+static int parse_template_name(const char *rest, Template *t) {
+    const char *p = rest;
+    const char *after = match_word(p, "rc");
+    t->is_rc = after && match_word(after, "struct");
+    if (t->is_rc) p = after;
+    after = match_word(p, "struct");
+    t->is_struct = after != NULL;
+
+    const char *name = NULL;
+    size_t      len = 0;
+    if (t->is_struct) {
+        name = after;
+        while (is_ident_char((unsigned char)name[len]))
+            len++;
+    } else {
+        // The name just before the parameter list
+        const char *paren = strchr(p, '(');
+        if (!paren) return 0;
+        const char *end = paren;
+        while (end > p && isspace((unsigned char)end[-1]))
+            end--;
+        name = end;
+        while (name > p && is_ident_char((unsigned char)name[-1]))
+            name--;
+        len = end - name;
+    }
+    if (len == 0 || len >= sizeof(t->name)) return 0;
+    memcpy(t->name, name, len);
+    t->name[len] = '\0';
+    return 1;
+}
+
+// =========================== [ REWRITING ] =========================================
+
+// Copies text to out with every whole-word `word` outside literals and
+// comments replaced; a word followed by `<` is kept when skip_args is set
+static void replace_word(const char *text, const char *word, const char *with, int skip_args, char *out,
+                         size_t size) {
+    size_t n = 0, len = strlen(word);
+    int    in_string = 0, in_char = 0;
+
+    for (const char *p = text; *p && n + 1 < size;) {
+        if (*p == '\\' && (in_string || in_char) && p[1]) {
+            out[n++] = *p++;
+            if (n + 1 < size) out[n++] = *p++;
+            continue;
+        }
+        if (*p == '"' && !in_char) in_string = !in_string;
+        if (*p == '\'' && !in_string) in_char = !in_char;
+        if (!in_string && !in_char && p[0] == '/' && p[1] == '/') {
+            n += snprintf(out + n, size - n, "%s", p);
+            break;
+        }
+        if (!in_string && !in_char && (p == text || !is_ident_char((unsigned char)p[-1])) &&
+            strncmp(p, word, len) == 0 && !is_ident_char((unsigned char)p[len]) &&
+            !(skip_args && p[len] == '<')) {
+            n += snprintf(out + n, size - n, "%s", with);
+            p += len;
+            continue;
+        }
+        out[n++] = *p++;
+    }
+    out[n < size ? n : size - 1] = '\0';
+}
+
+// A type argument with its spaces tidied, `char  *` as `char *`
+static void normalize_type(const char *text, size_t len, char *out, size_t size) {
+    size_t n = 0;
+    for (size_t i = 0; i < len && n + 2 < size; i++) {
+        if (isspace((unsigned char)text[i])) {
+            if (n > 0 && out[n - 1] != ' ') out[n++] = ' ';
+            continue;
+        }
+        if (text[i] == '*' && n > 0 && out[n - 1] != ' ' && out[n - 1] != '*') out[n++] = ' ';
+        out[n++] = text[i];
+    }
+    while (n > 0 && out[n - 1] == ' ')
+        n--;
+    out[n] = '\0';
+}
+
+// The identifier for Name<args>: Vec<unsigned char *> is Vec__unsigned_char_ptr
+static void mangle(const Template *t, char args[][96], int count, char *out, size_t size) {
+    size_t n = snprintf(out, size, "%s", t->name);
+    for (int a = 0; a < count && n + 3 < size; a++) {
+        n += snprintf(out + n, size - n, "__");
+        for (const char *p = args[a]; *p && n + 5 < size; p++) {
+            if (is_ident_char((unsigned char)*p)) {
+                out[n++] = *p;
+            } else if (*p == '*') {
+                n += snprintf(out + n, size - n, "%sptr", n > 0 && out[n - 1] == '_' ? "" : "_");
+            } else if (*p == ' ' && out[n - 1] != '_') {
+                out[n++] = '_';
+            }
+        }
+        out[n] = '\0';
+    }
+}
+
+static void declare(Instance *instance, LineBuffer *prelude);
+
+// The instance of t for args, made on first use. NULL after reporting an error.
+static Instance *instantiate(Template *t, char args[][96], int count, int number) {
+    if (count != t->param_count) {
+        char detail[128];
+        snprintf(detail, sizeof(detail), "%s takes %d type argument%s", t->name, t->param_count,
+                 t->param_count == 1 ? "" : "s");
+        report(number, "generic: ", detail);
+        return NULL;
+    }
+    char name[160];
+    mangle(t, args, count, name, sizeof(name));
+    for (int i = 0; i < instance_count; i++) {
+        if (strcmp(instances[i].name, name) == 0) return &instances[i];
+    }
+    if (instance_count == MAX_INSTANCES) {
+        report(number, "generic: too many instances, from ", name);
+        return NULL;
+    }
+
+    Instance *instance = &instances[instance_count++];
+    memset(instance, 0, sizeof(*instance));
+    instance->template = t;
+    snprintf(instance->name, sizeof(instance->name), "%s", name);
+    memcpy(instance->args, args, count * sizeof(instance->args[0]));
+    return instance;
+}
+
+// Copies line to out with each Name<args> replaced by its instance, whose
+// declaration goes to prelude if it is new
+static void rewrite_uses(const char *line, int number, LineBuffer *prelude, char *out, size_t size) {
+    size_t n = 0;
+    int    in_string = 0, in_char = 0;
+
+    for (const char *p = line; *p && n + 1 < size;) {
+        if (*p == '\\' && (in_string || in_char) && p[1]) {
+            out[n++] = *p++;
+            if (n + 1 < size) out[n++] = *p++;
+            continue;
+        }
+        if (*p == '"' && !in_char) in_string = !in_string;
+        if (*p == '\'' && !in_string) in_char = !in_char;
+        if (!in_string && !in_char && p[0] == '/' && p[1] == '/') {
+            n += snprintf(out + n, size - n, "%s", p);
+            break;
+        }
+
+        size_t    len = 0;
+        Template *t = NULL;
+        if (!in_string && !in_char && (p == line || !is_ident_char((unsigned char)p[-1]))) {
+            while (is_ident_char((unsigned char)p[len]))
+                len++;
+            if (len > 0 && p[len] == '<') t = find_template(p, len);
+        }
+        if (!t) {
+            out[n++] = *p++;
+            continue;
+        }
+
+        // The arguments, split at the commas outside nested <...>
+        char        args[MAX_PARAMS][96];
+        int         count = 0, nesting = 0;
+        const char *arg = p + len + 1, *q = arg;
+        for (; *q; q++) {
+            if (*q == '<' || *q == '(') nesting++;
+            if ((*q == '>' || *q == ')') && nesting-- == 0) break;
+            if (*q == ',' && nesting == 0) {
+                if (count < MAX_PARAMS) {
+                    char text[LINE_SIZE], inner[LINE_SIZE];
+                    snprintf(text, sizeof(text), "%.*s", (int)(q - arg), arg);
+                    rewrite_uses(text, number, prelude, inner, sizeof(inner));
+                    normalize_type(inner, strlen(inner), args[count], sizeof(args[count]));
+                }
+                count++;
+                arg = q + 1;
+            }
+        }
+        if (*q != '>') {
+            out[n++] = *p++; // Not closed on this line: a comparison after all
+            continue;
+        }
+        if (count < MAX_PARAMS) {
+            char text[LINE_SIZE], inner[LINE_SIZE];
+            snprintf(text, sizeof(text), "%.*s", (int)(q - arg), arg);
+            rewrite_uses(text, number, prelude, inner, sizeof(inner));
+            normalize_type(inner, strlen(inner), args[count], sizeof(args[count]));
+        }
+        count++;
+
+        Instance *instance = instantiate(t, args, count, number);
+        if (instance) declare(instance, prelude);
+        n += snprintf(out + n, size - n, "%s", instance ? instance->name : t->name);
+        p = q + 1;
+    }
+    out[n < size ? n : size - 1] = '\0';
+}
+
+// Line i of the instance's template, with its parameters and own name filled in
+static void expand_line(Instance *instance, int i, LineBuffer *prelude, char *out, size_t size) {
+    Template *t = instance->template;
+    char      text[LINE_SIZE], next[LINE_SIZE];
+
+    snprintf(text, sizeof(text), "%s", t->body.lines[i]);
+    for (int p = 0; p < t->param_count; p++) {
+        replace_word(text, t->params[p], instance->args[p], 0, next, sizeof(next));
+        strcpy(text, next);
+    }
+    rewrite_uses(text, t->line + i, prelude, next, sizeof(next));
+    replace_word(next, t->name, instance->name, 1, out, size);
+}
+
+// A struct field without its `;`, which plain structs need (rc_struct adds them
+// to rc structs)
+static void end_field(char *line, size_t size) {
+    char  *comment = strstr(line, "//");
+    size_t end = comment ? (size_t)(comment - line) : strcspn(line, "\n");
+    size_t len = end;
+    while (len > 0 && isspace((unsigned char)line[len - 1]))
+        len--;
+    if (len == 0 || strchr(";{}", line[len - 1]) || strlen(line) + 2 >= size) return;
+    memmove(line + len + 1, line + len, strlen(line + len) + 1);
+    line[len] = ';';
+}
+
+// Writes the instance's declaration to prelude the first time it is named:
+// the struct, or the function's prototype
+static void declare(Instance *instance, LineBuffer *prelude) {
+    if (instance->declared) return;
+    instance->declared = 1;
+    Template *t = instance->template;
+    char      line[LINE_SIZE];
+
+    if (!t->is_struct) {
+        // `static` so the C compiler may inline the instance and drop unused ones
+        expand_line(instance, 0, prelude, line, sizeof(line));
+        char *brace = strchr(line, '{');
+        if (brace) *brace = '\0';
+        size_t len = strlen(line);
+        while (len > 0 && isspace((unsigned char)line[len - 1]))
+            line[--len] = '\0';
+        const char *indent = line + strspn(line, " \t");
+        char        prototype[LINE_SIZE + 16];
+        snprintf(prototype, sizeof(prototype), "%s%s;\n", match_word(indent, "static") ? "" : "static ", indent);
+        push_line(prelude, prototype);
+        return;
+    }
+
+    // The struct after the instances its fields need
+    LineBuffer text = {0};
+    for (int i = 0; i < t->body.count; i++) {
+        expand_line(instance, i, prelude, line, sizeof(line));
+        if (!t->is_rc && i > 0 && i + 1 < t->body.count) end_field(line, sizeof(line));
+        if (!t->is_rc && i + 1 == t->body.count && line[strspn(line, " \t")] == '}' &&
+            !strchr(line, ';')) {
+            char *brace = strchr(line, '}');
+            memmove(brace + 2, brace + 1, strlen(brace + 1) + 1);
+            brace[1] = ';';
+        }
+        push_line(&text, line);
+    }
+    if (!t->is_rc) {
+        snprintf(line, sizeof(line), "typedef struct %s %s;\n", instance->name, instance->name);
+        push_line(prelude, line);
+    }
+    for (int i = 0; i < text.count; i++)
+        push_line(prelude, text.lines[i]);
+    free_lines(&text);
+}
+
+// The function instance's body, after the declarations it needs
+static void define(Instance *instance, FILE *out) {
+    LineBuffer prelude = {0}, text = {0};
+    char       line[LINE_SIZE];
+    Template  *t = instance->template;
+
+    instance->defined = 1;
+    for (int i = 0; i < t->body.count; i++) {
+        expand_line(instance, i, &prelude, line, sizeof(line));
+        if (i == 0 && !match_word(line + strspn(line, " \t"), "static")) {
+            char header[LINE_SIZE + 8];
+            size_t indent = strspn(line, " \t");
+            snprintf(header, sizeof(header), "%.*sstatic %s", (int)indent, line, line + indent);
+            push_line(&text, header);
+        } else {
+            push_line(&text, line);
+        }
+    }
+    fputc('\n', out);
+    flush_lines(&prelude, out);
+    flush_lines(&text, out);
+    free_lines(&prelude);
+    free_lines(&text);
+}
+
+// =========================== [ MAIN TRANSFORMATION ] ====================================
+
+int lower_generics(FILE *in, FILE *out) {
+    LineBuffer buf = {0};
+    char       line[LINE_SIZE];
+
+    pass_errors = 0;
+    template_count = instance_count = 0;
+    while (fgets(line, sizeof(line), in))
+        push_line(&buf, line);
+
+    // Collect the templates first, so they may be named before they are declared
+    int depth = 0;
+    for (int i = 0; i < buf.count; i++) {
+        const char *text = buf.lines[i] + strspn(buf.lines[i], " \t");
+        Template    t = {0};
+        const char *rest = depth == 0 ? parse_generic(text, &t) : NULL;
+        if (!rest) {
+            if (depth == 0 && match_word(text, "generic")) report(i + 1, "generic: expected generic(T, ...)", "");
+            depth += brace_delta(buf.lines[i]);
+            continue;
+        }
+
+        t.line = i + 1;
+        int before = pass_errors;
+        if (!parse_template_name(rest, &t)) {
+            report(i + 1, "generic: expected a struct or function after ", "generic(...)");
+        } else if (!strchr(rest, '{')) {
+            report(i + 1, "generic: the body must start on the header line: ", t.name);
+        } else if (find_template(t.name, strlen(t.name))) {
+            report(i + 1, "generic: declared twice: ", t.name);
+        } else if (template_count == MAX_TEMPLATES) {
+            report(i + 1, "generic: too many templates at ", t.name);
+        }
+
+        // The declaration through its closing brace; the lines become blank
+        int body_depth = brace_delta(rest);
+        push_line(&t.body, rest);
+        buf.lines[i][0] = '\0';
+        while (body_depth > 0 && i + 1 < buf.count) {
+            body_depth += brace_delta(buf.lines[++i]);
+            push_line(&t.body, buf.lines[i]);
+            buf.lines[i][0] = '\0';
+        }
+        if (body_depth > 0) report(t.line, "generic: no closing brace for ", t.name);
+        if (i + 1 < buf.count && buf.lines[i + 1][strspn(buf.lines[i + 1], " \t")] == '\n')
+            buf.lines[++i][0] = '\0'; // The blank line after it
+        if (pass_errors == before)
+            templates[template_count++] = t;
+        else
+            free_lines(&t.body);
+    }
+
+    // Each top-level declaration follows the instances it names
+    LineBuffer prelude = {0}, item = {0};
+    char       rewritten[LINE_SIZE];
+    depth = 0;
+    for (int i = 0; pass_errors == 0 && i < buf.count; i++) {
+        if (!buf.lines[i][0]) continue;
+        rewrite_uses(buf.lines[i], i + 1, &prelude, rewritten, sizeof(rewritten));
+        push_line(&item, rewritten);
+        depth += brace_delta(buf.lines[i]);
+        if (depth <= 0) {
+            flush_lines(&prelude, out);
+            flush_lines(&item, out);
+            depth = 0;
+        }
+    }
+    flush_lines(&prelude, out);
+    flush_lines(&item, out);
+
+    // Function bodies, including the instances they name in turn
+    for (int i = 0; pass_errors == 0 && i < instance_count; i++) {
+        if (!instances[i].template->is_struct && !instances[i].defined) define(&instances[i], out);
+    }
+
+    free_lines(&prelude);
+    free_lines(&item);
+    for (int i = 0; i < template_count; i++)
+        free_lines(&templates[i].body);
+    free_lines(&buf);
+    return pass_errors;
+}
@@ -0,0 +1,565 @@
+#define _POSIX_C_SOURCE 200809L
+// lib/iterators.c - Fuse `for x in` pipelines into one C loop
+//
+//     for y in range(0, n).map(|i| i * i).filter(|v| v % 3 == 0).take(4) {
+//         printf("%d\n", y)
+//     }
+//
+// becomes a single loop, with no array or function pointer in between:
+//
+//     for (__typeof__((0) + (n)) __i1 = (0), __end1 = (n), __taken1_3 = 0; __i1 < __end1; __i1++) {
+//         __typeof__(__i1 * __i1) __v1_1 = __i1 * __i1;
+//         if (!(__v1_1 % 3 == 0)) continue;
+//         if (__taken1_3 == (4)) break;
+//         __taken1_3++;
+//         __typeof__(__v1_1) y = __v1_1;
+//         printf("%d\n", y)
+//     }
+//
+// Sources:
+//   range(a, b)   a up to but not including b
+//   xs            an `array`, `soa` array, arena array or fixed-size C array
+//                 declared earlier, element by element
+//   zip(s, t)     pairs from two of the above, as long as the shorter lasts
+// Adaptors, applied left to right:
+//   .map(|x| e)       each value becomes e
+//   .filter(|x| c)    values for which c is false are skipped
+//   .take(n)          at most n values
+// Pairs are taken apart with `|(a, b)| ...` and `for (a, b) in ...`; the
+// loop variable can be given a type, `for long x in ...`, else it has the
+// type of its value. The header and its `{` share a line; `break` and
+// `continue` in the body work as in any C loop.
+#include "common.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_SOURCES 256
+#define MAX_STAGES 16
+#define LINE_SIZE 4096
+#define EXPR_SIZE 1024
+
+typedef enum { SOURCE_ARRAY, SOURCE_SOA, SOURCE_POINTER, SOURCE_FIXED } SourceKind;
+
+typedef struct {
+    char       name[64];
+    SourceKind kind;
+    char       detail[128]; // Element type of an array, length of an arena array
+} Source;
+
+typedef struct {
+    char names[2][64];
+    int  count; // 1, or 2 for a pair
+} Pattern;
+
+static Source sources[MAX_SOURCES];
+static int    source_count;
+static int    loop_count;
+
+// =========================== [ HELPERS ] =========================================
+
+// The bracket closing the one at p, skipping literals; NULL when there is none
+static const char *closing(const char *p) {
+    int nesting = 0, in_string = 0, in_char = 0;
+    for (; *p; p++) {
+        if (*p == '\\' && (in_string || in_char) && p[1]) {
+            p++;
+            continue;
+        }
+        if (*p == '"' && !in_char) in_string = !in_string;
+        if (*p == '\'' && !in_string) in_char = !in_char;
+        if (in_string || in_char) continue;
+        if (*p == '(' || *p == '[' || *p == '{') nesting++;
+        if ((*p == ')' || *p == ']' || *p == '}') && --nesting == 0) return p;
+    }
+    return NULL;
+}
+
+// Splits text at its top-level commas into at most max trimmed parts
+static int split_arguments(const char *text, char parts[][EXPR_SIZE], int max) {
+    int         count = 0;
+    const char *start = text;
+    for (const char *p = text;; p++) {
+        if (*p == '(' || *p == '[' || *p == '{' || *p == '"' || *p == '\'') {
+            const char *end = *p == '"' || *p == '\'' ? strchr(p + 1, *p) : closing(p);
+            if (end) p = end;
+            continue;
+        }
+        if (*p != ',' && *p != '\0') continue;
+        if (count < max) {
+            snprintf(parts[count], EXPR_SIZE, "%.*s", (int)(p - start), start);
+            trim(parts[count]);
+        }
+        count++;
+        if (*p == '\0') break;
+        start = p + 1;
+    }
+    return count == 1 && !parts[0][0] ? 0 : count;
+}
+
+static Source *find_source(const char *name) {
+    for (int i = source_count - 1; i >= 0; i--) {
+        if (strcmp(sources[i].name, name) == 0) return &sources[i];
+    }
+    return NULL;
+}
+
+static void add_source(const char *name, size_t len, SourceKind kind, const char *detail) {
+    if (source_count == MAX_SOURCES || len == 0 || len >= sizeof(sources[0].name)) return;
+    snprintf(sources[source_count].name, sizeof(sources[0].name), "%.*s", (int)len, name);
+    sources[source_count].kind = kind;
+    snprintf(sources[source_count++].detail, sizeof(sources[0].detail), "%s", detail);
+}
+
+// Is value a name, or a name indexed by a name (which needs no parentheses
+// and keeps `ps[i].x` on an soa array a column read)?
+static int is_postfix(const char *value) {
+    size_t len = 0;
+    while (is_ident_char((unsigned char)value[len]))
+        len++;
+    if (len == 0 || isdigit((unsigned char)value[0])) return 0;
+    if (value[len] == '\0') return 1;
+    if (value[len] != '[') return 0;
+    size_t index = ++len;
+    while (is_ident_char((unsigned char)value[len]))
+        len++;
+    return len > index && value[len] == ']' && value[len + 1] == '\0';
+}
+
+// Copies body to out with each name in the pattern replaced by its value
+static void substitute(const char *body, const Pattern *pattern, char values[][EXPR_SIZE], char *out,
+                       size_t size) {
+    size_t n = 0;
+    int    in_string = 0, in_char = 0;
+
+    for (const char *p = body; *p && n + 1 < size;) {
+        if (*p == '\\' && (in_string || in_char) && p[1]) {
+            out[n++] = *p++;
+            if (n + 1 < size) out[n++] = *p++;
+            continue;
+        }
+        if (*p == '"' && !in_char) in_string = !in_string;
+        if (*p == '\'' && !in_string) in_char = !in_char;
+        if (in_string || in_char || !is_ident_char((unsigned char)*p) ||
+            (p > body && is_ident_char((unsigned char)p[-1]))) {
+            out[n++] = *p++;
+            continue;
+        }
+
+        size_t len = 0;
+        while (is_ident_char((unsigned char)p[len]))
+            len++;
+        int member = p > body && (p[-1] == '.' || (p - body > 1 && p[-1] == '>' && p[-2] == '-'));
+        int match = -1;
+        for (int i = 0; i < pattern->count && !member; i++) {
+            if (strlen(pattern->names[i]) == len && strncmp(pattern->names[i], p, len) == 0) match = i;
+        }
+        if (match < 0)
+            n += snprintf(out + n, size - n, "%.*s", (int)len, p);
+        else if (is_postfix(values[match]))
+            n += snprintf(out + n, size - n, "%s", values[match]);
+        else
+            n += snprintf(out + n, size - n, "(%s)", values[match]);
+        if (n >= size) n = size - 1;
+        p += len;
+    }
+    out[n] = '\0';
+}
+
+// `x`, or `(a, b)`: 1 on success
+static int parse_pattern(const char *text, Pattern *pattern) {
+    char parts[3][EXPR_SIZE];
+    char inner[EXPR_SIZE];
+    snprintf(inner, sizeof(inner), "%s", text);
+    trim(inner);
+
+    pattern->count = 0;
+    if (inner[0] == '(') {
+        size_t len = strlen(inner);
+        if (inner[len - 1] != ')') return 0;
+        inner[len - 1] = '\0';
+        if (split_arguments(inner + 1, parts, 3) != 2) return 0;
+    } else {
+        snprintf(parts[0], EXPR_SIZE, "%s", inner);
+        if (!parts[0][0]) return 0;
+    }
+    int count = inner[0] == '(' ? 2 : 1;
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(parts[i]);
+        if (len == 0 || len >= 64 || isdigit((unsigned char)parts[i][0])) return 0;
+        for (size_t c = 0; c < len; c++) {
+            if (!is_ident_char((unsigned char)parts[i][c])) return 0;
+        }
+        memcpy(pattern->names[i], parts[i], len + 1);
+    }
+    pattern->count = count;
+    return 1;
+}
+
+// =========================== [ DECLARATIONS ] =========================================
+
+// Remembers the arrays a line declares, for loops over them later on
+static void note_declarations(const char *line) {
+    static const char *statement_words[] = {"return", "if", "else", "while", "for", "do", "switch", "case", "goto"};
+    const char        *p = line + strspn(line, " \t");
+    const char        *after;
+
+    // `[rc] array T name`, as add_arrays reads it
+    if ((after = match_word(p, "rc"))) p = after;
+    if ((after = match_word(p, "array")) && after > p + 5) {
+        size_t len = strcspn(after, "=;\n");
+        while (len > 0 && isspace((unsigned char)after[len - 1]))
+            len--;
+        size_t start = len;
+        while (start > 0 && is_ident_char((unsigned char)after[start - 1]))
+            start--;
+        char type[128];
+        snprintf(type, sizeof(type), "%.*s", (int)start, after);
+        trim(type);
+        if (type[0]) add_source(after + start, len - start, SOURCE_ARRAY, type);
+        return;
+    }
+    p = line + strspn(line, " \t");
+
+    // `soa [struct] T name[n]`, as lower_soa_arrays reads it
+    if ((after = match_word(p, "soa")) && after > p + 3) {
+        const char *bracket = strchr(after, '[');
+        const char *name = bracket;
+        while (name && name > after && isspace((unsigned char)name[-1]))
+            name--;
+        const char *end = name;
+        while (name && name > after && is_ident_char((unsigned char)name[-1]))
+            name--;
+        if (name) add_source(name, end - name, SOURCE_SOA, "");
+        return;
+    }
+
+    // `T *name = arena_array(arena, T, n)`, as add_arena_support writes it
+    const char *call = strstr(p, "= arena_array(");
+    if (call) {
+        const char *end = call;
+        while (end > p && isspace((unsigned char)end[-1]))
+            end--;
+        const char *name = end;
+        while (name > p && is_ident_char((unsigned char)name[-1]))
+            name--;
+        const char *close = closing(strchr(call, '('));
+        const char *comma = close ? close : NULL;
+        while (comma && comma > call && *comma != ',')
+            comma--;
+        if (comma && *comma == ',') {
+            char length[128];
+            snprintf(length, sizeof(length), "%.*s", (int)(close - comma - 1), comma + 1);
+            trim(length);
+            add_source(name, end - name, SOURCE_POINTER, length);
+        }
+        return;
+    }
+
+    // `T name[N]` and `T name[] = {...}`: type words, then the name and `[`
+    const char *q = p;
+    int         words = 0;
+    for (;;) {
+        q += strspn(q, " \t*");
+        if (!is_ident_char((unsigned char)*q) || isdigit((unsigned char)*q)) break;
+        const char *word = q;
+        while (is_ident_char((unsigned char)*q))
+            q++;
+        if (words == 0) {
+            for (size_t i = 0; i < sizeof(statement_words) / sizeof(statement_words[0]); i++) {
+                if (match_word(word, statement_words[i])) return;
+            }
+        }
+        words++;
+        const char *next = q + strspn(q, " \t");
+        if (*next == '[' && words >= 2 && !strchr(word, '(')) {
+            add_source(word, q - word, SOURCE_FIXED, "");
+            return;
+        }
+        if (*next != '*' && !is_ident_char((unsigned char)*next)) return;
+    }
+}
+
+// =========================== [ LOOPS ] =========================================
+
+typedef struct {
+    char init[EXPR_SIZE * 2]; // For-init declarations after the index
+    char cond[EXPR_SIZE * 2];
+    char values[2][EXPR_SIZE];
+    int  count;
+    int  ranged; // A lone range, counted in its own type
+} Loop;
+
+// Adds one source of a loop: its element and its bound on the index
+static int add_element(Loop *loop, const char *text, int number, const char *index, int zipped) {
+    char        args[3][EXPR_SIZE];
+    const char *after;
+    if ((after = match_word(text, "range")) && *after == '(') {
+        const char *close = closing(after);
+        char        inner[EXPR_SIZE];
+        snprintf(inner, sizeof(inner), "%.*s", close ? (int)(close - after - 1) : 0, after + 1);
+        if (!close || close[1] || split_arguments(inner, args, 3) != 2) {
+            report(number, "iterator: expected range(start, end), not ", text);
+            return 0;
+        }
+        char  *value = loop->values[loop->count++];
+        size_t used = strlen(loop->cond), written;
+        if (!zipped) {
+            loop->ranged = 1;
+            written = snprintf(loop->init, sizeof(loop->init), "__typeof__((%s) + (%s)) %s = (%s), __end%d = (%s)",
+                               args[0], args[1], index, args[0], loop_count, args[1]);
+            snprintf(loop->cond, sizeof(loop->cond), "%s < __end%d", index, loop_count);
+            snprintf(value, EXPR_SIZE, "%s", index);
+        } else {
+            written = snprintf(loop->cond + used, sizeof(loop->cond) - used,
+                               "%s%s < ((%s) > (%s) ? (size_t)((%s) - (%s)) : 0)", used ? " && " : "", index,
+                               args[1], args[0], args[1], args[0]);
+            written += snprintf(value, EXPR_SIZE, "(__typeof__((%s) + (%s)))(%s + (%s))", args[0], args[1], index,
+                                args[0]);
+        }
+        if (written >= EXPR_SIZE) report(number, "iterator: range too long: ", text);
+        return written < EXPR_SIZE;
+    }
+
+    Source *source = find_source(text);
+    if (!source) {
+        report(number, "iterator: not a range or an array of known length: ", text);
+        return 0;
+    }
+    char   length[EXPR_SIZE];
+    char  *value = loop->values[loop->count++];
+    size_t used = strlen(loop->cond);
+    switch (source->kind) {
+    case SOURCE_ARRAY:
+        snprintf(length, sizeof(length), "array_len(%s)", text);
+        snprintf(value, EXPR_SIZE, "((%s *)array_data(%s))[%s]", source->detail, text, index);
+        break;
+    case SOURCE_SOA:
+        snprintf(length, sizeof(length), "%s.length", text);
+        snprintf(value, EXPR_SIZE, "%s[%s]", text, index);
+        break;
+    case SOURCE_POINTER:
+        snprintf(length, sizeof(length), "(size_t)(%s)", source->detail);
+        snprintf(value, EXPR_SIZE, "%s[%s]", text, index);
+        break;
+    case SOURCE_FIXED:
+        snprintf(length, sizeof(length), "sizeof(%s) / sizeof((%s)[0])", text, text);
+        snprintf(value, EXPR_SIZE, "%s[%s]", text, index);
+        break;
+    }
+    snprintf(loop->cond + used, sizeof(loop->cond) - used, "%s%s < %s", used ? " && " : "", index, length);
+    return 1;
+}
+
+// `|x| body` or `|(a, b)| body`
+static int parse_lambda(const char *text, Pattern *pattern, char *body, size_t size) {
+    const char *p = text + strspn(text, " \t");
+    if (*p != '|') return 0;
+    const char *bar = strchr(p + 1, '|');
+    if (!bar) return 0;
+    char params[EXPR_SIZE];
+    snprintf(params, sizeof(params), "%.*s", (int)(bar - p - 1), p + 1);
+    if (!parse_pattern(params, pattern)) return 0;
+    snprintf(body, size, "%s", bar + 1);
+    trim(body);
+    return body[0] != '\0';
+}
+
+// Writes the loop for `for <pattern> in <pipeline> {rest`; 0 on errors
+static int write_loop(FILE *out, int indent, const char *pattern_text, const char *pipeline, const char *rest,
+                      int number) {
+    Loop        loop = {0};
+    char        index[32], stages[MAX_STAGES][EXPR_SIZE * 2];
+    int         stage_count = 0;
+    const char *p = pipeline;
+    const char *after;
+
+    loop_count++;
+    snprintf(index, sizeof(index), "__i%d", loop_count);
+
+    // The source runs up to the first `.adaptor(` outside brackets
+    const char *dot = p;
+    while (*dot && *dot != '.') {
+        const char *end = *dot == '(' || *dot == '[' ? closing(dot) : NULL;
+        dot = end ? end + 1 : dot + 1;
+    }
+    char source[EXPR_SIZE];
+    snprintf(source, sizeof(source), "%.*s", (int)(dot - p), p);
+    trim(source);
+    if ((after = match_word(source, "zip")) && *after == '(') {
+        char        args[3][EXPR_SIZE], inner[EXPR_SIZE];
+        const char *close = closing(after);
+        snprintf(inner, sizeof(inner), "%.*s", close ? (int)(close - after - 1) : 0, after + 1);
+        if (!close || close[1] || split_arguments(inner, args, 3) != 2) {
+            report(number, "iterator: expected zip(first, second), not ", source);
+            return 0;
+        }
+        if (!add_element(&loop, args[0], number, index, 1) || !add_element(&loop, args[1], number, index, 1))
+            return 0;
+    } else if (!add_element(&loop, source, number, index, 0)) {
+        return 0;
+    }
+    if (!loop.ranged) snprintf(loop.init, sizeof(loop.init), "size_t %s = 0", index);
+
+    // Adaptors, each one or two statements at the top of the body
+    for (p = dot; *p;) {
+        if (*p != '.') {
+            report(number, "iterator: expected .map, .filter or .take, not ", p);
+            return 0;
+        }
+        p++;
+        size_t len = 0;
+        while (is_ident_char((unsigned char)p[len]))
+            len++;
+        const char *open = p + len;
+        const char *close = *open == '(' ? closing(open) : NULL;
+        if (!close || stage_count == MAX_STAGES) {
+            report(number, "iterator: expected an adaptor call, not ", p);
+            return 0;
+        }
+        char adaptor[32], argument[EXPR_SIZE], body[EXPR_SIZE], rewritten[EXPR_SIZE];
+        snprintf(adaptor, sizeof(adaptor), "%.*s", (int)(len < 32 ? len : 31), p);
+        snprintf(argument, sizeof(argument), "%.*s", (int)(close - open - 1), open + 1);
+        trim(argument);
+        p = close + 1;
+        int     stage = stage_count + 1;
+        Pattern pattern;
+
+        if (strcmp(adaptor, "take") == 0) {
+            size_t used = strlen(loop.init);
+            snprintf(loop.init + used, sizeof(loop.init) - used, ", __taken%d_%d = 0", loop_count, stage);
+            snprintf(stages[stage_count++], sizeof(stages[0]), "if (__taken%d_%d == (%s)) break;\n%*s__taken%d_%d++;",
+                     loop_count, stage, argument, indent + 4, "", loop_count, stage);
+            continue;
+        }
+        if (strcmp(adaptor, "map") != 0 && strcmp(adaptor, "filter") != 0) {
+            report(number, "iterator: no such adaptor: ", adaptor);
+            return 0;
+        }
+        if (!parse_lambda(argument, &pattern, body, sizeof(body))) {
+            report(number, "iterator: expected |x| expression, not ", argument);
+            return 0;
+        }
+        if (pattern.count != loop.count) {
+            report(number, loop.count == 2 ? "iterator: pairs are taken apart with |(a, b)|, not " :
+                                             "iterator: only zip gives pairs: ",
+                   argument);
+            return 0;
+        }
+        substitute(body, &pattern, loop.values, rewritten, sizeof(rewritten));
+        size_t written;
+        if (adaptor[0] == 'f') {
+            written = snprintf(stages[stage_count++], sizeof(stages[0]), "if (!(%s)) continue;", rewritten);
+        } else {
+            written = snprintf(stages[stage_count++], sizeof(stages[0]), "__typeof__(%s) __v%d_%d = %s;", rewritten,
+                               loop_count, stage, rewritten);
+            snprintf(loop.values[0], EXPR_SIZE, "__v%d_%d", loop_count, stage);
+            loop.count = 1;
+        }
+        if (written >= sizeof(stages[0])) {
+            report(number, "iterator: adaptor too long: ", argument);
+            return 0;
+        }
+    }
+
+    // The loop variables: `(a, b)`, `x` or `T x`
+    Pattern pattern;
+    char    type[EXPR_SIZE] = "";
+    if (!parse_pattern(pattern_text, &pattern)) {
+        snprintf(type, sizeof(type), "%s", pattern_text);
+        size_t end = strlen(type), start = end;
+        while (start > 0 && is_ident_char((unsigned char)type[start - 1]))
+            start--;
+        if (!parse_pattern(type + start, &pattern) || start == 0) {
+            report(number, "iterator: expected a loop variable, not ", pattern_text);
+            return 0;
+        }
+        type[start] = '\0';
+        trim(type);
+    }
+    if (pattern.count != loop.count) {
+        report(number, loop.count == 2 ? "iterator: zip gives pairs, taken apart with for (a, b) in, not " :
+                                         "iterator: only zip gives pairs: ",
+               pattern_text);
+        return 0;
+    }
+
+    fprintf(out, "%*sfor (%s; %s; %s++) {%s", indent, "", loop.init, loop.cond, index, rest);
+    for (int i = 0; i < stage_count; i++)
+        fprintf(out, "%*s%s\n", indent + 4, "", stages[i]);
+    for (int i = 0; i < pattern.count; i++) {
+        if (type[0])
+            fprintf(out, "%*s%s %s = %s;\n", indent + 4, "", type, pattern.names[i], loop.values[i]);
+        else
+            fprintf(out, "%*s__typeof__(%s) %s = %s;\n", indent + 4, "", loop.values[i], pattern.names[i],
+                    loop.values[i]);
+    }
+    return 1;
+}
+
+// `for <pattern> in <pipeline> {`: splits the header; 0 for any other line
+static int parse_header(const char *line, char *pattern, char *pipeline, char *rest, int number) {
+    const char *p = match_word(line + strspn(line, " \t"), "for");
+    if (!p) return 0;
+
+    // The pattern is a pair in parentheses or runs up to the first ` in `
+    const char *in = p;
+    if (*p == '(') {
+        in = closing(p);
+        if (!in) return 0;
+        in += 1 + strspn(in + 1, " \t");
+        if (!match_word(in, "in")) return 0;
+    } else {
+        while (*in && !(in > p && !is_ident_char((unsigned char)in[-1]) && match_word(in, "in")))
+            in++;
+        if (!*in) return 0;
+    }
+    snprintf(pattern, EXPR_SIZE, "%.*s", (int)(in - p), p);
+    trim(pattern);
+
+    const char *start = match_word(in, "in");
+    const char *brace = NULL;
+    for (const char *q = start; *q; q++) {
+        if (*q == '(' || *q == '[') {
+            const char *end = closing(q);
+            if (!end) break;
+            q = end;
+        } else if (*q == '{' || (q[0] == '/' && q[1] == '/')) {
+            brace = *q == '{' ? q : NULL;
+            break;
+        }
+    }
+    if (!brace) {
+        char header[LINE_SIZE];
+        snprintf(header, sizeof(header), "%s", line);
+        trim(header);
+        report(number, "iterator: the loop's `{` goes on its header line: ", header);
+        return -1;
+    }
+    snprintf(pipeline, EXPR_SIZE, "%.*s", (int)(brace - start), start);
+    trim(pipeline);
+    snprintf(rest, EXPR_SIZE, "%s", brace + 1);
+    return 1;
+}
+
+// =========================== [ MAIN TRANSFORMATION ] ====================================
+
+int lower_iterators(FILE *in, FILE *out) {
+    char line[LINE_SIZE], pattern[EXPR_SIZE], pipeline[EXPR_SIZE], rest[EXPR_SIZE];
+    int  number = 0;
+
+    pass_errors = 0;
+    loop_count = source_count = 0;
+    while (fgets(line, sizeof(line), in)) {
+        number++;
+        int header = parse_header(line, pattern, pipeline, rest, number);
+        if (header == 0) {
+            note_declarations(line);
+            fputs(line, out);
+            continue;
+        }
+        if (header > 0 && !write_loop(out, strspn(line, " \t"), pattern, pipeline, rest, number)) fputs(line, out);
+    }
+    return pass_errors;
+}
@@ -0,0 +1,411 @@
+// lib/map.c - Swiss table: one control byte per slot, probed a group at a time
+#include "map.h"
+#include "arena.h"
+#include "simd.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef SAM_SIMD_X86
+#include <emmintrin.h>
+#endif
+
+#define MAP_GROUP 16
+#define MAP_MIN_CAPACITY 16
+#define MAP_NONE ((size_t)-1)
+
+// Control bytes: full slots hold the top 7 bits of the hash (0..127)
+#define CTRL_EMPTY ((int8_t)-128)
+#define CTRL_DELETED ((int8_t)-2)
+
+struct Map {
+    int8_t       *ctrl;        // capacity + MAP_GROUP bytes; the tail mirrors the first group
+    char         *slots;       // capacity * slot_size bytes, key then value
+    size_t        capacity;    // Power of two, 0 until the first insert
+    size_t        count;
+    size_t        growth_left; // Inserts into empty slots left before a rehash
+    size_t        key_size;
+    size_t        value_size;
+    size_t        value_offset;
+    size_t        slot_size;
+    int           string_keys;
+    struct Arena *arena; // NULL for RC maps
+};
+
+// A key about to be looked up: its bytes (or characters) and hashes
+typedef struct {
+    const void *key;
+    uint32_t    hash32; // 32-bit key hash; for strings, the one cached in the header
+    uint64_t    hash;   // hash32 spread over 64 bits for probing
+} MapKey;
+
+// =========================== [ GROUPS ] =========================================
+
+typedef uint32_t GroupMask; // Bit i set when slot pos + i matches
+
+static GroupMask group_match(const int8_t *ctrl, int8_t h2) {
+#ifdef SAM_SIMD_X86
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < MAP_GROUP; i++)
+        mask |= (GroupMask)(ctrl[i] == h2) << i;
+    return mask;
+#endif
+}
+
+static GroupMask group_empty(const int8_t *ctrl) { return group_match(ctrl, CTRL_EMPTY); }
+
+// Empty or deleted: the only control values below -1
+static GroupMask group_free(const int8_t *ctrl) {
+#ifdef SAM_SIMD_X86
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), group));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < MAP_GROUP; i++)
+        mask |= (GroupMask)(ctrl[i] < -1) << i;
+    return mask;
+#endif
+}
+
+static int lowest_bit(GroupMask mask) {
+#if defined(__GNUC__) && !defined(__TINYC__)
+    return __builtin_ctz(mask);
+#else
+    int bit = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static int highest_bit(GroupMask mask) {
+    int bit = 0;
+    while (mask >>= 1)
+        bit++;
+    return bit;
+}
+
+// =========================== [ HASHING ] =========================================
+
+static uint64_t spread(uint32_t hash32) { return (uint64_t)hash32 * 0x9E3779B97F4A7C15ULL; }
+
+static int8_t h2_of(uint64_t hash) { return (int8_t)(hash >> 57); }
+
+// Byte keys are usually integers or small structs; mix those inline instead of
+// going through the block hash kernel, which is built for long strings
+static uint32_t bytes_hash(const void *key, size_t size) {
+    if (size > 16) return string_hash32_bytes(key, size);
+
+    uint64_t lo = 0, hi = 0;
+    memcpy(&lo, key, size < 8 ? size : 8);
+    if (size > 8) memcpy(&hi, (const char *)key + 8, size - 8);
+    uint64_t hash = (lo ^ 0x9E3779B185EBCA87ULL) * 0xC2B2AE3D27D4EB4FULL;
+    hash ^= (hi + size) * 0x165667B19E3779F9ULL;
+    hash ^= hash >> 29;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static MapKey byte_key(map m, const void *key) {
+    MapKey mk = {key, bytes_hash(key, m->key_size), 0};
+    mk.hash = spread(mk.hash32);
+    return mk;
+}
+
+static MapKey string_key(string key) {
+    MapKey mk = {key, string_hash32(key), 0};
+    mk.hash = spread(mk.hash32);
+    return mk;
+}
+
+static MapKey cstr_key(const char *key) {
+    MapKey mk = {key, string_hash32_bytes(key, strlen(key)), 0};
+    mk.hash = spread(mk.hash32);
+    return mk;
+}
+
+static char *slot_at(map m, size_t index) { return m->slots + index * m->slot_size; }
+
+static uint64_t slot_hash(map m, const char *slot) {
+    if (m->string_keys) return spread(string_hash32(*(string *)slot));
+    return spread(bytes_hash(slot, m->key_size));
+}
+
+static int key_matches(map m, const char *slot, const MapKey *mk) {
+    if (!m->string_keys) return memcmp(slot, mk->key, m->key_size) == 0;
+    string stored = *(string *)slot;
+    return stored == mk->key ||
+           (string_hash32(stored) == mk->hash32 && strcmp(stored, mk->key) == 0);
+}
+
+// =========================== [ PROBING ] =========================================
+// Windows start at any slot (the mirrored tail keeps the load in bounds) and
+// advance by triangular multiples of the group width, which on a power-of-two
+// table visits every window exactly once.
+
+static void set_ctrl(map m, size_t index, int8_t value) {
+    m->ctrl[index] = value;
+    if (index < MAP_GROUP) m->ctrl[m->capacity + index] = value;
+}
+
+static size_t find_index(map m, const MapKey *mk) {
+    if (m->capacity == 0) return MAP_NONE;
+
+    size_t mask = m->capacity - 1;
+    size_t pos = mk->hash & mask;
+    int8_t h2 = h2_of(mk->hash);
+    for (size_t stride = MAP_GROUP;; stride += MAP_GROUP) {
+        const int8_t *group = m->ctrl + pos;
+        for (GroupMask hits = group_match(group, h2); hits; hits &= hits - 1) {
+            size_t index = (pos + lowest_bit(hits)) & mask;
+            if (key_matches(m, slot_at(m, index), mk)) return index;
+        }
+        if (group_empty(group)) return MAP_NONE;
+        pos = (pos + stride) & mask;
+    }
+}
+
+static size_t find_insert_index(map m, uint64_t hash) {
+    size_t mask = m->capacity - 1;
+    size_t pos = hash & mask;
+    for (size_t stride = MAP_GROUP;; stride += MAP_GROUP) {
+        GroupMask free_slots = group_free(m->ctrl + pos);
+        if (free_slots) return (pos + lowest_bit(free_slots)) & mask;
+        pos = (pos + stride) & mask;
+    }
+}
+
+// =========================== [ STORAGE ] =========================================
+
+static size_t max_load(size_t capacity) { return capacity - capacity / 8; }
+
+// Largest power of two dividing size, capped at 8
+static size_t natural_align(size_t size) {
+    size_t align = 1;
+    while (align < 8 && size % (align * 2) == 0)
+        align *= 2;
+    return align;
+}
+
+static size_t round_up(size_t n, size_t align) { return (n + align - 1) / align * align; }
+
+static int map_resize(map m, size_t capacity) {
+    size_t ctrl_bytes = round_up(capacity + MAP_GROUP, 16);
+    size_t total = ctrl_bytes + capacity * m->slot_size;
+    char  *block = m->arena ? arena_alloc(m->arena, total) : malloc(total);
+    if (!block) return 0;
+
+    int8_t *old_ctrl = m->ctrl;
+    char   *old_slots = m->slots;
+    size_t  old_capacity = m->capacity;
+
+    m->ctrl = (int8_t *)block;
+    m->slots = block + ctrl_bytes;
+    m->capacity = capacity;
+    m->growth_left = max_load(capacity) - m->count;
+    memset(m->ctrl, CTRL_EMPTY, capacity + MAP_GROUP);
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_ctrl[i] < 0) continue;
+        const char *slot = old_slots + i * m->slot_size;
+        uint64_t    hash = slot_hash(m, slot);
+        size_t      index = find_insert_index(m, hash);
+        set_ctrl(m, index, h2_of(hash));
+        memcpy(slot_at(m, index), slot, m->slot_size);
+    }
+
+    if (!m->arena) free(old_ctrl);
+    return 1;
+}
+
+// Out of empty slots: double, unless tombstones are what filled the table
+static int map_grow(map m) {
+    if (m->capacity == 0) return map_resize(m, MAP_MIN_CAPACITY);
+    if (m->count <= max_load(m->capacity) / 2) return map_resize(m, m->capacity);
+    return map_resize(m, m->capacity * 2);
+}
+
+static map map_new(struct Arena *arena, size_t key_size, size_t value_size, int string_keys) {
+    map m;
+    if (arena) {
+        // Arena maps still carry a header so rc_retain on them stays harmless
+        RCHeader *header = arena_alloc_zero(arena, RC_HEADER_SIZE + sizeof(struct Map));
+        if (!header) return NULL;
+        rc_init_header(header, 1);
+        m = (map)((char *)header + RC_HEADER_SIZE);
+    } else {
+        m = rc_alloc(sizeof(struct Map));
+        if (!m) return NULL;
+    }
+
+    size_t key_align = natural_align(key_size);
+    size_t value_align = natural_align(value_size);
+    m->key_size = key_size;
+    m->value_size = value_size;
+    m->value_offset = round_up(key_size, value_align);
+    m->slot_size = round_up(m->value_offset + value_size,
+                            key_align > value_align ? key_align : value_align);
+    m->string_keys = string_keys;
+    m->arena = arena;
+    return m;
+}
+
+// Drop the key references an RC string map holds
+static void release_keys(map m) {
+    if (!m->string_keys || m->arena) return;
+    for (size_t i = 0; i < m->capacity; i++) {
+        if (m->ctrl[i] >= 0) rc_release(*(string *)slot_at(m, i));
+    }
+}
+
+// =========================== [ PUBLIC API ] =========================================
+
+map map_create(size_t key_size, size_t value_size) {
+    return map_new(NULL, key_size, value_size, 0);
+}
+
+map map_create_strings(size_t value_size) { return map_new(NULL, sizeof(string), value_size, 1); }
+
+map map_create_arena(struct Arena *arena, size_t key_size, size_t value_size) {
+    return arena ? map_new(arena, key_size, value_size, 0) : NULL;
+}
+
+map map_create_strings_arena(struct Arena *arena, size_t value_size) {
+    return arena ? map_new(arena, sizeof(string), value_size, 1) : NULL;
+}
+
+static void map_destroy(void *ptr) {
+    map m = ptr;
+    release_keys(m);
+    free(m->ctrl);
+}
+
+void map_release(map m) {
+    if (!m || m->arena) return;
+    rc_release_with(m, map_destroy);
+}
+
+size_t map_count(map m) { return m ? m->count : 0; }
+
+void map_reserve(map m, size_t count) {
+    if (!m) return;
+    size_t capacity = m->capacity ? m->capacity : MAP_MIN_CAPACITY;
+    while (max_load(capacity) < count)
+        capacity *= 2;
+    if (capacity > m->capacity) map_resize(m, capacity);
+}
+
+void map_clear(map m) {
+    if (!m || m->capacity == 0) return;
+    release_keys(m);
+    memset(m->ctrl, CTRL_EMPTY, m->capacity + MAP_GROUP);
+    m->count = 0;
+    m->growth_left = max_load(m->capacity);
+}
+
+static void *put_key(map m, const MapKey *mk, const void *key, const void *value) {
+    size_t index = find_index(m, mk);
+    int    inserted = index == MAP_NONE;
+
+    if (inserted) {
+        if (m->growth_left == 0 && !map_grow(m)) return NULL;
+        index = find_insert_index(m, mk->hash);
+        if (m->ctrl[index] == CTRL_EMPTY) m->growth_left--;
+        set_ctrl(m, index, h2_of(mk->hash));
+        m->count++;
+        memcpy(slot_at(m, index), key, m->key_size);
+    }
+
+    char *stored = slot_at(m, index) + m->value_offset;
+    if (value) {
+        memcpy(stored, value, m->value_size);
+    } else if (inserted) {
+        memset(stored, 0, m->value_size);
+    }
+    if (inserted && m->string_keys && !m->arena) rc_retain(*(string *)slot_at(m, index));
+    return stored;
+}
+
+static int remove_key(map m, const MapKey *mk) {
+    size_t index = find_index(m, mk);
+    if (index == MAP_NONE) return 0;
+    if (m->string_keys && !m->arena) rc_release(*(string *)slot_at(m, index));
+
+    // A slot no probe window ever saw full (an empty slot within reach on both
+    // sides) can go straight back to empty; otherwise leave a tombstone so
+    // probes keep walking past it.
+    size_t    mask = m->capacity - 1;
+    GroupMask empty_after = group_empty(m->ctrl + index);
+    GroupMask empty_before = group_empty(m->ctrl + ((index - MAP_GROUP) & mask));
+    int       never_full = empty_before && empty_after &&
+                     lowest_bit(empty_after) + (MAP_GROUP - 1 - highest_bit(empty_before)) <
+                         MAP_GROUP;
+
+    set_ctrl(m, index, never_full ? CTRL_EMPTY : CTRL_DELETED);
+    if (never_full) m->growth_left++;
+    m->count--;
+    return 1;
+}
+
+void *map_put(map m, const void *key, const void *value) {
+    if (!m || !key || m->string_keys) return NULL;
+    MapKey mk = byte_key(m, key);
+    return put_key(m, &mk, key, value);
+}
+
+void *map_get(map m, const void *key) {
+    if (!m || !key || m->string_keys) return NULL;
+    MapKey mk = byte_key(m, key);
+    size_t index = find_index(m, &mk);
+    return index == MAP_NONE ? NULL : slot_at(m, index) + m->value_offset;
+}
+
+int map_remove(map m, const void *key) {
+    if (!m || !key || m->string_keys) return 0;
+    MapKey mk = byte_key(m, key);
+    return remove_key(m, &mk);
+}
+
+void *map_put_str(map m, string key, const void *value) {
+    if (!m || !key || !m->string_keys) return NULL;
+    MapKey mk = string_key(key);
+    return put_key(m, &mk, &key, value);
+}
+
+void *map_get_str(map m, string key) {
+    if (!m || !key || !m->string_keys) return NULL;
+    MapKey mk = string_key(key);
+    size_t index = find_index(m, &mk);
+    return index == MAP_NONE ? NULL : slot_at(m, index) + m->value_offset;
+}
+
+void *map_get_cstr(map m, const char *key) {
+    if (!m || !key || !m->string_keys) return NULL;
+    MapKey mk = cstr_key(key);
+    size_t index = find_index(m, &mk);
+    return index == MAP_NONE ? NULL : slot_at(m, index) + m->value_offset;
+}
+
+int map_remove_str(map m, string key) {
+    if (!m || !key || !m->string_keys) return 0;
+    MapKey mk = string_key(key);
+    return remove_key(m, &mk);
+}
+
+int map_next(map m, size_t *iter, void **key, void **value) {
+    if (!m) return 0;
+    for (size_t i = *iter; i < m->capacity; i++) {
+        if (m->ctrl[i] < 0) continue;
+        char *slot = slot_at(m, i);
+        if (key) *key = m->string_keys ? *(void **)slot : (void *)slot;
+        if (value) *value = slot + m->value_offset;
+        *iter = i + 1;
+        return 1;
+    }
+    *iter = m->capacity;
+    return 0;
+}
@@ -0,0 +1,52 @@
+// map.h - Open-addressing hash map (Swiss table) for the runtime
+#ifndef SAM_MAP_H
+#define SAM_MAP_H
+
+#include "safety.h"
+#include <stddef.h>
+#include <stdint.h>
+
+struct Arena;
+
+// Keys and values live inline in one slot array; a parallel array of control
+// bytes (7 hash bits per full slot) is probed 16 slots at a time with SSE2.
+//
+// Byte-keyed maps hash and compare key_size raw bytes. String-keyed maps store
+// the `string` pointer, compare by content and take the hash cached in the
+// string header, so a key is hashed once however often it is looked up or
+// rehashed. RC maps are refcounted (map_release frees the table and drops the
+// key references); arena maps allocate from the arena, do not retain their
+// keys, and are reclaimed by arena_destroy.
+typedef struct Map *map;
+
+map    map_create(size_t key_size, size_t value_size);
+map    map_create_strings(size_t value_size);
+map    map_create_arena(struct Arena *arena, size_t key_size, size_t value_size);
+map    map_create_strings_arena(struct Arena *arena, size_t value_size);
+void   map_release(map m);
+size_t map_count(map m);
+void   map_reserve(map m, size_t count);
+void   map_clear(map m);
+
+// Byte keys. map_put copies key and value in and returns the stored value,
+// valid until the next insert; a NULL value zero-fills a new entry and leaves
+// an existing one untouched.
+void *map_put(map m, const void *key, const void *value);
+void *map_get(map m, const void *key);
+int   map_remove(map m, const void *key);
+
+// String keys. map_get_cstr accepts any char *, including literals.
+void *map_put_str(map m, string key, const void *value);
+void *map_get_str(map m, string key);
+void *map_get_cstr(map m, const char *key);
+int   map_remove_str(map m, string key);
+
+// for (size_t it = 0; map_next(m, &it, &key, &value);) visits every entry.
+// key receives a pointer to the key bytes, or the string itself for string maps.
+int map_next(map m, size_t *iter, void **key, void **value);
+
+#define map_of(K, V) map_create(sizeof(K), sizeof(V))
+#define map_of_strings(V) map_create_strings(sizeof(V))
+#define map_value(ptr, V) (*(V *)(ptr))
+
+#endif
@@ -0,0 +1,282 @@
+// lib/memo.c - Lower `memo` functions to a cache in front of the body
+//
+//     memo long fib(int n) {
+//         if (n <= 1) return n;
+//         return fib(n - 1) + fib(n - 2);
+//     }
+//
+// The body moves to a static __memo_fib_compute and the name goes to a
+// wrapper that asks the function's cache (memo_cache.h) first, keyed on the
+// bytes of the arguments:
+//
+//     static MemoCache __memo_fib = MEMO_CACHE("fib", sizeof(int), sizeof(long), 4096, 4096);
+//     static long __memo_fib_compute(int n);
+//
+//     long fib(int n) {
+//         long          __value;
+//         long          __slot = memo_slot(n, 4096);
+//         unsigned char __key[sizeof(int)];
+//         memcpy(__key, &n, sizeof(int));
+//         if (memo_lookup(&__memo_fib, __slot, __key, &__value)) return __value;
+//         __value = __memo_fib_compute(n);
+//         memo_store(&__memo_fib, __slot, __key, &__value);
+//         return __value;
+//     }
+//
+//     static long __memo_fib_compute(int n) {
+//         ...
+//
+// Recursive calls name the wrapper, so they go through the cache as well.
+// `memo(size)` sets the size, 4096 by default: a lone integer argument below
+// it indexes the direct-mapped table and anything else is hashed into that
+// many entries. Arguments and the result must be plain values, since a
+// pointer or string would be compared by address and cached past its
+// release; whether the function is pure is up to its author.
+//
+// This runs after add_refcounting and elide_refcounts, which treat the body
+// like any other function's, and leaves the wrapper with nothing to count.
+#include "common.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMO_DEFAULT_SIZE 4096
+#define MAX_PARAMS 32
+
+typedef struct {
+    char name[64];
+    char type[128];
+} Param;
+
+typedef struct {
+    char  name[64];
+    char  type[128];   // Return type
+    char  params[1024]; // As written
+    Param list[MAX_PARAMS];
+    int   count;
+    long  size;
+    int   is_static;
+} MemoFn;
+
+
+// =========================== [ HELPERS ] =========================================
+
+// Space between a type and a name: none after a star
+static const char *gap(const char *type) { return type[strlen(type) - 1] == '*' ? "" : " "; }
+
+// =========================== [ TYPES ] =========================================
+
+// Types whose values are references: comparing or keeping their bits is not
+// comparing or keeping what they refer to
+static const char *const reference_words[] = {"string", "strview", "own_string", "Array", "map",
+                                              "chan",   "Arena",   "AsyncTask"};
+
+static const char *const integer_words[] = {
+    "char",     "short",   "int",       "long",     "signed",    "unsigned", "_Bool",
+    "bool",     "size_t",  "ssize_t",   "ptrdiff_t", "intptr_t", "uintptr_t", "const"};
+
+static int has_word(const char *type, const char *const *words, size_t count) {
+    for (const char *p = type; *p;) {
+        if (!is_ident_char((unsigned char)*p)) {
+            p++;
+            continue;
+        }
+        size_t len = 0;
+        while (is_ident_char((unsigned char)p[len]))
+            len++;
+        for (size_t i = 0; i < count; i++) {
+            if (strlen(words[i]) == len && strncmp(p, words[i], len) == 0) return 1;
+        }
+        p += len;
+    }
+    return 0;
+}
+
+static int is_plain_value(const char *type) {
+    return !strpbrk(type, "*[(") &&
+           !has_word(type, reference_words, sizeof(reference_words) / sizeof(reference_words[0]));
+}
+
+// Every word an integer type name or qualifier: `unsigned long`, `int64_t`
+static int is_integer(const char *type) {
+    int words = 0;
+    for (const char *p = type; *p;) {
+        if (!is_ident_char((unsigned char)*p)) {
+            p++;
+            continue;
+        }
+        char word[64];
+        size_t len = 0;
+        while (is_ident_char((unsigned char)p[len]) && len < sizeof(word) - 1) {
+            word[len] = p[len];
+            len++;
+        }
+        word[len] = '\0';
+        p += len;
+        int bits;
+        char tail[4];
+        int  fixed = sscanf(word, "int%d%3s", &bits, tail) == 2 || sscanf(word, "uint%d%3s", &bits, tail) == 2;
+        if (!(fixed && strcmp(tail, "_t") == 0) &&
+            !has_word(word, integer_words, sizeof(integer_words) / sizeof(integer_words[0])))
+            return 0;
+        words += strcmp(word, "const") != 0;
+    }
+    return words > 0;
+}
+
+// Splits fn->params into names and types; 0 when one is not `type name`
+static int split_params(MemoFn *fn, int number) {
+    char  params[1024];
+    char *param = params;
+    snprintf(params, sizeof(params), "%s", fn->params);
+    fn->count = 0;
+    trim(params);
+    if (!params[0] || strcmp(params, "void") == 0) return 1;
+
+    while (param) {
+        char *comma = strchr(param, ',');
+        if (comma) *comma = '\0';
+        trim(param);
+        size_t end = strlen(param), start = end;
+        while (start > 0 && is_ident_char((unsigned char)param[start - 1]))
+            start--;
+        if (fn->count == MAX_PARAMS || start == 0 || start == end || end - start >= sizeof(fn->list[0].name)) {
+            report(number, "memo parameters must be `type name`: ", param);
+            return 0;
+        }
+        Param *p = &fn->list[fn->count++];
+        snprintf(p->name, sizeof(p->name), "%s", param + start);
+        snprintf(p->type, sizeof(p->type), "%.*s", (int)start, param);
+        trim(p->type);
+        if (!is_plain_value(p->type)) {
+            report(number, "memo arguments must be plain values, not pointers, arrays or strings: ", param);
+            return 0;
+        }
+        param = comma ? comma + 1 : NULL;
+    }
+    return 1;
+}
+
+// =========================== [ FUNCTIONS ] =========================================
+
+// `[static] memo[(size)] type name(params)`: fills fn and returns the text
+// after the parameter list, or NULL. Sets *bad when the line is a memo
+// header that does not parse.
+static const char *parse_header(const char *line, MemoFn *fn, int number, int *bad) {
+    const char *p = line + strspn(line, " \t");
+    const char *next = match_word(p, "static");
+    fn->is_static = next != NULL;
+    if (next) p = next;
+    if (!(p = match_word(p, "memo"))) return NULL;
+
+    *bad = 1;
+    fn->size = MEMO_DEFAULT_SIZE;
+    if (*p == '(') {
+        char  size[64], *end;
+        const char *after = copy_parens(p, size, sizeof(size));
+        fn->size = after ? strtol(size, &end, 10) : 0;
+        if (!after || end == size || *end || fn->size <= 0) {
+            report(number, "memo size must be a positive integer", "");
+            return NULL;
+        }
+        p = after;
+    }
+
+    const char *open = strchr(p, '(');
+    if (!open) return NULL;
+    const char *name_end = open;
+    while (name_end > p && (name_end[-1] == ' ' || name_end[-1] == '\t'))
+        name_end--;
+    const char *name = name_end;
+    while (name > p && is_ident_char((unsigned char)name[-1]))
+        name--;
+    if (name == name_end || name == p || name_end - name >= (long)sizeof(fn->name)) return NULL;
+    if (name - p >= (long)sizeof(fn->type)) return NULL;
+
+    snprintf(fn->name, sizeof(fn->name), "%.*s", (int)(name_end - name), name);
+    snprintf(fn->type, sizeof(fn->type), "%.*s", (int)(name - p), p);
+    trim(fn->type);
+    const char *rest = copy_parens(open, fn->params, sizeof(fn->params));
+    if (!rest || (*rest != '{' && *rest != ';')) return NULL;
+    if (!fn->type[0] || strcmp(fn->type, "void") == 0 || !is_plain_value(fn->type)) {
+        report(number, "memo results must be plain values, not void, pointers or strings: ", fn->type);
+        return NULL;
+    }
+    if (!split_params(fn, number)) return NULL;
+    *bad = 0;
+    return rest;
+}
+
+// The cache, the body's prototype and the wrapper that takes the function's name
+static void write_wrapper(FILE *out, const MemoFn *fn) {
+    const char *name = fn->name, *type = fn->type;
+    char        key_size[2048] = "0";
+    size_t      used = 0;
+    for (int i = 0; i < fn->count; i++)
+        used += snprintf(key_size + used, sizeof(key_size) - used, "%ssizeof(%s)", i ? " + " : "",
+                         fn->list[i].type);
+
+    // A lone integer indexes the direct table; no arguments is one slot of it
+    int  direct = fn->count == 1 && is_integer(fn->list[0].type);
+    long slots = fn->count == 0 ? 1 : direct ? fn->size : 0;
+    long hashed = fn->count == 0 ? 0 : fn->size;
+
+    fprintf(out, "static MemoCache __memo_%s = MEMO_CACHE(\"%s\", %s, sizeof(%s), %ld, %ld);\n", name, name,
+            key_size, type, slots, hashed);
+    fprintf(out, "static %s%s__memo_%s_compute(%s);\n\n", type, gap(type), name, fn->params);
+
+    fprintf(out, "%s%s%s%s(%s) {\n", fn->is_static ? "static " : "", type, gap(type), name, fn->params);
+    fprintf(out, "    %s%s__value;\n", type, gap(type));
+    const char *key = "NULL";
+    if (fn->count == 0) {
+        fprintf(out, "    long __slot = 0;\n");
+    } else {
+        if (direct)
+            fprintf(out, "    long __slot = memo_slot(%s, %ld);\n", fn->list[0].name, fn->size);
+        else
+            fprintf(out, "    long __slot = -1;\n");
+        fprintf(out, "    unsigned char __key[%s];\n", key_size);
+        for (int i = 0; i < fn->count; i++) {
+            fprintf(out, "    memcpy(__key");
+            for (int j = 0; j < i; j++)
+                fprintf(out, " + sizeof(%s)", fn->list[j].type);
+            fprintf(out, ", &%s, sizeof(%s));\n", fn->list[i].name, fn->list[i].type);
+        }
+        key = "__key";
+    }
+    fprintf(out, "    if (memo_lookup(&__memo_%s, __slot, %s, &__value)) return __value;\n", name, key);
+    fprintf(out, "    __value = __memo_%s_compute(", name);
+    for (int i = 0; i < fn->count; i++)
+        fprintf(out, "%s%s", i ? ", " : "", fn->list[i].name);
+    fprintf(out, ");\n");
+    fprintf(out, "    memo_store(&__memo_%s, __slot, %s, &__value);\n", name, key);
+    fprintf(out, "    return __value;\n}\n\n");
+}
+
+// =========================== [ MAIN TRANSFORMATION ] ====================================
+
+int lower_memo_functions(FILE *in, FILE *out) {
+    char line[4096];
+    int  depth = 0, number = 0;
+
+    pass_errors = 0;
+    while (fgets(line, sizeof(line), in)) {
+        MemoFn      fn;
+        int         bad = 0, before = pass_errors;
+        const char *rest = depth == 0 ? parse_header(line, &fn, ++number, &bad) : (number++, NULL);
+
+        if (rest && *rest == '{') {
+            write_wrapper(out, &fn);
+            fprintf(out, "static %s%s__memo_%s_compute(%s) %s", fn.type, gap(fn.type), fn.name, fn.params, rest);
+        } else if (rest) {
+            fprintf(out, "%s%s%s%s(%s);\n", fn.is_static ? "static " : "", fn.type, gap(fn.type), fn.name,
+                    fn.params);
+        } else {
+            if (bad && pass_errors == before) report(number, "expected `memo type name(params) {` on one line", "");
+            fputs(line, out);
+        }
+        depth += brace_delta(line);
+    }
+    return pass_errors;
+}
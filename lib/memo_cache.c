@@ -0,0 +1,244 @@
+// lib/memo_cache.c - Direct-mapped and set-associative caches for `memo` functions
+#include "memo_cache.h"
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)
+#define MEMO_LOAD(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define MEMO_PUBLISH(field, value) __atomic_store_n(&(field), value, __ATOMIC_RELEASE)
+#define MEMO_COUNT(field, n) __atomic_fetch_add(&(field), n, __ATOMIC_RELAXED)
+#define MEMO_READ(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#else
+#define MEMO_LOAD(field) (field)
+#define MEMO_PUBLISH(field, value) ((field) = (value))
+#define MEMO_COUNT(field, n) ((field) += (n))
+#define MEMO_READ(field) (field)
+#endif
+
+enum { MEMO_EMPTY, MEMO_WRITING, MEMO_READY }; // Direct slot states
+
+static MemoCache *memo_caches; // Every cache that has allocated a table
+
+// Stores value into *field if it is still NULL; returns what *field holds
+static unsigned char *memo_install(unsigned char **field, unsigned char *value) {
+#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)
+    unsigned char *expected = NULL;
+    if (__atomic_compare_exchange_n(field, &expected, value, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return value;
+    free(value);
+    return expected;
+#else
+    return *field = value;
+#endif
+}
+
+static void memo_list(MemoCache *cache) {
+#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)
+    if (__atomic_exchange_n(&cache->listed, 1, __ATOMIC_ACQ_REL)) return;
+    cache->next = __atomic_load_n(&memo_caches, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&memo_caches, &cache->next, cache, 1, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED))
+        ;
+#else
+    if (cache->listed) return;
+    cache->listed = 1;
+    cache->next = memo_caches;
+    memo_caches = cache;
+#endif
+}
+
+// =========================== [ DIRECT TABLE ] ====================================
+
+// State bytes first, then the values from the next 8-byte boundary
+#define MEMO_VALUES(direct) (((direct) + 7) & ~(size_t)7)
+
+static int direct_lookup(MemoCache *cache, long slot, void *value) {
+    unsigned char *slots = MEMO_LOAD(cache->slots);
+    if (!slots || MEMO_LOAD(slots[slot]) != MEMO_READY) return 0;
+    memcpy(value, slots + MEMO_VALUES(cache->direct) + slot * cache->value_size, cache->value_size);
+    return 1;
+}
+
+static void direct_store(MemoCache *cache, long slot, const void *value) {
+    unsigned char *slots = MEMO_LOAD(cache->slots);
+    if (!slots) {
+        slots = calloc(1, MEMO_VALUES(cache->direct) + cache->direct * cache->value_size);
+        if (!slots) return;
+        slots = memo_install(&cache->slots, slots);
+        memo_list(cache);
+    }
+#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)
+    unsigned char state = MEMO_EMPTY;
+    if (!__atomic_compare_exchange_n(&slots[slot], &state, MEMO_WRITING, 0, __ATOMIC_ACQUIRE,
+                                     __ATOMIC_RELAXED))
+        return; // Another thread got there first
+#else
+    if (slots[slot] != MEMO_EMPTY) return;
+#endif
+    memcpy(slots + MEMO_VALUES(cache->direct) + slot * cache->value_size, value, cache->value_size);
+    MEMO_PUBLISH(slots[slot], MEMO_READY);
+    MEMO_COUNT(cache->stats.entries, 1);
+}
+
+// =========================== [ HASHED TABLE ] ====================================
+
+// The table starts with its set mask; each set is a lock and the round-robin
+// victim, then MEMO_WAYS entries of a tag (hash | 1, 0 when empty), the key
+// and the value
+typedef struct {
+    uint32_t lock;
+    uint32_t victim;
+} MemoSet;
+
+#define MEMO_HEADER 8
+
+static size_t entry_size(const MemoCache *cache) {
+    return 8 + ((cache->key_size + cache->value_size + 7) & ~(size_t)7);
+}
+
+static size_t set_size(const MemoCache *cache) {
+    return sizeof(MemoSet) + MEMO_WAYS * entry_size(cache);
+}
+
+static uint64_t memo_hash(const unsigned char *key, size_t size) {
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ size;
+    size_t   i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, key + i, 8);
+        h = (h ^ word) * 0x100000001b3ull;
+        h ^= h >> 29;
+    }
+    for (; i < size; i++)
+        h = (h ^ key[i]) * 0x100000001b3ull;
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ull;
+    return h ^ (h >> 32);
+}
+
+static MemoSet *find_set(const MemoCache *cache, unsigned char *table, uint64_t hash) {
+    uint64_t mask;
+    memcpy(&mask, table, sizeof(mask));
+    return (MemoSet *)(table + MEMO_HEADER + (hash & mask) * set_size(cache));
+}
+
+static void set_lock(MemoSet *set) {
+#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)
+    while (__atomic_exchange_n(&set->lock, 1, __ATOMIC_ACQUIRE)) {
+        // The holder copies one entry; if it is taking longer, it was preempted
+        for (int spins = 0; __atomic_load_n(&set->lock, __ATOMIC_RELAXED); spins++) {
+            if (spins >= 64) sched_yield();
+        }
+    }
+#else
+    (void)set;
+#endif
+}
+
+static void set_unlock(MemoSet *set) {
+#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)
+    __atomic_store_n(&set->lock, 0, __ATOMIC_RELEASE);
+#else
+    (void)set;
+#endif
+}
+
+// The entry holding key in set, or NULL
+static unsigned char *set_find(const MemoCache *cache, MemoSet *set, uint64_t tag, const void *key) {
+    unsigned char *entry = (unsigned char *)(set + 1);
+    for (int way = 0; way < MEMO_WAYS; way++, entry += entry_size(cache)) {
+        uint64_t stored;
+        memcpy(&stored, entry, 8);
+        if (stored == tag && memcmp(entry + 8, key, cache->key_size) == 0) return entry;
+    }
+    return NULL;
+}
+
+static int hashed_lookup(MemoCache *cache, const void *key, void *value) {
+    unsigned char *table = MEMO_LOAD(cache->sets);
+    if (!table) return 0;
+    uint64_t hash = memo_hash(key, cache->key_size);
+    MemoSet *set = find_set(cache, table, hash);
+    set_lock(set);
+    unsigned char *entry = set_find(cache, set, hash | 1, key);
+    if (entry) memcpy(value, entry + 8 + cache->key_size, cache->value_size);
+    set_unlock(set);
+    return entry != NULL;
+}
+
+static void hashed_store(MemoCache *cache, const void *key, const void *value) {
+    unsigned char *table = MEMO_LOAD(cache->sets);
+    if (!table) {
+        uint64_t sets = 1;
+        while (sets * MEMO_WAYS < cache->capacity)
+            sets *= 2;
+        table = calloc(1, MEMO_HEADER + sets * set_size(cache));
+        if (!table) return;
+        sets--;
+        memcpy(table, &sets, sizeof(sets));
+        table = memo_install(&cache->sets, table);
+        memo_list(cache);
+    }
+
+    uint64_t hash = memo_hash(key, cache->key_size), tag = hash | 1;
+    MemoSet *set = find_set(cache, table, hash);
+    set_lock(set);
+    if (!set_find(cache, set, tag, key)) {
+        unsigned char *first = (unsigned char *)(set + 1), *entry = NULL;
+        for (int way = 0; way < MEMO_WAYS && !entry; way++) {
+            uint64_t stored;
+            memcpy(&stored, first + way * entry_size(cache), 8);
+            if (stored == 0) entry = first + way * entry_size(cache);
+        }
+        if (entry) {
+            MEMO_COUNT(cache->stats.entries, 1);
+        } else {
+            entry = first + set->victim * entry_size(cache);
+            set->victim = (set->victim + 1) % MEMO_WAYS;
+            MEMO_COUNT(cache->stats.evictions, 1);
+        }
+        memcpy(entry, &tag, 8);
+        memcpy(entry + 8, key, cache->key_size);
+        memcpy(entry + 8 + cache->key_size, value, cache->value_size);
+    }
+    set_unlock(set);
+}
+
+// =========================== [ CACHES ] ====================================
+
+int memo_lookup(MemoCache *cache, long slot, const void *key, void *value) {
+    int hit = slot >= 0 ? direct_lookup(cache, slot, value) : hashed_lookup(cache, key, value);
+    if (hit)
+        MEMO_COUNT(cache->stats.hits, 1);
+    else
+        MEMO_COUNT(cache->stats.misses, 1);
+    return hit;
+}
+
+void memo_store(MemoCache *cache, long slot, const void *key, const void *value) {
+    if (slot >= 0)
+        direct_store(cache, slot, value);
+    else if (cache->capacity > 0)
+        hashed_store(cache, key, value);
+}
+
+MemoStats memo_cache_stats(MemoCache *cache) {
+    MemoStats stats;
+    stats.hits = MEMO_READ(cache->stats.hits);
+    stats.misses = MEMO_READ(cache->stats.misses);
+    stats.evictions = MEMO_READ(cache->stats.evictions);
+    stats.entries = MEMO_READ(cache->stats.entries);
+    return stats;
+}
+
+void memo_report(FILE *out) {
+    for (MemoCache *cache = MEMO_LOAD(memo_caches); cache; cache = cache->next) {
+        MemoStats          stats = memo_cache_stats(cache);
+        unsigned long long calls = stats.hits + stats.misses;
+        fprintf(out, "memo %s: %llu hits, %llu misses (%.1f%% hit rate), %llu entries, %llu evictions\n",
+                cache->name, stats.hits, stats.misses, calls ? 100.0 * stats.hits / calls : 0.0,
+                stats.entries, stats.evictions);
+    }
+}
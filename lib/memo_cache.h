@@ -0,0 +1,60 @@
+// memo_cache.h - Result caches behind `memo` functions
+#ifndef SAM_MEMO_CACHE_H
+#define SAM_MEMO_CACHE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Each `memo` function owns one cache, keyed on the bytes of its arguments.
+// A function of one integer argument (or none) keeps the keys in [0, direct)
+// in a direct-mapped table: a state byte and the value per slot, no key, no
+// hash, nothing evicted. Every other key goes to a hashed table of `capacity`
+// entries in sets of MEMO_WAYS, where a full set evicts its oldest entry, so
+// the cache stays bounded however many keys the program tries. Both tables
+// are allocated by the first store that needs them.
+//
+// Under --threads (SAM_RC_ATOMIC or SAM_RC_BIASED) all threads share the
+// cache: a direct slot is published with a release store once its value is
+// written, and each hashed set has a spinlock. Threads that miss on the same
+// key at once each compute it and the first store wins.
+#define MEMO_WAYS 4
+
+typedef struct {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    unsigned long long entries; // Values cached right now
+} MemoStats;
+
+typedef struct MemoCache {
+    const char       *name;
+    size_t            key_size;
+    size_t            value_size;
+    size_t            direct;   // Slots in the direct-mapped table
+    size_t            capacity; // Hashed entries, rounded up to a power of two
+    unsigned char    *slots;    // Direct table, NULL until the first store
+    unsigned char    *sets;     // Hashed table, NULL until the first store
+    MemoStats         stats;
+    int               listed; // On memo_report's list
+    struct MemoCache *next;
+} MemoCache;
+
+#define MEMO_CACHE(name, key_size, value_size, direct, capacity)                                   \
+    {name, key_size, value_size, direct, capacity, NULL, NULL, {0, 0, 0, 0}, 0, NULL}
+
+// Index of an integer key in a direct table of `direct` slots, or -1
+static inline long memo_slot(long long key, size_t direct) {
+    return key >= 0 && (unsigned long long)key < direct ? (long)key : -1;
+}
+
+// slot is the key's index in the direct table, or -1 to look key up by hash.
+// memo_lookup copies the cached value out and returns 1 on a hit.
+int  memo_lookup(MemoCache *cache, long slot, const void *key, void *value);
+void memo_store(MemoCache *cache, long slot, const void *key, const void *value);
+
+MemoStats memo_cache_stats(MemoCache *cache);
+void      memo_report(FILE *out); // One line per cache that has stored something
+
+#define memo_stats(fn) memo_cache_stats(&__memo_##fn)
+
+#endif
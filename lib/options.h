@@ -0,0 +1,27 @@
+// options.h - Command-line options shared by the transpiler passes
+#ifndef SAM_OPTIONS_H
+#define SAM_OPTIONS_H
+
+typedef enum {
+    RC_MODE_PLAIN,  // Default: non-atomic counts, single-threaded programs
+    RC_MODE_ATOMIC, // --threads: atomic counts (SAM_RC_ATOMIC)
+    RC_MODE_BIASED, // --threads=biased: owner-thread counts plus a shared one (SAM_RC_BIASED)
+} RcMode;
+
+typedef enum {
+    ALLOC_MODE_RC,     // Default: refcounted objects; --alloc=rc adds the program's malloc blocks
+    ALLOC_MODE_MALLOC, // --alloc=malloc: plain malloc/free for the program's blocks (SAM_ALLOC_MALLOC)
+    ALLOC_MODE_ARENA,  // --alloc=arena: everything from one region, freed at exit (SAM_ALLOC_ARENA)
+} AllocMode;
+
+typedef struct {
+    int       intern_literals; // --intern: string literals become string_intern("...")
+    RcMode    rc_mode;
+    AllocMode alloc_mode;
+    int       route_allocs;   // Any --alloc=: the program's malloc family goes through allocator.h
+    int       keep_refcounts; // --no-elide: keep every retain/release and heap string
+} SamOptions;
+
+extern SamOptions sam_options; // Defined in main.c, set before the passes run
+
+#endif
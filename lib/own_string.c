@@ -0,0 +1,756 @@
+// lib/own_string.c - Lower `own string` onto the header-less own_string runtime
+//
+// An own string has exactly one owner, so it needs no RCHeader and no counts:
+//
+//   own string s = "hi"            own_string s SAM_OWNED = own_string_create("hi");
+//   s = string_concat(s, "!")      own_string_append(&s, "!");
+//   own string t = s               own_string t SAM_OWNED = own_string_move(&s);
+//   printf("%s", t)          =>    printf("%s", t.ptr);
+//   string_length(t)               t.len
+//   string r = t                   string r = own_string_share(own_string_move(&t));
+//
+// Assignment and initialisation move: the source is nulled and may not be
+// used again until it is reassigned, which this pass checks per function,
+// following branches and refusing moves out of a variable inside a loop it
+// was declared outside of. SAM_OWNED frees the value once at scope exit.
+//
+// Elsewhere an own string is borrowed as its plain `.ptr`, for free. That is
+// only safe for code that never looks for an RCHeader in front of the text:
+// passing one to a runtime function that reads the header, or to a function
+// taking a refcounted `string`, is an error. A parameter declared `own string`
+// takes the argument over (the caller's variable is moved), and a function
+// returning `own string` hands its result to the caller.
+//
+// Runs before add_string_builders and add_refcounting, which then never see an
+// own string: its type is no longer the `string` keyword.
+#include "common.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// =========================== [ STRUCTS ] =========================================
+
+typedef enum { TYPE_OTHER, TYPE_RC, TYPE_OWN } OwnType;
+
+#define MAX_PARAMS 16
+
+typedef struct {
+    int     name; // Token index of the function name
+    OwnType returns;
+    int     param_count;
+    OwnType params[MAX_PARAMS];
+} Func;
+
+typedef struct {
+    int     name;  // Token index of the name
+    int     block; // Declaring block; the function body for parameters
+    OwnType type;  // TYPE_OWN or TYPE_RC
+} Var;
+
+typedef struct {
+    int  pos; // Byte offset the text goes in front of
+    char text[192];
+} Insert;
+
+typedef struct {
+    TokenStream ts;
+    Func       *funcs;
+    int         func_count, func_capacity;
+    Var        *vars;
+    int         var_count, var_capacity;
+    char       *deleted; // Per byte: dropped from the output
+    char       *handled; // Per token: already lowered by a statement form
+    Insert     *inserts;
+    int         insert_count, insert_capacity;
+    int         func;      // Func entry of the body being lowered, or -1
+    int        *moved;     // Per variable: line of the move that emptied it, 0 while it holds a value
+    int         revive;    // Variable whose assignment completes at token revive_at, or -1
+    int         revive_at;
+    int         errors;
+} OwnState;
+
+// Runtime functions that read their string arguments as plain const char *
+// and never look at a header; an own string may be lent to them as `.ptr`
+static const char *raw_functions[] = {
+    "string_create",       "string_concat",         "string_substr",
+    "string_length",       "string_builder_from",   "string_builder_append",
+    "string_builder_append_n", "strview_from",      "strview_eq",
+    "map_get_cstr",        "string_intern",         "string_hash32_bytes",
+};
+
+// Name prefixes of the runtime functions that do read or keep the header
+static const char *runtime_prefixes[] = {"string_", "strview_", "map_", "rc_", "arena_"};
+
+// Constructors and the own_string counterpart an own initialiser lowers them to
+static const char *own_constructors[][2] = {
+    {"string_create", "own_string_create"},
+    {"string_concat", "own_string_concat"},
+    {"string_substr", "own_string_substr"},
+    {"string_intern", "own_string_create"},
+};
+
+// Runtime functions returning a fresh reference an own string can take over
+static const char *fresh_functions[] = {"strview_to_string", "string_builder_finish"};
+
+// =========================== [ OUTPUT EDITS ] ====================================
+
+static void insert_text(OwnState *st, int pos, const char *text) {
+    if (st->insert_count >= st->insert_capacity) {
+        st->insert_capacity = st->insert_capacity ? st->insert_capacity * 2 : 16;
+        st->inserts = realloc(st->inserts, sizeof(Insert) * st->insert_capacity);
+    }
+    Insert *insert = &st->inserts[st->insert_count++];
+    insert->pos = pos;
+    snprintf(insert->text, sizeof(insert->text), "%s", text);
+}
+
+// Replace tokens first..last (inclusive) with text
+static void replace_tokens(OwnState *st, int first, int last, const char *text) {
+    memset(st->deleted + st->ts.toks[first].start, 1,
+           st->ts.toks[last].end - st->ts.toks[first].start);
+    insert_text(st, st->ts.toks[first].start, text);
+}
+
+static int line_of(OwnState *st, int tok) {
+    int line = 1;
+    for (int i = 0; i < st->ts.toks[tok].start; i++) {
+        if (st->ts.src[i] == '\n') line++;
+    }
+    return line;
+}
+
+static void report_at(OwnState *st, int tok, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "Error: line %d: ", line_of(st, tok));
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+    st->errors++;
+}
+
+static void tok_text(OwnState *st, int i, char *buf, size_t size) {
+    int len = st->ts.toks[i].end - st->ts.toks[i].start;
+    if (len >= (int)size) len = size - 1;
+    memcpy(buf, st->ts.src + st->ts.toks[i].start, len);
+    buf[len] = '\0';
+}
+
+// =========================== [ DECLARATIONS ] ====================================
+
+static int matching_paren(OwnState *st, int open) {
+    int depth = 0;
+    for (int i = open; i < st->ts.tok_count; i++) {
+        if (tok_is(&st->ts, i, "(")) depth++;
+        if (tok_is(&st->ts, i, ")") && --depth == 0) return i;
+    }
+    return -1;
+}
+
+static int is_own_type(OwnState *st, int i) {
+    return tok_is(&st->ts, i, "own") && tok_is(&st->ts, i + 1, "string");
+}
+
+// Type of the declaration whose type tokens run from first to the name at `name`
+static OwnType decl_type(OwnState *st, int first, int name) {
+    if (is_own_type(st, name - 2)) return TYPE_OWN;
+    for (int i = first; i < name; i++) {
+        if (tok_is(&st->ts, i, "*")) return TYPE_OTHER;
+    }
+    return tok_is(&st->ts, name - 1, "string") ? TYPE_RC : TYPE_OTHER;
+}
+
+// Prototypes and definitions at file scope: `type name ( params ) {` or `;`
+static void collect_funcs(OwnState *st) {
+    for (int i = 1; i + 1 < st->ts.tok_count; i++) {
+        if (st->ts.toks[i].block >= 0 || st->ts.toks[i].kind != TOK_IDENT ||
+            !tok_is(&st->ts, i + 1, "("))
+            continue;
+        if (st->ts.toks[i - 1].kind != TOK_IDENT && !tok_is(&st->ts, i - 1, "*")) continue;
+        int close = matching_paren(st, i + 1);
+        if (close < 0 || !(tok_is(&st->ts, close + 1, "{") || tok_is(&st->ts, close + 1, ";")))
+            continue;
+
+        if (st->func_count >= st->func_capacity) {
+            st->func_capacity = st->func_capacity ? st->func_capacity * 2 : 32;
+            st->funcs = realloc(st->funcs, sizeof(Func) * st->func_capacity);
+        }
+        Func *fn = &st->funcs[st->func_count++];
+        memset(fn, 0, sizeof(*fn));
+        fn->name = i;
+        fn->returns = decl_type(st, i - 1, i);
+        for (int first = i + 2, j = i + 2; j <= close && fn->param_count < MAX_PARAMS; j++) {
+            if (tok_is(&st->ts, j, "(")) j = matching_paren(st, j);
+            if (!tok_is(&st->ts, j, ",") && j != close) continue;
+            if (j > first) fn->params[fn->param_count++] = decl_type(st, first, j - 1);
+            first = j + 1;
+        }
+    }
+}
+
+static int find_func(OwnState *st, int tok) {
+    for (int f = 0; f < st->func_count; f++) {
+        if (tok_same(&st->ts, st->funcs[f].name, tok)) return f;
+    }
+    return -1;
+}
+
+static int is_function_body(OwnState *st, int b) {
+    return st->ts.blocks[b].parent < 0 && st->ts.blocks[b].close > 0 &&
+           tok_is(&st->ts, st->ts.blocks[b].open - 1, ")");
+}
+
+// Inside a function body, parameter lists excluded
+static int in_function(OwnState *st, int tok) {
+    int b = st->ts.toks[tok].block;
+    while (b >= 0 && st->ts.blocks[b].parent >= 0)
+        b = st->ts.blocks[b].parent;
+    return b >= 0 && is_function_body(st, b);
+}
+
+static int block_encloses(OwnState *st, int outer, int inner) {
+    for (int b = inner; b >= 0; b = st->ts.blocks[b].parent) {
+        if (b == outer) return 1;
+    }
+    return 0;
+}
+
+static void add_var(OwnState *st, int name, int block, OwnType type) {
+    if (st->var_count >= st->var_capacity) {
+        st->var_capacity = st->var_capacity ? st->var_capacity * 2 : 32;
+        st->vars = realloc(st->vars, sizeof(Var) * st->var_capacity);
+    }
+    st->vars[st->var_count++] = (Var){name, block, type};
+}
+
+// The variable an identifier token refers to: the latest declaration before it
+// whose block encloses it, parameters included. -1 for anything else.
+static int resolve(OwnState *st, int tok) {
+    if (st->ts.toks[tok].kind != TOK_IDENT || tok_is(&st->ts, tok - 1, ".") ||
+        tok_is(&st->ts, tok - 1, "->"))
+        return -1;
+    for (int v = st->var_count - 1; v >= 0; v--) {
+        Var *var = &st->vars[v];
+        if (var->name < tok && tok_same(&st->ts, var->name, tok) &&
+            block_encloses(st, var->block, st->ts.toks[tok].block))
+            return v;
+    }
+    return -1;
+}
+
+static int resolve_own(OwnState *st, int tok) {
+    int v = resolve(st, tok);
+    return v >= 0 && st->vars[v].type == TYPE_OWN ? v : -1;
+}
+
+static int at_stmt_start(OwnState *st, int i) {
+    return tok_is(&st->ts, i - 1, ";") || tok_is(&st->ts, i - 1, "{") ||
+           tok_is(&st->ts, i - 1, "}") || tok_is(&st->ts, i - 1, ")") ||
+           tok_is(&st->ts, i - 1, "else") || tok_is(&st->ts, i - 1, ":");
+}
+
+// The `;` ending the statement that contains token i, or -1 when i sits in
+// a for header or other bracketed expression
+static int stmt_end(OwnState *st, int i) {
+    int depth = 0;
+    for (int j = i; j < st->ts.tok_count; j++) {
+        if (tok_is(&st->ts, j, "(") || tok_is(&st->ts, j, "[")) depth++;
+        if (tok_is(&st->ts, j, ")") || tok_is(&st->ts, j, "]")) {
+            if (depth-- == 0) return -1;
+        }
+        if (depth == 0 && (tok_is(&st->ts, j, "{") || tok_is(&st->ts, j, "}"))) return -1;
+        if (depth == 0 && tok_is(&st->ts, j, ";")) return j;
+    }
+    return -1;
+}
+
+// String and own string locals and parameters of one function body
+static void collect_vars(OwnState *st, int body) {
+    const Block *fn = &st->ts.blocks[body];
+    int          depth = 0, open = fn->open - 1;
+    for (; open >= 0; open--) {
+        if (tok_is(&st->ts, open, ")")) depth++;
+        if (tok_is(&st->ts, open, "(") && --depth == 0) break;
+    }
+    for (int i = open + 1; i < fn->open - 1; i++) {
+        if (st->ts.toks[i].kind == TOK_IDENT && tok_is(&st->ts, i - 1, "string") &&
+            (tok_is(&st->ts, i + 1, ",") || tok_is(&st->ts, i + 1, ")")))
+            add_var(st, i, body, tok_is(&st->ts, i - 2, "own") ? TYPE_OWN : TYPE_RC);
+    }
+
+    for (int i = fn->open + 1; i < fn->close; i++) {
+        if (!tok_is(&st->ts, i, "string") || st->ts.toks[i + 1].kind != TOK_IDENT) continue;
+        int own = tok_is(&st->ts, i - 1, "own");
+        if (!at_stmt_start(st, own ? i - 1 : i)) continue;
+        if (tok_is(&st->ts, i + 2, "=") || tok_is(&st->ts, i + 2, ";"))
+            add_var(st, i + 1, st->ts.toks[i].block, own ? TYPE_OWN : TYPE_RC);
+        else if (own && tok_is(&st->ts, i + 2, ","))
+            report_at(st, i, "declare one own string per statement");
+    }
+}
+
+// =========================== [ MOVE TRACKING ] ====================================
+
+static void var_name(OwnState *st, int v, char *buf, size_t size) {
+    tok_text(st, st->vars[v].name, buf, size);
+}
+
+static void check_live(OwnState *st, int v, int tok) {
+    if (!st->moved[v]) return;
+    char name[64];
+    var_name(st, v, name, sizeof(name));
+    report_at(st, tok, "use of own string '%s' after it was moved on line %d", name, st->moved[v]);
+}
+
+// A for/while/do body or a block nested in one
+static int is_loop_body(OwnState *st, int b) {
+    int open = st->ts.blocks[b].open;
+    if (tok_is(&st->ts, open - 1, "do")) return 1;
+    if (!tok_is(&st->ts, open - 1, ")")) return 0;
+    int depth = 0, j = open - 1;
+    for (; j >= 0; j--) {
+        if (tok_is(&st->ts, j, ")")) depth++;
+        if (tok_is(&st->ts, j, "(") && --depth == 0) break;
+    }
+    return tok_is(&st->ts, j - 1, "for") || tok_is(&st->ts, j - 1, "while");
+}
+
+// `name =` starting a statement between tokens from and to
+static int reassigned(OwnState *st, int v, int from, int to) {
+    for (int i = from + 1; i < to; i++) {
+        if (resolve(st, i) == v && tok_is(&st->ts, i + 1, "=") && at_stmt_start(st, i)) return 1;
+    }
+    return 0;
+}
+
+// Variable v gives its value away at token tok
+static void move_var(OwnState *st, int v, int tok) {
+    check_live(st, v, tok);
+    st->moved[v] = line_of(st, tok);
+
+    // The next iteration would find it empty, unless the loop refills it first
+    for (int b = st->ts.toks[tok].block; b >= 0 && b != st->vars[v].block;
+         b = st->ts.blocks[b].parent) {
+        if (!is_loop_body(st, b) || reassigned(st, v, tok, st->ts.blocks[b].close)) continue;
+        char name[64];
+        var_name(st, v, name, sizeof(name));
+        report_at(st, tok, "own string '%s' is moved inside a loop it was declared outside of", name);
+        return;
+    }
+}
+
+// =========================== [ LOWERING ] =========================================
+
+static int in_list(OwnState *st, int tok, const char **names, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (tok_is(&st->ts, tok, names[i])) return 1;
+    }
+    return 0;
+}
+
+static int is_header_reader(OwnState *st, int tok) {
+    if (in_list(st, tok, raw_functions, sizeof(raw_functions) / sizeof(raw_functions[0])))
+        return 0;
+    for (size_t p = 0; p < sizeof(runtime_prefixes) / sizeof(runtime_prefixes[0]); p++) {
+        size_t len = strlen(runtime_prefixes[p]);
+        if (st->ts.toks[tok].end - st->ts.toks[tok].start > (int)len &&
+            memcmp(st->ts.src + st->ts.toks[tok].start, runtime_prefixes[p], len) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Callee token of the innermost call whose argument list holds token i, or
+// -1; *arg receives the argument index
+static int enclosing_call(OwnState *st, int i, int *arg) {
+    int depth = 0;
+    *arg = 0;
+    for (int j = i - 1; j >= 0; j--) {
+        if (tok_is(&st->ts, j, ";") || tok_is(&st->ts, j, "{") || tok_is(&st->ts, j, "}"))
+            return -1;
+        if (tok_is(&st->ts, j, ")")) depth++;
+        if (tok_is(&st->ts, j, ",") && depth == 0) (*arg)++;
+        if (tok_is(&st->ts, j, "(") && depth-- == 0)
+            return st->ts.toks[j - 1].kind == TOK_IDENT ? j - 1 : -1;
+    }
+    return -1;
+}
+
+static void emit_move(OwnState *st, int v, int tok, const char *format) {
+    char name[64], text[192];
+    var_name(st, v, name, sizeof(name));
+    snprintf(text, sizeof(text), format, name);
+    replace_tokens(st, tok, tok, text);
+    st->handled[tok] = 1;
+    move_var(st, v, tok);
+}
+
+// Wrap tokens first..last in call( ... )
+static void wrap_tokens(OwnState *st, int first, int last, const char *call) {
+    char open[64];
+    snprintf(open, sizeof(open), "%s(", call);
+    insert_text(st, st->ts.toks[first].start, open);
+    insert_text(st, st->ts.toks[last].end, ")");
+}
+
+// An expression over tokens first..end-1 that must produce an own_string
+static void lower_own_value(OwnState *st, int first, int end) {
+    int v = resolve_own(st, first);
+    if (end == first + 1 && v >= 0) {
+        emit_move(st, v, first, "own_string_move(&%s)");
+        return;
+    }
+
+    int call = st->ts.toks[first].kind == TOK_IDENT && tok_is(&st->ts, first + 1, "(") &&
+               matching_paren(st, first + 1) == end - 1;
+    if (call) {
+        for (size_t c = 0; c < sizeof(own_constructors) / sizeof(own_constructors[0]); c++) {
+            if (!tok_is(&st->ts, first, own_constructors[c][0])) continue;
+            replace_tokens(st, first, first, own_constructors[c][1]);
+            return;
+        }
+        int f = find_func(st, first);
+        if (f >= 0 && st->funcs[f].returns == TYPE_OWN) {
+            st->handled[first] = 1;
+            return;
+        }
+        if ((f >= 0 && st->funcs[f].returns == TYPE_RC) ||
+            in_list(st, first, fresh_functions, sizeof(fresh_functions) / sizeof(fresh_functions[0]))) {
+            wrap_tokens(st, first, end - 1, "own_string_adopt");
+            return;
+        }
+    }
+    // Anything else is read as a const char * and copied
+    wrap_tokens(st, first, end - 1, "own_string_create");
+}
+
+// An expression over tokens first..end-1 initialising or assigned to a `string`
+static void lower_rc_value(OwnState *st, int first, int end) {
+    int v = resolve_own(st, first);
+    if (end == first + 1 && v >= 0) {
+        emit_move(st, v, first, "own_string_share(own_string_move(&%s))");
+        return;
+    }
+    int f = st->ts.toks[first].kind == TOK_IDENT && tok_is(&st->ts, first + 1, "(") &&
+                    matching_paren(st, first + 1) == end - 1
+                ? find_func(st, first)
+                : -1;
+    if (f >= 0 && st->funcs[f].returns == TYPE_OWN) {
+        wrap_tokens(st, first, end - 1, "own_string_share");
+        st->handled[first] = 1;
+    }
+}
+
+// Statement forms that give an own string a value or take one away, at token
+// i; returns the token to continue from
+static int lower_statement(OwnState *st, int i) {
+    // own string name = value;  /  own string name;
+    if (is_own_type(st, i) && at_stmt_start(st, i) && st->ts.toks[i + 2].kind == TOK_IDENT) {
+        char name[64], text[192];
+        tok_text(st, i + 2, name, sizeof(name));
+        replace_tokens(st, i, i + 1, "own_string");
+        insert_text(st, st->ts.toks[i + 2].end, " SAM_OWNED");
+        snprintf(text, sizeof(text), "\n    OWN_STRING_END(%s);", name);
+        insert_text(st, st->ts.toks[st->ts.blocks[st->ts.toks[i].block].close].start, text);
+        st->handled[i + 2] = 1;
+
+        int end = stmt_end(st, i);
+        if (tok_is(&st->ts, i + 3, ";")) {
+            insert_text(st, st->ts.toks[i + 2].end, " = OWN_STRING_NONE");
+        } else if (tok_is(&st->ts, i + 3, "=") && end > i + 4) {
+            lower_own_value(st, i + 4, end);
+        }
+        return i + 3;
+    }
+    if (is_own_type(st, i)) {
+        report_at(st, i, "an own string declaration must start a statement");
+        return i + 2;
+    }
+
+    // string name = own;
+    if (tok_is(&st->ts, i, "string") && at_stmt_start(st, i) &&
+        st->ts.toks[i + 1].kind == TOK_IDENT && tok_is(&st->ts, i + 2, "=")) {
+        int end = stmt_end(st, i);
+        if (end > i + 3) lower_rc_value(st, i + 3, end);
+        return i + 3;
+    }
+
+    // return value;
+    if (tok_is(&st->ts, i, "return") && st->func >= 0) {
+        int     end = stmt_end(st, i);
+        OwnType returns = st->funcs[st->func].returns;
+        if (end <= i + 1) return i + 1;
+        if (returns == TYPE_OWN) {
+            lower_own_value(st, i + 1, end);
+        } else if (returns == TYPE_RC) {
+            lower_rc_value(st, i + 1, end);
+        } else if (end == i + 2 && resolve_own(st, i + 1) >= 0) {
+            char name[64];
+            tok_text(st, i + 1, name, sizeof(name));
+            report_at(st, i + 1, "returning own string '%s' from a function that does not return "
+                              "`own string` or `string` would leave it dangling",
+                   name);
+        }
+        return i + 1;
+    }
+
+    // name = value;
+    int v = resolve(st, i);
+    int end = v >= 0 && tok_is(&st->ts, i + 1, "=") && at_stmt_start(st, i) ? stmt_end(st, i) : -1;
+    if (end < 0) return i;
+    if (st->vars[v].type == TYPE_RC) {
+        lower_rc_value(st, i + 2, end);
+        return i + 1;
+    }
+
+    char name[64], text[192];
+    tok_text(st, i, name, sizeof(name));
+    st->handled[i] = 1;
+    st->revive = v;
+    st->revive_at = end;
+
+    // name = string_concat(name, piece);  appends in place
+    int mentions = 0;
+    for (int j = i + 6; j < end; j++) {
+        if (resolve(st, j) == v) mentions = 1;
+    }
+    if (tok_is(&st->ts, i + 2, "string_concat") && tok_is(&st->ts, i + 3, "(") &&
+        resolve(st, i + 4) == v && tok_is(&st->ts, i + 5, ",") &&
+        matching_paren(st, i + 3) == end - 1 && !mentions) {
+        check_live(st, v, i);
+        snprintf(text, sizeof(text), "own_string_append(&%s", name);
+        replace_tokens(st, i, i + 4, text);
+        st->handled[i + 4] = 1;
+        return i + 5;
+    }
+
+    snprintf(text, sizeof(text), "own_string_replace(&%s,", name);
+    replace_tokens(st, i, i + 1, text);
+    insert_text(st, st->ts.toks[end].start, ")");
+    lower_own_value(st, i + 2, end);
+    return i + 2;
+}
+
+// Any other mention of an own string borrows it
+static void lower_use(OwnState *st, int i, int v) {
+    char name[64], callee[64], text[192];
+    tok_text(st, i, name, sizeof(name));
+    check_live(st, v, i);
+    if (tok_is(&st->ts, i + 1, ".")) return; // s.ptr, s.len
+
+    if (tok_is(&st->ts, i - 1, "&")) {
+        report_at(st, i, "cannot take the address of own string '%s'", name);
+        return;
+    }
+
+    int arg = 0, call = -1;
+    if ((tok_is(&st->ts, i - 1, "(") || tok_is(&st->ts, i - 1, ",")) &&
+        (tok_is(&st->ts, i + 1, ")") || tok_is(&st->ts, i + 1, ",")))
+        call = enclosing_call(st, i, &arg);
+    if (call >= 0) {
+        int f = find_func(st, call);
+        tok_text(st, call, callee, sizeof(callee));
+        if (f >= 0 && arg < st->funcs[f].param_count && st->funcs[f].params[arg] == TYPE_OWN) {
+            emit_move(st, v, i, "own_string_move(&%s)");
+            return;
+        }
+        if ((f >= 0 && arg < st->funcs[f].param_count && st->funcs[f].params[arg] == TYPE_RC) ||
+            (f < 0 && is_header_reader(st, call))) {
+            report_at(st, i, "own string '%s' cannot be lent to '%s', which needs a refcounted "
+                          "string; move it into a `string` first",
+                   name, callee);
+            return;
+        }
+        // string_length(s) is the length kept alongside the pointer
+        if (tok_is(&st->ts, call, "string_length") && tok_is(&st->ts, i - 1, "(") &&
+            tok_is(&st->ts, i + 1, ")")) {
+            snprintf(text, sizeof(text), "%s.len", name);
+            replace_tokens(st, call, i + 1, text);
+            return;
+        }
+    }
+    insert_text(st, st->ts.toks[i].end, ".ptr");
+}
+
+// `own string name` in the parameter list of a definition takes the caller's
+// value: the parameter is renamed and an owned local declared under its name
+static void lower_params(OwnState *st, int body) {
+    int open = st->ts.blocks[body].open, depth = 0, params = open - 1;
+    for (; params >= 0; params--) {
+        if (tok_is(&st->ts, params, ")")) depth++;
+        if (tok_is(&st->ts, params, "(") && --depth == 0) break;
+    }
+    for (int i = params + 1; i < open - 1; i++) {
+        if (!is_own_type(st, i)) continue;
+        char name[64], text[192];
+        tok_text(st, i + 2, name, sizeof(name));
+        replace_tokens(st, i, i + 1, "own_string");
+        snprintf(text, sizeof(text), "__own_%s", name);
+        replace_tokens(st, i + 2, i + 2, text);
+        snprintf(text, sizeof(text), "\n    own_string %s SAM_OWNED = __own_%s;", name, name);
+        insert_text(st, st->ts.toks[open].end, text);
+        snprintf(text, sizeof(text), "\n    OWN_STRING_END(%s);", name);
+        insert_text(st, st->ts.toks[st->ts.blocks[body].close].start, text);
+    }
+}
+
+static void lower_block(OwnState *st, int b);
+
+// The tokens of block b, with branches: what an if/else chain moves in any
+// arm counts as moved after it
+static void lower_block(OwnState *st, int b) {
+    size_t size = sizeof(int) * (st->var_count + 1);
+    int   *branches = calloc(st->var_count + 1, sizeof(int)), *before = malloc(size);
+    int    in_chain = 0, merge_at = -1;
+
+    for (int i = st->ts.blocks[b].open + 1; i < st->ts.blocks[b].close; i++) {
+        if (st->revive >= 0 && i == st->revive_at) {
+            st->moved[st->revive] = 0;
+            st->revive = -1;
+        }
+        if (tok_is(&st->ts, i, "{") && st->ts.toks[i].block != b) {
+            int child = st->ts.toks[i].block, close = st->ts.blocks[child].close;
+            if (!in_chain) memcpy(before, st->moved, size);
+            lower_block(st, child);
+            i = close;
+
+            int arm_ends = !tok_is(&st->ts, close + 1, "else");
+            if (!arm_ends || in_chain) {
+                for (int v = 0; v < st->var_count; v++) {
+                    if (!branches[v]) branches[v] = st->moved[v];
+                }
+            }
+            if (!arm_ends) {
+                // The next arm starts from the state before the chain
+                memcpy(st->moved, before, size);
+                in_chain = 1;
+                int j = close + 2;
+                while (tok_is(&st->ts, j, "if") && tok_is(&st->ts, j + 1, "(")) {
+                    j = matching_paren(st, j + 1) + 1;
+                    if (j <= 0) break;
+                }
+                merge_at = tok_is(&st->ts, j, "{") ? -1 : stmt_end(st, j);
+            } else if (in_chain) {
+                memcpy(st->moved, branches, size);
+                memset(branches, 0, size);
+                in_chain = 0;
+            }
+            continue;
+        }
+        if (in_chain && i == merge_at) {
+            for (int v = 0; v < st->var_count; v++) {
+                if (!st->moved[v]) st->moved[v] = branches[v];
+            }
+            memset(branches, 0, size);
+            in_chain = 0;
+            merge_at = -1;
+        }
+
+        if (!st->handled[i]) {
+            int next = lower_statement(st, i);
+            if (next != i) {
+                i = next - 1;
+                continue;
+            }
+        }
+        if (st->handled[i]) continue;
+        int v = resolve_own(st, i);
+        if (v >= 0 && st->vars[v].name != i) {
+            lower_use(st, i, v);
+        } else if (st->ts.toks[i].kind == TOK_IDENT && tok_is(&st->ts, i + 1, "(")) {
+            int f = find_func(st, i);
+            if (f >= 0 && st->funcs[f].returns == TYPE_OWN && st->funcs[f].name != i) {
+                char callee[64];
+                tok_text(st, i, callee, sizeof(callee));
+                report_at(st, i, "the own string returned by '%s' must initialise or be assigned to "
+                              "an own string or a string",
+                       callee);
+            }
+        }
+    }
+    free(branches);
+    free(before);
+}
+
+static void lower_function(OwnState *st, int body) {
+    st->var_count = 0;
+    st->func = -1;
+    for (int f = 0; f < st->func_count; f++) {
+        int close = matching_paren(st, st->funcs[f].name + 1);
+        if (close + 1 == st->ts.blocks[body].open) st->func = f;
+    }
+    collect_vars(st, body);
+    st->moved = calloc(st->var_count + 1, sizeof(int));
+    st->revive = -1;
+    lower_params(st, body);
+    lower_block(st, body);
+    free(st->moved);
+}
+
+// =========================== [ MAIN TRANSFORMATION ] ====================================
+
+// Returns the number of errors reported; the output is only usable when it is 0
+int lower_owned_strings(FILE *in, FILE *out) {
+    size_t size = 0, capacity = 4096;
+    char  *src = malloc(capacity);
+    int    ch;
+    while ((ch = fgetc(in)) != EOF) {
+        if (size + 1 >= capacity) src = realloc(src, capacity *= 2);
+        src[size++] = ch;
+    }
+    src[size] = '\0';
+
+    OwnState st = {0};
+    st.ts.src = src;
+    st.deleted = calloc(size + 1, 1);
+    tokenize(&st.ts);
+    st.handled = calloc(st.ts.tok_count + 1, 1);
+    collect_funcs(&st);
+
+    // Return types, and parameters of prototypes; definitions lower their own
+    for (int i = 0; i + 2 < st.ts.tok_count; i++) {
+        if (!is_own_type(&st, i) || in_function(&st, i)) continue;
+        int open = i, depth = 0;
+        for (; open >= 0 && !tok_is(&st.ts, open, ";") && !tok_is(&st.ts, open, "}"); open--) {
+            if (tok_is(&st.ts, open, ")")) depth++;
+            if (tok_is(&st.ts, open, "(") && depth-- == 0) break;
+        }
+        int params = open >= 0 && tok_is(&st.ts, open, "(");
+        if (params ? !tok_is(&st.ts, matching_paren(&st, open) + 1, "{")
+                   : tok_is(&st.ts, i + 3, "(") && st.ts.toks[i].block < 0)
+            replace_tokens(&st, i, i + 1, "own_string");
+        else if (!params)
+            report_at(&st, i, "own strings can only be locals, parameters and return values");
+    }
+
+    // Function bodies: file-scope blocks opened right after a parameter list
+    for (int b = 0; b < st.ts.block_count; b++) {
+        if (is_function_body(&st, b)) lower_function(&st, b);
+    }
+
+    // Stable sort: inserts at one offset keep the order they were made in
+    for (int i = 1; i < st.insert_count; i++) {
+        Insert insert = st.inserts[i];
+        int    j = i;
+        for (; j > 0 && st.inserts[j - 1].pos > insert.pos; j--)
+            st.inserts[j] = st.inserts[j - 1];
+        st.inserts[j] = insert;
+    }
+    int next = 0;
+    for (size_t i = 0; i <= size; i++) {
+        while (next < st.insert_count && st.inserts[next].pos == (int)i)
+            fputs(st.inserts[next++].text, out);
+        if (i < size && !st.deleted[i]) fputc(src[i], out);
+    }
+
+    int errors = st.errors;
+    free_tokens(&st.ts);
+    free(st.funcs);
+    free(st.vars);
+    free(st.deleted);
+    free(st.handled);
+    free(st.inserts);
+    free(src);
+    return errors;
+}
@@ -0,0 +1,275 @@
+#define _GNU_SOURCE // sched_getaffinity
+// lib/parallel.c - Work-stealing pool: Chase-Lev deques of index ranges
+#include "parallel.h"
+#include "arena.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define PARALLEL_MAX_WORKERS 256
+#define PARALLEL_DEQUE_SIZE 1024 // Power of two
+#define PARALLEL_SPIN 2000       // Yields before an idle worker sleeps
+#define PARALLEL_SPLITS 8        // Default dynamic grain: this many pieces per worker
+
+typedef struct {
+    long begin, end;
+} ParallelRange;
+
+// Only the owner pushes and pops at bottom; thieves take from top. The slots
+// are read and written with relaxed atomics, since a thief may read one that
+// the owner is overwriting and then lose the race on top.
+typedef struct {
+    long          top;
+    char          pad[64];
+    long          bottom;
+    ParallelRange ranges[PARALLEL_DEQUE_SIZE];
+} ParallelDeque;
+
+typedef struct {
+    ParallelDeque deque;
+    Arena        *scratch;
+    unsigned      seed; // Picks steal victims
+} ParallelWorker;
+
+static struct {
+    int              count; // Workers, the submitting thread's included
+    ParallelWorker  *workers[PARALLEL_MAX_WORKERS];
+    pthread_mutex_t  lock; // Guards epoch and active
+    pthread_cond_t   wake;
+    pthread_cond_t   idle;
+    unsigned long    epoch;  // Bumped for every loop
+    int              active; // Pool threads still inside the last loop
+
+    // The running loop, written under lock before epoch changes
+    ParallelBody     body;
+    void            *context;
+    ParallelSchedule schedule;
+    long             grain;
+    long             pending; // Iterations not run yet
+} pool = {.lock = PTHREAD_MUTEX_INITIALIZER,
+          .wake = PTHREAD_COND_INITIALIZER,
+          .idle = PTHREAD_COND_INITIALIZER};
+
+static pthread_once_t         pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t        submit_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t        merge_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread ParallelWorker *parallel_self; // Set while a thread works for the pool
+
+// =========================== [ DEQUE ] ====================================
+
+static int deque_push(ParallelDeque *d, long begin, long end) {
+    long bottom = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= PARALLEL_DEQUE_SIZE) return 0;
+
+    ParallelRange *slot = &d->ranges[bottom & (PARALLEL_DEQUE_SIZE - 1)];
+    __atomic_store_n(&slot->begin, begin, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->end, end, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static int deque_pop(ParallelDeque *d, ParallelRange *range) {
+    long bottom = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long top = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+    if (top > bottom) {
+        __atomic_store_n(&d->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    ParallelRange *slot = &d->ranges[bottom & (PARALLEL_DEQUE_SIZE - 1)];
+    range->begin = __atomic_load_n(&slot->begin, __ATOMIC_RELAXED);
+    range->end = __atomic_load_n(&slot->end, __ATOMIC_RELAXED);
+    if (top < bottom) return 1;
+
+    // The last range: whoever moves top first gets it
+    int won = __atomic_compare_exchange_n(&d->top, &top, top + 1, 0, __ATOMIC_SEQ_CST,
+                                          __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return won;
+}
+
+static int deque_steal(ParallelDeque *d, ParallelRange *range) {
+    long top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long bottom = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) return 0;
+
+    ParallelRange *slot = &d->ranges[top & (PARALLEL_DEQUE_SIZE - 1)];
+    range->begin = __atomic_load_n(&slot->begin, __ATOMIC_RELAXED);
+    range->end = __atomic_load_n(&slot->end, __ATOMIC_RELAXED);
+    return __atomic_compare_exchange_n(&d->top, &top, top + 1, 0, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_RELAXED);
+}
+
+// =========================== [ WORKERS ] ====================================
+
+static int steal(ParallelWorker *self, ParallelRange *range) {
+    int count = pool.count;
+    if (count < 2) return 0;
+
+    self->seed ^= self->seed << 13;
+    self->seed ^= self->seed >> 17;
+    self->seed ^= self->seed << 5;
+    int first = self->seed % count;
+    for (int i = 0; i < count; i++) {
+        ParallelWorker *victim = pool.workers[(first + i) % count];
+        if (victim != self && deque_steal(&victim->deque, range)) return 1;
+    }
+    return 0;
+}
+
+static void run_range(ParallelWorker *self, long begin, long end) {
+    if (pool.schedule == PARALLEL_DYNAMIC) {
+        while (end - begin > pool.grain && deque_push(&self->deque, begin + (end - begin) / 2, end))
+            end = begin + (end - begin) / 2;
+    }
+    pool.body(pool.context, begin, end, self->scratch);
+    arena_reset(self->scratch);
+    __atomic_sub_fetch(&pool.pending, end - begin, __ATOMIC_ACQ_REL);
+}
+
+// Runs ranges until every iteration of the current loop has run
+static void work(ParallelWorker *self) {
+    ParallelRange range;
+    while (__atomic_load_n(&pool.pending, __ATOMIC_ACQUIRE) > 0) {
+        if (deque_pop(&self->deque, &range) || steal(self, &range))
+            run_range(self, range.begin, range.end);
+        else
+            sched_yield();
+    }
+}
+
+static void *worker_main(void *arg) {
+    ParallelWorker *self = arg;
+    unsigned long   seen = 0;
+
+    parallel_self = self;
+    for (;;) {
+        // Loops tend to come in bursts, so look for the next one before sleeping
+        for (int i = 0; i < PARALLEL_SPIN && __atomic_load_n(&pool.epoch, __ATOMIC_ACQUIRE) == seen; i++)
+            sched_yield();
+
+        pthread_mutex_lock(&pool.lock);
+        while (pool.epoch == seen)
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        seen = pool.epoch;
+        pool.active++;
+        pthread_mutex_unlock(&pool.lock);
+
+        work(self);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.active == 0) pthread_cond_signal(&pool.idle);
+        pthread_mutex_unlock(&pool.lock);
+    }
+    return NULL;
+}
+
+static int cpu_count(void) {
+    const char *threads = getenv("SAM_THREADS");
+    if (threads && atoi(threads) > 0) return atoi(threads);
+#ifdef CPU_COUNT
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) return CPU_COUNT(&set);
+#endif
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (int)online : 1;
+}
+
+static ParallelWorker *worker_create(int index) {
+    ParallelWorker *worker = calloc(1, sizeof(ParallelWorker));
+    if (!worker) return NULL;
+    worker->scratch = arena_create(PARALLEL_SCRATCH_SIZE);
+    if (!worker->scratch) {
+        free(worker);
+        return NULL;
+    }
+    worker->seed = 2654435761u * (index + 1);
+    return worker;
+}
+
+static void pool_start(void) {
+    int wanted = cpu_count();
+    if (wanted > PARALLEL_MAX_WORKERS) wanted = PARALLEL_MAX_WORKERS;
+
+    pool.workers[0] = worker_create(0);
+    if (!pool.workers[0]) {
+        fprintf(stderr, "parallel: out of memory starting the pool\n");
+        abort();
+    }
+    pool.count = 1;
+    // Workers sleep until the first epoch, so count only grows before any loop
+    while (pool.count < wanted) {
+        ParallelWorker *worker = worker_create(pool.count);
+        pthread_t       thread;
+        if (!worker) break;
+        if (pthread_create(&thread, NULL, worker_main, worker) != 0) {
+            arena_destroy(worker->scratch);
+            free(worker);
+            break;
+        }
+        pthread_detach(thread);
+        pool.workers[pool.count++] = worker;
+    }
+}
+
+// =========================== [ LOOPS ] ====================================
+
+int parallel_workers(void) {
+    pthread_once(&pool_once, pool_start);
+    return pool.count;
+}
+
+void parallel_for_range(long begin, long end, long chunk, ParallelSchedule schedule,
+                        ParallelBody body, void *context) {
+    if (end <= begin) return;
+    if (parallel_self) {
+        body(context, begin, end, parallel_self->scratch);
+        return;
+    }
+
+    pthread_once(&pool_once, pool_start);
+    pthread_mutex_lock(&submit_lock);
+    pthread_mutex_lock(&pool.lock);
+    // Stragglers from the last loop may still be looking at the deques
+    while (pool.active > 0)
+        pthread_cond_wait(&pool.idle, &pool.lock);
+
+    long count = end - begin;
+    pool.body = body;
+    pool.context = context;
+    pool.schedule = schedule;
+    pool.pending = count;
+    if (schedule == PARALLEL_STATIC) {
+        // Deal the chunks; the workers are idle, so their deques are ours
+        long most = (long)pool.count * PARALLEL_DEQUE_SIZE;
+        if (chunk <= 0) chunk = (count + pool.count - 1) / pool.count;
+        if ((count + chunk - 1) / chunk > most) chunk = (count + most - 1) / most;
+        int next = 0;
+        for (long start = begin; start < end; start += chunk) {
+            deque_push(&pool.workers[next]->deque, start, end - start > chunk ? start + chunk : end);
+            next = (next + 1) % pool.count;
+        }
+    } else {
+        pool.grain = chunk > 0 ? chunk : count / ((long)pool.count * PARALLEL_SPLITS);
+        if (pool.grain < 1) pool.grain = 1;
+        deque_push(&pool.workers[0]->deque, begin, end);
+    }
+    __atomic_store_n(&pool.epoch, pool.epoch + 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    parallel_self = pool.workers[0];
+    work(parallel_self);
+    parallel_self = NULL;
+    pthread_mutex_unlock(&submit_lock);
+}
+
+void parallel_lock(void) { pthread_mutex_lock(&merge_lock); }
+
+void parallel_unlock(void) { pthread_mutex_unlock(&merge_lock); }
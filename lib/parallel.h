@@ -0,0 +1,43 @@
+// parallel.h - Work-stealing thread pool behind `parallel for`
+#ifndef SAM_PARALLEL_H
+#define SAM_PARALLEL_H
+
+struct Arena;
+
+#ifdef SAM_ALLOC_ARENA
+#error "parallel for needs --alloc=rc or --alloc=malloc: the arena region is single-threaded"
+#endif
+
+// A loop's index range runs as chunks on a pool with one worker per CPU in
+// the affinity mask (SAM_THREADS overrides it), started by the first loop.
+// Each worker owns a deque of ranges: it takes the newest one from its own
+// end and, once that is empty, steals the oldest one of another worker, so
+// an idle worker always takes the biggest piece left.
+//   PARALLEL_STATIC   the range is cut into chunks of `chunk` iterations (one
+//                     per worker when 0) dealt round-robin before the start;
+//                     stealing only evens out what is left at the end
+//   PARALLEL_DYNAMIC  a worker halves the range it takes, keeping the lower
+//                     half and offering the upper one, until the piece has at
+//                     most `chunk` iterations (0 picks a grain); unbalanced
+//                     loops even themselves out
+// The calling thread works too and returns once every iteration has run.
+// Calls from several threads take turns; a loop started inside a loop body
+// runs inline on that worker. body gets the worker's scratch arena
+// (PARALLEL_SCRATCH_SIZE bytes), which is reset after every chunk.
+typedef enum { PARALLEL_STATIC, PARALLEL_DYNAMIC } ParallelSchedule;
+
+typedef void (*ParallelBody)(void *context, long begin, long end, struct Arena *scratch);
+
+#ifndef PARALLEL_SCRATCH_SIZE
+#define PARALLEL_SCRATCH_SIZE (1024 * 1024)
+#endif
+
+void parallel_for_range(long begin, long end, long chunk, ParallelSchedule schedule,
+                        ParallelBody body, void *context);
+int  parallel_workers(void); // Pool size, the calling thread included; starts the pool
+
+// One lock for merging reductions into the caller's variables
+void parallel_lock(void);
+void parallel_unlock(void);
+
+#endif
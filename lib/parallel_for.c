@@ -0,0 +1,705 @@
+#define _POSIX_C_SOURCE 200809L
+// lib/parallel_for.c - Lower `parallel for` loops onto the work-stealing pool
+//
+//     parallel reduce(+: total) for (int i = 0; i < n; i++) {
+//         total += xs[i] * scale
+//     }
+//
+// The body moves into a function emitted before the enclosing one, with the
+// locals it uses reached through a context of pointers:
+//
+//     struct __par1_ctx {
+//         double **xs;
+//         double *scale;
+//         long *total;
+//     };
+//     static void __par1_body(void *__context, long __begin, long __end, Arena *parallel_scratch) {
+//         struct __par1_ctx *__ctx = __context;
+//         long total = 0;
+//         for (int i = __begin; i < __end; i++) {
+//             total += (*__ctx->xs)[i] * (*__ctx->scale)
+//         }
+//         parallel_lock();
+//         *__ctx->total += total;
+//         parallel_unlock();
+//     }
+//
+// and the loop becomes a parallel_for_range call over [0, n) with a context
+// pointing at the caller's variables. Clauses go between `parallel` and `for`:
+//   static[(chunk)]     fixed chunks dealt to the workers up front
+//   dynamic[(chunk)]    range halved on demand down to chunk (the default)
+//   reduce(op: a, b)    per-chunk copies merged under parallel_lock; op is
+//                       one of + * & | ^ min max
+// The loop must count up by one with < or <=, and its body may not return or
+// break out of it. Writes to captured locals reach the caller and race unless
+// each iteration writes its own element; arrays are captured whole, VLAs by
+// their first element. Bodies sharing strings or rc structs between
+// iterations need --threads. parallel_scratch is the worker's scratch arena.
+#include "common.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LOCALS 256
+#define MAX_CAPTURES 64
+#define MAX_REDUCTIONS 8
+
+typedef struct {
+    char name[64];
+    char type[128]; // Declared type without the array dimensions
+    char dims[128]; // `[4][4]` for arrays, empty otherwise
+    int  vla;       // Dimensions that are not constants: captured decayed
+    int  depth;     // Brace depth where the variable is visible
+} Local;
+
+typedef struct {
+    char name[64];
+    char op[8];
+} Reduction;
+
+typedef struct {
+    int       dynamic;
+    char      chunk[128];
+    Reduction reductions[MAX_REDUCTIONS];
+    int       reduction_count;
+    char      type[64];
+    char      var[64];
+    char      start[256];
+    char      end[256];
+    int       inclusive; // <= rather than <
+} ParallelLoop;
+
+static int loop_count;
+
+// =========================== [ HELPERS ] =========================================
+
+// =========================== [ LOCALS ] =========================================
+
+static const char *const statement_words[] = {"return", "if",       "else",  "while",   "do",
+                                              "switch", "case",     "goto",  "break",   "continue",
+                                              "sizeof", "typedef",  "default", "parallel"};
+static const char *const storage_words[] = {"static", "register", "extern", "auto", "inline"};
+
+static int in_list(const char *word, const char *const *list, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(word, list[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static Local *find_local(Local *locals, int count, const char *name, size_t len) {
+    for (int i = count - 1; i >= 0; i--) {
+        if (strlen(locals[i].name) == len && strncmp(locals[i].name, name, len) == 0)
+            return &locals[i];
+    }
+    return NULL;
+}
+
+// Records the variables that `type name [dims] [= value], ...` declares in
+// text; returns how many. Statements that only look like one are rejected by
+// needing a type word before the name and one of = ; , [ after it.
+static int declare_locals(const char *text, int depth, Local *locals, int *count) {
+    char        base[112] = "";
+    char        words[8][64];
+    int         word_count = 0, stars = 0, declared = 0;
+    const char *p = text + strspn(text, " \t");
+
+    // Type words and stars up to the first declarator's name
+    for (;;) {
+        p += strspn(p, " \t");
+        if (*p == '*') {
+            stars++;
+            p++;
+            continue;
+        }
+        if (!isalpha((unsigned char)*p) && *p != '_') break;
+        size_t len = 0;
+        while (is_ident_char((unsigned char)p[len]))
+            len++;
+        if (word_count == 8 || len >= 64 || stars > 0) break;
+        memcpy(words[word_count], p, len);
+        words[word_count++][len] = '\0';
+        p += len;
+    }
+    // Attribute macros such as SAM_ARRAY follow the name
+    while (word_count > 2 && strncmp(words[word_count - 1], "SAM_", 4) == 0)
+        word_count--;
+    if (word_count < 2 && !(word_count == 1 && stars > 0)) return 0;
+    if (in_list(words[0], statement_words, sizeof(statement_words) / sizeof(statement_words[0])))
+        return 0;
+
+    // With stars the name comes after them
+    if (stars > 0) {
+        size_t len = 0;
+        while (is_ident_char((unsigned char)p[len]))
+            len++;
+        if (len == 0 || len >= 64 || isdigit((unsigned char)*p)) return 0;
+        memcpy(words[word_count++], p, len);
+        words[word_count - 1][len] = '\0';
+        p += len;
+    }
+
+    for (int i = 0; i < word_count - 1; i++) {
+        if (in_list(words[i], storage_words, sizeof(storage_words) / sizeof(storage_words[0])))
+            continue;
+        size_t used = strlen(base);
+        int    n = snprintf(base + used, sizeof(base) - used, "%s%s", used ? " " : "", words[i]);
+        if (n < 0 || (size_t)n >= sizeof(base) - used) return 0; // Too long a type
+    }
+    if (!base[0]) return 0;
+
+    const char *name = words[word_count - 1];
+    for (;;) {
+        p += strspn(p, " \t");
+        char dims[128] = "";
+        int  vla = 0;
+        while (*p == '[') {
+            const char *close = strchr(p, ']');
+            if (!close) return declared;
+            size_t used = strlen(dims);
+            if (used + (close - p) + 2 >= sizeof(dims)) return declared;
+            memcpy(dims + used, p, close - p + 1);
+            dims[used + (close - p) + 1] = '\0';
+            for (const char *q = p + 1; q < close; q++) {
+                if (islower((unsigned char)*q)) vla = 1;
+            }
+            p = close + 1 + strspn(close + 1, " \t");
+        }
+        if (*p != '=' && *p != ';' && *p != ',' && *p != '\n' && *p != '\0') return declared;
+        if (*p == '=' && p[1] == '=') return declared;
+
+        if (*count < MAX_LOCALS) {
+            Local *local = &locals[(*count)++];
+            snprintf(local->name, sizeof(local->name), "%s", name);
+            snprintf(local->type, sizeof(local->type), "%s%s%.*s", base, stars ? " " : "", stars,
+                     "********");
+            snprintf(local->dims, sizeof(local->dims), "%s", dims);
+            local->vla = vla;
+            local->depth = depth;
+            declared++;
+        }
+
+        // Skip the initializer to the next declarator
+        int nesting = 0, in_string = 0, in_char = 0;
+        for (; *p; p++) {
+            if (*p == '\\' && (in_string || in_char) && p[1]) {
+                p++;
+                continue;
+            }
+            if (*p == '"' && !in_char) in_string = !in_string;
+            if (*p == '\'' && !in_string) in_char = !in_char;
+            if (in_string || in_char) continue;
+            if (*p == '(' || *p == '{' || *p == '[') nesting++;
+            if (*p == ')' || *p == '}' || *p == ']') nesting--;
+            if (nesting == 0 && (*p == ',' || *p == ';')) break;
+        }
+        if (*p != ',') return declared;
+        p++;
+        p += strspn(p, " \t");
+        stars = 0;
+        while (*p == '*' || *p == ' ') {
+            if (*p == '*') stars++;
+            p++;
+        }
+        size_t len = 0;
+        while (is_ident_char((unsigned char)p[len]))
+            len++;
+        if (len == 0 || len >= 64) return declared;
+        memcpy(words[0], p, len);
+        words[0][len] = '\0';
+        name = words[0];
+        p += len;
+    }
+}
+
+// A line's declarations, including the first clause of a for header (whose
+// variable lives in the loop body, one level deeper)
+static void declare_line(const char *line, int depth, Local *locals, int *count) {
+    const char *p = line + strspn(line, " \t");
+    const char *after_for = match_word(p, "for");
+    if (after_for && *after_for == '(') {
+        declare_locals(after_for + 1, depth + 1, locals, count);
+        return;
+    }
+    if (*p != '#' && *p != '/' && *p != '}') declare_locals(p, depth, locals, count);
+}
+
+// `type name(type a, type b) {`: the parameters, visible at depth 1
+static void declare_params(const char *line, Local *locals, int *count) {
+    char        params[1024];
+    const char *open = strchr(line, '(');
+    if (!open || !copy_parens(open, params, sizeof(params))) return;
+
+    char *param = params;
+    while (param) {
+        char *comma = strchr(param, ',');
+        if (comma) *comma = '\0';
+        int before = *count;
+        declare_locals(param, 1, locals, count);
+        // An array parameter is a pointer
+        for (int i = before; i < *count; i++) {
+            if (locals[i].dims[0] && strchr(locals[i].dims + 1, '[') == NULL) {
+                size_t used = strlen(locals[i].type);
+                snprintf(locals[i].type + used, sizeof(locals[i].type) - used, " *");
+                locals[i].dims[0] = '\0';
+            } else if (locals[i].dims[0]) {
+                *count = i; // Multidimensional parameters are not captured
+            }
+        }
+        param = comma ? comma + 1 : NULL;
+    }
+}
+
+// =========================== [ LOOP HEADERS ] =========================================
+
+static int is_parallel_header(const char *line) {
+    const char *p = match_word(line + strspn(line, " \t"), "parallel");
+    return p && is_ident_char((unsigned char)*p);
+}
+
+static int parse_reductions(const char *text, ParallelLoop *loop) {
+    static const char *const ops[] = {"+", "*", "&", "|", "^", "min", "max"};
+    const char              *colon = strchr(text, ':');
+    if (!colon) return 0;
+
+    char op[8];
+    snprintf(op, sizeof(op), "%.*s", (int)(colon - text), text);
+    trim(op);
+    if (!in_list(op, ops, sizeof(ops) / sizeof(ops[0]))) return 0;
+
+    char names[128];
+    snprintf(names, sizeof(names), "%s", colon + 1);
+    for (char *name = strtok(names, ","); name; name = strtok(NULL, ",")) {
+        trim(name);
+        if (!name[0] || loop->reduction_count == MAX_REDUCTIONS) return 0;
+        Reduction *r = &loop->reductions[loop->reduction_count++];
+        snprintf(r->name, sizeof(r->name), "%s", name);
+        snprintf(r->op, sizeof(r->op), "%s", op);
+    }
+    return 1;
+}
+
+// `parallel [clauses] for (type i = start; i < end; i++) {`
+static int parse_header(const char *line, ParallelLoop *loop) {
+    const char *p = match_word(line + strspn(line, " \t"), "parallel");
+    char        text[512];
+
+    memset(loop, 0, sizeof(*loop));
+    loop->dynamic = 1;
+    strcpy(loop->chunk, "0");
+    for (;;) {
+        const char *next;
+        if ((next = match_word(p, "static")) || (next = match_word(p, "dynamic"))) {
+            loop->dynamic = *p == 'd';
+            p = next;
+            if (*p == '(') {
+                if (!(p = copy_parens(p, loop->chunk, sizeof(loop->chunk)))) return 0;
+                trim(loop->chunk);
+            }
+        } else if ((next = match_word(p, "reduce"))) {
+            if (!(p = copy_parens(next, text, sizeof(text))) || !parse_reductions(text, loop))
+                return 0;
+        } else {
+            break;
+        }
+    }
+    if (!(p = match_word(p, "for")) || !(p = copy_parens(p, text, sizeof(text)))) return 0;
+    if (*p != '{') return 0;
+
+    // The three clauses
+    char *init = text;
+    char *cond = strchr(init, ';');
+    if (!cond) return 0;
+    *cond++ = '\0';
+    char *step = strchr(cond, ';');
+    if (!step) return 0;
+    *step++ = '\0';
+
+    char *equals = strchr(init, '=');
+    if (!equals) return 0;
+    *equals = '\0';
+    snprintf(loop->start, sizeof(loop->start), "%s", equals + 1);
+    trim(loop->start);
+    trim(init);
+    size_t len = strlen(init), name = len;
+    while (name > 0 && is_ident_char((unsigned char)init[name - 1]))
+        name--;
+    if (name == 0 || name == len || len - name >= sizeof(loop->var)) return 0;
+    snprintf(loop->var, sizeof(loop->var), "%s", init + name);
+    init[name] = '\0';
+    trim(init);
+    if (strlen(init) >= sizeof(loop->type)) return 0;
+    strcpy(loop->type, init);
+
+    trim(cond);
+    const char *q = match_word(cond, loop->var);
+    if (!q || *q != '<') return 0;
+    loop->inclusive = q[1] == '=';
+    snprintf(loop->end, sizeof(loop->end), "%s", q + 1 + loop->inclusive);
+    trim(loop->end);
+
+    char expected[3][80];
+    snprintf(expected[0], sizeof(expected[0]), "%s++", loop->var);
+    snprintf(expected[1], sizeof(expected[1]), "++%s", loop->var);
+    snprintf(expected[2], sizeof(expected[2]), "%s += 1", loop->var);
+    trim(step);
+    return loop->type[0] && loop->start[0] && loop->end[0] &&
+           (strcmp(step, expected[0]) == 0 || strcmp(step, expected[1]) == 0 ||
+            strcmp(step, expected[2]) == 0);
+}
+
+// =========================== [ BODIES ] =========================================
+
+typedef struct {
+    Local *local;
+    int    reduction; // Merged rather than used in place
+} Capture;
+
+static Capture *find_capture(Capture *captures, int count, const char *name, size_t len) {
+    for (int i = 0; i < count; i++) {
+        if (strlen(captures[i].local->name) == len &&
+            strncmp(captures[i].local->name, name, len) == 0)
+            return &captures[i];
+    }
+    return NULL;
+}
+
+// Calls visit for every identifier in line outside literals and comments that
+// is not a member name; rewrites the line into out when out is not NULL
+typedef int (*IdentVisitor)(const char *name, size_t len, void *data, char *out, size_t size);
+
+static size_t scan_idents(const char *line, IdentVisitor visit, void *data, char *out, size_t size) {
+    size_t n = 0;
+    int    in_string = 0, in_char = 0;
+
+#define EMIT(c)                                                                                    \
+    do {                                                                                           \
+        if (out && n + 1 < size) out[n++] = (c);                                                   \
+    } while (0)
+
+    for (size_t i = 0; line[i]; i++) {
+        char c = line[i];
+        if (c == '\\' && (in_string || in_char) && line[i + 1]) {
+            EMIT(c);
+            EMIT(line[++i]);
+            continue;
+        }
+        if (c == '"' && !in_char) in_string = !in_string;
+        if (c == '\'' && !in_string) in_char = !in_char;
+        if (!in_string && !in_char && c == '/' && line[i + 1] == '/') {
+            while (line[i])
+                EMIT(line[i++]);
+            break;
+        }
+        if (in_string || in_char || !(isalpha((unsigned char)c) || c == '_') ||
+            (i > 0 && is_ident_char((unsigned char)line[i - 1]))) {
+            EMIT(c);
+            continue;
+        }
+
+        size_t end = i;
+        while (is_ident_char((unsigned char)line[end]))
+            end++;
+        int member = i > 0 && (line[i - 1] == '.' || (i > 1 && line[i - 1] == '>' && line[i - 2] == '-'));
+        size_t written = member ? 0 : visit(line + i, end - i, data, out ? out + n : NULL, n < size ? size - n : 0);
+        if (written == 0) {
+            for (size_t j = i; j < end; j++)
+                EMIT(line[j]);
+        } else {
+            n += written;
+            if (n >= size) n = size - 1;
+        }
+        i = end - 1;
+    }
+#undef EMIT
+
+    if (out) out[n] = '\0';
+    return n;
+}
+
+typedef struct {
+    Local      *locals;
+    int         local_count;
+    Local      *inner;       // Declared inside the body: shadow the outer ones
+    int         inner_count;
+    const char *var;
+    Capture    *captures;
+    int         capture_count;
+    int         uses_scratch;
+} CaptureScan;
+
+static int collect_capture(const char *name, size_t len, void *data, char *out, size_t size) {
+    CaptureScan *scan = data;
+    (void)out;
+    (void)size;
+    if (len == strlen("parallel_scratch") && strncmp(name, "parallel_scratch", len) == 0)
+        scan->uses_scratch = 1;
+    if ((strlen(scan->var) == len && strncmp(name, scan->var, len) == 0) ||
+        find_local(scan->inner, scan->inner_count, name, len) ||
+        find_capture(scan->captures, scan->capture_count, name, len))
+        return 0;
+
+    Local *local = find_local(scan->locals, scan->local_count, name, len);
+    if (local && scan->capture_count < MAX_CAPTURES) {
+        scan->captures[scan->capture_count].local = local;
+        scan->captures[scan->capture_count++].reduction = 0;
+    }
+    return 0;
+}
+
+// exits[0] counts `return`, exits[1] `break`
+static int find_exits(const char *name, size_t len, void *data, char *out, size_t size) {
+    int *exits = data;
+    (void)out;
+    (void)size;
+    if (len == 6 && strncmp(name, "return", 6) == 0) exits[0]++;
+    if (len == 5 && strncmp(name, "break", 5) == 0) exits[1]++;
+    return 0;
+}
+
+static int rewrite_capture(const char *name, size_t len, void *data, char *out, size_t size) {
+    CaptureScan *scan = data;
+    Capture     *capture = find_capture(scan->captures, scan->capture_count, name, len);
+    if (!capture || capture->reduction) return 0;
+
+    int written = capture->local->vla ? snprintf(out, size, "__ctx->%s", capture->local->name)
+                                      : snprintf(out, size, "(*__ctx->%s)", capture->local->name);
+    return written > 0 ? written : 0;
+}
+
+// Space between a type and a name: none after a star
+static const char *gap(const char *type) { return type[strlen(type) - 1] == '*' ? "" : " "; }
+
+// The context field that points at a captured variable
+static void write_field(FILE *out, const Local *local) {
+    if (local->vla) {
+        const char *rest = strchr(local->dims, ']');
+        fprintf(out, "    %s%s(*%s)%s;\n", local->type, gap(local->type), local->name, rest + 1);
+    } else if (local->dims[0]) {
+        fprintf(out, "    %s%s(*%s)%s;\n", local->type, gap(local->type), local->name, local->dims);
+    } else {
+        fprintf(out, "    %s%s*%s;\n", local->type, gap(local->type), local->name);
+    }
+}
+
+static const char *identity(const char *op) {
+    if (strcmp(op, "*") == 0) return "1";
+    if (strcmp(op, "min") == 0 || strcmp(op, "max") == 0) return NULL; // Start from the caller's value
+    return "0";
+}
+
+static void lower_function(LineBuffer *fn, FILE *out);
+
+// Writes the context struct and body function for the loop at fn->lines[header..end]
+// and appends its replacement to rewritten
+static void lower_loop(LineBuffer *fn, int header, int end, Local *locals, int local_count,
+                       LineBuffer *rewritten, FILE *out) {
+    ParallelLoop loop;
+    int          number = fn->numbers[header];
+    if (!parse_header(fn->lines[header], &loop)) {
+        report(number, "expected `parallel [static|dynamic[(chunk)]] [reduce(op: vars)] "
+                       "for (type i = start; i < end; i++) {`", "");
+        return;
+    }
+
+    // What the body declares itself, and whether it leaves the loop early
+    Local inner[MAX_LOCALS];
+    int   inner_count = 0, depth = 0, loops = 0; // loops: nested loops and switches open
+    int   loop_depth[64];
+    for (int i = header + 1; i < end; i++) {
+        const char *line = fn->lines[i];
+        const char *p = line + strspn(line, " \t");
+        declare_line(line, depth, inner, &inner_count);
+        int exits[2] = {0, 0};
+        scan_idents(line, find_exits, exits, NULL, 0);
+        if (exits[0]) report(fn->numbers[i], "return inside a parallel for", "");
+        if (exits[1] && loops == 0) report(fn->numbers[i], "break out of a parallel for", "");
+
+        depth += brace_delta(line);
+        while (loops > 0 && loop_depth[loops - 1] > depth)
+            loops--;
+        if (brace_delta(line) > 0 && loops < 64 &&
+            (match_word(p, "for") || match_word(p, "while") || match_word(p, "do") ||
+             match_word(p, "switch")))
+            loop_depth[loops++] = depth;
+    }
+
+    Capture     captures[MAX_CAPTURES];
+    CaptureScan scan = {locals, local_count, inner, inner_count, loop.var, captures, 0, 0};
+    for (int r = 0; r < loop.reduction_count; r++) {
+        const char *name = loop.reductions[r].name;
+        Local      *local = find_local(locals, local_count, name, strlen(name));
+        if (!local || local->dims[0]) {
+            report(number, "reduction variable is not a local scalar: ", name);
+            return;
+        }
+        captures[scan.capture_count].local = local;
+        captures[scan.capture_count++].reduction = 1;
+    }
+    for (int i = header + 1; i < end; i++)
+        scan_idents(fn->lines[i], collect_capture, &scan, NULL, 0);
+
+    int  id = ++loop_count;
+    int  indent = strspn(fn->lines[header], " \t");
+    char text[4096];
+
+    if (scan.capture_count > 0) {
+        fprintf(out, "struct __par%d_ctx {\n", id);
+        for (int c = 0; c < scan.capture_count; c++)
+            write_field(out, captures[c].local);
+        fprintf(out, "};\n\n");
+    }
+
+    // The body function, lowered in turn for loops nested in this one
+    LineBuffer body = {0};
+    snprintf(text, sizeof(text),
+             "static void __par%d_body(void *__context, long __begin, long __end, Arena *parallel_scratch) {\n",
+             id);
+    push_numbered_line(&body, text, number);
+    if (scan.capture_count > 0) {
+        snprintf(text, sizeof(text), "    struct __par%d_ctx *__ctx = __context;\n", id);
+    } else {
+        snprintf(text, sizeof(text), "    (void)__context;\n");
+    }
+    push_numbered_line(&body, text, number);
+    if (!scan.uses_scratch) push_numbered_line(&body, "    (void)parallel_scratch;\n", number);
+    for (int r = 0; r < loop.reduction_count; r++) {
+        Capture    *c = &captures[r];
+        const char *start = identity(loop.reductions[r].op);
+        if (start) {
+            snprintf(text, sizeof(text), "    %s%s%s = %s;\n", c->local->type, gap(c->local->type),
+                     c->local->name, start);
+            push_numbered_line(&body, text, number);
+            continue;
+        }
+        // Other chunks may be merging into the caller's value meanwhile
+        push_numbered_line(&body, "    parallel_lock();\n", number);
+        snprintf(text, sizeof(text), "    %s%s%s = *__ctx->%s;\n", c->local->type,
+                 gap(c->local->type), c->local->name, c->local->name);
+        push_numbered_line(&body, text, number);
+        push_numbered_line(&body, "    parallel_unlock();\n", number);
+    }
+    snprintf(text, sizeof(text), "    for (%s %s = __begin; %s < __end; %s++) {\n", loop.type, loop.var,
+             loop.var, loop.var);
+    push_numbered_line(&body, text, number);
+    for (int i = header + 1; i < end; i++) {
+        const char *line = fn->lines[i];
+        int         strip = strspn(line, " \t");
+        if (strip > indent) strip = indent;
+        text[0] = text[1] = text[2] = text[3] = ' ';
+        scan_idents(line + strip, rewrite_capture, &scan, text + 4, sizeof(text) - 4);
+        push_numbered_line(&body, line[strspn(line, " \t")] == '\n' ? "\n" : text, fn->numbers[i]);
+    }
+    push_numbered_line(&body, "    }\n", fn->numbers[end]);
+    if (loop.reduction_count > 0) {
+        push_numbered_line(&body, "    parallel_lock();\n", number);
+        for (int r = 0; r < loop.reduction_count; r++) {
+            const char *name = loop.reductions[r].name;
+            const char *op = loop.reductions[r].op;
+            if (strcmp(op, "min") == 0 || strcmp(op, "max") == 0) {
+                snprintf(text, sizeof(text), "    if (%s %s *__ctx->%s) *__ctx->%s = %s;\n", name,
+                         op[1] == 'i' ? "<" : ">", name, name, name);
+            } else {
+                snprintf(text, sizeof(text), "    *__ctx->%s %s= %s;\n", name, op, name);
+            }
+            push_numbered_line(&body, text, number);
+        }
+        push_numbered_line(&body, "    parallel_unlock();\n", number);
+    }
+    push_numbered_line(&body, "}\n", number);
+    push_numbered_line(&body, "\n", number);
+    lower_function(&body, out);
+    free_lines(&body);
+
+    // The call in place of the loop
+    snprintf(text, sizeof(text), "%*s{\n", indent, "");
+    push_numbered_line(rewritten, text, number);
+    if (scan.capture_count > 0) {
+        int n = snprintf(text, sizeof(text), "%*s    struct __par%d_ctx __par%d = {", indent, "", id, id);
+        for (int c = 0; c < scan.capture_count && n < (int)sizeof(text); c++) {
+            const Local *local = captures[c].local;
+            n += snprintf(text + n, sizeof(text) - n, "%s.%s = %s%s", c ? ", " : "", local->name,
+                          local->vla ? "" : "&", local->name);
+        }
+        if (n < (int)sizeof(text)) snprintf(text + n, sizeof(text) - n, "};\n");
+        push_numbered_line(rewritten, text, number);
+    }
+    snprintf(text, sizeof(text), "%*s    parallel_for_range(%s, (%s)%s, %s, %s, __par%d_body, %s__par%d);\n",
+             indent, "", loop.start, loop.end, loop.inclusive ? " + 1" : "", loop.chunk,
+             loop.dynamic ? "PARALLEL_DYNAMIC" : "PARALLEL_STATIC", id,
+             scan.capture_count > 0 ? "&" : "NULL", id);
+    push_numbered_line(rewritten, text, number);
+    snprintf(text, sizeof(text), "%*s}\n", indent, "");
+    push_numbered_line(rewritten, text, fn->numbers[end]);
+}
+
+// Writes fn with its parallel loops lowered, after the functions they become
+static void lower_function(LineBuffer *fn, FILE *out) {
+    Local      locals[MAX_LOCALS];
+    int        local_count = 0, depth = 1;
+    LineBuffer rewritten = {0};
+
+    declare_params(fn->lines[0], locals, &local_count);
+    push_numbered_line(&rewritten, fn->lines[0], fn->numbers[0]);
+    for (int i = 1; i < fn->count; i++) {
+        const char *line = fn->lines[i];
+        if (is_parallel_header(line)) {
+            int end = block_end(fn, i);
+            lower_loop(fn, i, end, locals, local_count, &rewritten, out);
+            i = end;
+            continue;
+        }
+        declare_line(line, depth, locals, &local_count);
+        push_numbered_line(&rewritten, line, fn->numbers[i]);
+        depth += brace_delta(line);
+        while (local_count > 0 && locals[local_count - 1].depth > depth)
+            local_count--;
+    }
+
+    for (int i = 0; i < rewritten.count; i++)
+        fputs(rewritten.lines[i], out);
+    free_lines(&rewritten);
+}
+
+static int opens_function(const char *line) {
+    const char *p = line + strspn(line, " \t");
+    if (*p == '#' || match_word(p, "struct") || match_word(p, "typedef") || match_word(p, "enum") ||
+        match_word(p, "union"))
+        return 0;
+    const char *paren = strchr(p, '(');
+    const char *equals = strchr(p, '=');
+    return paren && (!equals || equals > paren) && brace_delta(line) > 0;
+}
+
+// =========================== [ MAIN TRANSFORMATION ] ====================================
+
+int add_parallel_loops(FILE *in, FILE *out) {
+    LineBuffer buf = {0};
+    char       line[1024];
+    int        depth = 0;
+
+    pass_errors = 0;
+    loop_count = 0;
+    while (fgets(line, sizeof(line), in))
+        push_line(&buf, line);
+
+    for (int i = 0; i < buf.count; i++) {
+        if (depth == 0 && opens_function(buf.lines[i])) {
+            int        end = block_end(&buf, i);
+            LineBuffer fn = {0};
+            for (int j = i; j <= end; j++)
+                push_numbered_line(&fn, buf.lines[j], buf.numbers[j]);
+            lower_function(&fn, out);
+            free_lines(&fn);
+            i = end;
+            continue;
+        }
+        if (is_parallel_header(buf.lines[i])) report(buf.numbers[i], "parallel for outside a function", "");
+        fputs(buf.lines[i], out);
+        depth += brace_delta(buf.lines[i]);
+    }
+
+    free_lines(&buf);
+    return pass_errors;
+}
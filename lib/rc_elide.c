@@ -0,0 +1,505 @@
+// lib/rc_elide.c - Drop the retain/release pairs add_refcounting emitted but
+// the program does not need, and keep strings that never leave their function
+// off the heap
+//
+// add_refcounting retains the source of every `string b = a;` and releases
+// every local at the end of its block. Over each function body this pass
+// removes the pairs that cancel:
+//
+//   move    string b = a; rc_retain(a);      a is not mentioned again in the
+//           ...                              block, so its reference moves to
+//           rc_release(a); rc_release(b);    b: the retain and a's release go
+//
+//   borrow  string b = p; rc_retain(p);      p (a parameter, or a local of an
+//           ...                              enclosing block) outlives b, and b
+//           rc_release(b);                   is only read: the retain and b's
+//                                            release go
+//
+// Parameters are borrowed from the caller, so a copy of one is always a
+// borrow candidate. A variable stops being a candidate as soon as it is
+// assigned, has its address taken, is returned, is copied into another
+// variable, or is handed to a function that consumes its argument.
+//
+// Escape analysis runs first. A local initialised by string_create/concat/substr
+// whose only uses are as a plain argument to a known read-only function (printf,
+// string_length, string_eq, ...) cannot outlive the call frame, so it moves to
+// the function's StringFrame: a stack buffer sized from the literal lengths,
+// spilling to heap chunks freed on scope exit. Its release goes, and so does the
+// malloc. Strings declared inside loops stay on the heap so the frame cannot
+// grow without bound, and so do those of `async` functions, whose locals
+// outlive the C frame.
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// =========================== [ STRUCTS ] =========================================
+
+typedef struct {
+    int name;      // Token index of the name
+    int block;     // Declaring block; the function body for parameters
+    int is_param;  // Borrowed from the caller, never released here
+    int is_map;    // map rather than string
+    int borrowed;  // Its own reference was elided: it holds none
+    int lent;      // A borrowed variable still points at its value
+    int moved;     // Its reference went to another variable
+    int framed;    // Lives in the function's StringFrame, never released
+    int size;      // Payload bytes when known at compile time, else -1
+    int source;    // Variable a borrowed one points into, else -1
+} Var;
+
+typedef struct {
+    int  pos; // Byte offset the text goes in front of
+    char text[64];
+} Insert;
+
+typedef struct {
+    TokenStream ts;
+    Var        *vars;
+    int         var_count, var_capacity;
+    char       *deleted; // Per byte: dropped from the output
+    Insert     *inserts;
+    int         insert_count, insert_capacity;
+} ElideState;
+
+// Functions that take over the reference passed as their first argument
+static const char *consuming_functions[] = {
+    "rc_release", "map_release", "string_free", "string_concat_inplace", "string_builder_adopt",
+};
+
+// Functions that only read a string argument during the call: they neither
+// keep it nor return a pointer into it
+static const char *reading_functions[] = {
+    "printf",         "fprintf",          "sprintf",          "snprintf",
+    "puts",           "fputs",            "strlen",           "strcmp",
+    "strncmp",        "string_length",    "string_create",    "string_concat",
+    "string_substr",  "string_eq",        "string_cmp",       "string_count",
+    "string_hash",    "string_hash32",    "string_utf8_valid", "string_utf8_len",
+    "string_utf8_offset", "string_intern", "string_is_interned", "string_builder_from",
+    "string_builder_append", "string_builder_append_n", "map_get_str", "map_get_cstr",
+    "map_remove_str", "strview_eq",  "arena_string_create", "arena_string_concat",
+    "arena_string_substr",
+};
+
+// Heap constructors and their frame counterparts
+static const char *frame_constructors[][2] = {
+    {"string_create", "string_frame_create"},
+    {"string_concat", "string_frame_concat"},
+    {"string_substr", "string_frame_substr"},
+};
+
+// =========================== [ VARIABLES ] =========================================
+
+static int block_encloses(ElideState *st, int outer, int inner) {
+    for (int b = inner; b >= 0; b = st->ts.blocks[b].parent) {
+        if (b == outer) return 1;
+    }
+    return 0;
+}
+
+static void add_var(ElideState *st, int name, int block, int is_param, int is_map) {
+    if (st->var_count >= st->var_capacity) {
+        st->var_capacity = st->var_capacity ? st->var_capacity * 2 : 32;
+        st->vars = realloc(st->vars, sizeof(Var) * st->var_capacity);
+    }
+    st->vars[st->var_count++] = (Var){name, block, is_param, is_map, 0, 0, 0, 0, -1, -1};
+}
+
+// The variable an identifier token refers to: the latest declaration before it
+// whose block encloses it, parameters included. -1 for anything else.
+static int resolve(ElideState *st, int tok) {
+    for (int v = st->var_count - 1; v >= 0; v--) {
+        Var *var = &st->vars[v];
+        if (var->name < tok && tok_same(&st->ts, var->name, tok) &&
+            block_encloses(st, var->block, st->ts.toks[tok].block))
+            return v;
+    }
+    return -1;
+}
+
+static int is_refcounted_type(ElideState *st, int i) {
+    return tok_is(&st->ts, i, "string") || tok_is(&st->ts, i, "map");
+}
+
+// Parameters and block-level declarations of one function body
+static void collect_vars(ElideState *st, int body) {
+    const Block *fn = &st->ts.blocks[body];
+    int          depth = 0, open = fn->open - 1;
+    for (; open >= 0; open--) {
+        if (tok_is(&st->ts, open, ")")) depth++;
+        if (tok_is(&st->ts, open, "(") && --depth == 0) break;
+    }
+    for (int i = open + 1; i < fn->open - 1; i++) {
+        if (is_refcounted_type(st, i) && st->ts.toks[i + 1].kind == TOK_IDENT &&
+            (tok_is(&st->ts, i + 2, ",") || tok_is(&st->ts, i + 2, ")")))
+            add_var(st, i + 1, body, 1, tok_is(&st->ts, i, "map"));
+    }
+
+    for (int i = fn->open + 1; i < fn->close; i++) {
+        if (is_refcounted_type(st, i) && st->ts.toks[i + 1].kind == TOK_IDENT &&
+            (tok_is(&st->ts, i - 1, ";") || tok_is(&st->ts, i - 1, "{") ||
+             tok_is(&st->ts, i - 1, "}")) &&
+            (tok_is(&st->ts, i + 2, "=") || tok_is(&st->ts, i + 2, ";")))
+            add_var(st, i + 1, st->ts.toks[i].block, 0, tok_is(&st->ts, i, "map"));
+    }
+}
+
+// =========================== [ STATEMENT MATCHING ] ====================================
+
+// `call ( name ) ;` starting at token i
+static int is_call_stmt(ElideState *st, int i, const char *call, int name) {
+    return tok_is(&st->ts, i, call) && tok_is(&st->ts, i + 1, "(") &&
+           tok_same(&st->ts, i + 2, name) && tok_is(&st->ts, i + 3, ")") &&
+           tok_is(&st->ts, i + 4, ";");
+}
+
+static int is_release_stmt(ElideState *st, int i) {
+    return (tok_is(&st->ts, i, "rc_release") || tok_is(&st->ts, i, "map_release") ||
+            tok_is(&st->ts, i, "strview_release")) &&
+           tok_is(&st->ts, i + 1, "(") && st->ts.toks[i + 2].kind == TOK_IDENT &&
+           tok_is(&st->ts, i + 3, ")") && tok_is(&st->ts, i + 4, ";");
+}
+
+// The release add_refcounting put in the run of releases closing the
+// variable's block, or -1 when it has none (parameters, borrowed locals)
+static int find_scope_release(ElideState *st, int v) {
+    Var *var = &st->vars[v];
+    if (var->is_param || var->borrowed || var->moved || var->framed) return -1;
+    for (int i = st->ts.blocks[var->block].close - 5; i > var->name && is_release_stmt(st, i);
+         i -= 5) {
+        if (tok_same(&st->ts, i + 2, var->name)) return i;
+    }
+    return -1;
+}
+
+// First statement of the run of releases that closes a block
+static int scope_releases_start(ElideState *st, int block) {
+    int i = st->ts.blocks[block].close;
+    while (i - 5 > st->ts.blocks[block].open && is_release_stmt(st, i - 5))
+        i -= 5;
+    return i;
+}
+
+static void delete_stmt(ElideState *st, int first) {
+    int start = st->ts.toks[first].start, end = st->ts.toks[first + 4].end;
+    // Take the indentation and line break add_refcounting wrote before it
+    while (start > 0 && (st->ts.src[start - 1] == ' ' || st->ts.src[start - 1] == '\t'))
+        start--;
+    if (start > 0 && st->ts.src[start - 1] == '\n') start--;
+    memset(st->deleted + start, 1, end - start);
+}
+
+static void insert_text(ElideState *st, int pos, const char *text) {
+    if (st->insert_count >= st->insert_capacity) {
+        st->insert_capacity = st->insert_capacity ? st->insert_capacity * 2 : 16;
+        st->inserts = realloc(st->inserts, sizeof(Insert) * st->insert_capacity);
+    }
+    Insert *insert = &st->inserts[st->insert_count++];
+    insert->pos = pos;
+    snprintf(insert->text, sizeof(insert->text), "%s", text);
+}
+
+static int is_rc_call(ElideState *st, int i) {
+    return tok_is(&st->ts, i + 1, "(") &&
+           (tok_is(&st->ts, i, "rc_retain") || tok_is(&st->ts, i, "rc_release") ||
+            tok_is(&st->ts, i, "map_release") || tok_is(&st->ts, i, "strview_retain") ||
+            tok_is(&st->ts, i, "strview_release"));
+}
+
+// =========================== [ ESCAPE CHECKS ] ====================================
+
+// Token i names variable v and has not been deleted with an elided statement
+static int is_use(ElideState *st, int i, int v) {
+    return st->ts.toks[i].kind == TOK_IDENT && !st->deleted[st->ts.toks[i].start] &&
+           resolve(st, i) == v;
+}
+
+// Whether the variable keeps being a plain read-only name over tokens
+// (from, to). A borrower additionally may not be copied into anything.
+static int escapes(ElideState *st, int v, int from, int to, int as_borrower) {
+    for (int i = from + 1; i < to; i++) {
+        if (!is_use(st, i, v)) continue;
+        if (tok_is(&st->ts, i + 1, "=") || tok_is(&st->ts, i - 1, "&") || st->ts.toks[i].in_return)
+            return 1;
+        if (as_borrower && tok_is(&st->ts, i - 1, "=")) return 1;
+        if (tok_is(&st->ts, i - 1, "(")) {
+            for (size_t f = 0; f < sizeof(consuming_functions) / sizeof(consuming_functions[0]); f++) {
+                if (tok_is(&st->ts, i - 2, consuming_functions[f])) return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int mentioned(ElideState *st, int v, int from, int to, int except) {
+    for (int i = from + 1; i < to; i++) {
+        if (i >= except && i < except + 5) continue;
+        if (is_use(st, i, v)) return 1;
+    }
+    return 0;
+}
+
+// =========================== [ FRAME STRINGS ] ====================================
+
+static int in_list(ElideState *st, int tok, const char **names, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (tok_is(&st->ts, tok, names[i])) return 1;
+    }
+    return 0;
+}
+
+static int matching_paren(ElideState *st, int open) {
+    int depth = 0;
+    for (int i = open; i < st->ts.tok_count; i++) {
+        if (tok_is(&st->ts, i, "(")) depth++;
+        if (tok_is(&st->ts, i, ")") && --depth == 0) return i;
+    }
+    return -1;
+}
+
+// Callee of the innermost call whose argument list holds token i, or -1
+static int enclosing_call(ElideState *st, int i) {
+    int depth = 0;
+    for (int j = i - 1; j >= 0; j--) {
+        if (tok_is(&st->ts, j, ";") || tok_is(&st->ts, j, "{") || tok_is(&st->ts, j, "}"))
+            return -1;
+        if (tok_is(&st->ts, j, ")")) depth++;
+        if (tok_is(&st->ts, j, "(") && depth-- == 0)
+            return st->ts.toks[j - 1].kind == TOK_IDENT ? j - 1 : -1;
+    }
+    return -1;
+}
+
+// A for/while/do body, or a block nested in one, below the function body
+static int in_loop(ElideState *st, int block, int body) {
+    for (int b = block; b != body && b >= 0; b = st->ts.blocks[b].parent) {
+        int open = st->ts.blocks[b].open;
+        if (tok_is(&st->ts, open - 1, "do")) return 1;
+        if (!tok_is(&st->ts, open - 1, ")")) continue;
+        int depth = 0, j = open - 1;
+        for (; j >= 0; j--) {
+            if (tok_is(&st->ts, j, ")")) depth++;
+            if (tok_is(&st->ts, j, "(") && --depth == 0) break;
+        }
+        if (tok_is(&st->ts, j - 1, "for") || tok_is(&st->ts, j - 1, "while")) return 1;
+    }
+    return 0;
+}
+
+// Every use over tokens (from, to) is a whole argument of a reading function,
+// or initialises a borrowed copy whose own uses are
+static int only_read(ElideState *st, int v, int from, int to) {
+    for (int i = from + 1; i < to; i++) {
+        if (!is_use(st, i, v)) continue;
+        int alias = -1;
+        for (int a = 0; a < st->var_count; a++) {
+            if (st->vars[a].name == i - 2 && st->vars[a].source == v) alias = a;
+        }
+        if (alias >= 0) {
+            if (!tok_is(&st->ts, i + 1, ";") ||
+                !only_read(st, alias, i + 1, scope_releases_start(st, st->vars[alias].block)))
+                return 0;
+            continue;
+        }
+        if (!(tok_is(&st->ts, i - 1, "(") || tok_is(&st->ts, i - 1, ",")) ||
+            !(tok_is(&st->ts, i + 1, ")") || tok_is(&st->ts, i + 1, ",")))
+            return 0;
+        int callee = enclosing_call(st, i);
+        if (callee < 0 ||
+            !in_list(st, callee, reading_functions,
+                     sizeof(reading_functions) / sizeof(reading_functions[0])))
+            return 0;
+    }
+    return 1;
+}
+
+// Payload size of a string literal or framed variable argument, -1 if unknown
+static int arg_size(ElideState *st, int tok) {
+    const Token *t = &st->ts.toks[tok];
+    if (t->kind == TOK_OTHER && st->ts.src[t->start] == '"') return t->end - t->start - 2;
+    if (t->kind != TOK_IDENT) return -1;
+    int v = resolve(st, tok);
+    return v >= 0 && st->vars[v].framed ? st->vars[v].size : -1;
+}
+
+// Payload bytes the constructor call at `ctor` produces, -1 when only known at run time
+static int constructor_size(ElideState *st, int ctor, int close) {
+    int first = ctor + 2;
+    if (tok_is(&st->ts, ctor, "string_create") && close == first + 1) return arg_size(st, first);
+    if (tok_is(&st->ts, ctor, "string_substr"))
+        return tok_is(&st->ts, first + 1, ",") ? arg_size(st, first) : -1;
+    if (tok_is(&st->ts, ctor, "string_concat") && tok_is(&st->ts, first + 1, ",") &&
+        close == first + 3) {
+        int a = arg_size(st, first), b = arg_size(st, first + 2);
+        return a < 0 || b < 0 ? -1 : a + b;
+    }
+    return -1;
+}
+
+// `string s = string_create(...);` whose value never leaves the function:
+// rewrite the constructor onto the frame and drop the scope-end release
+static int frame_string(ElideState *st, int v, int body) {
+    Var *var = &st->vars[v];
+    int  ctor = var->name + 2, release = find_scope_release(st, v);
+    if (var->is_param || var->is_map || !tok_is(&st->ts, var->name + 1, "=") ||
+        release < 0) return 0;
+    if (!tok_is(&st->ts, ctor + 1, "(") || in_loop(st, var->block, body)) return 0;
+
+    const char *frame_ctor = NULL;
+    for (size_t c = 0; c < sizeof(frame_constructors) / sizeof(frame_constructors[0]); c++) {
+        if (tok_is(&st->ts, ctor, frame_constructors[c][0])) frame_ctor = frame_constructors[c][1];
+    }
+    int close = matching_paren(st, ctor + 1);
+    if (!frame_ctor || close < 0 || !tok_is(&st->ts, close + 1, ";")) return 0;
+    if (!only_read(st, v, close + 1, scope_releases_start(st, var->block))) return 0;
+
+    char call[64];
+    snprintf(call, sizeof(call), "%s(&__frame, ", frame_ctor);
+    memset(st->deleted + st->ts.toks[ctor].start, 1,
+           st->ts.toks[ctor + 1].end - st->ts.toks[ctor].start);
+    insert_text(st, st->ts.toks[ctor].start, call);
+    delete_stmt(st, release);
+    var->size = constructor_size(st, ctor, close);
+    var->framed = 1;
+    return 1;
+}
+
+// =========================== [ ELISION ] =========================================
+
+// `string dest = src; rc_retain(src);` at token i; returns the RC calls removed
+static int elide_copy(ElideState *st, int i) {
+    int dest_tok = i + 1, src_tok = i + 3, retain = i + 5;
+    int dest = -1, src = resolve(st, src_tok);
+    for (int v = 0; v < st->var_count; v++) {
+        if (st->vars[v].name == dest_tok) dest = v;
+    }
+    if (dest < 0 || src < 0) return 0;
+    if (!is_call_stmt(st, retain, "rc_retain", src_tok)) return 0;
+
+    Var *d = &st->vars[dest], *s = &st->vars[src];
+    if (d->is_map != s->is_map || s->moved) return 0;
+    int dest_release = find_scope_release(st, dest);
+    if (dest_release < 0) return 0;
+
+    // Move: the source dies with this copy
+    int src_release = find_scope_release(st, src);
+    if (src_release >= 0 && s->block == d->block && !s->lent &&
+        !mentioned(st, src, retain + 4, st->ts.blocks[s->block].close, src_release)) {
+        delete_stmt(st, retain);
+        delete_stmt(st, src_release);
+        s->moved = 1;
+        return 2;
+    }
+
+    // Borrow: the source outlives the copy and neither lets go of the value
+    // before the copy's scope ends
+    int src_lives = s->is_param || s->borrowed || src_release >= 0;
+    int scope_end = scope_releases_start(st, d->block);
+    if (src_lives && block_encloses(st, s->block, d->block) &&
+        !escapes(st, dest, retain + 4, scope_end, 1) &&
+        !escapes(st, src, retain + 4, scope_end, 0)) {
+        delete_stmt(st, retain);
+        delete_stmt(st, dest_release);
+        d->borrowed = 1;
+        d->source = src;
+        s->lent = 1;
+        return 2;
+    }
+    return 0;
+}
+
+// `async` functions return from their C frame at every await
+static int is_async_function(ElideState *st, int body) {
+    for (int i = st->ts.blocks[body].open - 1; i >= 0; i--) {
+        if (tok_is(&st->ts, i, ";") || tok_is(&st->ts, i, "}")) return 0;
+        if (tok_is(&st->ts, i, "async")) return 1;
+    }
+    return 0;
+}
+
+static int elide_function(ElideState *st, int body, int *framed) {
+    const Block *fn = &st->ts.blocks[body];
+    int          removed = 0, frame_count = 0, frame_bytes = 0, has_goto = 0;
+    st->var_count = 0;
+    collect_vars(st, body);
+
+    for (int i = fn->open + 1; i + 9 < fn->close; i++) {
+        if (is_refcounted_type(st, i) && st->ts.toks[i + 1].kind == TOK_IDENT &&
+            tok_is(&st->ts, i + 2, "=") && st->ts.toks[i + 3].kind == TOK_IDENT &&
+            tok_is(&st->ts, i + 4, ";"))
+            removed += elide_copy(st, i);
+    }
+
+    // Frame storage last, so borrowed copies count as reads of their source
+    for (int i = fn->open + 1; i < fn->close; i++) {
+        if (tok_is(&st->ts, i, "goto")) has_goto = 1;
+    }
+    for (int v = 0; v < st->var_count && !has_goto && !is_async_function(st, body); v++) {
+        if (!frame_string(st, v, body)) continue;
+        frame_count++;
+        frame_bytes += st->vars[v].size > 0 ? st->vars[v].size + 1 : 0;
+    }
+    if (frame_count > 0) {
+        char decl[64];
+        snprintf(decl, sizeof(decl), "\n    STRING_FRAME(__frame, %d, %d);", frame_count, frame_bytes);
+        insert_text(st, st->ts.toks[fn->open].end, decl);
+        insert_text(st, st->ts.toks[fn->close].start, "\n    STRING_FRAME_END(__frame);");
+        *framed += frame_count;
+        removed += frame_count;
+    }
+    return removed;
+}
+
+// =========================== [ MAIN TRANSFORMATION ] ====================================
+
+void elide_refcounts(FILE *in, FILE *out) {
+    size_t size = 0, capacity = 4096;
+    char  *src = malloc(capacity);
+    int    ch;
+    while ((ch = fgetc(in)) != EOF) {
+        if (size + 1 >= capacity) src = realloc(src, capacity *= 2);
+        src[size++] = ch;
+    }
+    src[size] = '\0';
+
+    ElideState st = {0};
+    st.ts.src = src;
+    st.deleted = calloc(size + 1, 1);
+    tokenize(&st.ts);
+
+    int removed = 0, total = 0, framed = 0;
+    for (int i = 0; i < st.ts.tok_count; i++) {
+        if (is_rc_call(&st, i)) total++;
+    }
+    // Function bodies: file-scope blocks opened right after a parameter list
+    for (int b = 0; b < st.ts.block_count; b++) {
+        if (st.ts.blocks[b].parent < 0 && st.ts.blocks[b].close > 0 &&
+            tok_is(&st.ts, st.ts.blocks[b].open - 1, ")"))
+            removed += elide_function(&st, b, &framed);
+    }
+
+    // Stable sort: inserts at one offset keep the order they were made in
+    for (int i = 1; i < st.insert_count; i++) {
+        Insert insert = st.inserts[i];
+        int    j = i;
+        for (; j > 0 && st.inserts[j - 1].pos > insert.pos; j--)
+            st.inserts[j] = st.inserts[j - 1];
+        st.inserts[j] = insert;
+    }
+    int next = 0;
+    for (size_t i = 0; i <= size; i++) {
+        while (next < st.insert_count && st.inserts[next].pos == (int)i)
+            fputs(st.inserts[next++].text, out);
+        if (i < size && !st.deleted[i]) fputc(src[i], out);
+    }
+    if (total > 0)
+        fprintf(stderr,
+                "Refcount elision: removed %d of %d retain/release calls, %d frame string(s)\n",
+                removed, total, framed);
+
+    free_tokens(&st.ts);
+    free(st.vars);
+    free(st.deleted);
+    free(st.inserts);
+    free(src);
+}
@@ -0,0 +1,159 @@
+// lib/rc_struct.c - Lower `rc struct` declarations onto refcounted handles
+//
+//     rc struct Node {           typedef struct Node *Node;
+//         Node   next            struct Node {
+//         string name      =>        struct Node *next;
+//         int    value               char *name;
+//     }                              int value;
+//                                };
+//                                static const size_t Node__fields[] = {offsetof(struct Node, next), ...};
+//                                static const RcType Node__type = {"Node", sizeof(struct Node), 2, Node__fields};
+//
+// The type name is a pointer handle, like string: `Node n = rc_new(Node)`
+// allocates a zeroed object, and add_refcounting retains and releases Node
+// variables. The descriptor lists the string and rc struct fields, which the
+// runtime releases when the object dies and traces when collecting cycles
+// (SAM_RC_CYCLES, defined by main.c for programs that use RcType). Fields are
+// written with their C types so the later passes do not mistake them for
+// local variables.
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_RC_STRUCTS 128
+#define MAX_FIELDS 64
+
+static char rc_structs[MAX_RC_STRUCTS][64];
+static int  rc_struct_count;
+
+int is_rc_struct(const char *name) {
+    for (int i = 0; i < rc_struct_count; i++) {
+        if (strcmp(rc_structs[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+// `rc struct Name {`: copies Name and returns 1
+static int parse_header(const char *line, char *name, size_t size) {
+    const char *p = line + strspn(line, " \t");
+    if (strncmp(p, "rc", 2) != 0 || !isspace((unsigned char)p[2])) return 0;
+    p += 2 + strspn(p + 2, " \t");
+    if (strncmp(p, "struct", 6) != 0 || !isspace((unsigned char)p[6])) return 0;
+    p += 6 + strspn(p + 6, " \t");
+
+    size_t len = 0;
+    while (isalnum((unsigned char)p[len]) || p[len] == '_')
+        len++;
+    if (len == 0 || len >= size) return 0;
+    const char *rest = p + len + strspn(p + len, " \t");
+    if (*rest != '{') return 0;
+
+    memcpy(name, p, len);
+    name[len] = '\0';
+    return 1;
+}
+
+// `type name` with an optional `;` and trailing comment. Returns 1 for a
+// field, with type and name split and the comment (if any) in comment.
+static int parse_field(const char *line, char *type, char *name, char *comment) {
+    char text[128];
+    snprintf(text, sizeof(text), "%s", line + strspn(line, " \t"));
+    text[strcspn(text, "\n")] = '\0';
+    comment[0] = '\0';
+
+    char *slash = strstr(text, "//");
+    if (slash) {
+        snprintf(comment, 128, "%s", slash);
+        *slash = '\0';
+    }
+    size_t len = strlen(text);
+    while (len > 0 && (isspace((unsigned char)text[len - 1]) || text[len - 1] == ';'))
+        text[--len] = '\0';
+
+    size_t start = len;
+    while (start > 0 && (isalnum((unsigned char)text[start - 1]) || text[start - 1] == '_'))
+        start--;
+    if (start == len || start == 0) return 0;
+
+    snprintf(name, 64, "%s", text + start);
+    text[start] = '\0';
+    len = start;
+    while (len > 0 && isspace((unsigned char)text[len - 1]))
+        text[--len] = '\0';
+    if (len == 0) return 0;
+    snprintf(type, 128, "%s", text);
+    return 1;
+}
+
+// =========================== [ MAIN TRANSFORMATION ] ====================================
+
+void add_rc_structs(FILE *in, FILE *out) {
+    char line[1024];
+    char name[64];
+
+    // Collect every name first so rc structs may point at ones declared later
+    while (fgets(line, sizeof(line), in)) {
+        if (parse_header(line, name, sizeof(name)) && rc_struct_count < MAX_RC_STRUCTS &&
+            !is_rc_struct(name))
+            strcpy(rc_structs[rc_struct_count++], name);
+    }
+    rewind(in);
+
+    int  declared_handles = 0;
+    int  in_struct = 0;
+    char fields[MAX_FIELDS][64];
+    int  field_count = 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        int indent = strspn(line, " \t");
+
+        if (!in_struct && parse_header(line, name, sizeof(name))) {
+            if (!declared_handles) {
+                for (int i = 0; i < rc_struct_count; i++)
+                    fprintf(out, "typedef struct %s *%s;\n", rc_structs[i], rc_structs[i]);
+                declared_handles = 1;
+            }
+            fprintf(out, "%*sstruct %s {\n", indent, "", name);
+            in_struct = 1;
+            field_count = 0;
+            continue;
+        }
+        if (!in_struct) {
+            fputs(line, out);
+            continue;
+        }
+
+        if (line[indent] == '}') {
+            fprintf(out, "%*s};\n", indent, "");
+            if (field_count > 0) {
+                fprintf(out, "%*sstatic const size_t %s__fields[] = {", indent, "", name);
+                for (int i = 0; i < field_count; i++)
+                    fprintf(out, "%soffsetof(struct %s, %s)", i ? ", " : "", name, fields[i]);
+                fprintf(out, "};\n");
+                fprintf(out, "%*sstatic const RcType %s__type = {\"%s\", sizeof(struct %s), %d, %s__fields};\n",
+                        indent, "", name, name, name, field_count, name);
+            } else {
+                fprintf(out, "%*sstatic const RcType %s__type = {\"%s\", sizeof(struct %s), 0, NULL};\n",
+                        indent, "", name, name, name);
+            }
+            in_struct = 0;
+            continue;
+        }
+
+        char type[128], field[64], comment[128];
+        if (!parse_field(line, type, field, comment)) {
+            fputs(line, out);
+            continue;
+        }
+        int traced = strcmp(type, "string") == 0 || is_rc_struct(type);
+        if (strcmp(type, "string") == 0) {
+            fprintf(out, "%*schar *%s;", indent, "", field);
+        } else if (traced) {
+            fprintf(out, "%*sstruct %s *%s;", indent, "", type, field);
+        } else {
+            fprintf(out, "%*s%s %s;", indent, "", type, field);
+        }
+        fprintf(out, "%s%s\n", comment[0] ? " " : "", comment);
+        if (traced && field_count < MAX_FIELDS) strcpy(fields[field_count++], field);
+    }
+}
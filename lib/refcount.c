@@ -5,10 +5,21 @@
 #include <string.h>
 
 // =========================== [ STRUCTS ] =========================================
+typedef enum {
+    VAR_NONE,
+    VAR_STRING, // string: rc_retain/rc_release on the pointer
+    VAR_VIEW,   // strview: holds one reference on its parent string
+    VAR_MAP,    // map: rc_retain, map_release (drops keys and table with the last reference)
+    VAR_OBJECT  // rc struct handle: rc_retain/rc_release; the runtime releases its fields
+} VarKind;
+
+int is_rc_struct(const char *name); // rc_struct.c
+
 typedef struct {
-    char name[256];
-    int  scope_depth;
-    int  is_temporary;
+    char    name[256];
+    int     scope_depth;
+    int     is_temporary;
+    VarKind kind;
 } RefcountedVar;
 
 typedef struct {
@@ -20,20 +31,23 @@ typedef struct {
 
     // For tracking assignments
     char dest_var[256];
-    char src_var[256];
+    char src_var[256]; // Variable or, for an rc struct, field path (`a->next`) assigned
+    int  after_member; // Last token was `->` (1) or `.` (2)
 
     // For tracking string function returns
     char last_string_func[256]; // Last string function called
     int  in_string_func_args;   // Inside string function arguments
 
     // State flags
-    int just_saw_string_type;
-    int in_assignment;
+    VarKind decl_kind; // Kind of the type keyword just seen
+    int     in_assignment;
     int expecting_var_name;
+    int declaring; // The statement declares dest_var
 
     // Output buffering
     char output_buffer[1024];
     int  buffer_pos;
+    int  stmt_start; // Buffer offset of the current statement, -1 once partly flushed
 
     // NEW: For tracking temps in expressions
     char temp_vars[10][256]; // Stack of temporary variables
@@ -52,6 +66,7 @@ static void buffer_char(RefcountState *state, char ch, FILE *out) {
     if (state->buffer_pos >= (int)(sizeof(state->output_buffer) - 1)) {
         fwrite(state->output_buffer, 1, state->buffer_pos, out);
         state->buffer_pos = 0;
+        state->stmt_start = -1;
     }
     state->output_buffer[state->buffer_pos++] = ch;
 }
@@ -61,11 +76,50 @@ static void flush_buffer(RefcountState *state, FILE *out) {
         fwrite(state->output_buffer, 1, state->buffer_pos, out);
         state->buffer_pos = 0;
     }
+    state->stmt_start = 0;
+}
+
+// Replace len bytes at offset pos of the buffered output with text
+static int buffer_replace(RefcountState *state, int pos, int len, const char *text) {
+    int text_len = strlen(text);
+    if (state->buffer_pos - len + text_len >= (int)sizeof(state->output_buffer) - 1) return 0;
+
+    memmove(state->output_buffer + pos + text_len, state->output_buffer + pos + len,
+            state->buffer_pos - pos - len);
+    memcpy(state->output_buffer + pos, text, text_len);
+    state->buffer_pos += text_len - len;
+    return 1;
+}
+
+// Start of the `arena_destroy(...);` and `RELEASE_POOL_END(...);` statements
+// that end the buffered output, where add_arena_support closes a function and
+// add_release_pools a pool scope: the scope's releases go ahead of them, since
+// releasing a value built in an arena reads its header and a pool must still be
+// current to batch what the scope releases
+static int scope_exit_start(RefcountState *state) {
+    char *buf = state->output_buffer;
+    int   start = state->buffer_pos;
+    buf[state->buffer_pos] = '\0';
+
+    for (;;) {
+        int end = start;
+        while (end > 0 && isspace((unsigned char)buf[end - 1]))
+            end--;
+        if (end == 0 || buf[end - 1] != ';') return start;
+        int begin = end - 1;
+        while (begin > 0 && !strchr(";{}", buf[begin - 1]))
+            begin--;
+        const char *statement = buf + begin + strspn(buf + begin, " \t\n");
+        if (strncmp(statement, "arena_destroy(", 14) != 0 &&
+            strncmp(statement, "RELEASE_POOL_END(", 17) != 0)
+            return start;
+        start = begin;
+    }
 }
 
 // =========================== [ VARIABLE MANAGEMENT ] ====================================
 
-static void add_var(RefcountState *state, const char *name, int is_temp) {
+static void add_var(RefcountState *state, const char *name, VarKind kind, int is_temp) {
     // Resize if needed
     if (state->var_count >= state->var_capacity) {
         state->var_capacity *= 2;
@@ -77,9 +131,33 @@ static void add_var(RefcountState *state, const char *name, int is_temp) {
     strncpy(var->name, name, sizeof(var->name) - 1);
     var->scope_depth = state->current_scope_depth;
     var->is_temporary = is_temp;
+    var->kind = kind;
+}
+
+static VarKind refcounted_kind(const char *type) {
+    if (strcmp(type, "string") == 0) return VAR_STRING;
+    if (strcmp(type, "strview") == 0) return VAR_VIEW;
+    if (strcmp(type, "map") == 0) return VAR_MAP;
+    if (is_rc_struct(type)) return VAR_OBJECT;
+    return VAR_NONE;
 }
 
-static int is_refcounted_type(const char *type) { return strcmp(type, "string") == 0; }
+static VarKind var_kind(RefcountState *state, const char *name) {
+    for (int i = state->var_count - 1; i >= 0; i--) {
+        if (strcmp(state->vars[i].name, name) == 0) return state->vars[i].kind;
+    }
+    return VAR_NONE;
+}
+
+static const char *retain_call(VarKind kind) {
+    return kind == VAR_VIEW ? "strview_retain" : "rc_retain";
+}
+
+static const char *release_call(VarKind kind) {
+    if (kind == VAR_VIEW) return "strview_release";
+    if (kind == VAR_MAP) return "map_release";
+    return "rc_release";
+}
 
 static int is_known_var(RefcountState *state, const char *name) {
     for (int i = 0; i < state->var_count; i++) {
@@ -90,9 +168,70 @@ static int is_known_var(RefcountState *state, const char *name) {
     return 0;
 }
 
+// Variable a field path starts from (`a` of `a->next`)
+static void path_base(const char *path, char *base) {
+    size_t len = strcspn(path, "-.");
+    memcpy(base, path, len);
+    base[len] = '\0';
+}
+
+// Locals declared inside a function body own their reference; parameters
+// (tracked at depth 0) are borrowed from the caller
+static int is_owned_var(RefcountState *state, const char *name) {
+    for (int i = state->var_count - 1; i >= 0; i--) {
+        if (strcmp(state->vars[i].name, name) == 0) {
+            return state->vars[i].scope_depth > 0 && !state->vars[i].is_temporary;
+        }
+    }
+    return 0;
+}
+
+static int mentions_identifier(const char *text, const char *name) {
+    size_t len = strlen(name);
+    for (const char *p = strstr(text, name); p; p = strstr(p + 1, name)) {
+        int starts = p == text || !(isalnum((unsigned char)p[-1]) || p[-1] == '_');
+        int ends = !(isalnum((unsigned char)p[len]) || p[len] == '_');
+        if (starts && ends) return 1;
+    }
+    return 0;
+}
+
 static int is_string_function(const char *name) {
     return strcmp(name, "string_create") == 0 || strcmp(name, "string_concat") == 0 ||
-           strcmp(name, "string_substr") == 0;
+           strcmp(name, "string_substr") == 0 || strcmp(name, "strview_to_string") == 0 ||
+           strcmp(name, "string_intern") == 0 || strcmp(name, "arena_string_create") == 0 ||
+           strcmp(name, "arena_string_concat") == 0 || strcmp(name, "arena_string_substr") == 0;
+}
+
+// =========================== [ IN-PLACE FORMS ] ====================================
+
+// Reassigning an owned local drops its old value, so a self-concat may grow the
+// buffer in place and a builder may take the buffer over instead of copying it.
+// The runtime still copies when the string turns out to be shared.
+static void rewrite_inplace_forms(RefcountState *state) {
+    if (state->stmt_start < 0) return;
+    state->output_buffer[state->buffer_pos] = '\0';
+
+    char *stmt = state->output_buffer + state->stmt_start;
+    char  dest[256], src[256];
+    int   consumed = 0;
+
+    if (sscanf(stmt, " %255[A-Za-z0-9_] = string_concat ( %255[A-Za-z0-9_] ,%n", dest, src,
+               &consumed) == 2 &&
+        consumed > 0 && strcmp(dest, src) == 0 && is_owned_var(state, dest) &&
+        !mentions_identifier(stmt + consumed, dest)) {
+        char *call = strstr(stmt, "string_concat");
+        buffer_replace(state, (call - state->output_buffer) + 13, 0, "_inplace");
+        return;
+    }
+
+    consumed = 0;
+    if (sscanf(stmt, " StringBuilder %255[A-Za-z0-9_] = string_builder_from ( %255[A-Za-z0-9_] )%n",
+               dest, src, &consumed) == 2 &&
+        consumed > 0 && is_owned_var(state, src)) {
+        char *call = strstr(stmt, "string_builder_from");
+        buffer_replace(state, call - state->output_buffer, 19, "string_builder_adopt");
+    }
 }
 
 // =========================== [ MAIN TRANSFORMATION ] ====================================
@@ -106,6 +245,7 @@ void add_refcounting(FILE *in, FILE *out) {
     int  in_string = 0, in_char = 0, in_line_comment = 0, in_block_comment = 0;
     char identifier[256];
     int  ident_pos = 0;
+    char last_identifier[256] = "";
 
     // For tracking parentheses in function calls
     int paren_depth = 0;
@@ -131,14 +271,20 @@ void add_refcounting(FILE *in, FILE *out) {
             if (ch == '{') {
                 state.current_scope_depth++;
             } else if (ch == '}') {
-                // Add rc_release() for all variables in this scope
-                flush_buffer(&state, out);
+                // Add rc_release() for all variables in this scope, before
+                // the arena they may live in is destroyed or their pool popped
+                int destroys = scope_exit_start(&state);
+                fwrite(state.output_buffer, 1, destroys, out);
                 for (int i = 0; i < state.var_count; i++) {
                     if (state.vars[i].scope_depth == state.current_scope_depth &&
                         !state.vars[i].is_temporary) {
-                        fprintf(out, "\n    rc_release(%s);", state.vars[i].name);
+                        fprintf(out, "\n    %s(%s);", release_call(state.vars[i].kind),
+                                state.vars[i].name);
                     }
                 }
+                fwrite(state.output_buffer + destroys, 1, state.buffer_pos - destroys, out);
+                state.buffer_pos = 0;
+                state.stmt_start = 0;
 
                 // Remove variables that went out of scope
                 int new_count = 0;
@@ -164,25 +310,39 @@ void add_refcounting(FILE *in, FILE *out) {
                     identifier[ident_pos] = '\0';
 
                     // Track parentheses for function calls
-                    if (ch == '(') {
-                        if (is_string_function(identifier)) {
-                            state.in_string_func_args = 1;
-                            strcpy(state.last_string_func, identifier);
-                        }
-                        paren_depth++;
+                    if (ch == '(' && is_string_function(identifier)) {
+                        state.in_string_func_args = 1;
+                        strcpy(state.last_string_func, identifier);
                     }
 
-                    // CASE 1: "string" type keyword
-                    if (is_refcounted_type(identifier)) {
-                        state.just_saw_string_type = 1;
-                        state.expecting_var_name = 1;
+                    // CASE 0: Field of an rc struct read in an assignment
+                    if (state.after_member && state.in_assignment && state.src_var[0] &&
+                        strlen(state.src_var) + strlen(identifier) < 250) {
+                        char base[256];
+                        path_base(state.src_var, base);
+                        if (var_kind(&state, base) == VAR_OBJECT) {
+                            strcat(state.src_var, state.after_member == 2 ? "." : "->");
+                            strcat(state.src_var, identifier);
+                        }
                     }
-                    // CASE 2: Variable name after "string" type
+                    // CASE 1: "string"/"strview" type keyword. A struct tag
+                    // (`struct Node`) or a type argument (`rc_new(Node)`) is not.
+                    else if (refcounted_kind(identifier) != VAR_NONE) {
+                        if (strcmp(last_identifier, "struct") != 0 && ch != ')') {
+                            state.decl_kind = refcounted_kind(identifier);
+                            state.expecting_var_name = 1;
+                        }
+                    }
+                    // CASE 2: Variable name after the type. Arrays and functions
+                    // returning the type are not tracked.
                     else if (state.expecting_var_name) {
-                        strcpy(state.dest_var, identifier);
-                        add_var(&state, identifier, 0);
+                        if (ch != '[' && ch != '(') {
+                            strcpy(state.dest_var, identifier);
+                            add_var(&state, identifier, state.decl_kind, 0);
+                            state.declaring = 1;
+                        }
                         state.expecting_var_name = 0;
-                        state.just_saw_string_type = 0;
+                        state.decl_kind = VAR_NONE;
                     }
                     // CASE 3: Variable in assignment RHS
                     else if (state.in_assignment && is_known_var(&state, identifier)) {
@@ -193,8 +353,21 @@ void add_refcounting(FILE *in, FILE *out) {
                         strcpy(state.dest_var, identifier);
                     }
 
+                    strcpy(last_identifier, identifier);
                     ident_pos = 0;
                 }
+                if (ch == '>' && prev_ch == '-') {
+                    state.after_member = 1;
+                } else if (ch == '.') {
+                    state.after_member = 2;
+                } else if (ch != '-' && !isspace(ch)) {
+                    state.after_member = 0;
+                }
+
+                // Track every parenthesis so ')' of for/if headers stays balanced
+                if (ch == '(') {
+                    paren_depth++;
+                }
 
                 // Handle parentheses closing
                 if (ch == ')') {
@@ -213,26 +386,60 @@ void add_refcounting(FILE *in, FILE *out) {
                 }
                 // Handle statement end
                 else if (ch == ';') {
+                    rewrite_inplace_forms(&state);
+
                     if (state.in_assignment) {
                         // Check if we need rc_retain
                         int need_retain = 0;
 
                         // Need retain if: dest = src (where src is a refcounted variable)
+                        char src_base[256];
+                        path_base(state.src_var, src_base);
                         if (strlen(state.src_var) > 0) {
-                            if (is_known_var(&state, state.src_var)) {
+                            if (is_known_var(&state, src_base)) {
                                 need_retain = 1;
                             }
                         }
 
-                        if (need_retain) {
+                        // A view variable always takes its own reference on the
+                        // parent, since view-producing functions never retain.
+                        // Reassigning one drops the reference on the old parent,
+                        // once the new view (maybe sliced from it) is retained.
+                        if (var_kind(&state, state.dest_var) == VAR_VIEW) {
+                            int reassigns = !state.declaring;
+                            if (reassigns) {
+                                char previous[300];
+                                snprintf(previous, sizeof(previous),
+                                         "\n    { strview __old_view = %s;", state.dest_var);
+                                if (state.stmt_start < 0 ||
+                                    !buffer_replace(&state, state.stmt_start, 0, previous)) {
+                                    fprintf(stderr, "Error: strview %s reassigned in too long a statement\n",
+                                            state.dest_var);
+                                    reassigns = 0;
+                                }
+                            }
                             buffer_char(&state, ch, out);
                             flush_buffer(&state, out);
-                            fprintf(out, "\n    rc_retain(%s);", state.src_var);
+                            fprintf(out, "\n    strview_retain(%s);", state.dest_var);
+                            if (reassigns) fprintf(out, "\n    strview_release(__old_view); }");
+                            ch = 0;
+                        } else if (need_retain) {
+                            buffer_char(&state, ch, out);
+                            flush_buffer(&state, out);
+                            fprintf(out, "\n    %s(%s);", retain_call(var_kind(&state, src_base)),
+                                    state.src_var);
                             ch = 0;
                         }
                     }
 
+                    // A view declared without a value starts empty, so that
+                    // its release is safe whatever it is assigned later
+                    else if (state.declaring && var_kind(&state, state.dest_var) == VAR_VIEW) {
+                        buffer_replace(&state, state.buffer_pos, 0, " = {0}");
+                    }
+
                     // Reset state
+                    state.declaring = 0;
                     state.in_assignment = 0;
                     state.expecting_var_name = 0;
                     memset(state.dest_var, 0, sizeof(state.dest_var));
@@ -244,6 +451,10 @@ void add_refcounting(FILE *in, FILE *out) {
         // Output the character
         if (ch != 0) {
             buffer_char(&state, ch, out);
+            if (!in_string && !in_char && !in_line_comment && !in_block_comment &&
+                (ch == ';' || ch == '{' || ch == '}')) {
+                state.stmt_start = state.buffer_pos;
+            }
         }
 
         prev_ch = ch;
@@ -0,0 +1,223 @@
+// lib/release_pool.c - Lower `release_pool` blocks and loops onto ReleasePool
+//
+//     release_pool for (...) {         for (...) {
+//         ...                    =>        RELEASE_POOL(__pool0);
+//     }                                    ...
+//                                          RELEASE_POOL_END(__pool0);
+//                                      }
+//
+// `release_pool {` marks a plain block the same way. The pool is pushed at the
+// top of every iteration and drained when the iteration's scope ends, so the
+// objects released in the body, by the calls it makes and by the releases
+// add_refcounting writes before the closing brace, are freed in one batch.
+// add_refcounting puts those releases ahead of RELEASE_POOL_END, which pops the
+// pool where no cleanup attribute does it. For the same reason every break,
+// continue and return that leaves pool scopes becomes
+//
+//     { RELEASE_POOL_EXIT(__pool1); RELEASE_POOL_EXIT(__pool0); return x; }
+//
+// innermost pool first. A goto inside a pool scope is an error, since where it
+// lands is not known here.
+#include "common.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_SCOPES 64
+
+// A braced scope that a break, continue or return can leave
+typedef struct {
+    int depth;     // Brace depth inside it
+    int pool;      // Pool number, or -1
+    int breaks;    // A loop or switch body: break ends it
+    int continues; // A loop body: continue ends it
+} Scope;
+
+// `release_pool {` or `release_pool for/while (...) {`: the keyword is
+// dropped from line and 1 returned
+static int strip_pool_keyword(char *line) {
+    char *text = line + strspn(line, " \t");
+    if (strncmp(text, "release_pool", 12) != 0 || isalnum((unsigned char)text[12]) ||
+        text[12] == '_')
+        return 0;
+
+    size_t len = strlen(text);
+    while (len > 0 && isspace((unsigned char)text[len - 1]))
+        len--;
+    if (len == 0 || text[len - 1] != '{') return 0;
+
+    char *rest = text + 12 + strspn(text + 12, " \t");
+    memmove(text, rest, strlen(rest) + 1);
+    return 1;
+}
+
+// The loop or switch keyword a block header starts with, if any
+static const char *loop_keyword(const char *line) {
+    const char *text = line + strspn(line, " \t");
+    static const char *keywords[] = {"for", "while", "do", "switch"};
+    for (int k = 0; k < 4; k++) {
+        if (match_word(text, keywords[k])) return keywords[k];
+    }
+    return NULL;
+}
+
+// The next break, continue, return or goto at or after p, outside literals and
+// comments; its length goes to len
+static char *find_exit(char *p, int *len) {
+    static const char *words[] = {"break", "continue", "return", "goto"};
+    int in_string = 0, in_char = 0;
+
+    for (char *start = p; *p; p++) {
+        if (*p == '\\' && (in_string || in_char) && p[1]) {
+            p++;
+            continue;
+        }
+        if (*p == '"' && !in_char) in_string = !in_string;
+        if (*p == '\'' && !in_string) in_char = !in_char;
+        if (in_string || in_char) continue;
+        if (*p == '/' && p[1] == '/') break;
+        if (p > start && is_ident_char(p[-1])) continue;
+        for (int w = 0; w < 4; w++) {
+            if (match_word(p, words[w])) {
+                *len = strlen(words[w]);
+                return p;
+            }
+        }
+    }
+    return NULL;
+}
+
+// The ';' ending the statement that starts at p, or NULL past the line's end
+static char *statement_end(char *p) {
+    int nesting = 0, in_string = 0, in_char = 0;
+    for (; *p; p++) {
+        if (*p == '\\' && (in_string || in_char) && p[1]) {
+            p++;
+            continue;
+        }
+        if (*p == '"' && !in_char) in_string = !in_string;
+        if (*p == '\'' && !in_string) in_char = !in_char;
+        if (in_string || in_char) continue;
+        if (*p == '(') nesting++;
+        if (*p == ')') nesting--;
+        if (*p == ';' && nesting == 0) return p;
+    }
+    return NULL;
+}
+
+// Index of the innermost scope the exit word leaves, -1 for none. braceless is
+// set when the line is governed by a loop header with no braces of its own, the
+// scope a break or continue then ends.
+static int exit_target(const Scope *scopes, int count, const char *word, int braceless) {
+    if (strcmp(word, "return") == 0 || strcmp(word, "goto") == 0) return 0;
+    if (braceless) return count;
+    int wants_loop = strcmp(word, "continue") == 0;
+    for (int i = count - 1; i >= 0; i--) {
+        if (wants_loop ? scopes[i].continues : scopes[i].breaks) return i;
+    }
+    return count;
+}
+
+// Wrap each exit in line that leaves pool scopes with the pops they skip
+static void write_exits(char *line, const Scope *scopes, int count, int braceless, int number,
+                        FILE *out) {
+    char *p = line;
+    int   len;
+    char *exit;
+    while ((exit = find_exit(p, &len))) {
+        char word[16];
+        memcpy(word, exit, len);
+        word[len] = '\0';
+
+        int target = exit_target(scopes, count, word, braceless && exit == line + strspn(line, " \t"));
+        int pools = 0;
+        for (int i = target; i < count; i++)
+            pools += scopes[i].pool >= 0;
+        if (pools == 0) {
+            fwrite(p, 1, exit + len - p, out);
+            p = exit + len;
+            continue;
+        }
+        if (strcmp(word, "goto") == 0) {
+            report(number, "goto inside a release_pool block", "");
+            break;
+        }
+        char *end = statement_end(exit);
+        if (!end) {
+            report(number, "a statement leaving a release_pool block must end on its line: ", word);
+            break;
+        }
+
+        fwrite(p, 1, exit - p, out);
+        fputs("{ ", out);
+        for (int i = count - 1; i >= target; i--) {
+            if (scopes[i].pool >= 0) fprintf(out, "RELEASE_POOL_EXIT(__pool%d); ", scopes[i].pool);
+        }
+        fwrite(exit, 1, end + 1 - exit, out);
+        fputs(" }", out);
+        p = end + 1;
+    }
+    fputs(p, out);
+}
+
+// =========================== [ MAIN TRANSFORMATION ] ====================================
+
+int add_release_pools(FILE *in, FILE *out) {
+    char  line[1024];
+    char  header[1024] = ""; // Last line that was not blank or a lone brace
+    int   depth = 0, number = 0;
+    Scope scopes[MAX_SCOPES]; // Open pool, loop and switch scopes, outermost first
+    int   scope_count = 0;
+    int   pool_count = 0;
+    pass_errors = 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        number++;
+        int indent = strspn(line, " \t");
+
+        // The line closing the innermost pool scope drains it first
+        if (scope_count > 0 && line[indent] == '}' && depth == scopes[scope_count - 1].depth &&
+            scopes[scope_count - 1].pool >= 0) {
+            fprintf(out, "%*sRELEASE_POOL_END(__pool%d);\n", indent + 4, "",
+                    scopes[scope_count - 1].pool);
+        }
+
+        // A loop header without braces governs the next line alone
+        size_t      header_len = strlen(header);
+        const char *governing = loop_keyword(header);
+        int braceless = governing && strcmp(governing, "do") != 0 && header_len > 0 &&
+                        !strchr("{;", header[header_len - 1]);
+
+        int opens = strip_pool_keyword(line);
+        int delta = brace_delta(line);
+        if (scope_count > 0) {
+            write_exits(line, scopes, scope_count, braceless, number, out);
+        } else {
+            fputs(line, out);
+        }
+        depth += delta;
+        while (scope_count > 0 && scopes[scope_count - 1].depth > depth)
+            scope_count--;
+
+        // A lone "{" opens the block its header line introduced
+        const char *text = line + indent;
+        const char *keyword = loop_keyword(strcmp(text, "{\n") == 0 ? header : line);
+        if (delta > 0 && (opens || keyword) && scope_count < MAX_SCOPES) {
+            Scope *scope = &scopes[scope_count++];
+            scope->depth = depth;
+            scope->pool = opens ? pool_count++ : -1;
+            scope->breaks = keyword != NULL;
+            scope->continues = keyword && strcmp(keyword, "switch") != 0;
+            if (opens) fprintf(out, "%*sRELEASE_POOL(__pool%d);\n", indent + 4, "", scope->pool);
+        }
+
+        if (text[strspn(text, "{} \t\n")] != '\0') {
+            snprintf(header, sizeof(header), "%s", text);
+            header[strcspn(header, "\n")] = '\0';
+            size_t n = strlen(header);
+            while (n > 0 && isspace((unsigned char)header[n - 1]))
+                header[--n] = '\0';
+        }
+    }
+    return pass_errors;
+}
@@ -1,75 +1,527 @@
 // lib/safety.c - Implementation matching safety.h
 #include "safety.h"
+#include "allocator.h"
+#include "arena.h"
+#include "simd.h"
+#include <ctype.h>
 #include <stdio.h>
 // Core refcounting implementation
+#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)
+#define RC_ADD(field, n) __atomic_fetch_add(&(field), n, __ATOMIC_RELAXED)
+#define RC_LOAD(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define RC_STORE(field, value) __atomic_store_n(&(field), value, __ATOMIC_RELAXED)
+#define RC_FLAGS_SET(header, bits) __atomic_fetch_or(&(header)->flags, bits, __ATOMIC_RELEASE)
+#else
+#define RC_ADD(field, n) ((field) += (n))
+#define RC_LOAD(field) (field)
+#define RC_STORE(field, value) ((field) = (value))
+#define RC_FLAGS_SET(header, bits) ((header)->flags |= (bits))
+#endif
+
+struct RcDeferred {
+    RCHeader *header;
+    void (*destroy)(void *);
+    int elements;
+};
+
+#if defined(__GNUC__) && !defined(__TINYC__)
+static __thread ReleasePool *rc_pool_current;
+#else
+static ReleasePool *rc_pool_current; // Without __thread the pool stack is per process
+#endif
+
+static void rc_finalize(RCHeader *header, void (*destroy)(void *), int elements) {
+    void *ptr = (char *)header + RC_HEADER_SIZE;
+    if (destroy && elements) {
+        void **array = (void **)ptr;
+        for (size_t i = 0; i < header->array_count; i++)
+            destroy(array[i]);
+    } else if (destroy) {
+        destroy(ptr);
+    }
+}
+
+// Drop one weak reference; returns 1 when it was the last one
+static int rc_weak_drop(RCHeader *header) {
+#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)
+    return __atomic_sub_fetch(&header->weak_count, 1, __ATOMIC_ACQ_REL) == 0;
+#else
+    return --header->weak_count == 0;
+#endif
+}
+
+// Queue a dead object on the pool. The pool holds a weak reference until the
+// drain, so a weak release in between cannot free the block under it.
+static int rc_pool_defer(ReleasePool *pool, RCHeader *header, void (*destroy)(void *), int elements) {
+    if (pool->count == pool->capacity) {
+        size_t      capacity = pool->capacity ? pool->capacity * 2 : 64;
+        RcDeferred *items = realloc(pool->items, capacity * sizeof(RcDeferred));
+        if (!items) return 0;
+        pool->items = items;
+        pool->capacity = capacity;
+    }
+    RC_ADD(header->weak_count, 1);
+    pool->items[pool->count++] = (RcDeferred){header, destroy, elements};
+    return 1;
+}
+
+// Run the destructor, then free the block unless weak references remain.
+// Under a release pool both wait for the pool's drain.
+static void rc_destroy(RCHeader *header, void (*destroy)(void *), int elements) {
+    ReleasePool *pool = rc_pool_current;
+    if (pool && rc_pool_defer(pool, header, destroy, elements)) return;
+    rc_finalize(header, destroy, elements);
+    if (RC_LOAD(header->weak_count) == 0) free(header);
+}
+
+#ifdef SAM_RC_BIASED
+#define RC_SHARED_COUNT(word) ((word) >> 3) // Arithmetic shift keeps negative counts
+
+typedef struct RcOwner {
+    RCHeader *queue; // Objects whose shared count went negative, pushed by other threads
+} RcOwner;
+
+static __thread RcOwner rc_self;
+
+// The shared count went negative, so only the owner's count can tell when the
+// object dies: hand it to the owner, which merges the two counts
+static void rc_queue_for_owner(RCHeader *header, void (*destroy)(void *), int elements) {
+    intptr_t bits = RC_SHARED_QUEUED | (elements ? RC_SHARED_ELEMENTS : 0);
+    header->destroy = destroy;
+    intptr_t old = __atomic_fetch_or(&header->shared, bits, __ATOMIC_ACQ_REL);
+    if (old & (RC_SHARED_QUEUED | RC_SHARED_MERGED)) return;
+
+    RcOwner  *owner = __atomic_load_n(&header->owner, __ATOMIC_RELAXED);
+    RCHeader *head = __atomic_load_n(&owner->queue, __ATOMIC_RELAXED);
+    do {
+        header->queue_next = head;
+    } while (!__atomic_compare_exchange_n(&owner->queue, &head, header, 1, __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+}
+
+void rc_biased_flush(void) {
+    RCHeader *header = __atomic_exchange_n(&rc_self.queue, NULL, __ATOMIC_ACQUIRE);
+    while (header) {
+        RCHeader *next = header->queue_next;
+        intptr_t  owned = (intptr_t)header->refcount;
+        header->refcount = 0;
+        __atomic_store_n(&header->owner, NULL, __ATOMIC_RELAXED);
+        intptr_t now = __atomic_add_fetch(&header->shared, owned * RC_SHARED_ONE + RC_SHARED_MERGED,
+                                          __ATOMIC_ACQ_REL);
+        if (RC_SHARED_COUNT(now) == 0)
+            rc_destroy(header, header->destroy, (now & RC_SHARED_ELEMENTS) != 0);
+        header = next;
+    }
+}
+#endif
+
+void rc_init_header(RCHeader *header, size_t refcount) {
+    header->refcount = refcount;
+    header->weak_count = 0;
+    header->array_count = 0;
+    header->flags = 0;
+    header->hash = 0;
+#ifdef SAM_RC_BIASED
+    // Immortal objects have no owner: any thread may hold them
+    int owned = refcount < RC_IMMORTAL;
+    header->owner = owned ? &rc_self : NULL;
+    header->refcount = owned ? refcount : 0;
+    header->shared = owned ? 0 : (intptr_t)refcount * RC_SHARED_ONE + RC_SHARED_MERGED;
+    header->queue_next = NULL;
+    header->destroy = NULL;
+#endif
+#ifdef SAM_RC_CYCLES
+    header->type = NULL;
+    header->root_index = 0;
+#endif
+}
+
 void *rc_alloc(size_t size) {
+#ifdef SAM_ALLOC_ARENA
+    // Region objects are immortal: retain and release only touch the count
+    RCHeader *header = allocator_region_alloc(RC_HEADER_SIZE + size);
+    if (!header) return NULL;
+    memset(header, 0, RC_HEADER_SIZE + size);
+    rc_init_header(header, RC_IMMORTAL);
+#else
     RCHeader *header = (RCHeader *)calloc(1, RC_HEADER_SIZE + size);
-    if (header) {
-        header->refcount = 1;
-        header->weak_count = 0;
-        header->array_count = 0;
-    }
-    return header ? (char *)header + RC_HEADER_SIZE : NULL;
+    if (!header) return NULL;
+    rc_init_header(header, 1);
+#endif
+    return (char *)header + RC_HEADER_SIZE;
 }
 
 void *rc_alloc_array(size_t elem_size, size_t count) {
-    RCHeader *header = (RCHeader *)calloc(1, RC_HEADER_SIZE + (elem_size * count));
-    if (header) {
-        header->refcount = 1;
-        header->weak_count = 0;
-        header->array_count = count;
-        memset((char *)header + RC_HEADER_SIZE, 0, elem_size * count);
-    }
-    return header ? (char *)header + RC_HEADER_SIZE : NULL;
+    char *ptr = rc_alloc(elem_size * count);
+    if (ptr) RC_GET_HEADER(ptr)->array_count = count;
+    return ptr;
 }
 
 void rc_retain(void *ptr) {
-    if (ptr) {
-        RCHeader *header = RC_GET_HEADER(ptr);
+    if (!ptr) return;
+    RCHeader *header = RC_GET_HEADER(ptr);
+#ifdef SAM_RC_BIASED
+    if (__atomic_load_n(&header->owner, __ATOMIC_RELAXED) == &rc_self) {
         header->refcount++;
+    } else {
+        __atomic_fetch_add(&header->shared, RC_SHARED_ONE, __ATOMIC_RELAXED);
     }
+#else
+    RC_ADD(header->refcount, 1);
+#endif
 }
 
-void rc_release(void *ptr) {
-    if (!ptr) return;
+// Drop one strong reference; returns 1 when it was the last one
+static int rc_drop(RCHeader *header, void (*destroy)(void *), int elements) {
+#if defined(SAM_RC_BIASED)
+    // Merge first: the flush may hand this very object over to the shared count
+    if (__atomic_load_n(&rc_self.queue, __ATOMIC_RELAXED)) rc_biased_flush();
+    if (__atomic_load_n(&header->owner, __ATOMIC_RELAXED) == &rc_self) {
+        if (--header->refcount > 0) return 0;
+        // The owner is done: from now on the shared count is the whole count
+        __atomic_store_n(&header->owner, NULL, __ATOMIC_RELAXED);
+        intptr_t old = __atomic_fetch_or(&header->shared, RC_SHARED_MERGED, __ATOMIC_ACQ_REL);
+        return RC_SHARED_COUNT(old) == 0;
+    }
+    intptr_t now = __atomic_sub_fetch(&header->shared, RC_SHARED_ONE, __ATOMIC_ACQ_REL);
+    if (now & RC_SHARED_MERGED) return RC_SHARED_COUNT(now) == 0;
+    if (RC_SHARED_COUNT(now) < 0 && !(now & RC_SHARED_QUEUED))
+        rc_queue_for_owner(header, destroy, elements);
+    return 0;
+#elif defined(SAM_RC_ATOMIC)
+    (void)destroy, (void)elements;
+    if (__atomic_fetch_sub(&header->refcount, 1, __ATOMIC_RELEASE) != 1) return 0;
+    // Acquire the release sequence so every other thread's writes happen before the free
+    (void)__atomic_load_n(&header->refcount, __ATOMIC_ACQUIRE);
+    return 1;
+#else
+    (void)destroy, (void)elements;
+    return --header->refcount == 0;
+#endif
+}
+
+// Strong count already at zero (only weak references left)
+static int rc_is_dead(RCHeader *header) {
+#ifdef SAM_RC_BIASED
+    intptr_t shared = __atomic_load_n(&header->shared, __ATOMIC_ACQUIRE);
+    return (shared & RC_SHARED_MERGED) && RC_SHARED_COUNT(shared) == 0;
+#else
+    return RC_LOAD(header->refcount) == 0;
+#endif
+}
+
+// Cycle collector implementation
+#ifdef SAM_RC_CYCLES
+#define RC_COLOR_MASK (3u << 5)
+#define RC_BLACK 0u         // In use, or not being examined
+#define RC_GRAY (1u << 5)   // Traced: the references from inside the subgraph are subtracted
+#define RC_WHITE (2u << 5)  // Garbage unless something black reaches it
+#define RC_PURPLE (3u << 5) // Possible root of a garbage cycle
+
+typedef struct {
+    RCHeader **items;
+    size_t     count, capacity;
+} RcHeaderStack;
+
+static RcHeaderStack rc_roots;
+static RcHeaderStack rc_dying; // Typed objects whose fields are still to be released
+static int           rc_collecting, rc_releasing;
+
+static uint32_t rc_color(RCHeader *header) { return header->flags & RC_COLOR_MASK; }
+
+static void rc_paint(RCHeader *header, uint32_t color) {
+    header->flags = (header->flags & ~RC_COLOR_MASK) | color;
+}
+
+// The traversals cannot stop halfway without corrupting counts, so running
+// out of memory for their stacks is fatal
+static void rc_stack_push(RcHeaderStack *stack, RCHeader *header) {
+    if (stack->count == stack->capacity) {
+        size_t     capacity = stack->capacity ? stack->capacity * 2 : 256;
+        RCHeader **items = realloc(stack->items, capacity * sizeof(RCHeader *));
+        if (!items) {
+            fprintf(stderr, "rc: out of memory tracing objects\n");
+            abort();
+        }
+        stack->items = items;
+        stack->capacity = capacity;
+    }
+    stack->items[stack->count++] = header;
+}
+
+static size_t rc_field_count(RCHeader *header) {
+    return header->type ? header->type->field_count : 0;
+}
+
+static RCHeader *rc_field(RCHeader *header, size_t i) {
+    void *child = *(void **)((char *)header + RC_HEADER_SIZE + header->type->fields[i]);
+    return child ? RC_GET_HEADER(child) : NULL;
+}
+
+static void rc_unbuffer(RCHeader *header) {
+    size_t    slot = header->root_index - 1;
+    RCHeader *last = rc_roots.items[--rc_roots.count];
+    rc_roots.items[slot] = last;
+    last->root_index = slot + 1;
+    header->root_index = 0;
+}
+
+static void rc_release_fields(void *ptr) {
     RCHeader *header = RC_GET_HEADER(ptr);
+    for (size_t i = 0; i < header->type->field_count; i++)
+        rc_release(*(void **)((char *)ptr + header->type->fields[i]));
+}
 
-    if (--header->refcount == 0 && header->weak_count == 0) {
-        free(header);
+static void rc_release_typed(RCHeader *header) {
+    if (--header->refcount == 0) {
+        // Deaths are queued so a long chain is torn down in a loop, not by recursion
+        rc_paint(header, RC_BLACK);
+        if (header->root_index) rc_unbuffer(header);
+        rc_stack_push(&rc_dying, header);
+        if (rc_releasing) return;
+        rc_releasing = 1;
+        while (rc_dying.count > 0)
+            rc_destroy(rc_dying.items[--rc_dying.count], rc_release_fields, 0);
+        rc_releasing = 0;
+        return;
+    }
+    if (rc_color(header) == RC_PURPLE || header->type->field_count == 0) return;
+    rc_paint(header, RC_PURPLE);
+    if (!header->root_index) {
+        rc_stack_push(&rc_roots, header);
+        header->root_index = rc_roots.count;
     }
+    if (rc_roots.count >= RC_CYCLE_THRESHOLD && !rc_collecting) rc_collect_step(RC_CYCLE_BUDGET);
 }
 
-void rc_weak_retain(void *ptr) {
-    if (ptr) {
-        RCHeader *header = RC_GET_HEADER(ptr);
-        header->weak_count++;
+// Paint everything root reaches gray, taking one count off each object per
+// edge that points at it; returns the number of objects traced
+static size_t rc_mark_gray(RCHeader *root, RcHeaderStack *work) {
+    size_t traced = 0;
+    rc_paint(root, RC_GRAY);
+    rc_stack_push(work, root);
+    while (work->count) {
+        RCHeader *header = work->items[--work->count];
+        traced++;
+        for (size_t i = 0; i < rc_field_count(header); i++) {
+            RCHeader *child = rc_field(header, i);
+            if (!child) continue;
+            child->refcount--;
+            if (rc_color(child) != RC_GRAY) {
+                rc_paint(child, RC_GRAY);
+                rc_stack_push(work, child);
+            }
+        }
     }
+    return traced;
 }
 
-void rc_weak_release(void *ptr) {
+// Referenced from outside the subgraph: give back the counts it and everything
+// it reaches lost in rc_mark_gray
+static void rc_scan_black(RCHeader *root, RcHeaderStack *work) {
+    rc_paint(root, RC_BLACK);
+    rc_stack_push(work, root);
+    while (work->count) {
+        RCHeader *header = work->items[--work->count];
+        for (size_t i = 0; i < rc_field_count(header); i++) {
+            RCHeader *child = rc_field(header, i);
+            if (!child) continue;
+            child->refcount++;
+            if (rc_color(child) != RC_BLACK) {
+                rc_paint(child, RC_BLACK);
+                rc_stack_push(work, child);
+            }
+        }
+    }
+}
+
+static void rc_scan(RCHeader *root, RcHeaderStack *work, RcHeaderStack *black) {
+    rc_stack_push(work, root);
+    while (work->count) {
+        RCHeader *header = work->items[--work->count];
+        if (rc_color(header) != RC_GRAY) continue;
+        if (header->refcount > 0) {
+            rc_scan_black(header, black);
+            continue;
+        }
+        rc_paint(header, RC_WHITE);
+        for (size_t i = 0; i < rc_field_count(header); i++) {
+            RCHeader *child = rc_field(header, i);
+            if (child) rc_stack_push(work, child);
+        }
+    }
+}
+
+// White objects only reference each other or objects whose counts already
+// exclude them, so they are freed without releasing their fields. One that
+// is still buffered as a root for a later step leaves the buffer now.
+static void rc_collect_white(RCHeader *root, RcHeaderStack *work, RcHeaderStack *garbage) {
+    if (rc_color(root) != RC_WHITE) return;
+    rc_paint(root, RC_BLACK);
+    rc_stack_push(work, root);
+    while (work->count) {
+        RCHeader *header = work->items[--work->count];
+        if (header->root_index) rc_unbuffer(header);
+        rc_stack_push(garbage, header);
+        for (size_t i = 0; i < rc_field_count(header); i++) {
+            RCHeader *child = rc_field(header, i);
+            if (child && rc_color(child) == RC_WHITE) {
+                rc_paint(child, RC_BLACK);
+                rc_stack_push(work, child);
+            }
+        }
+    }
+}
+
+void *rc_alloc_typed(const RcType *type) {
+    char *ptr = rc_alloc(type->size);
+    if (ptr) RC_GET_HEADER(ptr)->type = type;
+    return ptr;
+}
+
+size_t rc_collect_step(size_t budget) {
+    if (rc_collecting) return 0;
+    rc_collecting = 1;
+
+    RcHeaderStack roots = {0}, work = {0}, black = {0}, garbage = {0};
+    size_t        traced = 0;
+    while (rc_roots.count > 0 && traced < budget) {
+        RCHeader *root = rc_roots.items[rc_roots.count - 1];
+        rc_unbuffer(root);
+        // Roots a previous one reached this step were traced with it
+        if (rc_color(root) != RC_PURPLE) continue;
+        rc_stack_push(&roots, root);
+        traced += rc_mark_gray(root, &work);
+    }
+    for (size_t i = 0; i < roots.count; i++)
+        rc_scan(roots.items[i], &work, &black);
+    for (size_t i = 0; i < roots.count; i++)
+        rc_collect_white(roots.items[i], &work, &garbage);
+
+    for (size_t i = 0; i < garbage.count; i++) {
+        if (garbage.items[i]->weak_count == 0) free(garbage.items[i]);
+    }
+    size_t freed = garbage.count;
+    free(roots.items);
+    free(work.items);
+    free(black.items);
+    free(garbage.items);
+    rc_collecting = 0;
+    return freed;
+}
+
+size_t rc_collect_cycles(void) {
+    size_t freed = 0;
+    while (rc_roots.count > 0)
+        freed += rc_collect_step((size_t)-1);
+    return freed;
+}
+
+size_t rc_cycle_roots(void) { return rc_roots.count; }
+#endif
+
+void rc_release_with(void *ptr, void (*destroy)(void *)) {
     if (!ptr) return;
     RCHeader *header = RC_GET_HEADER(ptr);
-    if (--header->weak_count == 0) {
-        if (header->refcount == 0) {
-            free(header);
-        }
+#ifdef SAM_RC_CYCLES
+    if (header->type) {
+        rc_release_typed(header);
+        return;
     }
+#endif
+    if (rc_drop(header, destroy, 0)) rc_destroy(header, destroy, 0);
 }
 
+void rc_release(void *ptr) { rc_release_with(ptr, NULL); }
+
 void rc_release_array(void *ptr, void (*destructor)(void *)) {
     if (!ptr) return;
     RCHeader *header = RC_GET_HEADER(ptr);
-    if (--header->refcount == 0) {
-        if (destructor) {
-            void **array = (void **)ptr;
-            for (size_t i = 0; i < header->array_count; i++) {
-                destructor(array[i]);
-            }
+    if (rc_drop(header, destructor, 1)) rc_destroy(header, destructor, 1);
+}
+
+int rc_is_unique(void *ptr) {
+    RCHeader *header = RC_GET_HEADER(ptr);
+    if (RC_LOAD(header->weak_count) != 0) return 0;
+#ifdef SAM_RC_BIASED
+    intptr_t shared = __atomic_load_n(&header->shared, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&header->owner, __ATOMIC_RELAXED) == &rc_self)
+        return (intptr_t)header->refcount + RC_SHARED_COUNT(shared) == 1;
+    return (shared & RC_SHARED_MERGED) && RC_SHARED_COUNT(shared) == 1;
+#else
+    return RC_LOAD(header->refcount) == 1;
+#endif
+}
+
+void rc_weak_retain(void *ptr) {
+    if (ptr) RC_ADD(RC_GET_HEADER(ptr)->weak_count, 1);
+}
+
+void rc_weak_release(void *ptr) {
+    if (!ptr) return;
+    RCHeader *header = RC_GET_HEADER(ptr);
+    if (rc_weak_drop(header) && rc_is_dead(header)) free(header);
+}
+
+// Release pool implementation
+void rc_pool_push(ReleasePool *pool) {
+    pool->outer = rc_pool_current;
+    rc_pool_current = pool;
+}
+
+void rc_pool_pop(ReleasePool *pool) {
+    rc_pool_drain(pool);
+    free(pool->items);
+    pool->items = NULL;
+    pool->capacity = 0;
+    if (rc_pool_current == pool) rc_pool_current = pool->outer;
+}
+
+// Run the queued destructors while the pool is still current, so what they
+// release joins the same drain. Dead blocks go to batch, or straight to free()
+// when there is none.
+static void rc_pool_finalize(ReleasePool *pool, ReleaseBatch *batch) {
+    size_t capacity = 0;
+    for (size_t i = 0; i < pool->count; i++) {
+        RcDeferred item = pool->items[i];
+        rc_finalize(item.header, item.destroy, item.elements);
+        if (!rc_weak_drop(item.header)) continue; // A weak reference frees it later
+        if (batch && batch->count == capacity) {
+            capacity = capacity ? capacity * 2 : pool->count;
+            void **blocks = realloc(batch->blocks, capacity * sizeof(void *));
+            if (blocks) batch->blocks = blocks;
         }
-        if (header->weak_count == 0) {
-            free(header);
+        if (batch && batch->count < capacity) {
+            batch->blocks[batch->count++] = item.header;
+        } else {
+            free(item.header);
         }
     }
+    pool->count = 0;
+}
+
+ReleaseBatch rc_pool_collect(ReleasePool *pool) {
+    ReleaseBatch batch = {NULL, 0};
+    rc_pool_finalize(pool, &batch);
+    return batch;
+}
+
+void rc_batch_free(ReleaseBatch *batch) {
+    for (size_t i = 0; i < batch->count; i++)
+        free(batch->blocks[i]);
+    free(batch->blocks);
+    batch->blocks = NULL;
+    batch->count = 0;
+}
+
+void rc_pool_drain(ReleasePool *pool) {
+    if (!pool->free_blocks) {
+        rc_pool_finalize(pool, NULL);
+        return;
+    }
+    ReleaseBatch batch = rc_pool_collect(pool);
+    if (batch.count) pool->free_blocks(batch.blocks, batch.count);
+    free(batch.blocks);
 }
 
 // String implementation
@@ -111,3 +563,843 @@ string string_substr(string s, size_t start, size_t len) {
 
 size_t string_length(string s) { return s ? strlen(s) : 0; }
 void   string_free(string s) { rc_release(s); }
+
+// Uniqueness-aware string operations
+int string_is_unique(string s) { return s && rc_is_unique(s); }
+
+string string_concat_inplace(string a, const char *b) {
+    if (!a) return NULL;
+    if (!b) return a;
+
+    size_t len_a = strlen(a);
+    size_t len_b = strlen(b);
+
+    // b may point into a, in which case growing a would invalidate it
+    int aliases = b >= a && b <= a + len_a;
+    if (!string_is_unique(a) || aliases) {
+        string result = string_concat(a, (string)b);
+        if (!result) return a; // Out of memory: a is still the caller's
+        rc_release(a);
+        return result;
+    }
+
+    // Sole owner: let realloc use the size-class slack behind the buffer
+    RCHeader *header = realloc(RC_GET_HEADER(a), RC_HEADER_SIZE + len_a + len_b + 1);
+    if (!header) return a; // Out of memory: realloc left a as it was
+    header->flags &= ~RC_FLAG_DERIVED;
+    char *result = (char *)header + RC_HEADER_SIZE;
+    memcpy(result + len_a, b, len_b + 1);
+    return result;
+}
+
+void string_make_unique(string *s) {
+    if (!s || !*s || string_is_unique(*s)) return;
+    string copy = string_create(*s);
+    rc_release(*s);
+    *s = copy;
+}
+
+void string_set_char(string *s, size_t index, char ch) {
+    if (!s || !*s || index >= strlen(*s)) return;
+    string_make_unique(s);
+    string_invalidate(*s);
+    if (*s) (*s)[index] = ch;
+}
+
+void string_truncate(string *s, size_t len) {
+    if (!s || !*s || len >= strlen(*s)) return;
+    string_make_unique(s);
+    string_invalidate(*s);
+    if (*s) (*s)[len] = '\0';
+}
+
+void string_to_upper(string *s) {
+    if (!s || !*s) return;
+    string_make_unique(s);
+    string_invalidate(*s);
+    for (char *p = *s; p && *p; p++)
+        *p = toupper((unsigned char)*p);
+}
+
+void string_to_lower(string *s) {
+    if (!s || !*s) return;
+    string_make_unique(s);
+    string_invalidate(*s);
+    for (char *p = *s; p && *p; p++)
+        *p = tolower((unsigned char)*p);
+}
+
+// String view implementation
+strview strview_from(const char *s) {
+    strview v = {s, s ? strlen(s) : 0, NULL};
+    return v;
+}
+
+strview string_view(string s) {
+    strview v = {s, s ? strlen(s) : 0, s};
+    return v;
+}
+
+strview strview_slice(strview v, size_t start, size_t len) {
+    if (start > v.len) start = v.len;
+    if (len > v.len - start) len = v.len - start;
+    strview result = {v.ptr + start, len, v.parent};
+    return result;
+}
+
+strview string_slice(string s, size_t start, size_t len) {
+    return strview_slice(string_view(s), start, len);
+}
+
+strview strview_find(strview v, const char *needle) {
+    strview none = {NULL, 0, v.parent};
+    if (!v.ptr || !needle) return none;
+
+    size_t      needle_len = strlen(needle);
+    const char *hit = simd_kernels()->find(v.ptr, v.len, needle, needle_len);
+    if (!hit) return none;
+
+    strview match = {hit, needle_len, v.parent};
+    return match;
+}
+
+strview string_find(string s, const char *needle) { return strview_find(string_view(s), needle); }
+
+strview strview_trim(strview v) {
+    while (v.len > 0 && isspace((unsigned char)v.ptr[0])) {
+        v.ptr++;
+        v.len--;
+    }
+    while (v.len > 0 && isspace((unsigned char)v.ptr[v.len - 1]))
+        v.len--;
+    return v;
+}
+
+strview string_trim(string s) { return strview_trim(string_view(s)); }
+
+// Pop the next sep-delimited field off the front of *rest. *field holds a
+// reference like any strview variable: the new parent is retained and the
+// one it held before released.
+int strview_split_next(strview *rest, char sep, strview *field) {
+    if (!rest->ptr) return 0;
+
+    const char *hit = memchr(rest->ptr, sep, rest->len);
+    size_t      field_len = hit ? (size_t)(hit - rest->ptr) : rest->len;
+    strview     taken = {rest->ptr, field_len, rest->parent};
+    strview_retain(taken);
+    strview_release(*field);
+    *field = taken;
+
+    if (hit) {
+        rest->ptr = hit + 1;
+        rest->len -= field_len + 1;
+    } else {
+        rest->ptr = NULL;
+        rest->len = 0;
+    }
+    return 1;
+}
+
+size_t string_split(string s, char sep, strview *out, size_t max) {
+    strview rest = string_view(s);
+    strview field = {0};
+    size_t  count = 0;
+    while (count < max && strview_split_next(&rest, sep, &field)) {
+        out[count++] = field;
+    }
+    strview_release(field);
+    return count;
+}
+
+int strview_eq(strview v, const char *s) {
+    size_t len = s ? strlen(s) : 0;
+    return v.len == len && (len == 0 || simd_kernels()->eq(v.ptr, s, len));
+}
+
+// Explicit promotion to an owned string
+string strview_to_string(strview v) {
+    char *result = rc_alloc(v.len + 1);
+    if (result && v.len) memcpy(result, v.ptr, v.len);
+    return result;
+}
+
+// Search, comparison and hashing
+strview string_find_char(string s, char ch) {
+    strview     none = {NULL, 0, s};
+    const char *hit = s ? simd_kernels()->find_char(s, strlen(s), ch) : NULL;
+    if (!hit) return none;
+
+    strview match = {hit, 1, s};
+    return match;
+}
+
+int string_eq(string a, string b) {
+    if (a == b) return 1;
+    if (!a || !b) return 0;
+    if (RC_GET_HEADER(a)->flags & RC_GET_HEADER(b)->flags & RC_FLAG_INTERNED) return 0;
+
+    size_t len = strlen(a);
+    return len == strlen(b) && simd_kernels()->eq(a, b, len);
+}
+
+int string_cmp(string a, string b) {
+    if (a == b) return 0;
+    if (!a || !b) return a ? 1 : -1;
+
+    // Comparing the shorter terminator too gives strcmp ordering
+    size_t len_a = strlen(a);
+    size_t len_b = strlen(b);
+    return simd_kernels()->cmp(a, b, (len_a < len_b ? len_a : len_b) + 1);
+}
+
+// Non-overlapping occurrences of needle in s
+size_t string_count(string s, const char *needle) {
+    if (!s || !needle || !needle[0]) return 0;
+
+    const SimdKernels *kernels = simd_kernels();
+    size_t             len = strlen(s);
+    size_t             needle_len = strlen(needle);
+    if (needle_len == 1) return kernels->count_char(s, len, needle[0]);
+
+    size_t      count = 0;
+    const char *end = s + len;
+    for (const char *p = s; (p = kernels->find(p, end - p, needle, needle_len)); p += needle_len)
+        count++;
+    return count;
+}
+
+uint64_t string_hash(string s) { return s ? simd_kernels()->hash(s, strlen(s)) : 0; }
+
+uint32_t string_hash32_bytes(const char *s, size_t len) {
+    uint64_t hash = simd_kernels()->hash(s, len);
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+uint32_t string_hash32(string s) {
+    if (!s) return 0;
+    RCHeader *header = RC_GET_HEADER(s);
+    if (RC_LOAD(header->flags) & RC_FLAG_HASHED) return RC_LOAD(header->hash);
+    uint32_t hash = string_hash32_bytes(s, strlen(s));
+    RC_STORE(header->hash, hash);
+    RC_FLAGS_SET(header, RC_FLAG_HASHED);
+    return hash;
+}
+
+// UTF-8 implementation
+void string_invalidate(string s) {
+    if (s) RC_GET_HEADER(s)->flags &= ~RC_FLAG_DERIVED;
+}
+
+static uint32_t utf8_flags(string s) {
+    RCHeader *header = RC_GET_HEADER(s);
+    if (!(RC_LOAD(header->flags) & RC_FLAG_UTF8_CHECKED)) {
+        int verdict = simd_kernels()->utf8_validate(s, strlen(s));
+        uint32_t flags = RC_FLAG_UTF8_CHECKED;
+        if (verdict != SIMD_UTF8_INVALID) flags |= RC_FLAG_UTF8_VALID;
+        if (verdict == SIMD_UTF8_ASCII) flags |= RC_FLAG_ASCII;
+        RC_FLAGS_SET(header, flags);
+    }
+    return RC_LOAD(header->flags);
+}
+
+int string_utf8_valid(string s) { return s && (utf8_flags(s) & RC_FLAG_UTF8_VALID); }
+
+size_t string_utf8_len(string s) {
+    if (!s) return 0;
+    if (utf8_flags(s) & RC_FLAG_ASCII) return strlen(s);
+    return simd_kernels()->utf8_count(s, strlen(s));
+}
+
+// Byte offset of the cps-th code point of p[0..len), or len if there are fewer
+static size_t utf8_advance(const char *p, size_t len, size_t cps) {
+    const SimdKernels *kernels = simd_kernels();
+    size_t             off = 0;
+
+    // Skip whole blocks with the counting kernel, then walk to the lead byte
+    while (len - off > 64) {
+        size_t leads = kernels->utf8_count(p + off, 64);
+        if (leads > cps) break;
+        cps -= leads;
+        off += 64;
+    }
+    for (; off < len; off++) {
+        if (((unsigned char)p[off] & 0xC0) == 0x80) continue;
+        if (cps-- == 0) return off;
+    }
+    return len;
+}
+
+size_t string_utf8_offset(string s, size_t cp_index) {
+    if (!s) return 0;
+    size_t len = strlen(s);
+    if (utf8_flags(s) & RC_FLAG_ASCII) return cp_index < len ? cp_index : len;
+    return utf8_advance(s, len, cp_index);
+}
+
+strview string_utf8_slice(string s, size_t cp_start, size_t cp_len) {
+    if (!s) return string_view(s);
+    size_t len = strlen(s);
+    if (utf8_flags(s) & RC_FLAG_ASCII) return string_slice(s, cp_start, cp_len);
+
+    size_t  start = utf8_advance(s, len, cp_start);
+    size_t  end = start + utf8_advance(s + start, len - start, cp_len);
+    strview slice = {s + start, end - start, s};
+    return slice;
+}
+
+// Interning implementation
+#define INTERN_SHARDS 64
+
+typedef struct {
+    int     lock;
+    string *slots; // Open addressing, linear probing; NULL marks an empty slot
+    size_t  capacity;
+    size_t  count;
+} InternShard;
+
+static InternShard intern_shards[INTERN_SHARDS];
+
+// A spin lock per shard; without the __atomic builtins (tcc), one mutex
+// guards every shard
+#if !defined(__GNUC__) || defined(__TINYC__)
+#include <pthread.h>
+static pthread_mutex_t intern_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void intern_lock(InternShard *shard) {
+#if defined(__GNUC__) && !defined(__TINYC__)
+    while (__atomic_exchange_n(&shard->lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&shard->lock, __ATOMIC_RELAXED))
+            ;
+    }
+#else
+    (void)shard;
+    pthread_mutex_lock(&intern_mutex);
+#endif
+}
+
+static void intern_unlock(InternShard *shard) {
+#if defined(__GNUC__) && !defined(__TINYC__)
+    __atomic_store_n(&shard->lock, 0, __ATOMIC_RELEASE);
+#else
+    (void)shard;
+    pthread_mutex_unlock(&intern_mutex);
+#endif
+}
+
+// Slot holding s, or the empty slot where it belongs
+static string *intern_slot(InternShard *shard, const char *s, size_t len, uint32_t hash) {
+    size_t mask = shard->capacity - 1;
+    for (size_t i = (hash / INTERN_SHARDS) & mask;; i = (i + 1) & mask) {
+        string stored = shard->slots[i];
+        if (!stored) return &shard->slots[i];
+        if (RC_GET_HEADER(stored)->hash == hash && strncmp(stored, s, len) == 0 &&
+            stored[len] == '\0')
+            return &shard->slots[i];
+    }
+}
+
+static int intern_grow(InternShard *shard) {
+    size_t  capacity = shard->capacity ? shard->capacity * 2 : 64;
+    string *slots = calloc(capacity, sizeof(string));
+    if (!slots) return 0;
+
+    string *old_slots = shard->slots;
+    size_t  old_capacity = shard->capacity;
+    shard->slots = slots;
+    shard->capacity = capacity;
+    for (size_t i = 0; i < old_capacity; i++) {
+        string s = old_slots[i];
+        if (s) *intern_slot(shard, s, strlen(s), RC_GET_HEADER(s)->hash) = s;
+    }
+    free(old_slots);
+    return 1;
+}
+
+string string_intern(const char *s) {
+    if (!s) return NULL;
+    size_t       len = strlen(s);
+    uint32_t     hash = string_hash32_bytes(s, len);
+    InternShard *shard = &intern_shards[hash % INTERN_SHARDS];
+
+    intern_lock(shard);
+    string *slot = shard->capacity ? intern_slot(shard, s, len, hash) : NULL;
+    if (!slot || !*slot) {
+        if (shard->count * 4 >= shard->capacity * 3) {
+            if (!intern_grow(shard)) {
+                intern_unlock(shard);
+                return NULL;
+            }
+        }
+        slot = intern_slot(shard, s, len, hash);
+
+        string canonical = rc_alloc(len + 1);
+        if (canonical) {
+            memcpy(canonical, s, len + 1);
+            RCHeader *header = RC_GET_HEADER(canonical);
+            rc_init_header(header, RC_IMMORTAL);
+            header->hash = hash;
+            header->flags = RC_FLAG_HASHED | RC_FLAG_INTERNED;
+            *slot = canonical;
+            shard->count++;
+        }
+    }
+    string result = *slot;
+    intern_unlock(shard);
+    return result;
+}
+
+int string_is_interned(string s) { return s && (RC_GET_HEADER(s)->flags & RC_FLAG_INTERNED); }
+
+// Frame string implementation
+#define FRAME_CHUNK_MIN 1024
+
+// Room for a header and len + 1 bytes, stamped immortal
+static string frame_alloc(StringFrame *frame, size_t len) {
+    size_t size = (RC_HEADER_SIZE + len + 1 + 7) & ~(size_t)7;
+    if (frame->offset + size > frame->capacity) {
+        size_t capacity = frame->capacity * 2 > FRAME_CHUNK_MIN ? frame->capacity * 2 : FRAME_CHUNK_MIN;
+        if (capacity < size + sizeof(void *)) capacity = size + sizeof(void *);
+        char *chunk = malloc(capacity);
+        if (!chunk) return NULL;
+        *(void **)chunk = frame->chunks;
+        frame->chunks = chunk;
+        frame->buffer = chunk;
+        frame->offset = (sizeof(void *) + 7) & ~(size_t)7;
+        frame->capacity = capacity;
+    }
+
+    RCHeader *header = (RCHeader *)(frame->buffer + frame->offset);
+    frame->offset += size;
+    rc_init_header(header, RC_IMMORTAL);
+    return (char *)header + RC_HEADER_SIZE;
+}
+
+string string_frame_create(StringFrame *frame, const char *literal) {
+    if (!literal) return NULL;
+    size_t len = strlen(literal);
+    string str = frame_alloc(frame, len);
+    if (str) memcpy(str, literal, len + 1);
+    return str;
+}
+
+string string_frame_concat(StringFrame *frame, string a, string b) {
+    if (!a || !b) return NULL;
+    size_t len_a = strlen(a);
+    size_t len_b = strlen(b);
+    string result = frame_alloc(frame, len_a + len_b);
+    if (result) {
+        memcpy(result, a, len_a);
+        memcpy(result + len_a, b, len_b + 1);
+    }
+    return result;
+}
+
+string string_frame_substr(StringFrame *frame, string s, size_t start, size_t len) {
+    if (!s) return NULL;
+    size_t s_len = strlen(s);
+    if (start >= s_len) return string_frame_create(frame, "");
+    if (start + len > s_len) len = s_len - start;
+
+    string result = frame_alloc(frame, len);
+    if (result) {
+        memcpy(result, s + start, len);
+        result[len] = '\0';
+    }
+    return result;
+}
+
+void string_frame_release(StringFrame *frame) {
+    while (frame->chunks) {
+        void *next = *(void **)frame->chunks;
+        free(frame->chunks);
+        frame->chunks = next;
+    }
+}
+
+// Arena object implementation
+void *rc_arena_alloc(Arena *arena, size_t size) {
+    RCHeader *header = arena_try_alloc(arena, RC_HEADER_SIZE + size);
+    if (!header) return rc_alloc(size);
+    memset(header, 0, RC_HEADER_SIZE + size);
+    rc_init_header(header, RC_IMMORTAL);
+    return (char *)header + RC_HEADER_SIZE;
+}
+
+string arena_string_create(Arena *arena, const char *literal) {
+    if (!literal) return NULL;
+    size_t len = strlen(literal);
+    string str = rc_arena_alloc(arena, len + 1);
+    if (str) memcpy(str, literal, len + 1);
+    return str;
+}
+
+string arena_string_concat(Arena *arena, string a, string b) {
+    if (!a || !b) return NULL;
+    size_t len_a = strlen(a);
+    size_t len_b = strlen(b);
+    string result = rc_arena_alloc(arena, len_a + len_b + 1);
+    if (result) {
+        memcpy(result, a, len_a);
+        memcpy(result + len_a, b, len_b + 1);
+    }
+    return result;
+}
+
+string arena_string_substr(Arena *arena, string s, size_t start, size_t len) {
+    if (!s) return NULL;
+    size_t s_len = strlen(s);
+    if (start >= s_len) return arena_string_create(arena, "");
+    if (start + len > s_len) len = s_len - start;
+
+    string result = rc_arena_alloc(arena, len + 1);
+    if (result) {
+        memcpy(result, s + start, len);
+        result[len] = '\0';
+    }
+    return result;
+}
+
+// Owned string implementation
+static own_string own_alloc(size_t len) {
+    own_string s = {malloc(len + 1), len, len + 1};
+    return s.ptr ? s : OWN_STRING_NONE;
+}
+
+own_string own_string_create(const char *text) {
+    if (!text) return OWN_STRING_NONE;
+    size_t     len = strlen(text);
+    own_string s = own_alloc(len);
+    if (s.ptr) memcpy(s.ptr, text, len + 1);
+    return s;
+}
+
+own_string own_string_concat(const char *a, const char *b) {
+    if (!a || !b) return OWN_STRING_NONE;
+    size_t     len_a = strlen(a);
+    size_t     len_b = strlen(b);
+    own_string s = own_alloc(len_a + len_b);
+    if (s.ptr) {
+        memcpy(s.ptr, a, len_a);
+        memcpy(s.ptr + len_a, b, len_b + 1);
+    }
+    return s;
+}
+
+own_string own_string_substr(const char *text, size_t start, size_t len) {
+    if (!text) return OWN_STRING_NONE;
+    size_t text_len = strlen(text);
+    if (start >= text_len) return own_string_create("");
+    if (start + len > text_len) len = text_len - start;
+
+    own_string s = own_alloc(len);
+    if (s.ptr) {
+        memcpy(s.ptr, text + start, len);
+        s.ptr[len] = '\0';
+    }
+    return s;
+}
+
+own_string own_string_adopt(string s) {
+    own_string result = own_string_create(s);
+    rc_release(s);
+    return result;
+}
+
+own_string own_string_move(own_string *s) {
+    own_string value = *s;
+    *s = OWN_STRING_NONE;
+    return value;
+}
+
+void own_string_append(own_string *s, const char *text) {
+    if (!s->ptr || !text) return;
+    size_t len = strlen(text);
+    if (s->len + len + 1 > s->capacity) {
+        // text may point into s, which growing would move
+        size_t offset = text >= s->ptr && text <= s->ptr + s->len ? (size_t)(text - s->ptr) : (size_t)-1;
+        size_t capacity = s->capacity * 2 > s->len + len + 1 ? s->capacity * 2 : s->len + len + 1;
+        char  *ptr = realloc(s->ptr, capacity);
+        if (!ptr) return;
+        if (offset != (size_t)-1) text = ptr + offset;
+        s->ptr = ptr;
+        s->capacity = capacity;
+    }
+    memmove(s->ptr + s->len, text, len);
+    s->len += len;
+    s->ptr[s->len] = '\0';
+}
+
+void own_string_replace(own_string *s, own_string value) {
+    free(s->ptr);
+    *s = value;
+}
+
+// Grows the block at its end and slides the text up behind a fresh header
+string own_string_share(own_string s) {
+    if (!s.ptr) return NULL;
+    RCHeader *header = realloc(s.ptr, RC_HEADER_SIZE + s.len + 1);
+    if (!header) {
+        free(s.ptr);
+        return NULL;
+    }
+    memmove((char *)header + RC_HEADER_SIZE, header, s.len + 1);
+    rc_init_header(header, 1);
+    return (char *)header + RC_HEADER_SIZE;
+}
+
+void own_string_free(own_string *s) {
+    free(s->ptr);
+    *s = OWN_STRING_NONE;
+}
+
+// String builder implementation
+#define SB_MIN_CAPACITY 64
+
+static StringBuilder builder_with_capacity(Arena *arena, size_t capacity) {
+    StringBuilder sb = {NULL, 0, 0, arena};
+    if (capacity < SB_MIN_CAPACITY) capacity = SB_MIN_CAPACITY;
+
+    if (arena) {
+        sb.data = arena_alloc(arena, capacity);
+    } else {
+        char *block = malloc(RC_HEADER_SIZE + capacity);
+        sb.data = block ? block + RC_HEADER_SIZE : NULL;
+    }
+    if (sb.data) {
+        sb.data[0] = '\0';
+        sb.capacity = capacity;
+    }
+    return sb;
+}
+
+static int builder_reserve(StringBuilder *sb, size_t extra) {
+    size_t needed = sb->length + extra + 1;
+    if (needed <= sb->capacity) return 1;
+
+    // Geometric growth keeps a run of appends linear overall
+    size_t new_capacity = sb->capacity ? sb->capacity : SB_MIN_CAPACITY;
+    while (new_capacity < needed)
+        new_capacity *= 2;
+
+    char *data;
+    if (sb->arena) {
+        data = arena_realloc(sb->arena, sb->data, sb->capacity, new_capacity);
+    } else {
+        char *block = realloc(sb->data ? sb->data - RC_HEADER_SIZE : NULL,
+                              RC_HEADER_SIZE + new_capacity);
+        data = block ? block + RC_HEADER_SIZE : NULL;
+    }
+    if (!data) return 0;
+
+    sb->data = data;
+    sb->capacity = new_capacity;
+    return 1;
+}
+
+StringBuilder string_builder_create(size_t hint) { return builder_with_capacity(NULL, hint); }
+
+StringBuilder string_builder_create_arena(Arena *arena, size_t hint) {
+    return builder_with_capacity(arena, hint);
+}
+
+StringBuilder string_builder_from(const char *initial) {
+    size_t        len = initial ? strlen(initial) : 0;
+    StringBuilder sb = builder_with_capacity(NULL, len * 2);
+    string_builder_append_n(&sb, initial, len);
+    return sb;
+}
+
+// Take over the buffer of a string that is about to be overwritten. A unique
+// string is adopted without copying; a shared one is copied and released.
+StringBuilder string_builder_adopt(string s) {
+    if (!s || !string_is_unique(s)) {
+        StringBuilder sb = string_builder_from(s);
+        rc_release(s);
+        return sb;
+    }
+
+    size_t        len = strlen(s);
+    StringBuilder sb = {s, len, len + 1, NULL};
+    return sb;
+}
+
+void string_builder_append_n(StringBuilder *sb, const char *text, size_t len) {
+    if (!text || len == 0 || !builder_reserve(sb, len)) return;
+    memcpy(sb->data + sb->length, text, len);
+    sb->length += len;
+    sb->data[sb->length] = '\0';
+}
+
+void string_builder_append(StringBuilder *sb, const char *text) {
+    if (text) string_builder_append_n(sb, text, strlen(text));
+}
+
+void string_builder_append_char(StringBuilder *sb, char ch) {
+    if (!builder_reserve(sb, 1)) return;
+    sb->data[sb->length++] = ch;
+    sb->data[sb->length] = '\0';
+}
+
+string string_builder_finish(StringBuilder *sb) {
+    if (!sb->data && !builder_reserve(sb, 0)) return NULL;
+    char *result = sb->data;
+
+    if (!sb->arena) {
+        // The buffer already sits behind an RCHeader, so no copy is needed
+        rc_init_header(RC_GET_HEADER(result), 1);
+    }
+
+    sb->data = NULL;
+    sb->length = 0;
+    sb->capacity = 0;
+    return result;
+}
+
+void string_builder_free(StringBuilder *sb) {
+    if (sb->data && !sb->arena) free(sb->data - RC_HEADER_SIZE);
+    sb->data = NULL;
+    sb->length = 0;
+    sb->capacity = 0;
+}
+
+// Array implementation
+#define ARRAY_MIN_CAPACITY 8
+
+static Array array_with_backing(ArrayBacking backing, Arena *arena, size_t elem_size) {
+    Array a = {0};
+    a.elem_size = elem_size ? elem_size : 1;
+    a.backing = backing;
+    a.arena = arena;
+    a.capacity = ARRAY_INLINE_BYTES / a.elem_size;
+    return a;
+}
+
+// Back to the inline storage, with nothing in it
+static void array_empty(Array *a) {
+    a->block = NULL;
+    a->length = 0;
+    a->capacity = a->elem_size ? ARRAY_INLINE_BYTES / a->elem_size : 0;
+}
+
+Array array_create(size_t elem_size) { return array_with_backing(ARRAY_HEAP, NULL, elem_size); }
+
+Array array_create_rc(size_t elem_size) { return array_with_backing(ARRAY_RC, NULL, elem_size); }
+
+Array array_create_arena(Arena *arena, size_t elem_size) {
+    return array_with_backing(arena ? ARRAY_ARENA : ARRAY_HEAP, arena, elem_size);
+}
+
+// Moves the elements to room for at least needed of them. Capacity doubles,
+// so each element is copied O(1) times over a run of pushes.
+static void array_grow(Array *a, size_t needed) {
+    size_t capacity = a->capacity < ARRAY_MIN_CAPACITY / 2 ? ARRAY_MIN_CAPACITY : a->capacity * 2;
+    while (capacity < needed)
+        capacity *= 2;
+
+    void  *old = array_data(*a);
+    size_t used = a->length * a->elem_size;
+    void  *block = NULL;
+    if (capacity <= SIZE_MAX / a->elem_size) {
+        size_t bytes = capacity * a->elem_size;
+        switch (a->backing) {
+        case ARRAY_ARENA:
+            block = arena_try_realloc(a->arena, a->block, a->capacity * a->elem_size, bytes);
+            if (block) {
+                if (!a->block) memcpy(block, old, used);
+                break;
+            }
+            // The arena is full; the elements carry on from the heap
+            a->backing = ARRAY_HEAP;
+            block = malloc(bytes);
+            if (block) memcpy(block, old, used);
+            break;
+        case ARRAY_HEAP:
+            block = a->block ? realloc(a->block, bytes) : malloc(bytes);
+            if (block && !a->block) memcpy(block, old, used);
+            break;
+        case ARRAY_RC:
+            block = rc_alloc_array(a->elem_size, capacity);
+            if (block) {
+                memcpy(block, old, used);
+                rc_release(a->block);
+            }
+            break;
+        }
+    }
+    if (!block) {
+        fprintf(stderr, "array: out of memory growing to %zu elements\n", capacity);
+        abort();
+    }
+    a->block = block;
+    a->capacity = capacity;
+}
+
+void array_reserve_to(Array *a, size_t capacity) {
+    if (capacity > a->capacity) array_grow(a, capacity);
+}
+
+void *array_push_slot(Array *a) {
+    if (a->length == a->capacity) array_grow(a, a->length + 1);
+    return (char *)array_data(*a) + a->length++ * a->elem_size;
+}
+
+void *array_insert_slot(Array *a, size_t index) {
+#ifndef NDEBUG
+    if (index > a->length) {
+        fprintf(stderr, "array: insert at %zu past the end (length %zu)\n", index, a->length);
+        abort();
+    }
+#endif
+    if (a->length == a->capacity) array_grow(a, a->length + 1);
+    char *slot = (char *)array_data(*a) + index * a->elem_size;
+    memmove(slot + a->elem_size, slot, (a->length - index) * a->elem_size);
+    a->length++;
+    return slot;
+}
+
+void array_append(Array *a, const void *items, size_t count) {
+    if (count == 0) return;
+    if (a->length + count > a->capacity) array_grow(a, a->length + count);
+    memcpy((char *)array_data(*a) + a->length * a->elem_size, items, count * a->elem_size);
+    a->length += count;
+}
+
+void *array_at_checked(Array *a, size_t index, const char *file, int line) {
+    if (index >= a->length) {
+        fprintf(stderr, "%s:%d: array index %zu out of bounds (length %zu)\n", file, line, index,
+                a->length);
+        abort();
+    }
+    return (char *)array_data(*a) + index * a->elem_size;
+}
+
+void *array_pop_checked(Array *a, const char *file, int line) {
+    if (a->length == 0) {
+        fprintf(stderr, "%s:%d: pop from an empty array\n", file, line);
+        abort();
+    }
+    a->length--;
+    return (char *)array_data(*a) + a->length * a->elem_size;
+}
+
+void *array_to_rc(Array *a) {
+    void *result;
+    if (a->backing == ARRAY_RC && a->block) {
+        // Already an RC array block; only its count needs to shrink
+        result = a->block;
+        RC_GET_HEADER(result)->array_count = a->length;
+    } else {
+        result = rc_alloc_array(a->elem_size, a->length);
+        if (result) memcpy(result, array_data(*a), a->length * a->elem_size);
+        if (a->backing == ARRAY_HEAP) free(a->block);
+    }
+    array_empty(a);
+    return result;
+}
+
+void array_free(Array *a) {
+    if (a->backing == ARRAY_HEAP) free(a->block);
+    if (a->backing == ARRAY_RC) rc_release(a->block);
+    array_empty(a);
+}
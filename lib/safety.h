@@ -8,13 +8,63 @@
 #include <stdlib.h>
 #include <string.h>
 
-// Your refcounting system
-typedef struct {
-    size_t refcount;
-    size_t weak_count;
-    size_t array_count;
+// Your refcounting system. The counting discipline is picked at compile time:
+//   default        plain ++/--, for single-threaded programs
+//   SAM_RC_ATOMIC  atomic counts, safe to share objects between threads
+//   SAM_RC_BIASED  the allocating thread counts without atomics; every other
+//                  thread uses an atomic shared count that is merged in once
+//                  the owner lets go (biased reference counting). A thread
+//                  that allocated shared objects must outlive them, and calls
+//                  rc_biased_flush before exiting to free the ones other
+//                  threads released last
+// SAM_RC_CYCLES adds the cycle collector below, for the plain counts only.
+#if defined(SAM_RC_CYCLES) && (defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED))
+#error "SAM_RC_CYCLES needs the single-threaded refcount mode"
+#endif
+#if defined(SAM_ALLOC_ARENA) && (defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED))
+#error "SAM_ALLOC_ARENA needs the single-threaded refcount mode"
+#endif
+
+typedef struct RCHeader {
+    size_t   refcount; // Strong references (the owner's count under SAM_RC_BIASED)
+    size_t   weak_count;
+    size_t   array_count;
+    uint32_t flags; // RC_FLAG_* facts about the payload, cleared by the mutators
+    uint32_t hash;  // string_hash32 of the payload while RC_FLAG_HASHED is set
+#ifdef SAM_RC_BIASED
+    struct RcOwner  *owner;      // Allocating thread, NULL once its count is merged
+    intptr_t         shared;     // Other threads' count * RC_SHARED_ONE | RC_SHARED_* bits
+    struct RCHeader *queue_next; // Link in the owner's merge queue
+    void (*destroy)(void *);     // Destructor recorded when queued for a merge
+#endif
+#ifdef SAM_RC_CYCLES
+    const struct RcType *type; // Traced fields of the payload, NULL for leaf objects
+    size_t root_index;         // 1 + slot in the collector's root buffer, 0 when not buffered
+#endif
 } RCHeader;
 
+// Facts derived from a string's bytes (UTF-8 verdict, hash), cached on first
+// use. Only meaningful while the bytes change through the string API; writing
+// through the raw char * must be followed by string_invalidate.
+#define RC_FLAG_UTF8_CHECKED (1u << 0)
+#define RC_FLAG_UTF8_VALID (1u << 1)
+#define RC_FLAG_ASCII (1u << 2)
+#define RC_FLAG_HASHED (1u << 3)
+#define RC_FLAG_DERIVED (RC_FLAG_UTF8_CHECKED | RC_FLAG_UTF8_VALID | RC_FLAG_ASCII | RC_FLAG_HASHED)
+#define RC_FLAG_INTERNED (1u << 4) // Canonical instance from string_intern
+// Bits 5-6 hold the cycle collector's color under SAM_RC_CYCLES
+
+// Refcount of immortal objects: far enough from zero that unbalanced
+// retain/release pairs can never free them
+#define RC_IMMORTAL ((size_t)1 << 56)
+
+#ifdef SAM_RC_BIASED
+#define RC_SHARED_MERGED 1   // Owner count folded in; shared count is the total
+#define RC_SHARED_QUEUED 2   // Waiting in the owner's merge queue
+#define RC_SHARED_ELEMENTS 4 // destroy is an element destructor (rc_release_array)
+#define RC_SHARED_ONE 8
+#endif
+
 #define RC_HEADER_SIZE sizeof(RCHeader)
 #define RC_GET_HEADER(ptr) ((RCHeader *)((char *)(ptr) - RC_HEADER_SIZE))
 #define ZAL_RELEASE(ptr)                                                                           \
@@ -26,11 +76,94 @@ typedef struct {
 // Core refcounting functions
 void *rc_alloc(size_t size);
 void *rc_alloc_array(size_t elem_size, size_t count);
+void  rc_init_header(RCHeader *header, size_t refcount); // Stamp a header not made by rc_alloc
 void  rc_retain(void *ptr);
 void  rc_release(void *ptr);
+void  rc_release_with(void *ptr, void (*destroy)(void *)); // destroy(ptr) runs before the free
+int   rc_is_unique(void *ptr);
 void  rc_weak_retain(void *ptr);
 void  rc_weak_release(void *ptr);
 void  rc_release_array(void *ptr, void (*destructor)(void *));
+#ifdef SAM_RC_BIASED
+void rc_biased_flush(void); // Merge objects other threads queued for this owner
+#endif
+
+// Release pools (autorelease pools). While a pool is pushed on a thread, the
+// objects whose last reference that thread drops are queued instead of
+// destroyed, and the pool destroys them in one batch when it is drained or
+// popped, together with everything their destructors release. Scope exits
+// then cost a queue push, and the free() burst moves to a boundary the program
+// picks: the transpiler pushes one per `release_pool` block or loop iteration.
+// rc_pool_collect runs the destructors on the calling thread and returns the
+// dead blocks, which any thread may hand back with rc_batch_free. A pool's
+// free_blocks, when set, receives each drained batch instead, for allocators
+// that take memory back in bulk.
+typedef struct RcDeferred RcDeferred;
+
+typedef struct {
+    void **blocks;
+    size_t count;
+} ReleaseBatch;
+
+typedef struct ReleasePool {
+    RcDeferred         *items; // Objects waiting for the drain
+    size_t              count, capacity;
+    struct ReleasePool *outer;                        // Pool this one was pushed over
+    void (*free_blocks)(void **blocks, size_t count); // NULL: free() each block
+} ReleasePool;
+
+#if defined(__GNUC__) && !defined(__TINYC__)
+#define RELEASE_POOL(name)                                                                     \
+    ReleasePool name __attribute__((cleanup(rc_pool_pop))) = {0};                              \
+    rc_pool_push(&name)
+#define RELEASE_POOL_END(name)
+#define RELEASE_POOL_EXIT(name)
+#else
+#define RELEASE_POOL(name)                                                                     \
+    ReleasePool name = {0};                                                                    \
+    rc_pool_push(&name)
+#define RELEASE_POOL_END(name) rc_pool_pop(&name)  // After the scope's own releases
+#define RELEASE_POOL_EXIT(name) rc_pool_pop(&name) // Before a break, continue or return
+#endif
+
+void         rc_pool_push(ReleasePool *pool);
+void         rc_pool_pop(ReleasePool *pool); // Drain, then make the outer pool current again
+void         rc_pool_drain(ReleasePool *pool);
+ReleaseBatch rc_pool_collect(ReleasePool *pool);
+void         rc_batch_free(ReleaseBatch *batch);
+
+#ifdef SAM_RC_CYCLES
+// Cycle collection. An object allocated with rc_alloc_typed carries an RcType
+// listing the offsets of its refcounted pointer fields (the transpiler emits
+// one per `rc struct`); the fields are released when it dies. A release that
+// leaves such an object alive buffers it as a possible cycle root, and the
+// collector runs trial deletion from the buffered roots: it subtracts the
+// references the reachable subgraph holds on itself, restores the counts of
+// whatever is still referenced from outside, and frees the rest.
+// rc_collect_step stops taking roots once it has traced `budget` objects, so a
+// pause is bounded by the budget plus the subgraph of the last root. A release
+// that fills the buffer to RC_CYCLE_THRESHOLD runs one step of RC_CYCLE_BUDGET.
+#ifndef RC_CYCLE_THRESHOLD
+#define RC_CYCLE_THRESHOLD 4096
+#endif
+#ifndef RC_CYCLE_BUDGET
+#define RC_CYCLE_BUDGET 16384
+#endif
+
+typedef struct RcType {
+    const char   *name;
+    size_t        size;
+    size_t        field_count;
+    const size_t *fields; // offsetof each field holding a string or rc struct pointer
+} RcType;
+
+#define rc_new(T) ((T)rc_alloc_typed(&T##__type))
+
+void  *rc_alloc_typed(const RcType *type);
+size_t rc_collect_step(size_t budget); // Returns the number of objects freed
+size_t rc_collect_cycles(void);        // Steps until the root buffer is empty
+size_t rc_cycle_roots(void);           // Candidates waiting in the buffer
+#endif
 
 // String type (refcounted)
 typedef char *string;
@@ -41,6 +174,235 @@ string string_substr(string s, size_t start, size_t len);
 size_t string_length(string s);
 void   string_free(string s);
 
+// Uniqueness-aware operations. string_concat_inplace consumes `a` and grows it
+// in place when it has a single owner, or returns `a` unchanged when out of
+// memory; the mutators copy only when shared.
+string string_concat_inplace(string a, const char *b);
+int    string_is_unique(string s);
+void   string_make_unique(string *s);
+void   string_set_char(string *s, size_t index, char ch);
+void   string_truncate(string *s, size_t len);
+void   string_to_upper(string *s);
+void   string_to_lower(string *s);
+
+// String views: pointer + length into someone else's bytes. `parent` names the
+// string the bytes belong to; a view stored in a tracked `strview` variable
+// holds one reference on it (the refcount pass emits strview_retain/release).
+// Views the functions below return do not retain by themselves. The field
+// strview_split_next stores does, as a strview variable would: it drops the
+// reference the field held, so the field must start as a view or {0}.
+typedef struct {
+    const char *ptr;
+    size_t      len;
+    string      parent;
+} strview;
+
+#define SV_ARG(v) (int)(v).len, (v).ptr // printf("%.*s", SV_ARG(v))
+#define strview_retain(v) rc_retain((v).parent)
+#define strview_release(v) rc_release((v).parent)
+
+strview strview_from(const char *s);
+strview string_view(string s);
+strview string_slice(string s, size_t start, size_t len);
+strview string_find(string s, const char *needle);
+strview string_trim(string s);
+size_t  string_split(string s, char sep, strview *out, size_t max);
+strview strview_slice(strview v, size_t start, size_t len);
+strview strview_find(strview v, const char *needle);
+strview strview_trim(strview v);
+int     strview_split_next(strview *rest, char sep, strview *field);
+int     strview_eq(strview v, const char *s);
+string  strview_to_string(strview v);
+
+// Search, comparison and hashing, backed by the SIMD kernels in simd.c
+strview  string_find_char(string s, char ch);
+int      string_eq(string a, string b);
+int      string_cmp(string a, string b);
+size_t   string_count(string s, const char *needle);
+uint64_t string_hash(string s);
+uint32_t string_hash32(string s);           // Folded string_hash, cached in the header
+uint32_t string_hash32_bytes(const char *s, size_t len); // Same value, nothing cached
+
+// UTF-8. Validation runs once per string (lookup-table SIMD kernels) and the
+// verdict lives in the header flags, so repeated checks are O(1). Lengths and
+// slices count code points; on invalid input they count non-continuation bytes.
+int     string_utf8_valid(string s);
+size_t  string_utf8_len(string s);
+size_t  string_utf8_offset(string s, size_t cp_index);
+strview string_utf8_slice(string s, size_t cp_start, size_t cp_len);
+void    string_invalidate(string s);
+
+// Interning: one canonical, immortal instance per distinct text, so equality
+// of interned strings is a pointer compare (string_eq short-circuits on it).
+// The table is sharded by hash with a spinlock per shard, safe to call from
+// several threads. Canonical strings must not be written through the raw
+// pointer; the string API mutators copy them first like any shared string.
+string string_intern(const char *s);
+int    string_is_interned(string s);
+
+// Frame strings: storage for strings the transpiler proved never leave their
+// function. They are carved from a stack buffer sized at compile time and
+// spill into heap chunks when it runs out; string_frame_release frees the
+// chunks, and the frame's scope-exit cleanup calls it. Headers are immortal,
+// so frame strings work with every read-only string function and never need
+// retain/release.
+typedef struct StringFrame {
+    char  *buffer; // Current block: the stack buffer or the newest chunk
+    size_t offset;
+    size_t capacity;
+    void  *chunks; // Spilled heap chunks, linked through their first word
+} StringFrame;
+
+// Declares `name` over a stack buffer for `count` strings of `bytes` payload in all
+#define STRING_FRAME_SIZE(count, bytes) ((count) * (RC_HEADER_SIZE + 8) + (bytes))
+#if defined(__GNUC__) && !defined(__TINYC__)
+#define STRING_FRAME(name, count, bytes)                                                    \
+    uint64_t name##_stack[(STRING_FRAME_SIZE(count, bytes) + 7) / 8];                        \
+    StringFrame name __attribute__((cleanup(string_frame_release))) = {                      \
+        (char *)name##_stack, 0, sizeof(name##_stack), NULL}
+#define STRING_FRAME_END(name)
+#else
+#define STRING_FRAME(name, count, bytes)                                                    \
+    uint64_t    name##_stack[(STRING_FRAME_SIZE(count, bytes) + 7) / 8];                     \
+    StringFrame name = {(char *)name##_stack, 0, sizeof(name##_stack), NULL}
+#define STRING_FRAME_END(name) string_frame_release(&name) // Early returns skip it
+#endif
+
+string string_frame_create(StringFrame *frame, const char *literal);
+string string_frame_concat(StringFrame *frame, string a, string b);
+string string_frame_substr(StringFrame *frame, string s, size_t start, size_t len);
+void   string_frame_release(StringFrame *frame);
+
+// Arena objects: refcounted values carved from an Arena, which the transpiler
+// uses for the strings and rc_alloc blocks created inside an `arena(...)`
+// scope. Headers are immortal, so retain and release only touch the count and
+// never free; arena_destroy takes the whole set at once. When the arena is
+// full the value spills to an ordinary heap object, which the scope's
+// releases free as usual.
+struct Arena;
+
+void  *rc_arena_alloc(struct Arena *arena, size_t size);
+string arena_string_create(struct Arena *arena, const char *literal);
+string arena_string_concat(struct Arena *arena, string a, string b);
+string arena_string_substr(struct Arena *arena, string s, size_t start, size_t len);
+
+// Owned strings: the lowering of `own string`, for text with exactly one
+// owner. There is no RCHeader and nothing is counted; the length and capacity
+// travel with the pointer, so appends grow in place and the length is a field
+// read. The transpiler moves them (own_string_move empties the source) and
+// frees each one once, at scope exit. `.ptr` lends the text to anything taking
+// a plain const char *; string functions that read the header need a `string`,
+// which own_string_share makes without copying when realloc can extend in place.
+typedef struct {
+    char  *ptr;
+    size_t len;
+    size_t capacity; // Bytes allocated, including the terminator
+} own_string;
+
+#define OWN_STRING_NONE ((own_string){NULL, 0, 0})
+#if defined(__GNUC__) && !defined(__TINYC__)
+#define SAM_OWNED __attribute__((cleanup(own_string_free)))
+#define OWN_STRING_END(name)
+#else
+#define SAM_OWNED
+#define OWN_STRING_END(name) own_string_free(&name) // Early returns skip it
+#endif
+
+own_string own_string_create(const char *text);
+own_string own_string_concat(const char *a, const char *b);
+own_string own_string_substr(const char *text, size_t start, size_t len);
+own_string own_string_adopt(string s); // Copies s and drops the caller's reference
+own_string own_string_move(own_string *s);
+void       own_string_append(own_string *s, const char *text);
+void       own_string_replace(own_string *s, own_string value);
+string     own_string_share(own_string s); // Consumes s
+void       own_string_free(own_string *s);
+
+// String builder: amortised geometric growth, O(1) hand-off to a string.
+// RC builders grow an RCHeader-prefixed buffer in place, so finishing just
+// stamps the header; arena builders grow inside the arena and finish with a
+// plain arena-owned char * that lives until arena_destroy.
+typedef struct {
+    char         *data;     // Payload (just past the RCHeader for RC buffers)
+    size_t        length;   // Bytes used, excluding the terminator
+    size_t        capacity; // Payload bytes available, including the terminator
+    struct Arena *arena;    // NULL for RC-backed builders
+} StringBuilder;
+
+StringBuilder string_builder_create(size_t hint);
+StringBuilder string_builder_create_arena(struct Arena *arena, size_t hint);
+StringBuilder string_builder_from(const char *initial);
+StringBuilder string_builder_adopt(string s);
+void          string_builder_append(StringBuilder *sb, const char *text);
+void          string_builder_append_n(StringBuilder *sb, const char *text, size_t len);
+void          string_builder_append_char(StringBuilder *sb, char ch);
+string        string_builder_finish(StringBuilder *sb);
+void          string_builder_free(StringBuilder *sb);
+
+// Growable arrays: the lowering of `array T name`. Pushes grow the storage
+// geometrically, so a run of them is amortised O(1). The first
+// ARRAY_INLINE_BYTES of elements live inside the Array itself and short arrays
+// never allocate; past that the elements move to the heap, an RC block (which
+// array_to_rc hands off without copying) or the enclosing arena, which spills
+// to the heap once it is full. The macros take the element type, which the
+// transpiler fills in. Indexing and popping are bounds checked unless NDEBUG
+// is defined.
+#ifndef ARRAY_INLINE_BYTES
+#define ARRAY_INLINE_BYTES 64
+#endif
+
+typedef enum { ARRAY_HEAP, ARRAY_RC, ARRAY_ARENA } ArrayBacking;
+
+typedef struct {
+    void         *block;     // NULL while the elements fit inline
+    size_t        length;    // Elements in use
+    size_t        capacity;  // Elements that fit before the next growth
+    size_t        elem_size;
+    ArrayBacking  backing;
+    struct Arena *arena;     // ARRAY_ARENA only
+    union {
+        long double   align;
+        void         *pointer;
+        unsigned char bytes[ARRAY_INLINE_BYTES];
+    } small;
+} Array;
+
+#if defined(__GNUC__) && !defined(__TINYC__)
+#define SAM_ARRAY __attribute__((cleanup(array_free)))
+#define ARRAY_END(name)
+#else
+#define SAM_ARRAY
+#define ARRAY_END(name) array_free(&name) // Early returns skip it
+#endif
+
+#define array_data(a) ((a).block ? (a).block : (void *)(a).small.bytes)
+#define array_len(a) ((a).length)
+#define array_clear(a) ((void)((a).length = 0))
+#define array_reserve(a, count) array_reserve_to(&(a), (count))
+#define array_push(a, T, value)                                                                    \
+    (*(T *)((a).length < (a).capacity ? (char *)array_data(a) + (a).length++ * sizeof(T)           \
+                                      : array_push_slot(&(a))) = (value))
+#define array_insert(a, T, index, value) (*(T *)array_insert_slot(&(a), (index)) = (value))
+#ifdef NDEBUG
+#define array_at(a, T, index) (((T *)array_data(a))[index])
+#define array_pop(a, T) (((T *)array_data(a))[--(a).length])
+#else
+#define array_at(a, T, index) (*(T *)array_at_checked(&(a), (index), __FILE__, __LINE__))
+#define array_pop(a, T) (*(T *)array_pop_checked(&(a), __FILE__, __LINE__))
+#endif
+
+Array array_create(size_t elem_size);
+Array array_create_rc(size_t elem_size);
+Array array_create_arena(struct Arena *arena, size_t elem_size);
+void  array_reserve_to(Array *a, size_t capacity);
+void *array_push_slot(Array *a);
+void *array_insert_slot(Array *a, size_t index);
+void  array_append(Array *a, const void *items, size_t count);
+void *array_at_checked(Array *a, size_t index, const char *file, int line);
+void *array_pop_checked(Array *a, const char *file, int line);
+void *array_to_rc(Array *a); // rc_alloc_array block; empties a
+void  array_free(Array *a);
+
 // Convenience macros
 #define rc_new_array(type, count) (type *)rc_alloc_array(sizeof(type), count)
 #define rc_string_new(str) string_create(str)
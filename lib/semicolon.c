@@ -23,6 +23,28 @@ static char *rtrim(char *s) {
 static int starts_with(const char *str, const char *prefix) {
     return strncmp(str, prefix, strlen(prefix)) == 0;
 }
+// Helper: Statement after a control line's condition, as in `if (n <= 1) return n`
+static const char *statement_after_condition(const char *str) {
+    const char *p = strchr(str, '(');
+    int         nesting = 0;
+    for (; p && *p; p++) {
+        if (*p == '(') nesting++;
+        if (*p == ')' && --nesting == 0) {
+            p++;
+            while (isspace(*p))
+                p++;
+            return *p ? p : NULL;
+        }
+    }
+    return NULL;
+}
+// Helper: Check for a compound assignment such as `total += x` (reductions)
+static int has_compound_assignment(const char *str) {
+    for (const char *p = strchr(str, '='); p; p = strchr(p + 1, '=')) {
+        if (p > str && strchr("+-*/%&|^", p[-1]) && p[1] != '=') return 1;
+    }
+    return 0;
+}
 
 void add_semicolons(FILE *in, FILE *out) {
     char line[1024];
@@ -80,8 +102,12 @@ void add_semicolons(FILE *in, FILE *out) {
             starts_with(trimmed, "while ") || starts_with(trimmed, "while(") ||
             starts_with(trimmed, "switch ") || starts_with(trimmed, "switch(") ||
             starts_with(trimmed, "case ") || starts_with(trimmed, "default:")) {
+            // A one-line body needs its own semicolon unless it is a block
+            int loop_or_if = starts_with(trimmed, "if") || starts_with(trimmed, "for") ||
+                             starts_with(trimmed, "while");
+            const char *body = loop_or_if ? statement_after_condition(trimmed) : NULL;
             fputs(line, out);
-            fputc('\n', out);
+            fputs(body && line[len - 1] != '}' && !starts_with(body, "//") ? ";\n" : "\n", out);
             continue;
         }
 
@@ -107,6 +133,14 @@ void add_semicolons(FILE *in, FILE *out) {
             continue;
         }
 
+        // `own string name` declares an empty owned string, `array int xs` an empty array
+        if (starts_with(trimmed, "own ") || starts_with(trimmed, "array ") ||
+            starts_with(trimmed, "rc array ")) {
+            fputs(line, out);
+            fputs(";\n", out);
+            continue;
+        }
+
         // Check for assignments
         char *equals = strchr(trimmed, '=');
         if (equals && !strstr(trimmed, "==") && !strstr(trimmed, "!=") && !strstr(trimmed, ">=") &&
@@ -119,6 +153,12 @@ void add_semicolons(FILE *in, FILE *out) {
             continue;
         }
 
+        if (has_compound_assignment(trimmed)) {
+            fputs(line, out);
+            fputs(";\n", out);
+            continue;
+        }
+
         // Check for function calls (has parentheses)
         if (strchr(trimmed, '(') && strchr(trimmed, ')')) {
             // Function call - add semicolon to same line
@@ -0,0 +1,787 @@
+// lib/simd.c - SSE2/AVX2/AVX-512 byte kernels with a scalar fallback
+#include "simd.h"
+#include <string.h>
+
+#ifdef SAM_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// =========================== [ HASH CORE ] =========================================
+// Every implementation folds 64-byte blocks into eight 64-bit lanes the same
+// way, so the hash value does not depend on which kernel was selected.
+
+#define HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+
+static const uint64_t hash_secret[8] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+    0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+};
+
+typedef void (*HashAccumulate)(uint64_t acc[8], const unsigned char *data, size_t blocks);
+
+static uint64_t load64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t hash_avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t hash_with(const void *data, size_t len, HashAccumulate accumulate) {
+    const unsigned char *p = data;
+    uint64_t             h = len * HASH_PRIME1;
+    size_t               blocks = len / 64;
+
+    if (blocks) {
+        uint64_t acc[8];
+        memcpy(acc, hash_secret, sizeof(acc));
+        accumulate(acc, p, blocks);
+        for (int i = 0; i < 8; i++)
+            h = (h ^ hash_avalanche(acc[i])) * HASH_PRIME2;
+        p += blocks * 64;
+        len -= blocks * 64;
+    }
+
+    for (; len >= 8; p += 8, len -= 8) {
+        h ^= hash_avalanche(load64(p) * HASH_PRIME2);
+        h = ((h << 27) | (h >> 37)) * HASH_PRIME1;
+    }
+    if (len) {
+        uint64_t tail = 0;
+        memcpy(&tail, p, len);
+        h ^= hash_avalanche((tail ^ len) * HASH_PRIME1);
+    }
+    return hash_avalanche(h);
+}
+
+// =========================== [ SCALAR ] =========================================
+
+static const char *scalar_find_char(const char *hay, size_t len, int ch) {
+    return memchr(hay, ch, len);
+}
+
+static const char *scalar_find(const char *hay, size_t hay_len, const char *needle,
+                               size_t needle_len) {
+    if (needle_len == 0) return hay;
+    if (needle_len > hay_len) return NULL;
+
+    const char *end = hay + hay_len - needle_len;
+    for (const char *p = hay; p <= end; p++) {
+        p = memchr(p, needle[0], end - p + 1);
+        if (!p) return NULL;
+        if (memcmp(p + 1, needle + 1, needle_len - 1) == 0) return p;
+    }
+    return NULL;
+}
+
+static int scalar_eq(const void *a, const void *b, size_t len) { return memcmp(a, b, len) == 0; }
+
+static int scalar_cmp(const void *a, const void *b, size_t len) { return memcmp(a, b, len); }
+
+static size_t scalar_count_char(const char *hay, size_t len, int ch) {
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++)
+        count += (unsigned char)hay[i] == (unsigned char)ch;
+    return count;
+}
+
+static void scalar_accumulate(uint64_t acc[8], const unsigned char *data, size_t blocks) {
+    for (size_t b = 0; b < blocks; b++, data += 64) {
+        for (int i = 0; i < 8; i++) {
+            uint64_t d = load64(data + 8 * i);
+            uint64_t k = d ^ hash_secret[i];
+            acc[i] += (k & 0xffffffffULL) * (k >> 32) + d;
+        }
+    }
+}
+
+static uint64_t scalar_hash(const void *data, size_t len) {
+    return hash_with(data, len, scalar_accumulate);
+}
+
+static int scalar_utf8_validate(const char *s, size_t len) {
+    const unsigned char *p = (const unsigned char *)s;
+    const unsigned char *end = p + len;
+    int                  ascii = 1;
+
+    while (p < end) {
+        if (end - p >= 8 && !(load64(p) & 0x8080808080808080ULL)) {
+            p += 8;
+            continue;
+        }
+        if (*p < 0x80) {
+            p++;
+            continue;
+        }
+        ascii = 0;
+
+        size_t   extra;
+        uint32_t cp, min;
+        if (*p >= 0xC2 && *p <= 0xDF) {
+            extra = 1, cp = *p & 0x1F, min = 0x80;
+        } else if ((*p & 0xF0) == 0xE0) {
+            extra = 2, cp = *p & 0x0F, min = 0x800;
+        } else if (*p >= 0xF0 && *p <= 0xF4) {
+            extra = 3, cp = *p & 0x07, min = 0x10000;
+        } else {
+            return SIMD_UTF8_INVALID;
+        }
+        if ((size_t)(end - p) <= extra) return SIMD_UTF8_INVALID;
+
+        for (size_t i = 1; i <= extra; i++) {
+            if ((p[i] & 0xC0) != 0x80) return SIMD_UTF8_INVALID;
+            cp = (cp << 6) | (p[i] & 0x3F);
+        }
+        if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return SIMD_UTF8_INVALID;
+        p += extra + 1;
+    }
+    return ascii ? SIMD_UTF8_ASCII : SIMD_UTF8_VALID;
+}
+
+// Every byte that is not a continuation byte (10xxxxxx) starts a code point
+static size_t scalar_utf8_count(const char *s, size_t len) {
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++)
+        count += ((unsigned char)s[i] & 0xC0) != 0x80;
+    return count;
+}
+
+const SimdKernels simd_scalar = {
+    "scalar",    scalar_find_char,  scalar_find, scalar_eq,
+    scalar_cmp,  scalar_count_char, scalar_hash, scalar_utf8_validate,
+    scalar_utf8_count,
+};
+
+#ifdef SAM_SIMD_X86
+
+// =========================== [ SSE2 ] =========================================
+
+#define SSE2 __attribute__((target("sse2")))
+
+SSE2 static const char *sse2_find_char(const char *hay, size_t len, int ch) {
+    __m128i needle = _mm_set1_epi8((char)ch);
+    size_t  i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i  block = _mm_loadu_si128((const __m128i *)(hay + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask) return hay + i + __builtin_ctz(mask);
+    }
+    return scalar_find_char(hay + i, len - i, ch);
+}
+
+// First/last byte filter: compare the needle's first byte at i and its last
+// byte at i + n - 1 for 16 positions at once, then verify the candidates
+SSE2 static const char *sse2_find(const char *hay, size_t hay_len, const char *needle,
+                                  size_t needle_len) {
+    if (needle_len <= 1) {
+        return needle_len ? sse2_find_char(hay, hay_len, needle[0]) : hay;
+    }
+    if (needle_len > hay_len) return NULL;
+
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+    size_t  i = 0;
+    for (; i + needle_len - 1 + 16 <= hay_len; i += 16) {
+        __m128i  block_first = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i  block_last = _mm_loadu_si128((const __m128i *)(hay + i + needle_len - 1));
+        unsigned mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+        while (mask) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, needle_len - 2) == 0) return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return scalar_find(hay + i, hay_len - i, needle, needle_len);
+}
+
+SSE2 static int sse2_cmp(const void *a, const void *b, size_t len) {
+    const unsigned char *pa = a, *pb = b;
+    size_t               i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i  va = _mm_loadu_si128((const __m128i *)(pa + i));
+        __m128i  vb = _mm_loadu_si128((const __m128i *)(pb + i));
+        unsigned diff = ~_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xffffu;
+        if (diff) {
+            unsigned bit = __builtin_ctz(diff);
+            return (int)pa[i + bit] - (int)pb[i + bit];
+        }
+    }
+    return memcmp(pa + i, pb + i, len - i);
+}
+
+SSE2 static int sse2_eq(const void *a, const void *b, size_t len) {
+    const unsigned char *pa = a, *pb = b;
+    size_t               i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(pa + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(pb + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xffff) return 0;
+    }
+    return memcmp(pa + i, pb + i, len - i) == 0;
+}
+
+// Matches are subtracted into byte counters (cmpeq yields -1) and folded with
+// psadbw before any counter can wrap
+SSE2 static size_t sse2_count_char(const char *hay, size_t len, int ch) {
+    __m128i needle = _mm_set1_epi8((char)ch);
+    __m128i zero = _mm_setzero_si128();
+    size_t  count = 0, i = 0;
+    while (i + 16 <= len) {
+        __m128i counters = zero;
+        for (int round = 0; round < 255 && i + 16 <= len; round++, i += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *)(hay + i));
+            counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(block, needle));
+        }
+        __m128i sums = _mm_sad_epu8(counters, zero);
+        count += _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+    }
+    return count + scalar_count_char(hay + i, len - i, ch);
+}
+
+SSE2 static void sse2_accumulate(uint64_t acc[8], const unsigned char *data, size_t blocks) {
+    __m128i lanes[4], secret[4];
+    for (int j = 0; j < 4; j++) {
+        lanes[j] = _mm_loadu_si128((const __m128i *)(acc + 2 * j));
+        secret[j] = _mm_loadu_si128((const __m128i *)(hash_secret + 2 * j));
+    }
+    for (size_t b = 0; b < blocks; b++, data += 64) {
+        for (int j = 0; j < 4; j++) {
+            __m128i d = _mm_loadu_si128((const __m128i *)(data + 16 * j));
+            __m128i k = _mm_xor_si128(d, secret[j]);
+            __m128i product = _mm_mul_epu32(k, _mm_srli_epi64(k, 32));
+            lanes[j] = _mm_add_epi64(lanes[j], _mm_add_epi64(product, d));
+        }
+    }
+    for (int j = 0; j < 4; j++)
+        _mm_storeu_si128((__m128i *)(acc + 2 * j), lanes[j]);
+}
+
+SSE2 static uint64_t sse2_hash(const void *data, size_t len) {
+    return hash_with(data, len, sse2_accumulate);
+}
+
+SSE2 static size_t sse2_utf8_count(const char *s, size_t len) {
+    __m128i limit = _mm_set1_epi8(-65); // (int8_t)0xBF, the largest continuation byte
+    __m128i zero = _mm_setzero_si128();
+    size_t  count = 0, i = 0;
+    while (i + 16 <= len) {
+        __m128i counters = zero;
+        for (int round = 0; round < 255 && i + 16 <= len; round++, i += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *)(s + i));
+            counters = _mm_sub_epi8(counters, _mm_cmpgt_epi8(block, limit));
+        }
+        __m128i sums = _mm_sad_epu8(counters, zero);
+        count += _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+    }
+    return count + scalar_utf8_count(s + i, len - i);
+}
+
+static const SimdKernels sse2_kernels = {
+    "sse2",         sse2_find_char,       sse2_find, sse2_eq, sse2_cmp, sse2_count_char,
+    sse2_hash,      scalar_utf8_validate, sse2_utf8_count,
+};
+
+// =========================== [ UTF-8 LOOKUP TABLES ] ================================
+// Keiser & Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte".
+// Three 16-entry nibble lookups classify every (previous byte, byte) pair;
+// their AND is non-zero exactly where the pair is an error, except for the
+// 3rd/4th continuation bytes, which are checked against prev2/prev3.
+
+#define UTF8_TOO_SHORT (1 << 0)
+#define UTF8_TOO_LONG (1 << 1)
+#define UTF8_OVERLONG_3 (1 << 2)
+#define UTF8_TOO_LARGE (1 << 3)
+#define UTF8_SURROGATE (1 << 4)
+#define UTF8_OVERLONG_2 (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4 (1 << 6)
+#define UTF8_TWO_CONTS (1 << 7)
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+static const unsigned char utf8_byte_1_high[16] = {
+    UTF8_TOO_LONG,  UTF8_TOO_LONG,  UTF8_TOO_LONG,  UTF8_TOO_LONG,
+    UTF8_TOO_LONG,  UTF8_TOO_LONG,  UTF8_TOO_LONG,  UTF8_TOO_LONG,
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+};
+
+static const unsigned char utf8_byte_1_low[16] = {
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+    UTF8_CARRY | UTF8_OVERLONG_2,
+    UTF8_CARRY,
+    UTF8_CARRY,
+    UTF8_CARRY | UTF8_TOO_LARGE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+};
+
+static const unsigned char utf8_byte_2_high[16] = {
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 |
+        UTF8_OVERLONG_4,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+};
+
+// A block ending in the first bytes of a multi-byte sequence must be continued
+static const unsigned char utf8_incomplete_max[32] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  255,  255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  255,  255,
+    255, 255, 255, 0xEF, 0xDF, 0xBF,
+};
+
+// =========================== [ SSSE3 ] =========================================
+
+#define SSSE3 __attribute__((target("ssse3")))
+
+typedef struct {
+    __m128i byte_1_high, byte_1_low, byte_2_high, incomplete_max;
+} Utf8Tables128;
+
+SSSE3 static __m128i ssse3_utf8_errors(const Utf8Tables128 *t, __m128i input, __m128i prev_input) {
+    __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+    __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+    __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+
+    __m128i special = _mm_and_si128(
+        _mm_and_si128(
+            _mm_shuffle_epi8(t->byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+            _mm_shuffle_epi8(t->byte_1_low, _mm_and_si128(prev1, nibble))),
+        _mm_shuffle_epi8(t->byte_2_high, _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+
+    __m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80)));
+    __m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80)));
+    __m128i must_be_cont = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));
+    return _mm_xor_si128(must_be_cont, special);
+}
+
+SSSE3 static int ssse3_utf8_validate(const char *s, size_t len) {
+    Utf8Tables128 t = {
+        _mm_loadu_si128((const __m128i *)utf8_byte_1_high),
+        _mm_loadu_si128((const __m128i *)utf8_byte_1_low),
+        _mm_loadu_si128((const __m128i *)utf8_byte_2_high),
+        _mm_loadu_si128((const __m128i *)(utf8_incomplete_max + 16)),
+    };
+    __m128i zero = _mm_setzero_si128();
+    __m128i error = zero, prev_input = zero, prev_incomplete = zero, high_bits = zero;
+
+    for (size_t i = 0; i < len; i += 16) {
+        __m128i input;
+        if (i + 16 <= len) {
+            input = _mm_loadu_si128((const __m128i *)(s + i));
+        } else {
+            char tail[16] = {0};
+            memcpy(tail, s + i, len - i);
+            input = _mm_loadu_si128((const __m128i *)tail);
+        }
+
+        if (_mm_movemask_epi8(input) == 0) {
+            error = _mm_or_si128(error, prev_incomplete);
+            prev_incomplete = zero;
+        } else {
+            high_bits = _mm_or_si128(high_bits, input);
+            error = _mm_or_si128(error, ssse3_utf8_errors(&t, input, prev_input));
+            prev_incomplete = _mm_subs_epu8(input, t.incomplete_max);
+        }
+        prev_input = input;
+    }
+
+    error = _mm_or_si128(error, prev_incomplete);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, zero)) != 0xffff) return SIMD_UTF8_INVALID;
+    return _mm_movemask_epi8(high_bits) ? SIMD_UTF8_VALID : SIMD_UTF8_ASCII;
+}
+
+static const SimdKernels ssse3_kernels = {
+    "ssse3",        sse2_find_char,      sse2_find, sse2_eq, sse2_cmp, sse2_count_char,
+    sse2_hash,      ssse3_utf8_validate, sse2_utf8_count,
+};
+
+// =========================== [ AVX2 ] =========================================
+
+#define AVX2 __attribute__((target("avx2")))
+
+// Tails are handed to the narrower kernels. GCC does not clear the upper
+// register halves before such calls, and legacy SSE code running with dirty
+// upper state stalls, so each hand-off is preceded by vzeroupper.
+
+AVX2 static const char *avx2_find_char(const char *hay, size_t len, int ch) {
+    __m256i needle = _mm256_set1_epi8((char)ch);
+    size_t  i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i  block = _mm256_loadu_si256((const __m256i *)(hay + i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+        if (mask) return hay + i + __builtin_ctz(mask);
+    }
+    _mm256_zeroupper();
+    return sse2_find_char(hay + i, len - i, ch);
+}
+
+AVX2 static const char *avx2_find(const char *hay, size_t hay_len, const char *needle,
+                                  size_t needle_len) {
+    if (needle_len <= 1) {
+        return needle_len ? avx2_find_char(hay, hay_len, needle[0]) : hay;
+    }
+    if (needle_len > hay_len) return NULL;
+
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+    size_t  i = 0;
+    for (; i + needle_len - 1 + 32 <= hay_len; i += 32) {
+        __m256i  block_first = _mm256_loadu_si256((const __m256i *)(hay + i));
+        __m256i  block_last = _mm256_loadu_si256((const __m256i *)(hay + i + needle_len - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)));
+        while (mask) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, needle_len - 2) == 0) return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    _mm256_zeroupper();
+    return sse2_find(hay + i, hay_len - i, needle, needle_len);
+}
+
+AVX2 static int avx2_cmp(const void *a, const void *b, size_t len) {
+    const unsigned char *pa = a, *pb = b;
+    size_t               i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i  va = _mm256_loadu_si256((const __m256i *)(pa + i));
+        __m256i  vb = _mm256_loadu_si256((const __m256i *)(pb + i));
+        unsigned diff = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        if (diff) {
+            unsigned bit = __builtin_ctz(diff);
+            return (int)pa[i + bit] - (int)pb[i + bit];
+        }
+    }
+    _mm256_zeroupper();
+    return sse2_cmp(pa + i, pb + i, len - i);
+}
+
+AVX2 static int avx2_eq(const void *a, const void *b, size_t len) {
+    const unsigned char *pa = a, *pb = b;
+    size_t               i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(pa + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(pb + i));
+        if ((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)) != 0xffffffffu) return 0;
+    }
+    _mm256_zeroupper();
+    return sse2_eq(pa + i, pb + i, len - i);
+}
+
+AVX2 static size_t avx2_count_char(const char *hay, size_t len, int ch) {
+    __m256i needle = _mm256_set1_epi8((char)ch);
+    __m256i zero = _mm256_setzero_si256();
+    size_t  count = 0, i = 0;
+    while (i + 32 <= len) {
+        __m256i counters = zero;
+        for (int round = 0; round < 255 && i + 32 <= len; round++, i += 32) {
+            __m256i block = _mm256_loadu_si256((const __m256i *)(hay + i));
+            counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(block, needle));
+        }
+        __m256i sums = _mm256_sad_epu8(counters, zero);
+        count += (size_t)_mm256_extract_epi64(sums, 0) + (size_t)_mm256_extract_epi64(sums, 1) +
+                 (size_t)_mm256_extract_epi64(sums, 2) + (size_t)_mm256_extract_epi64(sums, 3);
+    }
+    _mm256_zeroupper();
+    return count + sse2_count_char(hay + i, len - i, ch);
+}
+
+AVX2 static void avx2_accumulate(uint64_t acc[8], const unsigned char *data, size_t blocks) {
+    __m256i lanes[2], secret[2];
+    for (int j = 0; j < 2; j++) {
+        lanes[j] = _mm256_loadu_si256((const __m256i *)(acc + 4 * j));
+        secret[j] = _mm256_loadu_si256((const __m256i *)(hash_secret + 4 * j));
+    }
+    for (size_t b = 0; b < blocks; b++, data += 64) {
+        for (int j = 0; j < 2; j++) {
+            __m256i d = _mm256_loadu_si256((const __m256i *)(data + 32 * j));
+            __m256i k = _mm256_xor_si256(d, secret[j]);
+            __m256i product = _mm256_mul_epu32(k, _mm256_srli_epi64(k, 32));
+            lanes[j] = _mm256_add_epi64(lanes[j], _mm256_add_epi64(product, d));
+        }
+    }
+    for (int j = 0; j < 2; j++)
+        _mm256_storeu_si256((__m256i *)(acc + 4 * j), lanes[j]);
+}
+
+AVX2 static uint64_t avx2_hash(const void *data, size_t len) {
+    return hash_with(data, len, avx2_accumulate);
+}
+
+typedef struct {
+    __m256i byte_1_high, byte_1_low, byte_2_high, incomplete_max;
+} Utf8Tables256;
+
+AVX2 static __m256i avx2_prev(__m256i input, __m256i prev_input, int n) {
+    __m256i carried = _mm256_permute2x128_si256(prev_input, input, 0x21);
+    switch (n) {
+    case 1: return _mm256_alignr_epi8(input, carried, 15);
+    case 2: return _mm256_alignr_epi8(input, carried, 14);
+    default: return _mm256_alignr_epi8(input, carried, 13);
+    }
+}
+
+AVX2 static __m256i avx2_utf8_errors(const Utf8Tables256 *t, __m256i input, __m256i prev_input) {
+    __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i prev1 = avx2_prev(input, prev_input, 1);
+    __m256i prev2 = avx2_prev(input, prev_input, 2);
+    __m256i prev3 = avx2_prev(input, prev_input, 3);
+
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(
+            _mm256_shuffle_epi8(t->byte_1_high,
+                                _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+            _mm256_shuffle_epi8(t->byte_1_low, _mm256_and_si256(prev1, nibble))),
+        _mm256_shuffle_epi8(t->byte_2_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+
+    __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i must_be_cont =
+        _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(must_be_cont, special);
+}
+
+AVX2 static int avx2_utf8_validate(const char *s, size_t len) {
+    Utf8Tables256 t = {
+        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)utf8_byte_1_high)),
+        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)utf8_byte_1_low)),
+        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)utf8_byte_2_high)),
+        _mm256_loadu_si256((const __m256i *)utf8_incomplete_max),
+    };
+    __m256i zero = _mm256_setzero_si256();
+    __m256i error = zero, prev_input = zero, prev_incomplete = zero, high_bits = zero;
+
+    for (size_t i = 0; i < len; i += 32) {
+        __m256i input;
+        if (i + 32 <= len) {
+            input = _mm256_loadu_si256((const __m256i *)(s + i));
+        } else {
+            char tail[32] = {0};
+            memcpy(tail, s + i, len - i);
+            input = _mm256_loadu_si256((const __m256i *)tail);
+        }
+
+        if (_mm256_movemask_epi8(input) == 0) {
+            error = _mm256_or_si256(error, prev_incomplete);
+            prev_incomplete = zero;
+        } else {
+            high_bits = _mm256_or_si256(high_bits, input);
+            error = _mm256_or_si256(error, avx2_utf8_errors(&t, input, prev_input));
+            prev_incomplete = _mm256_subs_epu8(input, t.incomplete_max);
+        }
+        prev_input = input;
+    }
+
+    error = _mm256_or_si256(error, prev_incomplete);
+    if (!_mm256_testz_si256(error, error)) return SIMD_UTF8_INVALID;
+    return _mm256_movemask_epi8(high_bits) ? SIMD_UTF8_VALID : SIMD_UTF8_ASCII;
+}
+
+AVX2 static size_t avx2_utf8_count(const char *s, size_t len) {
+    __m256i limit = _mm256_set1_epi8(-65);
+    __m256i zero = _mm256_setzero_si256();
+    size_t  count = 0, i = 0;
+    while (i + 32 <= len) {
+        __m256i counters = zero;
+        for (int round = 0; round < 255 && i + 32 <= len; round++, i += 32) {
+            __m256i block = _mm256_loadu_si256((const __m256i *)(s + i));
+            counters = _mm256_sub_epi8(counters, _mm256_cmpgt_epi8(block, limit));
+        }
+        __m256i sums = _mm256_sad_epu8(counters, zero);
+        count += (size_t)_mm256_extract_epi64(sums, 0) + (size_t)_mm256_extract_epi64(sums, 1) +
+                 (size_t)_mm256_extract_epi64(sums, 2) + (size_t)_mm256_extract_epi64(sums, 3);
+    }
+    _mm256_zeroupper();
+    return count + sse2_utf8_count(s + i, len - i);
+}
+
+static const SimdKernels avx2_kernels = {
+    "avx2",         avx2_find_char,     avx2_find, avx2_eq, avx2_cmp, avx2_count_char,
+    avx2_hash,      avx2_utf8_validate, avx2_utf8_count,
+};
+
+// =========================== [ AVX-512 ] =========================================
+
+#define AVX512 __attribute__((target("avx512f,avx512bw")))
+
+AVX512 static const char *avx512_find_char(const char *hay, size_t len, int ch) {
+    __m512i needle = _mm512_set1_epi8((char)ch);
+    size_t  i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i   block = _mm512_loadu_si512((const void *)(hay + i));
+        __mmask64 mask = _mm512_cmpeq_epi8_mask(block, needle);
+        if (mask) return hay + i + __builtin_ctzll(mask);
+    }
+    _mm256_zeroupper();
+    return avx2_find_char(hay + i, len - i, ch);
+}
+
+AVX512 static const char *avx512_find(const char *hay, size_t hay_len, const char *needle,
+                                      size_t needle_len) {
+    if (needle_len <= 1) {
+        return needle_len ? avx512_find_char(hay, hay_len, needle[0]) : hay;
+    }
+    if (needle_len > hay_len) return NULL;
+
+    __m512i first = _mm512_set1_epi8(needle[0]);
+    __m512i last = _mm512_set1_epi8(needle[needle_len - 1]);
+    size_t  i = 0;
+    for (; i + needle_len - 1 + 64 <= hay_len; i += 64) {
+        __m512i   block_first = _mm512_loadu_si512((const void *)(hay + i));
+        __m512i   block_last = _mm512_loadu_si512((const void *)(hay + i + needle_len - 1));
+        __mmask64 mask = _mm512_cmpeq_epi8_mask(block_first, first) &
+                         _mm512_cmpeq_epi8_mask(block_last, last);
+        while (mask) {
+            unsigned bit = __builtin_ctzll(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, needle_len - 2) == 0) return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    _mm256_zeroupper();
+    return avx2_find(hay + i, hay_len - i, needle, needle_len);
+}
+
+AVX512 static int avx512_cmp(const void *a, const void *b, size_t len) {
+    const unsigned char *pa = a, *pb = b;
+    size_t               i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i   va = _mm512_loadu_si512((const void *)(pa + i));
+        __m512i   vb = _mm512_loadu_si512((const void *)(pb + i));
+        __mmask64 diff = _mm512_cmpneq_epi8_mask(va, vb);
+        if (diff) {
+            unsigned bit = __builtin_ctzll(diff);
+            return (int)pa[i + bit] - (int)pb[i + bit];
+        }
+    }
+    _mm256_zeroupper();
+    return avx2_cmp(pa + i, pb + i, len - i);
+}
+
+AVX512 static int avx512_eq(const void *a, const void *b, size_t len) {
+    const unsigned char *pa = a, *pb = b;
+    size_t               i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i va = _mm512_loadu_si512((const void *)(pa + i));
+        __m512i vb = _mm512_loadu_si512((const void *)(pb + i));
+        if (_mm512_cmpneq_epi8_mask(va, vb)) return 0;
+    }
+    _mm256_zeroupper();
+    return avx2_eq(pa + i, pb + i, len - i);
+}
+
+AVX512 static size_t avx512_count_char(const char *hay, size_t len, int ch) {
+    __m512i needle = _mm512_set1_epi8((char)ch);
+    size_t  count = 0, i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i block = _mm512_loadu_si512((const void *)(hay + i));
+        count += __builtin_popcountll(_mm512_cmpeq_epi8_mask(block, needle));
+    }
+    _mm256_zeroupper();
+    return count + avx2_count_char(hay + i, len - i, ch);
+}
+
+AVX512 static void avx512_accumulate(uint64_t acc[8], const unsigned char *data, size_t blocks) {
+    __m512i lanes = _mm512_loadu_si512((const void *)acc);
+    __m512i secret = _mm512_loadu_si512((const void *)hash_secret);
+    for (size_t b = 0; b < blocks; b++, data += 64) {
+        __m512i d = _mm512_loadu_si512((const void *)data);
+        __m512i k = _mm512_xor_si512(d, secret);
+        __m512i product = _mm512_mul_epu32(k, _mm512_srli_epi64(k, 32));
+        lanes = _mm512_add_epi64(lanes, _mm512_add_epi64(product, d));
+    }
+    _mm512_storeu_si512((void *)acc, lanes);
+}
+
+AVX512 static uint64_t avx512_hash(const void *data, size_t len) {
+    return hash_with(data, len, avx512_accumulate);
+}
+
+AVX512 static size_t avx512_utf8_count(const char *s, size_t len) {
+    __m512i limit = _mm512_set1_epi8(-65);
+    size_t  count = 0, i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i block = _mm512_loadu_si512((const void *)(s + i));
+        count += __builtin_popcountll(_mm512_cmpgt_epi8_mask(block, limit));
+    }
+    return count + avx2_utf8_count(s + i, len - i);
+}
+
+// Validation stays on the AVX2 lookup kernel: pshufb is per 128-bit lane on
+// every width, so 512-bit registers only add cross-lane shuffling
+static const SimdKernels avx512_kernels = {
+    "avx512",    avx512_find_char,  avx512_find, avx512_eq,          avx512_cmp,
+    avx512_count_char, avx512_hash, avx2_utf8_validate, avx512_utf8_count,
+};
+
+const SimdKernels *simd_sse2(void) {
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("sse2")) return NULL;
+    return __builtin_cpu_supports("ssse3") ? &ssse3_kernels : &sse2_kernels;
+}
+
+const SimdKernels *simd_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? &avx2_kernels : NULL;
+}
+
+const SimdKernels *simd_avx512(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+               ? &avx512_kernels
+               : NULL;
+}
+
+#else
+
+const SimdKernels *simd_sse2(void) { return NULL; }
+const SimdKernels *simd_avx2(void) { return NULL; }
+const SimdKernels *simd_avx512(void) { return NULL; }
+
+#endif // SAM_SIMD_X86
+
+// =========================== [ DISPATCH ] =========================================
+
+static const SimdKernels *selected_kernels;
+
+const SimdKernels *simd_kernels(void) {
+    const SimdKernels *kernels = selected_kernels;
+    if (kernels) return kernels;
+
+    kernels = simd_avx512();
+    if (!kernels) kernels = simd_avx2();
+    if (!kernels) kernels = simd_sse2();
+    if (!kernels) kernels = &simd_scalar;
+    selected_kernels = kernels;
+    return kernels;
+}
+
+#ifdef __GNUC__
+// Resolve at startup so the first string call does not pay for cpuid
+__attribute__((constructor)) static void simd_select_at_startup(void) { simd_kernels(); }
+#endif
@@ -0,0 +1,40 @@
+// simd.h - Byte kernels behind the string API, dispatched once by CPU features
+#ifndef SAM_SIMD_H
+#define SAM_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__TINYC__)
+#define SAM_SIMD_X86 1
+#endif
+
+// utf8_validate results
+#define SIMD_UTF8_INVALID 0
+#define SIMD_UTF8_VALID 1
+#define SIMD_UTF8_ASCII 2 // Valid and every byte below 0x80
+
+// One implementation per instruction set; simd_kernels() picks the widest one
+// the CPU supports the first time it is called and keeps it for the process.
+typedef struct {
+    const char *name;
+    const char *(*find_char)(const char *hay, size_t len, int ch);
+    const char *(*find)(const char *hay, size_t hay_len, const char *needle, size_t needle_len);
+    int (*eq)(const void *a, const void *b, size_t len);
+    int (*cmp)(const void *a, const void *b, size_t len);
+    size_t (*count_char)(const char *hay, size_t len, int ch);
+    uint64_t (*hash)(const void *data, size_t len);
+    int (*utf8_validate)(const char *s, size_t len);
+    size_t (*utf8_count)(const char *s, size_t len); // Code points in valid UTF-8
+} SimdKernels;
+
+const SimdKernels *simd_kernels(void);
+
+// Individual tables, exposed so benchmarks can compare them side by side.
+// Entries are NULL when the instruction set is unavailable on this CPU/build.
+extern const SimdKernels simd_scalar;
+const SimdKernels       *simd_sse2(void);
+const SimdKernels       *simd_avx2(void);
+const SimdKernels       *simd_avx512(void);
+
+#endif
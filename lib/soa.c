@@ -0,0 +1,455 @@
+#define _POSIX_C_SOURCE 200809L
+// lib/soa.c - Lower `soa` arrays of structs onto one column per field
+//
+//     struct Particle {                      struct Particle { ... };
+//         double x;                          typedef struct {
+//         double vx;                             double *restrict x;
+//         char name[16];                         double *restrict vx;
+//     };                                         char (*restrict name)[16];
+//                                                size_t length;
+//     soa struct Particle ps[n]       =>         void  *base;
+//     ps[i].x += ps[i].vx * dt                } Particle__soa;
+//     struct Particle p = ps[i]               ... Particle__soa_create, _get, _set, _free
+//     ps[j] = p
+//                                            Particle__soa ps SAM_SOA(Particle) = Particle__soa_create(n, NULL);
+//                                            ps.x[i] += ps.vx[i] * dt;
+//                                            struct Particle p = Particle__soa_get(&ps, i);
+//                                            Particle__soa_set(&ps, j, p);
+//
+// A loop over `ps[i].x` then walks one dense column, which the C compiler
+// can vectorise; the columns are restrict pointers into one zeroed block,
+// each starting on a SOA_ALIGN boundary. The block comes from the
+// function's arena after an `arena(...)` (spilling to the heap once it is
+// full), else from the heap, freed when the declaring block ends. Reading
+// `ps[i]` whole gathers a struct copy, assigning it scatters one; an element
+// has no address, so `&ps[i]` is an error. `ps.length` is the element count.
+// The element type is a `struct` defined earlier in the file.
+#include "common.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_STRUCTS 128
+#define MAX_FIELDS 64
+#define MAX_SOA 128
+#define LINE_SIZE 4096
+
+typedef struct {
+    char type[128];       // Up to the first declarator, `char` in `char *name[4]`
+    char declarator[128]; // `*name[4]`
+    char name[64];
+} Field;
+
+typedef struct {
+    char  name[64]; // The struct tag
+    Field fields[MAX_FIELDS];
+    int   field_count;
+    int   end;  // Line closing the definition
+    int   used; // Declared `soa` somewhere
+} StructDef;
+
+typedef struct {
+    char       name[64];
+    StructDef *def;
+    int        depth; // Brace depth of the declaring block
+} SoaVar;
+
+static StructDef structs[MAX_STRUCTS];
+static int       struct_count;
+static SoaVar    soa_vars[MAX_SOA];
+static int       soa_count;
+
+// =========================== [ HELPERS ] =========================================
+
+static StructDef *find_struct(const char *name) {
+    for (int i = struct_count - 1; i >= 0; i--) {
+        if (strcmp(structs[i].name, name) == 0) return &structs[i];
+    }
+    return NULL;
+}
+
+static SoaVar *find_soa(const char *name, size_t len) {
+    for (int i = soa_count - 1; i >= 0; i--) {
+        if (strlen(soa_vars[i].name) == len && strncmp(soa_vars[i].name, name, len) == 0)
+            return &soa_vars[i];
+    }
+    return NULL;
+}
+
+static const Field *find_field(const StructDef *def, const char *name, size_t len) {
+    for (int i = 0; i < def->field_count; i++) {
+        if (strlen(def->fields[i].name) == len && strncmp(def->fields[i].name, name, len) == 0)
+            return &def->fields[i];
+    }
+    return NULL;
+}
+
+// =========================== [ STRUCTS ] =========================================
+
+// `struct Name {` at the start of a line: copies Name and returns 1
+static int parse_struct_header(const char *line, char *name) {
+    const char *p = match_word(line + strspn(line, " \t"), "struct");
+    if (!p) return 0;
+    size_t len = 0;
+    while (is_ident_char((unsigned char)p[len]))
+        len++;
+    if (len == 0 || len >= 64 || p[len + strspn(p + len, " \t")] != '{') return 0;
+    memcpy(name, p, len);
+    name[len] = '\0';
+    return 1;
+}
+
+// The fields of the struct whose body is lines [first, last)
+static void parse_fields(LineBuffer *buf, int first, int last, StructDef *def) {
+    for (int i = first; i < last; i++) {
+        char line[LINE_SIZE];
+        snprintf(line, sizeof(line), "%s", buf->lines[i]);
+        line[strcspn(line, "\n")] = '\0';
+        char *slash = strstr(line, "//");
+        if (slash) *slash = '\0';
+        trim(line);
+        size_t len = strlen(line);
+        while (len > 0 && line[len - 1] == ';')
+            line[--len] = '\0';
+        if (!line[0]) continue;
+        if (strchr(line, ':') || strchr(line, '{') || strchr(line, '(')) {
+            def->field_count = -1; // Bit-fields and nested definitions have no column
+            return;
+        }
+
+        // `int a, *b`: one column per declarator, each with the type
+        char  type[128] = "", *save;
+        int   declarator = 0;
+        for (char *part = strtok_r(line, ",", &save); part && def->field_count < MAX_FIELDS;
+             part = strtok_r(NULL, ",", &save)) {
+            Field *f = &def->fields[def->field_count];
+            trim(part);
+            if (declarator++ == 0) {
+                // The type is everything before the name and its stars
+                char *q = part + strcspn(part, "[");
+                while (q > part && isspace((unsigned char)q[-1]))
+                    q--;
+                while (q > part && is_ident_char((unsigned char)q[-1]))
+                    q--;
+                while (q > part && (q[-1] == '*' || isspace((unsigned char)q[-1])))
+                    q--;
+                snprintf(type, sizeof(type), "%.*s", (int)(q - part), part);
+                part = q + strspn(q, " \t");
+            }
+            char *end = part + strcspn(part, "[");
+            while (end > part && isspace((unsigned char)end[-1]))
+                end--;
+            char *name = end;
+            while (name > part && is_ident_char((unsigned char)name[-1]))
+                name--;
+            if (name == end || !type[0]) continue;
+            snprintf(f->type, sizeof(f->type), "%s", type);
+            snprintf(f->declarator, sizeof(f->declarator), "%s", part);
+            snprintf(f->name, sizeof(f->name), "%.*s", (int)(end - name), name);
+            def->field_count++;
+        }
+    }
+}
+
+// The column type and helpers for def, after its definition
+static void write_soa_type(FILE *out, const StructDef *def) {
+    const char *name = def->name;
+
+    fprintf(out, "typedef struct {\n");
+    for (int i = 0; i < def->field_count; i++) {
+        // `char *label[4]` has the column `char *(*restrict label)[4]`
+        const Field *f = &def->fields[i];
+        const char  *at = strstr(f->declarator, f->name);
+        int          array = strchr(at, '[') != NULL;
+        fprintf(out, "    %s %.*s%srestrict %s%s%s;\n", f->type, (int)(at - f->declarator), f->declarator,
+                array ? "(*" : "*", f->name, array ? ")" : "", at + strlen(f->name));
+    }
+    fprintf(out, "    size_t length;\n");
+    fprintf(out, "    void  *base; // Heap block to free, NULL in an arena\n");
+    fprintf(out, "} %s__soa;\n", name);
+
+    fprintf(out, "static inline %s__soa %s__soa_create(size_t length, Arena *arena) {\n", name, name);
+    fprintf(out, "    %s__soa s = {0};\n", name);
+    fprintf(out, "    size_t bytes = 0;\n");
+    for (int i = 0; i < def->field_count; i++)
+        fprintf(out, "    bytes += soa_column_bytes(length, sizeof(*s.%s));\n", def->fields[i].name);
+    fprintf(out, "    unsigned char *column = soa_block(arena, bytes, &s.base);\n");
+    for (int i = 0; i < def->field_count; i++) {
+        fprintf(out, "    s.%s = (void *)column;\n", def->fields[i].name);
+        if (i + 1 < def->field_count)
+            fprintf(out, "    column += soa_column_bytes(length, sizeof(*s.%s));\n", def->fields[i].name);
+    }
+    fprintf(out, "    s.length = length;\n");
+    fprintf(out, "    return s;\n}\n");
+
+    fprintf(out, "static inline void %s__soa_free(%s__soa *s) {\n", name, name);
+    fprintf(out, "    soa_release(s->base);\n");
+    fprintf(out, "    s->base = NULL;\n}\n");
+
+    fprintf(out, "static inline struct %s %s__soa_get(const %s__soa *s, size_t i) {\n", name, name, name);
+    fprintf(out, "    struct %s record;\n", name);
+    for (int i = 0; i < def->field_count; i++) {
+        const char *field = def->fields[i].name;
+        fprintf(out, "    memcpy(&record.%s, &s->%s[i], sizeof(record.%s));\n", field, field, field);
+    }
+    fprintf(out, "    return record;\n}\n");
+
+    fprintf(out, "static inline void %s__soa_set(%s__soa *s, size_t i, struct %s record) {\n", name, name,
+            name);
+    for (int i = 0; i < def->field_count; i++) {
+        const char *field = def->fields[i].name;
+        fprintf(out, "    memcpy(&s->%s[i], &record.%s, sizeof(record.%s));\n", field, field, field);
+    }
+    fprintf(out, "}\n");
+}
+
+// `soa [struct] Name var[count]`: the struct, var and count; 0 when line
+// declares no soa array
+static int parse_declaration(const char *line, char *type, char *name, char *count, char *rest) {
+    const char *start = line + strspn(line, " \t");
+    const char *p = match_word(start, "soa");
+    if (!p || p == start + 3 || !is_ident_char((unsigned char)*p)) return 0;
+    const char *after = match_word(p, "struct");
+    if (after) p = after;
+
+    type[0] = name[0] = count[0] = '\0';
+    size_t len = 0;
+    while (is_ident_char((unsigned char)p[len]))
+        len++;
+    snprintf(type, 64, "%.*s", (int)(len < 64 ? len : 0), p);
+    p += len + strspn(p + len, " \t");
+
+    len = 0;
+    while (is_ident_char((unsigned char)p[len]))
+        len++;
+    snprintf(name, 64, "%.*s", (int)(len < 64 ? len : 0), p);
+    p += len + strspn(p + len, " \t");
+
+    if (*p == '[') {
+        int         nesting = 0;
+        const char *close = p;
+        for (; *close; close++) {
+            if (*close == '[') nesting++;
+            if (*close == ']' && --nesting == 0) break;
+        }
+        if (*close == ']') {
+            snprintf(count, 256, "%.*s", (int)(close - p - 1), p + 1);
+            trim(count);
+            p = close + 1;
+        }
+    }
+    snprintf(rest, 256, "%s", p);
+    rest[strcspn(rest, "\n")] = '\0';
+    trim(rest);
+    return 1;
+}
+
+// =========================== [ USES ] =========================================
+
+// Copies text[0, len) to out with each soa array's indexing turned into
+// column indexing, or a gather or scatter of the whole element. Returns the
+// bytes written.
+static size_t rewrite_uses(const char *text, size_t len, int number, char *out, size_t size) {
+    size_t n = 0;
+    int    in_string = 0, in_char = 0;
+
+#define EMIT(c)                                                                                    \
+    do {                                                                                           \
+        if (n + 1 < size) out[n++] = (c);                                                          \
+    } while (0)
+
+    for (size_t i = 0; i < len; i++) {
+        char c = text[i];
+        if (c == '\\' && (in_string || in_char) && i + 1 < len) {
+            EMIT(c);
+            EMIT(text[++i]);
+            continue;
+        }
+        if (c == '"' && !in_char) in_string = !in_string;
+        if (c == '\'' && !in_string) in_char = !in_char;
+        if (in_string || in_char || !is_ident_char((unsigned char)c) ||
+            (i > 0 && is_ident_char((unsigned char)text[i - 1]))) {
+            if (!in_string && !in_char && c == '/' && i + 1 < len && text[i + 1] == '/') {
+                while (i < len)
+                    EMIT(text[i++]);
+                break;
+            }
+            EMIT(c);
+            continue;
+        }
+
+        size_t end = i;
+        while (end < len && is_ident_char((unsigned char)text[end]))
+            end++;
+        SoaVar *var = find_soa(text + i, end - i);
+        int     member = i > 0 && (text[i - 1] == '.' || (i > 1 && text[i - 1] == '>' && text[i - 2] == '-'));
+        size_t  open = end;
+        while (open < len && text[open] == ' ')
+            open++;
+        if (!var || member || open == len || text[open] != '[') {
+            while (i < end)
+                EMIT(text[i++]);
+            i--;
+            continue;
+        }
+
+        size_t close = open + 1;
+        int    nesting = 1;
+        for (; close < len; close++) {
+            if (text[close] == '[') nesting++;
+            if (text[close] == ']' && --nesting == 0) break;
+        }
+        if (close == len) {
+            report(number, "soa: no closing ']' for ", var->name);
+            break;
+        }
+        char index[LINE_SIZE];
+        rewrite_uses(text + open + 1, close - open - 1, number, index, sizeof(index));
+
+        size_t after = close + 1;
+        while (after < len && text[after] == ' ')
+            after++;
+        size_t back = n;
+        while (back > 0 && out[back - 1] == ' ')
+            back--;
+
+        if (after < len && text[after] == '.') {
+            // `ps[i].x` is the column `ps.x[i]`
+            size_t field = after + 1, field_end = field;
+            while (field_end < len && is_ident_char((unsigned char)text[field_end]))
+                field_end++;
+            if (!find_field(var->def, text + field, field_end - field)) {
+                char detail[128];
+                snprintf(detail, sizeof(detail), "%.*s in %s", (int)(field_end - field), text + field, var->name);
+                report(number, "soa: no such field: ", detail);
+            }
+            n += snprintf(out + n, n < size ? size - n : 0, "%s.%.*s[%s]", var->name, (int)(field_end - field),
+                          text + field, index);
+            i = field_end - 1;
+        } else if (back > 0 && out[back - 1] == '&') {
+            report(number, "soa: an element has no address, only its fields do: ", var->name);
+            i = close;
+        } else if (after < len && text[after] == '=' && (after + 1 == len || text[after + 1] != '=')) {
+            // `ps[i] = value;` scatters value over the columns
+            size_t value = after + 1, stop = value;
+            for (nesting = 0; stop < len; stop++) {
+                if (text[stop] == '(' || text[stop] == '[' || text[stop] == '{') nesting++;
+                if (text[stop] == ')' || text[stop] == ']' || text[stop] == '}') nesting--;
+                if (nesting == 0 && text[stop] == ';') break;
+            }
+            char rewritten[LINE_SIZE], *v = rewritten;
+            rewrite_uses(text + value, stop - value, number, rewritten, sizeof(rewritten));
+            v += strspn(v, " \t");
+            n += snprintf(out + n, n < size ? size - n : 0, "%s__soa_set(&%s, %s, %s)", var->def->name, var->name,
+                          index, v);
+            i = stop - 1;
+        } else {
+            // Anything else reads the whole element
+            n += snprintf(out + n, n < size ? size - n : 0, "%s__soa_get(&%s, %s)", var->def->name, var->name,
+                          index);
+            i = close;
+        }
+        if (n >= size) n = size - 1;
+    }
+#undef EMIT
+
+    out[n] = '\0';
+    return n;
+}
+
+// =========================== [ MAIN TRANSFORMATION ] ====================================
+
+int lower_soa_arrays(FILE *in, FILE *out) {
+    LineBuffer buf = {0};
+    char       line[LINE_SIZE], rewritten[LINE_SIZE * 2];
+    char       type[64], name[64], count[256], rest[256];
+
+    pass_errors = 0;
+    struct_count = soa_count = 0;
+    while (fgets(line, sizeof(line), in))
+        push_line(&buf, line);
+
+    // Struct definitions, and which of them soa arrays hold
+    for (int i = 0; i < buf.count; i++) {
+        if (parse_declaration(buf.lines[i], type, name, count, rest)) {
+            StructDef *def = find_struct(type);
+            if (def) def->used = 1;
+            continue;
+        }
+        if (struct_count == MAX_STRUCTS || !parse_struct_header(buf.lines[i], name)) continue;
+        StructDef *def = &structs[struct_count++];
+        memset(def, 0, sizeof(*def));
+        snprintf(def->name, sizeof(def->name), "%s", name);
+        int depth = 0, last = i;
+        for (; last < buf.count; last++) {
+            depth += brace_delta(buf.lines[last]);
+            if (depth == 0) break;
+        }
+        parse_fields(&buf, i + 1, last, def);
+        def->end = last;
+    }
+
+    int  depth = 0;
+    char arena[32] = ""; // Arena of the enclosing function, if any
+    for (int i = 0; i < buf.count; i++) {
+        const char *text = buf.lines[i];
+        int         indent = strspn(text, " \t");
+
+        // The line closing a block frees the soa arrays it declared
+        if (text[indent] == '}') {
+            while (soa_count > 0 && soa_vars[soa_count - 1].depth == depth) {
+                soa_count--;
+                fprintf(out, "%*sSOA_END(%s, %s);\n", indent + 4, "", soa_vars[soa_count].def->name,
+                        soa_vars[soa_count].name);
+            }
+        }
+
+        if (parse_declaration(text, type, name, count, rest)) {
+            StructDef *def = find_struct(type);
+            if (!type[0] || !name[0] || !count[0]) {
+                report(i + 1, "soa: expected `soa struct Name array[count]`, not ", text + indent);
+            } else if (!def) {
+                report(i + 1, "soa: the element type must be a struct defined earlier: ", type);
+            } else if (def->field_count <= 0) {
+                report(i + 1, "soa: a struct with bit-fields or nested definitions has no columns: ", type);
+            } else if (depth == 0) {
+                report(i + 1, "soa: arrays are declared inside functions: ", name);
+            } else if (rest[0] && strcmp(rest, ";") != 0) {
+                report(i + 1, "soa: arrays start zeroed and take no initializer: ", name);
+            } else {
+                char length[LINE_SIZE];
+                rewrite_uses(count, strlen(count), i + 1, length, sizeof(length));
+                fprintf(out, "%*s%s__soa %s SAM_SOA(%s) = %s__soa_create(%s, %s);\n", indent, "", def->name, name,
+                        def->name, def->name, length, arena[0] ? arena : "NULL");
+                if (soa_count < MAX_SOA) {
+                    snprintf(soa_vars[soa_count].name, sizeof(soa_vars[0].name), "%s", name);
+                    soa_vars[soa_count].def = def;
+                    soa_vars[soa_count++].depth = depth;
+                }
+            }
+            continue;
+        }
+
+        // Arrays declared after `arena(...)` take their columns from its arena
+        const char *arena_decl = strstr(text, "Arena *__arena");
+        if (arena_decl && strstr(text, "= arena_create(")) sscanf(arena_decl, "Arena *%31[A-Za-z0-9_]", arena);
+
+        if (soa_count > 0) {
+            rewrite_uses(text, strlen(text), i + 1, rewritten, sizeof(rewritten));
+            fputs(rewritten, out);
+        } else {
+            fputs(text, out);
+        }
+
+        for (int s = 0; s < struct_count; s++) {
+            if (structs[s].end == i && structs[s].used && structs[s].field_count > 0) write_soa_type(out, &structs[s]);
+        }
+
+        depth += brace_delta(text);
+        if (depth == 0) arena[0] = '\0';
+    }
+
+    free_lines(&buf);
+    return pass_errors;
+}
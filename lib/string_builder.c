@@ -0,0 +1,256 @@
+#define _POSIX_C_SOURCE 200809L
+// lib/string_builder.c - Lower self-append loops onto StringBuilder
+//
+//     for (...) {                      StringBuilder __sb_s = string_builder_from(s);
+//         s = string_concat(s, piece)  for (...) {
+//     }                          =>        string_builder_append(&__sb_s, piece);
+//                                      }
+//                                      s = string_builder_finish(&__sb_s);
+//
+// Only variables that are touched by nothing else in the loop are lowered,
+// so the stale value of `s` is never observed while the builder owns the text.
+// Parameters are left alone: the builder would take over the caller's string,
+// and the refcounting passes only release what the function itself declared.
+#include "common.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    char name[128];
+} AppendVar;
+
+// =========================== [ HELPERS ] =========================================
+
+// Count whole-word occurrences of name outside string and char literals
+static int count_ident(const char *line, const char *name) {
+    size_t len = strlen(name);
+    int    count = 0;
+    int    in_string = 0, in_char = 0;
+
+    for (const char *p = line; *p; p++) {
+        if (*p == '\\' && (in_string || in_char) && p[1]) {
+            p++;
+            continue;
+        }
+        if (*p == '"' && !in_char) in_string = !in_string;
+        if (*p == '\'' && !in_string) in_char = !in_char;
+        if (in_string || in_char) continue;
+        if (*p == '/' && p[1] == '/') break;
+
+        if (strncmp(p, name, len) == 0 && !is_ident_char(p[len]) &&
+            (p == line || !is_ident_char(p[-1]))) {
+            count++;
+            p += len - 1;
+        }
+    }
+    return count;
+}
+
+static int is_loop_header(const char *line) {
+    while (isspace((unsigned char)*line))
+        line++;
+    int is_loop = (strncmp(line, "for", 3) == 0 && !is_ident_char(line[3])) ||
+                  (strncmp(line, "while", 5) == 0 && !is_ident_char(line[5]));
+    return is_loop && brace_delta(line) > 0;
+}
+
+// Match "NAME = string_concat(NAME, PIECE);" and extract NAME and PIECE
+static int match_self_append(const char *line, char *name, size_t name_size, char *piece,
+                             size_t piece_size) {
+    const char *p = line;
+    while (isspace((unsigned char)*p))
+        p++;
+
+    const char *name_start = p;
+    while (is_ident_char(*p))
+        p++;
+    size_t name_len = p - name_start;
+    if (name_len == 0 || name_len >= name_size || isdigit((unsigned char)*name_start)) return 0;
+
+    while (isspace((unsigned char)*p))
+        p++;
+    if (*p != '=' || p[1] == '=') return 0;
+    p++;
+    while (isspace((unsigned char)*p))
+        p++;
+
+    if (strncmp(p, "string_concat", 13) != 0) return 0;
+    p += 13;
+    while (isspace((unsigned char)*p))
+        p++;
+    if (*p++ != '(') return 0;
+    while (isspace((unsigned char)*p))
+        p++;
+    if (strncmp(p, name_start, name_len) != 0 || is_ident_char(p[name_len])) return 0;
+    p += name_len;
+    while (isspace((unsigned char)*p))
+        p++;
+    if (*p++ != ',') return 0;
+    while (isspace((unsigned char)*p))
+        p++;
+
+    // PIECE runs to the parenthesis that closes string_concat(
+    const char *piece_start = p;
+    int         depth = 1;
+    int         in_string = 0, in_char = 0;
+    for (; *p; p++) {
+        if (*p == '\\' && (in_string || in_char) && p[1]) {
+            p++;
+            continue;
+        }
+        if (*p == '"' && !in_char) in_string = !in_string;
+        if (*p == '\'' && !in_string) in_char = !in_char;
+        if (in_string || in_char) continue;
+        if (*p == '(') depth++;
+        if (*p == ')' && --depth == 0) break;
+    }
+    if (*p != ')') return 0;
+
+    const char *rest = p + 1;
+    while (isspace((unsigned char)*rest))
+        rest++;
+    if (*rest != ';') return 0;
+    rest++;
+    while (isspace((unsigned char)*rest))
+        rest++;
+    if (*rest != '\0' && strncmp(rest, "//", 2) != 0) return 0;
+
+    size_t piece_len = p - piece_start;
+    while (piece_len > 0 && isspace((unsigned char)piece_start[piece_len - 1]))
+        piece_len--;
+    if (piece_len == 0 || piece_len >= piece_size) return 0;
+
+    memcpy(name, name_start, name_len);
+    name[name_len] = '\0';
+    memcpy(piece, piece_start, piece_len);
+    piece[piece_len] = '\0';
+
+    // The piece itself must not read the variable being appended to
+    return count_ident(piece, name) == 0;
+}
+
+static int find_loop_end(LineBuffer *buf, int header) {
+    int depth = 0;
+    for (int i = header; i < buf->count; i++) {
+        depth += brace_delta(buf->lines[i]);
+        if (depth <= 0) return i;
+    }
+    return -1;
+}
+
+static int has_var(AppendVar *vars, int count, const char *name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(vars[i].name, name) == 0) return 1;
+    }
+    return 0;
+}
+
+// Does name appear in the parameter list of the function enclosing line header?
+static int is_parameter(LineBuffer *buf, int header, const char *name) {
+    int depth = 0, opened = -1;
+    for (int i = 0; i < header; i++) {
+        if (depth == 0 && brace_delta(buf->lines[i]) > 0) opened = i;
+        depth += brace_delta(buf->lines[i]);
+    }
+    if (opened < 0) return 0;
+
+    // The list may sit on the line before a lone "{"
+    int sig = opened;
+    if (!strchr(buf->lines[sig], '(') && sig > 0) sig--;
+    const char *open = strchr(buf->lines[sig], '(');
+    if (!open) return 0;
+    char params[1024];
+    if (!copy_parens(open, params, sizeof(params))) return 0;
+    return count_ident(params, name) > 0;
+}
+
+// Collect variables whose only uses in the loop are self-appends
+static int collect_append_vars(LineBuffer *buf, int header, int end, AppendVar *vars,
+                               int max_vars) {
+    int  count = 0;
+    char name[128];
+    char piece[1024];
+
+    for (int i = header + 1; i < end && count < max_vars; i++) {
+        if (!match_self_append(buf->lines[i], name, sizeof(name), piece, sizeof(piece)))
+            continue;
+        if (has_var(vars, count, name) || is_parameter(buf, header, name)) continue;
+
+        int uses = 0, appends = 0;
+        for (int j = header; j <= end; j++) {
+            uses += count_ident(buf->lines[j], name);
+            char other_name[128];
+            if (j > header && j < end &&
+                match_self_append(buf->lines[j], other_name, sizeof(other_name), piece,
+                                  sizeof(piece)) &&
+                strcmp(other_name, name) == 0) {
+                appends++;
+            }
+        }
+
+        // Each self-append mentions the variable exactly twice
+        if (uses == appends * 2) {
+            strcpy(vars[count++].name, name);
+        }
+    }
+    return count;
+}
+
+static void write_indent(FILE *out, const char *line) {
+    for (const char *p = line; *p == ' ' || *p == '\t'; p++)
+        fputc(*p, out);
+}
+
+// =========================== [ MAIN TRANSFORMATION ] ====================================
+
+void add_string_builders(FILE *in, FILE *out) {
+    LineBuffer buf = {0};
+    char       line[1024];
+    while (fgets(line, sizeof(line), in))
+        push_line(&buf, line);
+
+    int i = 0;
+    while (i < buf.count) {
+        int end = is_loop_header(buf.lines[i]) ? find_loop_end(&buf, i) : -1;
+        if (end < 0) {
+            fputs(buf.lines[i++], out);
+            continue;
+        }
+
+        AppendVar vars[16];
+        int       var_count = collect_append_vars(&buf, i, end, vars, 16);
+        if (var_count == 0) {
+            fputs(buf.lines[i++], out);
+            continue;
+        }
+
+        for (int v = 0; v < var_count; v++) {
+            write_indent(out, buf.lines[i]);
+            fprintf(out, "StringBuilder __sb_%s = string_builder_from(%s);\n", vars[v].name,
+                    vars[v].name);
+        }
+
+        for (int j = i; j <= end; j++) {
+            char name[128];
+            char piece[1024];
+            if (j > i && j < end &&
+                match_self_append(buf.lines[j], name, sizeof(name), piece, sizeof(piece)) &&
+                has_var(vars, var_count, name)) {
+                write_indent(out, buf.lines[j]);
+                fprintf(out, "string_builder_append(&__sb_%s, %s);\n", name, piece);
+            } else {
+                fputs(buf.lines[j], out);
+            }
+        }
+
+        for (int v = 0; v < var_count; v++) {
+            write_indent(out, buf.lines[i]);
+            fprintf(out, "%s = string_builder_finish(&__sb_%s);\n", vars[v].name, vars[v].name);
+        }
+        i = end + 1;
+    }
+
+    free_lines(&buf);
+}
@@ -1,4 +1,5 @@
 // lib/string_transform.c - Complete with fixes
+#include "options.h"
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
@@ -18,7 +19,7 @@ typedef struct {
     int  ident_pos;
 
     // Track string functions to prevent double-wrapping
-    int in_string_func;   // Inside string_create/string_concat/string_substr
+    int in_string_func;   // Inside string_create/string_concat/string_substr/...
     int func_paren_depth; // Parentheses depth in string function
     int skip_next_string; // Skip wrapping next string literal
 
@@ -27,6 +28,19 @@ typedef struct {
     char last_func[32];  // Last function name seen
 } TransformState;
 
+// Runtime functions whose literal arguments are read as plain const char *
+static const char *raw_literal_functions[] = {
+    "string_create", "string_concat", "string_substr", "string_builder_append",
+    "string_builder_append_n", "string_find", "strview_find", "strview_from", "strview_eq",
+    "map_get_cstr", "string_intern", NULL};
+
+static int takes_raw_literals(const char *name) {
+    for (int i = 0; raw_literal_functions[i]; i++) {
+        if (strcmp(name, raw_literal_functions[i]) == 0) return 1;
+    }
+    return 0;
+}
+
 void transform_strings(FILE *in, FILE *out) {
     TransformState state;
     memset(&state, 0, sizeof(TransformState));
@@ -71,9 +85,7 @@ void transform_strings(FILE *in, FILE *out) {
             state.identifier[state.ident_pos] = '\0';
 
             // Check if it's a string function
-            if (strcmp(state.identifier, "string_create") == 0 ||
-                strcmp(state.identifier, "string_concat") == 0 ||
-                strcmp(state.identifier, "string_substr") == 0) {
+            if (takes_raw_literals(state.identifier)) {
                 state.in_string_func = 1;
                 state.func_paren_depth = 0;
                 state.skip_next_string = 1; // Don't wrap next string literal
@@ -137,6 +149,9 @@ void transform_strings(FILE *in, FILE *out) {
                 } else if (state.in_printf_func && strcmp(state.last_func, "printf") == 0) {
                     // printf format string - don't wrap (printf expects char*)
                     fputc('"', out);
+                } else if (sam_options.intern_literals) {
+                    // --intern: literals share one canonical immortal instance
+                    fputs("string_intern(\"", out);
                 } else {
                     // Normal string literal - wrap with string_create
                     fputs("string_create(\"", out);
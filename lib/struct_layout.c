@@ -0,0 +1,717 @@
+#define _POSIX_C_SOURCE 200809L
+// lib/struct_layout.c - Reorder `reorder` struct fields and split off the cold ones
+//
+//     reorder struct Particle {              struct Particle__cold {
+//         char   tag                             char name[64];
+//         double x                               double created;
+//         hot int id                         };
+//         cold char name[64]          =>     struct Particle {
+//         cold double created                    int id;
+//         double y                               double x;
+//     }                                          double y;
+//                                                char tag;
+//     printf("%s", ps[i].name)                   struct Particle__cold *__cold;
+//                                            };
+//                                            ...
+//                                            printf("%s", Particle__cold_of(&ps[i])->name);
+//
+// `reorder` (or `packed_layout`) lets the transpiler order the fields: `hot`
+// ones first, so they share the first cache line, then the rest, each group
+// by decreasing alignment, which leaves the least padding C's layout rules
+// allow. `cold` fields move to a side struct reached through one pointer,
+// calloc'ed on first use by Particle__cold_of.
+//
+// That pointer has to start out NULL, so every instance must start zeroed:
+// a local needs an initializer (`= {0}` will do), a heap one comes from
+// calloc, and statics are zeroed anyway. The pass reports a local without an
+// initializer and a malloc or realloc of `sizeof(struct Particle)`, also for
+// structs holding a Particle by value and for typedefs of them; it cannot see
+// through `malloc(sizeof *p)`. The program owns the cold part:
+// Particle_free_cold(&p) frees it, once per instance. A copy of the struct
+// shares the cold part, so only one of the copies may free it.
+//
+// Every `.name` and `->name` of a cold field in the file goes through
+// Particle__cold_of, so cold field names must not be used by other structs.
+// Each struct's size before and after is reported on stderr.
+//
+// Sizes are those of x86-64: the scalar types, pointers (and strings and
+// rc struct handles), arrays whose lengths are constants or comptime names,
+// and structs declared earlier in the file. A field of any other type keeps
+// its place at the front and the size is reported as unknown. `reorder rc
+// struct` reorders an rc struct's fields but cannot split them.
+#include "common.h"
+#include "comptime.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_STRUCTS 128
+#define MAX_FIELDS 64
+#define MAX_COLD 256
+#define LINE_SIZE 8192
+
+typedef struct {
+    char name[64];
+    int  size; // 0 when unknown
+    int  align;
+} Layout;
+
+typedef struct {
+    char text[256];    // `type declarator`, without the annotation or `;`
+    char comment[512]; // Comment lines before it and a trailing comment
+    char name[64];
+    int  size; // 0 when unknown
+    int  align;
+    int  hot;
+    int  cold;
+    int  order; // Position as declared
+} Field;
+
+typedef struct {
+    char name[64];  // The cold field
+    char owner[64]; // Its struct
+    int  line;
+} ColdField;
+
+typedef struct {
+    char name[64];
+    int  is_typedef; // A typedef name rather than a struct tag
+} ZeroedType;
+
+static Layout     layouts[MAX_STRUCTS];
+static int        layout_count;
+static ColdField  cold_fields[MAX_COLD];
+static int        cold_count;
+static ZeroedType zeroed[MAX_STRUCTS]; // Types whose instances must start zeroed
+static int        zeroed_count;
+
+// =========================== [ HELPERS ] =========================================
+
+static Layout *find_layout(const char *name) {
+    for (int i = layout_count - 1; i >= 0; i--) {
+        if (strcmp(layouts[i].name, name) == 0) return &layouts[i];
+    }
+    return NULL;
+}
+
+static void add_layout(const char *name, int size, int align) {
+    if (layout_count == MAX_STRUCTS) return;
+    snprintf(layouts[layout_count].name, sizeof(layouts[0].name), "%s", name);
+    layouts[layout_count].size = size;
+    layouts[layout_count++].align = align;
+}
+
+static const ColdField *find_cold(const char *name, size_t len) {
+    for (int i = 0; i < cold_count; i++) {
+        if (strlen(cold_fields[i].name) == len && strncmp(cold_fields[i].name, name, len) == 0)
+            return &cold_fields[i];
+    }
+    return NULL;
+}
+
+// `[attribute] [rc] struct Name {`: copies Name; returns 2 with `reorder` or
+// `packed_layout` in front, 1 for any other struct definition
+static int parse_header(const char *line, char *name, size_t size, int *is_rc) {
+    const char *p = line + strspn(line, " \t");
+    const char *after = match_word(p, "reorder");
+    if (!after) after = match_word(p, "packed_layout");
+    int reorder = after != NULL;
+    if (reorder) p = after;
+    after = match_word(p, "rc");
+    *is_rc = after != NULL;
+    if (after) p = after;
+    p = match_word(p, "struct");
+    if (!p) return 0;
+
+    size_t len = 0;
+    while (is_ident_char((unsigned char)p[len]))
+        len++;
+    if (len == 0 || len >= size || p[len + strspn(p + len, " \t")] != '{') return 0;
+    memcpy(name, p, len);
+    name[len] = '\0';
+    return reorder ? 2 : 1;
+}
+
+// =========================== [ SIZES ] =========================================
+
+static const struct {
+    const char *name;
+    int         size;
+} scalar_types[] = {
+    {"char", 1},      {"bool", 1},     {"_Bool", 1},    {"int8_t", 1},    {"uint8_t", 1},
+    {"short", 2},     {"int16_t", 2},  {"uint16_t", 2}, {"int", 4},       {"float", 4},
+    {"int32_t", 4},   {"uint32_t", 4}, {"long", 8},     {"double", 8},    {"int64_t", 8},
+    {"uint64_t", 8},  {"size_t", 8},   {"ssize_t", 8},  {"intptr_t", 8},  {"uintptr_t", 8},
+    {"ptrdiff_t", 8}, {"string", 8},   {"own_string", 8},
+};
+
+// Size and alignment of a type written without its declarator; 0 when unknown
+static int type_size(const char *type, int *align) {
+    char words[256];
+    snprintf(words, sizeof(words), "%s", type);
+    if (strchr(words, '*')) return *align = 8;
+
+    int size = 0, longs = 0, is_struct = 0, any = 0;
+    char *save;
+    for (char *word = strtok_r(words, " \t", &save); word; word = strtok_r(NULL, " \t", &save)) {
+        if (!strcmp(word, "const") || !strcmp(word, "volatile") || !strcmp(word, "signed")) continue;
+        if (!strcmp(word, "unsigned")) {
+            any = 1;
+            continue;
+        }
+        if (!strcmp(word, "struct")) {
+            is_struct = 1;
+            continue;
+        }
+        if (!strcmp(word, "long")) {
+            longs++;
+            continue;
+        }
+        Layout *layout = find_layout(word);
+        if (layout) {
+            *align = layout->align;
+            return layout->size;
+        }
+        if (is_struct) return 0;
+        size = 0;
+        for (size_t i = 0; i < sizeof(scalar_types) / sizeof(scalar_types[0]); i++) {
+            if (strcmp(word, scalar_types[i].name) == 0) size = scalar_types[i].size;
+        }
+        if (!size) return 0;
+        any = 1;
+    }
+    if (!any && !longs) return 0;
+    if (longs && size == 8) size = 16; // long double
+    else if (longs || !size) size = longs ? 8 : 4;
+    *align = size;
+    return size;
+}
+
+// Splits `type *name[4]` into f's name, size and alignment; number 0 for
+// a struct that is only measured, whose odd fields are its author's business
+static void measure_field(Field *f, int number) {
+    char text[256];
+    snprintf(text, sizeof(text), "%s", f->text);
+    f->size = 0;
+    f->align = 16; // Unknown types go first, in their own order
+
+    char *bracket = strchr(text, '[');
+    char *end = bracket ? bracket : text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1]))
+        end--;
+    char *name = end;
+    while (name > text && is_ident_char((unsigned char)name[-1]))
+        name--;
+    if (name == end || name == text) {
+        if (number) report(number, "struct layout: expected a field, not ", f->text);
+        return;
+    }
+    snprintf(f->name, sizeof(f->name), "%.*s", (int)(end - name), name);
+    *name = '\0';
+
+    int align = 0, size = type_size(text, &align);
+    for (char *p = bracket; size && p && *p == '['; p = strchr(p, '[')) {
+        char *close = strchr(p, ']');
+        if (!close) return;
+        char expr[128];
+        snprintf(expr, sizeof(expr), "%.*s", (int)(close - p - 1), p + 1);
+        ComptimeValue length;
+        if (!comptime_eval(expr, &length) || length.is_float || length.i <= 0) return;
+        size *= (int)length.i;
+        p = close + 1;
+    }
+    if (size) {
+        f->size = size;
+        f->align = align;
+    }
+}
+
+// Size of fields laid out in the given order, with the struct's alignment
+static int layout_size(Field **fields, int count, int extra_pointer, int *align) {
+    int offset = 0;
+    *align = 1;
+    for (int i = 0; i < count + extra_pointer; i++) {
+        int size = i < count ? fields[i]->size : 8, a = i < count ? fields[i]->align : 8;
+        if (!size) return 0;
+        offset = (offset + a - 1) / a * a + size;
+        if (a > *align) *align = a;
+    }
+    return offset == 0 ? 0 : (offset + *align - 1) / *align * *align;
+}
+
+// Hot before the rest, then decreasing alignment, then as declared
+static int field_order(const void *a, const void *b) {
+    const Field *x = *(Field *const *)a, *y = *(Field *const *)b;
+    if (x->hot != y->hot) return y->hot - x->hot;
+    if (x->align != y->align) return y->align - x->align;
+    return x->order - y->order;
+}
+
+// =========================== [ STRUCTS ] =========================================
+
+// The fields of the struct whose body is lines [first, last): annotations
+// and declarator lists split out, comment lines kept with the next field.
+// Errors are reported when strict, for a struct to be reordered.
+static int parse_fields(LineBuffer *buf, int first, int last, Field *fields, int strict) {
+    int  count = 0;
+    char pending[256] = "";
+
+    for (int i = first; i < last; i++) {
+        char line[LINE_SIZE], comment[256] = "";
+        snprintf(line, sizeof(line), "%s", buf->lines[i]);
+        line[strcspn(line, "\n")] = '\0';
+        char *slash = strstr(line, "//");
+        if (slash) {
+            snprintf(comment, sizeof(comment), "%s", slash);
+            *slash = '\0';
+        }
+        trim(line);
+        size_t len = strlen(line);
+        while (len > 0 && line[len - 1] == ';')
+            line[--len] = '\0';
+        trim(line);
+        if (!line[0]) {
+            if (comment[0]) {
+                size_t used = strlen(pending);
+                snprintf(pending + used, sizeof(pending) - used, "%s\n", comment);
+            }
+            continue;
+        }
+        if (strchr(line, ':') || strchr(line, '{') || strchr(line, '(')) {
+            if (!strict) return 0; // Its size is unknown
+            report(i + 1, "struct layout: cannot reorder bit-fields or nested definitions: ", line);
+            continue;
+        }
+
+        int         hot = 0, cold = 0;
+        const char *p = line, *after;
+        while ((after = match_word(p, "hot")) || (after = match_word(p, "cold"))) {
+            if (p[0] == 'h') hot = 1;
+            else cold = 1;
+            p = after;
+        }
+        if (hot && cold && strict) report(i + 1, "struct layout: a field cannot be hot and cold: ", p);
+
+        // `int a, *b`: one field per declarator, each with the type
+        char type[128] = "";
+        char list[LINE_SIZE];
+        snprintf(list, sizeof(list), "%s", p);
+        int declarator = 0;
+        char *save;
+        for (char *part = strtok_r(list, ",", &save); part && count < MAX_FIELDS; part = strtok_r(NULL, ",", &save)) {
+            Field *f = &fields[count];
+            memset(f, 0, sizeof(*f));
+            trim(part);
+            if (declarator++ == 0) {
+                // The type is everything before the name and its stars
+                char *q = part + strcspn(part, "[");
+                while (q > part && isspace((unsigned char)q[-1]))
+                    q--;
+                while (q > part && is_ident_char((unsigned char)q[-1]))
+                    q--;
+                while (q > part && (q[-1] == '*' || isspace((unsigned char)q[-1])))
+                    q--;
+                snprintf(type, sizeof(type), "%.*s", (int)(q - part), part);
+                snprintf(f->text, sizeof(f->text), "%s", part);
+            } else {
+                snprintf(f->text, sizeof(f->text), "%s %s", type, part);
+            }
+            snprintf(f->comment, sizeof(f->comment), "%s%s", declarator == 1 ? pending : "", comment);
+            f->hot = hot;
+            f->cold = cold;
+            f->order = count;
+            measure_field(f, strict ? i + 1 : 0);
+            count++;
+        }
+        pending[0] = '\0';
+    }
+    return count;
+}
+
+static void write_field(FILE *out, const char *indent, const Field *f) {
+    const char *comment = f->comment;
+    const char *newline;
+    while ((newline = strchr(comment, '\n'))) {
+        fprintf(out, "%s%.*s\n", indent, (int)(newline - comment), comment);
+        comment = newline + 1;
+    }
+    fprintf(out, "%s%s;%s%s\n", indent, f->text, comment[0] ? " " : "", comment);
+}
+
+// Writes the reordered struct, and its cold part and accessors when it has
+// one. Lines [first, last) are the body.
+static void write_struct(FILE *out, const char *name, int is_rc, LineBuffer *buf, int first, int last) {
+    Field  fields[MAX_FIELDS];
+    Field *order[MAX_FIELDS], *hot[MAX_FIELDS], *cold[MAX_FIELDS];
+    int    saved = pass_errors, hot_count = 0, cold_count_here = 0;
+    int    count = parse_fields(buf, first, last, fields, 1);
+    if (pass_errors > saved) return;
+
+    for (int i = 0; i < count; i++) {
+        order[i] = &fields[i];
+        if (fields[i].cold)
+            cold[cold_count_here++] = &fields[i];
+        else
+            hot[hot_count++] = &fields[i];
+    }
+    if (is_rc && cold_count_here > 0) {
+        report(first, "struct layout: rc structs cannot have cold fields: ", name);
+        return;
+    }
+    int before_align, after_align, cold_align;
+    int before = layout_size(order, count, 0, &before_align);
+    qsort(hot, hot_count, sizeof(Field *), field_order);
+    qsort(cold, cold_count_here, sizeof(Field *), field_order);
+    int after = layout_size(hot, hot_count, cold_count_here > 0, &after_align);
+    int cold_size = layout_size(cold, cold_count_here, 0, &cold_align);
+
+    const char *line = buf->lines[first - 1];
+    char        indent[64], inner[80];
+    snprintf(indent, sizeof(indent), "%.*s", (int)strspn(line, " \t"), line);
+    snprintf(inner, sizeof(inner), "%s    ", indent);
+
+    if (cold_count_here > 0) {
+        fprintf(out, "%sstruct %s__cold {\n", indent, name);
+        for (int i = 0; i < cold_count_here; i++)
+            write_field(out, inner, cold[i]);
+        fprintf(out, "%s};\n", indent);
+    }
+    fprintf(out, "%s%sstruct %s {\n", indent, is_rc ? "rc " : "", name);
+    for (int i = 0; i < hot_count; i++)
+        write_field(out, inner, hot[i]);
+    if (cold_count_here > 0) {
+        fprintf(out, "%sstruct %s__cold *__cold; // Cold fields, allocated on first use\n", inner, name);
+        fprintf(out, "%s}%s\n", indent, is_rc ? "" : ";");
+        fprintf(out, "%sstatic inline struct %s__cold *%s__cold_of(struct %s *p) {\n", indent, name, name, name);
+        fprintf(out, "%s    if (!p->__cold) p->__cold = calloc(1, sizeof(struct %s__cold));\n", indent, name);
+        fprintf(out, "%s    return p->__cold;\n%s}\n", indent, indent);
+        fprintf(out, "%sstatic inline void %s_free_cold(struct %s *p) {\n", indent, name, name);
+        fprintf(out, "%s    free(p->__cold);\n%s    p->__cold = NULL;\n%s}\n", indent, indent, indent);
+    } else {
+        fprintf(out, "%s}%s\n", indent, is_rc ? "" : ";");
+    }
+
+    if (!is_rc) add_layout(name, after, after_align);
+    if (before && after) {
+        fprintf(stderr, "Struct layout: %s %d -> %d bytes", name, before, after);
+        if (cold_count_here > 0) fprintf(stderr, " + %d cold", cold_size);
+        fprintf(stderr, "\n");
+    } else {
+        fprintf(stderr, "Struct layout: %s reordered, size unknown\n", name);
+    }
+}
+
+// =========================== [ ZEROED INSTANCES ] ====================================
+
+// A split struct's __cold must start out NULL, and so must that of a split
+// struct held by value in another one
+
+static void add_zeroed(const char *name, size_t len, int is_typedef) {
+    for (int i = 0; i < zeroed_count; i++) {
+        if (zeroed[i].is_typedef == is_typedef && strlen(zeroed[i].name) == len &&
+            strncmp(zeroed[i].name, name, len) == 0)
+            return;
+    }
+    if (zeroed_count == MAX_STRUCTS || len >= sizeof(zeroed[0].name)) return;
+    snprintf(zeroed[zeroed_count].name, sizeof(zeroed[0].name), "%.*s", (int)len, name);
+    zeroed[zeroed_count++].is_typedef = is_typedef;
+}
+
+// The type at p when it is one that must start zeroed (`struct Rec`, or a
+// typedef of it), with *after set past it; NULL for any other type
+static const char *zeroed_type(const char *p, const char **after) {
+    const char *tag = match_word(p, "struct");
+    const char *name = tag ? tag : p;
+    size_t      len = 0;
+    while (is_ident_char((unsigned char)name[len]))
+        len++;
+    for (int i = 0; len && i < zeroed_count; i++) {
+        if (zeroed[i].is_typedef == !tag && strlen(zeroed[i].name) == len &&
+            strncmp(zeroed[i].name, name, len) == 0) {
+            *after = name + len;
+            return zeroed[i].name;
+        }
+    }
+    return NULL;
+}
+
+// The zeroed type a declaration line gives its instances, with *declarators
+// set to what follows the type; NULL when the line declares none, or only
+// static or extern ones
+static const char *declared_zeroed(const char *line, const char **declarators) {
+    const char *p = line + strspn(line, " \t"), *after;
+    if (match_word(p, "static") || match_word(p, "extern") || match_word(p, "typedef")) return NULL;
+    while ((after = match_word(p, "const")) || (after = match_word(p, "volatile")) ||
+           (after = match_word(p, "register")))
+        p = after;
+    return zeroed_type(p, declarators);
+}
+
+// Whether declarators declares an instance with no initializer, whose name
+// goes to name: `r` and `rs[4]` are ones, `*p`, `make(void)` and `r = {0}` not
+static int uninitialised_instance(const char *declarators, char *name, size_t size) {
+    int         depth = 0;
+    const char *start = declarators;
+    for (const char *p = declarators;; p++) {
+        if (*p == '(' || *p == '{' || *p == '[') depth++;
+        if (*p == ')' || *p == '}' || *p == ']') depth--;
+        if (*p && *p != ';' && *p != '\n' && !(*p == '/' && p[1] == '/') && (*p != ',' || depth > 0))
+            continue;
+
+        const char *d = start + strspn(start, " \t");
+        size_t      len = 0;
+        while (is_ident_char((unsigned char)d[len]))
+            len++;
+        const char *rest = d + len + strspn(d + len, " \t");
+        int         initialised = *rest == '(';
+        for (const char *q = rest; q < p; q++)
+            initialised |= *q == '=';
+        if (len && !initialised) {
+            snprintf(name, size, "%.*s", (int)len, d);
+            return 1;
+        }
+        if (*p != ',') return 0;
+        start = p + 1;
+    }
+}
+
+// The zeroed type T when line mallocs or reallocs `sizeof(T)`, else NULL
+static const char *malloced_zeroed(const char *line) {
+    for (const char *p = strstr(line, "sizeof"); p; p = strstr(p + 6, "sizeof")) {
+        const char *operand = p + 6, *after;
+        operand += strspn(operand, " \t");
+        if (*operand != '(') continue;
+        operand += 1 + strspn(operand + 1, " \t");
+        const char *type = zeroed_type(operand, &after);
+        if (type && (strstr(line, "malloc") || strstr(line, "realloc"))) return type;
+    }
+    return NULL;
+}
+
+// Records typedefs of the split structs, and the structs holding one by value
+static void find_zeroed_types(const LineBuffer *buf) {
+    char name[64], instance[64];
+    int  is_rc;
+    for (int c = 0; c < cold_count; c++)
+        add_zeroed(cold_fields[c].owner, strlen(cold_fields[c].owner), 0);
+
+    for (int before = -1; before != zeroed_count;) {
+        before = zeroed_count;
+        for (int i = 0; i < buf->count; i++) {
+            const char *p = buf->lines[i] + strspn(buf->lines[i], " \t"), *after;
+            const char *tag = match_word(p, "typedef");
+            if (tag && zeroed_type(tag, &after)) {
+                after += strspn(after, " \t");
+                size_t len = 0;
+                while (is_ident_char((unsigned char)after[len]))
+                    len++;
+                if (len) add_zeroed(after, len, 1);
+                continue;
+            }
+            if (!parse_header(buf->lines[i], name, sizeof(name), &is_rc)) continue;
+            for (int j = i + 1; j < buf->count && buf->lines[j][strspn(buf->lines[j], " \t")] != '}'; j++) {
+                const char *declarators;
+                if (declared_zeroed(buf->lines[j], &declarators) &&
+                    uninitialised_instance(declarators, instance, sizeof(instance)))
+                    add_zeroed(name, strlen(name), 0);
+            }
+        }
+    }
+}
+
+// Reports instances of a zeroed type whose __cold would start out as garbage
+static void check_zeroed_instances(const char *line, int number, int depth) {
+    const char *declarators, *type;
+    char        instance[64];
+    if (depth > 0 && (type = declared_zeroed(line, &declarators)) &&
+        uninitialised_instance(declarators, instance, sizeof(instance))) {
+        char detail[160];
+        snprintf(detail, sizeof(detail), "%s (%s)", instance, type);
+        report(number, "struct layout: a local holding cold fields needs an initializer such as {0}: ",
+               detail);
+    }
+    if ((type = malloced_zeroed(line)))
+        report(number, "struct layout: allocate a struct holding cold fields with calloc, not malloc: ",
+               type);
+}
+
+// =========================== [ COLD ACCESS ] =========================================
+
+// Copies line to out with each `.field` and `->field` of a cold field going
+// through its struct's __cold_of
+static void route_cold_fields(const char *line, int number, char *out, size_t size) {
+    size_t n = 0;
+    int    in_string = 0, in_char = 0;
+
+    for (const char *p = line; *p && n + 1 < size;) {
+        if (*p == '\\' && (in_string || in_char) && p[1]) {
+            out[n++] = *p++;
+            if (n + 1 < size) out[n++] = *p++;
+            continue;
+        }
+        if (*p == '"' && !in_char) in_string = !in_string;
+        if (*p == '\'' && !in_string) in_char = !in_char;
+        if (!in_string && !in_char && p[0] == '/' && p[1] == '/') {
+            n += snprintf(out + n, size - n, "%s", p);
+            break;
+        }
+
+        int arrow = p[0] == '-' && p[1] == '>';
+        const ColdField *cold = NULL;
+        const char      *field = p + (arrow ? 2 : 1);
+        size_t           len = 0;
+        if (!in_string && !in_char && (arrow || (p[0] == '.' && !isdigit((unsigned char)p[1])))) {
+            while (is_ident_char((unsigned char)field[len]))
+                len++;
+            cold = len ? find_cold(field, len) : NULL;
+        }
+        if (!cold) {
+            out[n++] = *p++;
+            continue;
+        }
+
+        // The object: names, indexing, calls and member accesses back from here
+        size_t start = n;
+        for (;;) {
+            char c = start > 0 ? out[start - 1] : '\0';
+            if (c == ']' || c == ')') {
+                char open = c == ']' ? '[' : '(';
+                int  nesting = 0;
+                while (start > 0) {
+                    char d = out[--start];
+                    if (d == c) nesting++;
+                    if (d == open && --nesting == 0) break;
+                }
+                continue;
+            }
+            if (!is_ident_char((unsigned char)c)) break;
+            while (start > 0 && is_ident_char((unsigned char)out[start - 1]))
+                start--;
+            if (start > 0 && out[start - 1] == '.') {
+                start--;
+                continue;
+            }
+            if (start > 1 && out[start - 1] == '>' && out[start - 2] == '-') {
+                start -= 2;
+                continue;
+            }
+            break;
+        }
+        if (start == n) {
+            report(number, "struct layout: a cold field needs its object: ", cold->name);
+            out[n++] = *p++;
+            continue;
+        }
+
+        char object[LINE_SIZE];
+        snprintf(object, sizeof(object), "%.*s", (int)(n - start), out + start);
+        n = start;
+        n += snprintf(out + n, size - n, "%s__cold_of(%s%s)->%s", cold->owner, arrow ? "" : "&", object,
+                      cold->name);
+        if (n >= size) n = size - 1;
+        p = field + len;
+    }
+    out[n < size ? n : size - 1] = '\0';
+}
+
+// =========================== [ MAIN TRANSFORMATION ] ====================================
+
+int layout_structs(FILE *in, FILE *out) {
+    LineBuffer buf = {0};
+    char       line[LINE_SIZE], name[64];
+    int        is_rc;
+
+    pass_errors = 0;
+    layout_count = cold_count = 0;
+    while (fgets(line, sizeof(line), in))
+        push_line(&buf, line);
+
+    // Cold fields first, so uses before the struct route too; every other
+    // struct's field names, which a cold field must not share
+    char (*other_fields)[64] = malloc(sizeof(char[64]) * MAX_STRUCTS * MAX_FIELDS);
+    int   other_count = 0;
+    for (int i = 0; i < buf.count; i++) {
+        int kind = parse_header(buf.lines[i], name, sizeof(name), &is_rc);
+        if (!kind) continue;
+        for (int j = i + 1; j < buf.count && buf.lines[j][strspn(buf.lines[j], " \t")] != '}'; j++) {
+            Field f = {0};
+            char  text[LINE_SIZE];
+            snprintf(text, sizeof(text), "%s", buf.lines[j]);
+            text[strcspn(text, ";/\n")] = '\0';
+            trim(text);
+            const char *p = text, *after;
+            while ((after = match_word(p, "hot")) || (after = match_word(p, "cold"))) {
+                f.cold |= p[0] == 'c';
+                p = after;
+            }
+            const char *end = p + strcspn(p, "[");
+            while (end > p && isspace((unsigned char)end[-1]))
+                end--;
+            const char *field = end;
+            while (field > p && is_ident_char((unsigned char)field[-1]))
+                field--;
+            if (field == end) continue;
+            if (kind == 2 && f.cold && !is_rc && cold_count < MAX_COLD) {
+                snprintf(cold_fields[cold_count].name, 64, "%.*s", (int)(end - field), field);
+                snprintf(cold_fields[cold_count].owner, 64, "%s", name);
+                cold_fields[cold_count++].line = j + 1;
+            } else if (other_count < MAX_STRUCTS * MAX_FIELDS) {
+                snprintf(other_fields[other_count++], 64, "%.*s", (int)(end - field), field);
+            }
+        }
+    }
+    for (int c = 0; c < cold_count; c++) {
+        for (int o = 0; o < other_count; o++) {
+            if (strcmp(cold_fields[c].name, other_fields[o]) == 0)
+                report(cold_fields[c].line, "struct layout: a cold field's name must be its own: ", cold_fields[c].name);
+        }
+        for (int d = 0; d < c; d++) {
+            if (strcmp(cold_fields[c].name, cold_fields[d].name) == 0)
+                report(cold_fields[c].line, "struct layout: a cold field's name must be its own: ", cold_fields[c].name);
+        }
+    }
+    free(other_fields);
+    zeroed_count = 0;
+    find_zeroed_types(&buf);
+
+    char rewritten[LINE_SIZE];
+    int  depth = 0, counted = 0; // Brace depth before line `counted`
+    for (int i = 0; i < buf.count; i++) {
+        int kind = parse_header(buf.lines[i], name, sizeof(name), &is_rc);
+        if (kind == 0) {
+            for (; counted < i; counted++)
+                depth += brace_delta(buf.lines[counted]);
+            check_zeroed_instances(buf.lines[i], i + 1, depth);
+            route_cold_fields(buf.lines[i], i + 1, rewritten, sizeof(rewritten));
+            fputs(rewritten, out);
+            continue;
+        }
+        int last = i + 1;
+        while (last < buf.count && buf.lines[last][strspn(buf.lines[last], " \t")] != '}')
+            last++;
+        if (kind == 2) {
+            write_struct(out, name, is_rc, &buf, i + 1, last);
+            i = last;
+            continue;
+        }
+
+        // Any other struct is copied, and measured for the ones that hold it
+        Field  fields[MAX_FIELDS];
+        Field *order[MAX_FIELDS];
+        int    align;
+        int    count = is_rc ? 0 : parse_fields(&buf, i + 1, last, fields, 0);
+        for (int f = 0; f < count; f++)
+            order[f] = &fields[f];
+        int size = layout_size(order, count, 0, &align);
+        if (!is_rc) add_layout(name, size, align);
+        for (int j = i; j < last && j < buf.count; j++) {
+            route_cold_fields(buf.lines[j], j + 1, rewritten, sizeof(rewritten));
+            fputs(rewritten, out);
+        }
+        i = last - 1;
+    }
+
+    free_lines(&buf);
+    return pass_errors;
+}
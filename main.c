@@ -1,4 +1,6 @@
 // main.c - Updated with proper file handling
+#include "options.h"
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,9 +9,26 @@
 
 // Function declarations
 void add_semicolons(FILE *in, FILE *out);
+int  evaluate_comptime(FILE *in, FILE *out);
+int  lower_generics(FILE *in, FILE *out);
+int  layout_structs(FILE *in, FILE *out);
+void add_rc_structs(FILE *in, FILE *out);
 void transform_strings(FILE *in, FILE *out);
 void add_refcounting(FILE *in, FILE *out);
 void add_arena_support(FILE *in, FILE *out);
+int  lower_iterators(FILE *in, FILE *out);
+void add_arrays(FILE *in, FILE *out);
+int  lower_soa_arrays(FILE *in, FILE *out);
+int  add_parallel_loops(FILE *in, FILE *out);
+void add_string_builders(FILE *in, FILE *out);
+int  lower_owned_strings(FILE *in, FILE *out);
+int  add_release_pools(FILE *in, FILE *out);
+void elide_refcounts(FILE *in, FILE *out);
+int  lower_async_functions(FILE *in, FILE *out);
+int  lower_memo_functions(FILE *in, FILE *out);
+
+SamOptions sam_options;
+
 // Helper to ensure directory exists
 int ensure_dir(const char *path) {
     struct stat st = {0};
@@ -25,136 +44,4702 @@ int ensure_dir(const char *path) {
 
 // Inline runtime (same as before, includes arena functions)
 static const char *inline_runtime =
+    "#include <ctype.h>\n"
+    "#include <stdint.h>\n"
     "#include <stdio.h>\n"
     "#include <stdlib.h>\n"
     "#include <string.h>\n"
     "\n"
-    "// ========== ARENA ALLOCATOR ==========\n"
-    "typedef struct Arena Arena;\n"
-    "struct Arena {\n"
-    "    unsigned char *buffer;\n"
-    "    size_t offset;\n"
-    "    size_t capacity;\n"
-    "    int is_dynamic;\n"
-    "};\n"
+    "// ========== ARENA ALLOCATOR ==========\n"
+    "typedef struct Arena Arena;\n"
+    "struct Arena {\n"
+    "    unsigned char *buffer;\n"
+    "    size_t offset;\n"
+    "    size_t capacity;\n"
+    "    int is_dynamic;\n"
+    "};\n"
+    "\n"
+    "Arena *arena_create(size_t capacity) {\n"
+    "    Arena *arena = malloc(sizeof(Arena));\n"
+    "    if (!arena) return NULL;\n"
+    "    arena->buffer = malloc(capacity);\n"
+    "    if (!arena->buffer) { free(arena); return NULL; }\n"
+    "    arena->offset = 0;\n"
+    "    arena->capacity = capacity;\n"
+    "    arena->is_dynamic = 1;\n"
+    "    return arena;\n"
+    "}\n"
+    "\n"
+    "void arena_destroy(Arena *arena) {\n"
+    "    if (!arena) return;\n"
+    "    if (arena->is_dynamic && arena->buffer) free(arena->buffer);\n"
+    "    free(arena);\n"
+    "}\n"
+    "\n"
+    "void arena_reset(Arena *arena) {\n"
+    "    if (arena) arena->offset = 0;\n"
+    "}\n"
+    "\n"
+    "void *arena_try_alloc(Arena *arena, size_t size) {\n"
+    "    if (!arena || size == 0) return NULL;\n"
+    "    size = (size + 7) & ~7; // Align to 8 bytes\n"
+    "    if (arena->offset + size > arena->capacity) return NULL;\n"
+    "    void *ptr = arena->buffer + arena->offset;\n"
+    "    arena->offset += size;\n"
+    "    return ptr;\n"
+    "}\n"
+    "\n"
+    "void *arena_alloc(Arena *arena, size_t size) {\n"
+    "    void *ptr = arena_try_alloc(arena, size);\n"
+    "    if (!ptr && arena && size > 0) fprintf(stderr, \"Arena out of memory\\n\");\n"
+    "    return ptr;\n"
+    "}\n"
+    "\n"
+    "void *arena_alloc_zero(Arena *arena, size_t size) {\n"
+    "    void *ptr = arena_alloc(arena, size);\n"
+    "    if (ptr) memset(ptr, 0, size);\n"
+    "    return ptr;\n"
+    "}\n"
+    "\n"
+    "int arena_try_extend(Arena *arena, void *ptr, size_t old_size, size_t new_size) {\n"
+    "    size_t old_aligned = (old_size + 7) & ~7;\n"
+    "    size_t new_aligned = (new_size + 7) & ~7;\n"
+    "    if ((unsigned char *)ptr + old_aligned != arena->buffer + arena->offset ||\n"
+    "        arena->offset - old_aligned + new_aligned > arena->capacity)\n"
+    "        return 0;\n"
+    "    arena->offset = arena->offset - old_aligned + new_aligned;\n"
+    "    return 1;\n"
+    "}\n"
+    "\n"
+    "void *arena_try_realloc(Arena *arena, void *ptr, size_t old_size, size_t new_size) {\n"
+    "    if (!ptr) return arena_try_alloc(arena, new_size);\n"
+    "    if (new_size <= old_size || arena_try_extend(arena, ptr, old_size, new_size)) return ptr;\n"
+    "    void *copy = arena_try_alloc(arena, new_size);\n"
+    "    if (copy) memcpy(copy, ptr, old_size);\n"
+    "    return copy;\n"
+    "}\n"
+    "\n"
+    "void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t new_size) {\n"
+    "    void *result = arena_try_realloc(arena, ptr, old_size, new_size);\n"
+    "    if (!result && arena && new_size > 0) fprintf(stderr, \"Arena out of memory\\n\");\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "#define arena_array(arena, type, count) ((type*)arena_alloc_zero(arena, sizeof(type) * "
+    "(count)))\n"
+    "\n"
+    "// ========== REFCOUNTING RUNTIME ==========\n"
+    "// Plain counts unless the transpiler defined SAM_RC_ATOMIC or SAM_RC_BIASED (--threads)\n"
+    "#if defined(SAM_RC_CYCLES) && (defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED))\n"
+    "#error \"rc struct needs the single-threaded refcount mode (no --threads)\"\n"
+    "#endif\n"
+    "#if defined(SAM_ALLOC_ARENA) && (defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED))\n"
+    "#error \"--alloc=arena needs the single-threaded refcount mode (no --threads)\"\n"
+    "#endif\n"
+    "typedef struct RCHeader {\n"
+    "    size_t   refcount; // Strong references (the owner's count under SAM_RC_BIASED)\n"
+    "    size_t   weak_count;\n"
+    "    size_t   array_count;\n"
+    "    uint32_t flags; // RC_FLAG_* facts about the payload, cleared by the mutators\n"
+    "    uint32_t hash;  // string_hash32 of the payload while RC_FLAG_HASHED is set\n"
+    "#ifdef SAM_RC_BIASED\n"
+    "    struct RcOwner  *owner;      // Allocating thread, NULL once its count is merged\n"
+    "    intptr_t         shared;     // Other threads' count * RC_SHARED_ONE | RC_SHARED_* bits\n"
+    "    struct RCHeader *queue_next; // Link in the owner's merge queue\n"
+    "    void (*destroy)(void *);     // Destructor recorded when queued for a merge\n"
+    "#endif\n"
+    "#ifdef SAM_RC_CYCLES\n"
+    "    const struct RcType *type; // Traced fields of the payload, NULL for leaf objects\n"
+    "    size_t root_index;         // 1 + slot in the collector's root buffer, 0 when not buffered\n"
+    "#endif\n"
+    "} RCHeader;\n"
+    "\n"
+    "#define RC_HEADER_SIZE sizeof(RCHeader)\n"
+    "#define RC_GET_HEADER(ptr) ((RCHeader *)((char *)(ptr) - RC_HEADER_SIZE))\n"
+    "#define RC_FLAG_UTF8_CHECKED (1u << 0)\n"
+    "#define RC_FLAG_UTF8_VALID (1u << 1)\n"
+    "#define RC_FLAG_ASCII (1u << 2)\n"
+    "#define RC_FLAG_HASHED (1u << 3)\n"
+    "#define RC_FLAG_DERIVED (RC_FLAG_UTF8_CHECKED | RC_FLAG_UTF8_VALID | RC_FLAG_ASCII | RC_FLAG_HASHED)\n"
+    "#define RC_FLAG_INTERNED (1u << 4)\n"
+    "#define RC_IMMORTAL ((size_t)1 << 56)\n"
+    "\n"
+    "#ifdef SAM_RC_CYCLES\n"
+    "#include <stddef.h>\n"
+    "#ifndef RC_CYCLE_THRESHOLD\n"
+    "#define RC_CYCLE_THRESHOLD 4096\n"
+    "#endif\n"
+    "#ifndef RC_CYCLE_BUDGET\n"
+    "#define RC_CYCLE_BUDGET 16384\n"
+    "#endif\n"
+    "\n"
+    "typedef struct RcType {\n"
+    "    const char   *name;\n"
+    "    size_t        size;\n"
+    "    size_t        field_count;\n"
+    "    const size_t *fields; // offsetof each field holding a string or rc struct pointer\n"
+    "} RcType;\n"
+    "\n"
+    "#define rc_new(T) ((T)rc_alloc_typed(&T##__type))\n"
+    "\n"
+    "void   rc_release(void *ptr);\n"
+    "void  *rc_alloc_typed(const RcType *type);\n"
+    "size_t rc_collect_step(size_t budget); // Returns the number of objects freed\n"
+    "size_t rc_collect_cycles(void);        // Steps until the root buffer is empty\n"
+    "size_t rc_cycle_roots(void);           // Candidates waiting in the buffer\n"
+    "#endif\n"
+    "\n"
+    "#ifdef SAM_RC_BIASED\n"
+    "#define RC_SHARED_MERGED 1   // Owner count folded in; shared count is the total\n"
+    "#define RC_SHARED_QUEUED 2   // Waiting in the owner's merge queue\n"
+    "#define RC_SHARED_ELEMENTS 4 // destroy is an element destructor (rc_release_array)\n"
+    "#define RC_SHARED_ONE 8\n"
+    "#endif\n"
+    "\n"
+    "#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)\n"
+    "#define RC_ADD(field, n) __atomic_fetch_add(&(field), n, __ATOMIC_RELAXED)\n"
+    "#define RC_LOAD(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)\n"
+    "#define RC_STORE(field, value) __atomic_store_n(&(field), value, __ATOMIC_RELAXED)\n"
+    "#define RC_FLAGS_SET(header, bits) __atomic_fetch_or(&(header)->flags, bits, __ATOMIC_RELEASE)\n"
+    "#else\n"
+    "#define RC_ADD(field, n) ((field) += (n))\n"
+    "#define RC_LOAD(field) (field)\n"
+    "#define RC_STORE(field, value) ((field) = (value))\n"
+    "#define RC_FLAGS_SET(header, bits) ((header)->flags |= (bits))\n"
+    "#endif\n"
+    "\n"
+    "static void rc_finalize(RCHeader *header, void (*destroy)(void *), int elements) {\n"
+    "    void *ptr = (char *)header + RC_HEADER_SIZE;\n"
+    "    if (destroy && elements) {\n"
+    "        void **array = (void **)ptr;\n"
+    "        for (size_t i = 0; i < header->array_count; i++)\n"
+    "            destroy(array[i]);\n"
+    "    } else if (destroy) {\n"
+    "        destroy(ptr);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "#ifdef SAM_RELEASE_POOLS\n"
+    "// Release pools: dead objects queue on the current pool until it drains\n"
+    "typedef struct RcDeferred {\n"
+    "    RCHeader *header;\n"
+    "    void (*destroy)(void *);\n"
+    "    int elements;\n"
+    "} RcDeferred;\n"
+    "\n"
+    "typedef struct {\n"
+    "    void **blocks;\n"
+    "    size_t count;\n"
+    "} ReleaseBatch;\n"
+    "\n"
+    "typedef struct ReleasePool {\n"
+    "    RcDeferred         *items; // Objects waiting for the drain\n"
+    "    size_t              count, capacity;\n"
+    "    struct ReleasePool *outer;                        // Pool this one was pushed over\n"
+    "    void (*free_blocks)(void **blocks, size_t count); // NULL: free() each block\n"
+    "} ReleasePool;\n"
+    "\n"
+    "#if defined(__GNUC__) && !defined(__TINYC__)\n"
+    "static __thread ReleasePool *rc_pool_current;\n"
+    "#else\n"
+    "static ReleasePool *rc_pool_current; // Without __thread the pool stack is per process\n"
+    "#endif\n"
+    "\n"
+    "// Queue a dead object on the pool. The pool holds a weak reference until the\n"
+    "// drain, so a weak release in between cannot free the block under it.\n"
+    "static int rc_pool_defer(ReleasePool *pool, RCHeader *header, void (*destroy)(void *), int elements) {\n"
+    "    if (pool->count == pool->capacity) {\n"
+    "        size_t      capacity = pool->capacity ? pool->capacity * 2 : 64;\n"
+    "        RcDeferred *items = realloc(pool->items, capacity * sizeof(RcDeferred));\n"
+    "        if (!items) return 0;\n"
+    "        pool->items = items;\n"
+    "        pool->capacity = capacity;\n"
+    "    }\n"
+    "    RC_ADD(header->weak_count, 1);\n"
+    "    pool->items[pool->count++] = (RcDeferred){header, destroy, elements};\n"
+    "    return 1;\n"
+    "}\n"
+    "\n"
+    "#endif\n"
+    "\n"
+    "// Run the destructor, then free the block unless weak references remain.\n"
+    "// Under a release pool both wait for the pool's drain.\n"
+    "static void rc_destroy(RCHeader *header, void (*destroy)(void *), int elements) {\n"
+    "#ifdef SAM_RELEASE_POOLS\n"
+    "    ReleasePool *pool = rc_pool_current;\n"
+    "    if (pool && rc_pool_defer(pool, header, destroy, elements)) return;\n"
+    "#endif\n"
+    "    rc_finalize(header, destroy, elements);\n"
+    "    if (RC_LOAD(header->weak_count) == 0) free(header);\n"
+    "}\n"
+    "\n"
+    "#ifdef SAM_RC_BIASED\n"
+    "#define RC_SHARED_COUNT(word) ((word) >> 3) // Arithmetic shift keeps negative counts\n"
+    "\n"
+    "typedef struct RcOwner {\n"
+    "    RCHeader *queue; // Objects whose shared count went negative, pushed by other threads\n"
+    "} RcOwner;\n"
+    "\n"
+    "static __thread RcOwner rc_self;\n"
+    "\n"
+    "// The shared count went negative, so only the owner's count can tell when the\n"
+    "// object dies: hand it to the owner, which merges the two counts\n"
+    "static void rc_queue_for_owner(RCHeader *header, void (*destroy)(void *), int elements) {\n"
+    "    intptr_t bits = RC_SHARED_QUEUED | (elements ? RC_SHARED_ELEMENTS : 0);\n"
+    "    header->destroy = destroy;\n"
+    "    intptr_t old = __atomic_fetch_or(&header->shared, bits, __ATOMIC_ACQ_REL);\n"
+    "    if (old & (RC_SHARED_QUEUED | RC_SHARED_MERGED)) return;\n"
+    "\n"
+    "    RcOwner  *owner = __atomic_load_n(&header->owner, __ATOMIC_RELAXED);\n"
+    "    RCHeader *head = __atomic_load_n(&owner->queue, __ATOMIC_RELAXED);\n"
+    "    do {\n"
+    "        header->queue_next = head;\n"
+    "    } while (!__atomic_compare_exchange_n(&owner->queue, &head, header, 1, __ATOMIC_RELEASE,\n"
+    "                                          __ATOMIC_RELAXED));\n"
+    "}\n"
+    "\n"
+    "void rc_biased_flush(void) {\n"
+    "    RCHeader *header = __atomic_exchange_n(&rc_self.queue, NULL, __ATOMIC_ACQUIRE);\n"
+    "    while (header) {\n"
+    "        RCHeader *next = header->queue_next;\n"
+    "        intptr_t  owned = (intptr_t)header->refcount;\n"
+    "        header->refcount = 0;\n"
+    "        __atomic_store_n(&header->owner, NULL, __ATOMIC_RELAXED);\n"
+    "        intptr_t now = __atomic_add_fetch(&header->shared, owned * RC_SHARED_ONE + RC_SHARED_MERGED,\n"
+    "                                          __ATOMIC_ACQ_REL);\n"
+    "        if (RC_SHARED_COUNT(now) == 0)\n"
+    "            rc_destroy(header, header->destroy, (now & RC_SHARED_ELEMENTS) != 0);\n"
+    "        header = next;\n"
+    "    }\n"
+    "}\n"
+    "#endif\n"
+    "\n"
+    "void rc_init_header(RCHeader *header, size_t refcount) {\n"
+    "    header->refcount = refcount;\n"
+    "    header->weak_count = 0;\n"
+    "    header->array_count = 0;\n"
+    "    header->flags = 0;\n"
+    "    header->hash = 0;\n"
+    "#ifdef SAM_RC_BIASED\n"
+    "    // Immortal objects have no owner: any thread may hold them\n"
+    "    int owned = refcount < RC_IMMORTAL;\n"
+    "    header->owner = owned ? &rc_self : NULL;\n"
+    "    header->refcount = owned ? refcount : 0;\n"
+    "    header->shared = owned ? 0 : (intptr_t)refcount * RC_SHARED_ONE + RC_SHARED_MERGED;\n"
+    "    header->queue_next = NULL;\n"
+    "    header->destroy = NULL;\n"
+    "#endif\n"
+    "#ifdef SAM_RC_CYCLES\n"
+    "    header->type = NULL;\n"
+    "    header->root_index = 0;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "#ifdef SAM_ALLOC_ARENA\n"
+    "// --alloc=arena: every object is carved from a region of arena chunks that\n"
+    "// grows without moving anything, and lives until allocator_reset or exit\n"
+    "#ifndef ALLOCATOR_CHUNK_SIZE\n"
+    "#define ALLOCATOR_CHUNK_SIZE (1024 * 1024)\n"
+    "#endif\n"
+    "static Arena **region_chunks;\n"
+    "static size_t  region_count, region_capacity;\n"
+    "static size_t  region_chunk_size = ALLOCATOR_CHUNK_SIZE;\n"
+    "static int     region_registered;\n"
+    "\n"
+    "void allocator_init(size_t arena_size) {\n"
+    "    if (arena_size) region_chunk_size = arena_size;\n"
+    "}\n"
+    "\n"
+    "void *allocator_region_grow(void *ptr, size_t old_size, size_t new_size) {\n"
+    "    if (region_count == 0) return NULL;\n"
+    "    return arena_try_extend(region_chunks[region_count - 1], ptr, old_size, new_size) ? ptr : NULL;\n"
+    "}\n"
+    "\n"
+    "void allocator_reset(void) {\n"
+    "    while (region_count > 1)\n"
+    "        arena_destroy(region_chunks[--region_count]);\n"
+    "    if (region_count) arena_reset(region_chunks[0]);\n"
+    "}\n"
+    "\n"
+    "void allocator_cleanup(void) {\n"
+    "    while (region_count > 0)\n"
+    "        arena_destroy(region_chunks[--region_count]);\n"
+    "    free(region_chunks);\n"
+    "    region_chunks = NULL;\n"
+    "    region_capacity = 0;\n"
+    "}\n"
+    "\n"
+    "void *allocator_region_alloc(size_t size) {\n"
+    "    void *ptr = region_count ? arena_try_alloc(region_chunks[region_count - 1], size) : NULL;\n"
+    "    if (ptr || size == 0) return ptr;\n"
+    "    if (region_count == region_capacity) {\n"
+    "        size_t  capacity = region_capacity ? region_capacity * 2 : 16;\n"
+    "        Arena **chunks = realloc(region_chunks, capacity * sizeof(Arena *));\n"
+    "        if (!chunks) return NULL;\n"
+    "        region_chunks = chunks;\n"
+    "        region_capacity = capacity;\n"
+    "    }\n"
+    "    size_t needed = (size + 7) & ~(size_t)7;\n"
+    "    Arena *chunk = arena_create(needed > region_chunk_size ? needed : region_chunk_size);\n"
+    "    if (!chunk) return NULL;\n"
+    "    if (!region_registered) region_registered = atexit(allocator_cleanup) == 0;\n"
+    "    region_chunks[region_count++] = chunk;\n"
+    "    return arena_try_alloc(chunk, size);\n"
+    "}\n"
+    "#endif\n"
+    "\n"
+    "void *rc_alloc(size_t size) {\n"
+    "#ifdef SAM_ALLOC_ARENA\n"
+    "    // Region objects are immortal: retain and release only touch the count\n"
+    "    RCHeader *header = allocator_region_alloc(RC_HEADER_SIZE + size);\n"
+    "    if (!header) return NULL;\n"
+    "    memset(header, 0, RC_HEADER_SIZE + size);\n"
+    "    rc_init_header(header, RC_IMMORTAL);\n"
+    "#else\n"
+    "    RCHeader *header = (RCHeader *)calloc(1, RC_HEADER_SIZE + size);\n"
+    "    if (!header) return NULL;\n"
+    "    rc_init_header(header, 1);\n"
+    "#endif\n"
+    "    return (char *)header + RC_HEADER_SIZE;\n"
+    "}\n"
+    "\n"
+    "// Immortal header inside the arena, or a heap object once the arena is full\n"
+    "void *rc_arena_alloc(Arena *arena, size_t size) {\n"
+    "    RCHeader *header = arena_try_alloc(arena, RC_HEADER_SIZE + size);\n"
+    "    if (!header) return rc_alloc(size);\n"
+    "    memset(header, 0, RC_HEADER_SIZE + size);\n"
+    "    rc_init_header(header, RC_IMMORTAL);\n"
+    "    return (char *)header + RC_HEADER_SIZE;\n"
+    "}\n"
+    "\n"
+    "void rc_retain(void *ptr) {\n"
+    "    if (!ptr) return;\n"
+    "    RCHeader *header = RC_GET_HEADER(ptr);\n"
+    "#ifdef SAM_RC_BIASED\n"
+    "    if (__atomic_load_n(&header->owner, __ATOMIC_RELAXED) == &rc_self) {\n"
+    "        header->refcount++;\n"
+    "    } else {\n"
+    "        __atomic_fetch_add(&header->shared, RC_SHARED_ONE, __ATOMIC_RELAXED);\n"
+    "    }\n"
+    "#else\n"
+    "    RC_ADD(header->refcount, 1);\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "// Drop one strong reference; returns 1 when it was the last one\n"
+    "static int rc_drop(RCHeader *header, void (*destroy)(void *), int elements) {\n"
+    "#if defined(SAM_RC_BIASED)\n"
+    "    // Merge first: the flush may hand this very object over to the shared count\n"
+    "    if (__atomic_load_n(&rc_self.queue, __ATOMIC_RELAXED)) rc_biased_flush();\n"
+    "    if (__atomic_load_n(&header->owner, __ATOMIC_RELAXED) == &rc_self) {\n"
+    "        if (--header->refcount > 0) return 0;\n"
+    "        // The owner is done: from now on the shared count is the whole count\n"
+    "        __atomic_store_n(&header->owner, NULL, __ATOMIC_RELAXED);\n"
+    "        intptr_t old = __atomic_fetch_or(&header->shared, RC_SHARED_MERGED, __ATOMIC_ACQ_REL);\n"
+    "        return RC_SHARED_COUNT(old) == 0;\n"
+    "    }\n"
+    "    intptr_t now = __atomic_sub_fetch(&header->shared, RC_SHARED_ONE, __ATOMIC_ACQ_REL);\n"
+    "    if (now & RC_SHARED_MERGED) return RC_SHARED_COUNT(now) == 0;\n"
+    "    if (RC_SHARED_COUNT(now) < 0 && !(now & RC_SHARED_QUEUED))\n"
+    "        rc_queue_for_owner(header, destroy, elements);\n"
+    "    return 0;\n"
+    "#elif defined(SAM_RC_ATOMIC)\n"
+    "    (void)destroy, (void)elements;\n"
+    "    if (__atomic_fetch_sub(&header->refcount, 1, __ATOMIC_RELEASE) != 1) return 0;\n"
+    "    // Acquire the release sequence so every other thread's writes happen before the free\n"
+    "    (void)__atomic_load_n(&header->refcount, __ATOMIC_ACQUIRE);\n"
+    "    return 1;\n"
+    "#else\n"
+    "    (void)destroy, (void)elements;\n"
+    "    return --header->refcount == 0;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "// Cycle collector implementation\n"
+    "#ifdef SAM_RC_CYCLES\n"
+    "#define RC_COLOR_MASK (3u << 5)\n"
+    "#define RC_BLACK 0u         // In use, or not being examined\n"
+    "#define RC_GRAY (1u << 5)   // Traced: the references from inside the subgraph are subtracted\n"
+    "#define RC_WHITE (2u << 5)  // Garbage unless something black reaches it\n"
+    "#define RC_PURPLE (3u << 5) // Possible root of a garbage cycle\n"
+    "\n"
+    "typedef struct {\n"
+    "    RCHeader **items;\n"
+    "    size_t     count, capacity;\n"
+    "} RcHeaderStack;\n"
+    "\n"
+    "static RcHeaderStack rc_roots;\n"
+    "static RcHeaderStack rc_dying; // Typed objects whose fields are still to be released\n"
+    "static int           rc_collecting, rc_releasing;\n"
+    "\n"
+    "static uint32_t rc_color(RCHeader *header) { return header->flags & RC_COLOR_MASK; }\n"
+    "\n"
+    "static void rc_paint(RCHeader *header, uint32_t color) {\n"
+    "    header->flags = (header->flags & ~RC_COLOR_MASK) | color;\n"
+    "}\n"
+    "\n"
+    "// The traversals cannot stop halfway without corrupting counts, so running\n"
+    "// out of memory for their stacks is fatal\n"
+    "static void rc_stack_push(RcHeaderStack *stack, RCHeader *header) {\n"
+    "    if (stack->count == stack->capacity) {\n"
+    "        size_t     capacity = stack->capacity ? stack->capacity * 2 : 256;\n"
+    "        RCHeader **items = realloc(stack->items, capacity * sizeof(RCHeader *));\n"
+    "        if (!items) {\n"
+    "            fprintf(stderr, \"rc: out of memory tracing objects\\n\");\n"
+    "            abort();\n"
+    "        }\n"
+    "        stack->items = items;\n"
+    "        stack->capacity = capacity;\n"
+    "    }\n"
+    "    stack->items[stack->count++] = header;\n"
+    "}\n"
+    "\n"
+    "static size_t rc_field_count(RCHeader *header) {\n"
+    "    return header->type ? header->type->field_count : 0;\n"
+    "}\n"
+    "\n"
+    "static RCHeader *rc_field(RCHeader *header, size_t i) {\n"
+    "    void *child = *(void **)((char *)header + RC_HEADER_SIZE + header->type->fields[i]);\n"
+    "    return child ? RC_GET_HEADER(child) : NULL;\n"
+    "}\n"
+    "\n"
+    "static void rc_unbuffer(RCHeader *header) {\n"
+    "    size_t    slot = header->root_index - 1;\n"
+    "    RCHeader *last = rc_roots.items[--rc_roots.count];\n"
+    "    rc_roots.items[slot] = last;\n"
+    "    last->root_index = slot + 1;\n"
+    "    header->root_index = 0;\n"
+    "}\n"
+    "\n"
+    "static void rc_release_fields(void *ptr) {\n"
+    "    RCHeader *header = RC_GET_HEADER(ptr);\n"
+    "    for (size_t i = 0; i < header->type->field_count; i++)\n"
+    "        rc_release(*(void **)((char *)ptr + header->type->fields[i]));\n"
+    "}\n"
+    "\n"
+    "static void rc_release_typed(RCHeader *header) {\n"
+    "    if (--header->refcount == 0) {\n"
+    "        // Deaths are queued so a long chain is torn down in a loop, not by recursion\n"
+    "        rc_paint(header, RC_BLACK);\n"
+    "        if (header->root_index) rc_unbuffer(header);\n"
+    "        rc_stack_push(&rc_dying, header);\n"
+    "        if (rc_releasing) return;\n"
+    "        rc_releasing = 1;\n"
+    "        while (rc_dying.count > 0)\n"
+    "            rc_destroy(rc_dying.items[--rc_dying.count], rc_release_fields, 0);\n"
+    "        rc_releasing = 0;\n"
+    "        return;\n"
+    "    }\n"
+    "    if (rc_color(header) == RC_PURPLE || header->type->field_count == 0) return;\n"
+    "    rc_paint(header, RC_PURPLE);\n"
+    "    if (!header->root_index) {\n"
+    "        rc_stack_push(&rc_roots, header);\n"
+    "        header->root_index = rc_roots.count;\n"
+    "    }\n"
+    "    if (rc_roots.count >= RC_CYCLE_THRESHOLD && !rc_collecting) rc_collect_step(RC_CYCLE_BUDGET);\n"
+    "}\n"
+    "\n"
+    "// Paint everything root reaches gray, taking one count off each object per\n"
+    "// edge that points at it; returns the number of objects traced\n"
+    "static size_t rc_mark_gray(RCHeader *root, RcHeaderStack *work) {\n"
+    "    size_t traced = 0;\n"
+    "    rc_paint(root, RC_GRAY);\n"
+    "    rc_stack_push(work, root);\n"
+    "    while (work->count) {\n"
+    "        RCHeader *header = work->items[--work->count];\n"
+    "        traced++;\n"
+    "        for (size_t i = 0; i < rc_field_count(header); i++) {\n"
+    "            RCHeader *child = rc_field(header, i);\n"
+    "            if (!child) continue;\n"
+    "            child->refcount--;\n"
+    "            if (rc_color(child) != RC_GRAY) {\n"
+    "                rc_paint(child, RC_GRAY);\n"
+    "                rc_stack_push(work, child);\n"
+    "            }\n"
+    "        }\n"
+    "    }\n"
+    "    return traced;\n"
+    "}\n"
+    "\n"
+    "// Referenced from outside the subgraph: give back the counts it and everything\n"
+    "// it reaches lost in rc_mark_gray\n"
+    "static void rc_scan_black(RCHeader *root, RcHeaderStack *work) {\n"
+    "    rc_paint(root, RC_BLACK);\n"
+    "    rc_stack_push(work, root);\n"
+    "    while (work->count) {\n"
+    "        RCHeader *header = work->items[--work->count];\n"
+    "        for (size_t i = 0; i < rc_field_count(header); i++) {\n"
+    "            RCHeader *child = rc_field(header, i);\n"
+    "            if (!child) continue;\n"
+    "            child->refcount++;\n"
+    "            if (rc_color(child) != RC_BLACK) {\n"
+    "                rc_paint(child, RC_BLACK);\n"
+    "                rc_stack_push(work, child);\n"
+    "            }\n"
+    "        }\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static void rc_scan(RCHeader *root, RcHeaderStack *work, RcHeaderStack *black) {\n"
+    "    rc_stack_push(work, root);\n"
+    "    while (work->count) {\n"
+    "        RCHeader *header = work->items[--work->count];\n"
+    "        if (rc_color(header) != RC_GRAY) continue;\n"
+    "        if (header->refcount > 0) {\n"
+    "            rc_scan_black(header, black);\n"
+    "            continue;\n"
+    "        }\n"
+    "        rc_paint(header, RC_WHITE);\n"
+    "        for (size_t i = 0; i < rc_field_count(header); i++) {\n"
+    "            RCHeader *child = rc_field(header, i);\n"
+    "            if (child) rc_stack_push(work, child);\n"
+    "        }\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "// White objects only reference each other or objects whose counts already\n"
+    "// exclude them, so they are freed without releasing their fields. One that\n"
+    "// is still buffered as a root for a later step leaves the buffer now.\n"
+    "static void rc_collect_white(RCHeader *root, RcHeaderStack *work, RcHeaderStack *garbage) {\n"
+    "    if (rc_color(root) != RC_WHITE) return;\n"
+    "    rc_paint(root, RC_BLACK);\n"
+    "    rc_stack_push(work, root);\n"
+    "    while (work->count) {\n"
+    "        RCHeader *header = work->items[--work->count];\n"
+    "        if (header->root_index) rc_unbuffer(header);\n"
+    "        rc_stack_push(garbage, header);\n"
+    "        for (size_t i = 0; i < rc_field_count(header); i++) {\n"
+    "            RCHeader *child = rc_field(header, i);\n"
+    "            if (child && rc_color(child) == RC_WHITE) {\n"
+    "                rc_paint(child, RC_BLACK);\n"
+    "                rc_stack_push(work, child);\n"
+    "            }\n"
+    "        }\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "void *rc_alloc_typed(const RcType *type) {\n"
+    "    char *ptr = rc_alloc(type->size);\n"
+    "    if (ptr) RC_GET_HEADER(ptr)->type = type;\n"
+    "    return ptr;\n"
+    "}\n"
+    "\n"
+    "size_t rc_collect_step(size_t budget) {\n"
+    "    if (rc_collecting) return 0;\n"
+    "    rc_collecting = 1;\n"
+    "\n"
+    "    RcHeaderStack roots = {0}, work = {0}, black = {0}, garbage = {0};\n"
+    "    size_t        traced = 0;\n"
+    "    while (rc_roots.count > 0 && traced < budget) {\n"
+    "        RCHeader *root = rc_roots.items[rc_roots.count - 1];\n"
+    "        rc_unbuffer(root);\n"
+    "        // Roots a previous one reached this step were traced with it\n"
+    "        if (rc_color(root) != RC_PURPLE) continue;\n"
+    "        rc_stack_push(&roots, root);\n"
+    "        traced += rc_mark_gray(root, &work);\n"
+    "    }\n"
+    "    for (size_t i = 0; i < roots.count; i++)\n"
+    "        rc_scan(roots.items[i], &work, &black);\n"
+    "    for (size_t i = 0; i < roots.count; i++)\n"
+    "        rc_collect_white(roots.items[i], &work, &garbage);\n"
+    "\n"
+    "    for (size_t i = 0; i < garbage.count; i++) {\n"
+    "        if (garbage.items[i]->weak_count == 0) free(garbage.items[i]);\n"
+    "    }\n"
+    "    size_t freed = garbage.count;\n"
+    "    free(roots.items);\n"
+    "    free(work.items);\n"
+    "    free(black.items);\n"
+    "    free(garbage.items);\n"
+    "    rc_collecting = 0;\n"
+    "    return freed;\n"
+    "}\n"
+    "\n"
+    "size_t rc_collect_cycles(void) {\n"
+    "    size_t freed = 0;\n"
+    "    while (rc_roots.count > 0)\n"
+    "        freed += rc_collect_step((size_t)-1);\n"
+    "    return freed;\n"
+    "}\n"
+    "\n"
+    "size_t rc_cycle_roots(void) { return rc_roots.count; }\n"
+    "#endif\n"
+    "\n"
+    "void rc_release_with(void *ptr, void (*destroy)(void *)) {\n"
+    "    if (!ptr) return;\n"
+    "    RCHeader *header = RC_GET_HEADER(ptr);\n"
+    "#ifdef SAM_RC_CYCLES\n"
+    "    if (header->type) {\n"
+    "        rc_release_typed(header);\n"
+    "        return;\n"
+    "    }\n"
+    "#endif\n"
+    "    if (rc_drop(header, destroy, 0)) rc_destroy(header, destroy, 0);\n"
+    "}\n"
+    "\n"
+    "void rc_release(void *ptr) { rc_release_with(ptr, NULL); }\n"
+    "\n"
+    "int rc_is_unique(void *ptr) {\n"
+    "    RCHeader *header = RC_GET_HEADER(ptr);\n"
+    "    if (RC_LOAD(header->weak_count) != 0) return 0;\n"
+    "#ifdef SAM_RC_BIASED\n"
+    "    intptr_t shared = __atomic_load_n(&header->shared, __ATOMIC_ACQUIRE);\n"
+    "    if (__atomic_load_n(&header->owner, __ATOMIC_RELAXED) == &rc_self)\n"
+    "        return (intptr_t)header->refcount + RC_SHARED_COUNT(shared) == 1;\n"
+    "    return (shared & RC_SHARED_MERGED) && RC_SHARED_COUNT(shared) == 1;\n"
+    "#else\n"
+    "    return RC_LOAD(header->refcount) == 1;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "#ifdef SAM_RELEASE_POOLS\n"
+    "#if defined(__GNUC__) && !defined(__TINYC__)\n"
+    "#define RELEASE_POOL(name)                                                                     \\\n"
+    "    ReleasePool name __attribute__((cleanup(rc_pool_pop))) = {0};                              \\\n"
+    "    rc_pool_push(&name)\n"
+    "#define RELEASE_POOL_END(name)\n"
+    "#define RELEASE_POOL_EXIT(name)\n"
+    "#else\n"
+    "#define RELEASE_POOL(name)                                                                     \\\n"
+    "    ReleasePool name = {0};                                                                    \\\n"
+    "    rc_pool_push(&name)\n"
+    "#define RELEASE_POOL_END(name) rc_pool_pop(&name)  // After the scope's own releases\n"
+    "#define RELEASE_POOL_EXIT(name) rc_pool_pop(&name) // Before a break, continue or return\n"
+    "#endif\n"
+    "\n"
+    "void         rc_pool_push(ReleasePool *pool);\n"
+    "void         rc_pool_pop(ReleasePool *pool); // Drain, then make the outer pool current again\n"
+    "void         rc_pool_drain(ReleasePool *pool);\n"
+    "ReleaseBatch rc_pool_collect(ReleasePool *pool);\n"
+    "void         rc_batch_free(ReleaseBatch *batch);\n"
+    "\n"
+    "\n"
+    "// Drop one weak reference; returns 1 when it was the last one\n"
+    "static int rc_weak_drop(RCHeader *header) {\n"
+    "#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)\n"
+    "    return __atomic_sub_fetch(&header->weak_count, 1, __ATOMIC_ACQ_REL) == 0;\n"
+    "#else\n"
+    "    return --header->weak_count == 0;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "// Release pool implementation\n"
+    "void rc_pool_push(ReleasePool *pool) {\n"
+    "    pool->outer = rc_pool_current;\n"
+    "    rc_pool_current = pool;\n"
+    "}\n"
+    "\n"
+    "void rc_pool_pop(ReleasePool *pool) {\n"
+    "    rc_pool_drain(pool);\n"
+    "    free(pool->items);\n"
+    "    pool->items = NULL;\n"
+    "    pool->capacity = 0;\n"
+    "    if (rc_pool_current == pool) rc_pool_current = pool->outer;\n"
+    "}\n"
+    "\n"
+    "// Run the queued destructors while the pool is still current, so what they\n"
+    "// release joins the same drain. Dead blocks go to batch, or straight to free()\n"
+    "// when there is none.\n"
+    "static void rc_pool_finalize(ReleasePool *pool, ReleaseBatch *batch) {\n"
+    "    size_t capacity = 0;\n"
+    "    for (size_t i = 0; i < pool->count; i++) {\n"
+    "        RcDeferred item = pool->items[i];\n"
+    "        rc_finalize(item.header, item.destroy, item.elements);\n"
+    "        if (!rc_weak_drop(item.header)) continue; // A weak reference frees it later\n"
+    "        if (batch && batch->count == capacity) {\n"
+    "            capacity = capacity ? capacity * 2 : pool->count;\n"
+    "            void **blocks = realloc(batch->blocks, capacity * sizeof(void *));\n"
+    "            if (blocks) batch->blocks = blocks;\n"
+    "        }\n"
+    "        if (batch && batch->count < capacity) {\n"
+    "            batch->blocks[batch->count++] = item.header;\n"
+    "        } else {\n"
+    "            free(item.header);\n"
+    "        }\n"
+    "    }\n"
+    "    pool->count = 0;\n"
+    "}\n"
+    "\n"
+    "ReleaseBatch rc_pool_collect(ReleasePool *pool) {\n"
+    "    ReleaseBatch batch = {NULL, 0};\n"
+    "    rc_pool_finalize(pool, &batch);\n"
+    "    return batch;\n"
+    "}\n"
+    "\n"
+    "void rc_batch_free(ReleaseBatch *batch) {\n"
+    "    for (size_t i = 0; i < batch->count; i++)\n"
+    "        free(batch->blocks[i]);\n"
+    "    free(batch->blocks);\n"
+    "    batch->blocks = NULL;\n"
+    "    batch->count = 0;\n"
+    "}\n"
+    "\n"
+    "void rc_pool_drain(ReleasePool *pool) {\n"
+    "    if (!pool->free_blocks) {\n"
+    "        rc_pool_finalize(pool, NULL);\n"
+    "        return;\n"
+    "    }\n"
+    "    ReleaseBatch batch = rc_pool_collect(pool);\n"
+    "    if (batch.count) pool->free_blocks(batch.blocks, batch.count);\n"
+    "    free(batch.blocks);\n"
+    "}\n"
+    "#endif\n"
+    "\n"
+    "// ========== STRING API ==========\n"
+    "typedef char *string;\n"
+    "\n"
+    "string string_create(const char *literal) {\n"
+    "    if (!literal) return NULL;\n"
+    "    size_t len = strlen(literal);\n"
+    "    char *str = rc_alloc(len + 1);\n"
+    "    if (str) strcpy(str, literal);\n"
+    "    return str;\n"
+    "}\n"
+    "\n"
+    "string string_concat(string a, string b) {\n"
+    "    if (!a || !b) return NULL;\n"
+    "    size_t len_a = strlen(a);\n"
+    "    size_t len_b = strlen(b);\n"
+    "    char *result = rc_alloc(len_a + len_b + 1);\n"
+    "    if (result) {\n"
+    "        strcpy(result, a);\n"
+    "        strcpy(result + len_a, b);\n"
+    "    }\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "string string_substr(string s, size_t start, size_t len) {\n"
+    "    if (!s) return NULL;\n"
+    "    size_t s_len = strlen(s);\n"
+    "    if (start >= s_len) return string_create(\"\");\n"
+    "    if (start + len > s_len) len = s_len - start;\n"
+    "    char *result = rc_alloc(len + 1);\n"
+    "    if (result) {\n"
+    "        strncpy(result, s + start, len);\n"
+    "        result[len] = '\\0';\n"
+    "    }\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "size_t string_length(string s) { return s ? strlen(s) : 0; }\n"
+    "void string_free(string s) { rc_release(s); }\n"
+    "\n"
+    "// ========== UNIQUENESS-AWARE STRINGS ==========\n"
+    "void string_invalidate(string s) {\n"
+    "    if (s) RC_GET_HEADER(s)->flags &= ~RC_FLAG_DERIVED;\n"
+    "}\n"
+    "\n"
+    "int string_is_unique(string s) { return s && rc_is_unique(s); }\n"
+    "\n"
+    "string string_concat_inplace(string a, const char *b) {\n"
+    "    if (!a) return NULL;\n"
+    "    if (!b) return a;\n"
+    "    size_t len_a = strlen(a);\n"
+    "    size_t len_b = strlen(b);\n"
+    "    if (!string_is_unique(a) || (b >= a && b <= a + len_a)) {\n"
+    "        string result = string_concat(a, (string)b);\n"
+    "        if (!result) return a;\n"
+    "        rc_release(a);\n"
+    "        return result;\n"
+    "    }\n"
+    "    RCHeader *header = realloc(RC_GET_HEADER(a), RC_HEADER_SIZE + len_a + len_b + 1);\n"
+    "    if (!header) return a;\n"
+    "    header->flags &= ~RC_FLAG_DERIVED;\n"
+    "    char *result = (char *)header + RC_HEADER_SIZE;\n"
+    "    memcpy(result + len_a, b, len_b + 1);\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "void string_make_unique(string *s) {\n"
+    "    if (!s || !*s || string_is_unique(*s)) return;\n"
+    "    string copy = string_create(*s);\n"
+    "    rc_release(*s);\n"
+    "    *s = copy;\n"
+    "}\n"
+    "\n"
+    "void string_set_char(string *s, size_t index, char ch) {\n"
+    "    if (!s || !*s || index >= strlen(*s)) return;\n"
+    "    string_make_unique(s);\n"
+    "    string_invalidate(*s);\n"
+    "    if (*s) (*s)[index] = ch;\n"
+    "}\n"
+    "\n"
+    "void string_truncate(string *s, size_t len) {\n"
+    "    if (!s || !*s || len >= strlen(*s)) return;\n"
+    "    string_make_unique(s);\n"
+    "    string_invalidate(*s);\n"
+    "    if (*s) (*s)[len] = '\\0';\n"
+    "}\n"
+    "\n"
+    "void string_to_upper(string *s) {\n"
+    "    if (!s || !*s) return;\n"
+    "    string_make_unique(s);\n"
+    "    string_invalidate(*s);\n"
+    "    for (char *p = *s; p && *p; p++) *p = toupper((unsigned char)*p);\n"
+    "}\n"
+    "\n"
+    "void string_to_lower(string *s) {\n"
+    "    if (!s || !*s) return;\n"
+    "    string_make_unique(s);\n"
+    "    string_invalidate(*s);\n"
+    "    for (char *p = *s; p && *p; p++) *p = tolower((unsigned char)*p);\n"
+    "}\n"
+    "\n"
+    "// ========== SIMD STRING KERNELS ==========\n"
+    "#if defined(__x86_64__) && defined(__GNUC__) && !defined(__TINYC__)\n"
+    "#define SAM_SIMD_X86 1\n"
+    "#endif\n"
+    "\n"
+    "// utf8_validate results\n"
+    "#define SIMD_UTF8_INVALID 0\n"
+    "#define SIMD_UTF8_VALID 1\n"
+    "#define SIMD_UTF8_ASCII 2 // Valid and every byte below 0x80\n"
+    "\n"
+    "// One implementation per instruction set; simd_kernels() picks the widest one\n"
+    "// the CPU supports the first time it is called and keeps it for the process.\n"
+    "typedef struct {\n"
+    "    const char *name;\n"
+    "    const char *(*find_char)(const char *hay, size_t len, int ch);\n"
+    "    const char *(*find)(const char *hay, size_t hay_len, const char *needle, size_t needle_len);\n"
+    "    int (*eq)(const void *a, const void *b, size_t len);\n"
+    "    int (*cmp)(const void *a, const void *b, size_t len);\n"
+    "    size_t (*count_char)(const char *hay, size_t len, int ch);\n"
+    "    uint64_t (*hash)(const void *data, size_t len);\n"
+    "    int (*utf8_validate)(const char *s, size_t len);\n"
+    "    size_t (*utf8_count)(const char *s, size_t len); // Code points in valid UTF-8\n"
+    "} SimdKernels;\n"
+    "\n"
+    "const SimdKernels *simd_kernels(void);\n"
+    "\n"
+    "// Individual tables, exposed so benchmarks can compare them side by side.\n"
+    "// Entries are NULL when the instruction set is unavailable on this CPU/build.\n"
+    "extern const SimdKernels simd_scalar;\n"
+    "const SimdKernels       *simd_sse2(void);\n"
+    "const SimdKernels       *simd_avx2(void);\n"
+    "const SimdKernels       *simd_avx512(void);\n"
+    "\n"
+    "#ifdef SAM_SIMD_X86\n"
+    "#include <immintrin.h>\n"
+    "#endif\n"
+    "\n"
+    "// =========================== [ HASH CORE ] =========================================\n"
+    "// Every implementation folds 64-byte blocks into eight 64-bit lanes the same\n"
+    "// way, so the hash value does not depend on which kernel was selected.\n"
+    "\n"
+    "#define HASH_PRIME1 0x9E3779B185EBCA87ULL\n"
+    "#define HASH_PRIME2 0xC2B2AE3D27D4EB4FULL\n"
+    "\n"
+    "static const uint64_t hash_secret[8] = {\n"
+    "    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,\n"
+    "    0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,\n"
+    "};\n"
+    "\n"
+    "typedef void (*HashAccumulate)(uint64_t acc[8], const unsigned char *data, size_t blocks);\n"
+    "\n"
+    "static uint64_t load64(const unsigned char *p) {\n"
+    "    uint64_t v;\n"
+    "    memcpy(&v, p, sizeof(v));\n"
+    "    return v;\n"
+    "}\n"
+    "\n"
+    "static uint64_t hash_avalanche(uint64_t h) {\n"
+    "    h ^= h >> 33;\n"
+    "    h *= 0xff51afd7ed558ccdULL;\n"
+    "    h ^= h >> 33;\n"
+    "    h *= 0xc4ceb9fe1a85ec53ULL;\n"
+    "    h ^= h >> 33;\n"
+    "    return h;\n"
+    "}\n"
+    "\n"
+    "static uint64_t hash_with(const void *data, size_t len, HashAccumulate accumulate) {\n"
+    "    const unsigned char *p = data;\n"
+    "    uint64_t             h = len * HASH_PRIME1;\n"
+    "    size_t               blocks = len / 64;\n"
+    "\n"
+    "    if (blocks) {\n"
+    "        uint64_t acc[8];\n"
+    "        memcpy(acc, hash_secret, sizeof(acc));\n"
+    "        accumulate(acc, p, blocks);\n"
+    "        for (int i = 0; i < 8; i++)\n"
+    "            h = (h ^ hash_avalanche(acc[i])) * HASH_PRIME2;\n"
+    "        p += blocks * 64;\n"
+    "        len -= blocks * 64;\n"
+    "    }\n"
+    "\n"
+    "    for (; len >= 8; p += 8, len -= 8) {\n"
+    "        h ^= hash_avalanche(load64(p) * HASH_PRIME2);\n"
+    "        h = ((h << 27) | (h >> 37)) * HASH_PRIME1;\n"
+    "    }\n"
+    "    if (len) {\n"
+    "        uint64_t tail = 0;\n"
+    "        memcpy(&tail, p, len);\n"
+    "        h ^= hash_avalanche((tail ^ len) * HASH_PRIME1);\n"
+    "    }\n"
+    "    return hash_avalanche(h);\n"
+    "}\n"
+    "\n"
+    "// =========================== [ SCALAR ] =========================================\n"
+    "\n"
+    "static const char *scalar_find_char(const char *hay, size_t len, int ch) {\n"
+    "    return memchr(hay, ch, len);\n"
+    "}\n"
+    "\n"
+    "static const char *scalar_find(const char *hay, size_t hay_len, const char *needle,\n"
+    "                               size_t needle_len) {\n"
+    "    if (needle_len == 0) return hay;\n"
+    "    if (needle_len > hay_len) return NULL;\n"
+    "\n"
+    "    const char *end = hay + hay_len - needle_len;\n"
+    "    for (const char *p = hay; p <= end; p++) {\n"
+    "        p = memchr(p, needle[0], end - p + 1);\n"
+    "        if (!p) return NULL;\n"
+    "        if (memcmp(p + 1, needle + 1, needle_len - 1) == 0) return p;\n"
+    "    }\n"
+    "    return NULL;\n"
+    "}\n"
+    "\n"
+    "static int scalar_eq(const void *a, const void *b, size_t len) { return memcmp(a, b, len) == 0; }\n"
+    "\n"
+    "static int scalar_cmp(const void *a, const void *b, size_t len) { return memcmp(a, b, len); }\n"
+    "\n"
+    "static size_t scalar_count_char(const char *hay, size_t len, int ch) {\n"
+    "    size_t count = 0;\n"
+    "    for (size_t i = 0; i < len; i++)\n"
+    "        count += (unsigned char)hay[i] == (unsigned char)ch;\n"
+    "    return count;\n"
+    "}\n"
+    "\n"
+    "static void scalar_accumulate(uint64_t acc[8], const unsigned char *data, size_t blocks) {\n"
+    "    for (size_t b = 0; b < blocks; b++, data += 64) {\n"
+    "        for (int i = 0; i < 8; i++) {\n"
+    "            uint64_t d = load64(data + 8 * i);\n"
+    "            uint64_t k = d ^ hash_secret[i];\n"
+    "            acc[i] += (k & 0xffffffffULL) * (k >> 32) + d;\n"
+    "        }\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static uint64_t scalar_hash(const void *data, size_t len) {\n"
+    "    return hash_with(data, len, scalar_accumulate);\n"
+    "}\n"
+    "\n"
+    "static int scalar_utf8_validate(const char *s, size_t len) {\n"
+    "    const unsigned char *p = (const unsigned char *)s;\n"
+    "    const unsigned char *end = p + len;\n"
+    "    int                  ascii = 1;\n"
+    "\n"
+    "    while (p < end) {\n"
+    "        if (end - p >= 8 && !(load64(p) & 0x8080808080808080ULL)) {\n"
+    "            p += 8;\n"
+    "            continue;\n"
+    "        }\n"
+    "        if (*p < 0x80) {\n"
+    "            p++;\n"
+    "            continue;\n"
+    "        }\n"
+    "        ascii = 0;\n"
+    "\n"
+    "        size_t   extra;\n"
+    "        uint32_t cp, min;\n"
+    "        if (*p >= 0xC2 && *p <= 0xDF) {\n"
+    "            extra = 1, cp = *p & 0x1F, min = 0x80;\n"
+    "        } else if ((*p & 0xF0) == 0xE0) {\n"
+    "            extra = 2, cp = *p & 0x0F, min = 0x800;\n"
+    "        } else if (*p >= 0xF0 && *p <= 0xF4) {\n"
+    "            extra = 3, cp = *p & 0x07, min = 0x10000;\n"
+    "        } else {\n"
+    "            return SIMD_UTF8_INVALID;\n"
+    "        }\n"
+    "        if ((size_t)(end - p) <= extra) return SIMD_UTF8_INVALID;\n"
+    "\n"
+    "        for (size_t i = 1; i <= extra; i++) {\n"
+    "            if ((p[i] & 0xC0) != 0x80) return SIMD_UTF8_INVALID;\n"
+    "            cp = (cp << 6) | (p[i] & 0x3F);\n"
+    "        }\n"
+    "        if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return SIMD_UTF8_INVALID;\n"
+    "        p += extra + 1;\n"
+    "    }\n"
+    "    return ascii ? SIMD_UTF8_ASCII : SIMD_UTF8_VALID;\n"
+    "}\n"
+    "\n"
+    "// Every byte that is not a continuation byte (10xxxxxx) starts a code point\n"
+    "static size_t scalar_utf8_count(const char *s, size_t len) {\n"
+    "    size_t count = 0;\n"
+    "    for (size_t i = 0; i < len; i++)\n"
+    "        count += ((unsigned char)s[i] & 0xC0) != 0x80;\n"
+    "    return count;\n"
+    "}\n"
+    "\n"
+    "const SimdKernels simd_scalar = {\n"
+    "    \"scalar\",    scalar_find_char,  scalar_find, scalar_eq,\n"
+    "    scalar_cmp,  scalar_count_char, scalar_hash, scalar_utf8_validate,\n"
+    "    scalar_utf8_count,\n"
+    "};\n"
+    "\n"
+    "#ifdef SAM_SIMD_X86\n"
+    "\n"
+    "// =========================== [ SSE2 ] =========================================\n"
+    "\n"
+    "#define SSE2 __attribute__((target(\"sse2\")))\n"
+    "\n"
+    "SSE2 static const char *sse2_find_char(const char *hay, size_t len, int ch) {\n"
+    "    __m128i needle = _mm_set1_epi8((char)ch);\n"
+    "    size_t  i = 0;\n"
+    "    for (; i + 16 <= len; i += 16) {\n"
+    "        __m128i  block = _mm_loadu_si128((const __m128i *)(hay + i));\n"
+    "        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));\n"
+    "        if (mask) return hay + i + __builtin_ctz(mask);\n"
+    "    }\n"
+    "    return scalar_find_char(hay + i, len - i, ch);\n"
+    "}\n"
+    "\n"
+    "// First/last byte filter: compare the needle's first byte at i and its last\n"
+    "// byte at i + n - 1 for 16 positions at once, then verify the candidates\n"
+    "SSE2 static const char *sse2_find(const char *hay, size_t hay_len, const char *needle,\n"
+    "                                  size_t needle_len) {\n"
+    "    if (needle_len <= 1) {\n"
+    "        return needle_len ? sse2_find_char(hay, hay_len, needle[0]) : hay;\n"
+    "    }\n"
+    "    if (needle_len > hay_len) return NULL;\n"
+    "\n"
+    "    __m128i first = _mm_set1_epi8(needle[0]);\n"
+    "    __m128i last = _mm_set1_epi8(needle[needle_len - 1]);\n"
+    "    size_t  i = 0;\n"
+    "    for (; i + needle_len - 1 + 16 <= hay_len; i += 16) {\n"
+    "        __m128i  block_first = _mm_loadu_si128((const __m128i *)(hay + i));\n"
+    "        __m128i  block_last = _mm_loadu_si128((const __m128i *)(hay + i + needle_len - 1));\n"
+    "        unsigned mask = _mm_movemask_epi8(\n"
+    "            _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));\n"
+    "        while (mask) {\n"
+    "            unsigned bit = __builtin_ctz(mask);\n"
+    "            if (memcmp(hay + i + bit + 1, needle + 1, needle_len - 2) == 0) return hay + i + bit;\n"
+    "            mask &= mask - 1;\n"
+    "        }\n"
+    "    }\n"
+    "    return scalar_find(hay + i, hay_len - i, needle, needle_len);\n"
+    "}\n"
+    "\n"
+    "SSE2 static int sse2_cmp(const void *a, const void *b, size_t len) {\n"
+    "    const unsigned char *pa = a, *pb = b;\n"
+    "    size_t               i = 0;\n"
+    "    for (; i + 16 <= len; i += 16) {\n"
+    "        __m128i  va = _mm_loadu_si128((const __m128i *)(pa + i));\n"
+    "        __m128i  vb = _mm_loadu_si128((const __m128i *)(pb + i));\n"
+    "        unsigned diff = ~_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xffffu;\n"
+    "        if (diff) {\n"
+    "            unsigned bit = __builtin_ctz(diff);\n"
+    "            return (int)pa[i + bit] - (int)pb[i + bit];\n"
+    "        }\n"
+    "    }\n"
+    "    return memcmp(pa + i, pb + i, len - i);\n"
+    "}\n"
+    "\n"
+    "SSE2 static int sse2_eq(const void *a, const void *b, size_t len) {\n"
+    "    const unsigned char *pa = a, *pb = b;\n"
+    "    size_t               i = 0;\n"
+    "    for (; i + 16 <= len; i += 16) {\n"
+    "        __m128i va = _mm_loadu_si128((const __m128i *)(pa + i));\n"
+    "        __m128i vb = _mm_loadu_si128((const __m128i *)(pb + i));\n"
+    "        if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xffff) return 0;\n"
+    "    }\n"
+    "    return memcmp(pa + i, pb + i, len - i) == 0;\n"
+    "}\n"
+    "\n"
+    "// Matches are subtracted into byte counters (cmpeq yields -1) and folded with\n"
+    "// psadbw before any counter can wrap\n"
+    "SSE2 static size_t sse2_count_char(const char *hay, size_t len, int ch) {\n"
+    "    __m128i needle = _mm_set1_epi8((char)ch);\n"
+    "    __m128i zero = _mm_setzero_si128();\n"
+    "    size_t  count = 0, i = 0;\n"
+    "    while (i + 16 <= len) {\n"
+    "        __m128i counters = zero;\n"
+    "        for (int round = 0; round < 255 && i + 16 <= len; round++, i += 16) {\n"
+    "            __m128i block = _mm_loadu_si128((const __m128i *)(hay + i));\n"
+    "            counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(block, needle));\n"
+    "        }\n"
+    "        __m128i sums = _mm_sad_epu8(counters, zero);\n"
+    "        count += _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));\n"
+    "    }\n"
+    "    return count + scalar_count_char(hay + i, len - i, ch);\n"
+    "}\n"
+    "\n"
+    "SSE2 static void sse2_accumulate(uint64_t acc[8], const unsigned char *data, size_t blocks) {\n"
+    "    __m128i lanes[4], secret[4];\n"
+    "    for (int j = 0; j < 4; j++) {\n"
+    "        lanes[j] = _mm_loadu_si128((const __m128i *)(acc + 2 * j));\n"
+    "        secret[j] = _mm_loadu_si128((const __m128i *)(hash_secret + 2 * j));\n"
+    "    }\n"
+    "    for (size_t b = 0; b < blocks; b++, data += 64) {\n"
+    "        for (int j = 0; j < 4; j++) {\n"
+    "            __m128i d = _mm_loadu_si128((const __m128i *)(data + 16 * j));\n"
+    "            __m128i k = _mm_xor_si128(d, secret[j]);\n"
+    "            __m128i product = _mm_mul_epu32(k, _mm_srli_epi64(k, 32));\n"
+    "            lanes[j] = _mm_add_epi64(lanes[j], _mm_add_epi64(product, d));\n"
+    "        }\n"
+    "    }\n"
+    "    for (int j = 0; j < 4; j++)\n"
+    "        _mm_storeu_si128((__m128i *)(acc + 2 * j), lanes[j]);\n"
+    "}\n"
+    "\n"
+    "SSE2 static uint64_t sse2_hash(const void *data, size_t len) {\n"
+    "    return hash_with(data, len, sse2_accumulate);\n"
+    "}\n"
+    "\n"
+    "SSE2 static size_t sse2_utf8_count(const char *s, size_t len) {\n"
+    "    __m128i limit = _mm_set1_epi8(-65); // (int8_t)0xBF, the largest continuation byte\n"
+    "    __m128i zero = _mm_setzero_si128();\n"
+    "    size_t  count = 0, i = 0;\n"
+    "    while (i + 16 <= len) {\n"
+    "        __m128i counters = zero;\n"
+    "        for (int round = 0; round < 255 && i + 16 <= len; round++, i += 16) {\n"
+    "            __m128i block = _mm_loadu_si128((const __m128i *)(s + i));\n"
+    "            counters = _mm_sub_epi8(counters, _mm_cmpgt_epi8(block, limit));\n"
+    "        }\n"
+    "        __m128i sums = _mm_sad_epu8(counters, zero);\n"
+    "        count += _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));\n"
+    "    }\n"
+    "    return count + scalar_utf8_count(s + i, len - i);\n"
+    "}\n"
+    "\n"
+    "static const SimdKernels sse2_kernels = {\n"
+    "    \"sse2\",         sse2_find_char,       sse2_find, sse2_eq, sse2_cmp, sse2_count_char,\n"
+    "    sse2_hash,      scalar_utf8_validate, sse2_utf8_count,\n"
+    "};\n"
+    "\n"
+    "// =========================== [ UTF-8 LOOKUP TABLES ] ================================\n"
+    "// Keiser & Lemire, \"Validating UTF-8 In Less Than One Instruction Per Byte\".\n"
+    "// Three 16-entry nibble lookups classify every (previous byte, byte) pair;\n"
+    "// their AND is non-zero exactly where the pair is an error, except for the\n"
+    "// 3rd/4th continuation bytes, which are checked against prev2/prev3.\n"
+    "\n"
+    "#define UTF8_TOO_SHORT (1 << 0)\n"
+    "#define UTF8_TOO_LONG (1 << 1)\n"
+    "#define UTF8_OVERLONG_3 (1 << 2)\n"
+    "#define UTF8_TOO_LARGE (1 << 3)\n"
+    "#define UTF8_SURROGATE (1 << 4)\n"
+    "#define UTF8_OVERLONG_2 (1 << 5)\n"
+    "#define UTF8_TOO_LARGE_1000 (1 << 6)\n"
+    "#define UTF8_OVERLONG_4 (1 << 6)\n"
+    "#define UTF8_TWO_CONTS (1 << 7)\n"
+    "#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)\n"
+    "\n"
+    "static const unsigned char utf8_byte_1_high[16] = {\n"
+    "    UTF8_TOO_LONG,  UTF8_TOO_LONG,  UTF8_TOO_LONG,  UTF8_TOO_LONG,\n"
+    "    UTF8_TOO_LONG,  UTF8_TOO_LONG,  UTF8_TOO_LONG,  UTF8_TOO_LONG,\n"
+    "    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,\n"
+    "    UTF8_TOO_SHORT | UTF8_OVERLONG_2,\n"
+    "    UTF8_TOO_SHORT,\n"
+    "    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,\n"
+    "    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,\n"
+    "};\n"
+    "\n"
+    "static const unsigned char utf8_byte_1_low[16] = {\n"
+    "    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,\n"
+    "    UTF8_CARRY | UTF8_OVERLONG_2,\n"
+    "    UTF8_CARRY,\n"
+    "    UTF8_CARRY,\n"
+    "    UTF8_CARRY | UTF8_TOO_LARGE,\n"
+    "    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,\n"
+    "    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,\n"
+    "    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,\n"
+    "    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,\n"
+    "    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,\n"
+    "    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,\n"
+    "    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,\n"
+    "    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,\n"
+    "    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,\n"
+    "    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,\n"
+    "    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,\n"
+    "};\n"
+    "\n"
+    "static const unsigned char utf8_byte_2_high[16] = {\n"
+    "    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,\n"
+    "    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,\n"
+    "    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 |\n"
+    "        UTF8_OVERLONG_4,\n"
+    "    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,\n"
+    "    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,\n"
+    "    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,\n"
+    "    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,\n"
+    "};\n"
+    "\n"
+    "// A block ending in the first bytes of a multi-byte sequence must be continued\n"
+    "static const unsigned char utf8_incomplete_max[32] = {\n"
+    "    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  255,  255,\n"
+    "    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  255,  255,\n"
+    "    255, 255, 255, 0xEF, 0xDF, 0xBF,\n"
+    "};\n"
+    "\n"
+    "// =========================== [ SSSE3 ] =========================================\n"
+    "\n"
+    "#define SSSE3 __attribute__((target(\"ssse3\")))\n"
+    "\n"
+    "typedef struct {\n"
+    "    __m128i byte_1_high, byte_1_low, byte_2_high, incomplete_max;\n"
+    "} Utf8Tables128;\n"
+    "\n"
+    "SSSE3 static __m128i ssse3_utf8_errors(const Utf8Tables128 *t, __m128i input, __m128i prev_input) {\n"
+    "    __m128i nibble = _mm_set1_epi8(0x0F);\n"
+    "    __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);\n"
+    "    __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);\n"
+    "    __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);\n"
+    "\n"
+    "    __m128i special = _mm_and_si128(\n"
+    "        _mm_and_si128(\n"
+    "            _mm_shuffle_epi8(t->byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),\n"
+    "            _mm_shuffle_epi8(t->byte_1_low, _mm_and_si128(prev1, nibble))),\n"
+    "        _mm_shuffle_epi8(t->byte_2_high, _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));\n"
+    "\n"
+    "    __m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80)));\n"
+    "    __m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80)));\n"
+    "    __m128i must_be_cont = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));\n"
+    "    return _mm_xor_si128(must_be_cont, special);\n"
+    "}\n"
+    "\n"
+    "SSSE3 static int ssse3_utf8_validate(const char *s, size_t len) {\n"
+    "    Utf8Tables128 t = {\n"
+    "        _mm_loadu_si128((const __m128i *)utf8_byte_1_high),\n"
+    "        _mm_loadu_si128((const __m128i *)utf8_byte_1_low),\n"
+    "        _mm_loadu_si128((const __m128i *)utf8_byte_2_high),\n"
+    "        _mm_loadu_si128((const __m128i *)(utf8_incomplete_max + 16)),\n"
+    "    };\n"
+    "    __m128i zero = _mm_setzero_si128();\n"
+    "    __m128i error = zero, prev_input = zero, prev_incomplete = zero, high_bits = zero;\n"
+    "\n"
+    "    for (size_t i = 0; i < len; i += 16) {\n"
+    "        __m128i input;\n"
+    "        if (i + 16 <= len) {\n"
+    "            input = _mm_loadu_si128((const __m128i *)(s + i));\n"
+    "        } else {\n"
+    "            char tail[16] = {0};\n"
+    "            memcpy(tail, s + i, len - i);\n"
+    "            input = _mm_loadu_si128((const __m128i *)tail);\n"
+    "        }\n"
+    "\n"
+    "        if (_mm_movemask_epi8(input) == 0) {\n"
+    "            error = _mm_or_si128(error, prev_incomplete);\n"
+    "            prev_incomplete = zero;\n"
+    "        } else {\n"
+    "            high_bits = _mm_or_si128(high_bits, input);\n"
+    "            error = _mm_or_si128(error, ssse3_utf8_errors(&t, input, prev_input));\n"
+    "            prev_incomplete = _mm_subs_epu8(input, t.incomplete_max);\n"
+    "        }\n"
+    "        prev_input = input;\n"
+    "    }\n"
+    "\n"
+    "    error = _mm_or_si128(error, prev_incomplete);\n"
+    "    if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, zero)) != 0xffff) return SIMD_UTF8_INVALID;\n"
+    "    return _mm_movemask_epi8(high_bits) ? SIMD_UTF8_VALID : SIMD_UTF8_ASCII;\n"
+    "}\n"
+    "\n"
+    "static const SimdKernels ssse3_kernels = {\n"
+    "    \"ssse3\",        sse2_find_char,      sse2_find, sse2_eq, sse2_cmp, sse2_count_char,\n"
+    "    sse2_hash,      ssse3_utf8_validate, sse2_utf8_count,\n"
+    "};\n"
+    "\n"
+    "// =========================== [ AVX2 ] =========================================\n"
+    "\n"
+    "#define AVX2 __attribute__((target(\"avx2\")))\n"
+    "\n"
+    "// Tails are handed to the narrower kernels. GCC does not clear the upper\n"
+    "// register halves before such calls, and legacy SSE code running with dirty\n"
+    "// upper state stalls, so each hand-off is preceded by vzeroupper.\n"
+    "\n"
+    "AVX2 static const char *avx2_find_char(const char *hay, size_t len, int ch) {\n"
+    "    __m256i needle = _mm256_set1_epi8((char)ch);\n"
+    "    size_t  i = 0;\n"
+    "    for (; i + 32 <= len; i += 32) {\n"
+    "        __m256i  block = _mm256_loadu_si256((const __m256i *)(hay + i));\n"
+    "        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));\n"
+    "        if (mask) return hay + i + __builtin_ctz(mask);\n"
+    "    }\n"
+    "    _mm256_zeroupper();\n"
+    "    return sse2_find_char(hay + i, len - i, ch);\n"
+    "}\n"
+    "\n"
+    "AVX2 static const char *avx2_find(const char *hay, size_t hay_len, const char *needle,\n"
+    "                                  size_t needle_len) {\n"
+    "    if (needle_len <= 1) {\n"
+    "        return needle_len ? avx2_find_char(hay, hay_len, needle[0]) : hay;\n"
+    "    }\n"
+    "    if (needle_len > hay_len) return NULL;\n"
+    "\n"
+    "    __m256i first = _mm256_set1_epi8(needle[0]);\n"
+    "    __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);\n"
+    "    size_t  i = 0;\n"
+    "    for (; i + needle_len - 1 + 32 <= hay_len; i += 32) {\n"
+    "        __m256i  block_first = _mm256_loadu_si256((const __m256i *)(hay + i));\n"
+    "        __m256i  block_last = _mm256_loadu_si256((const __m256i *)(hay + i + needle_len - 1));\n"
+    "        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(\n"
+    "            _mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)));\n"
+    "        while (mask) {\n"
+    "            unsigned bit = __builtin_ctz(mask);\n"
+    "            if (memcmp(hay + i + bit + 1, needle + 1, needle_len - 2) == 0) return hay + i + bit;\n"
+    "            mask &= mask - 1;\n"
+    "        }\n"
+    "    }\n"
+    "    _mm256_zeroupper();\n"
+    "    return sse2_find(hay + i, hay_len - i, needle, needle_len);\n"
+    "}\n"
+    "\n"
+    "AVX2 static int avx2_cmp(const void *a, const void *b, size_t len) {\n"
+    "    const unsigned char *pa = a, *pb = b;\n"
+    "    size_t               i = 0;\n"
+    "    for (; i + 32 <= len; i += 32) {\n"
+    "        __m256i  va = _mm256_loadu_si256((const __m256i *)(pa + i));\n"
+    "        __m256i  vb = _mm256_loadu_si256((const __m256i *)(pb + i));\n"
+    "        unsigned diff = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));\n"
+    "        if (diff) {\n"
+    "            unsigned bit = __builtin_ctz(diff);\n"
+    "            return (int)pa[i + bit] - (int)pb[i + bit];\n"
+    "        }\n"
+    "    }\n"
+    "    _mm256_zeroupper();\n"
+    "    return sse2_cmp(pa + i, pb + i, len - i);\n"
+    "}\n"
+    "\n"
+    "AVX2 static int avx2_eq(const void *a, const void *b, size_t len) {\n"
+    "    const unsigned char *pa = a, *pb = b;\n"
+    "    size_t               i = 0;\n"
+    "    for (; i + 32 <= len; i += 32) {\n"
+    "        __m256i va = _mm256_loadu_si256((const __m256i *)(pa + i));\n"
+    "        __m256i vb = _mm256_loadu_si256((const __m256i *)(pb + i));\n"
+    "        if ((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)) != 0xffffffffu) return 0;\n"
+    "    }\n"
+    "    _mm256_zeroupper();\n"
+    "    return sse2_eq(pa + i, pb + i, len - i);\n"
+    "}\n"
+    "\n"
+    "AVX2 static size_t avx2_count_char(const char *hay, size_t len, int ch) {\n"
+    "    __m256i needle = _mm256_set1_epi8((char)ch);\n"
+    "    __m256i zero = _mm256_setzero_si256();\n"
+    "    size_t  count = 0, i = 0;\n"
+    "    while (i + 32 <= len) {\n"
+    "        __m256i counters = zero;\n"
+    "        for (int round = 0; round < 255 && i + 32 <= len; round++, i += 32) {\n"
+    "            __m256i block = _mm256_loadu_si256((const __m256i *)(hay + i));\n"
+    "            counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(block, needle));\n"
+    "        }\n"
+    "        __m256i sums = _mm256_sad_epu8(counters, zero);\n"
+    "        count += (size_t)_mm256_extract_epi64(sums, 0) + (size_t)_mm256_extract_epi64(sums, 1) +\n"
+    "                 (size_t)_mm256_extract_epi64(sums, 2) + (size_t)_mm256_extract_epi64(sums, 3);\n"
+    "    }\n"
+    "    _mm256_zeroupper();\n"
+    "    return count + sse2_count_char(hay + i, len - i, ch);\n"
+    "}\n"
+    "\n"
+    "AVX2 static void avx2_accumulate(uint64_t acc[8], const unsigned char *data, size_t blocks) {\n"
+    "    __m256i lanes[2], secret[2];\n"
+    "    for (int j = 0; j < 2; j++) {\n"
+    "        lanes[j] = _mm256_loadu_si256((const __m256i *)(acc + 4 * j));\n"
+    "        secret[j] = _mm256_loadu_si256((const __m256i *)(hash_secret + 4 * j));\n"
+    "    }\n"
+    "    for (size_t b = 0; b < blocks; b++, data += 64) {\n"
+    "        for (int j = 0; j < 2; j++) {\n"
+    "            __m256i d = _mm256_loadu_si256((const __m256i *)(data + 32 * j));\n"
+    "            __m256i k = _mm256_xor_si256(d, secret[j]);\n"
+    "            __m256i product = _mm256_mul_epu32(k, _mm256_srli_epi64(k, 32));\n"
+    "            lanes[j] = _mm256_add_epi64(lanes[j], _mm256_add_epi64(product, d));\n"
+    "        }\n"
+    "    }\n"
+    "    for (int j = 0; j < 2; j++)\n"
+    "        _mm256_storeu_si256((__m256i *)(acc + 4 * j), lanes[j]);\n"
+    "}\n"
+    "\n"
+    "AVX2 static uint64_t avx2_hash(const void *data, size_t len) {\n"
+    "    return hash_with(data, len, avx2_accumulate);\n"
+    "}\n"
+    "\n"
+    "typedef struct {\n"
+    "    __m256i byte_1_high, byte_1_low, byte_2_high, incomplete_max;\n"
+    "} Utf8Tables256;\n"
+    "\n"
+    "AVX2 static __m256i avx2_prev(__m256i input, __m256i prev_input, int n) {\n"
+    "    __m256i carried = _mm256_permute2x128_si256(prev_input, input, 0x21);\n"
+    "    switch (n) {\n"
+    "    case 1: return _mm256_alignr_epi8(input, carried, 15);\n"
+    "    case 2: return _mm256_alignr_epi8(input, carried, 14);\n"
+    "    default: return _mm256_alignr_epi8(input, carried, 13);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "AVX2 static __m256i avx2_utf8_errors(const Utf8Tables256 *t, __m256i input, __m256i prev_input) {\n"
+    "    __m256i nibble = _mm256_set1_epi8(0x0F);\n"
+    "    __m256i prev1 = avx2_prev(input, prev_input, 1);\n"
+    "    __m256i prev2 = avx2_prev(input, prev_input, 2);\n"
+    "    __m256i prev3 = avx2_prev(input, prev_input, 3);\n"
+    "\n"
+    "    __m256i special = _mm256_and_si256(\n"
+    "        _mm256_and_si256(\n"
+    "            _mm256_shuffle_epi8(t->byte_1_high,\n"
+    "                                _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),\n"
+    "            _mm256_shuffle_epi8(t->byte_1_low, _mm256_and_si256(prev1, nibble))),\n"
+    "        _mm256_shuffle_epi8(t->byte_2_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));\n"
+    "\n"
+    "    __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80)));\n"
+    "    __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)));\n"
+    "    __m256i must_be_cont =\n"
+    "        _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));\n"
+    "    return _mm256_xor_si256(must_be_cont, special);\n"
+    "}\n"
+    "\n"
+    "AVX2 static int avx2_utf8_validate(const char *s, size_t len) {\n"
+    "    Utf8Tables256 t = {\n"
+    "        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)utf8_byte_1_high)),\n"
+    "        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)utf8_byte_1_low)),\n"
+    "        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)utf8_byte_2_high)),\n"
+    "        _mm256_loadu_si256((const __m256i *)utf8_incomplete_max),\n"
+    "    };\n"
+    "    __m256i zero = _mm256_setzero_si256();\n"
+    "    __m256i error = zero, prev_input = zero, prev_incomplete = zero, high_bits = zero;\n"
+    "\n"
+    "    for (size_t i = 0; i < len; i += 32) {\n"
+    "        __m256i input;\n"
+    "        if (i + 32 <= len) {\n"
+    "            input = _mm256_loadu_si256((const __m256i *)(s + i));\n"
+    "        } else {\n"
+    "            char tail[32] = {0};\n"
+    "            memcpy(tail, s + i, len - i);\n"
+    "            input = _mm256_loadu_si256((const __m256i *)tail);\n"
+    "        }\n"
+    "\n"
+    "        if (_mm256_movemask_epi8(input) == 0) {\n"
+    "            error = _mm256_or_si256(error, prev_incomplete);\n"
+    "            prev_incomplete = zero;\n"
+    "        } else {\n"
+    "            high_bits = _mm256_or_si256(high_bits, input);\n"
+    "            error = _mm256_or_si256(error, avx2_utf8_errors(&t, input, prev_input));\n"
+    "            prev_incomplete = _mm256_subs_epu8(input, t.incomplete_max);\n"
+    "        }\n"
+    "        prev_input = input;\n"
+    "    }\n"
+    "\n"
+    "    error = _mm256_or_si256(error, prev_incomplete);\n"
+    "    if (!_mm256_testz_si256(error, error)) return SIMD_UTF8_INVALID;\n"
+    "    return _mm256_movemask_epi8(high_bits) ? SIMD_UTF8_VALID : SIMD_UTF8_ASCII;\n"
+    "}\n"
+    "\n"
+    "AVX2 static size_t avx2_utf8_count(const char *s, size_t len) {\n"
+    "    __m256i limit = _mm256_set1_epi8(-65);\n"
+    "    __m256i zero = _mm256_setzero_si256();\n"
+    "    size_t  count = 0, i = 0;\n"
+    "    while (i + 32 <= len) {\n"
+    "        __m256i counters = zero;\n"
+    "        for (int round = 0; round < 255 && i + 32 <= len; round++, i += 32) {\n"
+    "            __m256i block = _mm256_loadu_si256((const __m256i *)(s + i));\n"
+    "            counters = _mm256_sub_epi8(counters, _mm256_cmpgt_epi8(block, limit));\n"
+    "        }\n"
+    "        __m256i sums = _mm256_sad_epu8(counters, zero);\n"
+    "        count += (size_t)_mm256_extract_epi64(sums, 0) + (size_t)_mm256_extract_epi64(sums, 1) +\n"
+    "                 (size_t)_mm256_extract_epi64(sums, 2) + (size_t)_mm256_extract_epi64(sums, 3);\n"
+    "    }\n"
+    "    _mm256_zeroupper();\n"
+    "    return count + sse2_utf8_count(s + i, len - i);\n"
+    "}\n"
+    "\n"
+    "static const SimdKernels avx2_kernels = {\n"
+    "    \"avx2\",         avx2_find_char,     avx2_find, avx2_eq, avx2_cmp, avx2_count_char,\n"
+    "    avx2_hash,      avx2_utf8_validate, avx2_utf8_count,\n"
+    "};\n"
+    "\n"
+    "// =========================== [ AVX-512 ] =========================================\n"
+    "\n"
+    "#define AVX512 __attribute__((target(\"avx512f,avx512bw\")))\n"
+    "\n"
+    "AVX512 static const char *avx512_find_char(const char *hay, size_t len, int ch) {\n"
+    "    __m512i needle = _mm512_set1_epi8((char)ch);\n"
+    "    size_t  i = 0;\n"
+    "    for (; i + 64 <= len; i += 64) {\n"
+    "        __m512i   block = _mm512_loadu_si512((const void *)(hay + i));\n"
+    "        __mmask64 mask = _mm512_cmpeq_epi8_mask(block, needle);\n"
+    "        if (mask) return hay + i + __builtin_ctzll(mask);\n"
+    "    }\n"
+    "    _mm256_zeroupper();\n"
+    "    return avx2_find_char(hay + i, len - i, ch);\n"
+    "}\n"
+    "\n"
+    "AVX512 static const char *avx512_find(const char *hay, size_t hay_len, const char *needle,\n"
+    "                                      size_t needle_len) {\n"
+    "    if (needle_len <= 1) {\n"
+    "        return needle_len ? avx512_find_char(hay, hay_len, needle[0]) : hay;\n"
+    "    }\n"
+    "    if (needle_len > hay_len) return NULL;\n"
+    "\n"
+    "    __m512i first = _mm512_set1_epi8(needle[0]);\n"
+    "    __m512i last = _mm512_set1_epi8(needle[needle_len - 1]);\n"
+    "    size_t  i = 0;\n"
+    "    for (; i + needle_len - 1 + 64 <= hay_len; i += 64) {\n"
+    "        __m512i   block_first = _mm512_loadu_si512((const void *)(hay + i));\n"
+    "        __m512i   block_last = _mm512_loadu_si512((const void *)(hay + i + needle_len - 1));\n"
+    "        __mmask64 mask = _mm512_cmpeq_epi8_mask(block_first, first) &\n"
+    "                         _mm512_cmpeq_epi8_mask(block_last, last);\n"
+    "        while (mask) {\n"
+    "            unsigned bit = __builtin_ctzll(mask);\n"
+    "            if (memcmp(hay + i + bit + 1, needle + 1, needle_len - 2) == 0) return hay + i + bit;\n"
+    "            mask &= mask - 1;\n"
+    "        }\n"
+    "    }\n"
+    "    _mm256_zeroupper();\n"
+    "    return avx2_find(hay + i, hay_len - i, needle, needle_len);\n"
+    "}\n"
+    "\n"
+    "AVX512 static int avx512_cmp(const void *a, const void *b, size_t len) {\n"
+    "    const unsigned char *pa = a, *pb = b;\n"
+    "    size_t               i = 0;\n"
+    "    for (; i + 64 <= len; i += 64) {\n"
+    "        __m512i   va = _mm512_loadu_si512((const void *)(pa + i));\n"
+    "        __m512i   vb = _mm512_loadu_si512((const void *)(pb + i));\n"
+    "        __mmask64 diff = _mm512_cmpneq_epi8_mask(va, vb);\n"
+    "        if (diff) {\n"
+    "            unsigned bit = __builtin_ctzll(diff);\n"
+    "            return (int)pa[i + bit] - (int)pb[i + bit];\n"
+    "        }\n"
+    "    }\n"
+    "    _mm256_zeroupper();\n"
+    "    return avx2_cmp(pa + i, pb + i, len - i);\n"
+    "}\n"
+    "\n"
+    "AVX512 static int avx512_eq(const void *a, const void *b, size_t len) {\n"
+    "    const unsigned char *pa = a, *pb = b;\n"
+    "    size_t               i = 0;\n"
+    "    for (; i + 64 <= len; i += 64) {\n"
+    "        __m512i va = _mm512_loadu_si512((const void *)(pa + i));\n"
+    "        __m512i vb = _mm512_loadu_si512((const void *)(pb + i));\n"
+    "        if (_mm512_cmpneq_epi8_mask(va, vb)) return 0;\n"
+    "    }\n"
+    "    _mm256_zeroupper();\n"
+    "    return avx2_eq(pa + i, pb + i, len - i);\n"
+    "}\n"
+    "\n"
+    "AVX512 static size_t avx512_count_char(const char *hay, size_t len, int ch) {\n"
+    "    __m512i needle = _mm512_set1_epi8((char)ch);\n"
+    "    size_t  count = 0, i = 0;\n"
+    "    for (; i + 64 <= len; i += 64) {\n"
+    "        __m512i block = _mm512_loadu_si512((const void *)(hay + i));\n"
+    "        count += __builtin_popcountll(_mm512_cmpeq_epi8_mask(block, needle));\n"
+    "    }\n"
+    "    _mm256_zeroupper();\n"
+    "    return count + avx2_count_char(hay + i, len - i, ch);\n"
+    "}\n"
+    "\n"
+    "AVX512 static void avx512_accumulate(uint64_t acc[8], const unsigned char *data, size_t blocks) {\n"
+    "    __m512i lanes = _mm512_loadu_si512((const void *)acc);\n"
+    "    __m512i secret = _mm512_loadu_si512((const void *)hash_secret);\n"
+    "    for (size_t b = 0; b < blocks; b++, data += 64) {\n"
+    "        __m512i d = _mm512_loadu_si512((const void *)data);\n"
+    "        __m512i k = _mm512_xor_si512(d, secret);\n"
+    "        __m512i product = _mm512_mul_epu32(k, _mm512_srli_epi64(k, 32));\n"
+    "        lanes = _mm512_add_epi64(lanes, _mm512_add_epi64(product, d));\n"
+    "    }\n"
+    "    _mm512_storeu_si512((void *)acc, lanes);\n"
+    "}\n"
+    "\n"
+    "AVX512 static uint64_t avx512_hash(const void *data, size_t len) {\n"
+    "    return hash_with(data, len, avx512_accumulate);\n"
+    "}\n"
+    "\n"
+    "AVX512 static size_t avx512_utf8_count(const char *s, size_t len) {\n"
+    "    __m512i limit = _mm512_set1_epi8(-65);\n"
+    "    size_t  count = 0, i = 0;\n"
+    "    for (; i + 64 <= len; i += 64) {\n"
+    "        __m512i block = _mm512_loadu_si512((const void *)(s + i));\n"
+    "        count += __builtin_popcountll(_mm512_cmpgt_epi8_mask(block, limit));\n"
+    "    }\n"
+    "    return count + avx2_utf8_count(s + i, len - i);\n"
+    "}\n"
+    "\n"
+    "// Validation stays on the AVX2 lookup kernel: pshufb is per 128-bit lane on\n"
+    "// every width, so 512-bit registers only add cross-lane shuffling\n"
+    "static const SimdKernels avx512_kernels = {\n"
+    "    \"avx512\",    avx512_find_char,  avx512_find, avx512_eq,          avx512_cmp,\n"
+    "    avx512_count_char, avx512_hash, avx2_utf8_validate, avx512_utf8_count,\n"
+    "};\n"
+    "\n"
+    "const SimdKernels *simd_sse2(void) {\n"
+    "    __builtin_cpu_init();\n"
+    "    if (!__builtin_cpu_supports(\"sse2\")) return NULL;\n"
+    "    return __builtin_cpu_supports(\"ssse3\") ? &ssse3_kernels : &sse2_kernels;\n"
+    "}\n"
+    "\n"
+    "const SimdKernels *simd_avx2(void) {\n"
+    "    __builtin_cpu_init();\n"
+    "    return __builtin_cpu_supports(\"avx2\") ? &avx2_kernels : NULL;\n"
+    "}\n"
+    "\n"
+    "const SimdKernels *simd_avx512(void) {\n"
+    "    __builtin_cpu_init();\n"
+    "    return __builtin_cpu_supports(\"avx512f\") && __builtin_cpu_supports(\"avx512bw\")\n"
+    "               ? &avx512_kernels\n"
+    "               : NULL;\n"
+    "}\n"
+    "\n"
+    "#else\n"
+    "\n"
+    "const SimdKernels *simd_sse2(void) { return NULL; }\n"
+    "const SimdKernels *simd_avx2(void) { return NULL; }\n"
+    "const SimdKernels *simd_avx512(void) { return NULL; }\n"
+    "\n"
+    "#endif // SAM_SIMD_X86\n"
+    "\n"
+    "// =========================== [ DISPATCH ] =========================================\n"
+    "\n"
+    "static const SimdKernels *selected_kernels;\n"
+    "\n"
+    "const SimdKernels *simd_kernels(void) {\n"
+    "    const SimdKernels *kernels = selected_kernels;\n"
+    "    if (kernels) return kernels;\n"
+    "\n"
+    "    kernels = simd_avx512();\n"
+    "    if (!kernels) kernels = simd_avx2();\n"
+    "    if (!kernels) kernels = simd_sse2();\n"
+    "    if (!kernels) kernels = &simd_scalar;\n"
+    "    selected_kernels = kernels;\n"
+    "    return kernels;\n"
+    "}\n"
+    "\n"
+    "#ifdef __GNUC__\n"
+    "// Resolve at startup so the first string call does not pay for cpuid\n"
+    "__attribute__((constructor)) static void simd_select_at_startup(void) { simd_kernels(); }\n"
+    "#endif\n"
+    "\n"
+    "// ========== STRING VIEWS ==========\n"
+    "typedef struct {\n"
+    "    const char *ptr;\n"
+    "    size_t len;\n"
+    "    string parent;\n"
+    "} strview;\n"
+    "\n"
+    "#define SV_ARG(v) (int)(v).len, (v).ptr\n"
+    "#define strview_retain(v) rc_retain((v).parent)\n"
+    "#define strview_release(v) rc_release((v).parent)\n"
+    "\n"
+    "strview strview_from(const char *s) {\n"
+    "    strview v = {s, s ? strlen(s) : 0, NULL};\n"
+    "    return v;\n"
+    "}\n"
+    "\n"
+    "strview string_view(string s) {\n"
+    "    strview v = {s, s ? strlen(s) : 0, s};\n"
+    "    return v;\n"
+    "}\n"
+    "\n"
+    "strview strview_slice(strview v, size_t start, size_t len) {\n"
+    "    if (start > v.len) start = v.len;\n"
+    "    if (len > v.len - start) len = v.len - start;\n"
+    "    strview result = {v.ptr + start, len, v.parent};\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "strview string_slice(string s, size_t start, size_t len) {\n"
+    "    return strview_slice(string_view(s), start, len);\n"
+    "}\n"
+    "\n"
+    "strview strview_find(strview v, const char *needle) {\n"
+    "    strview none = {NULL, 0, v.parent};\n"
+    "    if (!v.ptr || !needle) return none;\n"
+    "    size_t needle_len = strlen(needle);\n"
+    "    const char *hit = simd_kernels()->find(v.ptr, v.len, needle, needle_len);\n"
+    "    if (!hit) return none;\n"
+    "    strview match = {hit, needle_len, v.parent};\n"
+    "    return match;\n"
+    "}\n"
+    "\n"
+    "strview string_find(string s, const char *needle) { return strview_find(string_view(s), needle); }\n"
+    "\n"
+    "strview strview_trim(strview v) {\n"
+    "    while (v.len > 0 && isspace((unsigned char)v.ptr[0])) { v.ptr++; v.len--; }\n"
+    "    while (v.len > 0 && isspace((unsigned char)v.ptr[v.len - 1])) v.len--;\n"
+    "    return v;\n"
+    "}\n"
+    "\n"
+    "strview string_trim(string s) { return strview_trim(string_view(s)); }\n"
+    "\n"
+    "// *field holds a reference like any strview variable: the new parent is\n"
+    "// retained and the one it held before released\n"
+    "int strview_split_next(strview *rest, char sep, strview *field) {\n"
+    "    if (!rest->ptr) return 0;\n"
+    "    const char *hit = memchr(rest->ptr, sep, rest->len);\n"
+    "    size_t field_len = hit ? (size_t)(hit - rest->ptr) : rest->len;\n"
+    "    strview taken = {rest->ptr, field_len, rest->parent};\n"
+    "    strview_retain(taken);\n"
+    "    strview_release(*field);\n"
+    "    *field = taken;\n"
+    "    if (hit) {\n"
+    "        rest->ptr = hit + 1;\n"
+    "        rest->len -= field_len + 1;\n"
+    "    } else {\n"
+    "        rest->ptr = NULL;\n"
+    "        rest->len = 0;\n"
+    "    }\n"
+    "    return 1;\n"
+    "}\n"
+    "\n"
+    "size_t string_split(string s, char sep, strview *out, size_t max) {\n"
+    "    strview rest = string_view(s);\n"
+    "    strview field = {0};\n"
+    "    size_t count = 0;\n"
+    "    while (count < max && strview_split_next(&rest, sep, &field)) out[count++] = field;\n"
+    "    strview_release(field);\n"
+    "    return count;\n"
+    "}\n"
+    "\n"
+    "int strview_eq(strview v, const char *s) {\n"
+    "    size_t len = s ? strlen(s) : 0;\n"
+    "    return v.len == len && (len == 0 || simd_kernels()->eq(v.ptr, s, len));\n"
+    "}\n"
+    "\n"
+    "string strview_to_string(strview v) {\n"
+    "    char *result = rc_alloc(v.len + 1);\n"
+    "    if (result && v.len) memcpy(result, v.ptr, v.len);\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "strview string_find_char(string s, char ch) {\n"
+    "    strview none = {NULL, 0, s};\n"
+    "    const char *hit = s ? simd_kernels()->find_char(s, strlen(s), ch) : NULL;\n"
+    "    if (!hit) return none;\n"
+    "    strview match = {hit, 1, s};\n"
+    "    return match;\n"
+    "}\n"
+    "\n"
+    "int string_eq(string a, string b) {\n"
+    "    if (a == b) return 1;\n"
+    "    if (!a || !b) return 0;\n"
+    "    if (RC_GET_HEADER(a)->flags & RC_GET_HEADER(b)->flags & RC_FLAG_INTERNED) return 0;\n"
+    "    size_t len = strlen(a);\n"
+    "    return len == strlen(b) && simd_kernels()->eq(a, b, len);\n"
+    "}\n"
+    "\n"
+    "int string_cmp(string a, string b) {\n"
+    "    if (a == b) return 0;\n"
+    "    if (!a || !b) return a ? 1 : -1;\n"
+    "    size_t len_a = strlen(a);\n"
+    "    size_t len_b = strlen(b);\n"
+    "    return simd_kernels()->cmp(a, b, (len_a < len_b ? len_a : len_b) + 1);\n"
+    "}\n"
+    "\n"
+    "size_t string_count(string s, const char *needle) {\n"
+    "    if (!s || !needle || !needle[0]) return 0;\n"
+    "    const SimdKernels *kernels = simd_kernels();\n"
+    "    size_t len = strlen(s);\n"
+    "    size_t needle_len = strlen(needle);\n"
+    "    if (needle_len == 1) return kernels->count_char(s, len, needle[0]);\n"
+    "    size_t count = 0;\n"
+    "    const char *end = s + len;\n"
+    "    for (const char *p = s; (p = kernels->find(p, end - p, needle, needle_len)); p += needle_len)\n"
+    "        count++;\n"
+    "    return count;\n"
+    "}\n"
+    "\n"
+    "uint64_t string_hash(string s) { return s ? simd_kernels()->hash(s, strlen(s)) : 0; }\n"
+    "\n"
+    "uint32_t string_hash32_bytes(const char *s, size_t len) {\n"
+    "    uint64_t hash = simd_kernels()->hash(s, len);\n"
+    "    return (uint32_t)(hash ^ (hash >> 32));\n"
+    "}\n"
+    "\n"
+    "uint32_t string_hash32(string s) {\n"
+    "    if (!s) return 0;\n"
+    "    RCHeader *header = RC_GET_HEADER(s);\n"
+    "    if (RC_LOAD(header->flags) & RC_FLAG_HASHED) return RC_LOAD(header->hash);\n"
+    "    uint32_t hash = string_hash32_bytes(s, strlen(s));\n"
+    "    RC_STORE(header->hash, hash);\n"
+    "    RC_FLAGS_SET(header, RC_FLAG_HASHED);\n"
+    "    return hash;\n"
+    "}\n"
+    "\n"
+    "// ========== UTF-8 ==========\n"
+    "static uint32_t utf8_flags(string s) {\n"
+    "    RCHeader *header = RC_GET_HEADER(s);\n"
+    "    if (!(RC_LOAD(header->flags) & RC_FLAG_UTF8_CHECKED)) {\n"
+    "        int verdict = simd_kernels()->utf8_validate(s, strlen(s));\n"
+    "        uint32_t flags = RC_FLAG_UTF8_CHECKED;\n"
+    "        if (verdict != SIMD_UTF8_INVALID) flags |= RC_FLAG_UTF8_VALID;\n"
+    "        if (verdict == SIMD_UTF8_ASCII) flags |= RC_FLAG_ASCII;\n"
+    "        RC_FLAGS_SET(header, flags);\n"
+    "    }\n"
+    "    return RC_LOAD(header->flags);\n"
+    "}\n"
+    "\n"
+    "int string_utf8_valid(string s) { return s && (utf8_flags(s) & RC_FLAG_UTF8_VALID); }\n"
+    "\n"
+    "size_t string_utf8_len(string s) {\n"
+    "    if (!s) return 0;\n"
+    "    if (utf8_flags(s) & RC_FLAG_ASCII) return strlen(s);\n"
+    "    return simd_kernels()->utf8_count(s, strlen(s));\n"
+    "}\n"
+    "\n"
+    "// Byte offset of the cps-th code point of p[0..len), or len if there are fewer\n"
+    "static size_t utf8_advance(const char *p, size_t len, size_t cps) {\n"
+    "    const SimdKernels *kernels = simd_kernels();\n"
+    "    size_t             off = 0;\n"
+    "\n"
+    "    // Skip whole blocks with the counting kernel, then walk to the lead byte\n"
+    "    while (len - off > 64) {\n"
+    "        size_t leads = kernels->utf8_count(p + off, 64);\n"
+    "        if (leads > cps) break;\n"
+    "        cps -= leads;\n"
+    "        off += 64;\n"
+    "    }\n"
+    "    for (; off < len; off++) {\n"
+    "        if (((unsigned char)p[off] & 0xC0) == 0x80) continue;\n"
+    "        if (cps-- == 0) return off;\n"
+    "    }\n"
+    "    return len;\n"
+    "}\n"
+    "\n"
+    "size_t string_utf8_offset(string s, size_t cp_index) {\n"
+    "    if (!s) return 0;\n"
+    "    size_t len = strlen(s);\n"
+    "    if (utf8_flags(s) & RC_FLAG_ASCII) return cp_index < len ? cp_index : len;\n"
+    "    return utf8_advance(s, len, cp_index);\n"
+    "}\n"
+    "\n"
+    "strview string_utf8_slice(string s, size_t cp_start, size_t cp_len) {\n"
+    "    if (!s) return string_view(s);\n"
+    "    size_t len = strlen(s);\n"
+    "    if (utf8_flags(s) & RC_FLAG_ASCII) return string_slice(s, cp_start, cp_len);\n"
+    "\n"
+    "    size_t  start = utf8_advance(s, len, cp_start);\n"
+    "    size_t  end = start + utf8_advance(s + start, len - start, cp_len);\n"
+    "    strview slice = {s + start, end - start, s};\n"
+    "    return slice;\n"
+    "}\n"
+    "\n"
+    "// ========== STRING BUILDER ==========\n"
+    "typedef struct {\n"
+    "    char  *data;\n"
+    "    size_t length;\n"
+    "    size_t capacity;\n"
+    "    Arena *arena;\n"
+    "} StringBuilder;\n"
+    "\n"
+    "static StringBuilder builder_with_capacity(Arena *arena, size_t capacity) {\n"
+    "    StringBuilder sb = {NULL, 0, 0, arena};\n"
+    "    if (capacity < 64) capacity = 64;\n"
+    "    if (arena) {\n"
+    "        sb.data = arena_alloc(arena, capacity);\n"
+    "    } else {\n"
+    "        char *block = malloc(RC_HEADER_SIZE + capacity);\n"
+    "        sb.data = block ? block + RC_HEADER_SIZE : NULL;\n"
+    "    }\n"
+    "    if (sb.data) { sb.data[0] = '\\0'; sb.capacity = capacity; }\n"
+    "    return sb;\n"
+    "}\n"
+    "\n"
+    "static int builder_reserve(StringBuilder *sb, size_t extra) {\n"
+    "    size_t needed = sb->length + extra + 1;\n"
+    "    if (needed <= sb->capacity) return 1;\n"
+    "    size_t new_capacity = sb->capacity ? sb->capacity : 64;\n"
+    "    while (new_capacity < needed) new_capacity *= 2;\n"
+    "    char *data;\n"
+    "    if (sb->arena) {\n"
+    "        data = arena_realloc(sb->arena, sb->data, sb->capacity, new_capacity);\n"
+    "    } else {\n"
+    "        char *block = realloc(sb->data ? sb->data - RC_HEADER_SIZE : NULL,\n"
+    "                              RC_HEADER_SIZE + new_capacity);\n"
+    "        data = block ? block + RC_HEADER_SIZE : NULL;\n"
+    "    }\n"
+    "    if (!data) return 0;\n"
+    "    sb->data = data;\n"
+    "    sb->capacity = new_capacity;\n"
+    "    return 1;\n"
+    "}\n"
+    "\n"
+    "StringBuilder string_builder_create(size_t hint) { return builder_with_capacity(NULL, hint); }\n"
+    "StringBuilder string_builder_create_arena(Arena *arena, size_t hint) {\n"
+    "    return builder_with_capacity(arena, hint);\n"
+    "}\n"
+    "\n"
+    "void string_builder_append_n(StringBuilder *sb, const char *text, size_t len) {\n"
+    "    if (!text || len == 0 || !builder_reserve(sb, len)) return;\n"
+    "    memcpy(sb->data + sb->length, text, len);\n"
+    "    sb->length += len;\n"
+    "    sb->data[sb->length] = '\\0';\n"
+    "}\n"
+    "\n"
+    "void string_builder_append(StringBuilder *sb, const char *text) {\n"
+    "    if (text) string_builder_append_n(sb, text, strlen(text));\n"
+    "}\n"
+    "\n"
+    "void string_builder_append_char(StringBuilder *sb, char ch) {\n"
+    "    if (!builder_reserve(sb, 1)) return;\n"
+    "    sb->data[sb->length++] = ch;\n"
+    "    sb->data[sb->length] = '\\0';\n"
+    "}\n"
+    "\n"
+    "StringBuilder string_builder_from(const char *initial) {\n"
+    "    size_t len = initial ? strlen(initial) : 0;\n"
+    "    StringBuilder sb = builder_with_capacity(NULL, len * 2);\n"
+    "    string_builder_append_n(&sb, initial, len);\n"
+    "    return sb;\n"
+    "}\n"
+    "\n"
+    "StringBuilder string_builder_adopt(string s) {\n"
+    "    if (!s || !string_is_unique(s)) {\n"
+    "        StringBuilder sb = string_builder_from(s);\n"
+    "        rc_release(s);\n"
+    "        return sb;\n"
+    "    }\n"
+    "    size_t len = strlen(s);\n"
+    "    StringBuilder sb = {s, len, len + 1, NULL};\n"
+    "    return sb;\n"
+    "}\n"
+    "\n"
+    "string string_builder_finish(StringBuilder *sb) {\n"
+    "    if (!sb->data && !builder_reserve(sb, 0)) return NULL;\n"
+    "    char *result = sb->data;\n"
+    "    if (!sb->arena) rc_init_header(RC_GET_HEADER(result), 1);\n"
+    "    sb->data = NULL;\n"
+    "    sb->length = sb->capacity = 0;\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "void string_builder_free(StringBuilder *sb) {\n"
+    "    if (sb->data && !sb->arena) free(sb->data - RC_HEADER_SIZE);\n"
+    "    sb->data = NULL;\n"
+    "    sb->length = sb->capacity = 0;\n"
+    "}\n";
+
+
+// Optional runtime sections, emitted only when the transpiled code uses them
+static const char inline_map_runtime[] =
+    "// ========== HASH MAP ==========\n"
+    "struct Arena;\n"
+    "\n"
+    "// Keys and values live inline in one slot array; a parallel array of control\n"
+    "// bytes (7 hash bits per full slot) is probed 16 slots at a time with SSE2.\n"
+    "//\n"
+    "// Byte-keyed maps hash and compare key_size raw bytes. String-keyed maps store\n"
+    "// the `string` pointer, compare by content and take the hash cached in the\n"
+    "// string header, so a key is hashed once however often it is looked up or\n"
+    "// rehashed. RC maps are refcounted (map_release frees the table and drops the\n"
+    "// key references); arena maps allocate from the arena, do not retain their\n"
+    "// keys, and are reclaimed by arena_destroy.\n"
+    "typedef struct Map *map;\n"
+    "\n"
+    "map    map_create(size_t key_size, size_t value_size);\n"
+    "map    map_create_strings(size_t value_size);\n"
+    "map    map_create_arena(struct Arena *arena, size_t key_size, size_t value_size);\n"
+    "map    map_create_strings_arena(struct Arena *arena, size_t value_size);\n"
+    "void   map_release(map m);\n"
+    "size_t map_count(map m);\n"
+    "void   map_reserve(map m, size_t count);\n"
+    "void   map_clear(map m);\n"
+    "\n"
+    "// Byte keys. map_put copies key and value in and returns the stored value,\n"
+    "// valid until the next insert; a NULL value zero-fills a new entry and leaves\n"
+    "// an existing one untouched.\n"
+    "void *map_put(map m, const void *key, const void *value);\n"
+    "void *map_get(map m, const void *key);\n"
+    "int   map_remove(map m, const void *key);\n"
+    "\n"
+    "// String keys. map_get_cstr accepts any char *, including literals.\n"
+    "void *map_put_str(map m, string key, const void *value);\n"
+    "void *map_get_str(map m, string key);\n"
+    "void *map_get_cstr(map m, const char *key);\n"
+    "int   map_remove_str(map m, string key);\n"
+    "\n"
+    "// for (size_t it = 0; map_next(m, &it, &key, &value);) visits every entry.\n"
+    "// key receives a pointer to the key bytes, or the string itself for string maps.\n"
+    "int map_next(map m, size_t *iter, void **key, void **value);\n"
+    "\n"
+    "#define map_of(K, V) map_create(sizeof(K), sizeof(V))\n"
+    "#define map_of_strings(V) map_create_strings(sizeof(V))\n"
+    "#define map_value(ptr, V) (*(V *)(ptr))\n"
+    "\n"
+    "#ifdef SAM_SIMD_X86\n"
+    "#include <emmintrin.h>\n"
+    "#endif\n"
+    "\n"
+    "#define MAP_GROUP 16\n"
+    "#define MAP_MIN_CAPACITY 16\n"
+    "#define MAP_NONE ((size_t)-1)\n"
+    "\n"
+    "// Control bytes: full slots hold the top 7 bits of the hash (0..127)\n"
+    "#define CTRL_EMPTY ((int8_t)-128)\n"
+    "#define CTRL_DELETED ((int8_t)-2)\n"
+    "\n"
+    "struct Map {\n"
+    "    int8_t       *ctrl;        // capacity + MAP_GROUP bytes; the tail mirrors the first group\n"
+    "    char         *slots;       // capacity * slot_size bytes, key then value\n"
+    "    size_t        capacity;    // Power of two, 0 until the first insert\n"
+    "    size_t        count;\n"
+    "    size_t        growth_left; // Inserts into empty slots left before a rehash\n"
+    "    size_t        key_size;\n"
+    "    size_t        value_size;\n"
+    "    size_t        value_offset;\n"
+    "    size_t        slot_size;\n"
+    "    int           string_keys;\n"
+    "    struct Arena *arena; // NULL for RC maps\n"
+    "};\n"
+    "\n"
+    "// A key about to be looked up: its bytes (or characters) and hashes\n"
+    "typedef struct {\n"
+    "    const void *key;\n"
+    "    uint32_t    hash32; // 32-bit key hash; for strings, the one cached in the header\n"
+    "    uint64_t    hash;   // hash32 spread over 64 bits for probing\n"
+    "} MapKey;\n"
+    "\n"
+    "// =========================== [ GROUPS ] =========================================\n"
+    "\n"
+    "typedef uint32_t GroupMask; // Bit i set when slot pos + i matches\n"
+    "\n"
+    "static GroupMask group_match(const int8_t *ctrl, int8_t h2) {\n"
+    "#ifdef SAM_SIMD_X86\n"
+    "    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);\n"
+    "    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));\n"
+    "#else\n"
+    "    GroupMask mask = 0;\n"
+    "    for (int i = 0; i < MAP_GROUP; i++)\n"
+    "        mask |= (GroupMask)(ctrl[i] == h2) << i;\n"
+    "    return mask;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static GroupMask group_empty(const int8_t *ctrl) { return group_match(ctrl, CTRL_EMPTY); }\n"
+    "\n"
+    "// Empty or deleted: the only control values below -1\n"
+    "static GroupMask group_free(const int8_t *ctrl) {\n"
+    "#ifdef SAM_SIMD_X86\n"
+    "    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);\n"
+    "    return (GroupMask)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), group));\n"
+    "#else\n"
+    "    GroupMask mask = 0;\n"
+    "    for (int i = 0; i < MAP_GROUP; i++)\n"
+    "        mask |= (GroupMask)(ctrl[i] < -1) << i;\n"
+    "    return mask;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static int lowest_bit(GroupMask mask) {\n"
+    "#if defined(__GNUC__) && !defined(__TINYC__)\n"
+    "    return __builtin_ctz(mask);\n"
+    "#else\n"
+    "    int bit = 0;\n"
+    "    while (!(mask & 1)) {\n"
+    "        mask >>= 1;\n"
+    "        bit++;\n"
+    "    }\n"
+    "    return bit;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static int highest_bit(GroupMask mask) {\n"
+    "    int bit = 0;\n"
+    "    while (mask >>= 1)\n"
+    "        bit++;\n"
+    "    return bit;\n"
+    "}\n"
+    "\n"
+    "// =========================== [ HASHING ] =========================================\n"
+    "\n"
+    "static uint64_t spread(uint32_t hash32) { return (uint64_t)hash32 * 0x9E3779B97F4A7C15ULL; }\n"
+    "\n"
+    "static int8_t h2_of(uint64_t hash) { return (int8_t)(hash >> 57); }\n"
+    "\n"
+    "// Byte keys are usually integers or small structs; mix those inline instead of\n"
+    "// going through the block hash kernel, which is built for long strings\n"
+    "static uint32_t bytes_hash(const void *key, size_t size) {\n"
+    "    if (size > 16) return string_hash32_bytes(key, size);\n"
+    "\n"
+    "    uint64_t lo = 0, hi = 0;\n"
+    "    memcpy(&lo, key, size < 8 ? size : 8);\n"
+    "    if (size > 8) memcpy(&hi, (const char *)key + 8, size - 8);\n"
+    "    uint64_t hash = (lo ^ 0x9E3779B185EBCA87ULL) * 0xC2B2AE3D27D4EB4FULL;\n"
+    "    hash ^= (hi + size) * 0x165667B19E3779F9ULL;\n"
+    "    hash ^= hash >> 29;\n"
+    "    hash *= 0xBF58476D1CE4E5B9ULL;\n"
+    "    return (uint32_t)(hash ^ (hash >> 32));\n"
+    "}\n"
+    "\n"
+    "static MapKey byte_key(map m, const void *key) {\n"
+    "    MapKey mk = {key, bytes_hash(key, m->key_size), 0};\n"
+    "    mk.hash = spread(mk.hash32);\n"
+    "    return mk;\n"
+    "}\n"
+    "\n"
+    "static MapKey string_key(string key) {\n"
+    "    MapKey mk = {key, string_hash32(key), 0};\n"
+    "    mk.hash = spread(mk.hash32);\n"
+    "    return mk;\n"
+    "}\n"
+    "\n"
+    "static MapKey cstr_key(const char *key) {\n"
+    "    MapKey mk = {key, string_hash32_bytes(key, strlen(key)), 0};\n"
+    "    mk.hash = spread(mk.hash32);\n"
+    "    return mk;\n"
+    "}\n"
+    "\n"
+    "static char *slot_at(map m, size_t index) { return m->slots + index * m->slot_size; }\n"
+    "\n"
+    "static uint64_t slot_hash(map m, const char *slot) {\n"
+    "    if (m->string_keys) return spread(string_hash32(*(string *)slot));\n"
+    "    return spread(bytes_hash(slot, m->key_size));\n"
+    "}\n"
+    "\n"
+    "static int key_matches(map m, const char *slot, const MapKey *mk) {\n"
+    "    if (!m->string_keys) return memcmp(slot, mk->key, m->key_size) == 0;\n"
+    "    string stored = *(string *)slot;\n"
+    "    return stored == mk->key ||\n"
+    "           (string_hash32(stored) == mk->hash32 && strcmp(stored, mk->key) == 0);\n"
+    "}\n"
+    "\n"
+    "// =========================== [ PROBING ] =========================================\n"
+    "// Windows start at any slot (the mirrored tail keeps the load in bounds) and\n"
+    "// advance by triangular multiples of the group width, which on a power-of-two\n"
+    "// table visits every window exactly once.\n"
+    "\n"
+    "static void set_ctrl(map m, size_t index, int8_t value) {\n"
+    "    m->ctrl[index] = value;\n"
+    "    if (index < MAP_GROUP) m->ctrl[m->capacity + index] = value;\n"
+    "}\n"
+    "\n"
+    "static size_t find_index(map m, const MapKey *mk) {\n"
+    "    if (m->capacity == 0) return MAP_NONE;\n"
+    "\n"
+    "    size_t mask = m->capacity - 1;\n"
+    "    size_t pos = mk->hash & mask;\n"
+    "    int8_t h2 = h2_of(mk->hash);\n"
+    "    for (size_t stride = MAP_GROUP;; stride += MAP_GROUP) {\n"
+    "        const int8_t *group = m->ctrl + pos;\n"
+    "        for (GroupMask hits = group_match(group, h2); hits; hits &= hits - 1) {\n"
+    "            size_t index = (pos + lowest_bit(hits)) & mask;\n"
+    "            if (key_matches(m, slot_at(m, index), mk)) return index;\n"
+    "        }\n"
+    "        if (group_empty(group)) return MAP_NONE;\n"
+    "        pos = (pos + stride) & mask;\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static size_t find_insert_index(map m, uint64_t hash) {\n"
+    "    size_t mask = m->capacity - 1;\n"
+    "    size_t pos = hash & mask;\n"
+    "    for (size_t stride = MAP_GROUP;; stride += MAP_GROUP) {\n"
+    "        GroupMask free_slots = group_free(m->ctrl + pos);\n"
+    "        if (free_slots) return (pos + lowest_bit(free_slots)) & mask;\n"
+    "        pos = (pos + stride) & mask;\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "// =========================== [ STORAGE ] =========================================\n"
+    "\n"
+    "static size_t max_load(size_t capacity) { return capacity - capacity / 8; }\n"
+    "\n"
+    "// Largest power of two dividing size, capped at 8\n"
+    "static size_t natural_align(size_t size) {\n"
+    "    size_t align = 1;\n"
+    "    while (align < 8 && size % (align * 2) == 0)\n"
+    "        align *= 2;\n"
+    "    return align;\n"
+    "}\n"
+    "\n"
+    "static size_t round_up(size_t n, size_t align) { return (n + align - 1) / align * align; }\n"
+    "\n"
+    "static int map_resize(map m, size_t capacity) {\n"
+    "    size_t ctrl_bytes = round_up(capacity + MAP_GROUP, 16);\n"
+    "    size_t total = ctrl_bytes + capacity * m->slot_size;\n"
+    "    char  *block = m->arena ? arena_alloc(m->arena, total) : malloc(total);\n"
+    "    if (!block) return 0;\n"
+    "\n"
+    "    int8_t *old_ctrl = m->ctrl;\n"
+    "    char   *old_slots = m->slots;\n"
+    "    size_t  old_capacity = m->capacity;\n"
+    "\n"
+    "    m->ctrl = (int8_t *)block;\n"
+    "    m->slots = block + ctrl_bytes;\n"
+    "    m->capacity = capacity;\n"
+    "    m->growth_left = max_load(capacity) - m->count;\n"
+    "    memset(m->ctrl, CTRL_EMPTY, capacity + MAP_GROUP);\n"
+    "\n"
+    "    for (size_t i = 0; i < old_capacity; i++) {\n"
+    "        if (old_ctrl[i] < 0) continue;\n"
+    "        const char *slot = old_slots + i * m->slot_size;\n"
+    "        uint64_t    hash = slot_hash(m, slot);\n"
+    "        size_t      index = find_insert_index(m, hash);\n"
+    "        set_ctrl(m, index, h2_of(hash));\n"
+    "        memcpy(slot_at(m, index), slot, m->slot_size);\n"
+    "    }\n"
+    "\n"
+    "    if (!m->arena) free(old_ctrl);\n"
+    "    return 1;\n"
+    "}\n"
+    "\n"
+    "// Out of empty slots: double, unless tombstones are what filled the table\n"
+    "static int map_grow(map m) {\n"
+    "    if (m->capacity == 0) return map_resize(m, MAP_MIN_CAPACITY);\n"
+    "    if (m->count <= max_load(m->capacity) / 2) return map_resize(m, m->capacity);\n"
+    "    return map_resize(m, m->capacity * 2);\n"
+    "}\n"
+    "\n"
+    "static map map_new(struct Arena *arena, size_t key_size, size_t value_size, int string_keys) {\n"
+    "    map m;\n"
+    "    if (arena) {\n"
+    "        // Arena maps still carry a header so rc_retain on them stays harmless\n"
+    "        RCHeader *header = arena_alloc_zero(arena, RC_HEADER_SIZE + sizeof(struct Map));\n"
+    "        if (!header) return NULL;\n"
+    "        rc_init_header(header, 1);\n"
+    "        m = (map)((char *)header + RC_HEADER_SIZE);\n"
+    "    } else {\n"
+    "        m = rc_alloc(sizeof(struct Map));\n"
+    "        if (!m) return NULL;\n"
+    "    }\n"
+    "\n"
+    "    size_t key_align = natural_align(key_size);\n"
+    "    size_t value_align = natural_align(value_size);\n"
+    "    m->key_size = key_size;\n"
+    "    m->value_size = value_size;\n"
+    "    m->value_offset = round_up(key_size, value_align);\n"
+    "    m->slot_size = round_up(m->value_offset + value_size,\n"
+    "                            key_align > value_align ? key_align : value_align);\n"
+    "    m->string_keys = string_keys;\n"
+    "    m->arena = arena;\n"
+    "    return m;\n"
+    "}\n"
+    "\n"
+    "// Drop the key references an RC string map holds\n"
+    "static void release_keys(map m) {\n"
+    "    if (!m->string_keys || m->arena) return;\n"
+    "    for (size_t i = 0; i < m->capacity; i++) {\n"
+    "        if (m->ctrl[i] >= 0) rc_release(*(string *)slot_at(m, i));\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "// =========================== [ PUBLIC API ] =========================================\n"
+    "\n"
+    "map map_create(size_t key_size, size_t value_size) {\n"
+    "    return map_new(NULL, key_size, value_size, 0);\n"
+    "}\n"
+    "\n"
+    "map map_create_strings(size_t value_size) { return map_new(NULL, sizeof(string), value_size, 1); }\n"
+    "\n"
+    "map map_create_arena(struct Arena *arena, size_t key_size, size_t value_size) {\n"
+    "    return arena ? map_new(arena, key_size, value_size, 0) : NULL;\n"
+    "}\n"
+    "\n"
+    "map map_create_strings_arena(struct Arena *arena, size_t value_size) {\n"
+    "    return arena ? map_new(arena, sizeof(string), value_size, 1) : NULL;\n"
+    "}\n"
+    "\n"
+    "static void map_destroy(void *ptr) {\n"
+    "    map m = ptr;\n"
+    "    release_keys(m);\n"
+    "    free(m->ctrl);\n"
+    "}\n"
+    "\n"
+    "void map_release(map m) {\n"
+    "    if (!m || m->arena) return;\n"
+    "    rc_release_with(m, map_destroy);\n"
+    "}\n"
+    "\n"
+    "size_t map_count(map m) { return m ? m->count : 0; }\n"
+    "\n"
+    "void map_reserve(map m, size_t count) {\n"
+    "    if (!m) return;\n"
+    "    size_t capacity = m->capacity ? m->capacity : MAP_MIN_CAPACITY;\n"
+    "    while (max_load(capacity) < count)\n"
+    "        capacity *= 2;\n"
+    "    if (capacity > m->capacity) map_resize(m, capacity);\n"
+    "}\n"
+    "\n"
+    "void map_clear(map m) {\n"
+    "    if (!m || m->capacity == 0) return;\n"
+    "    release_keys(m);\n"
+    "    memset(m->ctrl, CTRL_EMPTY, m->capacity + MAP_GROUP);\n"
+    "    m->count = 0;\n"
+    "    m->growth_left = max_load(m->capacity);\n"
+    "}\n"
+    "\n"
+    "static void *put_key(map m, const MapKey *mk, const void *key, const void *value) {\n"
+    "    size_t index = find_index(m, mk);\n"
+    "    int    inserted = index == MAP_NONE;\n"
+    "\n"
+    "    if (inserted) {\n"
+    "        if (m->growth_left == 0 && !map_grow(m)) return NULL;\n"
+    "        index = find_insert_index(m, mk->hash);\n"
+    "        if (m->ctrl[index] == CTRL_EMPTY) m->growth_left--;\n"
+    "        set_ctrl(m, index, h2_of(mk->hash));\n"
+    "        m->count++;\n"
+    "        memcpy(slot_at(m, index), key, m->key_size);\n"
+    "    }\n"
+    "\n"
+    "    char *stored = slot_at(m, index) + m->value_offset;\n"
+    "    if (value) {\n"
+    "        memcpy(stored, value, m->value_size);\n"
+    "    } else if (inserted) {\n"
+    "        memset(stored, 0, m->value_size);\n"
+    "    }\n"
+    "    if (inserted && m->string_keys && !m->arena) rc_retain(*(string *)slot_at(m, index));\n"
+    "    return stored;\n"
+    "}\n"
+    "\n"
+    "static int remove_key(map m, const MapKey *mk) {\n"
+    "    size_t index = find_index(m, mk);\n"
+    "    if (index == MAP_NONE) return 0;\n"
+    "    if (m->string_keys && !m->arena) rc_release(*(string *)slot_at(m, index));\n"
+    "\n"
+    "    // A slot no probe window ever saw full (an empty slot within reach on both\n"
+    "    // sides) can go straight back to empty; otherwise leave a tombstone so\n"
+    "    // probes keep walking past it.\n"
+    "    size_t    mask = m->capacity - 1;\n"
+    "    GroupMask empty_after = group_empty(m->ctrl + index);\n"
+    "    GroupMask empty_before = group_empty(m->ctrl + ((index - MAP_GROUP) & mask));\n"
+    "    int       never_full = empty_before && empty_after &&\n"
+    "                     lowest_bit(empty_after) + (MAP_GROUP - 1 - highest_bit(empty_before)) <\n"
+    "                         MAP_GROUP;\n"
+    "\n"
+    "    set_ctrl(m, index, never_full ? CTRL_EMPTY : CTRL_DELETED);\n"
+    "    if (never_full) m->growth_left++;\n"
+    "    m->count--;\n"
+    "    return 1;\n"
+    "}\n"
+    "\n"
+    "void *map_put(map m, const void *key, const void *value) {\n"
+    "    if (!m || !key || m->string_keys) return NULL;\n"
+    "    MapKey mk = byte_key(m, key);\n"
+    "    return put_key(m, &mk, key, value);\n"
+    "}\n"
+    "\n"
+    "void *map_get(map m, const void *key) {\n"
+    "    if (!m || !key || m->string_keys) return NULL;\n"
+    "    MapKey mk = byte_key(m, key);\n"
+    "    size_t index = find_index(m, &mk);\n"
+    "    return index == MAP_NONE ? NULL : slot_at(m, index) + m->value_offset;\n"
+    "}\n"
+    "\n"
+    "int map_remove(map m, const void *key) {\n"
+    "    if (!m || !key || m->string_keys) return 0;\n"
+    "    MapKey mk = byte_key(m, key);\n"
+    "    return remove_key(m, &mk);\n"
+    "}\n"
+    "\n"
+    "void *map_put_str(map m, string key, const void *value) {\n"
+    "    if (!m || !key || !m->string_keys) return NULL;\n"
+    "    MapKey mk = string_key(key);\n"
+    "    return put_key(m, &mk, &key, value);\n"
+    "}\n"
+    "\n"
+    "void *map_get_str(map m, string key) {\n"
+    "    if (!m || !key || !m->string_keys) return NULL;\n"
+    "    MapKey mk = string_key(key);\n"
+    "    size_t index = find_index(m, &mk);\n"
+    "    return index == MAP_NONE ? NULL : slot_at(m, index) + m->value_offset;\n"
+    "}\n"
+    "\n"
+    "void *map_get_cstr(map m, const char *key) {\n"
+    "    if (!m || !key || !m->string_keys) return NULL;\n"
+    "    MapKey mk = cstr_key(key);\n"
+    "    size_t index = find_index(m, &mk);\n"
+    "    return index == MAP_NONE ? NULL : slot_at(m, index) + m->value_offset;\n"
+    "}\n"
+    "\n"
+    "int map_remove_str(map m, string key) {\n"
+    "    if (!m || !key || !m->string_keys) return 0;\n"
+    "    MapKey mk = string_key(key);\n"
+    "    return remove_key(m, &mk);\n"
+    "}\n"
+    "\n"
+    "int map_next(map m, size_t *iter, void **key, void **value) {\n"
+    "    if (!m) return 0;\n"
+    "    for (size_t i = *iter; i < m->capacity; i++) {\n"
+    "        if (m->ctrl[i] < 0) continue;\n"
+    "        char *slot = slot_at(m, i);\n"
+    "        if (key) *key = m->string_keys ? *(void **)slot : (void *)slot;\n"
+    "        if (value) *value = slot + m->value_offset;\n"
+    "        *iter = i + 1;\n"
+    "        return 1;\n"
+    "    }\n"
+    "    *iter = m->capacity;\n"
+    "    return 0;\n"
+    "}\n"
+    "\n";
+
+static const char inline_intern_runtime[] =
+    "// ========== STRING INTERNING ==========\n"
+    "#define INTERN_SHARDS 64\n"
+    "\n"
+    "typedef struct {\n"
+    "    int     lock;\n"
+    "    string *slots; // Open addressing, linear probing; NULL marks an empty slot\n"
+    "    size_t  capacity;\n"
+    "    size_t  count;\n"
+    "} InternShard;\n"
+    "\n"
+    "static InternShard intern_shards[INTERN_SHARDS];\n"
+    "\n"
+    "#if !defined(__GNUC__) || defined(__TINYC__)\n"
+    "#include <pthread.h>\n"
+    "static pthread_mutex_t intern_mutex = PTHREAD_MUTEX_INITIALIZER; // No __atomic builtins: one lock\n"
+    "#endif\n"
+    "\n"
+    "static void intern_lock(InternShard *shard) {\n"
+    "#if defined(__GNUC__) && !defined(__TINYC__)\n"
+    "    while (__atomic_exchange_n(&shard->lock, 1, __ATOMIC_ACQUIRE)) {\n"
+    "        while (__atomic_load_n(&shard->lock, __ATOMIC_RELAXED))\n"
+    "            ;\n"
+    "    }\n"
+    "#else\n"
+    "    (void)shard;\n"
+    "    pthread_mutex_lock(&intern_mutex);\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static void intern_unlock(InternShard *shard) {\n"
+    "#if defined(__GNUC__) && !defined(__TINYC__)\n"
+    "    __atomic_store_n(&shard->lock, 0, __ATOMIC_RELEASE);\n"
+    "#else\n"
+    "    (void)shard;\n"
+    "    pthread_mutex_unlock(&intern_mutex);\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "// Slot holding s, or the empty slot where it belongs\n"
+    "static string *intern_slot(InternShard *shard, const char *s, size_t len, uint32_t hash) {\n"
+    "    size_t mask = shard->capacity - 1;\n"
+    "    for (size_t i = (hash / INTERN_SHARDS) & mask;; i = (i + 1) & mask) {\n"
+    "        string stored = shard->slots[i];\n"
+    "        if (!stored) return &shard->slots[i];\n"
+    "        if (RC_GET_HEADER(stored)->hash == hash && strncmp(stored, s, len) == 0 &&\n"
+    "            stored[len] == '\\0')\n"
+    "            return &shard->slots[i];\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static int intern_grow(InternShard *shard) {\n"
+    "    size_t  capacity = shard->capacity ? shard->capacity * 2 : 64;\n"
+    "    string *slots = calloc(capacity, sizeof(string));\n"
+    "    if (!slots) return 0;\n"
+    "\n"
+    "    string *old_slots = shard->slots;\n"
+    "    size_t  old_capacity = shard->capacity;\n"
+    "    shard->slots = slots;\n"
+    "    shard->capacity = capacity;\n"
+    "    for (size_t i = 0; i < old_capacity; i++) {\n"
+    "        string s = old_slots[i];\n"
+    "        if (s) *intern_slot(shard, s, strlen(s), RC_GET_HEADER(s)->hash) = s;\n"
+    "    }\n"
+    "    free(old_slots);\n"
+    "    return 1;\n"
+    "}\n"
+    "\n"
+    "string string_intern(const char *s) {\n"
+    "    if (!s) return NULL;\n"
+    "    size_t       len = strlen(s);\n"
+    "    uint32_t     hash = string_hash32_bytes(s, len);\n"
+    "    InternShard *shard = &intern_shards[hash % INTERN_SHARDS];\n"
+    "\n"
+    "    intern_lock(shard);\n"
+    "    string *slot = shard->capacity ? intern_slot(shard, s, len, hash) : NULL;\n"
+    "    if (!slot || !*slot) {\n"
+    "        if (shard->count * 4 >= shard->capacity * 3) {\n"
+    "            if (!intern_grow(shard)) {\n"
+    "                intern_unlock(shard);\n"
+    "                return NULL;\n"
+    "            }\n"
+    "        }\n"
+    "        slot = intern_slot(shard, s, len, hash);\n"
+    "\n"
+    "        string canonical = rc_alloc(len + 1);\n"
+    "        if (canonical) {\n"
+    "            memcpy(canonical, s, len + 1);\n"
+    "            RCHeader *header = RC_GET_HEADER(canonical);\n"
+    "            rc_init_header(header, RC_IMMORTAL);\n"
+    "            header->hash = hash;\n"
+    "            header->flags = RC_FLAG_HASHED | RC_FLAG_INTERNED;\n"
+    "            *slot = canonical;\n"
+    "            shard->count++;\n"
+    "        }\n"
+    "    }\n"
+    "    string result = *slot;\n"
+    "    intern_unlock(shard);\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "int string_is_interned(string s) { return s && (RC_GET_HEADER(s)->flags & RC_FLAG_INTERNED); }\n";
+
+static const char inline_arena_string_runtime[] =
+    "// ========== ARENA STRINGS ==========\n"
+    "string arena_string_create(Arena *arena, const char *literal) {\n"
+    "    if (!literal) return NULL;\n"
+    "    size_t len = strlen(literal);\n"
+    "    string str = rc_arena_alloc(arena, len + 1);\n"
+    "    if (str) memcpy(str, literal, len + 1);\n"
+    "    return str;\n"
+    "}\n"
+    "\n"
+    "string arena_string_concat(Arena *arena, string a, string b) {\n"
+    "    if (!a || !b) return NULL;\n"
+    "    size_t len_a = strlen(a);\n"
+    "    size_t len_b = strlen(b);\n"
+    "    string result = rc_arena_alloc(arena, len_a + len_b + 1);\n"
+    "    if (result) {\n"
+    "        memcpy(result, a, len_a);\n"
+    "        memcpy(result + len_a, b, len_b + 1);\n"
+    "    }\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "string arena_string_substr(Arena *arena, string s, size_t start, size_t len) {\n"
+    "    if (!s) return NULL;\n"
+    "    size_t s_len = strlen(s);\n"
+    "    if (start >= s_len) return arena_string_create(arena, \"\");\n"
+    "    if (start + len > s_len) len = s_len - start;\n"
+    "\n"
+    "    string result = rc_arena_alloc(arena, len + 1);\n"
+    "    if (result) {\n"
+    "        memcpy(result, s + start, len);\n"
+    "        result[len] = '\\0';\n"
+    "    }\n"
+    "    return result;\n"
+    "}\n";
+
+static const char inline_frame_runtime[] =
+    "// ========== FRAME STRINGS ==========\n"
+    "typedef struct StringFrame {\n"
+    "    char  *buffer; // Current block: the stack buffer or the newest chunk\n"
+    "    size_t offset;\n"
+    "    size_t capacity;\n"
+    "    void  *chunks; // Spilled heap chunks, linked through their first word\n"
+    "} StringFrame;\n"
+    "\n"
+    "// Declares `name` over a stack buffer for `count` strings of `bytes` payload in all\n"
+    "#define STRING_FRAME_SIZE(count, bytes) ((count) * (RC_HEADER_SIZE + 8) + (bytes))\n"
+    "#if defined(__GNUC__) && !defined(__TINYC__)\n"
+    "#define STRING_FRAME(name, count, bytes)                                                    \\\n"
+    "    uint64_t name##_stack[(STRING_FRAME_SIZE(count, bytes) + 7) / 8];                        \\\n"
+    "    StringFrame name __attribute__((cleanup(string_frame_release))) = {                      \\\n"
+    "        (char *)name##_stack, 0, sizeof(name##_stack), NULL}\n"
+    "#define STRING_FRAME_END(name)\n"
+    "#else\n"
+    "#define STRING_FRAME(name, count, bytes)                                                    \\\n"
+    "    uint64_t    name##_stack[(STRING_FRAME_SIZE(count, bytes) + 7) / 8];                     \\\n"
+    "    StringFrame name = {(char *)name##_stack, 0, sizeof(name##_stack), NULL}\n"
+    "#define STRING_FRAME_END(name) string_frame_release(&name) // Early returns skip it\n"
+    "#endif\n"
+    "\n"
+    "#define FRAME_CHUNK_MIN 1024\n"
+    "\n"
+    "// Room for a header and len + 1 bytes, stamped immortal\n"
+    "static string frame_alloc(StringFrame *frame, size_t len) {\n"
+    "    size_t size = (RC_HEADER_SIZE + len + 1 + 7) & ~(size_t)7;\n"
+    "    if (frame->offset + size > frame->capacity) {\n"
+    "        size_t capacity = frame->capacity * 2 > FRAME_CHUNK_MIN ? frame->capacity * 2 : FRAME_CHUNK_MIN;\n"
+    "        if (capacity < size + sizeof(void *)) capacity = size + sizeof(void *);\n"
+    "        char *chunk = malloc(capacity);\n"
+    "        if (!chunk) return NULL;\n"
+    "        *(void **)chunk = frame->chunks;\n"
+    "        frame->chunks = chunk;\n"
+    "        frame->buffer = chunk;\n"
+    "        frame->offset = (sizeof(void *) + 7) & ~(size_t)7;\n"
+    "        frame->capacity = capacity;\n"
+    "    }\n"
+    "\n"
+    "    RCHeader *header = (RCHeader *)(frame->buffer + frame->offset);\n"
+    "    frame->offset += size;\n"
+    "    rc_init_header(header, RC_IMMORTAL);\n"
+    "    return (char *)header + RC_HEADER_SIZE;\n"
+    "}\n"
+    "\n"
+    "string string_frame_create(StringFrame *frame, const char *literal) {\n"
+    "    if (!literal) return NULL;\n"
+    "    size_t len = strlen(literal);\n"
+    "    string str = frame_alloc(frame, len);\n"
+    "    if (str) memcpy(str, literal, len + 1);\n"
+    "    return str;\n"
+    "}\n"
+    "\n"
+    "string string_frame_concat(StringFrame *frame, string a, string b) {\n"
+    "    if (!a || !b) return NULL;\n"
+    "    size_t len_a = strlen(a);\n"
+    "    size_t len_b = strlen(b);\n"
+    "    string result = frame_alloc(frame, len_a + len_b);\n"
+    "    if (result) {\n"
+    "        memcpy(result, a, len_a);\n"
+    "        memcpy(result + len_a, b, len_b + 1);\n"
+    "    }\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "string string_frame_substr(StringFrame *frame, string s, size_t start, size_t len) {\n"
+    "    if (!s) return NULL;\n"
+    "    size_t s_len = strlen(s);\n"
+    "    if (start >= s_len) return string_frame_create(frame, \"\");\n"
+    "    if (start + len > s_len) len = s_len - start;\n"
+    "\n"
+    "    string result = frame_alloc(frame, len);\n"
+    "    if (result) {\n"
+    "        memcpy(result, s + start, len);\n"
+    "        result[len] = '\\0';\n"
+    "    }\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "void string_frame_release(StringFrame *frame) {\n"
+    "    while (frame->chunks) {\n"
+    "        void *next = *(void **)frame->chunks;\n"
+    "        free(frame->chunks);\n"
+    "        frame->chunks = next;\n"
+    "    }\n"
+    "}\n"
+    "\n";
+
+static const char inline_own_runtime[] =
+    "// ========== OWNED STRINGS ==========\n"
+    "// Owned strings: the lowering of `own string`, for text with exactly one\n"
+    "// owner. There is no RCHeader and nothing is counted; the length and capacity\n"
+    "// travel with the pointer, so appends grow in place and the length is a field\n"
+    "// read. The transpiler moves them (own_string_move empties the source) and\n"
+    "// frees each one once, at scope exit. `.ptr` lends the text to anything taking\n"
+    "// a plain const char *; string functions that read the header need a `string`,\n"
+    "// which own_string_share makes without copying when realloc can extend in place.\n"
+    "typedef struct {\n"
+    "    char  *ptr;\n"
+    "    size_t len;\n"
+    "    size_t capacity; // Bytes allocated, including the terminator\n"
+    "} own_string;\n"
+    "\n"
+    "#define OWN_STRING_NONE ((own_string){NULL, 0, 0})\n"
+    "#if defined(__GNUC__) && !defined(__TINYC__)\n"
+    "#define SAM_OWNED __attribute__((cleanup(own_string_free)))\n"
+    "#define OWN_STRING_END(name)\n"
+    "#else\n"
+    "#define SAM_OWNED\n"
+    "#define OWN_STRING_END(name) own_string_free(&name) // Early returns skip it\n"
+    "#endif\n"
+    "\n"
+    "static own_string own_alloc(size_t len) {\n"
+    "    own_string s = {malloc(len + 1), len, len + 1};\n"
+    "    return s.ptr ? s : OWN_STRING_NONE;\n"
+    "}\n"
+    "\n"
+    "own_string own_string_create(const char *text) {\n"
+    "    if (!text) return OWN_STRING_NONE;\n"
+    "    size_t     len = strlen(text);\n"
+    "    own_string s = own_alloc(len);\n"
+    "    if (s.ptr) memcpy(s.ptr, text, len + 1);\n"
+    "    return s;\n"
+    "}\n"
+    "\n"
+    "own_string own_string_concat(const char *a, const char *b) {\n"
+    "    if (!a || !b) return OWN_STRING_NONE;\n"
+    "    size_t     len_a = strlen(a);\n"
+    "    size_t     len_b = strlen(b);\n"
+    "    own_string s = own_alloc(len_a + len_b);\n"
+    "    if (s.ptr) {\n"
+    "        memcpy(s.ptr, a, len_a);\n"
+    "        memcpy(s.ptr + len_a, b, len_b + 1);\n"
+    "    }\n"
+    "    return s;\n"
+    "}\n"
+    "\n"
+    "own_string own_string_substr(const char *text, size_t start, size_t len) {\n"
+    "    if (!text) return OWN_STRING_NONE;\n"
+    "    size_t text_len = strlen(text);\n"
+    "    if (start >= text_len) return own_string_create(\"\");\n"
+    "    if (start + len > text_len) len = text_len - start;\n"
+    "\n"
+    "    own_string s = own_alloc(len);\n"
+    "    if (s.ptr) {\n"
+    "        memcpy(s.ptr, text + start, len);\n"
+    "        s.ptr[len] = '\\0';\n"
+    "    }\n"
+    "    return s;\n"
+    "}\n"
+    "\n"
+    "own_string own_string_adopt(string s) {\n"
+    "    own_string result = own_string_create(s);\n"
+    "    rc_release(s);\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "own_string own_string_move(own_string *s) {\n"
+    "    own_string value = *s;\n"
+    "    *s = OWN_STRING_NONE;\n"
+    "    return value;\n"
+    "}\n"
+    "\n"
+    "void own_string_append(own_string *s, const char *text) {\n"
+    "    if (!s->ptr || !text) return;\n"
+    "    size_t len = strlen(text);\n"
+    "    if (s->len + len + 1 > s->capacity) {\n"
+    "        // text may point into s, which growing would move\n"
+    "        size_t offset = text >= s->ptr && text <= s->ptr + s->len ? (size_t)(text - s->ptr) : (size_t)-1;\n"
+    "        size_t capacity = s->capacity * 2 > s->len + len + 1 ? s->capacity * 2 : s->len + len + 1;\n"
+    "        char  *ptr = realloc(s->ptr, capacity);\n"
+    "        if (!ptr) return;\n"
+    "        if (offset != (size_t)-1) text = ptr + offset;\n"
+    "        s->ptr = ptr;\n"
+    "        s->capacity = capacity;\n"
+    "    }\n"
+    "    memmove(s->ptr + s->len, text, len);\n"
+    "    s->len += len;\n"
+    "    s->ptr[s->len] = '\\0';\n"
+    "}\n"
+    "\n"
+    "void own_string_replace(own_string *s, own_string value) {\n"
+    "    free(s->ptr);\n"
+    "    *s = value;\n"
+    "}\n"
+    "\n"
+    "// Grows the block at its end and slides the text up behind a fresh header\n"
+    "string own_string_share(own_string s) {\n"
+    "    if (!s.ptr) return NULL;\n"
+    "    RCHeader *header = realloc(s.ptr, RC_HEADER_SIZE + s.len + 1);\n"
+    "    if (!header) {\n"
+    "        free(s.ptr);\n"
+    "        return NULL;\n"
+    "    }\n"
+    "    memmove((char *)header + RC_HEADER_SIZE, header, s.len + 1);\n"
+    "    rc_init_header(header, 1);\n"
+    "    return (char *)header + RC_HEADER_SIZE;\n"
+    "}\n"
+    "\n"
+    "void own_string_free(own_string *s) {\n"
+    "    free(s->ptr);\n"
+    "    *s = OWN_STRING_NONE;\n"
+    "}\n"
+    "\n";
+
+static const char inline_array_runtime[] =
+    "// ========== ARRAYS ==========\n"
+    "// Growable arrays: the lowering of `array T name`. Pushes grow the storage\n"
+    "// geometrically, so a run of them is amortised O(1). The first\n"
+    "// ARRAY_INLINE_BYTES of elements live inside the Array itself and short arrays\n"
+    "// never allocate; past that the elements move to the heap, an RC block (which\n"
+    "// array_to_rc hands off without copying) or the enclosing arena, which spills\n"
+    "// to the heap once it is full. The macros take the element type, which the\n"
+    "// transpiler fills in. Indexing and popping are bounds checked unless NDEBUG\n"
+    "// is defined.\n"
+    "#ifndef ARRAY_INLINE_BYTES\n"
+    "#define ARRAY_INLINE_BYTES 64\n"
+    "#endif\n"
+    "\n"
+    "typedef enum { ARRAY_HEAP, ARRAY_RC, ARRAY_ARENA } ArrayBacking;\n"
+    "\n"
+    "typedef struct {\n"
+    "    void         *block;     // NULL while the elements fit inline\n"
+    "    size_t        length;    // Elements in use\n"
+    "    size_t        capacity;  // Elements that fit before the next growth\n"
+    "    size_t        elem_size;\n"
+    "    ArrayBacking  backing;\n"
+    "    Arena        *arena;     // ARRAY_ARENA only\n"
+    "    union {\n"
+    "        long double   align;\n"
+    "        void         *pointer;\n"
+    "        unsigned char bytes[ARRAY_INLINE_BYTES];\n"
+    "    } small;\n"
+    "} Array;\n"
+    "\n"
+    "#if defined(__GNUC__) && !defined(__TINYC__)\n"
+    "#define SAM_ARRAY __attribute__((cleanup(array_free)))\n"
+    "#define ARRAY_END(name)\n"
+    "#else\n"
+    "#define SAM_ARRAY\n"
+    "#define ARRAY_END(name) array_free(&name) // Early returns skip it\n"
+    "#endif\n"
+    "\n"
+    "#define array_data(a) ((a).block ? (a).block : (void *)(a).small.bytes)\n"
+    "#define array_len(a) ((a).length)\n"
+    "#define array_clear(a) ((void)((a).length = 0))\n"
+    "#define array_reserve(a, count) array_reserve_to(&(a), (count))\n"
+    "#define array_push(a, T, value)                                                                    \\\n"
+    "    (*(T *)((a).length < (a).capacity ? (char *)array_data(a) + (a).length++ * sizeof(T)           \\\n"
+    "                                      : array_push_slot(&(a))) = (value))\n"
+    "#define array_insert(a, T, index, value) (*(T *)array_insert_slot(&(a), (index)) = (value))\n"
+    "#ifdef NDEBUG\n"
+    "#define array_at(a, T, index) (((T *)array_data(a))[index])\n"
+    "#define array_pop(a, T) (((T *)array_data(a))[--(a).length])\n"
+    "#else\n"
+    "#define array_at(a, T, index) (*(T *)array_at_checked(&(a), (index), __FILE__, __LINE__))\n"
+    "#define array_pop(a, T) (*(T *)array_pop_checked(&(a), __FILE__, __LINE__))\n"
+    "#endif\n"
+    "\n"
+    "#define ARRAY_MIN_CAPACITY 8\n"
+    "\n"
+    "static Array array_with_backing(ArrayBacking backing, Arena *arena, size_t elem_size) {\n"
+    "    Array a = {0};\n"
+    "    a.elem_size = elem_size ? elem_size : 1;\n"
+    "    a.backing = backing;\n"
+    "    a.arena = arena;\n"
+    "    a.capacity = ARRAY_INLINE_BYTES / a.elem_size;\n"
+    "    return a;\n"
+    "}\n"
+    "\n"
+    "// Back to the inline storage, with nothing in it\n"
+    "static void array_empty(Array *a) {\n"
+    "    a->block = NULL;\n"
+    "    a->length = 0;\n"
+    "    a->capacity = a->elem_size ? ARRAY_INLINE_BYTES / a->elem_size : 0;\n"
+    "}\n"
+    "\n"
+    "Array array_create(size_t elem_size) { return array_with_backing(ARRAY_HEAP, NULL, elem_size); }\n"
+    "\n"
+    "Array array_create_rc(size_t elem_size) { return array_with_backing(ARRAY_RC, NULL, elem_size); }\n"
+    "\n"
+    "Array array_create_arena(Arena *arena, size_t elem_size) {\n"
+    "    return array_with_backing(arena ? ARRAY_ARENA : ARRAY_HEAP, arena, elem_size);\n"
+    "}\n"
+    "\n"
+    "// Moves the elements to room for at least needed of them. Capacity doubles,\n"
+    "// so each element is copied O(1) times over a run of pushes.\n"
+    "static void array_grow(Array *a, size_t needed) {\n"
+    "    size_t capacity = a->capacity < ARRAY_MIN_CAPACITY / 2 ? ARRAY_MIN_CAPACITY : a->capacity * 2;\n"
+    "    while (capacity < needed)\n"
+    "        capacity *= 2;\n"
+    "\n"
+    "    void  *old = array_data(*a);\n"
+    "    size_t used = a->length * a->elem_size;\n"
+    "    void  *block = NULL;\n"
+    "    if (capacity <= SIZE_MAX / a->elem_size) {\n"
+    "        size_t bytes = capacity * a->elem_size;\n"
+    "        switch (a->backing) {\n"
+    "        case ARRAY_ARENA:\n"
+    "            block = arena_try_realloc(a->arena, a->block, a->capacity * a->elem_size, bytes);\n"
+    "            if (block) {\n"
+    "                if (!a->block) memcpy(block, old, used);\n"
+    "                break;\n"
+    "            }\n"
+    "            // The arena is full; the elements carry on from the heap\n"
+    "            a->backing = ARRAY_HEAP;\n"
+    "            block = malloc(bytes);\n"
+    "            if (block) memcpy(block, old, used);\n"
+    "            break;\n"
+    "        case ARRAY_HEAP:\n"
+    "            block = a->block ? realloc(a->block, bytes) : malloc(bytes);\n"
+    "            if (block && !a->block) memcpy(block, old, used);\n"
+    "            break;\n"
+    "        case ARRAY_RC:\n"
+    "            block = rc_alloc(bytes);\n"
+    "            if (block) {\n"
+    "                RC_GET_HEADER(block)->array_count = capacity;\n"
+    "                memcpy(block, old, used);\n"
+    "                rc_release(a->block);\n"
+    "            }\n"
+    "            break;\n"
+    "        }\n"
+    "    }\n"
+    "    if (!block) {\n"
+    "        fprintf(stderr, \"array: out of memory growing to %zu elements\\n\", capacity);\n"
+    "        abort();\n"
+    "    }\n"
+    "    a->block = block;\n"
+    "    a->capacity = capacity;\n"
+    "}\n"
+    "\n"
+    "void array_reserve_to(Array *a, size_t capacity) {\n"
+    "    if (capacity > a->capacity) array_grow(a, capacity);\n"
+    "}\n"
+    "\n"
+    "void *array_push_slot(Array *a) {\n"
+    "    if (a->length == a->capacity) array_grow(a, a->length + 1);\n"
+    "    return (char *)array_data(*a) + a->length++ * a->elem_size;\n"
+    "}\n"
+    "\n"
+    "void *array_insert_slot(Array *a, size_t index) {\n"
+    "#ifndef NDEBUG\n"
+    "    if (index > a->length) {\n"
+    "        fprintf(stderr, \"array: insert at %zu past the end (length %zu)\\n\", index, a->length);\n"
+    "        abort();\n"
+    "    }\n"
+    "#endif\n"
+    "    if (a->length == a->capacity) array_grow(a, a->length + 1);\n"
+    "    char *slot = (char *)array_data(*a) + index * a->elem_size;\n"
+    "    memmove(slot + a->elem_size, slot, (a->length - index) * a->elem_size);\n"
+    "    a->length++;\n"
+    "    return slot;\n"
+    "}\n"
+    "\n"
+    "void array_append(Array *a, const void *items, size_t count) {\n"
+    "    if (count == 0) return;\n"
+    "    if (a->length + count > a->capacity) array_grow(a, a->length + count);\n"
+    "    memcpy((char *)array_data(*a) + a->length * a->elem_size, items, count * a->elem_size);\n"
+    "    a->length += count;\n"
+    "}\n"
+    "\n"
+    "void *array_at_checked(Array *a, size_t index, const char *file, int line) {\n"
+    "    if (index >= a->length) {\n"
+    "        fprintf(stderr, \"%s:%d: array index %zu out of bounds (length %zu)\\n\", file, line, index,\n"
+    "                a->length);\n"
+    "        abort();\n"
+    "    }\n"
+    "    return (char *)array_data(*a) + index * a->elem_size;\n"
+    "}\n"
+    "\n"
+    "void *array_pop_checked(Array *a, const char *file, int line) {\n"
+    "    if (a->length == 0) {\n"
+    "        fprintf(stderr, \"%s:%d: pop from an empty array\\n\", file, line);\n"
+    "        abort();\n"
+    "    }\n"
+    "    a->length--;\n"
+    "    return (char *)array_data(*a) + a->length * a->elem_size;\n"
+    "}\n"
+    "\n"
+    "void *array_to_rc(Array *a) {\n"
+    "    void *result;\n"
+    "    if (a->backing == ARRAY_RC && a->block) {\n"
+    "        // Already an RC array block; only its count needs to shrink\n"
+    "        result = a->block;\n"
+    "        RC_GET_HEADER(result)->array_count = a->length;\n"
+    "    } else {\n"
+    "        result = rc_alloc(a->length * a->elem_size);\n"
+    "        if (result) {\n"
+    "            RC_GET_HEADER(result)->array_count = a->length;\n"
+    "            memcpy(result, array_data(*a), a->length * a->elem_size);\n"
+    "        }\n"
+    "        if (a->backing == ARRAY_HEAP) free(a->block);\n"
+    "    }\n"
+    "    array_empty(a);\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "void array_free(Array *a) {\n"
+    "    if (a->backing == ARRAY_HEAP) free(a->block);\n"
+    "    if (a->backing == ARRAY_RC) rc_release(a->block);\n"
+    "    array_empty(a);\n"
+    "}\n";
+
+static const char inline_allocator_runtime[] =
+    "// ========== ALLOCATOR ==========\n"
+    "// Allocator interface. The backend is fixed at compile time (main.c defines\n"
+    "// SAM_ALLOC_ARENA or SAM_ALLOC_MALLOC for --alloc=arena|malloc), so the\n"
+    "// dispatch below is static inline and folds to a direct call.\n"
+    "//   ALLOC_REFCOUNT  default: refcounted objects on calloc/free. Under --alloc=rc\n"
+    "//                   the program's malloc family hands out refcounted blocks\n"
+    "//                   that free() releases, so rc_retain can share them\n"
+    "//   ALLOC_STANDARD  refcounted objects as above; malloc and free are plain\n"
+    "//   ALLOC_ARENA     objects and the program's blocks are carved from one\n"
+    "//                   growing region with immortal headers. Nothing is freed\n"
+    "//                   until allocator_reset or exit\n"
+    "// Only when --alloc= is given, the transpiler routes malloc, calloc, realloc,\n"
+    "// strdup and free in Sam code here, and then only if every free() and\n"
+    "// realloc() in the program takes a pointer it saw filled by those calls.\n"
+    "// Otherwise all of them stay with the C library: a block from the C library\n"
+    "// must never reach allocator_free or allocator_realloc.\n"
+    "typedef enum {\n"
+    "    ALLOC_STANDARD, // Use malloc/free\n"
+    "    ALLOC_ARENA,    // Use arena allocator\n"
+    "    ALLOC_REFCOUNT  // Use refcounting (default)\n"
+    "} AllocatorMode;\n"
+    "\n"
+    "#if defined(SAM_ALLOC_ARENA)\n"
+    "#define SAM_ALLOC_MODE ALLOC_ARENA\n"
+    "#elif defined(SAM_ALLOC_MALLOC)\n"
+    "#define SAM_ALLOC_MODE ALLOC_STANDARD\n"
+    "#else\n"
+    "#define SAM_ALLOC_MODE ALLOC_REFCOUNT\n"
+    "#endif\n"
+    "\n"
+    "#ifndef SAM_ALLOC_ARENA\n"
+    "// Only the region backend has anything to set up or drop\n"
+    "void allocator_init(size_t arena_size) { (void)arena_size; }\n"
+    "void allocator_reset(void) {}\n"
+    "void allocator_cleanup(void) {}\n"
+    "void *allocator_region_grow(void *ptr, size_t old_size, size_t new_size) {\n"
+    "    (void)ptr, (void)old_size, (void)new_size;\n"
+    "    return NULL;\n"
+    "}\n"
+    "#endif\n"
+    "\n"
+    "// Under the refcounting backends a block is a refcounted byte array, whose\n"
+    "// header remembers the size for realloc\n"
+    "static inline void *allocator_rc_block(size_t size) {\n"
+    "    void *ptr = rc_alloc(size);\n"
+    "    if (ptr) RC_GET_HEADER(ptr)->array_count = size;\n"
+    "    return ptr;\n"
+    "}\n"
+    "\n"
+    "// Allocation functions\n"
+    "static inline void *allocator_alloc(size_t size) {\n"
+    "    if (SAM_ALLOC_MODE == ALLOC_STANDARD) return malloc(size);\n"
+    "    return allocator_rc_block(size);\n"
+    "}\n"
+    "\n"
+    "static inline void *allocator_alloc_array(size_t elem_size, size_t count) {\n"
+    "    if (SAM_ALLOC_MODE == ALLOC_STANDARD) return calloc(count, elem_size);\n"
+    "    if (elem_size && count > SIZE_MAX / elem_size) return NULL;\n"
+    "    return allocator_rc_block(elem_size * count);\n"
+    "}\n"
+    "\n"
+    "static inline void *allocator_realloc(void *ptr, size_t size) {\n"
+    "    if (SAM_ALLOC_MODE == ALLOC_STANDARD) return realloc(ptr, size);\n"
+    "    if (!ptr) return allocator_alloc(size);\n"
+    "\n"
+    "    RCHeader *header = RC_GET_HEADER(ptr);\n"
+    "    if (SAM_ALLOC_MODE == ALLOC_REFCOUNT && rc_is_unique(ptr)) {\n"
+    "        header = realloc(header, RC_HEADER_SIZE + size);\n"
+    "        if (!header) return NULL;\n"
+    "        header->array_count = size;\n"
+    "        return (char *)header + RC_HEADER_SIZE;\n"
+    "    }\n"
+    "    if (SAM_ALLOC_MODE == ALLOC_ARENA &&\n"
+    "        allocator_region_grow(header, RC_HEADER_SIZE + header->array_count, RC_HEADER_SIZE + size)) {\n"
+    "        header->array_count = size;\n"
+    "        return ptr;\n"
+    "    }\n"
+    "    // Shared or older region blocks move; the other holders keep the old bytes\n"
+    "    void *copy = allocator_alloc(size);\n"
+    "    if (copy) {\n"
+    "        memcpy(copy, ptr, header->array_count < size ? header->array_count : size);\n"
+    "        rc_release(ptr);\n"
+    "    }\n"
+    "    return copy;\n"
+    "}\n"
+    "\n"
+    "static inline void allocator_free(void *ptr) {\n"
+    "    if (SAM_ALLOC_MODE == ALLOC_STANDARD) free(ptr);\n"
+    "    else rc_release(ptr);\n"
+    "}\n"
+    "\n"
+    "// String allocation\n"
+    "static inline char *allocator_strdup(const char *str) {\n"
+    "    if (!str) return NULL;\n"
+    "    size_t len = strlen(str);\n"
+    "    char  *copy = allocator_alloc(len + 1);\n"
+    "    if (copy) memcpy(copy, str, len + 1);\n"
+    "    return copy;\n"
+    "}\n";
+
+static const char inline_parallel_runtime[] =
+    "// ========== PARALLEL LOOPS ==========\n"
+    "#include <pthread.h>\n"
+    "#include <sched.h>\n"
+    "#include <unistd.h>\n"
+    "\n"
+    "struct Arena;\n"
+    "\n"
+    "#ifdef SAM_ALLOC_ARENA\n"
+    "#error \"parallel for needs --alloc=rc or --alloc=malloc: the arena region is single-threaded\"\n"
+    "#endif\n"
+    "\n"
+    "// A loop's index range runs as chunks on a pool with one worker per CPU in\n"
+    "// the affinity mask (SAM_THREADS overrides it), started by the first loop.\n"
+    "// Each worker owns a deque of ranges: it takes the newest one from its own\n"
+    "// end and, once that is empty, steals the oldest one of another worker, so\n"
+    "// an idle worker always takes the biggest piece left.\n"
+    "//   PARALLEL_STATIC   the range is cut into chunks of `chunk` iterations (one\n"
+    "//                     per worker when 0) dealt round-robin before the start;\n"
+    "//                     stealing only evens out what is left at the end\n"
+    "//   PARALLEL_DYNAMIC  a worker halves the range it takes, keeping the lower\n"
+    "//                     half and offering the upper one, until the piece has at\n"
+    "//                     most `chunk` iterations (0 picks a grain); unbalanced\n"
+    "//                     loops even themselves out\n"
+    "// The calling thread works too and returns once every iteration has run.\n"
+    "// Calls from several threads take turns; a loop started inside a loop body\n"
+    "// runs inline on that worker. body gets the worker's scratch arena\n"
+    "// (PARALLEL_SCRATCH_SIZE bytes), which is reset after every chunk.\n"
+    "typedef enum { PARALLEL_STATIC, PARALLEL_DYNAMIC } ParallelSchedule;\n"
+    "\n"
+    "typedef void (*ParallelBody)(void *context, long begin, long end, struct Arena *scratch);\n"
+    "\n"
+    "#ifndef PARALLEL_SCRATCH_SIZE\n"
+    "#define PARALLEL_SCRATCH_SIZE (1024 * 1024)\n"
+    "#endif\n"
+    "\n"
+    "void parallel_for_range(long begin, long end, long chunk, ParallelSchedule schedule,\n"
+    "                        ParallelBody body, void *context);\n"
+    "int  parallel_workers(void); // Pool size, the calling thread included; starts the pool\n"
+    "\n"
+    "// One lock for merging reductions into the caller's variables\n"
+    "void parallel_lock(void);\n"
+    "void parallel_unlock(void);\n"
+    "\n"
+    "#define PARALLEL_MAX_WORKERS 256\n"
+    "#define PARALLEL_DEQUE_SIZE 1024 // Power of two\n"
+    "#define PARALLEL_SPIN 2000       // Yields before an idle worker sleeps\n"
+    "#define PARALLEL_SPLITS 8        // Default dynamic grain: this many pieces per worker\n"
+    "\n"
+    "typedef struct {\n"
+    "    long begin, end;\n"
+    "} ParallelRange;\n"
+    "\n"
+    "// Only the owner pushes and pops at bottom; thieves take from top. The slots\n"
+    "// are read and written with relaxed atomics, since a thief may read one that\n"
+    "// the owner is overwriting and then lose the race on top.\n"
+    "typedef struct {\n"
+    "    long          top;\n"
+    "    char          pad[64];\n"
+    "    long          bottom;\n"
+    "    ParallelRange ranges[PARALLEL_DEQUE_SIZE];\n"
+    "} ParallelDeque;\n"
+    "\n"
+    "typedef struct {\n"
+    "    ParallelDeque deque;\n"
+    "    Arena        *scratch;\n"
+    "    unsigned      seed; // Picks steal victims\n"
+    "} ParallelWorker;\n"
+    "\n"
+    "static struct {\n"
+    "    int              count; // Workers, the submitting thread's included\n"
+    "    ParallelWorker  *workers[PARALLEL_MAX_WORKERS];\n"
+    "    pthread_mutex_t  lock; // Guards epoch and active\n"
+    "    pthread_cond_t   wake;\n"
+    "    pthread_cond_t   idle;\n"
+    "    unsigned long    epoch;  // Bumped for every loop\n"
+    "    int              active; // Pool threads still inside the last loop\n"
+    "\n"
+    "    // The running loop, written under lock before epoch changes\n"
+    "    ParallelBody     body;\n"
+    "    void            *context;\n"
+    "    ParallelSchedule schedule;\n"
+    "    long             grain;\n"
+    "    long             pending; // Iterations not run yet\n"
+    "} pool = {.lock = PTHREAD_MUTEX_INITIALIZER,\n"
+    "          .wake = PTHREAD_COND_INITIALIZER,\n"
+    "          .idle = PTHREAD_COND_INITIALIZER};\n"
+    "\n"
+    "static pthread_once_t         pool_once = PTHREAD_ONCE_INIT;\n"
+    "static pthread_mutex_t        submit_lock = PTHREAD_MUTEX_INITIALIZER;\n"
+    "static pthread_mutex_t        merge_lock = PTHREAD_MUTEX_INITIALIZER;\n"
+    "static __thread ParallelWorker *parallel_self; // Set while a thread works for the pool\n"
+    "\n"
+    "// =========================== [ DEQUE ] ====================================\n"
+    "\n"
+    "static int deque_push(ParallelDeque *d, long begin, long end) {\n"
+    "    long bottom = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);\n"
+    "    long top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);\n"
+    "    if (bottom - top >= PARALLEL_DEQUE_SIZE) return 0;\n"
+    "\n"
+    "    ParallelRange *slot = &d->ranges[bottom & (PARALLEL_DEQUE_SIZE - 1)];\n"
+    "    __atomic_store_n(&slot->begin, begin, __ATOMIC_RELAXED);\n"
+    "    __atomic_store_n(&slot->end, end, __ATOMIC_RELAXED);\n"
+    "    __atomic_store_n(&d->bottom, bottom + 1, __ATOMIC_RELEASE);\n"
+    "    return 1;\n"
+    "}\n"
+    "\n"
+    "static int deque_pop(ParallelDeque *d, ParallelRange *range) {\n"
+    "    long bottom = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;\n"
+    "    __atomic_store_n(&d->bottom, bottom, __ATOMIC_RELAXED);\n"
+    "    __atomic_thread_fence(__ATOMIC_SEQ_CST);\n"
+    "    long top = __atomic_load_n(&d->top, __ATOMIC_RELAXED);\n"
+    "\n"
+    "    if (top > bottom) {\n"
+    "        __atomic_store_n(&d->bottom, bottom + 1, __ATOMIC_RELAXED);\n"
+    "        return 0;\n"
+    "    }\n"
+    "    ParallelRange *slot = &d->ranges[bottom & (PARALLEL_DEQUE_SIZE - 1)];\n"
+    "    range->begin = __atomic_load_n(&slot->begin, __ATOMIC_RELAXED);\n"
+    "    range->end = __atomic_load_n(&slot->end, __ATOMIC_RELAXED);\n"
+    "    if (top < bottom) return 1;\n"
+    "\n"
+    "    // The last range: whoever moves top first gets it\n"
+    "    int won = __atomic_compare_exchange_n(&d->top, &top, top + 1, 0, __ATOMIC_SEQ_CST,\n"
+    "                                          __ATOMIC_RELAXED);\n"
+    "    __atomic_store_n(&d->bottom, bottom + 1, __ATOMIC_RELAXED);\n"
+    "    return won;\n"
+    "}\n"
+    "\n"
+    "static int deque_steal(ParallelDeque *d, ParallelRange *range) {\n"
+    "    long top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);\n"
+    "    __atomic_thread_fence(__ATOMIC_SEQ_CST);\n"
+    "    long bottom = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);\n"
+    "    if (top >= bottom) return 0;\n"
+    "\n"
+    "    ParallelRange *slot = &d->ranges[top & (PARALLEL_DEQUE_SIZE - 1)];\n"
+    "    range->begin = __atomic_load_n(&slot->begin, __ATOMIC_RELAXED);\n"
+    "    range->end = __atomic_load_n(&slot->end, __ATOMIC_RELAXED);\n"
+    "    return __atomic_compare_exchange_n(&d->top, &top, top + 1, 0, __ATOMIC_SEQ_CST,\n"
+    "                                       __ATOMIC_RELAXED);\n"
+    "}\n"
+    "\n"
+    "// =========================== [ WORKERS ] ====================================\n"
+    "\n"
+    "static int steal(ParallelWorker *self, ParallelRange *range) {\n"
+    "    int count = pool.count;\n"
+    "    if (count < 2) return 0;\n"
+    "\n"
+    "    self->seed ^= self->seed << 13;\n"
+    "    self->seed ^= self->seed >> 17;\n"
+    "    self->seed ^= self->seed << 5;\n"
+    "    int first = self->seed % count;\n"
+    "    for (int i = 0; i < count; i++) {\n"
+    "        ParallelWorker *victim = pool.workers[(first + i) % count];\n"
+    "        if (victim != self && deque_steal(&victim->deque, range)) return 1;\n"
+    "    }\n"
+    "    return 0;\n"
+    "}\n"
+    "\n"
+    "static void run_range(ParallelWorker *self, long begin, long end) {\n"
+    "    if (pool.schedule == PARALLEL_DYNAMIC) {\n"
+    "        while (end - begin > pool.grain && deque_push(&self->deque, begin + (end - begin) / 2, end))\n"
+    "            end = begin + (end - begin) / 2;\n"
+    "    }\n"
+    "    pool.body(pool.context, begin, end, self->scratch);\n"
+    "    arena_reset(self->scratch);\n"
+    "    __atomic_sub_fetch(&pool.pending, end - begin, __ATOMIC_ACQ_REL);\n"
+    "}\n"
+    "\n"
+    "// Runs ranges until every iteration of the current loop has run\n"
+    "static void work(ParallelWorker *self) {\n"
+    "    ParallelRange range;\n"
+    "    while (__atomic_load_n(&pool.pending, __ATOMIC_ACQUIRE) > 0) {\n"
+    "        if (deque_pop(&self->deque, &range) || steal(self, &range))\n"
+    "            run_range(self, range.begin, range.end);\n"
+    "        else\n"
+    "            sched_yield();\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static void *worker_main(void *arg) {\n"
+    "    ParallelWorker *self = arg;\n"
+    "    unsigned long   seen = 0;\n"
+    "\n"
+    "    parallel_self = self;\n"
+    "    for (;;) {\n"
+    "        // Loops tend to come in bursts, so look for the next one before sleeping\n"
+    "        for (int i = 0; i < PARALLEL_SPIN && __atomic_load_n(&pool.epoch, __ATOMIC_ACQUIRE) == seen; i++)\n"
+    "            sched_yield();\n"
+    "\n"
+    "        pthread_mutex_lock(&pool.lock);\n"
+    "        while (pool.epoch == seen)\n"
+    "            pthread_cond_wait(&pool.wake, &pool.lock);\n"
+    "        seen = pool.epoch;\n"
+    "        pool.active++;\n"
+    "        pthread_mutex_unlock(&pool.lock);\n"
+    "\n"
+    "        work(self);\n"
+    "\n"
+    "        pthread_mutex_lock(&pool.lock);\n"
+    "        if (--pool.active == 0) pthread_cond_signal(&pool.idle);\n"
+    "        pthread_mutex_unlock(&pool.lock);\n"
+    "    }\n"
+    "    return NULL;\n"
+    "}\n"
+    "\n"
+    "static int cpu_count(void) {\n"
+    "    const char *threads = getenv(\"SAM_THREADS\");\n"
+    "    if (threads && atoi(threads) > 0) return atoi(threads);\n"
+    "#ifdef CPU_COUNT\n"
+    "    cpu_set_t set;\n"
+    "    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) return CPU_COUNT(&set);\n"
+    "#endif\n"
+    "    long online = sysconf(_SC_NPROCESSORS_ONLN);\n"
+    "    return online > 0 ? (int)online : 1;\n"
+    "}\n"
+    "\n"
+    "static ParallelWorker *worker_create(int index) {\n"
+    "    ParallelWorker *worker = calloc(1, sizeof(ParallelWorker));\n"
+    "    if (!worker) return NULL;\n"
+    "    worker->scratch = arena_create(PARALLEL_SCRATCH_SIZE);\n"
+    "    if (!worker->scratch) {\n"
+    "        free(worker);\n"
+    "        return NULL;\n"
+    "    }\n"
+    "    worker->seed = 2654435761u * (index + 1);\n"
+    "    return worker;\n"
+    "}\n"
+    "\n"
+    "static void pool_start(void) {\n"
+    "    int wanted = cpu_count();\n"
+    "    if (wanted > PARALLEL_MAX_WORKERS) wanted = PARALLEL_MAX_WORKERS;\n"
+    "\n"
+    "    pool.workers[0] = worker_create(0);\n"
+    "    if (!pool.workers[0]) {\n"
+    "        fprintf(stderr, \"parallel: out of memory starting the pool\\n\");\n"
+    "        abort();\n"
+    "    }\n"
+    "    pool.count = 1;\n"
+    "    // Workers sleep until the first epoch, so count only grows before any loop\n"
+    "    while (pool.count < wanted) {\n"
+    "        ParallelWorker *worker = worker_create(pool.count);\n"
+    "        pthread_t       thread;\n"
+    "        if (!worker) break;\n"
+    "        if (pthread_create(&thread, NULL, worker_main, worker) != 0) {\n"
+    "            arena_destroy(worker->scratch);\n"
+    "            free(worker);\n"
+    "            break;\n"
+    "        }\n"
+    "        pthread_detach(thread);\n"
+    "        pool.workers[pool.count++] = worker;\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "// =========================== [ LOOPS ] ====================================\n"
+    "\n"
+    "int parallel_workers(void) {\n"
+    "    pthread_once(&pool_once, pool_start);\n"
+    "    return pool.count;\n"
+    "}\n"
+    "\n"
+    "void parallel_for_range(long begin, long end, long chunk, ParallelSchedule schedule,\n"
+    "                        ParallelBody body, void *context) {\n"
+    "    if (end <= begin) return;\n"
+    "    if (parallel_self) {\n"
+    "        body(context, begin, end, parallel_self->scratch);\n"
+    "        return;\n"
+    "    }\n"
+    "\n"
+    "    pthread_once(&pool_once, pool_start);\n"
+    "    pthread_mutex_lock(&submit_lock);\n"
+    "    pthread_mutex_lock(&pool.lock);\n"
+    "    // Stragglers from the last loop may still be looking at the deques\n"
+    "    while (pool.active > 0)\n"
+    "        pthread_cond_wait(&pool.idle, &pool.lock);\n"
+    "\n"
+    "    long count = end - begin;\n"
+    "    pool.body = body;\n"
+    "    pool.context = context;\n"
+    "    pool.schedule = schedule;\n"
+    "    pool.pending = count;\n"
+    "    if (schedule == PARALLEL_STATIC) {\n"
+    "        // Deal the chunks; the workers are idle, so their deques are ours\n"
+    "        long most = (long)pool.count * PARALLEL_DEQUE_SIZE;\n"
+    "        if (chunk <= 0) chunk = (count + pool.count - 1) / pool.count;\n"
+    "        if ((count + chunk - 1) / chunk > most) chunk = (count + most - 1) / most;\n"
+    "        int next = 0;\n"
+    "        for (long start = begin; start < end; start += chunk) {\n"
+    "            deque_push(&pool.workers[next]->deque, start, end - start > chunk ? start + chunk : end);\n"
+    "            next = (next + 1) % pool.count;\n"
+    "        }\n"
+    "    } else {\n"
+    "        pool.grain = chunk > 0 ? chunk : count / ((long)pool.count * PARALLEL_SPLITS);\n"
+    "        if (pool.grain < 1) pool.grain = 1;\n"
+    "        deque_push(&pool.workers[0]->deque, begin, end);\n"
+    "    }\n"
+    "    __atomic_store_n(&pool.epoch, pool.epoch + 1, __ATOMIC_RELEASE);\n"
+    "    pthread_cond_broadcast(&pool.wake);\n"
+    "    pthread_mutex_unlock(&pool.lock);\n"
+    "\n"
+    "    parallel_self = pool.workers[0];\n"
+    "    work(parallel_self);\n"
+    "    parallel_self = NULL;\n"
+    "    pthread_mutex_unlock(&submit_lock);\n"
+    "}\n"
+    "\n"
+    "void parallel_lock(void) { pthread_mutex_lock(&merge_lock); }\n"
+    "\n"
+    "void parallel_unlock(void) { pthread_mutex_unlock(&merge_lock); }\n";
+
+static const char inline_chan_runtime[] =
+    "// ========== CHANNELS ==========\n"
+    "#include <limits.h>\n"
+    "#include <sched.h>\n"
+    "#ifdef __linux__\n"
+    "#include <linux/futex.h>\n"
+    "#include <sys/syscall.h>\n"
+    "#include <unistd.h>\n"
+    "#endif\n"
+    "\n"
+    "// A channel is a ring of fixed-size slots; capacity rounds up to a power of two.\n"
+    "//   CHAN_SPSC  one sending and one receiving thread at a time: each side owns\n"
+    "//              its index and only reads the other's when its cached copy says\n"
+    "//              the ring is full or empty\n"
+    "//   CHAN_MPMC  any number of threads on either side: a slot's sequence number\n"
+    "//              says whose turn it is, and a position is claimed with one CAS\n"
+    "//              (one per batch)\n"
+    "// The blocking calls spin briefly, then sleep on a futex that the other side\n"
+    "// only wakes when someone is asleep. chan_close makes sends fail and lets\n"
+    "// receivers drain what is left; close once the last send has returned.\n"
+    "//\n"
+    "// A string channel moves references: chan_send_str takes the caller's\n"
+    "// reference and clears the variable, chan_recv_str hands it to the receiver,\n"
+    "// so nothing is retained or released on the way (the count is never touched\n"
+    "// by two threads at once). chan_free releases strings nobody received.\n"
+    "// Channels are not refcounted, since threads share them; free one once every\n"
+    "// thread is done with it.\n"
+    "typedef struct Chan *chan;\n"
+    "\n"
+    "typedef enum { CHAN_MPMC, CHAN_SPSC } ChanKind;\n"
+    "\n"
+    "chan chan_create(size_t elem_size, size_t capacity, ChanKind kind);\n"
+    "chan chan_create_strings(size_t capacity, ChanKind kind);\n"
+    "void chan_close(chan c);\n"
+    "void chan_free(chan c);\n"
+    "\n"
+    "// 1 once sent or received; 0 when the channel is closed (and, for receives,\n"
+    "// drained). The try forms return 0 at once when full or empty.\n"
+    "int chan_send(chan c, const void *value);\n"
+    "int chan_recv(chan c, void *value);\n"
+    "int chan_try_send(chan c, const void *value);\n"
+    "int chan_try_recv(chan c, void *value);\n"
+    "\n"
+    "// Batches claim several slots at once. chan_send_batch blocks until all count\n"
+    "// values are in (fewer only when closed); chan_recv_batch blocks until at\n"
+    "// least one arrives and takes up to max. Both return how many moved.\n"
+    "size_t chan_send_batch(chan c, const void *values, size_t count);\n"
+    "size_t chan_recv_batch(chan c, void *values, size_t max);\n"
+    "size_t chan_try_send_batch(chan c, const void *values, size_t count);\n"
+    "size_t chan_try_recv_batch(chan c, void *values, size_t max);\n"
+    "\n"
+    "// Strings: send clears *s on success and leaves it alone when closed; receive\n"
+    "// returns NULL once closed and drained\n"
+    "int    chan_send_str(chan c, string *s);\n"
+    "string chan_recv_str(chan c);\n"
+    "\n"
+    "#define chan_of(T, capacity) chan_create(sizeof(T), (capacity), CHAN_MPMC)\n"
+    "\n"
+    "#define CHAN_LINE 64  // Keeps the two sides' indices off each other's cache line\n"
+    "#define CHAN_SPIN 128 // Polls before sleeping\n"
+    "\n"
+    "struct Chan {\n"
+    "    // Senders' side\n"
+    "    size_t head;      // Next position to send into\n"
+    "    size_t tail_seen; // SPSC: the sender's last look at tail\n"
+    "    char   pad_send[CHAN_LINE - 2 * sizeof(size_t)];\n"
+    "\n"
+    "    // Receivers' side\n"
+    "    size_t tail;      // Next position to receive from\n"
+    "    size_t head_seen; // SPSC: the receiver's last look at head\n"
+    "    char   pad_recv[CHAN_LINE - 2 * sizeof(size_t)];\n"
+    "\n"
+    "    // Futex words, bumped to wake the other side, and how many sleep on each\n"
+    "    uint32_t not_empty;\n"
+    "    uint32_t not_full;\n"
+    "    uint32_t receivers_asleep;\n"
+    "    uint32_t senders_asleep;\n"
+    "    uint32_t closed;\n"
+    "\n"
+    "    ChanKind       kind;\n"
+    "    int            strings;\n"
+    "    size_t         elem_size;\n"
+    "    size_t         mask;  // Capacity - 1\n"
+    "    size_t        *turns; // MPMC: slot free for position p when p, full when p + 1\n"
+    "    unsigned char *slots;\n"
+    "};\n"
+    "\n"
+    "static inline void chan_relax(void) {\n"
+    "#if defined(__x86_64__) || defined(__i386__)\n"
+    "    __builtin_ia32_pause();\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static void futex_wait(uint32_t *word, uint32_t seen) {\n"
+    "#ifdef __linux__\n"
+    "    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);\n"
+    "#else\n"
+    "    (void)word;\n"
+    "    (void)seen;\n"
+    "    sched_yield();\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static void futex_wake(uint32_t *word) {\n"
+    "#ifdef __linux__\n"
+    "    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);\n"
+    "#else\n"
+    "    (void)word;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static inline unsigned char *slot(chan c, size_t pos) {\n"
+    "    return c->slots + (pos & c->mask) * c->elem_size;\n"
+    "}\n"
+    "\n"
+    "// =========================== [ RINGS ] ====================================\n"
+    "\n"
+    "static size_t spsc_send(chan c, const unsigned char *values, size_t count) {\n"
+    "    size_t head = __atomic_load_n(&c->head, __ATOMIC_RELAXED);\n"
+    "    if (head - c->tail_seen + count > c->mask + 1)\n"
+    "        c->tail_seen = __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);\n"
+    "    size_t room = c->mask + 1 - (head - c->tail_seen);\n"
+    "    if (count > room) count = room;\n"
+    "    if (count == 0) return 0;\n"
+    "\n"
+    "    for (size_t i = 0; i < count; i++)\n"
+    "        memcpy(slot(c, head + i), values + i * c->elem_size, c->elem_size);\n"
+    "    __atomic_store_n(&c->head, head + count, __ATOMIC_RELEASE);\n"
+    "    return count;\n"
+    "}\n"
+    "\n"
+    "static size_t spsc_recv(chan c, unsigned char *values, size_t max) {\n"
+    "    size_t tail = __atomic_load_n(&c->tail, __ATOMIC_RELAXED);\n"
+    "    if (c->head_seen - tail < max) c->head_seen = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);\n"
+    "    size_t ready = c->head_seen - tail;\n"
+    "    if (max > ready) max = ready;\n"
+    "    if (max == 0) return 0;\n"
+    "\n"
+    "    for (size_t i = 0; i < max; i++)\n"
+    "        memcpy(values + i * c->elem_size, slot(c, tail + i), c->elem_size);\n"
+    "    __atomic_store_n(&c->tail, tail + max, __ATOMIC_RELEASE);\n"
+    "    return max;\n"
+    "}\n"
+    "\n"
+    "// Claims the run of free slots at head with one CAS, then fills them\n"
+    "static size_t mpmc_send(chan c, const unsigned char *values, size_t count) {\n"
+    "    size_t pos = __atomic_load_n(&c->head, __ATOMIC_RELAXED);\n"
+    "    for (;;) {\n"
+    "        size_t n = 0;\n"
+    "        while (n < count && __atomic_load_n(&c->turns[(pos + n) & c->mask], __ATOMIC_ACQUIRE) == pos + n)\n"
+    "            n++;\n"
+    "        if (n == 0) {\n"
+    "            size_t turn = __atomic_load_n(&c->turns[pos & c->mask], __ATOMIC_ACQUIRE);\n"
+    "            if ((intptr_t)(turn - pos) < 0) return 0; // Still holds the value from a lap ago\n"
+    "            pos = __atomic_load_n(&c->head, __ATOMIC_RELAXED);\n"
+    "            continue;\n"
+    "        }\n"
+    "        if (__atomic_compare_exchange_n(&c->head, &pos, pos + n, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {\n"
+    "            for (size_t i = 0; i < n; i++) {\n"
+    "                memcpy(slot(c, pos + i), values + i * c->elem_size, c->elem_size);\n"
+    "                __atomic_store_n(&c->turns[(pos + i) & c->mask], pos + i + 1, __ATOMIC_RELEASE);\n"
+    "            }\n"
+    "            return n;\n"
+    "        }\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static size_t mpmc_recv(chan c, unsigned char *values, size_t max) {\n"
+    "    size_t pos = __atomic_load_n(&c->tail, __ATOMIC_RELAXED);\n"
+    "    for (;;) {\n"
+    "        size_t n = 0;\n"
+    "        while (n < max && __atomic_load_n(&c->turns[(pos + n) & c->mask], __ATOMIC_ACQUIRE) == pos + n + 1)\n"
+    "            n++;\n"
+    "        if (n == 0) {\n"
+    "            size_t turn = __atomic_load_n(&c->turns[pos & c->mask], __ATOMIC_ACQUIRE);\n"
+    "            if ((intptr_t)(turn - (pos + 1)) < 0) return 0; // Not sent yet\n"
+    "            pos = __atomic_load_n(&c->tail, __ATOMIC_RELAXED);\n"
+    "            continue;\n"
+    "        }\n"
+    "        if (__atomic_compare_exchange_n(&c->tail, &pos, pos + n, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {\n"
+    "            for (size_t i = 0; i < n; i++) {\n"
+    "                memcpy(values + i * c->elem_size, slot(c, pos + i), c->elem_size);\n"
+    "                __atomic_store_n(&c->turns[(pos + i) & c->mask], pos + i + c->mask + 1, __ATOMIC_RELEASE);\n"
+    "            }\n"
+    "            return n;\n"
+    "        }\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "// =========================== [ SLEEPING ] ====================================\n"
+    "\n"
+    "// After a send or receive: wake the other side if any of it sleeps. The\n"
+    "// fence pairs with the one in wait_for, so either the sleeper sees the new\n"
+    "// state or this sees the sleeper. Taking the count to zero wakes them all at\n"
+    "// once, so the sends made before they get to run cost no further syscalls.\n"
+    "static void wake(uint32_t *word, uint32_t *asleep) {\n"
+    "    __atomic_thread_fence(__ATOMIC_SEQ_CST);\n"
+    "    if (__atomic_load_n(asleep, __ATOMIC_RELAXED) == 0) return;\n"
+    "    if (__atomic_exchange_n(asleep, 0, __ATOMIC_RELAXED) == 0) return;\n"
+    "    __atomic_add_fetch(word, 1, __ATOMIC_RELEASE);\n"
+    "    futex_wake(word);\n"
+    "}\n"
+    "\n"
+    "static int is_closed(chan c) { return __atomic_load_n(&c->closed, __ATOMIC_ACQUIRE); }\n"
+    "\n"
+    "// Could a send (or receive) get anywhere now? Losing a race still counts.\n"
+    "static int ready(chan c, int sending) {\n"
+    "    if (is_closed(c)) return 1;\n"
+    "    if (sending) {\n"
+    "        size_t head = __atomic_load_n(&c->head, __ATOMIC_RELAXED);\n"
+    "        if (c->kind == CHAN_SPSC) return head - __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE) <= c->mask;\n"
+    "        return (intptr_t)(__atomic_load_n(&c->turns[head & c->mask], __ATOMIC_ACQUIRE) - head) >= 0;\n"
+    "    }\n"
+    "    size_t tail = __atomic_load_n(&c->tail, __ATOMIC_RELAXED);\n"
+    "    if (c->kind == CHAN_SPSC) return __atomic_load_n(&c->head, __ATOMIC_ACQUIRE) != tail;\n"
+    "    return (intptr_t)(__atomic_load_n(&c->turns[tail & c->mask], __ATOMIC_ACQUIRE) - (tail + 1)) >= 0;\n"
+    "}\n"
+    "\n"
+    "static void wait_for(chan c, int sending) {\n"
+    "    uint32_t *word = sending ? &c->not_full : &c->not_empty;\n"
+    "    uint32_t *asleep = sending ? &c->senders_asleep : &c->receivers_asleep;\n"
+    "\n"
+    "    for (int i = 0; i < CHAN_SPIN; i++) {\n"
+    "        if (ready(c, sending)) return;\n"
+    "        chan_relax();\n"
+    "    }\n"
+    "    uint32_t seen = __atomic_load_n(word, __ATOMIC_ACQUIRE);\n"
+    "    __atomic_add_fetch(asleep, 1, __ATOMIC_RELAXED);\n"
+    "    __atomic_thread_fence(__ATOMIC_SEQ_CST);\n"
+    "    if (!ready(c, sending)) {\n"
+    "        futex_wait(word, seen);\n"
+    "        return;\n"
+    "    }\n"
+    "    // Did not sleep after all: take back the count unless a waker already did\n"
+    "    uint32_t count = __atomic_load_n(asleep, __ATOMIC_RELAXED);\n"
+    "    while (count > 0 &&\n"
+    "           !__atomic_compare_exchange_n(asleep, &count, count - 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))\n"
+    "        ;\n"
+    "}\n"
+    "\n"
+    "// =========================== [ CHANNELS ] ====================================\n"
+    "\n"
+    "static chan chan_new(size_t elem_size, size_t capacity, ChanKind kind, int strings) {\n"
+    "    size_t rounded = 2;\n"
+    "    while (rounded < capacity && rounded <= SIZE_MAX / 4)\n"
+    "        rounded *= 2;\n"
+    "    if (elem_size == 0 || rounded > SIZE_MAX / elem_size) return NULL;\n"
+    "\n"
+    "    chan c = calloc(1, sizeof(struct Chan));\n"
+    "    if (!c) return NULL;\n"
+    "    c->kind = kind;\n"
+    "    c->strings = strings;\n"
+    "    c->elem_size = elem_size;\n"
+    "    c->mask = rounded - 1;\n"
+    "    c->slots = malloc(rounded * elem_size);\n"
+    "    if (kind == CHAN_MPMC) c->turns = malloc(rounded * sizeof(size_t));\n"
+    "    if (!c->slots || (kind == CHAN_MPMC && !c->turns)) {\n"
+    "        free(c->slots);\n"
+    "        free(c->turns);\n"
+    "        free(c);\n"
+    "        return NULL;\n"
+    "    }\n"
+    "    for (size_t i = 0; c->turns && i < rounded; i++)\n"
+    "        c->turns[i] = i;\n"
+    "    return c;\n"
+    "}\n"
+    "\n"
+    "chan chan_create(size_t elem_size, size_t capacity, ChanKind kind) {\n"
+    "    return chan_new(elem_size, capacity, kind, 0);\n"
+    "}\n"
+    "\n"
+    "chan chan_create_strings(size_t capacity, ChanKind kind) {\n"
+    "    return chan_new(sizeof(string), capacity, kind, 1);\n"
+    "}\n"
+    "\n"
+    "void chan_close(chan c) {\n"
+    "    if (!c) return;\n"
+    "    __atomic_store_n(&c->closed, 1, __ATOMIC_SEQ_CST);\n"
+    "    __atomic_add_fetch(&c->not_empty, 1, __ATOMIC_RELEASE);\n"
+    "    __atomic_add_fetch(&c->not_full, 1, __ATOMIC_RELEASE);\n"
+    "    futex_wake(&c->not_empty);\n"
+    "    futex_wake(&c->not_full);\n"
+    "}\n"
+    "\n"
+    "void chan_free(chan c) {\n"
+    "    if (!c) return;\n"
+    "    string s;\n"
+    "    while (c->strings && chan_try_recv(c, &s))\n"
+    "        rc_release(s);\n"
+    "    free(c->slots);\n"
+    "    free(c->turns);\n"
+    "    free(c);\n"
+    "}\n"
+    "\n"
+    "size_t chan_try_send_batch(chan c, const void *values, size_t count) {\n"
+    "    if (is_closed(c)) return 0;\n"
+    "    size_t n = c->kind == CHAN_SPSC ? spsc_send(c, values, count) : mpmc_send(c, values, count);\n"
+    "    if (n > 0) wake(&c->not_empty, &c->receivers_asleep);\n"
+    "    return n;\n"
+    "}\n"
+    "\n"
+    "size_t chan_try_recv_batch(chan c, void *values, size_t max) {\n"
+    "    size_t n = c->kind == CHAN_SPSC ? spsc_recv(c, values, max) : mpmc_recv(c, values, max);\n"
+    "    if (n > 0) wake(&c->not_full, &c->senders_asleep);\n"
+    "    return n;\n"
+    "}\n"
+    "\n"
+    "int chan_try_send(chan c, const void *value) { return chan_try_send_batch(c, value, 1) == 1; }\n"
+    "\n"
+    "int chan_try_recv(chan c, void *value) { return chan_try_recv_batch(c, value, 1) == 1; }\n"
+    "\n"
+    "size_t chan_send_batch(chan c, const void *values, size_t count) {\n"
+    "    const unsigned char *bytes = values;\n"
+    "    size_t               sent = 0;\n"
+    "    while (sent < count && !is_closed(c)) {\n"
+    "        size_t n = chan_try_send_batch(c, bytes + sent * c->elem_size, count - sent);\n"
+    "        if (n == 0) wait_for(c, 1);\n"
+    "        sent += n;\n"
+    "    }\n"
+    "    return sent;\n"
+    "}\n"
+    "\n"
+    "size_t chan_recv_batch(chan c, void *values, size_t max) {\n"
+    "    if (max == 0) return 0;\n"
+    "    for (;;) {\n"
+    "        size_t n = chan_try_recv_batch(c, values, max);\n"
+    "        if (n > 0) return n;\n"
+    "        // Whatever was sent before the close is still delivered\n"
+    "        if (is_closed(c)) return chan_try_recv_batch(c, values, max);\n"
+    "        wait_for(c, 0);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "int chan_send(chan c, const void *value) { return chan_send_batch(c, value, 1) == 1; }\n"
+    "\n"
+    "int chan_recv(chan c, void *value) { return chan_recv_batch(c, value, 1) == 1; }\n"
+    "\n"
+    "int chan_send_str(chan c, string *s) {\n"
+    "    if (!chan_send(c, s)) return 0;\n"
+    "    *s = NULL;\n"
+    "    return 1;\n"
+    "}\n"
+    "\n"
+    "string chan_recv_str(chan c) {\n"
+    "    string s;\n"
+    "    return chan_recv(c, &s) ? s : NULL;\n"
+    "}\n";
+
+static const char inline_async_runtime[] =
+    "// ========== ASYNC FUNCTIONS ==========\n"
+    "#include <arpa/inet.h>\n"
+    "#include <errno.h>\n"
+    "#include <fcntl.h>\n"
+    "#include <limits.h>\n"
+    "#include <netinet/in.h>\n"
+    "#include <pthread.h>\n"
+    "#include <sched.h>\n"
+    "#include <sys/epoll.h>\n"
+    "#include <sys/socket.h>\n"
+    "#include <time.h>\n"
+    "#include <unistd.h>\n"
+    "\n"
+    "// An async function is lowered to a frame holding its parameters and locals\n"
+    "// plus a step function that resumes it where it last suspended (`state`).\n"
+    "// Frames come from a per-thread pool of 64-byte size classes, so a task\n"
+    "// costs the header below plus its locals. Each thread that runs tasks owns\n"
+    "// one loop: tasks never move between threads, and nothing here locks.\n"
+    "//\n"
+    "// Awaitables are plain functions taking the task as their first argument:\n"
+    "// they return a result, or ASYNC_PENDING after arranging for the task to be\n"
+    "// resumed, at which point the same call is made again. Results are >= 0 on\n"
+    "// success and -errno on failure. `waiting` tells a retry from a first call;\n"
+    "// an awaitable of your own should clear it as the ones here do. File\n"
+    "// descriptors must be non-blocking; a regular file never reports EAGAIN, so\n"
+    "// async_read on one completes at once.\n"
+    "#define ASYNC_PENDING LONG_MIN\n"
+    "\n"
+    "enum { ASYNC_DONE, ASYNC_SUSPENDED }; // What a step function returns\n"
+    "\n"
+    "typedef struct AsyncTask AsyncTask;\n"
+    "typedef int (*AsyncStep)(AsyncTask *task);\n"
+    "\n"
+    "struct AsyncTask {\n"
+    "    AsyncStep  step;\n"
+    "    void     (*drop)(AsyncTask *task); // Releases what the frame owns, or NULL\n"
+    "    AsyncTask *waiter;                 // Resumed when this task finishes\n"
+    "    void      *result;                 // Where `return` stores its value, or NULL\n"
+    "    AsyncTask *next;                   // Ready queue\n"
+    "    long long  deadline;               // async_sleep, monotonic nanoseconds\n"
+    "    long       progress;               // An awaitable's own state across retries\n"
+    "    int        state;                  // Resume point; 0 before the first step\n"
+    "    int        waiting;                // Suspended by an awaitable that will be retried\n"
+    "    int        timer;                  // Slot in the timer heap, -1 when not sleeping\n"
+    "    unsigned   size;                   // Frame bytes, for the pool\n"
+    "};\n"
+    "\n"
+    "// Frames and scheduling, used by the lowered code\n"
+    "void *async_frame_alloc(size_t size, AsyncStep step);\n"
+    "void  async_spawn(AsyncTask *task);\n"
+    "int   async_await(AsyncTask *self, AsyncTask *child, void *result); // 1 when self must suspend\n"
+    "\n"
+    "// Runs this thread's tasks until none is left; returns how many are still\n"
+    "// suspended on something the loop cannot see (0 normally)\n"
+    "int async_run(void);\n"
+    "// One thread and loop per CPU (SAM_THREADS overrides the count), each pinned\n"
+    "// to its CPU: start(core, arg) spawns that loop's tasks, typically accepting\n"
+    "// on its own async_listen socket\n"
+    "int async_run_per_core(void (*start)(int core, void *arg), void *arg);\n"
+    "\n"
+    "// Awaitables\n"
+    "long async_read(AsyncTask *self, int fd, void *buf, size_t n);\n"
+    "long async_write(AsyncTask *self, int fd, const void *buf, size_t n);\n"
+    "long async_write_all(AsyncTask *self, int fd, const void *buf, size_t n);\n"
+    "long async_accept(AsyncTask *self, int fd);\n"
+    "long async_connect_tcp(AsyncTask *self, const char *host, int port); // The connected fd\n"
+    "long async_sleep(AsyncTask *self, long ms);\n"
+    "long async_yield(AsyncTask *self);\n"
+    "long async_wait_fd(AsyncTask *self, int fd, int writable); // Readiness only\n"
+    "\n"
+    "// Non-blocking descriptors\n"
+    "int async_nonblocking(int fd);\n"
+    "int async_pipe(int fds[2]);\n"
+    "int async_listen(const char *host, int port, int backlog); // SO_REUSEPORT; port 0 picks one\n"
+    "int async_local_port(int fd);\n"
+    "\n"
+    "#define ASYNC_POOL_CLASS 64          // Frame sizes round up to a multiple of this\n"
+    "#define ASYNC_POOL_CLASSES 64        // Pooled up to 4KB; bigger frames use malloc\n"
+    "#define ASYNC_POOL_CHUNK (64 * 1024) // Carved into frames as the pool grows\n"
+    "#define ASYNC_EVENTS 256             // epoll_wait batch\n"
+    "#define ASYNC_MAX_CORES 256\n"
+    "\n"
+    "// Who waits on a descriptor: one reader and one writer at a time. The\n"
+    "// registration is one-shot, so it is re-armed for whatever is still wanted.\n"
+    "typedef struct {\n"
+    "    AsyncTask *reader;\n"
+    "    AsyncTask *writer;\n"
+    "    int        registered;\n"
+    "} AsyncFd;\n"
+    "\n"
+    "typedef struct {\n"
+    "    int         epfd;\n"
+    "    long        tasks;  // Spawned or awaited and not finished\n"
+    "    long        frames; // Allocated and not freed\n"
+    "    AsyncTask  *ready, *ready_tail;\n"
+    "    AsyncTask **timers; // Min-heap on deadline\n"
+    "    int         timer_count, timer_capacity;\n"
+    "    AsyncFd    *fds;\n"
+    "    int         fd_capacity;\n"
+    "    int         io_waiting; // Tasks parked on a descriptor\n"
+    "\n"
+    "    void *free_frames[ASYNC_POOL_CLASSES];\n"
+    "    char *chunk;      // Current chunk; each starts with a link to the previous one\n"
+    "    size_t chunk_used;\n"
+    "} EventLoop;\n"
+    "\n"
+    "static __thread EventLoop *loop_self;\n"
     "\n"
-    "Arena *arena_create(size_t capacity) {\n"
-    "    Arena *arena = malloc(sizeof(Arena));\n"
-    "    if (!arena) return NULL;\n"
-    "    arena->buffer = malloc(capacity);\n"
-    "    if (!arena->buffer) { free(arena); return NULL; }\n"
-    "    arena->offset = 0;\n"
-    "    arena->capacity = capacity;\n"
-    "    arena->is_dynamic = 1;\n"
-    "    return arena;\n"
+    "static void out_of_memory(const char *what) {\n"
+    "    fprintf(stderr, \"async: out of memory %s\\n\", what);\n"
+    "    abort();\n"
     "}\n"
     "\n"
-    "void arena_destroy(Arena *arena) {\n"
-    "    if (!arena) return;\n"
-    "    if (arena->is_dynamic && arena->buffer) free(arena->buffer);\n"
-    "    free(arena);\n"
+    "static EventLoop *current_loop(void) {\n"
+    "    if (loop_self) return loop_self;\n"
+    "    EventLoop *loop = calloc(1, sizeof(EventLoop));\n"
+    "    if (!loop) out_of_memory(\"starting the event loop\");\n"
+    "    loop->epfd = epoll_create1(EPOLL_CLOEXEC);\n"
+    "    if (loop->epfd < 0) {\n"
+    "        perror(\"async: epoll_create1\");\n"
+    "        abort();\n"
+    "    }\n"
+    "    loop_self = loop;\n"
+    "    return loop;\n"
     "}\n"
     "\n"
-    "void arena_reset(Arena *arena) {\n"
-    "    if (arena) arena->offset = 0;\n"
+    "static long long now_ns(void) {\n"
+    "    struct timespec ts;\n"
+    "    clock_gettime(CLOCK_MONOTONIC, &ts);\n"
+    "    return ts.tv_sec * 1000000000LL + ts.tv_nsec;\n"
     "}\n"
     "\n"
-    "void *arena_alloc(Arena *arena, size_t size) {\n"
-    "    if (!arena || size == 0) return NULL;\n"
-    "    size = (size + 7) & ~7; // Align to 8 bytes\n"
-    "    if (arena->offset + size > arena->capacity) {\n"
-    "        fprintf(stderr, \"Arena out of memory\\n\");\n"
-    "        return NULL;\n"
+    "// =========================== [ FRAMES ] ====================================\n"
+    "\n"
+    "void *async_frame_alloc(size_t size, AsyncStep step) {\n"
+    "    EventLoop *loop = current_loop();\n"
+    "    size_t     class = (size + ASYNC_POOL_CLASS - 1) / ASYNC_POOL_CLASS;\n"
+    "    AsyncTask *task;\n"
+    "\n"
+    "    if (class > ASYNC_POOL_CLASSES) {\n"
+    "        task = malloc(size);\n"
+    "    } else if (loop->free_frames[class - 1]) {\n"
+    "        task = loop->free_frames[class - 1];\n"
+    "        loop->free_frames[class - 1] = *(void **)task;\n"
+    "    } else {\n"
+    "        size_t bytes = class * ASYNC_POOL_CLASS;\n"
+    "        if (!loop->chunk || loop->chunk_used + bytes > ASYNC_POOL_CHUNK) {\n"
+    "            char *chunk = malloc(ASYNC_POOL_CHUNK);\n"
+    "            if (!chunk) out_of_memory(\"allocating a task\");\n"
+    "            *(char **)chunk = loop->chunk;\n"
+    "            loop->chunk = chunk;\n"
+    "            loop->chunk_used = ASYNC_POOL_CLASS; // The link takes the first slot\n"
+    "        }\n"
+    "        task = (AsyncTask *)(loop->chunk + loop->chunk_used);\n"
+    "        loop->chunk_used += bytes;\n"
     "    }\n"
-    "    void *ptr = arena->buffer + arena->offset;\n"
-    "    arena->offset += size;\n"
-    "    return ptr;\n"
+    "    if (!task) out_of_memory(\"allocating a task\");\n"
+    "    memset(task, 0, size);\n"
+    "    task->step = step;\n"
+    "    task->timer = -1;\n"
+    "    task->size = (unsigned)size;\n"
+    "    loop->frames++;\n"
+    "    return task;\n"
     "}\n"
     "\n"
-    "void *arena_alloc_zero(Arena *arena, size_t size) {\n"
-    "    void *ptr = arena_alloc(arena, size);\n"
-    "    if (ptr) memset(ptr, 0, size);\n"
-    "    return ptr;\n"
+    "static void frame_free(EventLoop *loop, AsyncTask *task) {\n"
+    "    size_t class = (task->size + ASYNC_POOL_CLASS - 1) / ASYNC_POOL_CLASS;\n"
+    "    if (class > ASYNC_POOL_CLASSES) {\n"
+    "        free(task);\n"
+    "    } else {\n"
+    "        *(void **)task = loop->free_frames[class - 1];\n"
+    "        loop->free_frames[class - 1] = task;\n"
+    "    }\n"
+    "    loop->frames--;\n"
     "}\n"
     "\n"
-    "#define arena_array(arena, type, count) ((type*)arena_alloc_zero(arena, sizeof(type) * "
-    "(count)))\n"
+    "// Once every frame is back, the chunks go too\n"
+    "static void pool_trim(EventLoop *loop) {\n"
+    "    if (loop->frames > 0) return;\n"
+    "    while (loop->chunk) {\n"
+    "        char *previous = *(char **)loop->chunk;\n"
+    "        free(loop->chunk);\n"
+    "        loop->chunk = previous;\n"
+    "    }\n"
+    "    memset(loop->free_frames, 0, sizeof(loop->free_frames));\n"
+    "    loop->chunk_used = 0;\n"
+    "}\n"
     "\n"
-    "// ========== REFCOUNTING RUNTIME ==========\n"
-    "typedef struct RCHeader {\n"
-    "    size_t refcount;\n"
-    "    size_t weak_count;\n"
-    "    size_t array_count;\n"
-    "} RCHeader;\n"
+    "// =========================== [ SCHEDULING ] ====================================\n"
     "\n"
-    "#define RC_HEADER_SIZE sizeof(RCHeader)\n"
-    "#define RC_GET_HEADER(ptr) ((RCHeader *)((char *)(ptr) - RC_HEADER_SIZE))\n"
+    "static void make_ready(EventLoop *loop, AsyncTask *task) {\n"
+    "    task->next = NULL;\n"
+    "    if (loop->ready_tail)\n"
+    "        loop->ready_tail->next = task;\n"
+    "    else\n"
+    "        loop->ready = task;\n"
+    "    loop->ready_tail = task;\n"
+    "}\n"
     "\n"
-    "void *rc_alloc(size_t size) {\n"
-    "    RCHeader *header = (RCHeader *)calloc(1, RC_HEADER_SIZE + size);\n"
-    "    if (header) header->refcount = 1;\n"
-    "    return header ? (char *)header + RC_HEADER_SIZE : NULL;\n"
+    "static void finish(EventLoop *loop, AsyncTask *task) {\n"
+    "    if (task->waiter) make_ready(loop, task->waiter);\n"
+    "    if (task->drop) task->drop(task);\n"
+    "    frame_free(loop, task);\n"
+    "    loop->tasks--;\n"
     "}\n"
     "\n"
-    "void rc_retain(void *ptr) {\n"
-    "    if (ptr) RC_GET_HEADER(ptr)->refcount++;\n"
+    "static void run_task(EventLoop *loop, AsyncTask *task) {\n"
+    "    if (task->step(task) == ASYNC_DONE) finish(loop, task);\n"
     "}\n"
     "\n"
-    "void rc_release(void *ptr) {\n"
-    "    if (!ptr) return;\n"
-    "    RCHeader *header = RC_GET_HEADER(ptr);\n"
-    "    if (--header->refcount == 0 && header->weak_count == 0) {\n"
-    "        free(header);\n"
+    "void async_spawn(AsyncTask *task) {\n"
+    "    EventLoop *loop = current_loop();\n"
+    "    loop->tasks++;\n"
+    "    make_ready(loop, task);\n"
+    "}\n"
+    "\n"
+    "// The child runs at once; only if it suspends does the parent wait for it\n"
+    "int async_await(AsyncTask *self, AsyncTask *child, void *result) {\n"
+    "    EventLoop *loop = current_loop();\n"
+    "    loop->tasks++;\n"
+    "    child->result = result;\n"
+    "    if (child->step(child) == ASYNC_DONE) {\n"
+    "        finish(loop, child);\n"
+    "        return 0;\n"
     "    }\n"
+    "    child->waiter = self;\n"
+    "    return 1;\n"
     "}\n"
     "\n"
-    "// ========== STRING API ==========\n"
-    "typedef char *string;\n"
+    "// =========================== [ TIMERS ] ====================================\n"
     "\n"
-    "string string_create(const char *literal) {\n"
-    "    if (!literal) return NULL;\n"
-    "    size_t len = strlen(literal);\n"
-    "    char *str = rc_alloc(len + 1);\n"
-    "    if (str) strcpy(str, literal);\n"
-    "    return str;\n"
+    "static void timer_swap(EventLoop *loop, int a, int b) {\n"
+    "    AsyncTask *t = loop->timers[a];\n"
+    "    loop->timers[a] = loop->timers[b];\n"
+    "    loop->timers[b] = t;\n"
+    "    loop->timers[a]->timer = a;\n"
+    "    loop->timers[b]->timer = b;\n"
     "}\n"
     "\n"
-    "string string_concat(string a, string b) {\n"
-    "    if (!a || !b) return NULL;\n"
-    "    size_t len_a = strlen(a);\n"
-    "    size_t len_b = strlen(b);\n"
-    "    char *result = rc_alloc(len_a + len_b + 1);\n"
-    "    if (result) {\n"
-    "        strcpy(result, a);\n"
-    "        strcpy(result + len_a, b);\n"
+    "static void timer_push(EventLoop *loop, AsyncTask *task) {\n"
+    "    if (loop->timer_count == loop->timer_capacity) {\n"
+    "        int         capacity = loop->timer_capacity ? loop->timer_capacity * 2 : 64;\n"
+    "        AsyncTask **timers = realloc(loop->timers, sizeof(AsyncTask *) * capacity);\n"
+    "        if (!timers) out_of_memory(\"adding a timer\");\n"
+    "        loop->timers = timers;\n"
+    "        loop->timer_capacity = capacity;\n"
+    "    }\n"
+    "    int i = loop->timer_count++;\n"
+    "    loop->timers[i] = task;\n"
+    "    task->timer = i;\n"
+    "    while (i > 0 && loop->timers[(i - 1) / 2]->deadline > task->deadline) {\n"
+    "        timer_swap(loop, i, (i - 1) / 2);\n"
+    "        i = (i - 1) / 2;\n"
     "    }\n"
-    "    return result;\n"
     "}\n"
     "\n"
-    "string string_substr(string s, size_t start, size_t len) {\n"
-    "    if (!s) return NULL;\n"
-    "    size_t s_len = strlen(s);\n"
-    "    if (start >= s_len) return string_create(\"\");\n"
-    "    if (start + len > s_len) len = s_len - start;\n"
-    "    char *result = rc_alloc(len + 1);\n"
-    "    if (result) {\n"
-    "        strncpy(result, s + start, len);\n"
-    "        result[len] = '\\0';\n"
+    "static AsyncTask *timer_pop(EventLoop *loop) {\n"
+    "    AsyncTask *top = loop->timers[0];\n"
+    "    timer_swap(loop, 0, --loop->timer_count);\n"
+    "    for (int i = 0;;) {\n"
+    "        int child = 2 * i + 1;\n"
+    "        if (child >= loop->timer_count) break;\n"
+    "        if (child + 1 < loop->timer_count &&\n"
+    "            loop->timers[child + 1]->deadline < loop->timers[child]->deadline)\n"
+    "            child++;\n"
+    "        if (loop->timers[i]->deadline <= loop->timers[child]->deadline) break;\n"
+    "        timer_swap(loop, i, child);\n"
+    "        i = child;\n"
     "    }\n"
-    "    return result;\n"
+    "    top->timer = -1;\n"
+    "    return top;\n"
     "}\n"
     "\n"
-    "size_t string_length(string s) { return s ? strlen(s) : 0; }\n"
-    "void string_free(string s) { rc_release(s); }\n"
+    "// =========================== [ DESCRIPTORS ] ====================================\n"
+    "\n"
+    "static int arm(EventLoop *loop, int fd) {\n"
+    "    AsyncFd           *entry = &loop->fds[fd];\n"
+    "    struct epoll_event event = {0};\n"
+    "    event.events = EPOLLONESHOT | (entry->reader ? EPOLLIN : 0) | (entry->writer ? EPOLLOUT : 0);\n"
+    "    event.data.fd = fd;\n"
+    "    // A descriptor closed and reopened under the same number left epoll with it\n"
+    "    int op = entry->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;\n"
+    "    if (epoll_ctl(loop->epfd, op, fd, &event) < 0) {\n"
+    "        if (errno != ENOENT && errno != EEXIST) return -errno;\n"
+    "        op = op == EPOLL_CTL_MOD ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;\n"
+    "        if (epoll_ctl(loop->epfd, op, fd, &event) < 0) return -errno;\n"
+    "    }\n"
+    "    entry->registered = 1;\n"
+    "    return 0;\n"
+    "}\n"
+    "\n"
+    "long async_wait_fd(AsyncTask *self, int fd, int writable) {\n"
+    "    EventLoop *loop = current_loop();\n"
+    "    if (self->waiting) {\n"
+    "        self->waiting = 0;\n"
+    "        return 0;\n"
+    "    }\n"
+    "    if (fd < 0) return -EBADF;\n"
+    "    if (fd >= loop->fd_capacity) {\n"
+    "        int capacity = loop->fd_capacity ? loop->fd_capacity : 256;\n"
+    "        while (capacity <= fd)\n"
+    "            capacity *= 2;\n"
+    "        AsyncFd *fds = realloc(loop->fds, sizeof(AsyncFd) * capacity);\n"
+    "        if (!fds) out_of_memory(\"watching a descriptor\");\n"
+    "        memset(fds + loop->fd_capacity, 0, sizeof(AsyncFd) * (capacity - loop->fd_capacity));\n"
+    "        loop->fds = fds;\n"
+    "        loop->fd_capacity = capacity;\n"
+    "    }\n"
+    "    AsyncTask **slot = writable ? &loop->fds[fd].writer : &loop->fds[fd].reader;\n"
+    "    if (*slot) return -EBUSY;\n"
+    "    *slot = self;\n"
+    "    int failed = arm(loop, fd);\n"
+    "    if (failed) {\n"
+    "        *slot = NULL;\n"
+    "        return failed;\n"
+    "    }\n"
+    "    loop->io_waiting++;\n"
+    "    self->waiting = 1;\n"
+    "    return ASYNC_PENDING;\n"
+    "}\n"
+    "\n"
+    "static void dispatch(EventLoop *loop, const struct epoll_event *event) {\n"
+    "    AsyncFd *entry = &loop->fds[event->data.fd];\n"
+    "    int      failed = event->events & (EPOLLERR | EPOLLHUP);\n"
+    "    if (entry->reader && (event->events & EPOLLIN || failed)) {\n"
+    "        make_ready(loop, entry->reader);\n"
+    "        entry->reader = NULL;\n"
+    "        loop->io_waiting--;\n"
+    "    }\n"
+    "    if (entry->writer && (event->events & EPOLLOUT || failed)) {\n"
+    "        make_ready(loop, entry->writer);\n"
+    "        entry->writer = NULL;\n"
+    "        loop->io_waiting--;\n"
+    "    }\n"
+    "    if (entry->reader || entry->writer) arm(loop, event->data.fd);\n"
+    "}\n"
+    "\n"
+    "// =========================== [ RUNNING ] ====================================\n"
+    "\n"
+    "int async_run(void) {\n"
+    "    EventLoop         *loop = current_loop();\n"
+    "    struct epoll_event events[ASYNC_EVENTS];\n"
+    "\n"
+    "    while (loop->tasks > 0) {\n"
+    "        // Tasks readied meanwhile wait for the next round, after I/O is polled\n"
+    "        AsyncTask *ready = loop->ready;\n"
+    "        loop->ready = loop->ready_tail = NULL;\n"
+    "        while (ready) {\n"
+    "            AsyncTask *next = ready->next;\n"
+    "            run_task(loop, ready);\n"
+    "            ready = next;\n"
+    "        }\n"
+    "        if (loop->tasks == 0) break;\n"
+    "\n"
+    "        int timeout = -1;\n"
+    "        if (loop->ready) {\n"
+    "            timeout = 0;\n"
+    "        } else if (loop->timer_count > 0) {\n"
+    "            long long wait = loop->timers[0]->deadline - now_ns();\n"
+    "            timeout = wait <= 0 ? 0 : (int)((wait + 999999) / 1000000);\n"
+    "        } else if (loop->io_waiting == 0) {\n"
+    "            break; // Nothing left that could wake anyone\n"
+    "        }\n"
+    "        int count = epoll_wait(loop->epfd, events, ASYNC_EVENTS, timeout);\n"
+    "        for (int i = 0; i < count; i++)\n"
+    "            dispatch(loop, &events[i]);\n"
+    "        if (loop->timer_count > 0) {\n"
+    "            long long now = now_ns();\n"
+    "            while (loop->timer_count > 0 && loop->timers[0]->deadline <= now)\n"
+    "                make_ready(loop, timer_pop(loop));\n"
+    "        }\n"
+    "    }\n"
+    "    int stuck = (int)loop->tasks;\n"
+    "    pool_trim(loop);\n"
+    "    return stuck;\n"
+    "}\n"
+    "\n"
+    "typedef struct {\n"
+    "    int  core;\n"
+    "    int  cpu; // -1 when it cannot be pinned\n"
+    "    void (*start)(int core, void *arg);\n"
+    "    void *arg;\n"
+    "    int   stuck;\n"
+    "} AsyncCore;\n"
+    "\n"
+    "static void *core_main(void *data) {\n"
+    "    AsyncCore *core = data;\n"
+    "#ifdef CPU_SET\n"
+    "    if (core->cpu >= 0) {\n"
+    "        cpu_set_t set;\n"
+    "        CPU_ZERO(&set);\n"
+    "        CPU_SET(core->cpu, &set);\n"
+    "        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);\n"
+    "    }\n"
+    "#endif\n"
+    "    core->start(core->core, core->arg);\n"
+    "    core->stuck = async_run();\n"
+    "    return NULL;\n"
+    "}\n"
+    "\n"
+    "int async_run_per_core(void (*start)(int core, void *arg), void *arg) {\n"
+    "    AsyncCore        cores[ASYNC_MAX_CORES];\n"
+    "    pthread_t        threads[ASYNC_MAX_CORES];\n"
+    "    int              count = 0;\n"
+    "    const char      *wanted = getenv(\"SAM_THREADS\");\n"
+    "\n"
+    "#ifdef CPU_SET\n"
+    "    cpu_set_t set;\n"
+    "    if (sched_getaffinity(0, sizeof(set), &set) == 0) {\n"
+    "        for (int cpu = 0; cpu < CPU_SETSIZE && count < ASYNC_MAX_CORES; cpu++) {\n"
+    "            if (CPU_ISSET(cpu, &set)) cores[count++].cpu = cpu;\n"
+    "        }\n"
+    "    }\n"
+    "#endif\n"
+    "    if (count == 0) {\n"
+    "        long online = sysconf(_SC_NPROCESSORS_ONLN);\n"
+    "        count = online > 0 ? (online < ASYNC_MAX_CORES ? (int)online : ASYNC_MAX_CORES) : 1;\n"
+    "        for (int i = 0; i < count; i++)\n"
+    "            cores[i].cpu = -1;\n"
+    "    }\n"
+    "    if (wanted && atoi(wanted) > 0) {\n"
+    "        int n = atoi(wanted) < ASYNC_MAX_CORES ? atoi(wanted) : ASYNC_MAX_CORES;\n"
+    "        for (int i = count; i < n; i++)\n"
+    "            cores[i].cpu = -1; // More loops than CPUs share them unpinned\n"
+    "        count = n;\n"
+    "    }\n"
+    "\n"
+    "    int started = 1;\n"
+    "    for (int i = 0; i < count; i++) {\n"
+    "        cores[i].core = i;\n"
+    "        cores[i].start = start;\n"
+    "        cores[i].arg = arg;\n"
+    "        cores[i].stuck = 0;\n"
+    "    }\n"
+    "    for (; started < count; started++) {\n"
+    "        if (pthread_create(&threads[started], NULL, core_main, &cores[started]) != 0) break;\n"
+    "    }\n"
+    "    core_main(&cores[0]); // The calling thread is core 0\n"
+    "    int stuck = cores[0].stuck;\n"
+    "    for (int i = 1; i < started; i++) {\n"
+    "        pthread_join(threads[i], NULL);\n"
+    "        stuck += cores[i].stuck;\n"
+    "    }\n"
+    "    return stuck;\n"
+    "}\n"
+    "\n"
+    "// =========================== [ AWAITABLES ] ====================================\n"
+    "\n"
+    "long async_read(AsyncTask *self, int fd, void *buf, size_t n) {\n"
+    "    self->waiting = 0;\n"
+    "    for (;;) {\n"
+    "        ssize_t got = read(fd, buf, n);\n"
+    "        if (got >= 0) return got;\n"
+    "        if (errno == EINTR) continue;\n"
+    "        if (errno != EAGAIN && errno != EWOULDBLOCK) return -errno;\n"
+    "        return async_wait_fd(self, fd, 0);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "long async_write(AsyncTask *self, int fd, const void *buf, size_t n) {\n"
+    "    self->waiting = 0;\n"
+    "    for (;;) {\n"
+    "        ssize_t put = write(fd, buf, n);\n"
+    "        if (put >= 0) return put;\n"
+    "        if (errno == EINTR) continue;\n"
+    "        if (errno != EAGAIN && errno != EWOULDBLOCK) return -errno;\n"
+    "        return async_wait_fd(self, fd, 1);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "// Keeps the bytes already written in progress across retries\n"
+    "long async_write_all(AsyncTask *self, int fd, const void *buf, size_t n) {\n"
+    "    if (!self->waiting) self->progress = 0;\n"
+    "    self->waiting = 0;\n"
+    "    while ((size_t)self->progress < n) {\n"
+    "        ssize_t put = write(fd, (const char *)buf + self->progress, n - self->progress);\n"
+    "        if (put >= 0) {\n"
+    "            self->progress += put;\n"
+    "            continue;\n"
+    "        }\n"
+    "        if (errno == EINTR) continue;\n"
+    "        if (errno != EAGAIN && errno != EWOULDBLOCK) return -errno;\n"
+    "        return async_wait_fd(self, fd, 1);\n"
+    "    }\n"
+    "    return (long)n;\n"
+    "}\n"
+    "\n"
+    "long async_accept(AsyncTask *self, int fd) {\n"
+    "    self->waiting = 0;\n"
+    "    for (;;) {\n"
+    "        int client = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);\n"
+    "        if (client >= 0) return client;\n"
+    "        if (errno == EINTR || errno == ECONNABORTED) continue;\n"
+    "        if (errno != EAGAIN && errno != EWOULDBLOCK) return -errno;\n"
+    "        return async_wait_fd(self, fd, 0);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "// The socket being connected waits in progress\n"
+    "long async_connect_tcp(AsyncTask *self, const char *host, int port) {\n"
+    "    if (self->waiting) {\n"
+    "        int       fd = (int)self->progress, error = 0;\n"
+    "        socklen_t len = sizeof(error);\n"
+    "        self->waiting = 0;\n"
+    "        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) error = errno;\n"
+    "        if (error == 0) return fd;\n"
+    "        close(fd);\n"
+    "        return -error;\n"
+    "    }\n"
+    "\n"
+    "    struct sockaddr_in addr = {0};\n"
+    "    addr.sin_family = AF_INET;\n"
+    "    addr.sin_port = htons(port);\n"
+    "    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) return -EINVAL;\n"
+    "    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);\n"
+    "    if (fd < 0) return -errno;\n"
+    "    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return fd;\n"
+    "    if (errno != EINPROGRESS) {\n"
+    "        int error = errno;\n"
+    "        close(fd);\n"
+    "        return -error;\n"
+    "    }\n"
+    "    self->progress = fd;\n"
+    "    long waited = async_wait_fd(self, fd, 1);\n"
+    "    if (waited != ASYNC_PENDING) close(fd);\n"
+    "    return waited;\n"
+    "}\n"
+    "\n"
+    "long async_sleep(AsyncTask *self, long ms) {\n"
+    "    if (self->waiting) {\n"
+    "        self->waiting = 0;\n"
+    "        return 0;\n"
+    "    }\n"
+    "    if (ms <= 0) return async_yield(self);\n"
+    "    self->deadline = now_ns() + ms * 1000000LL;\n"
+    "    self->waiting = 1;\n"
+    "    timer_push(current_loop(), self);\n"
+    "    return ASYNC_PENDING;\n"
+    "}\n"
+    "\n"
+    "// Lets every other ready task run first\n"
+    "long async_yield(AsyncTask *self) {\n"
+    "    if (self->waiting) {\n"
+    "        self->waiting = 0;\n"
+    "        return 0;\n"
+    "    }\n"
+    "    self->waiting = 1;\n"
+    "    make_ready(current_loop(), self);\n"
+    "    return ASYNC_PENDING;\n"
+    "}\n"
+    "\n"
+    "// =========================== [ SETUP ] =====================================\n"
+    "\n"
+    "int async_nonblocking(int fd) {\n"
+    "    int flags = fcntl(fd, F_GETFL);\n"
+    "    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return -errno;\n"
+    "    return 0;\n"
+    "}\n"
+    "\n"
+    "int async_pipe(int fds[2]) { return pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0 ? -errno : 0; }\n"
+    "\n"
+    "int async_listen(const char *host, int port, int backlog) {\n"
+    "    struct sockaddr_in addr = {0};\n"
+    "    int                on = 1;\n"
+    "    addr.sin_family = AF_INET;\n"
+    "    addr.sin_port = htons(port);\n"
+    "    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) return -EINVAL;\n"
+    "\n"
+    "    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);\n"
+    "    if (fd < 0) return -errno;\n"
+    "    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));\n"
+    "    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));\n"
+    "    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, backlog) < 0) {\n"
+    "        int error = errno;\n"
+    "        close(fd);\n"
+    "        return -error;\n"
+    "    }\n"
+    "    return fd;\n"
+    "}\n"
+    "\n"
+    "int async_local_port(int fd) {\n"
+    "    struct sockaddr_in addr;\n"
+    "    socklen_t          len = sizeof(addr);\n"
+    "    if (getsockname(fd, (struct sockaddr *)&addr, &len) < 0) return -errno;\n"
+    "    return ntohs(addr.sin_port);\n"
+    "}\n";
+
+static const char inline_memo_runtime[] =
+    "// ========== MEMO CACHES ==========\n"
+    "// Each `memo` function owns one cache, keyed on the bytes of its arguments.\n"
+    "// A function of one integer argument (or none) keeps the keys in [0, direct)\n"
+    "// in a direct-mapped table: a state byte and the value per slot, no key, no\n"
+    "// hash, nothing evicted. Every other key goes to a hashed table of `capacity`\n"
+    "// entries in sets of MEMO_WAYS, where a full set evicts its oldest entry, so\n"
+    "// the cache stays bounded however many keys the program tries. Both tables\n"
+    "// are allocated by the first store that needs them.\n"
+    "//\n"
+    "// Under --threads (SAM_RC_ATOMIC or SAM_RC_BIASED) all threads share the\n"
+    "// cache: a direct slot is published with a release store once its value is\n"
+    "// written, and each hashed set has a spinlock. Threads that miss on the same\n"
+    "// key at once each compute it and the first store wins.\n"
+    "#define MEMO_WAYS 4\n"
+    "\n"
+    "typedef struct {\n"
+    "    unsigned long long hits;\n"
+    "    unsigned long long misses;\n"
+    "    unsigned long long evictions;\n"
+    "    unsigned long long entries; // Values cached right now\n"
+    "} MemoStats;\n"
+    "\n"
+    "typedef struct MemoCache {\n"
+    "    const char       *name;\n"
+    "    size_t            key_size;\n"
+    "    size_t            value_size;\n"
+    "    size_t            direct;   // Slots in the direct-mapped table\n"
+    "    size_t            capacity; // Hashed entries, rounded up to a power of two\n"
+    "    unsigned char    *slots;    // Direct table, NULL until the first store\n"
+    "    unsigned char    *sets;     // Hashed table, NULL until the first store\n"
+    "    MemoStats         stats;\n"
+    "    int               listed; // On memo_report's list\n"
+    "    struct MemoCache *next;\n"
+    "} MemoCache;\n"
+    "\n"
+    "#define MEMO_CACHE(name, key_size, value_size, direct, capacity)                                   \\\n"
+    "    {name, key_size, value_size, direct, capacity, NULL, NULL, {0, 0, 0, 0}, 0, NULL}\n"
+    "\n"
+    "// Index of an integer key in a direct table of `direct` slots, or -1\n"
+    "static inline long memo_slot(long long key, size_t direct) {\n"
+    "    return key >= 0 && (unsigned long long)key < direct ? (long)key : -1;\n"
+    "}\n"
+    "\n"
+    "// slot is the key's index in the direct table, or -1 to look key up by hash.\n"
+    "// memo_lookup copies the cached value out and returns 1 on a hit.\n"
+    "int  memo_lookup(MemoCache *cache, long slot, const void *key, void *value);\n"
+    "void memo_store(MemoCache *cache, long slot, const void *key, const void *value);\n"
+    "\n"
+    "MemoStats memo_cache_stats(MemoCache *cache);\n"
+    "void      memo_report(FILE *out); // One line per cache that has stored something\n"
+    "\n"
+    "#define memo_stats(fn) memo_cache_stats(&__memo_##fn)\n"
+    "\n"
+    "#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)\n"
+    "#define MEMO_LOAD(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)\n"
+    "#define MEMO_PUBLISH(field, value) __atomic_store_n(&(field), value, __ATOMIC_RELEASE)\n"
+    "#define MEMO_COUNT(field, n) __atomic_fetch_add(&(field), n, __ATOMIC_RELAXED)\n"
+    "#define MEMO_READ(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)\n"
+    "#else\n"
+    "#define MEMO_LOAD(field) (field)\n"
+    "#define MEMO_PUBLISH(field, value) ((field) = (value))\n"
+    "#define MEMO_COUNT(field, n) ((field) += (n))\n"
+    "#define MEMO_READ(field) (field)\n"
+    "#endif\n"
+    "\n"
+    "enum { MEMO_EMPTY, MEMO_WRITING, MEMO_READY }; // Direct slot states\n"
+    "\n"
+    "static MemoCache *memo_caches; // Every cache that has allocated a table\n"
+    "\n"
+    "// Stores value into *field if it is still NULL; returns what *field holds\n"
+    "static unsigned char *memo_install(unsigned char **field, unsigned char *value) {\n"
+    "#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)\n"
+    "    unsigned char *expected = NULL;\n"
+    "    if (__atomic_compare_exchange_n(field, &expected, value, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))\n"
+    "        return value;\n"
+    "    free(value);\n"
+    "    return expected;\n"
+    "#else\n"
+    "    return *field = value;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static void memo_list(MemoCache *cache) {\n"
+    "#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)\n"
+    "    if (__atomic_exchange_n(&cache->listed, 1, __ATOMIC_ACQ_REL)) return;\n"
+    "    cache->next = __atomic_load_n(&memo_caches, __ATOMIC_RELAXED);\n"
+    "    while (!__atomic_compare_exchange_n(&memo_caches, &cache->next, cache, 1, __ATOMIC_RELEASE,\n"
+    "                                        __ATOMIC_RELAXED))\n"
+    "        ;\n"
+    "#else\n"
+    "    if (cache->listed) return;\n"
+    "    cache->listed = 1;\n"
+    "    cache->next = memo_caches;\n"
+    "    memo_caches = cache;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "// =========================== [ DIRECT TABLE ] ====================================\n"
+    "\n"
+    "// State bytes first, then the values from the next 8-byte boundary\n"
+    "#define MEMO_VALUES(direct) (((direct) + 7) & ~(size_t)7)\n"
+    "\n"
+    "static int direct_lookup(MemoCache *cache, long slot, void *value) {\n"
+    "    unsigned char *slots = MEMO_LOAD(cache->slots);\n"
+    "    if (!slots || MEMO_LOAD(slots[slot]) != MEMO_READY) return 0;\n"
+    "    memcpy(value, slots + MEMO_VALUES(cache->direct) + slot * cache->value_size, cache->value_size);\n"
+    "    return 1;\n"
+    "}\n"
+    "\n"
+    "static void direct_store(MemoCache *cache, long slot, const void *value) {\n"
+    "    unsigned char *slots = MEMO_LOAD(cache->slots);\n"
+    "    if (!slots) {\n"
+    "        slots = calloc(1, MEMO_VALUES(cache->direct) + cache->direct * cache->value_size);\n"
+    "        if (!slots) return;\n"
+    "        slots = memo_install(&cache->slots, slots);\n"
+    "        memo_list(cache);\n"
+    "    }\n"
+    "#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)\n"
+    "    unsigned char state = MEMO_EMPTY;\n"
+    "    if (!__atomic_compare_exchange_n(&slots[slot], &state, MEMO_WRITING, 0, __ATOMIC_ACQUIRE,\n"
+    "                                     __ATOMIC_RELAXED))\n"
+    "        return; // Another thread got there first\n"
+    "#else\n"
+    "    if (slots[slot] != MEMO_EMPTY) return;\n"
+    "#endif\n"
+    "    memcpy(slots + MEMO_VALUES(cache->direct) + slot * cache->value_size, value, cache->value_size);\n"
+    "    MEMO_PUBLISH(slots[slot], MEMO_READY);\n"
+    "    MEMO_COUNT(cache->stats.entries, 1);\n"
+    "}\n"
+    "\n"
+    "// =========================== [ HASHED TABLE ] ====================================\n"
+    "\n"
+    "// The table starts with its set mask; each set is a lock and the round-robin\n"
+    "// victim, then MEMO_WAYS entries of a tag (hash | 1, 0 when empty), the key\n"
+    "// and the value\n"
+    "typedef struct {\n"
+    "    uint32_t lock;\n"
+    "    uint32_t victim;\n"
+    "} MemoSet;\n"
+    "\n"
+    "#define MEMO_HEADER 8\n"
+    "\n"
+    "static size_t entry_size(const MemoCache *cache) {\n"
+    "    return 8 + ((cache->key_size + cache->value_size + 7) & ~(size_t)7);\n"
+    "}\n"
+    "\n"
+    "static size_t set_size(const MemoCache *cache) {\n"
+    "    return sizeof(MemoSet) + MEMO_WAYS * entry_size(cache);\n"
+    "}\n"
+    "\n"
+    "static uint64_t memo_hash(const unsigned char *key, size_t size) {\n"
+    "    uint64_t h = 0x9e3779b97f4a7c15ull ^ size;\n"
+    "    size_t   i = 0;\n"
+    "    for (; i + 8 <= size; i += 8) {\n"
+    "        uint64_t word;\n"
+    "        memcpy(&word, key + i, 8);\n"
+    "        h = (h ^ word) * 0x100000001b3ull;\n"
+    "        h ^= h >> 29;\n"
+    "    }\n"
+    "    for (; i < size; i++)\n"
+    "        h = (h ^ key[i]) * 0x100000001b3ull;\n"
+    "    h ^= h >> 32;\n"
+    "    h *= 0xd6e8feb86659fd93ull;\n"
+    "    return h ^ (h >> 32);\n"
+    "}\n"
+    "\n"
+    "static MemoSet *find_set(const MemoCache *cache, unsigned char *table, uint64_t hash) {\n"
+    "    uint64_t mask;\n"
+    "    memcpy(&mask, table, sizeof(mask));\n"
+    "    return (MemoSet *)(table + MEMO_HEADER + (hash & mask) * set_size(cache));\n"
+    "}\n"
+    "\n"
+    "static void set_lock(MemoSet *set) {\n"
+    "#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)\n"
+    "    while (__atomic_exchange_n(&set->lock, 1, __ATOMIC_ACQUIRE)) {\n"
+    "        // The holder copies one entry; if it is taking longer, it was preempted\n"
+    "        for (int spins = 0; __atomic_load_n(&set->lock, __ATOMIC_RELAXED); spins++) {\n"
+    "            if (spins >= 64) sched_yield();\n"
+    "        }\n"
+    "    }\n"
+    "#else\n"
+    "    (void)set;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static void set_unlock(MemoSet *set) {\n"
+    "#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)\n"
+    "    __atomic_store_n(&set->lock, 0, __ATOMIC_RELEASE);\n"
+    "#else\n"
+    "    (void)set;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "// The entry holding key in set, or NULL\n"
+    "static unsigned char *set_find(const MemoCache *cache, MemoSet *set, uint64_t tag, const void *key) {\n"
+    "    unsigned char *entry = (unsigned char *)(set + 1);\n"
+    "    for (int way = 0; way < MEMO_WAYS; way++, entry += entry_size(cache)) {\n"
+    "        uint64_t stored;\n"
+    "        memcpy(&stored, entry, 8);\n"
+    "        if (stored == tag && memcmp(entry + 8, key, cache->key_size) == 0) return entry;\n"
+    "    }\n"
+    "    return NULL;\n"
+    "}\n"
+    "\n"
+    "static int hashed_lookup(MemoCache *cache, const void *key, void *value) {\n"
+    "    unsigned char *table = MEMO_LOAD(cache->sets);\n"
+    "    if (!table) return 0;\n"
+    "    uint64_t hash = memo_hash(key, cache->key_size);\n"
+    "    MemoSet *set = find_set(cache, table, hash);\n"
+    "    set_lock(set);\n"
+    "    unsigned char *entry = set_find(cache, set, hash | 1, key);\n"
+    "    if (entry) memcpy(value, entry + 8 + cache->key_size, cache->value_size);\n"
+    "    set_unlock(set);\n"
+    "    return entry != NULL;\n"
+    "}\n"
+    "\n"
+    "static void hashed_store(MemoCache *cache, const void *key, const void *value) {\n"
+    "    unsigned char *table = MEMO_LOAD(cache->sets);\n"
+    "    if (!table) {\n"
+    "        uint64_t sets = 1;\n"
+    "        while (sets * MEMO_WAYS < cache->capacity)\n"
+    "            sets *= 2;\n"
+    "        table = calloc(1, MEMO_HEADER + sets * set_size(cache));\n"
+    "        if (!table) return;\n"
+    "        sets--;\n"
+    "        memcpy(table, &sets, sizeof(sets));\n"
+    "        table = memo_install(&cache->sets, table);\n"
+    "        memo_list(cache);\n"
+    "    }\n"
+    "\n"
+    "    uint64_t hash = memo_hash(key, cache->key_size), tag = hash | 1;\n"
+    "    MemoSet *set = find_set(cache, table, hash);\n"
+    "    set_lock(set);\n"
+    "    if (!set_find(cache, set, tag, key)) {\n"
+    "        unsigned char *first = (unsigned char *)(set + 1), *entry = NULL;\n"
+    "        for (int way = 0; way < MEMO_WAYS && !entry; way++) {\n"
+    "            uint64_t stored;\n"
+    "            memcpy(&stored, first + way * entry_size(cache), 8);\n"
+    "            if (stored == 0) entry = first + way * entry_size(cache);\n"
+    "        }\n"
+    "        if (entry) {\n"
+    "            MEMO_COUNT(cache->stats.entries, 1);\n"
+    "        } else {\n"
+    "            entry = first + set->victim * entry_size(cache);\n"
+    "            set->victim = (set->victim + 1) % MEMO_WAYS;\n"
+    "            MEMO_COUNT(cache->stats.evictions, 1);\n"
+    "        }\n"
+    "        memcpy(entry, &tag, 8);\n"
+    "        memcpy(entry + 8, key, cache->key_size);\n"
+    "        memcpy(entry + 8 + cache->key_size, value, cache->value_size);\n"
+    "    }\n"
+    "    set_unlock(set);\n"
+    "}\n"
+    "\n"
+    "// =========================== [ CACHES ] ====================================\n"
+    "\n"
+    "int memo_lookup(MemoCache *cache, long slot, const void *key, void *value) {\n"
+    "    int hit = slot >= 0 ? direct_lookup(cache, slot, value) : hashed_lookup(cache, key, value);\n"
+    "    if (hit)\n"
+    "        MEMO_COUNT(cache->stats.hits, 1);\n"
+    "    else\n"
+    "        MEMO_COUNT(cache->stats.misses, 1);\n"
+    "    return hit;\n"
+    "}\n"
+    "\n"
+    "void memo_store(MemoCache *cache, long slot, const void *key, const void *value) {\n"
+    "    if (slot >= 0)\n"
+    "        direct_store(cache, slot, value);\n"
+    "    else if (cache->capacity > 0)\n"
+    "        hashed_store(cache, key, value);\n"
+    "}\n"
+    "\n"
+    "MemoStats memo_cache_stats(MemoCache *cache) {\n"
+    "    MemoStats stats;\n"
+    "    stats.hits = MEMO_READ(cache->stats.hits);\n"
+    "    stats.misses = MEMO_READ(cache->stats.misses);\n"
+    "    stats.evictions = MEMO_READ(cache->stats.evictions);\n"
+    "    stats.entries = MEMO_READ(cache->stats.entries);\n"
+    "    return stats;\n"
+    "}\n"
+    "\n"
+    "void memo_report(FILE *out) {\n"
+    "    for (MemoCache *cache = MEMO_LOAD(memo_caches); cache; cache = cache->next) {\n"
+    "        MemoStats          stats = memo_cache_stats(cache);\n"
+    "        unsigned long long calls = stats.hits + stats.misses;\n"
+    "        fprintf(out, \"memo %s: %llu hits, %llu misses (%.1f%% hit rate), %llu entries, %llu evictions\\n\",\n"
+    "                cache->name, stats.hits, stats.misses, calls ? 100.0 * stats.hits / calls : 0.0,\n"
+    "                stats.entries, stats.evictions);\n"
+    "    }\n"
+    "}\n";
+
+static const char inline_soa_runtime[] =
+    "// ========== STRUCT OF ARRAYS ==========\n"
+    "// An `soa` array of structs keeps each field in a column of its own, so a\n"
+    "// loop over one field reads nothing else and can be vectorised. The\n"
+    "// transpiler writes a Name__soa type per struct, a restrict pointer per\n"
+    "// column; the columns share one zeroed block, each starting on a SOA_ALIGN\n"
+    "// boundary, from the enclosing function's arena (the heap once it is full)\n"
+    "// or the heap.\n"
+    "#ifndef SOA_ALIGN\n"
+    "#define SOA_ALIGN 64\n"
+    "#endif\n"
+    "\n"
+    "#if defined(__GNUC__) && !defined(__TINYC__)\n"
+    "#define SAM_SOA(T) __attribute__((cleanup(T##__soa_free)))\n"
+    "#define SOA_END(T, name)\n"
+    "#else\n"
+    "#define SAM_SOA(T)\n"
+    "#define SOA_END(T, name) T##__soa_free(&name) // Early returns skip it\n"
+    "#endif\n"
+    "\n"
+    "// Bytes a column of count elements takes, up to the next column's boundary\n"
+    "static inline size_t soa_column_bytes(size_t count, size_t size) {\n"
+    "    if (size && count > (SIZE_MAX / 2 - SOA_ALIGN) / size) {\n"
+    "        fprintf(stderr, \"soa: %zu elements of %zu bytes do not fit\\n\", count, size);\n"
+    "        abort();\n"
+    "    }\n"
+    "    return (count * size + SOA_ALIGN - 1) & ~(size_t)(SOA_ALIGN - 1);\n"
+    "}\n"
+    "\n"
+    "// A zeroed block of bytes starting on a SOA_ALIGN boundary; *base is what\n"
+    "// soa_release frees, NULL when it came from the arena\n"
+    "static inline unsigned char *soa_block(Arena *arena, size_t bytes, void **base) {\n"
+    "    unsigned char *block = arena ? arena_try_alloc(arena, bytes + SOA_ALIGN) : NULL;\n"
+    "    *base = NULL;\n"
+    "    if (block)\n"
+    "        memset(block, 0, bytes + SOA_ALIGN);\n"
+    "    else\n"
+    "        block = *base = calloc(1, bytes + SOA_ALIGN);\n"
+    "    if (!block) {\n"
+    "        fprintf(stderr, \"soa: out of memory for %zu bytes\\n\", bytes);\n"
+    "        abort();\n"
+    "    }\n"
+    "    return (unsigned char *)(((uintptr_t)block + SOA_ALIGN - 1) & ~(uintptr_t)(SOA_ALIGN - 1));\n"
+    "}\n"
     "\n"
-    "// ========== USER CODE STARTS HERE ==========\n";
+    "static inline void soa_release(void *base) { free(base); }\n";
+
+typedef struct {
+    const char *name; // Pulled in by this identifier or any name_* identifier
+    const char *text;
+} RuntimeSection;
+
+static const RuntimeSection runtime_sections[] = {
+    {"map", inline_map_runtime},
+    {"string_intern", inline_intern_runtime},
+    {"string_frame", inline_frame_runtime},
+    {"arena_string", inline_arena_string_runtime},
+    {"own_string", inline_own_runtime},
+    {"array", inline_array_runtime},
+    {"allocator", inline_allocator_runtime},
+    {"parallel", inline_parallel_runtime},
+    {"chan", inline_chan_runtime},
+    {"async", inline_async_runtime},
+    {"memo", inline_memo_runtime},
+    {"soa", inline_soa_runtime},
+};
+
+// Does code use the identifier name, or any identifier starting with name_?
+static int uses_runtime_name(const char *code, const char *name) {
+    size_t len = strlen(name);
+    for (const char *p = strstr(code, name); p; p = strstr(p + 1, name)) {
+        int starts = p == code || !(isalnum((unsigned char)p[-1]) || p[-1] == '_');
+        int ends = !(isalnum((unsigned char)p[len])) || p[len] == '_';
+        if (starts && ends) return 1;
+    }
+    return 0;
+}
+
+static char *read_stream(FILE *f) {
+    size_t size = 0, capacity = 4096;
+    char  *text = malloc(capacity);
+    int    ch;
+    rewind(f);
+    while (text && (ch = fgetc(f)) != EOF) {
+        if (size + 1 >= capacity) text = realloc(text, capacity *= 2);
+        if (text) text[size++] = ch;
+    }
+    if (text) text[size] = '\0';
+    return text;
+}
 
+#define STAGE_COUNT 18 // Transpiler stages below, each writing its own temp file
 
 int main(int argc, char **argv) {
     if (argc == 1) {
         printf("Usage: %s [options] <input.sam> [output.c]\n", argv[0]);
         printf("Options:\n");
         printf("  --run, --tcc   Transpile and run with tcc\n");
+        printf("  --intern       Intern string literals (one shared instance per text)\n");
+        printf("  --no-elide     Keep every retain/release and heap string (no elision or escape analysis)\n");
+        printf("  --threads      Atomic refcounts, for programs that share objects between threads\n");
+        printf("  --threads=biased  Owner thread counts without atomics, others atomically\n");
+        printf("  --alloc=rc|malloc|arena  Send the program's malloc and free through allocator.h\n");
         printf("  --help, -h     Show this help\n");
         printf("\nExamples:\n");
         printf("  %s program.sam               # Transpile to output/out.c\n", argv[0]);
@@ -171,10 +4756,36 @@ int main(int argc, char **argv) {
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--run") == 0 || strcmp(argv[i], "--tcc") == 0) {
             run_with_tcc = 1;
+        } else if (strcmp(argv[i], "--intern") == 0) {
+            sam_options.intern_literals = 1;
+        } else if (strcmp(argv[i], "--no-elide") == 0) {
+            sam_options.keep_refcounts = 1;
+        } else if (strcmp(argv[i], "--threads") == 0 || strcmp(argv[i], "--threads=atomic") == 0) {
+            sam_options.rc_mode = RC_MODE_ATOMIC;
+        } else if (strcmp(argv[i], "--threads=biased") == 0) {
+            sam_options.rc_mode = RC_MODE_BIASED;
+        } else if (strncmp(argv[i], "--alloc=", 8) == 0) {
+            const char *backend = argv[i] + 8;
+            sam_options.route_allocs = 1;
+            if (strcmp(backend, "rc") == 0) {
+                sam_options.alloc_mode = ALLOC_MODE_RC;
+            } else if (strcmp(backend, "malloc") == 0) {
+                sam_options.alloc_mode = ALLOC_MODE_MALLOC;
+            } else if (strcmp(backend, "arena") == 0) {
+                sam_options.alloc_mode = ALLOC_MODE_ARENA;
+            } else {
+                fprintf(stderr, "Error: Unknown allocator '%s' (expected rc, malloc or arena)\n", backend);
+                return 1;
+            }
         } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
             printf("Usage: %s [options] <input.sam> [output.c]\n", argv[0]);
             printf("Options:\n");
             printf("  --run, --tcc   Transpile and run with tcc\n");
+            printf("  --intern       Intern string literals (one shared instance per text)\n");
+            printf("  --no-elide     Keep every retain/release and heap string (no elision or escape analysis)\n");
+            printf("  --threads      Atomic refcounts, for programs that share objects between threads\n");
+            printf("  --threads=biased  Owner thread counts without atomics, others atomically\n");
+            printf("  --alloc=rc|malloc|arena  Send the program's malloc and free through allocator.h\n");
             printf("  --help, -h     Show this help\n");
             return 0;
         } else if (!input_file) {
@@ -188,6 +4799,10 @@ int main(int argc, char **argv) {
         fprintf(stderr, "Error: No input file specified\n");
         return 1;
     }
+    if (sam_options.alloc_mode == ALLOC_MODE_ARENA && sam_options.rc_mode != RC_MODE_PLAIN) {
+        fprintf(stderr, "Error: --alloc=arena needs the single-threaded refcount mode\n");
+        return 1;
+    }
 
     // Set default output file if not specified
     if (!output_file) {
@@ -227,63 +4842,147 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    // Create temporary files for each stage
-    FILE *temp1 = tmpfile();
-    FILE *temp2 = tmpfile();
-    FILE *temp3 = tmpfile();
-    FILE *temp4 = tmpfile();
+    // One temporary file per stage: stage n writes temps[n - 1]
+    FILE *temps[STAGE_COUNT] = {0};
+    FILE *result = NULL;
+    char *code = NULL;
+    int   status = 1;
+    int   errors = 0;
 
-    if (!temp1 || !temp2 || !temp3 || !temp4) {
-        fprintf(stderr, "Error: Cannot create temp files\n");
-        fclose(in);
-        fclose(out);
-        if (temp1) fclose(temp1);
-        if (temp2) fclose(temp2);
-        if (temp3) fclose(temp3);
-        if (temp4) fclose(temp4);
-        return 1;
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        temps[i] = tmpfile();
+        if (!temps[i]) {
+            fprintf(stderr, "Error: Cannot create temp files\n");
+            goto cleanup;
+        }
     }
 
-    int ch;
-
     // 1. add_semicolons - FIRST to ensure all statements end properly
     rewind(in);
-    add_semicolons(in, temp1);
+    add_semicolons(in, temps[0]);
+
+    // 2. evaluate_comptime - `comptime` declarations and expressions become constants
+    rewind(temps[0]);
+    if (evaluate_comptime(temps[0], temps[1]) > 0) goto cleanup;
+
+    // 3. lower_generics - `generic` structs and functions become one copy per instance
+    rewind(temps[1]);
+    if (lower_generics(temps[1], temps[2]) > 0) goto cleanup;
+
+    // 4. layout_structs - `reorder` structs get their fields sorted and cold ones split off
+    rewind(temps[2]);
+    if (layout_structs(temps[2], temps[3]) > 0) goto cleanup;
+
+    // 5. transform_strings
+    rewind(temps[3]);
+    transform_strings(temps[3], temps[4]);
+
+    // 6. add_rc_structs - `rc struct` becomes a handle type plus its RcType
+    rewind(temps[4]);
+    add_rc_structs(temps[4], temps[5]);
 
-    // 2. transform_strings
-    rewind(temp1);
-    transform_strings(temp1, temp2);
+    // 7. add_arena_support - works on code with semicolons
+    rewind(temps[5]);
+    add_arena_support(temps[5], temps[6]);
 
-    // 3. add_arena_support - works on code with semicolons
-    rewind(temp2);
-    add_arena_support(temp2, temp3);
+    // 8. lower_iterators - `for x in` pipelines become one fused loop
+    rewind(temps[6]);
+    errors = lower_iterators(temps[6], temps[7]);
 
-    // 4. add_refcounting
-    rewind(temp3);
-    add_refcounting(temp3, temp4);
+    // 9. add_arrays - `array T name` becomes a growable Array
+    rewind(temps[7]);
+    add_arrays(temps[7], temps[8]);
+
+    // 10. lower_soa_arrays - `soa` arrays of structs become one column per field
+    rewind(temps[8]);
+    if (errors == 0) errors = lower_soa_arrays(temps[8], temps[9]);
+
+    // 11. add_parallel_loops - `parallel for` bodies become functions run on the pool
+    rewind(temps[9]);
+    if (errors == 0) errors = add_parallel_loops(temps[9], temps[10]);
+
+    // 12. lower_owned_strings - `own string` becomes a header-less own_string
+    rewind(temps[10]);
+    if (errors == 0) errors = lower_owned_strings(temps[10], temps[11]);
+    if (errors > 0) goto cleanup;
+
+    // 13. add_release_pools - `release_pool` scopes batch their frees
+    rewind(temps[11]);
+    if (add_release_pools(temps[11], temps[12]) > 0) goto cleanup;
+
+    // 14. add_string_builders - self-appends in loops become builder appends
+    rewind(temps[12]);
+    add_string_builders(temps[12], temps[13]);
+
+    // 15. add_refcounting
+    rewind(temps[13]);
+    add_refcounting(temps[13], temps[14]);
+
+    // 16. elide_refcounts - drop the retain/release pairs that cancel out
+    rewind(temps[14]);
+    result = temps[14];
+    if (!sam_options.keep_refcounts) {
+        elide_refcounts(temps[14], temps[15]);
+        result = temps[15];
+    }
+
+    // 17. lower_async_functions - `async` functions become frames and step functions,
+    // after the refcounting they carry along
+    rewind(result);
+    if (lower_async_functions(result, temps[16]) > 0) goto cleanup;
+    result = temps[16];
+
+    // 18. lower_memo_functions - `memo` functions get a cache in front of their body
+    rewind(result);
+    if (lower_memo_functions(result, temps[17]) > 0) goto cleanup;
+    result = temps[17];
 
     // Debug: Show what was produced
-    rewind(temp4);
-    while ((ch = fgetc(temp4)) != EOF)
+    rewind(result);
+    int ch;
+    while ((ch = fgetc(result)) != EOF)
         putchar(ch);
-    rewind(temp4);
+    rewind(result);
 
-    // Write inline runtime to output
+    // Write inline runtime to output, plus the optional sections the code uses
+    code = read_stream(result);
+    if (!code) {
+        fprintf(stderr, "Error: Out of memory\n");
+        goto cleanup;
+    }
+    if (uses_runtime_name(code, "parallel") || uses_runtime_name(code, "chan") ||
+        uses_runtime_name(code, "async"))
+        fprintf(out, "#define _GNU_SOURCE 1\n"); // sched_getaffinity, syscall, accept4
+    if (sam_options.rc_mode == RC_MODE_ATOMIC) fprintf(out, "#define SAM_RC_ATOMIC 1\n");
+    if (sam_options.rc_mode == RC_MODE_BIASED) fprintf(out, "#define SAM_RC_BIASED 1\n");
+    if (sam_options.alloc_mode == ALLOC_MODE_MALLOC) fprintf(out, "#define SAM_ALLOC_MALLOC 1\n");
+    if (sam_options.alloc_mode == ALLOC_MODE_ARENA) fprintf(out, "#define SAM_ALLOC_ARENA 1\n");
+    if (uses_runtime_name(code, "RELEASE_POOL") || uses_runtime_name(code, "rc_pool"))
+        fprintf(out, "#define SAM_RELEASE_POOLS 1\n");
+    if (uses_runtime_name(code, "RcType")) fprintf(out, "#define SAM_RC_CYCLES 1\n");
     fprintf(out, "%s", inline_runtime);
+    for (size_t i = 0; i < sizeof(runtime_sections) / sizeof(runtime_sections[0]); i++) {
+        if (uses_runtime_name(code, runtime_sections[i].name))
+            fprintf(out, "\n%s", runtime_sections[i].text);
+    }
+    fprintf(out, "\n// ========== USER CODE STARTS HERE ==========\n");
 
     // Copy transpiled user code
-    rewind(temp4);
-    while ((ch = fgetc(temp4)) != EOF) {
-        fputc(ch, out);
-    }
+    fputs(code, out);
+    status = 0;
 
-    // Cleanup - close ALL files
+cleanup:
+    // Every exit after the files are open comes through here
+    free(code);
     fclose(in);
     fclose(out);
-    fclose(temp1);
-    fclose(temp2);
-    fclose(temp3);
-    fclose(temp4);
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        if (temps[i]) fclose(temps[i]);
+    }
+    if (status != 0) {
+        remove(output_file);
+        return status;
+    }
 
     // If --run mode, execute with tcc
     if (run_with_tcc) {
@@ -0,0 +1,1989 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ========== ARENA ALLOCATOR ==========
+typedef struct Arena Arena;
+struct Arena {
+    unsigned char *buffer;
+    size_t offset;
+    size_t capacity;
+    int is_dynamic;
+};
+
+Arena *arena_create(size_t capacity) {
+    Arena *arena = malloc(sizeof(Arena));
+    if (!arena) return NULL;
+    arena->buffer = malloc(capacity);
+    if (!arena->buffer) { free(arena); return NULL; }
+    arena->offset = 0;
+    arena->capacity = capacity;
+    arena->is_dynamic = 1;
+    return arena;
+}
+
+void arena_destroy(Arena *arena) {
+    if (!arena) return;
+    if (arena->is_dynamic && arena->buffer) free(arena->buffer);
+    free(arena);
+}
+
+void arena_reset(Arena *arena) {
+    if (arena) arena->offset = 0;
+}
+
+void *arena_try_alloc(Arena *arena, size_t size) {
+    if (!arena || size == 0) return NULL;
+    size = (size + 7) & ~7; // Align to 8 bytes
+    if (arena->offset + size > arena->capacity) return NULL;
+    void *ptr = arena->buffer + arena->offset;
+    arena->offset += size;
+    return ptr;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    void *ptr = arena_try_alloc(arena, size);
+    if (!ptr && arena && size > 0) fprintf(stderr, "Arena out of memory\n");
+    return ptr;
+}
+
+void *arena_alloc_zero(Arena *arena, size_t size) {
+    void *ptr = arena_alloc(arena, size);
+    if (ptr) memset(ptr, 0, size);
+    return ptr;
+}
+
+int arena_try_extend(Arena *arena, void *ptr, size_t old_size, size_t new_size) {
+    size_t old_aligned = (old_size + 7) & ~7;
+    size_t new_aligned = (new_size + 7) & ~7;
+    if ((unsigned char *)ptr + old_aligned != arena->buffer + arena->offset ||
+        arena->offset - old_aligned + new_aligned > arena->capacity)
+        return 0;
+    arena->offset = arena->offset - old_aligned + new_aligned;
+    return 1;
+}
+
+void *arena_try_realloc(Arena *arena, void *ptr, size_t old_size, size_t new_size) {
+    if (!ptr) return arena_try_alloc(arena, new_size);
+    if (new_size <= old_size || arena_try_extend(arena, ptr, old_size, new_size)) return ptr;
+    void *copy = arena_try_alloc(arena, new_size);
+    if (copy) memcpy(copy, ptr, old_size);
+    return copy;
+}
+
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t new_size) {
+    void *result = arena_try_realloc(arena, ptr, old_size, new_size);
+    if (!result && arena && new_size > 0) fprintf(stderr, "Arena out of memory\n");
+    return result;
+}
+
+#define arena_array(arena, type, count) ((type*)arena_alloc_zero(arena, sizeof(type) * (count)))
+
+// ========== REFCOUNTING RUNTIME ==========
+// Plain counts unless the transpiler defined SAM_RC_ATOMIC or SAM_RC_BIASED (--threads)
+#if defined(SAM_RC_CYCLES) && (defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED))
+#error "rc struct needs the single-threaded refcount mode (no --threads)"
+#endif
+#if defined(SAM_ALLOC_ARENA) && (defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED))
+#error "--alloc=arena needs the single-threaded refcount mode (no --threads)"
+#endif
+typedef struct RCHeader {
+    size_t   refcount; // Strong references (the owner's count under SAM_RC_BIASED)
+    size_t   weak_count;
+    size_t   array_count;
+    uint32_t flags; // RC_FLAG_* facts about the payload, cleared by the mutators
+    uint32_t hash;  // string_hash32 of the payload while RC_FLAG_HASHED is set
+#ifdef SAM_RC_BIASED
+    struct RcOwner  *owner;      // Allocating thread, NULL once its count is merged
+    intptr_t         shared;     // Other threads' count * RC_SHARED_ONE | RC_SHARED_* bits
+    struct RCHeader *queue_next; // Link in the owner's merge queue
+    void (*destroy)(void *);     // Destructor recorded when queued for a merge
+#endif
+#ifdef SAM_RC_CYCLES
+    const struct RcType *type; // Traced fields of the payload, NULL for leaf objects
+    size_t root_index;         // 1 + slot in the collector's root buffer, 0 when not buffered
+#endif
+} RCHeader;
+
+#define RC_HEADER_SIZE sizeof(RCHeader)
+#define RC_GET_HEADER(ptr) ((RCHeader *)((char *)(ptr) - RC_HEADER_SIZE))
+#define RC_FLAG_UTF8_CHECKED (1u << 0)
+#define RC_FLAG_UTF8_VALID (1u << 1)
+#define RC_FLAG_ASCII (1u << 2)
+#define RC_FLAG_HASHED (1u << 3)
+#define RC_FLAG_DERIVED (RC_FLAG_UTF8_CHECKED | RC_FLAG_UTF8_VALID | RC_FLAG_ASCII | RC_FLAG_HASHED)
+#define RC_FLAG_INTERNED (1u << 4)
+#define RC_IMMORTAL ((size_t)1 << 56)
+
+#ifdef SAM_RC_CYCLES
+#include <stddef.h>
+#ifndef RC_CYCLE_THRESHOLD
+#define RC_CYCLE_THRESHOLD 4096
+#endif
+#ifndef RC_CYCLE_BUDGET
+#define RC_CYCLE_BUDGET 16384
+#endif
+
+typedef struct RcType {
+    const char   *name;
+    size_t        size;
+    size_t        field_count;
+    const size_t *fields; // offsetof each field holding a string or rc struct pointer
+} RcType;
+
+#define rc_new(T) ((T)rc_alloc_typed(&T##__type))
+
+void   rc_release(void *ptr);
+void  *rc_alloc_typed(const RcType *type);
+size_t rc_collect_step(size_t budget); // Returns the number of objects freed
+size_t rc_collect_cycles(void);        // Steps until the root buffer is empty
+size_t rc_cycle_roots(void);           // Candidates waiting in the buffer
+#endif
+
+#ifdef SAM_RC_BIASED
+#define RC_SHARED_MERGED 1   // Owner count folded in; shared count is the total
+#define RC_SHARED_QUEUED 2   // Waiting in the owner's merge queue
+#define RC_SHARED_ELEMENTS 4 // destroy is an element destructor (rc_release_array)
+#define RC_SHARED_ONE 8
+#endif
+
+#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)
+#define RC_ADD(field, n) __atomic_fetch_add(&(field), n, __ATOMIC_RELAXED)
+#define RC_LOAD(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define RC_STORE(field, value) __atomic_store_n(&(field), value, __ATOMIC_RELAXED)
+#define RC_FLAGS_SET(header, bits) __atomic_fetch_or(&(header)->flags, bits, __ATOMIC_RELEASE)
+#else
+#define RC_ADD(field, n) ((field) += (n))
+#define RC_LOAD(field) (field)
+#define RC_STORE(field, value) ((field) = (value))
+#define RC_FLAGS_SET(header, bits) ((header)->flags |= (bits))
+#endif
+
+static void rc_finalize(RCHeader *header, void (*destroy)(void *), int elements) {
+    void *ptr = (char *)header + RC_HEADER_SIZE;
+    if (destroy && elements) {
+        void **array = (void **)ptr;
+        for (size_t i = 0; i < header->array_count; i++)
+            destroy(array[i]);
+    } else if (destroy) {
+        destroy(ptr);
+    }
+}
+
+#ifdef SAM_RELEASE_POOLS
+// Release pools: dead objects queue on the current pool until it drains
+typedef struct RcDeferred {
+    RCHeader *header;
+    void (*destroy)(void *);
+    int elements;
+} RcDeferred;
+
+typedef struct {
+    void **blocks;
+    size_t count;
+} ReleaseBatch;
+
+typedef struct ReleasePool {
+    RcDeferred         *items; // Objects waiting for the drain
+    size_t              count, capacity;
+    struct ReleasePool *outer;                        // Pool this one was pushed over
+    void (*free_blocks)(void **blocks, size_t count); // NULL: free() each block
+} ReleasePool;
+
+#if defined(__GNUC__) && !defined(__TINYC__)
+static __thread ReleasePool *rc_pool_current;
+#else
+static ReleasePool *rc_pool_current; // Without __thread the pool stack is per process
+#endif
+
+// Queue a dead object on the pool. The pool holds a weak reference until the
+// drain, so a weak release in between cannot free the block under it.
+static int rc_pool_defer(ReleasePool *pool, RCHeader *header, void (*destroy)(void *), int elements) {
+    if (pool->count == pool->capacity) {
+        size_t      capacity = pool->capacity ? pool->capacity * 2 : 64;
+        RcDeferred *items = realloc(pool->items, capacity * sizeof(RcDeferred));
+        if (!items) return 0;
+        pool->items = items;
+        pool->capacity = capacity;
+    }
+    RC_ADD(header->weak_count, 1);
+    pool->items[pool->count++] = (RcDeferred){header, destroy, elements};
+    return 1;
+}
+
+#endif
+
+// Run the destructor, then free the block unless weak references remain.
+// Under a release pool both wait for the pool's drain.
+static void rc_destroy(RCHeader *header, void (*destroy)(void *), int elements) {
+#ifdef SAM_RELEASE_POOLS
+    ReleasePool *pool = rc_pool_current;
+    if (pool && rc_pool_defer(pool, header, destroy, elements)) return;
+#endif
+    rc_finalize(header, destroy, elements);
+    if (RC_LOAD(header->weak_count) == 0) free(header);
+}
+
+#ifdef SAM_RC_BIASED
+#define RC_SHARED_COUNT(word) ((word) >> 3) // Arithmetic shift keeps negative counts
+
+typedef struct RcOwner {
+    RCHeader *queue; // Objects whose shared count went negative, pushed by other threads
+} RcOwner;
+
+static __thread RcOwner rc_self;
+
+// The shared count went negative, so only the owner's count can tell when the
+// object dies: hand it to the owner, which merges the two counts
+static void rc_queue_for_owner(RCHeader *header, void (*destroy)(void *), int elements) {
+    intptr_t bits = RC_SHARED_QUEUED | (elements ? RC_SHARED_ELEMENTS : 0);
+    header->destroy = destroy;
+    intptr_t old = __atomic_fetch_or(&header->shared, bits, __ATOMIC_ACQ_REL);
+    if (old & (RC_SHARED_QUEUED | RC_SHARED_MERGED)) return;
+
+    RcOwner  *owner = __atomic_load_n(&header->owner, __ATOMIC_RELAXED);
+    RCHeader *head = __atomic_load_n(&owner->queue, __ATOMIC_RELAXED);
+    do {
+        header->queue_next = head;
+    } while (!__atomic_compare_exchange_n(&owner->queue, &head, header, 1, __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+}
+
+void rc_biased_flush(void) {
+    RCHeader *header = __atomic_exchange_n(&rc_self.queue, NULL, __ATOMIC_ACQUIRE);
+    while (header) {
+        RCHeader *next = header->queue_next;
+        intptr_t  owned = (intptr_t)header->refcount;
+        header->refcount = 0;
+        __atomic_store_n(&header->owner, NULL, __ATOMIC_RELAXED);
+        intptr_t now = __atomic_add_fetch(&header->shared, owned * RC_SHARED_ONE + RC_SHARED_MERGED,
+                                          __ATOMIC_ACQ_REL);
+        if (RC_SHARED_COUNT(now) == 0)
+            rc_destroy(header, header->destroy, (now & RC_SHARED_ELEMENTS) != 0);
+        header = next;
+    }
+}
+#endif
+
+void rc_init_header(RCHeader *header, size_t refcount) {
+    header->refcount = refcount;
+    header->weak_count = 0;
+    header->array_count = 0;
+    header->flags = 0;
+    header->hash = 0;
+#ifdef SAM_RC_BIASED
+    // Immortal objects have no owner: any thread may hold them
+    int owned = refcount < RC_IMMORTAL;
+    header->owner = owned ? &rc_self : NULL;
+    header->refcount = owned ? refcount : 0;
+    header->shared = owned ? 0 : (intptr_t)refcount * RC_SHARED_ONE + RC_SHARED_MERGED;
+    header->queue_next = NULL;
+    header->destroy = NULL;
+#endif
+#ifdef SAM_RC_CYCLES
+    header->type = NULL;
+    header->root_index = 0;
+#endif
+}
+
+#ifdef SAM_ALLOC_ARENA
+// --alloc=arena: every object is carved from a region of arena chunks that
+// grows without moving anything, and lives until allocator_reset or exit
+#ifndef ALLOCATOR_CHUNK_SIZE
+#define ALLOCATOR_CHUNK_SIZE (1024 * 1024)
+#endif
+static Arena **region_chunks;
+static size_t  region_count, region_capacity;
+static size_t  region_chunk_size = ALLOCATOR_CHUNK_SIZE;
+static int     region_registered;
+
+void allocator_init(size_t arena_size) {
+    if (arena_size) region_chunk_size = arena_size;
+}
+
+void *allocator_region_grow(void *ptr, size_t old_size, size_t new_size) {
+    if (region_count == 0) return NULL;
+    return arena_try_extend(region_chunks[region_count - 1], ptr, old_size, new_size) ? ptr : NULL;
+}
+
+void allocator_reset(void) {
+    while (region_count > 1)
+        arena_destroy(region_chunks[--region_count]);
+    if (region_count) arena_reset(region_chunks[0]);
+}
+
+void allocator_cleanup(void) {
+    while (region_count > 0)
+        arena_destroy(region_chunks[--region_count]);
+    free(region_chunks);
+    region_chunks = NULL;
+    region_capacity = 0;
+}
+
+void *allocator_region_alloc(size_t size) {
+    void *ptr = region_count ? arena_try_alloc(region_chunks[region_count - 1], size) : NULL;
+    if (ptr || size == 0) return ptr;
+    if (region_count == region_capacity) {
+        size_t  capacity = region_capacity ? region_capacity * 2 : 16;
+        Arena **chunks = realloc(region_chunks, capacity * sizeof(Arena *));
+        if (!chunks) return NULL;
+        region_chunks = chunks;
+        region_capacity = capacity;
+    }
+    size_t needed = (size + 7) & ~(size_t)7;
+    Arena *chunk = arena_create(needed > region_chunk_size ? needed : region_chunk_size);
+    if (!chunk) return NULL;
+    if (!region_registered) region_registered = atexit(allocator_cleanup) == 0;
+    region_chunks[region_count++] = chunk;
+    return arena_try_alloc(chunk, size);
+}
+#endif
+
+void *rc_alloc(size_t size) {
+#ifdef SAM_ALLOC_ARENA
+    // Region objects are immortal: retain and release only touch the count
+    RCHeader *header = allocator_region_alloc(RC_HEADER_SIZE + size);
+    if (!header) return NULL;
+    memset(header, 0, RC_HEADER_SIZE + size);
+    rc_init_header(header, RC_IMMORTAL);
+#else
+    RCHeader *header = (RCHeader *)calloc(1, RC_HEADER_SIZE + size);
+    if (!header) return NULL;
+    rc_init_header(header, 1);
+#endif
+    return (char *)header + RC_HEADER_SIZE;
+}
+
+// Immortal header inside the arena, or a heap object once the arena is full
+void *rc_arena_alloc(Arena *arena, size_t size) {
+    RCHeader *header = arena_try_alloc(arena, RC_HEADER_SIZE + size);
+    if (!header) return rc_alloc(size);
+    memset(header, 0, RC_HEADER_SIZE + size);
+    rc_init_header(header, RC_IMMORTAL);
+    return (char *)header + RC_HEADER_SIZE;
+}
+
+void rc_retain(void *ptr) {
+    if (!ptr) return;
+    RCHeader *header = RC_GET_HEADER(ptr);
+#ifdef SAM_RC_BIASED
+    if (__atomic_load_n(&header->owner, __ATOMIC_RELAXED) == &rc_self) {
+        header->refcount++;
+    } else {
+        __atomic_fetch_add(&header->shared, RC_SHARED_ONE, __ATOMIC_RELAXED);
+    }
+#else
+    RC_ADD(header->refcount, 1);
+#endif
+}
+
+// Drop one strong reference; returns 1 when it was the last one
+static int rc_drop(RCHeader *header, void (*destroy)(void *), int elements) {
+#if defined(SAM_RC_BIASED)
+    // Merge first: the flush may hand this very object over to the shared count
+    if (__atomic_load_n(&rc_self.queue, __ATOMIC_RELAXED)) rc_biased_flush();
+    if (__atomic_load_n(&header->owner, __ATOMIC_RELAXED) == &rc_self) {
+        if (--header->refcount > 0) return 0;
+        // The owner is done: from now on the shared count is the whole count
+        __atomic_store_n(&header->owner, NULL, __ATOMIC_RELAXED);
+        intptr_t old = __atomic_fetch_or(&header->shared, RC_SHARED_MERGED, __ATOMIC_ACQ_REL);
+        return RC_SHARED_COUNT(old) == 0;
+    }
+    intptr_t now = __atomic_sub_fetch(&header->shared, RC_SHARED_ONE, __ATOMIC_ACQ_REL);
+    if (now & RC_SHARED_MERGED) return RC_SHARED_COUNT(now) == 0;
+    if (RC_SHARED_COUNT(now) < 0 && !(now & RC_SHARED_QUEUED))
+        rc_queue_for_owner(header, destroy, elements);
+    return 0;
+#elif defined(SAM_RC_ATOMIC)
+    (void)destroy, (void)elements;
+    if (__atomic_fetch_sub(&header->refcount, 1, __ATOMIC_RELEASE) != 1) return 0;
+    // Acquire the release sequence so every other thread's writes happen before the free
+    (void)__atomic_load_n(&header->refcount, __ATOMIC_ACQUIRE);
+    return 1;
+#else
+    (void)destroy, (void)elements;
+    return --header->refcount == 0;
+#endif
+}
+
+// Cycle collector implementation
+#ifdef SAM_RC_CYCLES
+#define RC_COLOR_MASK (3u << 5)
+#define RC_BLACK 0u         // In use, or not being examined
+#define RC_GRAY (1u << 5)   // Traced: the references from inside the subgraph are subtracted
+#define RC_WHITE (2u << 5)  // Garbage unless something black reaches it
+#define RC_PURPLE (3u << 5) // Possible root of a garbage cycle
+
+typedef struct {
+    RCHeader **items;
+    size_t     count, capacity;
+} RcHeaderStack;
+
+static RcHeaderStack rc_roots;
+static RcHeaderStack rc_dying; // Typed objects whose fields are still to be released
+static int           rc_collecting, rc_releasing;
+
+static uint32_t rc_color(RCHeader *header) { return header->flags & RC_COLOR_MASK; }
+
+static void rc_paint(RCHeader *header, uint32_t color) {
+    header->flags = (header->flags & ~RC_COLOR_MASK) | color;
+}
+
+// The traversals cannot stop halfway without corrupting counts, so running
+// out of memory for their stacks is fatal
+static void rc_stack_push(RcHeaderStack *stack, RCHeader *header) {
+    if (stack->count == stack->capacity) {
+        size_t     capacity = stack->capacity ? stack->capacity * 2 : 256;
+        RCHeader **items = realloc(stack->items, capacity * sizeof(RCHeader *));
+        if (!items) {
+            fprintf(stderr, "rc: out of memory tracing objects\n");
+            abort();
+        }
+        stack->items = items;
+        stack->capacity = capacity;
+    }
+    stack->items[stack->count++] = header;
+}
+
+static size_t rc_field_count(RCHeader *header) {
+    return header->type ? header->type->field_count : 0;
+}
+
+static RCHeader *rc_field(RCHeader *header, size_t i) {
+    void *child = *(void **)((char *)header + RC_HEADER_SIZE + header->type->fields[i]);
+    return child ? RC_GET_HEADER(child) : NULL;
+}
+
+static void rc_unbuffer(RCHeader *header) {
+    size_t    slot = header->root_index - 1;
+    RCHeader *last = rc_roots.items[--rc_roots.count];
+    rc_roots.items[slot] = last;
+    last->root_index = slot + 1;
+    header->root_index = 0;
+}
+
+static void rc_release_fields(void *ptr) {
+    RCHeader *header = RC_GET_HEADER(ptr);
+    for (size_t i = 0; i < header->type->field_count; i++)
+        rc_release(*(void **)((char *)ptr + header->type->fields[i]));
+}
+
+static void rc_release_typed(RCHeader *header) {
+    if (--header->refcount == 0) {
+        // Deaths are queued so a long chain is torn down in a loop, not by recursion
+        rc_paint(header, RC_BLACK);
+        if (header->root_index) rc_unbuffer(header);
+        rc_stack_push(&rc_dying, header);
+        if (rc_releasing) return;
+        rc_releasing = 1;
+        while (rc_dying.count > 0)
+            rc_destroy(rc_dying.items[--rc_dying.count], rc_release_fields, 0);
+        rc_releasing = 0;
+        return;
+    }
+    if (rc_color(header) == RC_PURPLE || header->type->field_count == 0) return;
+    rc_paint(header, RC_PURPLE);
+    if (!header->root_index) {
+        rc_stack_push(&rc_roots, header);
+        header->root_index = rc_roots.count;
+    }
+    if (rc_roots.count >= RC_CYCLE_THRESHOLD && !rc_collecting) rc_collect_step(RC_CYCLE_BUDGET);
+}
+
+// Paint everything root reaches gray, taking one count off each object per
+// edge that points at it; returns the number of objects traced
+static size_t rc_mark_gray(RCHeader *root, RcHeaderStack *work) {
+    size_t traced = 0;
+    rc_paint(root, RC_GRAY);
+    rc_stack_push(work, root);
+    while (work->count) {
+        RCHeader *header = work->items[--work->count];
+        traced++;
+        for (size_t i = 0; i < rc_field_count(header); i++) {
+            RCHeader *child = rc_field(header, i);
+            if (!child) continue;
+            child->refcount--;
+            if (rc_color(child) != RC_GRAY) {
+                rc_paint(child, RC_GRAY);
+                rc_stack_push(work, child);
+            }
+        }
+    }
+    return traced;
+}
+
+// Referenced from outside the subgraph: give back the counts it and everything
+// it reaches lost in rc_mark_gray
+static void rc_scan_black(RCHeader *root, RcHeaderStack *work) {
+    rc_paint(root, RC_BLACK);
+    rc_stack_push(work, root);
+    while (work->count) {
+        RCHeader *header = work->items[--work->count];
+        for (size_t i = 0; i < rc_field_count(header); i++) {
+            RCHeader *child = rc_field(header, i);
+            if (!child) continue;
+            child->refcount++;
+            if (rc_color(child) != RC_BLACK) {
+                rc_paint(child, RC_BLACK);
+                rc_stack_push(work, child);
+            }
+        }
+    }
+}
+
+static void rc_scan(RCHeader *root, RcHeaderStack *work, RcHeaderStack *black) {
+    rc_stack_push(work, root);
+    while (work->count) {
+        RCHeader *header = work->items[--work->count];
+        if (rc_color(header) != RC_GRAY) continue;
+        if (header->refcount > 0) {
+            rc_scan_black(header, black);
+            continue;
+        }
+        rc_paint(header, RC_WHITE);
+        for (size_t i = 0; i < rc_field_count(header); i++) {
+            RCHeader *child = rc_field(header, i);
+            if (child) rc_stack_push(work, child);
+        }
+    }
+}
+
+// White objects only reference each other or objects whose counts already
+// exclude them, so they are freed without releasing their fields. One that
+// is still buffered as a root for a later step leaves the buffer now.
+static void rc_collect_white(RCHeader *root, RcHeaderStack *work, RcHeaderStack *garbage) {
+    if (rc_color(root) != RC_WHITE) return;
+    rc_paint(root, RC_BLACK);
+    rc_stack_push(work, root);
+    while (work->count) {
+        RCHeader *header = work->items[--work->count];
+        if (header->root_index) rc_unbuffer(header);
+        rc_stack_push(garbage, header);
+        for (size_t i = 0; i < rc_field_count(header); i++) {
+            RCHeader *child = rc_field(header, i);
+            if (child && rc_color(child) == RC_WHITE) {
+                rc_paint(child, RC_BLACK);
+                rc_stack_push(work, child);
+            }
+        }
+    }
+}
+
+void *rc_alloc_typed(const RcType *type) {
+    char *ptr = rc_alloc(type->size);
+    if (ptr) RC_GET_HEADER(ptr)->type = type;
+    return ptr;
+}
+
+size_t rc_collect_step(size_t budget) {
+    if (rc_collecting) return 0;
+    rc_collecting = 1;
+
+    RcHeaderStack roots = {0}, work = {0}, black = {0}, garbage = {0};
+    size_t        traced = 0;
+    while (rc_roots.count > 0 && traced < budget) {
+        RCHeader *root = rc_roots.items[rc_roots.count - 1];
+        rc_unbuffer(root);
+        // Roots a previous one reached this step were traced with it
+        if (rc_color(root) != RC_PURPLE) continue;
+        rc_stack_push(&roots, root);
+        traced += rc_mark_gray(root, &work);
+    }
+    for (size_t i = 0; i < roots.count; i++)
+        rc_scan(roots.items[i], &work, &black);
+    for (size_t i = 0; i < roots.count; i++)
+        rc_collect_white(roots.items[i], &work, &garbage);
+
+    for (size_t i = 0; i < garbage.count; i++) {
+        if (garbage.items[i]->weak_count == 0) free(garbage.items[i]);
+    }
+    size_t freed = garbage.count;
+    free(roots.items);
+    free(work.items);
+    free(black.items);
+    free(garbage.items);
+    rc_collecting = 0;
+    return freed;
+}
+
+size_t rc_collect_cycles(void) {
+    size_t freed = 0;
+    while (rc_roots.count > 0)
+        freed += rc_collect_step((size_t)-1);
+    return freed;
+}
+
+size_t rc_cycle_roots(void) { return rc_roots.count; }
+#endif
+
+void rc_release_with(void *ptr, void (*destroy)(void *)) {
+    if (!ptr) return;
+    RCHeader *header = RC_GET_HEADER(ptr);
+#ifdef SAM_RC_CYCLES
+    if (header->type) {
+        rc_release_typed(header);
+        return;
+    }
+#endif
+    if (rc_drop(header, destroy, 0)) rc_destroy(header, destroy, 0);
+}
+
+void rc_release(void *ptr) { rc_release_with(ptr, NULL); }
+
+int rc_is_unique(void *ptr) {
+    RCHeader *header = RC_GET_HEADER(ptr);
+    if (RC_LOAD(header->weak_count) != 0) return 0;
+#ifdef SAM_RC_BIASED
+    intptr_t shared = __atomic_load_n(&header->shared, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&header->owner, __ATOMIC_RELAXED) == &rc_self)
+        return (intptr_t)header->refcount + RC_SHARED_COUNT(shared) == 1;
+    return (shared & RC_SHARED_MERGED) && RC_SHARED_COUNT(shared) == 1;
+#else
+    return RC_LOAD(header->refcount) == 1;
+#endif
+}
+
+#ifdef SAM_RELEASE_POOLS
+#if defined(__GNUC__) && !defined(__TINYC__)
+#define RELEASE_POOL(name)                                                                     \
+    ReleasePool name __attribute__((cleanup(rc_pool_pop))) = {0};                              \
+    rc_pool_push(&name)
+#define RELEASE_POOL_END(name)
+#define RELEASE_POOL_EXIT(name)
+#else
+#define RELEASE_POOL(name)                                                                     \
+    ReleasePool name = {0};                                                                    \
+    rc_pool_push(&name)
+#define RELEASE_POOL_END(name) rc_pool_pop(&name)  // After the scope's own releases
+#define RELEASE_POOL_EXIT(name) rc_pool_pop(&name) // Before a break, continue or return
+#endif
+
+void         rc_pool_push(ReleasePool *pool);
+void         rc_pool_pop(ReleasePool *pool); // Drain, then make the outer pool current again
+void         rc_pool_drain(ReleasePool *pool);
+ReleaseBatch rc_pool_collect(ReleasePool *pool);
+void         rc_batch_free(ReleaseBatch *batch);
+
+
+// Drop one weak reference; returns 1 when it was the last one
+static int rc_weak_drop(RCHeader *header) {
+#if defined(SAM_RC_ATOMIC) || defined(SAM_RC_BIASED)
+    return __atomic_sub_fetch(&header->weak_count, 1, __ATOMIC_ACQ_REL) == 0;
+#else
+    return --header->weak_count == 0;
+#endif
+}
+
+// Release pool implementation
+void rc_pool_push(ReleasePool *pool) {
+    pool->outer = rc_pool_current;
+    rc_pool_current = pool;
+}
+
+void rc_pool_pop(ReleasePool *pool) {
+    rc_pool_drain(pool);
+    free(pool->items);
+    pool->items = NULL;
+    pool->capacity = 0;
+    if (rc_pool_current == pool) rc_pool_current = pool->outer;
+}
+
+// Run the queued destructors while the pool is still current, so what they
+// release joins the same drain. Dead blocks go to batch, or straight to free()
+// when there is none.
+static void rc_pool_finalize(ReleasePool *pool, ReleaseBatch *batch) {
+    size_t capacity = 0;
+    for (size_t i = 0; i < pool->count; i++) {
+        RcDeferred item = pool->items[i];
+        rc_finalize(item.header, item.destroy, item.elements);
+        if (!rc_weak_drop(item.header)) continue; // A weak reference frees it later
+        if (batch && batch->count == capacity) {
+            capacity = capacity ? capacity * 2 : pool->count;
+            void **blocks = realloc(batch->blocks, capacity * sizeof(void *));
+            if (blocks) batch->blocks = blocks;
+        }
+        if (batch && batch->count < capacity) {
+            batch->blocks[batch->count++] = item.header;
+        } else {
+            free(item.header);
+        }
+    }
+    pool->count = 0;
+}
+
+ReleaseBatch rc_pool_collect(ReleasePool *pool) {
+    ReleaseBatch batch = {NULL, 0};
+    rc_pool_finalize(pool, &batch);
+    return batch;
+}
+
+void rc_batch_free(ReleaseBatch *batch) {
+    for (size_t i = 0; i < batch->count; i++)
+        free(batch->blocks[i]);
+    free(batch->blocks);
+    batch->blocks = NULL;
+    batch->count = 0;
+}
+
+void rc_pool_drain(ReleasePool *pool) {
+    if (!pool->free_blocks) {
+        rc_pool_finalize(pool, NULL);
+        return;
+    }
+    ReleaseBatch batch = rc_pool_collect(pool);
+    if (batch.count) pool->free_blocks(batch.blocks, batch.count);
+    free(batch.blocks);
+}
+#endif
+
+// ========== STRING API ==========
+typedef char *string;
+
+string string_create(const char *literal) {
+    if (!literal) return NULL;
+    size_t len = strlen(literal);
+    char *str = rc_alloc(len + 1);
+    if (str) strcpy(str, literal);
+    return str;
+}
+
+string string_concat(string a, string b) {
+    if (!a || !b) return NULL;
+    size_t len_a = strlen(a);
+    size_t len_b = strlen(b);
+    char *result = rc_alloc(len_a + len_b + 1);
+    if (result) {
+        strcpy(result, a);
+        strcpy(result + len_a, b);
+    }
+    return result;
+}
+
+string string_substr(string s, size_t start, size_t len) {
+    if (!s) return NULL;
+    size_t s_len = strlen(s);
+    if (start >= s_len) return string_create("");
+    if (start + len > s_len) len = s_len - start;
+    char *result = rc_alloc(len + 1);
+    if (result) {
+        strncpy(result, s + start, len);
+        result[len] = '\0';
+    }
+    return result;
+}
+
+size_t string_length(string s) { return s ? strlen(s) : 0; }
+void string_free(string s) { rc_release(s); }
+
+// ========== UNIQUENESS-AWARE STRINGS ==========
+void string_invalidate(string s) {
+    if (s) RC_GET_HEADER(s)->flags &= ~RC_FLAG_DERIVED;
+}
+
+int string_is_unique(string s) { return s && rc_is_unique(s); }
+
+string string_concat_inplace(string a, const char *b) {
+    if (!a) return NULL;
+    if (!b) return a;
+    size_t len_a = strlen(a);
+    size_t len_b = strlen(b);
+    if (!string_is_unique(a) || (b >= a && b <= a + len_a)) {
+        string result = string_concat(a, (string)b);
+        if (!result) return a;
+        rc_release(a);
+        return result;
+    }
+    RCHeader *header = realloc(RC_GET_HEADER(a), RC_HEADER_SIZE + len_a + len_b + 1);
+    if (!header) return a;
+    header->flags &= ~RC_FLAG_DERIVED;
+    char *result = (char *)header + RC_HEADER_SIZE;
+    memcpy(result + len_a, b, len_b + 1);
+    return result;
+}
+
+void string_make_unique(string *s) {
+    if (!s || !*s || string_is_unique(*s)) return;
+    string copy = string_create(*s);
+    rc_release(*s);
+    *s = copy;
+}
+
+void string_set_char(string *s, size_t index, char ch) {
+    if (!s || !*s || index >= strlen(*s)) return;
+    string_make_unique(s);
+    string_invalidate(*s);
+    if (*s) (*s)[index] = ch;
+}
+
+void string_truncate(string *s, size_t len) {
+    if (!s || !*s || len >= strlen(*s)) return;
+    string_make_unique(s);
+    string_invalidate(*s);
+    if (*s) (*s)[len] = '\0';
+}
+
+void string_to_upper(string *s) {
+    if (!s || !*s) return;
+    string_make_unique(s);
+    string_invalidate(*s);
+    for (char *p = *s; p && *p; p++) *p = toupper((unsigned char)*p);
+}
+
+void string_to_lower(string *s) {
+    if (!s || !*s) return;
+    string_make_unique(s);
+    string_invalidate(*s);
+    for (char *p = *s; p && *p; p++) *p = tolower((unsigned char)*p);
+}
+
+// ========== SIMD STRING KERNELS ==========
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__TINYC__)
+#define SAM_SIMD_X86 1
+#endif
+
+// utf8_validate results
+#define SIMD_UTF8_INVALID 0
+#define SIMD_UTF8_VALID 1
+#define SIMD_UTF8_ASCII 2 // Valid and every byte below 0x80
+
+// One implementation per instruction set; simd_kernels() picks the widest one
+// the CPU supports the first time it is called and keeps it for the process.
+typedef struct {
+    const char *name;
+    const char *(*find_char)(const char *hay, size_t len, int ch);
+    const char *(*find)(const char *hay, size_t hay_len, const char *needle, size_t needle_len);
+    int (*eq)(const void *a, const void *b, size_t len);
+    int (*cmp)(const void *a, const void *b, size_t len);
+    size_t (*count_char)(const char *hay, size_t len, int ch);
+    uint64_t (*hash)(const void *data, size_t len);
+    int (*utf8_validate)(const char *s, size_t len);
+    size_t (*utf8_count)(const char *s, size_t len); // Code points in valid UTF-8
+} SimdKernels;
+
+const SimdKernels *simd_kernels(void);
+
+// Individual tables, exposed so benchmarks can compare them side by side.
+// Entries are NULL when the instruction set is unavailable on this CPU/build.
+extern const SimdKernels simd_scalar;
+const SimdKernels       *simd_sse2(void);
+const SimdKernels       *simd_avx2(void);
+const SimdKernels       *simd_avx512(void);
+
+#ifdef SAM_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// =========================== [ HASH CORE ] =========================================
+// Every implementation folds 64-byte blocks into eight 64-bit lanes the same
+// way, so the hash value does not depend on which kernel was selected.
+
+#define HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+
+static const uint64_t hash_secret[8] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+    0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+};
+
+typedef void (*HashAccumulate)(uint64_t acc[8], const unsigned char *data, size_t blocks);
+
+static uint64_t load64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t hash_avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t hash_with(const void *data, size_t len, HashAccumulate accumulate) {
+    const unsigned char *p = data;
+    uint64_t             h = len * HASH_PRIME1;
+    size_t               blocks = len / 64;
+
+    if (blocks) {
+        uint64_t acc[8];
+        memcpy(acc, hash_secret, sizeof(acc));
+        accumulate(acc, p, blocks);
+        for (int i = 0; i < 8; i++)
+            h = (h ^ hash_avalanche(acc[i])) * HASH_PRIME2;
+        p += blocks * 64;
+        len -= blocks * 64;
+    }
+
+    for (; len >= 8; p += 8, len -= 8) {
+        h ^= hash_avalanche(load64(p) * HASH_PRIME2);
+        h = ((h << 27) | (h >> 37)) * HASH_PRIME1;
+    }
+    if (len) {
+        uint64_t tail = 0;
+        memcpy(&tail, p, len);
+        h ^= hash_avalanche((tail ^ len) * HASH_PRIME1);
+    }
+    return hash_avalanche(h);
+}
+
+// =========================== [ SCALAR ] =========================================
+
+static const char *scalar_find_char(const char *hay, size_t len, int ch) {
+    return memchr(hay, ch, len);
+}
+
+static const char *scalar_find(const char *hay, size_t hay_len, const char *needle,
+                               size_t needle_len) {
+    if (needle_len == 0) return hay;
+    if (needle_len > hay_len) return NULL;
+
+    const char *end = hay + hay_len - needle_len;
+    for (const char *p = hay; p <= end; p++) {
+        p = memchr(p, needle[0], end - p + 1);
+        if (!p) return NULL;
+        if (memcmp(p + 1, needle + 1, needle_len - 1) == 0) return p;
+    }
+    return NULL;
+}
+
+static int scalar_eq(const void *a, const void *b, size_t len) { return memcmp(a, b, len) == 0; }
+
+static int scalar_cmp(const void *a, const void *b, size_t len) { return memcmp(a, b, len); }
+
+static size_t scalar_count_char(const char *hay, size_t len, int ch) {
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++)
+        count += (unsigned char)hay[i] == (unsigned char)ch;
+    return count;
+}
+
+static void scalar_accumulate(uint64_t acc[8], const unsigned char *data, size_t blocks) {
+    for (size_t b = 0; b < blocks; b++, data += 64) {
+        for (int i = 0; i < 8; i++) {
+            uint64_t d = load64(data + 8 * i);
+            uint64_t k = d ^ hash_secret[i];
+            acc[i] += (k & 0xffffffffULL) * (k >> 32) + d;
+        }
+    }
+}
+
+static uint64_t scalar_hash(const void *data, size_t len) {
+    return hash_with(data, len, scalar_accumulate);
+}
+
+static int scalar_utf8_validate(const char *s, size_t len) {
+    const unsigned char *p = (const unsigned char *)s;
+    const unsigned char *end = p + len;
+    int                  ascii = 1;
+
+    while (p < end) {
+        if (end - p >= 8 && !(load64(p) & 0x8080808080808080ULL)) {
+            p += 8;
+            continue;
+        }
+        if (*p < 0x80) {
+            p++;
+            continue;
+        }
+        ascii = 0;
+
+        size_t   extra;
+        uint32_t cp, min;
+        if (*p >= 0xC2 && *p <= 0xDF) {
+            extra = 1, cp = *p & 0x1F, min = 0x80;
+        } else if ((*p & 0xF0) == 0xE0) {
+            extra = 2, cp = *p & 0x0F, min = 0x800;
+        } else if (*p >= 0xF0 && *p <= 0xF4) {
+            extra = 3, cp = *p & 0x07, min = 0x10000;
+        } else {
+            return SIMD_UTF8_INVALID;
+        }
+        if ((size_t)(end - p) <= extra) return SIMD_UTF8_INVALID;
+
+        for (size_t i = 1; i <= extra; i++) {
+            if ((p[i] & 0xC0) != 0x80) return SIMD_UTF8_INVALID;
+            cp = (cp << 6) | (p[i] & 0x3F);
+        }
+        if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return SIMD_UTF8_INVALID;
+        p += extra + 1;
+    }
+    return ascii ? SIMD_UTF8_ASCII : SIMD_UTF8_VALID;
+}
+
+// Every byte that is not a continuation byte (10xxxxxx) starts a code point
+static size_t scalar_utf8_count(const char *s, size_t len) {
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++)
+        count += ((unsigned char)s[i] & 0xC0) != 0x80;
+    return count;
+}
+
+const SimdKernels simd_scalar = {
+    "scalar",    scalar_find_char,  scalar_find, scalar_eq,
+    scalar_cmp,  scalar_count_char, scalar_hash, scalar_utf8_validate,
+    scalar_utf8_count,
+};
+
+#ifdef SAM_SIMD_X86
+
+// =========================== [ SSE2 ] =========================================
+
+#define SSE2 __attribute__((target("sse2")))
+
+SSE2 static const char *sse2_find_char(const char *hay, size_t len, int ch) {
+    __m128i needle = _mm_set1_epi8((char)ch);
+    size_t  i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i  block = _mm_loadu_si128((const __m128i *)(hay + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask) return hay + i + __builtin_ctz(mask);
+    }
+    return scalar_find_char(hay + i, len - i, ch);
+}
+
+// First/last byte filter: compare the needle's first byte at i and its last
+// byte at i + n - 1 for 16 positions at once, then verify the candidates
+SSE2 static const char *sse2_find(const char *hay, size_t hay_len, const char *needle,
+                                  size_t needle_len) {
+    if (needle_len <= 1) {
+        return needle_len ? sse2_find_char(hay, hay_len, needle[0]) : hay;
+    }
+    if (needle_len > hay_len) return NULL;
+
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+    size_t  i = 0;
+    for (; i + needle_len - 1 + 16 <= hay_len; i += 16) {
+        __m128i  block_first = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i  block_last = _mm_loadu_si128((const __m128i *)(hay + i + needle_len - 1));
+        unsigned mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+        while (mask) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, needle_len - 2) == 0) return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return scalar_find(hay + i, hay_len - i, needle, needle_len);
+}
+
+SSE2 static int sse2_cmp(const void *a, const void *b, size_t len) {
+    const unsigned char *pa = a, *pb = b;
+    size_t               i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i  va = _mm_loadu_si128((const __m128i *)(pa + i));
+        __m128i  vb = _mm_loadu_si128((const __m128i *)(pb + i));
+        unsigned diff = ~_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xffffu;
+        if (diff) {
+            unsigned bit = __builtin_ctz(diff);
+            return (int)pa[i + bit] - (int)pb[i + bit];
+        }
+    }
+    return memcmp(pa + i, pb + i, len - i);
+}
+
+SSE2 static int sse2_eq(const void *a, const void *b, size_t len) {
+    const unsigned char *pa = a, *pb = b;
+    size_t               i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(pa + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(pb + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xffff) return 0;
+    }
+    return memcmp(pa + i, pb + i, len - i) == 0;
+}
+
+// Matches are subtracted into byte counters (cmpeq yields -1) and folded with
+// psadbw before any counter can wrap
+SSE2 static size_t sse2_count_char(const char *hay, size_t len, int ch) {
+    __m128i needle = _mm_set1_epi8((char)ch);
+    __m128i zero = _mm_setzero_si128();
+    size_t  count = 0, i = 0;
+    while (i + 16 <= len) {
+        __m128i counters = zero;
+        for (int round = 0; round < 255 && i + 16 <= len; round++, i += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *)(hay + i));
+            counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(block, needle));
+        }
+        __m128i sums = _mm_sad_epu8(counters, zero);
+        count += _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+    }
+    return count + scalar_count_char(hay + i, len - i, ch);
+}
+
+SSE2 static void sse2_accumulate(uint64_t acc[8], const unsigned char *data, size_t blocks) {
+    __m128i lanes[4], secret[4];
+    for (int j = 0; j < 4; j++) {
+        lanes[j] = _mm_loadu_si128((const __m128i *)(acc + 2 * j));
+        secret[j] = _mm_loadu_si128((const __m128i *)(hash_secret + 2 * j));
+    }
+    for (size_t b = 0; b < blocks; b++, data += 64) {
+        for (int j = 0; j < 4; j++) {
+            __m128i d = _mm_loadu_si128((const __m128i *)(data + 16 * j));
+            __m128i k = _mm_xor_si128(d, secret[j]);
+            __m128i product = _mm_mul_epu32(k, _mm_srli_epi64(k, 32));
+            lanes[j] = _mm_add_epi64(lanes[j], _mm_add_epi64(product, d));
+        }
+    }
+    for (int j = 0; j < 4; j++)
+        _mm_storeu_si128((__m128i *)(acc + 2 * j), lanes[j]);
+}
+
+SSE2 static uint64_t sse2_hash(const void *data, size_t len) {
+    return hash_with(data, len, sse2_accumulate);
+}
+
+SSE2 static size_t sse2_utf8_count(const char *s, size_t len) {
+    __m128i limit = _mm_set1_epi8(-65); // (int8_t)0xBF, the largest continuation byte
+    __m128i zero = _mm_setzero_si128();
+    size_t  count = 0, i = 0;
+    while (i + 16 <= len) {
+        __m128i counters = zero;
+        for (int round = 0; round < 255 && i + 16 <= len; round++, i += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *)(s + i));
+            counters = _mm_sub_epi8(counters, _mm_cmpgt_epi8(block, limit));
+        }
+        __m128i sums = _mm_sad_epu8(counters, zero);
+        count += _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+    }
+    return count + scalar_utf8_count(s + i, len - i);
+}
+
+static const SimdKernels sse2_kernels = {
+    "sse2",         sse2_find_char,       sse2_find, sse2_eq, sse2_cmp, sse2_count_char,
+    sse2_hash,      scalar_utf8_validate, sse2_utf8_count,
+};
+
+// =========================== [ UTF-8 LOOKUP TABLES ] ================================
+// Keiser & Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte".
+// Three 16-entry nibble lookups classify every (previous byte, byte) pair;
+// their AND is non-zero exactly where the pair is an error, except for the
+// 3rd/4th continuation bytes, which are checked against prev2/prev3.
+
+#define UTF8_TOO_SHORT (1 << 0)
+#define UTF8_TOO_LONG (1 << 1)
+#define UTF8_OVERLONG_3 (1 << 2)
+#define UTF8_TOO_LARGE (1 << 3)
+#define UTF8_SURROGATE (1 << 4)
+#define UTF8_OVERLONG_2 (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4 (1 << 6)
+#define UTF8_TWO_CONTS (1 << 7)
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+static const unsigned char utf8_byte_1_high[16] = {
+    UTF8_TOO_LONG,  UTF8_TOO_LONG,  UTF8_TOO_LONG,  UTF8_TOO_LONG,
+    UTF8_TOO_LONG,  UTF8_TOO_LONG,  UTF8_TOO_LONG,  UTF8_TOO_LONG,
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+};
+
+static const unsigned char utf8_byte_1_low[16] = {
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+    UTF8_CARRY | UTF8_OVERLONG_2,
+    UTF8_CARRY,
+    UTF8_CARRY,
+    UTF8_CARRY | UTF8_TOO_LARGE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+};
+
+static const unsigned char utf8_byte_2_high[16] = {
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 |
+        UTF8_OVERLONG_4,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+};
+
+// A block ending in the first bytes of a multi-byte sequence must be continued
+static const unsigned char utf8_incomplete_max[32] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  255,  255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  255,  255,
+    255, 255, 255, 0xEF, 0xDF, 0xBF,
+};
+
+// =========================== [ SSSE3 ] =========================================
+
+#define SSSE3 __attribute__((target("ssse3")))
+
+typedef struct {
+    __m128i byte_1_high, byte_1_low, byte_2_high, incomplete_max;
+} Utf8Tables128;
+
+SSSE3 static __m128i ssse3_utf8_errors(const Utf8Tables128 *t, __m128i input, __m128i prev_input) {
+    __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+    __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+    __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+
+    __m128i special = _mm_and_si128(
+        _mm_and_si128(
+            _mm_shuffle_epi8(t->byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+            _mm_shuffle_epi8(t->byte_1_low, _mm_and_si128(prev1, nibble))),
+        _mm_shuffle_epi8(t->byte_2_high, _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+
+    __m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80)));
+    __m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80)));
+    __m128i must_be_cont = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));
+    return _mm_xor_si128(must_be_cont, special);
+}
+
+SSSE3 static int ssse3_utf8_validate(const char *s, size_t len) {
+    Utf8Tables128 t = {
+        _mm_loadu_si128((const __m128i *)utf8_byte_1_high),
+        _mm_loadu_si128((const __m128i *)utf8_byte_1_low),
+        _mm_loadu_si128((const __m128i *)utf8_byte_2_high),
+        _mm_loadu_si128((const __m128i *)(utf8_incomplete_max + 16)),
+    };
+    __m128i zero = _mm_setzero_si128();
+    __m128i error = zero, prev_input = zero, prev_incomplete = zero, high_bits = zero;
+
+    for (size_t i = 0; i < len; i += 16) {
+        __m128i input;
+        if (i + 16 <= len) {
+            input = _mm_loadu_si128((const __m128i *)(s + i));
+        } else {
+            char tail[16] = {0};
+            memcpy(tail, s + i, len - i);
+            input = _mm_loadu_si128((const __m128i *)tail);
+        }
+
+        if (_mm_movemask_epi8(input) == 0) {
+            error = _mm_or_si128(error, prev_incomplete);
+            prev_incomplete = zero;
+        } else {
+            high_bits = _mm_or_si128(high_bits, input);
+            error = _mm_or_si128(error, ssse3_utf8_errors(&t, input, prev_input));
+            prev_incomplete = _mm_subs_epu8(input, t.incomplete_max);
+        }
+        prev_input = input;
+    }
+
+    error = _mm_or_si128(error, prev_incomplete);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, zero)) != 0xffff) return SIMD_UTF8_INVALID;
+    return _mm_movemask_epi8(high_bits) ? SIMD_UTF8_VALID : SIMD_UTF8_ASCII;
+}
+
+static const SimdKernels ssse3_kernels = {
+    "ssse3",        sse2_find_char,      sse2_find, sse2_eq, sse2_cmp, sse2_count_char,
+    sse2_hash,      ssse3_utf8_validate, sse2_utf8_count,
+};
+
+// =========================== [ AVX2 ] =========================================
+
+#define AVX2 __attribute__((target("avx2")))
+
+// Tails are handed to the narrower kernels. GCC does not clear the upper
+// register halves before such calls, and legacy SSE code running with dirty
+// upper state stalls, so each hand-off is preceded by vzeroupper.
+
+AVX2 static const char *avx2_find_char(const char *hay, size_t len, int ch) {
+    __m256i needle = _mm256_set1_epi8((char)ch);
+    size_t  i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i  block = _mm256_loadu_si256((const __m256i *)(hay + i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+        if (mask) return hay + i + __builtin_ctz(mask);
+    }
+    _mm256_zeroupper();
+    return sse2_find_char(hay + i, len - i, ch);
+}
+
+AVX2 static const char *avx2_find(const char *hay, size_t hay_len, const char *needle,
+                                  size_t needle_len) {
+    if (needle_len <= 1) {
+        return needle_len ? avx2_find_char(hay, hay_len, needle[0]) : hay;
+    }
+    if (needle_len > hay_len) return NULL;
+
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+    size_t  i = 0;
+    for (; i + needle_len - 1 + 32 <= hay_len; i += 32) {
+        __m256i  block_first = _mm256_loadu_si256((const __m256i *)(hay + i));
+        __m256i  block_last = _mm256_loadu_si256((const __m256i *)(hay + i + needle_len - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)));
+        while (mask) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, needle_len - 2) == 0) return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    _mm256_zeroupper();
+    return sse2_find(hay + i, hay_len - i, needle, needle_len);
+}
+
+AVX2 static int avx2_cmp(const void *a, const void *b, size_t len) {
+    const unsigned char *pa = a, *pb = b;
+    size_t               i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i  va = _mm256_loadu_si256((const __m256i *)(pa + i));
+        __m256i  vb = _mm256_loadu_si256((const __m256i *)(pb + i));
+        unsigned diff = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        if (diff) {
+            unsigned bit = __builtin_ctz(diff);
+            return (int)pa[i + bit] - (int)pb[i + bit];
+        }
+    }
+    _mm256_zeroupper();
+    return sse2_cmp(pa + i, pb + i, len - i);
+}
+
+AVX2 static int avx2_eq(const void *a, const void *b, size_t len) {
+    const unsigned char *pa = a, *pb = b;
+    size_t               i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(pa + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(pb + i));
+        if ((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)) != 0xffffffffu) return 0;
+    }
+    _mm256_zeroupper();
+    return sse2_eq(pa + i, pb + i, len - i);
+}
+
+AVX2 static size_t avx2_count_char(const char *hay, size_t len, int ch) {
+    __m256i needle = _mm256_set1_epi8((char)ch);
+    __m256i zero = _mm256_setzero_si256();
+    size_t  count = 0, i = 0;
+    while (i + 32 <= len) {
+        __m256i counters = zero;
+        for (int round = 0; round < 255 && i + 32 <= len; round++, i += 32) {
+            __m256i block = _mm256_loadu_si256((const __m256i *)(hay + i));
+            counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(block, needle));
+        }
+        __m256i sums = _mm256_sad_epu8(counters, zero);
+        count += (size_t)_mm256_extract_epi64(sums, 0) + (size_t)_mm256_extract_epi64(sums, 1) +
+                 (size_t)_mm256_extract_epi64(sums, 2) + (size_t)_mm256_extract_epi64(sums, 3);
+    }
+    _mm256_zeroupper();
+    return count + sse2_count_char(hay + i, len - i, ch);
+}
+
+AVX2 static void avx2_accumulate(uint64_t acc[8], const unsigned char *data, size_t blocks) {
+    __m256i lanes[2], secret[2];
+    for (int j = 0; j < 2; j++) {
+        lanes[j] = _mm256_loadu_si256((const __m256i *)(acc + 4 * j));
+        secret[j] = _mm256_loadu_si256((const __m256i *)(hash_secret + 4 * j));
+    }
+    for (size_t b = 0; b < blocks; b++, data += 64) {
+        for (int j = 0; j < 2; j++) {
+            __m256i d = _mm256_loadu_si256((const __m256i *)(data + 32 * j));
+            __m256i k = _mm256_xor_si256(d, secret[j]);
+            __m256i product = _mm256_mul_epu32(k, _mm256_srli_epi64(k, 32));
+            lanes[j] = _mm256_add_epi64(lanes[j], _mm256_add_epi64(product, d));
+        }
+    }
+    for (int j = 0; j < 2; j++)
+        _mm256_storeu_si256((__m256i *)(acc + 4 * j), lanes[j]);
+}
+
+AVX2 static uint64_t avx2_hash(const void *data, size_t len) {
+    return hash_with(data, len, avx2_accumulate);
+}
+
+typedef struct {
+    __m256i byte_1_high, byte_1_low, byte_2_high, incomplete_max;
+} Utf8Tables256;
+
+AVX2 static __m256i avx2_prev(__m256i input, __m256i prev_input, int n) {
+    __m256i carried = _mm256_permute2x128_si256(prev_input, input, 0x21);
+    switch (n) {
+    case 1: return _mm256_alignr_epi8(input, carried, 15);
+    case 2: return _mm256_alignr_epi8(input, carried, 14);
+    default: return _mm256_alignr_epi8(input, carried, 13);
+    }
+}
+
+AVX2 static __m256i avx2_utf8_errors(const Utf8Tables256 *t, __m256i input, __m256i prev_input) {
+    __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i prev1 = avx2_prev(input, prev_input, 1);
+    __m256i prev2 = avx2_prev(input, prev_input, 2);
+    __m256i prev3 = avx2_prev(input, prev_input, 3);
+
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(
+            _mm256_shuffle_epi8(t->byte_1_high,
+                                _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+            _mm256_shuffle_epi8(t->byte_1_low, _mm256_and_si256(prev1, nibble))),
+        _mm256_shuffle_epi8(t->byte_2_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+
+    __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i must_be_cont =
+        _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(must_be_cont, special);
+}
+
+AVX2 static int avx2_utf8_validate(const char *s, size_t len) {
+    Utf8Tables256 t = {
+        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)utf8_byte_1_high)),
+        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)utf8_byte_1_low)),
+        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)utf8_byte_2_high)),
+        _mm256_loadu_si256((const __m256i *)utf8_incomplete_max),
+    };
+    __m256i zero = _mm256_setzero_si256();
+    __m256i error = zero, prev_input = zero, prev_incomplete = zero, high_bits = zero;
+
+    for (size_t i = 0; i < len; i += 32) {
+        __m256i input;
+        if (i + 32 <= len) {
+            input = _mm256_loadu_si256((const __m256i *)(s + i));
+        } else {
+            char tail[32] = {0};
+            memcpy(tail, s + i, len - i);
+            input = _mm256_loadu_si256((const __m256i *)tail);
+        }
+
+        if (_mm256_movemask_epi8(input) == 0) {
+            error = _mm256_or_si256(error, prev_incomplete);
+            prev_incomplete = zero;
+        } else {
+            high_bits = _mm256_or_si256(high_bits, input);
+            error = _mm256_or_si256(error, avx2_utf8_errors(&t, input, prev_input));
+            prev_incomplete = _mm256_subs_epu8(input, t.incomplete_max);
+        }
+        prev_input = input;
+    }
+
+    error = _mm256_or_si256(error, prev_incomplete);
+    if (!_mm256_testz_si256(error, error)) return SIMD_UTF8_INVALID;
+    return _mm256_movemask_epi8(high_bits) ? SIMD_UTF8_VALID : SIMD_UTF8_ASCII;
+}
+
+AVX2 static size_t avx2_utf8_count(const char *s, size_t len) {
+    __m256i limit = _mm256_set1_epi8(-65);
+    __m256i zero = _mm256_setzero_si256();
+    size_t  count = 0, i = 0;
+    while (i + 32 <= len) {
+        __m256i counters = zero;
+        for (int round = 0; round < 255 && i + 32 <= len; round++, i += 32) {
+            __m256i block = _mm256_loadu_si256((const __m256i *)(s + i));
+            counters = _mm256_sub_epi8(counters, _mm256_cmpgt_epi8(block, limit));
+        }
+        __m256i sums = _mm256_sad_epu8(counters, zero);
+        count += (size_t)_mm256_extract_epi64(sums, 0) + (size_t)_mm256_extract_epi64(sums, 1) +
+                 (size_t)_mm256_extract_epi64(sums, 2) + (size_t)_mm256_extract_epi64(sums, 3);
+    }
+    _mm256_zeroupper();
+    return count + sse2_utf8_count(s + i, len - i);
+}
+
+static const SimdKernels avx2_kernels = {
+    "avx2",         avx2_find_char,     avx2_find, avx2_eq, avx2_cmp, avx2_count_char,
+    avx2_hash,      avx2_utf8_validate, avx2_utf8_count,
+};
+
+// =========================== [ AVX-512 ] =========================================
+
+#define AVX512 __attribute__((target("avx512f,avx512bw")))
+
+AVX512 static const char *avx512_find_char(const char *hay, size_t len, int ch) {
+    __m512i needle = _mm512_set1_epi8((char)ch);
+    size_t  i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i   block = _mm512_loadu_si512((const void *)(hay + i));
+        __mmask64 mask = _mm512_cmpeq_epi8_mask(block, needle);
+        if (mask) return hay + i + __builtin_ctzll(mask);
+    }
+    _mm256_zeroupper();
+    return avx2_find_char(hay + i, len - i, ch);
+}
+
+AVX512 static const char *avx512_find(const char *hay, size_t hay_len, const char *needle,
+                                      size_t needle_len) {
+    if (needle_len <= 1) {
+        return needle_len ? avx512_find_char(hay, hay_len, needle[0]) : hay;
+    }
+    if (needle_len > hay_len) return NULL;
+
+    __m512i first = _mm512_set1_epi8(needle[0]);
+    __m512i last = _mm512_set1_epi8(needle[needle_len - 1]);
+    size_t  i = 0;
+    for (; i + needle_len - 1 + 64 <= hay_len; i += 64) {
+        __m512i   block_first = _mm512_loadu_si512((const void *)(hay + i));
+        __m512i   block_last = _mm512_loadu_si512((const void *)(hay + i + needle_len - 1));
+        __mmask64 mask = _mm512_cmpeq_epi8_mask(block_first, first) &
+                         _mm512_cmpeq_epi8_mask(block_last, last);
+        while (mask) {
+            unsigned bit = __builtin_ctzll(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, needle_len - 2) == 0) return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    _mm256_zeroupper();
+    return avx2_find(hay + i, hay_len - i, needle, needle_len);
+}
+
+AVX512 static int avx512_cmp(const void *a, const void *b, size_t len) {
+    const unsigned char *pa = a, *pb = b;
+    size_t               i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i   va = _mm512_loadu_si512((const void *)(pa + i));
+        __m512i   vb = _mm512_loadu_si512((const void *)(pb + i));
+        __mmask64 diff = _mm512_cmpneq_epi8_mask(va, vb);
+        if (diff) {
+            unsigned bit = __builtin_ctzll(diff);
+            return (int)pa[i + bit] - (int)pb[i + bit];
+        }
+    }
+    _mm256_zeroupper();
+    return avx2_cmp(pa + i, pb + i, len - i);
+}
+
+AVX512 static int avx512_eq(const void *a, const void *b, size_t len) {
+    const unsigned char *pa = a, *pb = b;
+    size_t               i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i va = _mm512_loadu_si512((const void *)(pa + i));
+        __m512i vb = _mm512_loadu_si512((const void *)(pb + i));
+        if (_mm512_cmpneq_epi8_mask(va, vb)) return 0;
+    }
+    _mm256_zeroupper();
+    return avx2_eq(pa + i, pb + i, len - i);
+}
+
+AVX512 static size_t avx512_count_char(const char *hay, size_t len, int ch) {
+    __m512i needle = _mm512_set1_epi8((char)ch);
+    size_t  count = 0, i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i block = _mm512_loadu_si512((const void *)(hay + i));
+        count += __builtin_popcountll(_mm512_cmpeq_epi8_mask(block, needle));
+    }
+    _mm256_zeroupper();
+    return count + avx2_count_char(hay + i, len - i, ch);
+}
+
+AVX512 static void avx512_accumulate(uint64_t acc[8], const unsigned char *data, size_t blocks) {
+    __m512i lanes = _mm512_loadu_si512((const void *)acc);
+    __m512i secret = _mm512_loadu_si512((const void *)hash_secret);
+    for (size_t b = 0; b < blocks; b++, data += 64) {
+        __m512i d = _mm512_loadu_si512((const void *)data);
+        __m512i k = _mm512_xor_si512(d, secret);
+        __m512i product = _mm512_mul_epu32(k, _mm512_srli_epi64(k, 32));
+        lanes = _mm512_add_epi64(lanes, _mm512_add_epi64(product, d));
+    }
+    _mm512_storeu_si512((void *)acc, lanes);
+}
+
+AVX512 static uint64_t avx512_hash(const void *data, size_t len) {
+    return hash_with(data, len, avx512_accumulate);
+}
+
+AVX512 static size_t avx512_utf8_count(const char *s, size_t len) {
+    __m512i limit = _mm512_set1_epi8(-65);
+    size_t  count = 0, i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i block = _mm512_loadu_si512((const void *)(s + i));
+        count += __builtin_popcountll(_mm512_cmpgt_epi8_mask(block, limit));
+    }
+    return count + avx2_utf8_count(s + i, len - i);
+}
+
+// Validation stays on the AVX2 lookup kernel: pshufb is per 128-bit lane on
+// every width, so 512-bit registers only add cross-lane shuffling
+static const SimdKernels avx512_kernels = {
+    "avx512",    avx512_find_char,  avx512_find, avx512_eq,          avx512_cmp,
+    avx512_count_char, avx512_hash, avx2_utf8_validate, avx512_utf8_count,
+};
+
+const SimdKernels *simd_sse2(void) {
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("sse2")) return NULL;
+    return __builtin_cpu_supports("ssse3") ? &ssse3_kernels : &sse2_kernels;
+}
+
+const SimdKernels *simd_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? &avx2_kernels : NULL;
+}
+
+const SimdKernels *simd_avx512(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+               ? &avx512_kernels
+               : NULL;
+}
+
+#else
+
+const SimdKernels *simd_sse2(void) { return NULL; }
+const SimdKernels *simd_avx2(void) { return NULL; }
+const SimdKernels *simd_avx512(void) { return NULL; }
+
+#endif // SAM_SIMD_X86
+
+// =========================== [ DISPATCH ] =========================================
+
+static const SimdKernels *selected_kernels;
+
+const SimdKernels *simd_kernels(void) {
+    const SimdKernels *kernels = selected_kernels;
+    if (kernels) return kernels;
+
+    kernels = simd_avx512();
+    if (!kernels) kernels = simd_avx2();
+    if (!kernels) kernels = simd_sse2();
+    if (!kernels) kernels = &simd_scalar;
+    selected_kernels = kernels;
+    return kernels;
+}
+
+#ifdef __GNUC__
+// Resolve at startup so the first string call does not pay for cpuid
+__attribute__((constructor)) static void simd_select_at_startup(void) { simd_kernels(); }
+#endif
+
+// ========== STRING VIEWS ==========
+typedef struct {
+    const char *ptr;
+    size_t len;
+    string parent;
+} strview;
+
+#define SV_ARG(v) (int)(v).len, (v).ptr
+#define strview_retain(v) rc_retain((v).parent)
+#define strview_release(v) rc_release((v).parent)
+
+strview strview_from(const char *s) {
+    strview v = {s, s ? strlen(s) : 0, NULL};
+    return v;
+}
+
+strview string_view(string s) {
+    strview v = {s, s ? strlen(s) : 0, s};
+    return v;
+}
+
+strview strview_slice(strview v, size_t start, size_t len) {
+    if (start > v.len) start = v.len;
+    if (len > v.len - start) len = v.len - start;
+    strview result = {v.ptr + start, len, v.parent};
+    return result;
+}
+
+strview string_slice(string s, size_t start, size_t len) {
+    return strview_slice(string_view(s), start, len);
+}
+
+strview strview_find(strview v, const char *needle) {
+    strview none = {NULL, 0, v.parent};
+    if (!v.ptr || !needle) return none;
+    size_t needle_len = strlen(needle);
+    const char *hit = simd_kernels()->find(v.ptr, v.len, needle, needle_len);
+    if (!hit) return none;
+    strview match = {hit, needle_len, v.parent};
+    return match;
+}
+
+strview string_find(string s, const char *needle) { return strview_find(string_view(s), needle); }
+
+strview strview_trim(strview v) {
+    while (v.len > 0 && isspace((unsigned char)v.ptr[0])) { v.ptr++; v.len--; }
+    while (v.len > 0 && isspace((unsigned char)v.ptr[v.len - 1])) v.len--;
+    return v;
+}
+
+strview string_trim(string s) { return strview_trim(string_view(s)); }
+
+// *field holds a reference like any strview variable: the new parent is
+// retained and the one it held before released
+int strview_split_next(strview *rest, char sep, strview *field) {
+    if (!rest->ptr) return 0;
+    const char *hit = memchr(rest->ptr, sep, rest->len);
+    size_t field_len = hit ? (size_t)(hit - rest->ptr) : rest->len;
+    strview taken = {rest->ptr, field_len, rest->parent};
+    strview_retain(taken);
+    strview_release(*field);
+    *field = taken;
+    if (hit) {
+        rest->ptr = hit + 1;
+        rest->len -= field_len + 1;
+    } else {
+        rest->ptr = NULL;
+        rest->len = 0;
+    }
+    return 1;
+}
+
+size_t string_split(string s, char sep, strview *out, size_t max) {
+    strview rest = string_view(s);
+    strview field = {0};
+    size_t count = 0;
+    while (count < max && strview_split_next(&rest, sep, &field)) out[count++] = field;
+    strview_release(field);
+    return count;
+}
+
+int strview_eq(strview v, const char *s) {
+    size_t len = s ? strlen(s) : 0;
+    return v.len == len && (len == 0 || simd_kernels()->eq(v.ptr, s, len));
+}
+
+string strview_to_string(strview v) {
+    char *result = rc_alloc(v.len + 1);
+    if (result && v.len) memcpy(result, v.ptr, v.len);
+    return result;
+}
+
+strview string_find_char(string s, char ch) {
+    strview none = {NULL, 0, s};
+    const char *hit = s ? simd_kernels()->find_char(s, strlen(s), ch) : NULL;
+    if (!hit) return none;
+    strview match = {hit, 1, s};
+    return match;
+}
+
+int string_eq(string a, string b) {
+    if (a == b) return 1;
+    if (!a || !b) return 0;
+    if (RC_GET_HEADER(a)->flags & RC_GET_HEADER(b)->flags & RC_FLAG_INTERNED) return 0;
+    size_t len = strlen(a);
+    return len == strlen(b) && simd_kernels()->eq(a, b, len);
+}
+
+int string_cmp(string a, string b) {
+    if (a == b) return 0;
+    if (!a || !b) return a ? 1 : -1;
+    size_t len_a = strlen(a);
+    size_t len_b = strlen(b);
+    return simd_kernels()->cmp(a, b, (len_a < len_b ? len_a : len_b) + 1);
+}
+
+size_t string_count(string s, const char *needle) {
+    if (!s || !needle || !needle[0]) return 0;
+    const SimdKernels *kernels = simd_kernels();
+    size_t len = strlen(s);
+    size_t needle_len = strlen(needle);
+    if (needle_len == 1) return kernels->count_char(s, len, needle[0]);
+    size_t count = 0;
+    const char *end = s + len;
+    for (const char *p = s; (p = kernels->find(p, end - p, needle, needle_len)); p += needle_len)
+        count++;
+    return count;
+}
+
+uint64_t string_hash(string s) { return s ? simd_kernels()->hash(s, strlen(s)) : 0; }
+
+uint32_t string_hash32_bytes(const char *s, size_t len) {
+    uint64_t hash = simd_kernels()->hash(s, len);
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+uint32_t string_hash32(string s) {
+    if (!s) return 0;
+    RCHeader *header = RC_GET_HEADER(s);
+    if (RC_LOAD(header->flags) & RC_FLAG_HASHED) return RC_LOAD(header->hash);
+    uint32_t hash = string_hash32_bytes(s, strlen(s));
+    RC_STORE(header->hash, hash);
+    RC_FLAGS_SET(header, RC_FLAG_HASHED);
+    return hash;
+}
+
+// ========== UTF-8 ==========
+static uint32_t utf8_flags(string s) {
+    RCHeader *header = RC_GET_HEADER(s);
+    if (!(RC_LOAD(header->flags) & RC_FLAG_UTF8_CHECKED)) {
+        int verdict = simd_kernels()->utf8_validate(s, strlen(s));
+        uint32_t flags = RC_FLAG_UTF8_CHECKED;
+        if (verdict != SIMD_UTF8_INVALID) flags |= RC_FLAG_UTF8_VALID;
+        if (verdict == SIMD_UTF8_ASCII) flags |= RC_FLAG_ASCII;
+        RC_FLAGS_SET(header, flags);
+    }
+    return RC_LOAD(header->flags);
+}
+
+int string_utf8_valid(string s) { return s && (utf8_flags(s) & RC_FLAG_UTF8_VALID); }
+
+size_t string_utf8_len(string s) {
+    if (!s) return 0;
+    if (utf8_flags(s) & RC_FLAG_ASCII) return strlen(s);
+    return simd_kernels()->utf8_count(s, strlen(s));
+}
+
+// Byte offset of the cps-th code point of p[0..len), or len if there are fewer
+static size_t utf8_advance(const char *p, size_t len, size_t cps) {
+    const SimdKernels *kernels = simd_kernels();
+    size_t             off = 0;
+
+    // Skip whole blocks with the counting kernel, then walk to the lead byte
+    while (len - off > 64) {
+        size_t leads = kernels->utf8_count(p + off, 64);
+        if (leads > cps) break;
+        cps -= leads;
+        off += 64;
+    }
+    for (; off < len; off++) {
+        if (((unsigned char)p[off] & 0xC0) == 0x80) continue;
+        if (cps-- == 0) return off;
+    }
+    return len;
+}
+
+size_t string_utf8_offset(string s, size_t cp_index) {
+    if (!s) return 0;
+    size_t len = strlen(s);
+    if (utf8_flags(s) & RC_FLAG_ASCII) return cp_index < len ? cp_index : len;
+    return utf8_advance(s, len, cp_index);
+}
+
+strview string_utf8_slice(string s, size_t cp_start, size_t cp_len) {
+    if (!s) return string_view(s);
+    size_t len = strlen(s);
+    if (utf8_flags(s) & RC_FLAG_ASCII) return string_slice(s, cp_start, cp_len);
+
+    size_t  start = utf8_advance(s, len, cp_start);
+    size_t  end = start + utf8_advance(s + start, len - start, cp_len);
+    strview slice = {s + start, end - start, s};
+    return slice;
+}
+
+// ========== STRING BUILDER ==========
+typedef struct {
+    char  *data;
+    size_t length;
+    size_t capacity;
+    Arena *arena;
+} StringBuilder;
+
+static StringBuilder builder_with_capacity(Arena *arena, size_t capacity) {
+    StringBuilder sb = {NULL, 0, 0, arena};
+    if (capacity < 64) capacity = 64;
+    if (arena) {
+        sb.data = arena_alloc(arena, capacity);
+    } else {
+        char *block = malloc(RC_HEADER_SIZE + capacity);
+        sb.data = block ? block + RC_HEADER_SIZE : NULL;
+    }
+    if (sb.data) { sb.data[0] = '\0'; sb.capacity = capacity; }
+    return sb;
+}
+
+static int builder_reserve(StringBuilder *sb, size_t extra) {
+    size_t needed = sb->length + extra + 1;
+    if (needed <= sb->capacity) return 1;
+    size_t new_capacity = sb->capacity ? sb->capacity : 64;
+    while (new_capacity < needed) new_capacity *= 2;
+    char *data;
+    if (sb->arena) {
+        data = arena_realloc(sb->arena, sb->data, sb->capacity, new_capacity);
+    } else {
+        char *block = realloc(sb->data ? sb->data - RC_HEADER_SIZE : NULL,
+                              RC_HEADER_SIZE + new_capacity);
+        data = block ? block + RC_HEADER_SIZE : NULL;
+    }
+    if (!data) return 0;
+    sb->data = data;
+    sb->capacity = new_capacity;
+    return 1;
+}
+
+StringBuilder string_builder_create(size_t hint) { return builder_with_capacity(NULL, hint); }
+StringBuilder string_builder_create_arena(Arena *arena, size_t hint) {
+    return builder_with_capacity(arena, hint);
+}
+
+void string_builder_append_n(StringBuilder *sb, const char *text, size_t len) {
+    if (!text || len == 0 || !builder_reserve(sb, len)) return;
+    memcpy(sb->data + sb->length, text, len);
+    sb->length += len;
+    sb->data[sb->length] = '\0';
+}
+
+void string_builder_append(StringBuilder *sb, const char *text) {
+    if (text) string_builder_append_n(sb, text, strlen(text));
+}
+
+void string_builder_append_char(StringBuilder *sb, char ch) {
+    if (!builder_reserve(sb, 1)) return;
+    sb->data[sb->length++] = ch;
+    sb->data[sb->length] = '\0';
+}
+
+StringBuilder string_builder_from(const char *initial) {
+    size_t len = initial ? strlen(initial) : 0;
+    StringBuilder sb = builder_with_capacity(NULL, len * 2);
+    string_builder_append_n(&sb, initial, len);
+    return sb;
+}
+
+StringBuilder string_builder_adopt(string s) {
+    if (!s || !string_is_unique(s)) {
+        StringBuilder sb = string_builder_from(s);
+        rc_release(s);
+        return sb;
+    }
+    size_t len = strlen(s);
+    StringBuilder sb = {s, len, len + 1, NULL};
+    return sb;
+}
+
+string string_builder_finish(StringBuilder *sb) {
+    if (!sb->data && !builder_reserve(sb, 0)) return NULL;
+    char *result = sb->data;
+    if (!sb->arena) rc_init_header(RC_GET_HEADER(result), 1);
+    sb->data = NULL;
+    sb->length = sb->capacity = 0;
+    return result;
+}
+
+void string_builder_free(StringBuilder *sb) {
+    if (sb->data && !sb->arena) free(sb->data - RC_HEADER_SIZE);
+    sb->data = NULL;
+    sb->length = sb->capacity = 0;
+}
+
+// ========== USER CODE STARTS HERE ==========
+void arenaTest() {
+    Arena *__arena1 = arena_create(1048576);
+    int   *my_array = arena_array(__arena1, int, 5);
+    int    temp_my_array[] = {1, 2, 3, 4, 5};
+    for (int i = 0; i < 5; i++) {
+        my_array[i] = temp_my_array[i];
+    }
+    for (int i = 0; i < 5; i++) {
+        printf("%d ", my_array[i]);
+    }
+    printf("\n");
+
+    arena_destroy(__arena1);  // Added HERE, not in main();
+}
+
+int main() {
+    Arena *__arena1 = arena_create(2048);  // Note: reset to __arena1 in this scope;
+    float *floats = arena_array(__arena1, float, 3);
+    float  temp_floats[] = {1.0, 2.0, 3.0};
+    for (int i = 0; i < 3; i++) {
+        floats[i] = temp_floats[i];
+    }
+
+    for (int i = 0; i < 3; i++) {
+        printf("%.1f ", floats[i]);
+    }
+    arenaTest();
+    printf("\n");
+
+    arena_destroy(__arena1);  // Only destroys main()'s arena;
+    return 0;
+}